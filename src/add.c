@@ -103,32 +103,35 @@ const char *fossil_all_reserved_names(void){
 }
 
 /*
-** Add a single file named zName to the VFILE table with vid.
-**
-** Omit any file whose name is pOmit.
+** Add a single file named zPath to the VFILE table.  pUndelete and
+** pInsert are the statements prepared by add_files_in_sfile() to mark
+** an existing entry as no longer deleted and to insert a new entry.
 */
 static int add_one_file(
   const char *zPath,   /* Tree-name of file to add. */
-  int vid,             /* Add to this VFILE */
-  int caseSensitive    /* True if filenames are case sensitive */
+  Stmt *pUndelete,     /* Clear the deleted flag on :path */
+  Stmt *pInsert        /* Insert :path into VFILE */
 ){
-  const char *zCollate = caseSensitive ? "binary" : "nocase";
+  int nChng;
   if( !file_is_simple_pathname(zPath) ){
     fossil_fatal("filename contains illegal characters: %s", zPath);
   }
-  if( db_exists("SELECT 1 FROM vfile"
-                " WHERE pathname=%Q COLLATE %s", zPath, zCollate) ){
-    db_multi_exec("UPDATE vfile SET deleted=0"
-                  " WHERE pathname=%Q COLLATE %s", zPath, zCollate);
-  }else{
+  db_bind_text(pUndelete, ":path", zPath);
+  db_step(pUndelete);
+  db_reset(pUndelete);
+  nChng = db_changes();
+  if( nChng==0 ){
     char *zFullname = mprintf("%s%s", g.zLocalRoot, zPath);
-    db_multi_exec(
-      "INSERT INTO vfile(vid,deleted,rid,mrid,pathname,isexe,islink)"
-      "VALUES(%d,0,0,0,%Q,%d,%d)",
-      vid, zPath, file_wd_isexe(zFullname), file_wd_islink(zFullname));
+    int perm = file_wd_perm(zFullname);
+    db_bind_text(pInsert, ":path", zPath);
+    db_bind_int(pInsert, ":isexe", perm==PERM_EXE);
+    db_bind_int(pInsert, ":islink", perm==PERM_LNK);
+    db_step(pInsert);
+    db_reset(pInsert);
+    nChng = db_changes();
     fossil_free(zFullname);
   }
-  if( db_changes() ){
+  if( nChng ){
     fossil_print("ADDED  %s\n", zPath);
     return 1;
   }else{
@@ -149,6 +152,8 @@ static int add_files_in_sfile(int vid, int caseSensitive){
   const char *zReserved;    /* Name of a reserved file */
   Blob repoName;            /* Treename of the repository */
   Stmt loop;                /* SQL to loop over all files to add */
+  Stmt undelete;            /* SQL to clear the deleted flag of a file */
+  Stmt insert;              /* SQL to insert a new file into VFILE */
   int (*xCmp)(const char*,const char*);
  
   if( !file_tree_name(g.zRepositoryName, &repoName, 0) ){
@@ -166,6 +171,15 @@ static int add_files_in_sfile(int vid, int caseSensitive){
       "    ON vfile(pathname COLLATE nocase)"
     );
   }
+  db_prepare(&undelete,
+    "UPDATE vfile SET deleted=0 WHERE pathname=:path COLLATE %s",
+    caseSensitive ? "binary" : "nocase"
+  );
+  db_prepare(&insert,
+    "INSERT INTO vfile(vid,deleted,rid,mrid,pathname,isexe,islink)"
+    "VALUES(%d,0,0,0,:path,:isexe,:islink)",
+    vid
+  );
   db_prepare(&loop, "SELECT x FROM sfile ORDER BY x");
   while( db_step(&loop)==SQLITE_ROW ){
     const char *zToAdd = db_column_text(&loop, 0);
@@ -174,13 +188,27 @@ static int add_files_in_sfile(int vid, int caseSensitive){
       if( xCmp(zToAdd, zReserved)==0 ) break;
     }
     if( zReserved ) continue;
-    nAdd += add_one_file(zToAdd, vid, caseSensitive);
+    nAdd += add_one_file(zToAdd, &undelete, &insert);
   }
   db_finalize(&loop);
+  db_finalize(&undelete);
+  db_finalize(&insert);
   blob_reset(&repoName);
   return nAdd;
 }
 
+/*
+** Return true if the progress of a directory scan should be shown.
+*/
+static int add_show_progress(void){
+  if( g.fQuiet ) return 0;
+#if defined(_WIN32)
+  return _isatty(fileno(stdout));
+#else
+  return isatty(fileno(stdout));
+#endif
+}
+
 /*
 ** COMMAND: add
 **
@@ -236,6 +264,7 @@ void add_cmd(void){
 #endif
   pIgnore = glob_create(zIgnoreFlag);
   nRoot = strlen(g.zLocalRoot);
+  vfile_scan_progress(add_show_progress());
   
   /* Load the names of all files that are to be added into sfile temp table */
   for(i=2; i<g.argc; i++){
@@ -421,6 +450,7 @@ void addremove_cmd(void){
   int caseSensitive;
   int n;
   Stmt q;
+  Stmt del;
   int vid;
   int nAdd = 0;
   int nDelete = 0;
@@ -449,11 +479,13 @@ void addremove_cmd(void){
   blob_init(&path, g.zLocalRoot, n-1);
   /* now we read the complete file structure into a temp table */
   pIgnore = glob_create(zIgnoreFlag);
+  vfile_scan_progress(add_show_progress());
   vfile_scan(&path, blob_size(&path), allFlag, pIgnore);
   glob_free(pIgnore);
   nAdd = add_files_in_sfile(vid, caseSensitive);
 
   /* step 2: search for missing files */
+  db_prepare(&del, "UPDATE vfile SET deleted=1 WHERE pathname=:path");
   db_prepare(&q,
       "SELECT pathname, %Q || pathname, deleted FROM vfile"
       " WHERE NOT deleted"
@@ -468,13 +500,16 @@ void addremove_cmd(void){
     zPath = db_column_text(&q, 1);
     if( !file_wd_isfile_or_link(zPath) ){
       if( !isTest ){
-        db_multi_exec("UPDATE vfile SET deleted=1 WHERE pathname=%Q", zFile);
+        db_bind_text(&del, ":path", zFile);
+        db_step(&del);
+        db_reset(&del);
       }
       fossil_print("DELETED  %s\n", zFile);
       nDelete++;
     }
   }
   db_finalize(&q);
+  db_finalize(&del);
   /* show cmmand summary */
   fossil_print("added %d files, deleted %d files\n", nAdd, nDelete);
 
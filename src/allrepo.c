@@ -20,6 +20,12 @@
 #include "config.h"
 #include "allrepo.h"
 #include <assert.h>
+#ifndef _WIN32
+# include <fcntl.h>
+# include <sys/types.h>
+# include <sys/wait.h>
+# include <unistd.h>
+#endif
 
 /*
 ** The input string is a filename.  Return a new copy of this
@@ -47,11 +53,102 @@ static char *quoteFilename(const char *zFilename){
   }
 }
 
+#ifndef _WIN32
+/*
+** A command being run by all_run_parallel().
+*/
+typedef struct AllJob AllJob;
+struct AllJob {
+  char *zCmd;            /* The command */
+  char zOut[100];        /* Temporary file that holds its output */
+  int pid;               /* Process running it, or 0 if not started */
+  int isDone;            /* True once the process has exited */
+  int rc;                /* Exit status */
+};
+
+/*
+** Print the command and the output of pJob, then delete its output file.
+*/
+static void all_job_report(AllJob *pJob){
+  Blob out;
+  fossil_print("%s\n", pJob->zCmd);
+  blob_zero(&out);
+  if( file_size(pJob->zOut)>0 ){
+    blob_read_from_file(&out, pJob->zOut);
+    fossil_print("%s", blob_str(&out));
+  }
+  blob_reset(&out);
+  fflush(stdout);
+  file_delete(pJob->zOut);
+}
+
+/*
+** Run the nCmd commands in azCmd[], at most nJob at once.  The output
+** of each command goes to a temporary file, and is printed after the
+** command line once the command finishes, in the order of azCmd[], so
+** that the output of different repositories is not interleaved.
+**
+** If stopOnError is true and a command fails, start no more commands.
+** Return non-zero if any command failed.
+*/
+static int all_run_parallel(char **azCmd, int nCmd, int nJob, int stopOnError){
+  AllJob *aJob = fossil_malloc( sizeof(AllJob)*nCmd );
+  int nStart = 0;        /* Jobs started */
+  int nRunning = 0;      /* Jobs started and not yet done */
+  int nReport = 0;       /* Jobs reported */
+  int rcAll = 0;
+  int i;
+
+  memset(aJob, 0, sizeof(AllJob)*nCmd);
+  fflush(stdout);
+  while( nReport<nCmd ){
+    int pid, status;
+    while( nRunning<nJob && nStart<nCmd && (rcAll==0 || !stopOnError) ){
+      AllJob *p = &aJob[nStart++];
+      p->zCmd = azCmd[nStart-1];
+      file_tempname(sizeof(p->zOut), p->zOut);
+      pid = fork();
+      if( pid<0 ){
+        fossil_fatal("unable to fork a process for: %s", p->zCmd);
+      }
+      if( pid==0 ){
+        int fd = open(p->zOut, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+        if( fd>=0 ){
+          dup2(fd, 1);
+          dup2(fd, 2);
+          close(fd);
+        }
+        execl("/bin/sh", "sh", "-c", p->zCmd, (char*)0);
+        _exit(127);
+      }
+      p->pid = pid;
+      nRunning++;
+    }
+    if( nRunning==0 ) break;
+    pid = waitpid(-1, &status, 0);
+    if( pid<0 ) break;
+    for(i=0; i<nStart; i++){
+      if( aJob[i].pid==pid && !aJob[i].isDone ){
+        aJob[i].isDone = 1;
+        aJob[i].rc = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+        if( aJob[i].rc ) rcAll = aJob[i].rc;
+        nRunning--;
+        break;
+      }
+    }
+    while( nReport<nStart && aJob[nReport].isDone ){
+      all_job_report(&aJob[nReport++]);
+    }
+  }
+  fossil_free(aJob);
+  return rcAll;
+}
+#endif
 
 /*
 ** COMMAND: all
 **
-** Usage: %fossil all (list|ls|pull|push|rebuild|sync)
+** Usage: %fossil all ?OPTIONS? (list|ls|pull|push|rebuild|sync)
 **
 ** The ~/.fossil file records the location of all repositories for a
 ** user.  This command performs certain operations on all repositories
@@ -79,6 +176,14 @@ static char *quoteFilename(const char *zFilename){
 ** when one of the following commands are run against the repository: clone,
 ** info, pull, push, or sync.  Even previously ignored repositories are
 ** added back to the list of repositories by these commands.
+**
+** Options:
+**
+**    --dontstop   Continue with the other repositories after an error
+**
+**    --jobs N     Work on up to N repositories at once.  The output for
+**                 each repository is printed, in the usual order, once
+**                 its command finishes.  Unix only.
 */
 void all_cmd(void){
   int n;
@@ -89,8 +194,15 @@ void all_cmd(void){
   char *zQFilename;
   int nMissing;
   int stopOnError = find_option("dontstop",0,0)==0;
+  const char *zJobs = find_option("jobs","j",1);
+  int nJob = zJobs ? atoi(zJobs) : 1;
+  char **azCmd = 0;
+  int nCmd = 0, nCmdAlloc = 0;
   int rc;
   
+#ifdef _WIN32
+  nJob = 1;
+#endif
   if( g.argc<3 ){
     usage("list|ls|pull|push|rebuild|sync");
   }
@@ -142,16 +254,33 @@ void all_cmd(void){
     }
     zQFilename = quoteFilename(zFilename);
     zSyscmd = mprintf("%s %s %s", zFossil, zCmd, zQFilename);
+    free(zQFilename);
+    if( nJob>1 ){
+      if( nCmd>=nCmdAlloc ){
+        nCmdAlloc = nCmdAlloc*2 + 100;
+        azCmd = fossil_realloc(azCmd, nCmdAlloc*sizeof(azCmd[0]));
+      }
+      azCmd[nCmd++] = zSyscmd;
+      continue;
+    }
     fossil_print("%s\n", zSyscmd);
     fflush(stdout);
     rc = fossil_system(zSyscmd);
     free(zSyscmd);
-    free(zQFilename);
     if( stopOnError && rc ){
       nMissing = 0;
       break;
     }
   }
+#ifndef _WIN32
+  if( nCmd>0 ){
+    int i;
+    rc = all_run_parallel(azCmd, nCmd, nJob, stopOnError);
+    if( stopOnError && rc ) nMissing = 0;
+    for(i=0; i<nCmd; i++) free(azCmd[i]);
+    fossil_free(azCmd);
+  }
+#endif
   
   /* If any repositories whose names appear in the ~/.fossil file could not
   ** be found, remove those names from the ~/.fossil file.
@@ -29,6 +29,14 @@
 ** An integer can appear in the bag at most once.
 ** Integers must be positive.
 **
+** A bag is stored in one of two ways.  Small or sparse bags use a
+** hash table in Bag.a.  Bags that hold many integers that are close
+** together, such as the record IDs of a large repository, are stored
+** as a bitmap in Bag.aBit instead.  The bag switches between the two
+** representations automatically.
+**
+** In the hash table representation:
+**
 ** On a hash collision, search continues to the next slot in the array,
 ** looping back to the beginning of the array when we reach the end.
 ** The search stops when a match is found or upon encountering a 0 entry.
@@ -43,12 +51,18 @@
 ** The length of a search increases as the hash table fills up.  So
 ** the table is enlarged whenever Bag.used reaches half of Bag.sz.  That
 ** way, the expected collision length never exceeds 2.
+**
+** In the bitmap representation, integer N is present if bit N%32 of
+** Bag.aBit[N/32] is set.  Bag.sz is the number of words in aBit[] and
+** Bag.used is the index of a word at or before the first non-zero word,
+** so that bag_first() need not rescan words that are known to be empty.
 */
 struct Bag {
   int cnt;   /* Number of integers in the bag */
-  int sz;    /* Number of slots in a[] */
-  int used;  /* Number of used slots in a[] */
+  int sz;    /* Number of slots in a[] or words in aBit[] */
+  int used;  /* Number of used slots in a[], or lowest non-zero aBit[] */
   int *a;    /* Hash table of integers that are in the bag */
+  unsigned int *aBit;  /* Bitmap of integers in the bag, or NULL */
 };
 #endif
 
@@ -64,6 +78,7 @@ void bag_init(Bag *p){
 */
 void bag_clear(Bag *p){
   free(p->a);
+  free(p->aBit);
   bag_init(p);
 }
 
@@ -72,6 +87,102 @@ void bag_clear(Bag *p){
 */
 #define bag_hash(i)  (i*101)
 
+/*
+** A bag uses the bitmap representation only once it holds at least
+** BAG_MIN_DENSE integers.  It switches from a hash table to a bitmap
+** when the bitmap would need no more than 2 words per entry, and back
+** to a hash table when the bitmap would need more than 8 words per
+** entry.  The gap between those two thresholds keeps a bag from
+** flipping back and forth.
+*/
+#define BAG_MIN_DENSE  64
+#define bag_is_dense(p)  ((p)->aBit!=0)
+
+/*
+** Return the number of bits that are set in x.
+*/
+static int bag_popcount(unsigned int x){
+  x = x - ((x>>1) & 0x55555555);
+  x = (x & 0x33333333) + ((x>>2) & 0x33333333);
+  x = (x + (x>>4)) & 0x0f0f0f0f;
+  return (x*0x01010101)>>24;
+}
+
+/*
+** Return the smallest integer greater than or equal to i that is in
+** the bitmap of bag p.  Return 0 if there is no such integer.
+*/
+static int bag_next_bit(Bag *p, int i){
+  int w = i>>5;
+  unsigned int x;
+  if( w>=p->sz ) return 0;
+  x = p->aBit[w] & (0xffffffff<<(i&31));
+  while( x==0 ){
+    if( ++w>=p->sz ) return 0;
+    x = p->aBit[w];
+  }
+  i = w<<5;
+  while( (x&1)==0 ){ x >>= 1; i++; }
+  return i;
+}
+
+/*
+** Change the number of words in the bitmap of bag p to nWord.  New
+** words are zeroed.  nWord must be large enough to hold every
+** integer currently in the bag.
+*/
+static void bag_bitmap_resize(Bag *p, int nWord){
+  p->aBit = fossil_realloc(p->aBit, sizeof(p->aBit[0])*nWord);
+  if( nWord>p->sz ){
+    memset(&p->aBit[p->sz], 0, sizeof(p->aBit[0])*(nWord-p->sz));
+  }
+  p->sz = nWord;
+}
+
+/*
+** Convert bag p from a hash table into a bitmap of nWord words.
+*/
+static void bag_to_bitmap(Bag *p, int nWord){
+  Bag old;
+  int i;
+
+  old = *p;
+  p->a = 0;
+  p->sz = 0;
+  p->used = 0;
+  p->aBit = 0;
+  bag_bitmap_resize(p, nWord);
+  for(i=0; i<old.sz; i++){
+    int e = old.a[i];
+    if( e>0 ) p->aBit[e>>5] |= 1u<<(e&31);
+  }
+  free(old.a);
+}
+
+/*
+** Convert bag p from a bitmap into a hash table.
+*/
+static void bag_to_hash(Bag *p){
+  Bag old;
+  int e;
+
+  old = *p;
+  p->aBit = 0;
+  p->sz = old.cnt*4 + 20;
+  p->a = fossil_malloc( sizeof(p->a[0])*p->sz );
+  memset(p->a, 0, sizeof(p->a[0])*p->sz );
+  for(e=bag_next_bit(&old, old.used<<5); e; e=bag_next_bit(&old, e+1)){
+    unsigned h = bag_hash(e)%p->sz;
+    while( p->a[h] ){
+      h++;
+      if( h==p->sz ) h = 0;
+    }
+    p->a[h] = e;
+  }
+  p->used = p->cnt;
+  free(old.aBit);
+}
+
 /*
 ** Change the size of the hash table on a bag so that
 ** it contains N slots
@@ -118,19 +229,52 @@ static void bag_resize(Bag *p, int newSize){
 */
 int bag_insert(Bag *p, int e){
   unsigned h;
+  int iDel = -1;  /* First deleted slot on the search path */
   int rc = 0;
   assert( e>0 );
+  if( bag_is_dense(p) ){
+    int w = e>>5;
+    if( w>=p->sz ){
+      int nWord = w+1;
+      if( nWord>8*(p->cnt+1) ){
+        bag_to_hash(p);
+        return bag_insert(p, e);
+      }
+      if( p->sz*2>nWord && p->sz*2<=8*(p->cnt+1) ) nWord = p->sz*2;
+      bag_bitmap_resize(p, nWord);
+    }
+    if( p->aBit[w] & (1u<<(e&31)) ) return 0;
+    p->aBit[w] |= 1u<<(e&31);
+    if( w<p->used ) p->used = w;
+    p->cnt++;
+    return 1;
+  }
   if( p->used+1 >= p->sz/2 ){
     int n = p->sz*2;
+    if( p->cnt>=BAG_MIN_DENSE ){
+      int i, mx = e;
+      for(i=0; i<p->sz; i++){
+        if( p->a[i]>mx ) mx = p->a[i];
+      }
+      if( (mx>>5)+1<=2*(p->cnt+1) ){
+        bag_to_bitmap(p, (mx>>5)+1);
+        return bag_insert(p, e);
+      }
+    }
     bag_resize(p,  n + 20 );
   }
   h = bag_hash(e)%p->sz;
-  while( p->a[h]>0 && p->a[h]!=e ){
+  while( p->a[h] && p->a[h]!=e ){
+    if( p->a[h]<0 && iDel<0 ) iDel = h;
     h++;
     if( h>=p->sz ) h = 0;
   }
-  if( p->a[h]<=0 ){
-    if( p->a[h]==0 ) p->used++;
+  if( p->a[h]==0 ){
+    if( iDel>=0 ){
+      h = iDel;
+    }else{
+      p->used++;
+    }
     p->a[h] = e;
     p->cnt++;
     rc = 1;
@@ -147,6 +291,9 @@ int bag_find(Bag *p, int e){
   if( p->sz==0 ){
     return 0;
   }
+  if( bag_is_dense(p) ){
+    return (e>>5)<p->sz && (p->aBit[e>>5] & (1u<<(e&31)))!=0;
+  }
   h = bag_hash(e)%p->sz;
   while( p->a[h] && p->a[h]!=e ){
     h++;
@@ -163,6 +310,19 @@ void bag_remove(Bag *p, int e){
   unsigned h;
   assert( e>0 );
   if( p->sz==0 ) return;
+  if( bag_is_dense(p) ){
+    int w = e>>5;
+    if( w<p->sz && (p->aBit[w] & (1u<<(e&31)))!=0 ){
+      p->aBit[w] &= ~(1u<<(e&31));
+      p->cnt--;
+      if( p->cnt==0 ){
+        p->used = 0;
+      }else if( p->sz>BAG_MIN_DENSE && p->sz>8*p->cnt ){
+        bag_to_hash(p);
+      }
+    }
+    return;
+  }
   h = bag_hash(e)%p->sz;
   while( p->a[h] && p->a[h]!=e ){
     h++;
@@ -190,9 +350,17 @@ void bag_remove(Bag *p, int e){
 /*
 ** Return the first element in the bag.  Return 0 if the bag
 ** is empty.
+**
+** A bag stored as a bitmap returns its elements in increasing order.
 */
 int bag_first(Bag *p){
   int i;
+  if( bag_is_dense(p) ){
+    if( p->cnt==0 ) return 0;
+    i = bag_next_bit(p, p->used<<5);
+    p->used = i>>5;
+    return i;
+  }
   for(i=0; i<p->sz && p->a[i]<=0; i++){}
   if( i<p->sz ){
     return p->a[i];
@@ -210,6 +378,9 @@ int bag_next(Bag *p, int e){
   unsigned h;
   assert( p->sz>0 );
   assert( e>0 );
+  if( bag_is_dense(p) ){
+    return bag_next_bit(p, e+1);
+  }
   h = bag_hash(e)%p->sz;
   while( p->a[h] && p->a[h]!=e ){
     h++;
@@ -229,3 +400,66 @@ int bag_next(Bag *p, int e){
 int bag_count(Bag *p){
   return p->cnt;
 }
+
+/*
+** Add every element of pSrc to p.  pSrc is unchanged.
+*/
+void bag_union(Bag *p, Bag *pSrc){
+  int e;
+  if( bag_is_dense(p) && bag_is_dense(pSrc) ){
+    int i;
+    if( pSrc->sz>p->sz ) bag_bitmap_resize(p, pSrc->sz);
+    p->cnt = 0;
+    for(i=0; i<p->sz; i++){
+      if( i<pSrc->sz ) p->aBit[i] |= pSrc->aBit[i];
+      p->cnt += bag_popcount(p->aBit[i]);
+    }
+    if( pSrc->used<p->used ) p->used = pSrc->used;
+    return;
+  }
+  for(e=bag_first(pSrc); e; e=bag_next(pSrc, e)){
+    bag_insert(p, e);
+  }
+}
+
+/*
+** Remove from p every element that is not also in pSrc.  pSrc is
+** unchanged.
+*/
+void bag_intersect(Bag *p, Bag *pSrc){
+  Bag x;
+  Bag *pScan, *pOther;
+  int e;
+  if( bag_is_dense(p) && bag_is_dense(pSrc) ){
+    int i;
+    p->cnt = 0;
+    for(i=0; i<p->sz; i++){
+      if( i<pSrc->sz ){
+        p->aBit[i] &= pSrc->aBit[i];
+      }else{
+        p->aBit[i] = 0;
+      }
+      p->cnt += bag_popcount(p->aBit[i]);
+    }
+    if( pSrc->used>p->used ) p->used = pSrc->used;
+    if( p->cnt==0 ){
+      p->used = 0;
+    }else if( p->sz>BAG_MIN_DENSE && p->sz>8*p->cnt ){
+      bag_to_hash(p);
+    }
+    return;
+  }
+  if( bag_count(pSrc)<bag_count(p) ){
+    pScan = pSrc;
+    pOther = p;
+  }else{
+    pScan = p;
+    pOther = pSrc;
+  }
+  bag_init(&x);
+  for(e=bag_first(pScan); e; e=bag_next(pScan, e)){
+    if( bag_find(pOther, e) ) bag_insert(&x, e);
+  }
+  bag_clear(p);
+  *p = x;
+}
@@ -0,0 +1,730 @@
+/*
+** Copyright (c) 2012 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*******************************************************************************
+**
+** This file implements the "test-bench" command, which times the code
+** paths that matter most to the speed of fossil: delta encoding,
+** compression, diff, manifest parsing, reading artifacts at the end of
+** long delta chains, the checkout signature check, and rebuild.
+**
+** Results are printed one per line as JSON objects so that runs of two
+** builds can be compared by a script.  The test/bench.tcl script builds
+** a synthetic repository of a chosen size, runs this command against it,
+** and adds timings for clone over loopback and for common web pages.
+**
+** The "test-synth-repo" command, also here, makes large repositories
+** for scale testing directly, without a checkout or a sequence of
+** commits.
+*/
+#include "config.h"
+#include "bench.h"
+#include <assert.h>
+
+/*
+** State of the pseudo-random number generator used to make synthetic
+** input.  A private generator is used, rather than sqlite3_randomness(),
+** so that every run times exactly the same input.
+*/
+static unsigned int benchSeed = 1;
+
+/*
+** Return a pseudo-random integer between 0 and 32767.
+*/
+static int bench_rand(void){
+  benchSeed = benchSeed*1103515245 + 12345;
+  return (benchSeed>>16) & 0x7fff;
+}
+
+/*
+** Append a line of text that looks like C source code to pOut.
+*/
+static void bench_line(Blob *pOut){
+  static const char *azWord[] = {
+    "int", "return", "if", "else", "for", "while", "Blob", "zName", "rid",
+    "db_step(&q)", "(void)", "{", "}", "0;", "struct", "char", "*p", "=",
+    "+", "i++", "static", "const", "n", "x", "blob_size(&a)", "&&", "||",
+  };
+  int nWord = bench_rand()%12 + 1;
+  int nIndent = bench_rand()%4;
+  int i;
+  for(i=0; i<nIndent; i++) blob_append(pOut, "  ", 2);
+  for(i=0; i<nWord; i++){
+    if( i ) blob_append(pOut, " ", 1);
+    blob_append(pOut, azWord[bench_rand()%(sizeof(azWord)/sizeof(azWord[0]))],
+                -1);
+  }
+  blob_append(pOut, "\n", 1);
+}
+
+/*
+** Fill pOut with about nByte bytes of synthetic source code.
+*/
+static void bench_text(Blob *pOut, int nByte){
+  blob_zero(pOut);
+  while( blob_size(pOut)<nByte ) bench_line(pOut);
+}
+
+/*
+** Copy pIn into pOut, replacing about one line in a hundred with new
+** text and inserting a new line after about one line in two hundred.
+** This is the kind of edit that a typical check-in makes to a file.
+*/
+static void bench_edit(Blob *pIn, Blob *pOut){
+  const char *z = blob_buffer(pIn);
+  int n = blob_size(pIn);
+  int i = 0;
+  blob_zero(pOut);
+  while( i<n ){
+    int j = i;
+    while( j<n && z[j]!='\n' ) j++;
+    if( j<n ) j++;
+    if( bench_rand()%100==0 ){
+      bench_line(pOut);
+    }else{
+      blob_append(pOut, &z[i], j-i);
+    }
+    if( bench_rand()%200==0 ) bench_line(pOut);
+    i = j;
+  }
+}
+
+/*
+** Print the result of one benchmark.  nIter is the number of times
+** the operation was repeated, nItem the number of files or artifacts
+** that each repetition handled, iTime the total elapsed microseconds,
+** and nByte the number of input bytes handled by each repetition.
+*/
+static void bench_result(
+  const char *zName,
+  int nIter,
+  int nItem,
+  i64 iTime,
+  i64 nByte
+){
+  fossil_print("{\"bench\":\"%s\",\"iterations\":%d,\"items\":%d,"
+               "\"usec\":%lld,\"usec_per_op\":%.1f,\"bytes\":%lld}\n",
+               zName, nIter, nItem, iTime,
+               nIter>0 ? (double)iTime/nIter : 0.0, nByte);
+}
+
+/*
+** Print a line saying that a benchmark was not run, and why.
+*/
+static void bench_skipped(const char *zName, const char *zReason){
+  fossil_print("{\"bench\":\"%s\",\"skipped\":\"%s\"}\n", zName, zReason);
+}
+
+/*
+** Options shared by all benchmarks.
+*/
+static struct {
+  int nIter;       /* Repetitions of each benchmark */
+  int nSize;       /* Bytes of synthetic input */
+  int nChain;      /* Number of deep delta chains to read */
+} bench;
+
+/*
+** Benchmark delta_create() between a synthetic file and an edited
+** copy of it.
+*/
+static void bench_delta_create(const char *zName){
+  Blob a, b;
+  char *zDelta;
+  int i;
+  i64 iStart;
+  bench_text(&a, bench.nSize);
+  bench_edit(&a, &b);
+  zDelta = fossil_malloc(blob_size(&b)+60);
+  iStart = perf_clock();
+  for(i=0; i<bench.nIter; i++){
+    delta_create(blob_buffer(&a), blob_size(&a),
+                 blob_buffer(&b), blob_size(&b), zDelta);
+  }
+  bench_result(zName, bench.nIter, 1, perf_clock()-iStart, blob_size(&b));
+  fossil_free(zDelta);
+  blob_reset(&a);
+  blob_reset(&b);
+}
+
+/*
+** Benchmark delta_apply() on the delta made by bench_delta_create().
+*/
+static void bench_delta_apply(const char *zName){
+  Blob a, b;
+  char *zDelta, *zOut;
+  int i, nDelta;
+  i64 iStart;
+  bench_text(&a, bench.nSize);
+  bench_edit(&a, &b);
+  zDelta = fossil_malloc(blob_size(&b)+60);
+  zOut = fossil_malloc(blob_size(&b)+1);
+  nDelta = delta_create(blob_buffer(&a), blob_size(&a),
+                        blob_buffer(&b), blob_size(&b), zDelta);
+  iStart = perf_clock();
+  for(i=0; i<bench.nIter; i++){
+    delta_apply(blob_buffer(&a), blob_size(&a), zDelta, nDelta, zOut);
+  }
+  bench_result(zName, bench.nIter, 1, perf_clock()-iStart, blob_size(&b));
+  fossil_free(zDelta);
+  fossil_free(zOut);
+  blob_reset(&a);
+  blob_reset(&b);
+}
+
+/*
+** Benchmark blob_compress() on synthetic text.
+*/
+static void bench_compress(const char *zName){
+  Blob a, out;
+  int i;
+  i64 iStart;
+  bench_text(&a, bench.nSize);
+  iStart = perf_clock();
+  for(i=0; i<bench.nIter; i++){
+    blob_compress(&a, &out);
+    blob_reset(&out);
+  }
+  bench_result(zName, bench.nIter, 1, perf_clock()-iStart, blob_size(&a));
+  blob_reset(&a);
+}
+
+/*
+** Benchmark blob_uncompress() on compressed synthetic text.
+*/
+static void bench_uncompress(const char *zName){
+  Blob a, z, out;
+  int i;
+  i64 iStart;
+  bench_text(&a, bench.nSize);
+  blob_compress(&a, &z);
+  iStart = perf_clock();
+  for(i=0; i<bench.nIter; i++){
+    blob_uncompress(&z, &out);
+    blob_reset(&out);
+  }
+  bench_result(zName, bench.nIter, 1, perf_clock()-iStart, blob_size(&a));
+  blob_reset(&a);
+  blob_reset(&z);
+}
+
+/*
+** Benchmark text_diff() between a synthetic file and an edited copy,
+** both as a unified diff and as the side-by-side HTML diff shown by
+** the web pages.
+*/
+static void bench_diff_flags(const char *zName, u64 diffFlags){
+  Blob a, b, out;
+  int i;
+  i64 iStart;
+  bench_text(&a, bench.nSize);
+  bench_edit(&a, &b);
+  iStart = perf_clock();
+  for(i=0; i<bench.nIter; i++){
+    blob_zero(&out);
+    text_diff(&a, &b, &out, diffFlags);
+    blob_reset(&out);
+  }
+  bench_result(zName, bench.nIter, 1, perf_clock()-iStart, blob_size(&b));
+  blob_reset(&a);
+  blob_reset(&b);
+}
+static void bench_diff(const char *zName){
+  bench_diff_flags(zName, 0);
+}
+static void bench_diff_html(const char *zName){
+  bench_diff_flags(zName, DIFF_SIDEBYSIDE|DIFF_HTML|DIFF_LINENO);
+}
+
+/*
+** Benchmark manifest_parse() on the text of every check-in manifest
+** in the repository.  The text is read before the clock starts, so
+** only the parse is timed.
+*/
+static void bench_manifest(const char *zName){
+  Stmt q;
+  Blob *aText = 0;
+  int *aRid = 0;
+  int nText = 0, nAlloc = 0;
+  i64 nByte = 0, iTime = 0;
+  int i, j;
+  db_prepare(&q, "SELECT objid FROM event WHERE type='ci'");
+  while( db_step(&q)==SQLITE_ROW ){
+    if( nText>=nAlloc ){
+      nAlloc = nAlloc*2 + 100;
+      aText = fossil_realloc(aText, nAlloc*sizeof(aText[0]));
+      aRid = fossil_realloc(aRid, nAlloc*sizeof(aRid[0]));
+    }
+    aRid[nText] = db_column_int(&q, 0);
+    if( content_get(aRid[nText], &aText[nText]) ){
+      nByte += blob_size(&aText[nText]);
+      nText++;
+    }
+  }
+  db_finalize(&q);
+  if( nText==0 ){
+    bench_skipped(zName, "no check-ins");
+    fossil_free(aText);
+    fossil_free(aRid);
+    return;
+  }
+  for(i=0; i<bench.nIter; i++){
+    for(j=0; j<nText; j++){
+      Blob copy;
+      Manifest *p;
+      i64 iStart;
+      blob_copy(&copy, &aText[j]);
+      iStart = perf_clock();
+      p = manifest_parse(&copy, aRid[j]);
+      iTime += perf_clock() - iStart;
+      manifest_destroy(p);
+    }
+  }
+  bench_result(zName, bench.nIter, nText, iTime, nByte);
+  for(j=0; j<nText; j++) blob_reset(&aText[j]);
+  fossil_free(aText);
+  fossil_free(aRid);
+}
+
+/*
+** Benchmark content_get() on the artifacts at the end of the longest
+** delta chains in the repository.  The content cache is cleared before
+** each repetition, so every delta in each chain is applied.
+*/
+static void bench_content(const char *zName){
+  Stmt q;
+  int mxRid = db_int(0, "SELECT max(rid) FROM blob");
+  int *aSrc, *aDepth, *aTop;
+  int nTop = 0;
+  int i, rid;
+  i64 nByte = 0, iStart;
+
+  if( mxRid==0 ){
+    bench_skipped(zName, "no artifacts");
+    return;
+  }
+  aSrc = fossil_malloc( sizeof(int)*(mxRid+1)*2 + sizeof(int)*bench.nChain );
+  aDepth = &aSrc[mxRid+1];
+  aTop = &aDepth[mxRid+1];
+  memset(aSrc, 0, sizeof(int)*(mxRid+1)*2);
+  db_prepare(&q, "SELECT rid, srcid FROM delta");
+  while( db_step(&q)==SQLITE_ROW ){
+    int r = db_column_int(&q, 0);
+    int s = db_column_int(&q, 1);
+    if( r>0 && r<=mxRid && s>0 && s<=mxRid ) aSrc[r] = s;
+  }
+  db_finalize(&q);
+
+  /* Find the depth of every artifact.  aDepth[] holds the depth plus
+  ** one once it is known, so that zero means "not yet computed". */
+  for(rid=1; rid<=mxRid; rid++){
+    int r = rid, n = 0, d;
+    while( aSrc[r] && aDepth[r]==0 && n<=mxRid ){ r = aSrc[r]; n++; }
+    d = aDepth[r] ? aDepth[r] + n : n + 1;
+    for(r=rid; n>0 && aDepth[r]==0; n--){ aDepth[r] = d--; r = aSrc[r]; }
+    if( aDepth[r]==0 ) aDepth[r] = 1;
+  }
+
+  /* Keep the nChain deepest, in order of decreasing depth */
+  for(rid=1; rid<=mxRid; rid++){
+    if( aDepth[rid]<=1 ) continue;
+    if( nTop==bench.nChain && aDepth[aTop[nTop-1]]>=aDepth[rid] ) continue;
+    if( nTop<bench.nChain ) nTop++;
+    for(i=nTop-1; i>0 && aDepth[aTop[i-1]]<aDepth[rid]; i--){
+      aTop[i] = aTop[i-1];
+    }
+    aTop[i] = rid;
+  }
+  if( nTop==0 ){
+    bench_skipped(zName, "no delta chains");
+    fossil_free(aSrc);
+    return;
+  }
+  for(i=0; i<nTop; i++){
+    nByte += db_int(0, "SELECT size FROM blob WHERE rid=%d", aTop[i]);
+  }
+  iStart = perf_clock();
+  for(i=0; i<bench.nIter; i++){
+    int j;
+    content_clear_cache();
+    for(j=0; j<nTop; j++){
+      Blob content;
+      content_get(aTop[j], &content);
+      blob_reset(&content);
+    }
+  }
+  bench_result(zName, bench.nIter, nTop, perf_clock()-iStart, nByte);
+  fossil_free(aSrc);
+}
+
+/*
+** Benchmark vfile_check_signature() on the current checkout, first
+** comparing mtimes and then with the --sha1sum behavior of hashing
+** every file.  The results are rolled back.
+*/
+static void bench_signature_flags(const char *zName, int useSha1sum){
+  int vid = db_lget_int("checkout", 0);
+  int nFile = db_int(0, "SELECT count(*) FROM vfile WHERE vid=%d", vid);
+  i64 nByte = db_int64(0, "SELECT sum(size) FROM vfile"
+                          " JOIN blob USING(rid) WHERE vid=%d", vid);
+  int i;
+  i64 iStart;
+  db_begin_transaction();
+  iStart = perf_clock();
+  for(i=0; i<bench.nIter; i++){
+    vfile_check_signature(vid, 0, useSha1sum);
+  }
+  bench_result(zName, bench.nIter, nFile, perf_clock()-iStart, nByte);
+  db_end_transaction(1);
+}
+static void bench_signature(const char *zName){
+  bench_signature_flags(zName, 0);
+}
+static void bench_signature_sha1(const char *zName){
+  bench_signature_flags(zName, 1);
+}
+
+/*
+** Benchmark a full rebuild of the repository.  Each rebuild is rolled
+** back, so the repository is unchanged afterwards.
+**
+** rebuild_db() needs the repository to be the main database, so as in
+** the "rebuild" command it is reopened without the checkout.  This must
+** be the last benchmark.
+*/
+static void bench_rebuild(const char *zName){
+  int nArtifact;
+  i64 nByte;
+  i64 iTime = 0;
+  int i;
+  if( g.localOpen ){
+    db_close(1);
+    db_open_repository(g.zRepositoryName);
+  }
+  nArtifact = db_int(0, "SELECT count(*) FROM blob WHERE size>=0");
+  nByte = db_int64(0, "SELECT sum(size) FROM blob WHERE size>=0");
+  for(i=0; i<bench.nIter; i++){
+    i64 iStart;
+    db_begin_transaction();
+    iStart = perf_clock();
+    rebuild_db(0, 0, 0);
+    iTime += perf_clock() - iStart;
+    db_end_transaction(1);
+    content_clear_cache();
+    manifest_cache_clear();
+  }
+  bench_result(zName, bench.nIter, nArtifact, iTime, nByte);
+}
+
+/*
+** The benchmarks, in the order they are run.
+*/
+#define BENCH_REPO   0x01     /* Needs a repository */
+#define BENCH_CKOUT  0x02     /* Needs a checkout */
+static const struct {
+  const char *zName;              /* Name of the benchmark */
+  void (*xBench)(const char*);    /* Run the benchmark */
+  int mFlags;                     /* BENCH_* flags */
+  const char *zDesc;              /* What is timed */
+} aBench[] = {
+  { "delta-create",   bench_delta_create,   0,
+                      "delta_create() for a one percent edit" },
+  { "delta-apply",    bench_delta_apply,    0,
+                      "delta_apply() of the same delta" },
+  { "compress",       bench_compress,       0,
+                      "blob_compress() of synthetic text" },
+  { "uncompress",     bench_uncompress,     0,
+                      "blob_uncompress() of the same text" },
+  { "diff",           bench_diff,           0,
+                      "text_diff() unified diff of a one percent edit" },
+  { "diff-html",      bench_diff_html,      0,
+                      "text_diff() side-by-side HTML diff of the same" },
+  { "manifest",       bench_manifest,       BENCH_REPO,
+                      "manifest_parse() of every check-in manifest" },
+  { "content",        bench_content,        BENCH_REPO,
+                      "content_get() at the end of the deepest delta chains" },
+  { "signature",      bench_signature,      BENCH_REPO|BENCH_CKOUT,
+                      "vfile_check_signature() on the checkout" },
+  { "signature-sha1", bench_signature_sha1, BENCH_REPO|BENCH_CKOUT,
+                      "vfile_check_signature() hashing every file" },
+  { "rebuild",        bench_rebuild,        BENCH_REPO,
+                      "rebuild_db() of the whole repository, rolled back" },
+};
+
+/*
+** COMMAND: test-bench
+**
+** Usage: %fossil test-bench ?OPTIONS? ?BENCHMARK ...?
+**
+** Time the code paths that matter most to the speed of fossil and print
+** the results one per line as JSON objects.  Each result names the
+** benchmark and gives the number of iterations, the number of files or
+** artifacts handled per iteration, the total and per-iteration time in
+** microseconds, and the input bytes handled per iteration.
+**
+** BENCHMARK arguments are names or GLOB patterns.  All benchmarks run
+** if none are given.  The benchmarks that read a repository use the one
+** for the current checkout or named by -R, and are skipped if there is
+** none.  The signature benchmarks are also skipped outside a checkout.
+** Nothing is changed: work that writes to the repository is rolled back.
+**
+** The test/bench.tcl script builds a synthetic repository and runs this
+** command on it, along with clone and web page timings.
+**
+** Options:
+**
+**   -n|--iterations N    Repeat each benchmark N times.  Default: 10
+**   --size N             Bytes of synthetic text for the delta, compress
+**                        and diff benchmarks.  Default: 1000000
+**   --chains N           Read the N deepest delta chains.  Default: 20
+**   --list               List the benchmarks instead of running them
+**   -R|--repository FILE Use repository FILE
+*/
+void test_bench_cmd(void){
+  const char *zIter = find_option("iterations", "n", 1);
+  const char *zSize = find_option("size", 0, 1);
+  const char *zChain = find_option("chains", 0, 1);
+  int listFlag = find_option("list", 0, 0)!=0;
+  int i, j;
+
+  bench.nIter = zIter ? atoi(zIter) : 10;
+  bench.nSize = zSize ? atoi(zSize) : 1000000;
+  bench.nChain = zChain ? atoi(zChain) : 20;
+  if( bench.nIter<1 ) bench.nIter = 1;
+  if( bench.nSize<100 ) bench.nSize = 100;
+  if( bench.nChain<1 ) bench.nChain = 1;
+  if( listFlag ){
+    for(i=0; i<sizeof(aBench)/sizeof(aBench[0]); i++){
+      fossil_print("%-16s %s\n", aBench[i].zName, aBench[i].zDesc);
+    }
+    return;
+  }
+  db_find_and_open_repository(OPEN_OK_NOT_FOUND, 0);
+  for(i=0; i<sizeof(aBench)/sizeof(aBench[0]); i++){
+    const char *zName = aBench[i].zName;
+    if( g.argc>2 ){
+      for(j=2; j<g.argc && !strglob(g.argv[j], zName); j++){}
+      if( j>=g.argc ) continue;
+    }
+    if( (aBench[i].mFlags & BENCH_REPO)!=0 && !g.repositoryOpen ){
+      bench_skipped(zName, "no repository");
+    }else if( (aBench[i].mFlags & BENCH_CKOUT)!=0 && !g.localOpen ){
+      bench_skipped(zName, "no checkout");
+    }else{
+      benchSeed = 1;
+      aBench[i].xBench(zName);
+    }
+  }
+}
+
+/*
+** Return a pseudo-random integer between 0 and N-1, where N may be
+** larger than bench_rand() can return.
+*/
+static int synth_rand(int N){
+  return (int)((((unsigned)bench_rand()<<15) | bench_rand()) % N);
+}
+
+/*
+** Store pContent as a new artifact and return its rid.  Write its SHA1
+** hash into zUuid[].  pContent is left unchanged.
+*/
+static int synth_store(Blob *pContent, char *zUuid){
+  Blob hash;
+  int rid;
+  sha1sum_blob(pContent, &hash);
+  memcpy(zUuid, blob_buffer(&hash), UUID_SIZE+1);
+  rid = content_put_ex(pContent, zUuid, 0, 0, 0);
+  blob_reset(&hash);
+  return rid;
+}
+
+/*
+** COMMAND: test-synth-repo
+**
+** Usage: %fossil test-synth-repo FILENAME ?OPTIONS?
+**
+** Create a new repository FILENAME filled with synthetic check-ins, for
+** scale testing and benchmarks with a repository that can be shared.
+** The same options always make the same check-ins.  Artifacts are
+** stored with content_put_ex(), each prior version of a file and each
+** parent manifest is made a delta of its successor as "commit" does,
+** and manifests are built and crosslinked directly, so large
+** repositories are made far faster than by a sequence of commits.
+**
+** The first check-in adds every file.  Each later one changes a random
+** CHURN percent of the files, at least one, replacing about one line in
+** a hundred of each.  File sizes vary between a quarter of and seven
+** quarters of SIZE bytes, and one file in a hundred is twenty times
+** larger.  Files that are changed often end up at the bottom of long
+** delta chains.
+**
+** About half of the check-ins after the first are on trunk and the
+** rest are spread over the branches, each of which is forked from
+** trunk by its first check-in.  All branches share one evolving set
+** of files, so a check-in on a branch records the latest version of
+** every file whichever branch changed it.  The branches are there for
+** the timeline, tags and leaves rather than as separate lines of work.
+**
+** Options:
+**
+**   --files N       Number of files.  Default: 1000
+**   --per-dir N     Files in each directory.  Default: 50
+**   --commits N     Number of check-ins.  Default: 100
+**   --branches N    Number of branches besides trunk.  Default: 0
+**   --size N        Average size of a file in bytes.  Default: 4000
+**   --churn PCT     Percent of files changed by each check-in.  Default: 1
+**   --seed N        Seed for the pseudo-random generator.  Default: 1
+**   -f|--force      Overwrite FILENAME if it exists
+**
+** See also: test-bench
+*/
+void test_synth_repo_cmd(void){
+  const char *zFiles = find_option("files", 0, 1);
+  const char *zPerDir = find_option("per-dir", 0, 1);
+  const char *zCommits = find_option("commits", 0, 1);
+  const char *zBranches = find_option("branches", 0, 1);
+  const char *zSize = find_option("size", 0, 1);
+  const char *zChurn = find_option("churn", 0, 1);
+  const char *zSeed = find_option("seed", 0, 1);
+  int forceFlag = find_option("force", "f", 0)!=0;
+  int nFile, nPerDir, nCommit, nBranch, nSize, nChurn;
+  int *aRid;                  /* Current rid of each file */
+  char *aUuid;                /* Current UUID of each file */
+  int *aBrRid;                /* Latest check-in on each branch, or 0 */
+  char *aBrUuid;              /* UUID of the same */
+  int nArtifact = 0;
+  int c, i;
+
+  verify_all_options();
+  if( g.argc!=3 ) usage("FILENAME ?OPTIONS?");
+  nFile = zFiles ? atoi(zFiles) : 1000;
+  nPerDir = zPerDir ? atoi(zPerDir) : 50;
+  nCommit = zCommits ? atoi(zCommits) : 100;
+  nBranch = zBranches ? atoi(zBranches) : 0;
+  nSize = zSize ? atoi(zSize) : 4000;
+  nChurn = zChurn ? atoi(zChurn) : 1;
+  if( nFile<1 ) nFile = 1;
+  if( nPerDir<1 ) nPerDir = 1;
+  if( nCommit<1 ) nCommit = 1;
+  if( nBranch<0 ) nBranch = 0;
+  if( nSize<4 ) nSize = 4;
+  if( nChurn<0 ) nChurn = 0;
+  benchSeed = zSeed ? atoi(zSeed) : 1;
+
+  if( forceFlag ) file_delete(g.argv[2]);
+  db_create_repository(g.argv[2]);
+  db_open_repository(g.argv[2]);
+  db_open_config(0);
+  db_begin_transaction();
+  db_initial_setup(0, 0, 1);
+  content_compression_init();
+
+  aRid = fossil_malloc( sizeof(int)*nFile );
+  aUuid = fossil_malloc( (UUID_SIZE+1)*nFile );
+  aBrRid = fossil_malloc( sizeof(int)*(nBranch+1) );
+  aBrUuid = fossil_malloc( (UUID_SIZE+1)*(nBranch+1) );
+  memset(aRid, 0, sizeof(int)*nFile);
+  memset(aBrRid, 0, sizeof(int)*(nBranch+1));
+
+  manifest_crosslink_begin();
+  for(c=0; c<nCommit; c++){
+    int iBr = 0;                /* Branch of this check-in.  0 is trunk */
+    int iParent;                /* Branch holding the parent check-in */
+    int nChange;
+    Blob mfst, cksum;
+    char *zDate;
+    int rid;
+
+    if( c==0 ){
+      /* The first check-in adds every file */
+      for(i=0; i<nFile; i++){
+        Blob content;
+        int sz = nSize/4 + synth_rand(nSize*3/2);
+        if( bench_rand()%100==0 ) sz *= 20;
+        bench_text(&content, sz);
+        aRid[i] = synth_store(&content, &aUuid[i*(UUID_SIZE+1)]);
+        blob_reset(&content);
+        nArtifact++;
+      }
+    }else{
+      if( nBranch>0 && bench_rand()%2 ) iBr = 1 + synth_rand(nBranch);
+      nChange = (int)((i64)nFile*nChurn/100);
+      if( nChange<1 ) nChange = 1;
+      for(; nChange>0; nChange--){
+        Blob old, content;
+        int iFile = synth_rand(nFile);
+        content_get(aRid[iFile], &old);
+        bench_edit(&old, &content);
+        rid = synth_store(&content, &aUuid[iFile*(UUID_SIZE+1)]);
+        if( rid!=aRid[iFile] ){
+          content_deltify(aRid[iFile], rid, 0);
+          aRid[iFile] = rid;
+          nArtifact++;
+        }
+        blob_reset(&old);
+        blob_reset(&content);
+      }
+    }
+
+    /* Build the manifest.  Names are zero-padded so that the order of
+    ** the files is also the sorted order the F cards require. */
+    iParent = aBrRid[iBr] ? iBr : 0;
+    zDate = db_text(0, "SELECT strftime('%%Y-%%m-%%dT%%H:%%M:%%S',"
+                       " 946684800+%d, 'unixepoch')", c*600);
+    blob_zero(&mfst);
+    blob_appendf(&mfst, "C synthetic\\scheck-in\\s%d\n", c);
+    blob_appendf(&mfst, "D %s\n", zDate);
+    for(i=0; i<nFile; i++){
+      blob_appendf(&mfst, "F d%05d/f%07d.c %s\n", i/nPerDir, i,
+                   &aUuid[i*(UUID_SIZE+1)]);
+    }
+    if( aBrRid[iParent] ){
+      blob_appendf(&mfst, "P %s\n", &aBrUuid[iParent*(UUID_SIZE+1)]);
+    }
+    if( c==0 ){
+      blob_appendf(&mfst, "T *branch * trunk\nT *sym-trunk *\n");
+    }else if( iBr>0 && aBrRid[iBr]==0 ){
+      blob_appendf(&mfst, "T *branch * b%05d\nT *sym-b%05d *\n"
+                          "T -sym-trunk *\n", iBr, iBr);
+    }
+    blob_appendf(&mfst, "U %F\n", g.zLogin);
+    md5sum_blob(&mfst, &cksum);
+    blob_appendf(&mfst, "Z %b\n", &cksum);
+    rid = synth_store(&mfst, &aBrUuid[iBr*(UUID_SIZE+1)]);
+    nArtifact++;
+    if( aBrRid[iParent] ) content_deltify(aBrRid[iParent], rid, 0);
+    aBrRid[iBr] = rid;
+    manifest_crosslink(rid, &mfst);
+    blob_reset(&mfst);
+    blob_reset(&cksum);
+    fossil_free(zDate);
+
+    /* Crosslink in batches, as "import" does, to bound memory use */
+    if( c%1000==999 ){
+      manifest_crosslink_end();
+      manifest_crosslink_begin();
+    }
+  }
+  manifest_crosslink_end();
+  create_cluster();
+  db_end_transaction(0);
+  fossil_print("%d check-ins, %d files, %d artifacts\n",
+               nCommit, nFile, nArtifact);
+  fossil_free(aRid);
+  fossil_free(aUuid);
+  fossil_free(aBrRid);
+  fossil_free(aBrUuid);
+}
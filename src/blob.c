@@ -20,6 +20,9 @@
 */
 #include "config.h"
 #include <zlib.h>
+#ifdef FOSSIL_ENABLE_ZSTD
+# include <zstd.h>
+#endif
 #include "blob.h"
 
 #if INTERFACE
@@ -52,13 +55,20 @@ struct Blob {
 #define BLOB_SEEK_CUR 2
 #define BLOB_SEEK_END 3
 
+/*
+** Compression methods for blob_compress_ex()
+*/
+#define BLOB_COMPRESS_ZLIB  0     /* zlib compress().  The legacy format */
+#define BLOB_COMPRESS_ZSTD  1     /* Zstandard, if this build supports it */
+
 #endif /* INTERFACE */
 
 /*
 ** Make sure a blob is initialized
 */
 #define blob_is_init(x) \
-  assert((x)->xRealloc==blobReallocMalloc || (x)->xRealloc==blobReallocStatic)
+  assert((x)->xRealloc==blobReallocMalloc || (x)->xRealloc==blobReallocStatic \
+          || (x)->xRealloc==blobReallocArena)
 
 /*
 ** Make sure a blob does not contain malloced memory.
@@ -177,6 +187,146 @@ static void blobReallocStatic(Blob *pBlob, unsigned int newSize){
   }
 }
 
+/*
+** Arena blobs.
+**
+** Pages and commands create and destroy many small, short-lived blobs.
+** A blob initialized by blob_zero_arena() takes its memory from an arena
+** instead of from malloc().  Arena memory is released all at once when
+** the enclosing arena scope ends, so blob_reset() and growth of such
+** blobs are nearly free.
+**
+** Scopes are opened by blob_arena_begin() and closed by blob_arena_end().
+** One scope surrounds each command and each web page, and scopes may
+** nest.  An arena blob must be initialized, used and finished within a
+** single scope, and must not be handed to code that free()s its buffer
+** or to another thread.  Blobs that grow large move to malloc()ed memory
+** automatically, and outside of any scope blob_zero_arena() is the same
+** as blob_zero().
+*/
+#define BLOB_ARENA_CHUNK    65536  /* Bytes in each arena chunk */
+#define BLOB_ARENA_MAXBLOB  16384  /* Larger blobs use malloc() instead */
+#define BLOB_ARENA_MXSCOPE  8      /* Nesting depth with separate marks */
+
+typedef struct BlobArenaChunk BlobArenaChunk;
+struct BlobArenaChunk {
+  BlobArenaChunk *pPrev;           /* Next older chunk */
+  unsigned int nUsed;              /* Bytes of a[] in use */
+  char a[BLOB_ARENA_CHUNK];        /* Space for blob content */
+};
+
+static struct {
+  BlobArenaChunk *pChunk;          /* Newest chunk.  Allocations come here */
+  int nScope;                      /* Number of open scopes */
+  struct {
+    BlobArenaChunk *pChunk;        /* Newest chunk when the scope began */
+    unsigned int nUsed;            /* Value of pChunk->nUsed at that time */
+  } aMark[BLOB_ARENA_MXSCOPE];
+} blobArena;
+
+/*
+** Begin a new arena scope.
+*/
+void blob_arena_begin(void){
+  int i = blobArena.nScope++;
+  if( i<BLOB_ARENA_MXSCOPE ){
+    blobArena.aMark[i].pChunk = blobArena.pChunk;
+    blobArena.aMark[i].nUsed = blobArena.pChunk ? blobArena.pChunk->nUsed : 0;
+  }
+}
+
+/*
+** End the innermost arena scope, releasing all arena memory allocated
+** since the matching blob_arena_begin().
+*/
+void blob_arena_end(void){
+  int i;
+  assert( blobArena.nScope>0 );
+  i = --blobArena.nScope;
+  if( i<BLOB_ARENA_MXSCOPE ){
+    BlobArenaChunk *pMark = blobArena.aMark[i].pChunk;
+    while( blobArena.pChunk!=pMark ){
+      BlobArenaChunk *pPrev = blobArena.pChunk->pPrev;
+      free(blobArena.pChunk);
+      blobArena.pChunk = pPrev;
+    }
+    if( pMark ) pMark->nUsed = blobArena.aMark[i].nUsed;
+  }
+}
+
+/*
+** Return true if the content of arena blob p is the most recent
+** allocation in the newest chunk and that allocation belongs to the
+** innermost scope, so that it can be grown or released in place.
+*/
+static int blob_arena_is_top(Blob *p){
+  BlobArenaChunk *pChunk = blobArena.pChunk;
+  int i = blobArena.nScope-1;
+  if( pChunk==0 || p->aData+p->nAlloc!=pChunk->a+pChunk->nUsed ) return 0;
+  if( i>=BLOB_ARENA_MXSCOPE ) return 0;
+  if( blobArena.aMark[i].pChunk==pChunk
+   && p->aData<pChunk->a+blobArena.aMark[i].nUsed ){
+    return 0;
+  }
+  return 1;
+}
+
+/*
+** A reallocation function for arena blobs.
+*/
+static void blobReallocArena(Blob *pBlob, unsigned int newSize){
+  BlobArenaChunk *pChunk = blobArena.pChunk;
+  char *pNew;
+  if( newSize==0 ){
+    if( blob_arena_is_top(pBlob) ) pChunk->nUsed -= pBlob->nAlloc;
+    pBlob->nUsed = 0;
+    pBlob->nAlloc = 0;
+    pBlob->aData = 0;
+    pBlob->iCursor = 0;
+    if( blobArena.nScope==0 ) pBlob->xRealloc = blobReallocMalloc;
+    return;
+  }
+  if( newSize<=pBlob->nAlloc ){
+    if( pBlob->nUsed>newSize ) pBlob->nUsed = newSize;
+    return;
+  }
+  if( blobArena.nScope==0 || newSize>BLOB_ARENA_MAXBLOB ){
+    pNew = fossil_malloc(newSize);
+    if( pBlob->nUsed ) memcpy(pNew, pBlob->aData, pBlob->nUsed);
+    pBlob->aData = pNew;
+    pBlob->nAlloc = newSize;
+    pBlob->xRealloc = blobReallocMalloc;
+    return;
+  }
+  if( blob_arena_is_top(pBlob)
+   && pChunk->nUsed+(newSize-pBlob->nAlloc)<=BLOB_ARENA_CHUNK
+  ){
+    pChunk->nUsed += newSize - pBlob->nAlloc;
+    pBlob->nAlloc = newSize;
+    return;
+  }
+  if( pChunk==0 || pChunk->nUsed+newSize>BLOB_ARENA_CHUNK ){
+    pChunk = fossil_malloc(sizeof(*pChunk));
+    pChunk->pPrev = blobArena.pChunk;
+    pChunk->nUsed = 0;
+    blobArena.pChunk = pChunk;
+  }
+  pNew = &pChunk->a[pChunk->nUsed];
+  pChunk->nUsed += newSize;
+  if( pBlob->nUsed ) memcpy(pNew, pBlob->aData, pBlob->nUsed);
+  pBlob->aData = pNew;
+  pBlob->nAlloc = newSize;
+}
+
+/*
+** Initialize a blob to an empty string whose content will be held in
+** the current arena.  See the discussion of arena blobs above.
+*/
+void blob_zero_arena(Blob *pBlob){
+  blob_zero(pBlob);
+  if( blobArena.nScope>0 ) pBlob->xRealloc = blobReallocArena;
+}
+
 /*
 ** Reset a blob to be an empty container.
 */
@@ -254,6 +404,24 @@ void blob_append(Blob *pBlob, const char *aData, int nData){
   pBlob->aData[pBlob->nUsed] = 0;   /* Blobs are always nul-terminated */
 }
 
+/*
+** Extend a blob by nData bytes and return a pointer to the new bytes,
+** for the caller to fill in.  The blob grows in the same way as for
+** blob_append(), so that many small extensions are cheap.
+*/
+char *blob_append_space(Blob *pBlob, int nData){
+  blob_is_init(pBlob);
+  if( pBlob->nUsed + nData >= pBlob->nAlloc ){
+    pBlob->xRealloc(pBlob, pBlob->nUsed + nData + pBlob->nAlloc + 100);
+    if( pBlob->nUsed + nData >= pBlob->nAlloc ){
+      blob_panic();
+    }
+  }
+  pBlob->nUsed += nData;
+  pBlob->aData[pBlob->nUsed] = 0;
+  return &pBlob->aData[pBlob->nUsed - nData];
+}
+
 /*
 ** Copy a blob
 */
@@ -376,6 +544,17 @@ void blob_resize(Blob *pBlob, unsigned int newSize){
   pBlob->aData[newSize] = 0;
 }
 
+/*
+** Truncate a blob to its first n bytes, keeping its buffer so that the
+** space can be reused by later appends.
+*/
+void blob_truncate(Blob *pBlob, int n){
+  if( n<(int)pBlob->nUsed ){
+    pBlob->nUsed = n;
+    pBlob->aData[n] = 0;
+  }
+}
+
 /*
 ** Make sure a blob is nul-terminated and is not a pointer to unmanaged
 ** space.  Return a pointer to the
@@ -385,6 +564,18 @@ char *blob_materialize(Blob *pBlob){
   return pBlob->aData;
 }
 
+/*
+** Return true if pBlob is ephemeral.  An ephemeral blob borrows its
+** content from memory it does not own, as set up by blob_init(),
+** blob_extract(), or db_ephemeral_blob(), and the content becomes
+** invalid when the owner releases that memory.  Reading from an
+** ephemeral blob is free; the first change made to it, or a call to
+** blob_materialize(), copies the content into memory the blob owns.
+*/
+int blob_is_ephemeral(Blob *pBlob){
+  return pBlob->xRealloc==blobReallocStatic && pBlob->nUsed>0;
+}
+
 
 /*
 ** Call dehttpize on a blob.  This causes an ephemeral blob to be
@@ -815,6 +1006,10 @@ int blob_write_to_file(Blob *pBlob, const char *zFilename){
         zName[i] = '/';
       }
     }
+    if( file_unshare(zName) ){
+      fossil_fatal_recursive("unable to copy \"%s\" out of the cache", zName);
+      return 0;
+    }
     out = fossil_fopen(zName, "wb");
     if( out==0 ){
       fossil_fatal_recursive("unable to open file \"%s\" for writing", zName);
@@ -832,28 +1027,106 @@ int blob_write_to_file(Blob *pBlob, const char *zFilename){
   return wrote;
 }
 
+/*
+** Compressed content always begins with the size of the uncompressed
+** content as a 4-byte big-endian integer.  In the legacy format, a zlib
+** stream follows.  Otherwise a Zstandard frame follows, recognized by
+** its magic number.  The first two bytes of that magic number do not
+** form a valid zlib stream header, so the two formats cannot be
+** confused and content of both kinds can live in the same repository.
+*/
+static const unsigned char aZstdMagic[4] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+/*
+** Return true if the n bytes of compressed data at z (not counting the
+** size prefix) are a Zstandard frame.
+*/
+static int blob_is_zstd_frame(const unsigned char *z, unsigned int n){
+  return n>=4 && memcmp(z, aZstdMagic, 4)==0;
+}
+
+/*
+** Return true if this build of fossil is able to read and write
+** Zstandard compressed content.
+*/
+int blob_have_zstd(void){
+#ifdef FOSSIL_ENABLE_ZSTD
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+/*
+** Return the BLOB_COMPRESS_* method used for the compressed blob pIn.
+*/
+int blob_compress_method(Blob *pIn){
+  if( blob_size(pIn)>4
+   && blob_is_zstd_frame((unsigned char*)blob_buffer(pIn)+4, blob_size(pIn)-4)
+  ){
+    return BLOB_COMPRESS_ZSTD;
+  }
+  return BLOB_COMPRESS_ZLIB;
+}
+
 /*
 ** Compress a blob pIn.  Store the result in pOut.  It is ok for pIn and
 ** pOut to be the same blob. 
 ** 
 ** pOut must either be the same as pIn or else uninitialized.
+**
+** The result is always in the legacy zlib format, which every version
+** of fossil understands.  Use this for anything sent over the wire.
 */
 void blob_compress(Blob *pIn, Blob *pOut){
+  blob_compress_ex(pIn, pOut, BLOB_COMPRESS_ZLIB, 0);
+}
+
+/*
+** Compress pIn into pOut using the BLOB_COMPRESS_* method eMethod at
+** compression level iLevel.  An iLevel of zero or less selects the
+** default level for the method: Z_DEFAULT_COMPRESSION for zlib, the
+** level of compress() used by older versions, and 3 for zstd.  If this build does not support
+** eMethod, zlib is used instead.
+**
+** pOut must either be the same as pIn or else uninitialized.
+*/
+void blob_compress_ex(Blob *pIn, Blob *pOut, int eMethod, int iLevel){
   unsigned int nIn = blob_size(pIn);
-  unsigned int nOut = 13 + nIn + (nIn+999)/1000;
+  unsigned int nOut;
   unsigned long int nOut2;
   unsigned char *outBuf;
   Blob temp;
   blob_zero(&temp);
+#ifdef FOSSIL_ENABLE_ZSTD
+  if( eMethod==BLOB_COMPRESS_ZSTD ){
+    size_t nZ;
+    nOut = ZSTD_compressBound(nIn);
+    blob_resize(&temp, nOut+4);
+    outBuf = (unsigned char*)blob_buffer(&temp);
+    nZ = ZSTD_compress(&outBuf[4], nOut, blob_buffer(pIn), nIn,
+                       iLevel>0 ? iLevel : 3);
+    if( !ZSTD_isError(nZ) ){
+      nOut2 = nZ;
+      goto compress_done;
+    }
+    blob_reset(&temp);
+  }
+#endif
+  if( iLevel<=0 || iLevel>9 ) iLevel = Z_DEFAULT_COMPRESSION;
+  nOut = 13 + nIn + (nIn+999)/1000;
   blob_resize(&temp, nOut+4);
   outBuf = (unsigned char*)blob_buffer(&temp);
+  nOut2 = (long int)nOut;
+  compress2(&outBuf[4], &nOut2,
+            (unsigned char*)blob_buffer(pIn), blob_size(pIn), iLevel);
+#ifdef FOSSIL_ENABLE_ZSTD
+compress_done:
+#endif
   outBuf[0] = nIn>>24 & 0xff;
   outBuf[1] = nIn>>16 & 0xff;
   outBuf[2] = nIn>>8 & 0xff;
   outBuf[3] = nIn & 0xff;
-  nOut2 = (long int)nOut;
-  compress(&outBuf[4], &nOut2,
-           (unsigned char*)blob_buffer(pIn), blob_size(pIn));
   if( pOut==pIn ) blob_reset(pOut);
   assert_blob_is_reset(pOut);
   *pOut = temp;
@@ -945,8 +1218,19 @@ int blob_uncompress(Blob *pIn, Blob *pOut){
   blob_zero(&temp);
   blob_resize(&temp, nOut+1);
   nOut2 = (long int)nOut;
-  rc = uncompress((unsigned char*)blob_buffer(&temp), &nOut2, 
-                  &inBuf[4], nIn - 4);
+  if( blob_is_zstd_frame(&inBuf[4], nIn-4) ){
+#ifdef FOSSIL_ENABLE_ZSTD
+    size_t nZ = ZSTD_decompress(blob_buffer(&temp), nOut, &inBuf[4], nIn-4);
+    rc = ZSTD_isError(nZ) ? Z_DATA_ERROR : Z_OK;
+    nOut2 = nZ;
+#else
+    fossil_fatal("content is compressed using zstd, which this build "
+                 "of fossil does not support");
+#endif
+  }else{
+    rc = uncompress((unsigned char*)blob_buffer(&temp), &nOut2, 
+                    &inBuf[4], nIn - 4);
+  }
   if( rc!=Z_OK ){
     blob_reset(&temp);
     return 1;
@@ -958,6 +1242,277 @@ int blob_uncompress(Blob *pIn, Blob *pOut){
   return 0;
 }
 
+/*
+** Uncompress content in the format generated by blob_compress() a piece
+** at a time, never holding more than a small piece of the input or the
+** output in memory.
+**
+** Compressed input is obtained by calling xRead(pArg, zBuf, N), which
+** should copy up to N bytes of the next part of the input into zBuf
+** and return the number of bytes copied, or 0 at the end of input.
+** Output is delivered by calls to xWrite(pOutArg, zBuf, N).  The first
+** call to xWrite has a NULL zBuf and gives the expected size of the
+** whole output in N, so that space can be allocated in advance.
+**
+** Return the number of bytes written, or -1 if the input is malformed.
+** Output may already have been written when an error is detected, but
+** never more than the size announced by the first call to xWrite.
+*/
+int blob_uncompress_incr(
+  int (*xRead)(void*, unsigned char*, int),        /* Compressed input */
+  void *pArg,                                      /* Argument to xRead */
+  void (*xWrite)(void*, const unsigned char*, int),/* Receives output */
+  void *pOutArg                                    /* Argument to xWrite */
+){
+  unsigned char aIn[4096];
+  unsigned char aOut[16384];
+  unsigned int nOut;
+  int nIn;
+  i64 nWritten = 0;
+  int rc = Z_OK;
+
+  if( xRead(pArg, aIn, 4)!=4 ) return -1;
+  nOut = (aIn[0]<<24) + (aIn[1]<<16) + (aIn[2]<<8) + aIn[3];
+  if( nOut>0x7fffffff ) return -1;
+  xWrite(pOutArg, 0, (int)nOut);
+  nIn = xRead(pArg, aIn, sizeof(aIn));
+  if( blob_is_zstd_frame(aIn, nIn) ){
+#ifdef FOSSIL_ENABLE_ZSTD
+    ZSTD_DStream *pZ = ZSTD_createDStream();
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer zOut;
+    size_t r = 1;
+    if( pZ==0 ) return -1;
+    ZSTD_initDStream(pZ);
+    while( nIn>0 && r!=0 ){
+      in.src = aIn;
+      in.size = nIn;
+      in.pos = 0;
+      do{
+        zOut.dst = aOut;
+        zOut.size = sizeof(aOut);
+        zOut.pos = 0;
+        r = ZSTD_decompressStream(pZ, &zOut, &in);
+        if( ZSTD_isError(r) || nWritten+zOut.pos>nOut ){
+          ZSTD_freeDStream(pZ);
+          return -1;
+        }
+        xWrite(pOutArg, aOut, (int)zOut.pos);
+        nWritten += zOut.pos;
+      }while( r!=0 && (in.pos<in.size || zOut.pos==zOut.size) );
+      nIn = xRead(pArg, aIn, sizeof(aIn));
+    }
+    ZSTD_freeDStream(pZ);
+    if( r!=0 ) rc = Z_DATA_ERROR;
+#else
+    return -1;
+#endif
+  }else{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if( inflateInit(&stream)!=Z_OK ) return -1;
+    while( nIn>0 && rc!=Z_STREAM_END ){
+      stream.avail_in = nIn;
+      stream.next_in = aIn;
+      do{
+        stream.avail_out = sizeof(aOut);
+        stream.next_out = aOut;
+        rc = inflate(&stream, Z_NO_FLUSH);
+        if( rc!=Z_OK && rc!=Z_STREAM_END && rc!=Z_BUF_ERROR ){
+          inflateEnd(&stream);
+          return -1;
+        }
+        if( stream.avail_out<sizeof(aOut) ){
+          int n = sizeof(aOut) - stream.avail_out;
+          if( nWritten+n>nOut ){
+            inflateEnd(&stream);
+            return -1;
+          }
+          xWrite(pOutArg, aOut, n);
+          nWritten += n;
+        }
+      }while( stream.avail_out==0 && rc!=Z_STREAM_END );
+      nIn = xRead(pArg, aIn, sizeof(aIn));
+    }
+    inflateEnd(&stream);
+    rc = rc==Z_STREAM_END ? Z_OK : Z_DATA_ERROR;
+  }
+  if( rc!=Z_OK || nWritten!=nOut ) return -1;
+  return (int)nWritten;
+}
+
+/*
+** Read channel in to its end and write its content on channel out,
+** compressed with zlib at level iLevel, or the default level if iLevel
+** is 0, in the format generated by blob_compress().  Only a small piece of the input and of the output
+** is in memory at any time.  Each piece of the input is also passed
+** to xStep(pArg, z, n), if xStep is not NULL, so that the caller can
+** compute a hash of the content in the same pass.
+**
+** The size prefix is written last, so channel out must be seekable.
+** It is left positioned at the end of the output.  Return the size of
+** the input, or -1 on an I/O error or if the input is too large for
+** the format.
+*/
+i64 blob_compress_channel(
+  FILE *in,                                   /* Read content from here */
+  FILE *out,                                  /* Write compressed content */
+  int iLevel,                                 /* zlib compression level */
+  void (*xStep)(void*, const char*, int),     /* Also receives the input */
+  void *pArg                                  /* First argument to xStep */
+){
+  unsigned char *aIn, *aOut;
+  const int nBuf = 65536;
+  unsigned char aHdr[4];
+  z_stream stream;
+  long iStart;
+  i64 nIn = 0;
+  int flush;
+  int rc = 0;
+
+  if( iLevel<=0 || iLevel>9 ) iLevel = Z_DEFAULT_COMPRESSION;
+  memset(&stream, 0, sizeof(stream));
+  if( deflateInit(&stream, iLevel)!=Z_OK ) return -1;
+  aIn = fossil_malloc(nBuf*2);
+  aOut = &aIn[nBuf];
+  iStart = ftell(out);
+  memset(aHdr, 0, sizeof(aHdr));
+  if( iStart<0 || fwrite(aHdr, 1, 4, out)!=4 ) rc = 1;
+  do{
+    int n = (int)fread(aIn, 1, nBuf, in);
+    flush = (feof(in) || ferror(in)) ? Z_FINISH : Z_NO_FLUSH;
+    if( n>0 && xStep ) xStep(pArg, (const char*)aIn, n);
+    nIn += n;
+    stream.next_in = aIn;
+    stream.avail_in = n;
+    do{
+      int nOut;
+      stream.next_out = aOut;
+      stream.avail_out = nBuf;
+      deflate(&stream, flush);
+      nOut = nBuf - stream.avail_out;
+      if( nOut>0 && fwrite(aOut, 1, nOut, out)!=(size_t)nOut ) rc = 1;
+    }while( stream.avail_out==0 );
+  }while( flush!=Z_FINISH && rc==0 );
+  deflateEnd(&stream);
+  fossil_free(aIn);
+  if( rc || ferror(in) || nIn>0x7fffffff ) return -1;
+  aHdr[0] = nIn>>24 & 0xff;
+  aHdr[1] = nIn>>16 & 0xff;
+  aHdr[2] = nIn>>8 & 0xff;
+  aHdr[3] = nIn & 0xff;
+  if( fseek(out, iStart, SEEK_SET)
+   || fwrite(aHdr, 1, 4, out)!=4
+   || fseek(out, 0, SEEK_END)
+   || fflush(out)
+  ){
+    return -1;
+  }
+  return nIn;
+}
+
+/*
+** State of a blob_read_uncompressed() operation.
+*/
+typedef struct BlobChannelIn BlobChannelIn;
+struct BlobChannelIn {
+  FILE *in;                /* Read from this channel */
+  int nLeft;               /* Bytes of compressed input not yet read */
+};
+
+/*
+** xRead callback for blob_uncompress_incr() that reads from a channel.
+*/
+static int blob_incr_from_channel(void *pArg, unsigned char *z, int n){
+  BlobChannelIn *p = (BlobChannelIn*)pArg;
+  if( n>p->nLeft ) n = p->nLeft;
+  if( n<=0 ) return 0;
+  n = (int)fread(z, 1, n, p->in);
+  p->nLeft -= n;
+  return n;
+}
+
+/*
+** xWrite callback for blob_uncompress_incr() that appends to a blob.
+*/
+static void blob_incr_to_blob(void *pArg, const unsigned char *z, int n){
+  Blob *pBlob = (Blob*)pArg;
+  if( z ){
+    blob_append(pBlob, (const char*)z, n);
+  }else if( n>0 ){
+    blob_resize(pBlob, n);
+    blob_truncate(pBlob, 0);
+  }
+}
+
+/*
+** Read nToRead bytes of content in the format generated by
+** blob_compress() from channel in, and store the uncompressed content
+** in pOut.  The input is uncompressed as it is read, so that only the
+** output is ever held in memory in full, rather than the output plus
+** a complete copy of the compressed input as with
+** blob_read_from_channel() followed by blob_uncompress().
+**
+** All nToRead bytes are consumed even if the input is malformed, so
+** that the channel is ready for whatever follows.  pOut must be
+** uninitialized.  Return non-zero if the input is malformed, in which
+** case pOut is left empty.
+*/
+int blob_read_uncompressed(Blob *pOut, FILE *in, int nToRead){
+  BlobChannelIn x;
+  int rc = 0;
+  unsigned char zSkip[4096];
+  x.in = in;
+  x.nLeft = nToRead;
+  blob_zero(pOut);
+  if( blob_uncompress_incr(blob_incr_from_channel, &x,
+                           blob_incr_to_blob, pOut)<0 ){
+    blob_reset(pOut);
+    rc = 1;
+  }
+  while( blob_incr_from_channel(&x, zSkip, sizeof(zSkip))>0 ){}
+  return rc;
+}
+
+/*
+** Uncompress a zlib stream pIn that has no size prefix, such as the
+** body of an "application/x-fossil-stream" reply, and store the result
+** in pOut.  It is ok for pIn and pOut to be the same blob.  Return
+** non-zero if pIn is malformed.
+**
+** pOut must be either uninitialized or the same as pIn.
+*/
+int blob_uncompress_stream(Blob *pIn, Blob *pOut){
+  z_stream stream;
+  Blob temp;
+  int rc;
+  unsigned int nOut;
+
+  blob_zero(&temp);
+  memset(&stream, 0, sizeof(stream));
+  if( inflateInit(&stream)!=Z_OK ) return 1;
+  stream.avail_in = blob_size(pIn);
+  stream.next_in = (unsigned char*)blob_buffer(pIn);
+  nOut = blob_size(pIn)*4 + 1000;
+  do{
+    blob_resize(&temp, nOut);
+    stream.avail_out = nOut - stream.total_out;
+    stream.next_out = (unsigned char*)blob_buffer(&temp) + stream.total_out;
+    rc = inflate(&stream, Z_NO_FLUSH);
+    nOut *= 2;
+  }while( rc==Z_OK || (rc==Z_BUF_ERROR && stream.avail_out==0) );
+  inflateEnd(&stream);
+  if( rc!=Z_STREAM_END ){
+    blob_reset(&temp);
+    return 1;
+  }
+  blob_resize(&temp, stream.total_out);
+  if( pOut==pIn ) blob_reset(pOut);
+  assert_blob_is_reset(pOut);
+  *pOut = temp;
+  return 0;
+}
+
 /*
 ** COMMAND: test-uncompress
 */
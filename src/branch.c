@@ -179,6 +179,115 @@ void branch_new(void){
   if( !isPrivate ) autosync(AUTOSYNC_PUSH);
 }
 
+/*
+** The BRANCH_SUMMARY table has one row for each branch name, with the
+** most recent check-in on the branch and whether or not the branch is
+** closed.  A branch is closed if none of its leaves are open.  The table
+** is derived from LEAF and TAGXREF so that lists of branches do not have
+** to scan every branch tag in the repository.  It is created the first
+** time branches are listed and is kept up to date by
+** branch_summary_update() whenever the LEAF table changes.
+*/
+static const char zBranchSummarySchema[] =
+@ CREATE TABLE IF NOT EXISTS %s.branch_summary(
+@   name TEXT PRIMARY KEY,         -- Name of the branch
+@   rid INTEGER,                   -- Most recent check-in on the branch
+@   mtime DATETIME,                -- Time of that check-in
+@   isclosed BOOLEAN               -- True if the branch has no open leaves
+@ );
+@ CREATE INDEX IF NOT EXISTS %s.branch_summary_i1 ON branch_summary(rid);
+;
+
+/*
+** Return true if the BRANCH_SUMMARY table exists.
+*/
+static int branch_summary_exists(void){
+  return db_exists("SELECT 1 FROM %s.sqlite_master"
+                   " WHERE name='branch_summary'", db_name("repository"));
+}
+
+/*
+** Compute the BRANCH_SUMMARY rows for the branch names in the one-column
+** table or subquery zNames, or for all branches if zNames is NULL.
+*/
+static void branch_summary_fill(const char *zNames){
+  char *zIn = zNames ? mprintf("AND tagxref.value IN (%s)", zNames)
+                     : mprintf("");
+  db_multi_exec(
+    "INSERT INTO branch_summary(name,rid,mtime,isclosed)"
+    " SELECT tagxref.value, tagxref.rid, max(event.mtime), 1"
+    "   FROM tagxref LEFT JOIN event ON event.objid=tagxref.rid"
+    "  WHERE tagxref.tagid=%d AND tagxref.value NOT NULL %s"
+    "  GROUP BY tagxref.value;"
+    "UPDATE branch_summary SET isclosed=0"
+    " WHERE name IN (SELECT tagxref.value FROM leaf, tagxref"
+    "                 WHERE tagxref.rid=leaf.rid AND tagxref.tagid=%d"
+    "                   AND NOT %z %s);",
+    TAG_BRANCH, zIn, TAG_BRANCH, leaf_is_closed_sql("leaf.rid"), zIn
+  );
+  fossil_free(zIn);
+}
+
+/*
+** Bring the BRANCH_SUMMARY table up to date after the leaf status of
+** every check-in in the one-column table or subquery zRids has been
+** checked.  The branches recomputed are those of the check-ins in zRids
+** together with any branch whose most recent check-in is in zRids, in
+** case that check-in has since moved to a different branch.
+**
+** Nothing is done if the table has not been created yet.  The
+** branch_pending table is created by manifest_crosslink_begin() when
+** this runs as part of a crosslink batch.
+*/
+void branch_summary_update(const char *zRids){
+  if( !branch_summary_exists() ) return;
+  db_multi_exec(
+    "CREATE TEMP TABLE IF NOT EXISTS branch_pending(name TEXT PRIMARY KEY);"
+    "DELETE FROM branch_pending;"
+    "INSERT OR IGNORE INTO branch_pending"
+    " SELECT value FROM tagxref"
+    "  WHERE tagid=%d AND value NOT NULL AND rid IN (%s);"
+    "INSERT OR IGNORE INTO branch_pending"
+    " SELECT name FROM branch_summary WHERE rid IN (%s);"
+    "DELETE FROM branch_summary WHERE name IN branch_pending;",
+    TAG_BRANCH, zRids, zRids
+  );
+  branch_summary_fill("SELECT name FROM branch_pending");
+  db_multi_exec("DELETE FROM branch_pending");
+}
+
+/*
+** Recompute the entire BRANCH_SUMMARY table, if it exists.
+*/
+void branch_summary_rebuild(void){
+  if( !branch_summary_exists() ) return;
+  db_multi_exec("DELETE FROM branch_summary");
+  branch_summary_fill(0);
+}
+
+/*
+** Create and fill the BRANCH_SUMMARY table if it does not already exist.
+** Return true if the table is available.  This might fail for a
+** read-only repository, in which case the caller must compute the
+** branches the slow way.
+*/
+static int branch_summary_ensure(void){
+  const char *zDb = db_name("repository");
+  char *zSql;
+  if( branch_summary_exists() ) return 1;
+  db_begin_transaction();
+  zSql = mprintf(zBranchSummarySchema, zDb, zDb);
+  db_multi_exec_ignore_error(zSql, 0);
+  fossil_free(zSql);
+  if( branch_summary_exists() ){
+    branch_summary_fill(0);
+    db_end_transaction(0);
+    return 1;
+  }
+  db_end_transaction(0);
+  return 0;
+}
+
 /*
 ** Prepare a query that will list branches.
 **
@@ -187,7 +296,14 @@ void branch_new(void){
 ** branches. Else the query pulls currently-opened branches.
 */
 void branch_prepare_list_query(Stmt *pQuery, int which ){
-  if( which < 0 ){
+  if( branch_summary_ensure() ){
+    db_prepare(pQuery,
+      "SELECT name FROM branch_summary"
+      " WHERE %s"
+      " ORDER BY name COLLATE nocase /*sort*/",
+      which<0 ? "isclosed" : which>0 ? "1" : "NOT isclosed"
+    );
+  }else if( which < 0 ){
     db_prepare(pQuery,
       "SELECT value FROM tagxref"
       " WHERE tagid=%d AND value NOT NULL "
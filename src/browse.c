@@ -95,6 +95,98 @@ void hyperlinked_path(const char *zPath, Blob *pOut, const char *zCI){
   }
 }
 
+/*
+** The DIRCACHE table holds the directory listings of check-ins that
+** have been shown by the "dir" page, one row for each file or
+** subdirectory of each directory.  A listing never changes once
+** made, since a check-in never changes, so the manifest of a large
+** check-in is parsed only the first time one of its directories is
+** shown.  The table is cleared once it grows to DIRCACHE_MAX_ROWS.
+*/
+static const char zDircacheSchema[] =
+@ CREATE TABLE IF NOT EXISTS %s.dircache(
+@   vid INTEGER,         -- The check-in
+@   dir TEXT,            -- Directory name.  Empty string for the top level
+@   x TEXT,              -- File name, or "/" and the subdirectory name
+@   u TEXT,              -- UUID of the file.  NULL for a subdirectory
+@   PRIMARY KEY(vid,dir,x)
+@ );
+;
+#define DIRCACHE_MAX_ROWS 1000000
+
+/*
+** Make sure the DIRCACHE table holds the directory listings of the
+** check-in vid.  Return true on success, or false if the listings are
+** not cached and the repository is read-only, so that they cannot be
+** added.  Nothing is written to a read-only repository.
+*/
+static int dircache_fill(int vid){
+  const char *zDb = db_name("repository");
+  Manifest *pM;
+  ManifestFile *pFile;
+  const char *zPrev = "";
+  Blob x;
+  Stmt ins;
+  char *zSql;
+
+  if( db_exists("SELECT 1 FROM %s.sqlite_master WHERE name='dircache'",
+                zDb) ){
+    if( db_exists("SELECT 1 FROM dircache WHERE vid=%d", vid) ) return 1;
+  }
+  if( sqlite3_db_readonly(g.db, zDb)!=0 ) return 0;
+  zSql = mprintf(zDircacheSchema, zDb);
+  db_multi_exec("%s", zSql);
+  fossil_free(zSql);
+  pM = manifest_get(vid, CFTYPE_MANIFEST);
+  if( pM==0 ) return 0;
+  db_begin_transaction();
+  if( db_int(0, "SELECT count(*) FROM dircache")>=DIRCACHE_MAX_ROWS ){
+    db_multi_exec("DELETE FROM dircache");
+  }
+  db_prepare(&ins,
+    "INSERT OR IGNORE INTO dircache(vid,dir,x,u)"
+    " VALUES(%d,substr(:name,1,:ndir),:x,:u)", vid
+  );
+  blob_zero(&x);
+  manifest_file_rewind(pM);
+  while( (pFile = manifest_file_next(pM,0))!=0 ){
+    const char *zName = pFile->zName;
+    int i, iDir = 0, nSame = 0;
+
+    /* Files are in sorted order, so only the directories that are not
+    ** also directories of the previous file are new. */
+    for(i=0; zName[i] && zName[i]==zPrev[i]; i++){
+      if( zName[i]=='/' ) nSame = i+1;
+    }
+    for(i=0; zName[i]; i++){
+      if( zName[i]!='/' ) continue;
+      if( i>=nSame ){
+        blob_truncate(&x, 0);
+        blob_appendf(&x, "/%.*s", i-iDir, &zName[iDir]);
+        db_bind_text(&ins, ":name", zName);
+        db_bind_int(&ins, ":ndir", iDir>0 ? iDir-1 : 0);
+        db_bind_str(&ins, ":x", &x);
+        db_bind_null(&ins, ":u");
+        db_step(&ins);
+        db_reset(&ins);
+      }
+      iDir = i+1;
+    }
+    db_bind_text(&ins, ":name", zName);
+    db_bind_int(&ins, ":ndir", iDir>0 ? iDir-1 : 0);
+    db_bind_text(&ins, ":x", &zName[iDir]);
+    db_bind_text(&ins, ":u", pFile->zUuid);
+    db_step(&ins);
+    db_reset(&ins);
+    zPrev = zName;
+  }
+  db_finalize(&ins);
+  db_end_transaction(0);
+  blob_reset(&x);
+  manifest_destroy(pM);
+  return 1;
+}
+
 
 /*
 ** WEBPAGE: dir
@@ -129,13 +221,14 @@ void page_dir(void){
   /* If the name= parameter is an empty string, make it a NULL pointer */
   if( zD && strlen(zD)==0 ){ zD = 0; }
 
-  /* If a specific check-in is requested, fetch and parse it.  If the
+  /* If a specific check-in is requested, find it.  Its manifest is
+  ** only parsed if its listings are not in the DIRCACHE table.  If the
   ** specific check-in does not exist, clear zCI.  zCI==0 will cause all
   ** files from all check-ins to be displayed.
   */
   if( zCI ){
-    pM = manifest_get_by_name(zCI, &rid);
-    if( pM ){
+    rid = symbolic_name_to_rid(zCI, "ci");
+    if( rid>0 && is_a_version(rid) ){
       zUuid = db_text(0, "SELECT uuid FROM blob WHERE rid=%d", rid);
     }else{
       zCI = 0;
@@ -201,13 +294,20 @@ void page_dir(void){
      "CREATE TEMP TABLE localfiles(x UNIQUE NOT NULL %s, u);",
      filename_collation()
   );
-  if( zCI ){
+  if( zCI && dircache_fill(rid) ){
+    db_multi_exec(
+      "INSERT OR IGNORE INTO localfiles"
+      " SELECT x, u FROM dircache WHERE vid=%d AND dir=%Q ORDER BY x",
+      rid, zD ? zD : ""
+    );
+  }else if( zCI ){
     Stmt ins;
     ManifestFile *pFile;
     ManifestFile *pPrev = 0;
     int nPrev = 0;
     int c;
 
+    pM = manifest_get_by_name(zCI, &rid);
     db_prepare(&ins,
        "INSERT OR IGNORE INTO localfiles VALUES(pathelement(:x,0), :u)"
     );
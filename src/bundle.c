@@ -0,0 +1,454 @@
+/*
+** Copyright (c) 2012 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*******************************************************************************
+**
+** This file implements the "bundle" command, which writes the artifacts
+** of a repository into a single file for backup and reads them back.
+**
+** A bundle is written from start to finish in one pass.  It uses the
+** same cards as the sync protocol, so artifacts are copied exactly as
+** they are stored, still compressed and still as deltas:
+**
+**     fossil-bundle 1 PROJECT-CODE SINCE LAST
+**     cfile UUID USIZE CSIZE \n CONTENT
+**     cfile UUID DELTASRC USIZE CSIZE \n CONTENT
+**     private
+**     ...
+**     index N
+**     UUID OFFSET
+**     ...
+**     end OFFSET
+**
+** The header holds the project code of the repository and the range of
+** received-from IDs (blob.rcvid) that the bundle covers: everything
+** received after SINCE up to and including LAST.  A full bundle has a
+** SINCE of 0 and holds every artifact, even those that came from
+** "fossil import" and have no rcvid.  A "private" card marks the next
+** artifact as private.  The trailer has one line for each of the N
+** artifacts, giving the byte offset of its cfile card, and then the
+** offset of the "index" card.  A bundle without a trailer is
+** incomplete and is never used.
+**
+** An incremental bundle starts where a previous bundle ended, so a
+** full bundle followed by its incremental bundles holds every artifact
+** of the repository.
+*/
+#include "config.h"
+#include "bundle.h"
+
+/*
+** Read one line of text from in into pLine, not including the
+** newline.  Return false at the end of the file.
+*/
+static int bundle_read_line(FILE *in, Blob *pLine){
+  int c;
+  blob_reset(pLine);
+  while( (c = getc(in))!=EOF && c!='\n' ){
+    char x = (char)c;
+    blob_append(pLine, &x, 1);
+  }
+  return c!=EOF || blob_size(pLine)>0;
+}
+
+/*
+** Read the header of the bundle in file in.  Write the project code
+** into pProject, and return the SINCE and LAST values of the header in
+** *piSince and *piLast.  piSince may be NULL.  Fail if the file is not
+** a bundle.
+*/
+static void bundle_read_header(
+  FILE *in,              /* The bundle */
+  const char *zName,     /* Name of the bundle, for error messages */
+  Blob *pProject,        /* Write the project code here */
+  int *piSince,          /* Write the SINCE value here, if not NULL */
+  int *piLast            /* Write the LAST value here */
+){
+  Blob line, aToken[5];
+  int iSince;
+  blob_zero(&line);
+  if( !bundle_read_line(in, &line)
+   || blob_tokenize(&line, aToken, 5)!=5
+   || !blob_eq(&aToken[0], "fossil-bundle")
+   || !blob_eq(&aToken[1], "1")
+   || !blob_is_int(&aToken[3], &iSince)
+   || !blob_is_int(&aToken[4], piLast)
+  ){
+    fossil_fatal("not a bundle: %s", zName);
+  }
+  if( piSince ) *piSince = iSince;
+  blob_zero(pProject);
+  blob_append(pProject, blob_buffer(&aToken[2]), blob_size(&aToken[2]));
+  blob_reset(&line);
+}
+
+/*
+** Fail unless the bundle in file in ends with a complete trailer.
+*/
+static void bundle_check_trailer(FILE *in, const char *zName){
+  char zBuf[100];
+  long sz;
+  int i, n;
+  fseek(in, 0, SEEK_END);
+  sz = ftell(in);
+  n = sz<(long)sizeof(zBuf)-1 ? (int)sz : (int)sizeof(zBuf)-1;
+  fseek(in, sz-n, SEEK_SET);
+  n = fread(zBuf, 1, n, in);
+  zBuf[n] = 0;
+  for(i=n-2; i>=0 && zBuf[i]!='\n'; i--){}
+  if( n<1 || zBuf[n-1]!='\n' || strncmp(&zBuf[i+1], "end ", 4)!=0 ){
+    fossil_fatal("bundle is incomplete: %s", zName);
+  }
+  fseek(in, 0, SEEK_SET);
+}
+
+/*
+** Write a bundle of every artifact received after iSince into the
+** file zFile.  Private artifacts are included only if bPrivate is true.
+** A full bundle, with an iSince of 0, has every artifact whatever its
+** rcvid, including those of "fossil import" that have none.
+*/
+static void bundle_export(const char *zFile, int iSince, int bPrivate){
+  FILE *out;
+  Stmt q;
+  Blob hdr;              /* Text of a card */
+  Blob index;            /* Lines of the trailer */
+  i64 iOffset = 0;       /* Bytes written so far */
+  int nArtifact = 0;     /* Number of artifacts written */
+  int iLast;             /* Last rcvid covered by this bundle */
+  char *zRange = 0;      /* SQL that limits an incremental bundle */
+
+  db_begin_transaction();
+  iLast = db_int(0, "SELECT max(rcvid) FROM blob");
+  if( iLast<iSince ) iLast = iSince;
+  if( iSince>0 ){
+    zRange = mprintf("AND blob.rcvid>%d AND blob.rcvid<=%d", iSince, iLast);
+  }
+  out = fossil_fopen(zFile, "wb");
+  if( out==0 ){
+    fossil_fatal("cannot open \"%s\" for writing", zFile);
+  }
+  blob_zero(&hdr);
+  blob_zero(&index);
+  blob_appendf(&hdr, "fossil-bundle 1 %s %d %d\n",
+               db_get("project-code", ""), iSince, iLast);
+  db_prepare(&q,
+    "SELECT blob.rid, blob.uuid, blob.size, blob.content,"
+    "       src.uuid, src.size,"
+    "       blob.rid IN private, delta.srcid IN private,"
+    "       EXISTS(SELECT 1 FROM shun WHERE shun.uuid=src.uuid)"
+    "  FROM blob LEFT JOIN delta ON delta.rid=blob.rid"
+    "            LEFT JOIN blob AS src ON src.rid=delta.srcid"
+    " WHERE blob.size>=0 %z"
+    "   AND NOT EXISTS(SELECT 1 FROM shun WHERE shun.uuid=blob.uuid)"
+    " ORDER BY blob.rid",
+    zRange
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    int rid = db_column_int(&q, 0);
+    const char *zUuid = db_column_text(&q, 1);
+    int szU = db_column_int(&q, 2);
+    const char *zSrc = db_column_text(&q, 4);
+    int isPriv = db_column_int(&q, 6);
+    Blob content;
+
+    if( isPriv && !bPrivate ) continue;
+    if( (zSrc && (db_column_int(&q, 5)<0
+                  || (db_column_int(&q, 7) && !bPrivate)
+                  || db_column_int(&q, 8)))
+     || (szU>0 && db_column_bytes(&q, 3)==0)
+    ){
+      /* The delta source will not be in any bundle, or the artifact is
+      ** stored in chunks.  Send full text. */
+      content_get(rid, &content);
+      szU = blob_size(&content);
+      content_compress(&content, &content);
+      zSrc = 0;
+    }else{
+      blob_init(&content, db_column_raw(&q, 3), db_column_bytes(&q, 3));
+    }
+    if( isPriv ) blob_append(&hdr, "private\n", -1);
+    blob_appendf(&index, "%s %lld\n", zUuid, iOffset+blob_size(&hdr));
+    blob_appendf(&hdr, "cfile %s ", zUuid);
+    if( zSrc ) blob_appendf(&hdr, "%s ", zSrc);
+    blob_appendf(&hdr, "%d %d\n", szU, blob_size(&content));
+    if( fwrite(blob_buffer(&hdr), 1, blob_size(&hdr), out)!=blob_size(&hdr)
+     || fwrite(blob_buffer(&content), 1, blob_size(&content), out)
+                                                      !=blob_size(&content)
+     || fwrite("\n", 1, 1, out)!=1
+    ){
+      fossil_fatal("error writing \"%s\"", zFile);
+    }
+    iOffset += blob_size(&hdr) + blob_size(&content) + 1;
+    blob_reset(&hdr);
+    blob_reset(&content);
+    nArtifact++;
+  }
+  db_finalize(&q);
+  blob_appendf(&hdr, "index %d\n", nArtifact);
+  blob_append(&hdr, blob_buffer(&index), blob_size(&index));
+  blob_appendf(&hdr, "end %lld\n", iOffset);
+  if( fwrite(blob_buffer(&hdr), 1, blob_size(&hdr), out)!=blob_size(&hdr)
+   || fclose(out)!=0
+  ){
+    fossil_fatal("error writing \"%s\"", zFile);
+  }
+  blob_reset(&hdr);
+  blob_reset(&index);
+  db_end_transaction(0);
+  fossil_print("%d artifacts written to %s\n", nArtifact, zFile);
+}
+
+/*
+** Read the artifacts of the bundle zFile into the open repository.
+** Fail unless the bundle is for the same project as the repository,
+** or bForce is true.  The record ID of every artifact that is added is
+** inserted into pAdded.  Return the number of artifacts added.
+*/
+static int bundle_import(const char *zFile, int bForce, Bag *pAdded){
+  FILE *in;
+  Blob project;
+  Blob line, aToken[6];
+  Blob content;
+  int iLast;
+  int isPriv = 0;
+  int nRead = 0;
+  int nAdded = 0;
+  char *zCode;
+
+  in = fossil_fopen(zFile, "rb");
+  if( in==0 ){
+    fossil_fatal("cannot open \"%s\" for reading", zFile);
+  }
+  bundle_check_trailer(in, zFile);
+  bundle_read_header(in, zFile, &project, 0, &iLast);
+  zCode = db_get("project-code", 0);
+  if( !bForce && zCode && !blob_eq_str(&project, zCode, -1) ){
+    fossil_fatal("%s is a bundle of a different project", zFile);
+  }
+  free(zCode);
+  blob_zero(&line);
+  blob_zero(&content);
+  while( bundle_read_line(in, &line) ){
+    int nToken = blob_tokenize(&line, aToken, 6);
+    int szU, szC, srcid, rid;
+    const char *zUuid;
+    if( nToken==1 && blob_eq(&aToken[0], "private") ){
+      isPriv = 1;
+      continue;
+    }
+    if( nToken==2 && blob_eq(&aToken[0], "index") ){
+      int n;
+      if( !blob_is_int(&aToken[1], &n) || n!=nRead ){
+        fossil_fatal("%s has a bad index", zFile);
+      }
+      break;
+    }
+    if( nToken<4 || nToken>5
+     || !blob_eq(&aToken[0], "cfile")
+     || !blob_is_uuid(&aToken[1])
+     || (nToken==5 && !blob_is_uuid(&aToken[2]))
+     || !blob_is_int(&aToken[nToken-2], &szU)
+     || !blob_is_int(&aToken[nToken-1], &szC)
+     || szU<0 || szC<0
+    ){
+      fossil_fatal("malformed card in %s: %b", zFile, &line);
+    }
+    blob_resize(&content, szC);
+    if( fread(blob_buffer(&content), 1, szC, in)!=szC || getc(in)!='\n' ){
+      fossil_fatal("%s is truncated", zFile);
+    }
+    nRead++;
+    zUuid = blob_str(&aToken[1]);
+    if( uuid_is_shunned(zUuid)
+     || db_exists("SELECT 1 FROM blob WHERE uuid='%s' AND size>=0", zUuid)
+    ){
+      isPriv = 0;
+      continue;
+    }
+    srcid = nToken==5 ? uuid_to_rid(blob_str(&aToken[2]), isPriv ? 2 : 1) : 0;
+    rid = content_put_ex(&content, zUuid, srcid, szU, isPriv);
+    bag_insert(pAdded, rid);
+    nAdded++;
+    isPriv = 0;
+  }
+  fclose(in);
+  blob_reset(&line);
+  blob_reset(&content);
+  blob_reset(&project);
+  return nAdded;
+}
+
+/*
+** COMMAND: bundle*
+**
+** Usage: %fossil bundle METHOD ... ?OPTIONS?
+**
+** Write the artifacts of a repository into a single file, or read them
+** back.  Artifacts are copied as they are stored, compressed and as
+** deltas, so a bundle is about the size of the repository.  Settings,
+** users, and other configuration are not included.  Use the
+** "configuration export" command to save those.
+**
+**    %fossil bundle export ?--since PREVIOUS? FILENAME
+**
+**         Write every artifact of the repository to FILENAME.  With
+**         --since, write only the artifacts received after the bundle
+**         PREVIOUS was made, so that a nightly backup costs only as much
+**         as what is new.  Private artifacts are written only if the
+**         --private option is used.
+**
+**    %fossil bundle import ?--force? FILENAME ...
+**
+**         Add the artifacts in each bundle FILENAME to the repository.
+**         Use --force to accept bundles of a different project.
+**
+**    %fossil bundle restore REPOSITORY FILENAME ...
+**
+**         Create the new repository REPOSITORY from a full bundle
+**         followed by any number of incremental bundles, in the order
+**         they were made.  Nothing is created if the first bundle is
+**         not a full bundle or if a bundle does not follow the one
+**         before it.
+**
+** Options:
+**    -R|--repository FILE       Use repository FILE
+**
+** See also: deconstruct, reconstruct
+*/
+void bundle_cmd(void){
+  int n;
+  const char *zMethod;
+  if( g.argc<3 ){
+    usage("export|import|restore ...");
+  }
+  zMethod = g.argv[2];
+  n = strlen(zMethod);
+  if( strncmp(zMethod, "export", n)==0 ){
+    const char *zSince = find_option("since",0,1);
+    int bPrivate = find_option("private",0,0)!=0;
+    int iSince = 0;
+    db_find_and_open_repository(0, 0);
+    if( g.argc!=4 ){
+      usage("export ?--since PREVIOUS? FILENAME");
+    }
+    if( zSince ){
+      FILE *in = fossil_fopen(zSince, "rb");
+      Blob project;
+      if( in==0 ){
+        fossil_fatal("cannot open \"%s\" for reading", zSince);
+      }
+      bundle_check_trailer(in, zSince);
+      bundle_read_header(in, zSince, &project, 0, &iSince);
+      fclose(in);
+      if( !blob_eq_str(&project, db_get("project-code", ""), -1) ){
+        fossil_fatal("%s is a bundle of a different project", zSince);
+      }
+      blob_reset(&project);
+    }
+    bundle_export(g.argv[3], iSince, bPrivate);
+  }else if( strncmp(zMethod, "import", n)==0 ){
+    int bForce = find_option("force","f",0)!=0;
+    int i, nAdded = 0;
+    Bag added;
+    int rid;
+    db_find_and_open_repository(0, 0);
+    if( g.argc<4 ){
+      usage("import ?--force? FILENAME ...");
+    }
+    bag_init(&added);
+    db_begin_transaction();
+    content_enable_dephantomize(0);
+    for(i=3; i<g.argc; i++){
+      nAdded += bundle_import(g.argv[i], bForce, &added);
+    }
+    content_enable_dephantomize(1);
+    manifest_crosslink_begin();
+    for(rid=bag_first(&added); rid; rid=bag_next(&added, rid)){
+      Blob content;
+      if( content_get(rid, &content) ){
+        manifest_crosslink(rid, &content);
+      }
+    }
+    manifest_crosslink_end();
+    db_end_transaction(0);
+    bag_clear(&added);
+    fossil_print("%d artifacts added\n", nAdded);
+  }else if( strncmp(zMethod, "restore", n)==0 ){
+    char *zPassword;
+    int i, iSince, iLast = 0;
+    Bag added;
+    Blob project, other;
+    FILE *in;
+    if( g.argc<5 ){
+      usage("restore REPOSITORY FILENAME ...");
+    }
+    if( file_size(g.argv[3])>0 ){
+      fossil_fatal("file already exists: %s", g.argv[3]);
+    }
+    /* The first bundle must be a full bundle, and each of the others
+    ** must start no later than where the one before it ended, or some
+    ** artifacts would be missing from the new repository. */
+    for(i=4; i<g.argc; i++){
+      int iPrevLast = iLast;
+      in = fossil_fopen(g.argv[i], "rb");
+      if( in==0 ){
+        fossil_fatal("cannot open \"%s\" for reading", g.argv[i]);
+      }
+      bundle_check_trailer(in, g.argv[i]);
+      bundle_read_header(in, g.argv[i], i==4 ? &project : &other,
+                         &iSince, &iLast);
+      fclose(in);
+      if( i==4 ){
+        if( iSince!=0 ){
+          fossil_fatal("%s is an incremental bundle.  Restore from a full "
+                       "bundle first.", g.argv[i]);
+        }
+      }else{
+        if( !blob_eq_str(&other, blob_str(&project), -1) ){
+          fossil_fatal("%s is a bundle of a different project", g.argv[i]);
+        }
+        blob_reset(&other);
+        if( iSince>iPrevLast ){
+          fossil_fatal("%s does not follow %s", g.argv[i], g.argv[i-1]);
+        }
+      }
+    }
+    db_create_repository(g.argv[3]);
+    db_open_repository(g.argv[3]);
+    db_open_config(0);
+    db_begin_transaction();
+    db_initial_setup(0, 0, 1);
+    db_set("project-code", blob_str(&project), 0);
+    blob_reset(&project);
+    bag_init(&added);
+    content_enable_dephantomize(0);
+    for(i=4; i<g.argc; i++){
+      bundle_import(g.argv[i], 0, &added);
+    }
+    content_enable_dephantomize(1);
+    bag_clear(&added);
+    fossil_print("Building the Fossil repository...\n");
+    rebuild_db(0, 1, 0);
+    db_end_transaction(0);
+    fossil_print("project-id: %s\n", db_get("project-code", 0));
+    fossil_print("server-id: %s\n", db_get("server-code", 0));
+    zPassword = db_text(0, "SELECT pw FROM user WHERE login=%Q", g.zLogin);
+    fossil_print("admin-user: %s (initial password is \"%s\")\n",
+                 g.zLogin, zPassword);
+  }else{
+    fossil_fatal("METHOD should be one of: export import restore");
+  }
+}
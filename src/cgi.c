@@ -36,6 +36,10 @@
 # include <sys/time.h>
 # include <sys/wait.h>
 # include <sys/select.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <poll.h>
+# include <signal.h>
 #endif
 #ifdef __EMX__
   typedef int socklen_t;
@@ -44,6 +48,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <zlib.h>
 #include "cgi.h"
 
 #if INTERFACE
@@ -79,6 +84,70 @@
 static Blob cgiContent[2] = { BLOB_INITIALIZER, BLOB_INITIALIZER };
 static Blob *pContent = &cgiContent[0];
 
+/*
+** When xStreamBody is not NULL, the body of the reply is not in
+** cgiContent[] but is instead written by xStreamBody() directly onto
+** the output channel as the reply is sent.  nStreamBody is the number
+** of bytes that xStreamBody() will write.
+*/
+static void (*xStreamBody)(void*, FILE*) = 0;
+static void *pStreamArg = 0;
+static i64 nStreamBody = 0;
+
+/*
+** Some replies, such as those to the sync protocol, can be sent
+** incrementally while they are still being generated.  Once a page
+** calls cgi_allow_incremental_reply(), each call to cgi_flush_content()
+** that finds at least CGI_FLUSH_SIZE bytes of accumulated content sends
+** the reply header followed by that content, and later content follows
+** as it is flushed.  The reply then has no Content-Length.  It is sent
+** with chunked transfer encoding on a keep-alive connection and
+** otherwise ends when the connection closes.  An "application/x-fossil"
+** reply is sent as a single zlib stream of type
+** "application/x-fossil-stream".  Other content types are sent as-is.
+*/
+#define CGI_FLUSH_SIZE 65536
+static int incrReplyOk = 0;      /* True if an incremental reply is ok */
+static int incrReplyState = 0;   /* 0: not begun 1: plain 2: compressed
+                                 ** 3: gzip content-encoding */
+static i64 nIncrReply = 0;       /* Uncompressed bytes flushed so far */
+static i64 nReplySent = 0;       /* Bytes of reply content written */
+static z_stream incrStream;      /* Compressor for incrReplyState>=2 */
+
+/*
+** The "fossil server" command can keep a connection open for several
+** HTTP/1.1 requests.  Each request is then handled by a new process
+** forked from the process that holds the connection.  keepAliveFd is a
+** pipe back to that process and is -1 for the usual one request per
+** process.  If the request allows the connection to stay open,
+** httpKeepAlive is true and the reply is written so that the client
+** can find its end without the connection being closed.  The process
+** holding the connection is told to wait for another request once the
+** reply is complete.
+*/
+static int keepAliveFd = -1;     /* Pipe to the connection process */
+static int httpKeepAlive = 0;    /* True to keep the connection open */
+
+/*
+** A request on a keep-alive connection can leave up to CGI_STATE_MAX
+** bytes of text for the requests that follow it on the same connection.
+** The text is sent back to the process holding the connection along
+** with the "k" on keepAliveFd, and later request processes inherit it
+** when they are forked.  zConnState is the text left by earlier
+** requests and zConnStateOut is the text this request leaves.
+*/
+#define CGI_STATE_MAX 1000
+static char *zConnState = 0;     /* State left by earlier requests */
+static char *zConnStateOut = 0;  /* State to leave for later requests */
+
+/*
+** Text replies of at least CGI_GZIP_MIN bytes are compressed with gzip
+** content-encoding if the client says that it accepts it.  replyGzipped
+** is true once the content of the reply is in gzip form.
+*/
+#define CGI_GZIP_MIN 1000
+static int replyGzipped = 0;     /* True if content is gzip-compressed */
+
 /*
 ** Set the destination buffer into which to accumulate CGI content.
 */
@@ -111,6 +180,8 @@ void cgi_append_content(const char *zData, int nAmt){
 void cgi_reset_content(void){
   blob_reset(&cgiContent[0]);
   blob_reset(&cgiContent[1]);
+  xStreamBody = 0;
+  replyGzipped = 0;
 }
 
 /*
@@ -164,6 +235,176 @@ void cgi_set_content(Blob *pNewContent){
   blob_zero(pNewContent);
 }
 
+/*
+** Arrange for the body of the reply to be exactly nByte bytes written
+** by xBody(pArg, out) at the moment the reply is sent, replacing any
+** content generated so far.  Use this to send large content without
+** first accumulating it in memory.
+*/
+void cgi_set_content_stream(i64 nByte, void (*xBody)(void*,FILE*), void *pArg){
+  cgi_reset_content();
+  cgi_destination(CGI_HEADER);
+  xStreamBody = xBody;
+  pStreamArg = pArg;
+  nStreamBody = nByte;
+}
+
+/*
+** Look at the Range header of the request for a reply whose complete
+** body is nTotal bytes.  If it asks for a single range of bytes that
+** lies at least partly within the body, set up a "206 Partial Content"
+** reply, write the offset and length of the range in *piFirst and
+** *pnByte and return 1.  The caller must then send just those bytes.
+** If the range lies entirely beyond the end of the body, set up a
+** "416 Requested Range Not Satisfiable" reply with no content and
+** return 2.  Otherwise, including for requests with several ranges or
+** an If-Range header, return 0 and the caller sends the entire body.
+*/
+int cgi_byte_range(int nTotal, int *piFirst, int *pnByte){
+  const char *z = P("HTTP_RANGE");
+  i64 iFirst, iLast;
+  char *zEnd;
+
+  if( z==0 || P("HTTP_IF_RANGE")!=0 ) return 0;
+  while( fossil_isspace(z[0]) ) z++;
+  if( fossil_strnicmp(z, "bytes=", 6)!=0 ) return 0;
+  z += 6;
+  if( strchr(z, ',')!=0 ) return 0;
+  while( fossil_isspace(z[0]) ) z++;
+  if( z[0]=='-' ){
+    /* The last N bytes */
+    if( !fossil_isdigit(z[1]) ) return 0;
+    iLast = nTotal-1;
+    iFirst = nTotal - strtoll(&z[1], &zEnd, 10);
+    if( iFirst<0 ) iFirst = 0;
+  }else{
+    if( !fossil_isdigit(z[0]) ) return 0;
+    iFirst = strtoll(z, &zEnd, 10);
+    while( fossil_isspace(zEnd[0]) ) zEnd++;
+    if( zEnd[0]!='-' ) return 0;
+    z = zEnd+1;
+    while( fossil_isspace(z[0]) ) z++;
+    if( fossil_isdigit(z[0]) ){
+      iLast = strtoll(z, &zEnd, 10);
+      if( iLast<iFirst ) return 0;
+      if( iLast>=nTotal ) iLast = nTotal-1;
+    }else{
+      iLast = nTotal-1;
+      zEnd = (char*)z;
+    }
+  }
+  while( fossil_isspace(zEnd[0]) ) zEnd++;
+  if( zEnd[0]!=0 ) return 0;
+  if( iFirst>=nTotal || iLast<iFirst ){
+    cgi_reset_content();
+    blob_appendf(&extraHeader, "Content-Range: bytes */%d\r\n", nTotal);
+    cgi_set_status(416, "Requested Range Not Satisfiable");
+    return 2;
+  }
+  blob_appendf(&extraHeader, "Content-Range: bytes %lld-%lld/%d\r\n",
+               iFirst, iLast, nTotal);
+  cgi_set_status(206, "Partial Content");
+  *piFirst = (int)iFirst;
+  *pnByte = (int)(iLast - iFirst + 1);
+  return 1;
+}
+
+/*
+** Set the reply content to pNewContent, or to just the bytes of it
+** that the Range header of the request asks for.  See
+** cgi_byte_range().
+*/
+void cgi_set_content_ranged(Blob *pNewContent){
+  int iFirst, nByte;
+  switch( cgi_byte_range(blob_size(pNewContent), &iFirst, &nByte) ){
+    case 1: {
+      Blob part;
+      blob_zero(&part);
+      blob_append(&part, blob_buffer(pNewContent)+iFirst, nByte);
+      blob_reset(pNewContent);
+      cgi_set_content(&part);
+      break;
+    }
+    case 2: {
+      blob_reset(pNewContent);
+      break;
+    }
+    default: {
+      cgi_set_content(pNewContent);
+      break;
+    }
+  }
+}
+
+/*
+** If the reply is a complete "200 OK" reply held in memory, with no
+** extra header lines such as cookies, then it could be sent again in
+** answer to an identical request.  In that case return its content and
+** write its content type into *pzType.  Otherwise return NULL.
+*/
+Blob *cgi_reusable_reply(const char **pzType){
+  if( iReplyStatus!=200 || incrReplyState || xStreamBody ) return 0;
+  if( replyGzipped ) return 0;
+  if( blob_size(&extraHeader)>0 ) return 0;
+  cgi_combine_header_and_body();
+  *pzType = zContentType;
+  return &cgiContent[0];
+}
+
+/*
+** Set the reply content to pGzip, which is already compressed with
+** gzip.  Only do this if cgi_reply_gzip_ok() is true.
+*/
+void cgi_set_content_gzipped(Blob *pGzip){
+  cgi_set_content(pGzip);
+  replyGzipped = 1;
+}
+
+/*
+** Return true if the content type of the reply is text that is worth
+** compressing.
+*/
+int cgi_content_is_text(void){
+  static const char *azText[] = {
+    "application/javascript", "application/json", "application/rss+xml",
+    "application/x-javascript", "application/xml", "image/svg+xml",
+  };
+  int i;
+  if( strncmp(zContentType, "text/", 5)==0 ) return 1;
+  for(i=0; i<sizeof(azText)/sizeof(azText[0]); i++){
+    if( fossil_strcmp(zContentType, azText[i])==0 ) return 1;
+  }
+  return 0;
+}
+
+/*
+** Return true if the reply is text and the Accept-Encoding header of
+** the request allows it to be sent with gzip content-encoding.
+*/
+int cgi_reply_gzip_ok(void){
+  const char *z = P("HTTP_ACCEPT_ENCODING");
+  if( z==0 || !cgi_content_is_text() ) return 0;
+  while( z[0] ){
+    int n;
+    while( fossil_isspace(z[0]) || z[0]==',' ) z++;
+    for(n=0; z[n] && z[n]!=',' && z[n]!=';' && !fossil_isspace(z[n]); n++){}
+    if( (n==4 && fossil_strnicmp(z, "gzip", 4)==0)
+     || (n==6 && fossil_strnicmp(z, "x-gzip", 6)==0)
+    ){
+      /* Accepted unless the quality value is zero */
+      z += n;
+      while( fossil_isspace(z[0]) ) z++;
+      if( z[0]!=';' ) return 1;
+      z++;
+      while( fossil_isspace(z[0]) ) z++;
+      return z[0]!='q' || z[1]!='=' || atof(&z[2])>0.0;
+    }
+    while( z[n] && z[n]!=',' ) n++;
+    z += n;
+  }
+  return 0;
+}
+
 /*
 ** Set the reply status code
 */
@@ -261,10 +502,10 @@ static int check_cache_control(void){
 #endif
 
 /*
-** Do a normal HTTP reply
+** Write the HTTP reply header on g.httpOut down to and including the
+** Content-Type line.
 */
-void cgi_reply(void){
-  int total_size;
+static void cgi_reply_header(void){
   if( iReplyStatus<=0 ){
     iReplyStatus = 200;
     zReplyStatus = "OK";
@@ -281,7 +522,10 @@ void cgi_reply(void){
   }
 #endif
 
-  if( g.fullHttpReply ){
+  if( g.fullHttpReply && httpKeepAlive ){
+    fprintf(g.httpOut, "HTTP/1.1 %d %s\r\n", iReplyStatus, zReplyStatus);
+    fprintf(g.httpOut, "Date: %s\r\n", cgi_rfc822_datestamp(time(0)));
+  }else if( g.fullHttpReply ){
     fprintf(g.httpOut, "HTTP/1.0 %d %s\r\n", iReplyStatus, zReplyStatus);
     fprintf(g.httpOut, "Date: %s\r\n", cgi_rfc822_datestamp(time(0)));
     fprintf(g.httpOut, "Connection: close\r\n");
@@ -331,19 +575,223 @@ void cgi_reply(void){
   ** the browser, not some shared location.
   */
   fprintf(g.httpOut, "Content-Type: %s; charset=utf-8\r\n", zContentType);
-  if( fossil_strcmp(zContentType,"application/x-fossil")==0 ){
+  if( cgi_content_is_text() ){
+    fprintf(g.httpOut, "Vary: Accept-Encoding\r\n");
+  }
+  if( replyGzipped ){
+    fprintf(g.httpOut, "Content-Encoding: gzip\r\n");
+  }
+}
+
+/*
+** Write n bytes of an incremental reply onto g.httpOut, as one chunk
+** if the connection is being kept open.
+*/
+static void cgi_write_chunk(const void *z, int n){
+  if( n<=0 ) return;
+  nReplySent += n;
+  if( httpKeepAlive && g.fullHttpReply ){
+    fprintf(g.httpOut, "%x\r\n", n);
+    fwrite(z, 1, n, g.httpOut);
+    fprintf(g.httpOut, "\r\n");
+  }else{
+    fwrite(z, 1, n, g.httpOut);
+  }
+}
+
+/*
+** Write the accumulated content of the reply onto g.httpOut as part of
+** an incremental reply, and reset it.  The compressor is flushed with
+** zlib flush mode iFlush.
+*/
+static void cgi_write_incremental(int iFlush){
+  int i;
+  for(i=0; i<2; i++){
+    int size = blob_size(&cgiContent[i]);
+    nIncrReply += size;
+    if( incrReplyState==1 ){
+      cgi_write_chunk(blob_buffer(&cgiContent[i]), size);
+    }else{
+      unsigned char aOut[16384];
+      int flush = i==1 ? iFlush : Z_NO_FLUSH;
+      incrStream.avail_in = size;
+      incrStream.next_in = (unsigned char*)blob_buffer(&cgiContent[i]);
+      do{
+        incrStream.avail_out = sizeof(aOut);
+        incrStream.next_out = aOut;
+        deflate(&incrStream, flush);
+        cgi_write_chunk(aOut, sizeof(aOut)-incrStream.avail_out);
+      }while( incrStream.avail_out==0 );
+    }
+    blob_reset(&cgiContent[i]);
+  }
+}
+
+/*
+** Allow the current reply to be sent incrementally by
+** cgi_flush_content().
+*/
+void cgi_allow_incremental_reply(void){
+  incrReplyOk = 1;
+}
+
+/*
+** If the current reply may be sent incrementally and enough content
+** has accumulated, send the content generated so far, preceded by the
+** reply header if it has not already been sent.  Content that has been
+** sent can no longer be changed or reset.
+*/
+void cgi_flush_content(void){
+  if( !incrReplyOk || xStreamBody ) return;
+  if( blob_size(&cgiContent[0])+blob_size(&cgiContent[1])<CGI_FLUSH_SIZE ){
+    return;
+  }
+  if( incrReplyState==0 ){
+    if( fossil_strcmp(zContentType,"application/x-fossil")==0 ){
+      memset(&incrStream, 0, sizeof(incrStream));
+      deflateInit(&incrStream, 9);
+      zContentType = "application/x-fossil-stream";
+      incrReplyState = 2;
+    }else if( cgi_reply_gzip_ok() && !replyGzipped ){
+      memset(&incrStream, 0, sizeof(incrStream));
+      deflateInit2(&incrStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                   MAX_WBITS+16, 8, Z_DEFAULT_STRATEGY);
+      replyGzipped = 1;
+      incrReplyState = 3;
+    }else{
+      incrReplyState = 1;
+    }
+    cgi_reply_header();
+    if( httpKeepAlive && g.fullHttpReply ){
+      fprintf(g.httpOut, "Transfer-Encoding: chunked\r\n");
+    }
+    fprintf(g.httpOut, "\r\n");
+  }
+  /* Let the browser render gzip content that has been sent so far */
+  cgi_write_incremental(incrReplyState==3 ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+}
+
+/*
+** Return the number of bytes of reply content that have already been
+** sent by cgi_flush_content(), measured before compression.
+*/
+i64 cgi_flushed_size(void){
+  return nIncrReply;
+}
+
+/*
+** The reply to a request on a keep-alive connection has been sent in
+** full.  Tell the process holding the connection that it may wait for
+** another request.  This happens at most once per request.
+*/
+static void cgi_keep_alive_done(void){
+  if( httpKeepAlive && keepAliveFd>=0 ){
+    if( write(keepAliveFd, "k", 1)!=1 ){ /* Connection will be closed */ }
+    if( zConnStateOut ){
+      int n = (int)strlen(zConnStateOut);
+      if( write(keepAliveFd, zConnStateOut, n)!=n ){ /* State is lost */ }
+    }
+    close(keepAliveFd);
+    keepAliveFd = -1;
+  }
+}
+
+/*
+** Return the text left by earlier requests on the same keep-alive
+** connection through cgi_set_connection_state(), or an empty string if
+** there is none.  Return NULL if this request is not on a keep-alive
+** connection of "fossil server", so that nothing is worth leaving.
+*/
+const char *cgi_connection_state(void){
+  if( keepAliveFd<0 ) return 0;
+  return zConnState ? zConnState : "";
+}
+
+/*
+** Leave the text zState for later requests on the same keep-alive
+** connection.  The text must not be empty.  Later calls replace the
+** text of earlier ones.  A no-op if there is no keep-alive connection
+** or if the text is longer than CGI_STATE_MAX bytes.
+*/
+void cgi_set_connection_state(const char *zState){
+  if( keepAliveFd<0 || zState[0]==0 || strlen(zState)>CGI_STATE_MAX ) return;
+  fossil_free(zConnStateOut);
+  zConnStateOut = fossil_strdup(zState);
+}
+
+/*
+** Tell the process holding the connection that this request opened the
+** repository zRepo, from a directory of repositories, so that it can
+** open the same repository ahead of the requests that follow.  A no-op
+** if this request was not forked by such a process.
+*/
+void cgi_set_connection_repository(const char *zRepo){
+  int n;
+  if( keepAliveFd<0 ) return;
+  n = (int)strlen(zRepo);
+  if( n>FILENAME_MAX || strchr(zRepo, '\n')!=0 ) return;
+  if( write(keepAliveFd, "r", 1)!=1
+   || write(keepAliveFd, zRepo, n)!=n
+   || write(keepAliveFd, "\n", 1)!=1
+  ){
+    /* The repository is opened again by the next request */
+  }
+}
+
+/*
+** Do a normal HTTP reply
+*/
+void cgi_reply(void){
+  int total_size;
+  if( incrReplyState ){
+    /* The header and part of the content are already sent */
+    cgi_write_incremental(Z_FINISH);
+    if( incrReplyState>=2 ) deflateEnd(&incrStream);
+    incrReplyState = 0;
+    if( httpKeepAlive && g.fullHttpReply ){
+      fprintf(g.httpOut, "0\r\n\r\n");
+    }
+    fflush(g.httpOut);
+    cgi_keep_alive_done();
+    metrics_reply(nReplySent);
+    perf_slow_log();
+    CGIDEBUG(("DONE\n"));
+    return;
+  }
+  if( !xStreamBody && !replyGzipped
+   && iReplyStatus!=304 && iReplyStatus!=206
+   && blob_size(&cgiContent[0])+blob_size(&cgiContent[1])>=CGI_GZIP_MIN
+   && cgi_reply_gzip_ok()
+  ){
+    Blob gz;
+    cgi_combine_header_and_body();
+    gzip_compress_blob(&cgiContent[0], &gz, Z_DEFAULT_COMPRESSION);
+    blob_reset(&cgiContent[0]);
+    cgiContent[0] = gz;
+    replyGzipped = 1;
+  }
+  cgi_reply_header();
+  if( fossil_strcmp(zContentType,"application/x-fossil")==0 && !xStreamBody ){
     cgi_combine_header_and_body();
     blob_compress(&cgiContent[0], &cgiContent[0]);
   }
 
   if( iReplyStatus != 304 ) {
     total_size = blob_size(&cgiContent[0]) + blob_size(&cgiContent[1]);
-    fprintf(g.httpOut, "Content-Length: %d\r\n", total_size);
+    if( xStreamBody ){
+      fprintf(g.httpOut, "Content-Length: %lld\r\n", nStreamBody);
+    }else{
+      fprintf(g.httpOut, "Content-Length: %d\r\n", total_size);
+    }
   }else{
     total_size = 0;
   }
   fprintf(g.httpOut, "\r\n");
-  if( total_size>0 && iReplyStatus != 304 ){
+  if( xStreamBody ){
+    if( nStreamBody>0 && iReplyStatus != 304 ){
+      xStreamBody(pStreamArg, g.httpOut);
+    }
+  }else if( total_size>0 && iReplyStatus != 304 ){
     int i, size;
     for(i=0; i<2; i++){
       size = blob_size(&cgiContent[i]);
@@ -353,6 +801,9 @@ void cgi_reply(void){
     }
   }
   fflush(g.httpOut);
+  cgi_keep_alive_done();
+  metrics_reply(xStreamBody ? nStreamBody : total_size);
+  perf_slow_log();
   CGIDEBUG(("DONE\n"));
 }
 
@@ -812,8 +1263,7 @@ void cgi_init(void){
         process_multipart_form_data(z, len);
       }
     }else if( fossil_strcmp(zType, "application/x-fossil")==0 ){
-      blob_read_from_channel(&g.cgiIn, g.httpIn, len);
-      blob_uncompress(&g.cgiIn, &g.cgiIn);
+      blob_read_uncompressed(&g.cgiIn, g.httpIn, len);
     }else if( fossil_strcmp(zType, "application/x-fossil-debug")==0 ){
       blob_read_from_channel(&g.cgiIn, g.httpIn, len);
     }else if( fossil_strcmp(zType, "application/x-fossil-uncompressed")==0 ){
@@ -1125,6 +1575,7 @@ void cgi_handle_http_request(const char *zIpAddr){
   if( fgets(zLine, sizeof(zLine),g.httpIn)==0 ){
     malformed_request();
   }
+  perf_init();
   zToken = extract_token(zLine, &z);
   if( zToken==0 ){
     malformed_request();
@@ -1144,6 +1595,10 @@ void cgi_handle_http_request(const char *zIpAddr){
   if( zToken[i] ) zToken[i++] = 0;
   cgi_setenv("PATH_INFO", zToken);
   cgi_setenv("QUERY_STRING", &zToken[i]);
+  zToken = extract_token(z, &z);
+  if( keepAliveFd>=0 && zToken && fossil_strcmp(zToken,"HTTP/1.1")==0 ){
+    httpKeepAlive = 1;
+  }
   if( zIpAddr==0 &&
         getpeername(fileno(g.httpIn), (struct sockaddr*)&remoteName, 
                                 &size)>=0
@@ -1184,12 +1639,20 @@ void cgi_handle_http_request(const char *zIpAddr){
       cgi_setenv("HTTP_IF_NONE_MATCH", zVal);
     }else if( fossil_strcmp(zFieldName,"if-modified-since:")==0 ){
       cgi_setenv("HTTP_IF_MODIFIED_SINCE", zVal);
+    }else if( fossil_strcmp(zFieldName,"range:")==0 ){
+      cgi_setenv("HTTP_RANGE", zVal);
+    }else if( fossil_strcmp(zFieldName,"if-range:")==0 ){
+      cgi_setenv("HTTP_IF_RANGE", zVal);
 #if 0
     }else if( fossil_strcmp(zFieldName,"referer:")==0 ){
       cgi_setenv("HTTP_REFERER", zVal);
 #endif
     }else if( fossil_strcmp(zFieldName,"user-agent:")==0 ){
       cgi_setenv("HTTP_USER_AGENT", zVal);
+    }else if( fossil_strcmp(zFieldName,"accept-encoding:")==0 ){
+      cgi_setenv("HTTP_ACCEPT_ENCODING", zVal);
+    }else if( fossil_strcmp(zFieldName,"connection:")==0 ){
+      if( fossil_stricmp(zVal,"close")==0 ) httpKeepAlive = 0;
     }
   }
 
@@ -1205,36 +1668,432 @@ void cgi_handle_http_request(const char *zIpAddr){
 #endif /* INTERFACE */
 
 /*
-** Maximum number of child processes that we can have running
-** at one time before we start slowing things down.
+** Maximum number of child processes that we can have running at one
+** time.  Further connections wait in the queue of cgi_http_server().
+*/
+#define MAX_PARALLEL 32
+
+/*
+** Default number of accepted connections that may wait in the queue
+** of cgi_http_server() for a child process.  Connections that arrive
+** when the queue is full get a 503 reply.
+*/
+#define HTTP_QUEUE_DEPTH 64
+
+/*
+** Number of seconds that an idle keep-alive connection is held open
+** waiting for another request.
+*/
+#define HTTP_KEEPALIVE_TIMEOUT 15
+
+/*
+** Maximum number of child processes, beyond MAX_PARALLEL, that may be
+** holding an idle keep-alive connection.  Idle children are not counted
+** against MAX_PARALLEL, but no new child is started once there are
+** MAX_PARALLEL+MAX_KEEPALIVE_IDLE children in all.
+*/
+#define MAX_KEEPALIVE_IDLE 32
+
+#if !defined(_WIN32)
+/*
+** Write end of a pipe on which the child processes of cgi_http_server()
+** report that their keep-alive connection went idle (the negated process
+** ID) or has a new request (the process ID).  -1 if there is no such
+** pipe.
+*/
+static int connStatusFd = -1;
+
+/*
+** Tell cgi_http_server() that this connection process is idle if
+** isIdle is true, or busy again otherwise.
+*/
+static void cgi_report_idle(int isIdle){
+  int pid = getpid();
+  if( connStatusFd<0 ) return;
+  if( isIdle ) pid = -pid;
+  if( write(connStatusFd, &pid, sizeof(pid))!=sizeof(pid) ){
+    /* The parent keeps counting this process as busy */
+  }
+}
+
+/*
+** Make the socket "connection" the standard input and output of this
+** process, and also its standard error unless tracing.  Return the
+** number of errors.
+*/
+static int cgi_connection_to_stdio(int connection){
+  int nErr = 0;
+  if( dup2(connection, 0)!=0 ) nErr++;
+  if( dup2(connection, 1)!=1 ) nErr++;
+  if( !g.fHttpTrace && !g.fSqlTrace ){
+    if( dup2(connection, 2)!=2 ) nErr++;
+  }
+  if( connection>2 ) close(connection);
+  return nErr;
+}
+
+/*
+** Called in the process that owns a newly accepted connection on
+** standard input and output.  Fork a new process to handle each
+** request that arrives on the connection, and return 1 in that process.
+** Requests are handled one at a time.  Once the reply to a request
+** finishes without allowing the connection to stay open, or after
+** HTTP_KEEPALIVE_TIMEOUT seconds pass without a new request, return 0
+** in this process.
+**
+** If a request opens a repository from a directory of repositories,
+** this process opens the same one with server_keep_repository() so that
+** later requests find it open.
+**
+** If a new process cannot be started, return 1 so that the current
+** process handles one request in the usual way.
+*/
+static int cgi_serve_connection(void){
+  while( 1 ){
+    int aFd[2];
+    pid_t pid;
+    char c = 0;
+    fd_set readfds;
+    struct timeval delay;
+    char *zRepo = 0;
+
+    if( pipe(aFd) ) return 1;
+    pid = fork();
+    if( pid<0 ){
+      close(aFd[0]);
+      close(aFd[1]);
+      return 1;
+    }
+    if( pid==0 ){
+      close(aFd[0]);
+      keepAliveFd = aFd[1];
+      return 1;
+    }
+    close(aFd[1]);
+    if( read(aFd[0], &c, 1)!=1 ) c = 0;
+    if( c=='r' ){
+      /* The request opened a repository.  Its name comes first. */
+      char zName[FILENAME_MAX+2];
+      int n = 0;
+      while( n<=FILENAME_MAX && read(aFd[0], &zName[n], 1)==1
+          && zName[n]!='\n' ){
+        n++;
+      }
+      if( n<=FILENAME_MAX && zName[n]=='\n' ){
+        zName[n] = 0;
+        zRepo = fossil_strdup(zName);
+      }
+      if( read(aFd[0], &c, 1)!=1 ) c = 0;
+    }
+    if( c=='k' ){
+      /* Keep any state that the request left for the next one */
+      char zBuf[CGI_STATE_MAX+1];
+      int n = 0, got;
+      while( n<CGI_STATE_MAX
+          && (got = read(aFd[0], &zBuf[n], CGI_STATE_MAX-n))>0 ){
+        n += got;
+      }
+      if( n>0 ){
+        zBuf[n] = 0;
+        fossil_free(zConnState);
+        zConnState = fossil_strdup(zBuf);
+      }
+    }
+    close(aFd[0]);
+    waitpid(pid, 0, 0);
+    if( zRepo ){
+      server_keep_repository(zRepo);
+      fossil_free(zRepo);
+    }
+    if( c!='k' ) return 0;
+
+    /* Wait for the next request, or for the client to go away */
+    cgi_report_idle(1);
+    delay.tv_sec = HTTP_KEEPALIVE_TIMEOUT;
+    delay.tv_usec = 0;
+    FD_ZERO(&readfds);
+    FD_SET(0, &readfds);
+    if( select(1, &readfds, 0, 0, &delay)<=0 ) return 0;
+    if( recv(0, &c, 1, MSG_PEEK)!=1 ) return 0;
+    cgi_report_idle(0);
+  }
+}
+#endif
+
+#if !defined(_WIN32)
+/*
+** In prefork mode, "fossil server" keeps a pool of worker processes
+** that are forked ahead of time.  Each idle worker opens the repository
+** and then waits in cgi_http_accept() for a connection on the shared
+** listening socket.  A worker that accepts a connection writes its
+** process ID to a pipe back to the parent, which then forks a new idle
+** worker to replace it.  So the cost of fork() and of opening the
+** repository is paid before a connection arrives rather than after.
+**
+** Each request is handled by a process forked from the worker, so the
+** state of one request never leaks into the next.  After its
+** connection closes, the worker writes its negated process ID to the
+** pipe and waits for another connection, up to PREFORK_MAX_CONNECTIONS
+** of them.  The parent counts it as idle again.  A worker that waits
+** PREFORK_IDLE_TIMEOUT seconds without a connection exits, so that
+** the pool shrinks back after a busy period.  A fresh worker waits
+** for as long as it takes, since the parent would only replace it.
+** When serving a directory of repositories, a worker keeps open the
+** last repository that one of its requests used, so that a popular
+** repository is usually open already when its next request arrives.
+** There is at most one open repository per worker, so the limit on
+** the number of workers also limits the memory that they use.
+**
+** preforkListener is the listening socket and preforkStatus is the
+** write end of the pipe back to the parent.  Both are -1 when not in
+** prefork mode.
 */
-#define MAX_PARALLEL 2
+static int preforkListener = -1;
+static int preforkStatus = -1;
+
+/*
+** Maximum number of workers busy with a connection, per idle worker,
+** before the parent stops forking replacements and lets new
+** connections wait in the listen queue.
+*/
+#define PREFORK_BUSY_RATIO 8
+
+/*
+** Number of connections that a worker serves before it exits and is
+** replaced, to bound the effect of any leak.
+*/
+#define PREFORK_MAX_CONNECTIONS 1000
+
+/*
+** Seconds that a worker that has served a connection waits for another
+** before it exits.
+*/
+#define PREFORK_IDLE_TIMEOUT 60
+
+/*
+** The parent process of prefork mode.  Keep nWorker idle workers
+** waiting on listener.  Return 0 in each worker.  Never return in the
+** parent.
+*/
+static int cgi_prefork_loop(int listener, int nWorker){
+  int aFd[2];                  /* Pipe from workers to the parent */
+  int *aIdle;                  /* Process IDs of idle workers */
+  int nIdle = 0;               /* Number of entries in aIdle[] */
+  int nBusy = 0;               /* Workers busy with a connection */
+  int i;
+
+  if( pipe(aFd) ) fossil_fatal("unable to create a pipe");
+  aIdle = fossil_malloc( sizeof(aIdle[0])*nWorker*(PREFORK_BUSY_RATIO+1) );
+  while( 1 ){
+    int pid;
+    fd_set readfds;
+    struct timeval delay;
+
+    while( nIdle<nWorker && nBusy<nWorker*PREFORK_BUSY_RATIO ){
+      pid = fork();
+      if( pid==0 ){
+        close(aFd[0]);
+        preforkListener = listener;
+        preforkStatus = aFd[1];
+        return 0;
+      }
+      if( pid<0 ) break;
+      aIdle[nIdle++] = pid;
+    }
+
+    /* Wait for a worker to take a connection */
+    delay.tv_sec = 1;
+    delay.tv_usec = 0;
+    FD_ZERO(&readfds);
+    FD_SET(aFd[0], &readfds);
+    if( select(aFd[0]+1, &readfds, 0, 0, &delay)>0 ){
+      if( read(aFd[0], &pid, sizeof(pid))==sizeof(pid) ){
+        if( pid>0 ){
+          /* A worker took a connection */
+          for(i=0; i<nIdle && aIdle[i]!=pid; i++){}
+          if( i<nIdle ){
+            aIdle[i] = aIdle[--nIdle];
+            nBusy++;
+          }
+        }else if( nBusy>0 ){
+          /* A worker finished its connection */
+          nBusy--;
+          aIdle[nIdle++] = -pid;
+        }
+      }
+    }
+
+    /* Bury dead workers */
+    while( (pid = waitpid(0, 0, WNOHANG))>0 ){
+      for(i=0; i<nIdle && aIdle[i]!=pid; i++){}
+      if( i<nIdle ){
+        /* Died before taking a connection */
+        aIdle[i] = aIdle[--nIdle];
+      }else if( nBusy>0 ){
+        nBusy--;
+      }
+    }
+    metrics_workers(nBusy, nWorker*PREFORK_BUSY_RATIO, 0);
+  }
+}
+#endif
+
+/*
+** In prefork mode, wait for a connection on the shared listening
+** socket, make it the standard input and output of this worker, and
+** return in the process forked to handle its first request.  The worker
+** itself serves further connections until PREFORK_MAX_CONNECTIONS is
+** reached and then exits.  Otherwise this is a no-op, because
+** cgi_http_server() has already done the same.  Call this after any
+** per-process initialization that does not depend on the request, such
+** as opening the repository.
+*/
+void cgi_http_accept(void){
+#if !defined(_WIN32)
+  int connection;
+  int pid = getpid();
+  int nConn;
+  if( preforkListener<0 ) return;
+  for(nConn=0; nConn<PREFORK_MAX_CONNECTIONS; nConn++){
+    if( nConn>0 ){
+      fd_set readfds;
+      struct timeval delay;
+      int rc;
+      do{
+        delay.tv_sec = PREFORK_IDLE_TIMEOUT;
+        delay.tv_usec = 0;
+        FD_ZERO(&readfds);
+        FD_SET(preforkListener, &readfds);
+        rc = select(preforkListener+1, &readfds, 0, 0, &delay);
+      }while( rc<0 && errno==EINTR );
+      if( rc<=0 ) exit(0);
+    }
+    do{
+      connection = accept(preforkListener, 0, 0);
+    }while( connection<0 && errno==EINTR );
+    if( connection<0 ) exit(1);
+    if( write(preforkStatus, &pid, sizeof(pid))!=sizeof(pid) ){
+      /* The parent will replace this worker when it exits */
+    }
+    fossil_free(zConnState);
+    zConnState = 0;
+    if( cgi_connection_to_stdio(connection) ) exit(1);
+    if( cgi_serve_connection() ){
+      close(preforkStatus);
+      close(preforkListener);
+      preforkStatus = preforkListener = -1;
+      return;
+    }
+
+    /* The connection is finished.  Wait for another. */
+    close(0);
+    close(1);
+    if( !g.fHttpTrace && !g.fSqlTrace ) close(2);
+    pid = -pid;
+    if( write(preforkStatus, &pid, sizeof(pid))!=sizeof(pid) ){
+      exit(0);
+    }
+    pid = -pid;
+  }
+  exit(0);
+#endif
+}
+
+#if !defined(_WIN32)
+/*
+** Write end of the pipe that wakes up cgi_http_server() when a child
+** process exits.  -1 if there is no such pipe.
+*/
+static int childExitFd = -1;
+
+/*
+** SIGCHLD handler for cgi_http_server().
+*/
+static void cgi_child_exit(int sig){
+  int e = errno;
+  if( childExitFd>=0 && write(childExitFd, "x", 1)!=1 ){
+    /* The pipe is full, so a wake-up is already pending */
+  }
+  errno = e;
+}
+
+/*
+** Send a 503 reply to a connection for which there is no room in the
+** queue, without waiting on the client.
+*/
+static void cgi_reply_busy(int connection){
+  static const char zReply[] =
+    "HTTP/1.0 503 Service Unavailable\r\n"
+    "Retry-After: 2\r\n"
+    "Connection: close\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 22\r\n"
+    "\r\n"
+    "Server is overloaded.\n";
+  int flags = fcntl(connection, F_GETFL);
+  if( flags>=0 ) fcntl(connection, F_SETFL, flags|O_NONBLOCK);
+  if( send(connection, zReply, sizeof(zReply)-1, 0)<0 ){
+    /* The client will see a closed connection instead */
+  }
+  metrics_rejected();
+}
+#endif
 
 /*
 ** Implement an HTTP server daemon listening on port iPort.
 **
-** As new connections arrive, fork a child and let child return
-** out of this procedure call.  The child will handle the request.
-** The parent never returns from this procedure.
+** New connections are accepted as soon as they arrive and held in a
+** queue of up to nQueue entries until the client has sent something
+** and fewer than MAX_PARALLEL child processes are busy.  Then fork a
+** child and let child return out of this procedure call.  The child
+** will handle the request.  A connection that is kept open for further
+** requests forks a new child for each of them, and the process that
+** holds it does not count as busy while it waits for the next request.
+** A connection that arrives while the queue is full gets a 503 reply,
+** as does one that waits HTTP_KEEPALIVE_TIMEOUT seconds in the queue
+** because every child is busy.  One that sends nothing for that long
+** while there is room for it is closed.  The parent never returns from
+** this procedure.
+**
+** If nWorker is greater than zero, use prefork mode instead, with
+** nWorker idle workers.  Each worker returns from this procedure
+** before it has a connection and must call cgi_http_accept() to get
+** one.
 **
 ** Return 0 to each child as it runs.  If unable to establish a
 ** listening socket, return non-zero.
 */
-int cgi_http_server(int mnPort, int mxPort, char *zBrowser, int flags){
+int cgi_http_server(
+  int mnPort,                  /* Lowest TCP port to try */
+  int mxPort,                  /* Highest TCP port to try */
+  char *zBrowser,              /* Command to launch a web browser, or NULL */
+  int nWorker,                 /* Number of prefork workers, or 0 */
+  int nQueue,                  /* Depth of the connection queue, or 0 */
+  int flags                    /* One or more HTTP_SERVER_ flags */
+){
 #if defined(_WIN32)
   /* Use win32_http_server() instead */
   fossil_exit(1);
 #else
   int listener = -1;           /* The server socket */
   int connection;              /* A socket for each individual connection */
-  fd_set readfds;              /* Set of file descriptors for select() */
   socklen_t lenaddr;           /* Length of the inaddr structure */
   int child;                   /* PID of the child process */
   int nchildren = 0;           /* Number of child processes */
-  struct timeval delay;        /* How long to wait inside select() */
+  int nIdle = 0;               /* Children with an idle connection */
+  int *aChild;                 /* Process IDs of the children */
+  char *aIsIdle;               /* True for each idle entry of aChild[] */
+  int aStatus[2];              /* Pipe written by cgi_report_idle() */
+  int isPolled;                /* True if the queue was polled */
   struct sockaddr_in inaddr;   /* The socket address */
   int opt = 1;                 /* setsockopt flag */
   int iPort = mnPort;
+  int aWake[2];                /* Pipe written by cgi_child_exit() */
+  struct pollfd *aPoll;        /* Listener, wake-up and status pipes, queue */
+  time_t *aArrive;             /* When each queued connection arrived */
+  int nWait = 0;               /* Number of connections in the queue */
+  int nPoll;                   /* Number of aPoll[] entries to watch */
+  int i, j;
 
   while( iPort<=mxPort ){
     memset(&inaddr, 0, sizeof(inaddr));
@@ -1281,47 +2140,130 @@ int cgi_http_server(int mnPort, int mxPort, char *zBrowser, int flags){
       fossil_warning("cannot start browser: %s\n", zBrowser);
     }
   }
+  if( nWorker>0 ) return cgi_prefork_loop(listener, nWorker);
+
+  if( nQueue<=0 ) nQueue = HTTP_QUEUE_DEPTH;
+  if( pipe(aWake) || pipe(aStatus) ){
+    fossil_fatal("unable to create a pipe");
+  }
+  fcntl(aWake[0], F_SETFL, O_NONBLOCK);
+  fcntl(aWake[1], F_SETFL, O_NONBLOCK);
+  fcntl(aStatus[0], F_SETFL, O_NONBLOCK);
+  childExitFd = aWake[1];
+  signal(SIGCHLD, cgi_child_exit);
+  fcntl(listener, F_SETFL, O_NONBLOCK);
+  aPoll = fossil_malloc( sizeof(aPoll[0])*(nQueue+3) );
+  aArrive = fossil_malloc( sizeof(aArrive[0])*nQueue );
+  aChild = fossil_malloc( sizeof(aChild[0])*(MAX_PARALLEL+MAX_KEEPALIVE_IDLE) );
+  aIsIdle = fossil_malloc( MAX_PARALLEL+MAX_KEEPALIVE_IDLE );
+  aPoll[0].fd = listener;
+  aPoll[1].fd = aWake[0];
+  aPoll[2].fd = aStatus[0];
   while( 1 ){
-    if( nchildren>MAX_PARALLEL ){
-      /* Slow down if connections are arriving too fast */
-      sleep( nchildren-MAX_PARALLEL );
+    char aBuf[64];
+    time_t now;
+    int pid;
+
+    /* Wait until a connection arrives, a queued client sends something,
+    ** or a child exits or changes state.  Queued connections are only
+    ** watched while there is room for another busy child. */
+    isPolled = nchildren-nIdle<MAX_PARALLEL
+            && nchildren<MAX_PARALLEL+MAX_KEEPALIVE_IDLE;
+    nPoll = isPolled ? nWait+3 : 3;
+    for(i=0; i<nWait+3; i++){
+      aPoll[i].events = POLLIN;
+      aPoll[i].revents = 0;
     }
-    delay.tv_sec = 60;
-    delay.tv_usec = 0;
-    FD_ZERO(&readfds);
-    assert( listener>=0 );
-    FD_SET( listener, &readfds);
-    select( listener+1, &readfds, 0, 0, &delay);
-    if( FD_ISSET(listener, &readfds) ){
-      lenaddr = sizeof(inaddr);
-      connection = accept(listener, (struct sockaddr*)&inaddr, &lenaddr);
-      if( connection>=0 ){
+    if( poll(aPoll, nPoll, nWait>0 ? 1000 : -1)<0 && errno!=EINTR ){
+      fossil_fatal("poll() failed on the listening socket");
+    }
+    while( read(aWake[0], aBuf, sizeof(aBuf))>0 ){}
+
+    /* Note children whose connections went idle or became busy.  This
+    ** comes before the burial of dead children, so that a child that
+    ** reported and then exited is not left counted as idle. */
+    while( read(aStatus[0], &pid, sizeof(pid))==sizeof(pid) ){
+      for(i=0; i<nchildren && aChild[i]!=(pid<0 ? -pid : pid); i++){}
+      if( i<nchildren && aIsIdle[i]!=(pid<0) ){
+        aIsIdle[i] = pid<0;
+        nIdle += pid<0 ? 1 : -1;
+      }
+    }
+
+    /* Bury dead children */
+    while( (pid = waitpid(0, 0, WNOHANG))>0 ){
+      for(i=0; i<nchildren && aChild[i]!=pid; i++){}
+      if( i<nchildren ){
+        if( aIsIdle[i] ) nIdle--;
+        nchildren--;
+        aChild[i] = aChild[nchildren];
+        aIsIdle[i] = aIsIdle[nchildren];
+      }
+    }
+
+    /* Start a child for each queued connection that is ready.  Turn
+    ** away a connection that has waited too long because every child
+    ** is busy, and close one that has had room to send a request for
+    ** that long and has not. */
+    now = time(0);
+    for(i=j=0; i<nWait; i++){
+      connection = aPoll[i+3].fd;
+      if( aPoll[i+3].revents
+       && nchildren-nIdle<MAX_PARALLEL
+       && nchildren<MAX_PARALLEL+MAX_KEEPALIVE_IDLE
+      ){
         child = fork();
-        if( child!=0 ){
-          if( child>0 ) nchildren++;
-          close(connection);
-        }else{
-          int nErr = 0, fd;
-          close(0);
-          fd = dup(connection);
-          if( fd!=0 ) nErr++;
-          close(1);
-          fd = dup(connection);
-          if( fd!=1 ) nErr++;
-          if( !g.fHttpTrace && !g.fSqlTrace ){
-            close(2);
-            fd = dup(connection);
-            if( fd!=2 ) nErr++;
+        if( child==0 ){
+          int nErr;
+          signal(SIGCHLD, SIG_DFL);
+          childExitFd = -1;
+          close(aWake[0]);
+          close(aWake[1]);
+          close(aStatus[0]);
+          connStatusFd = aStatus[1];
+          close(listener);
+          for(j=0; j<nWait; j++){
+            if( j!=i ) close(aPoll[j+3].fd);
           }
-          close(connection);
+          nErr = cgi_connection_to_stdio(connection);
+          if( nErr==0 && !cgi_serve_connection() ) exit(0);
           return nErr;
         }
+        if( child>0 ){
+          aChild[nchildren] = child;
+          aIsIdle[nchildren] = 0;
+          nchildren++;
+          close(connection);
+          continue;
+        }
       }
+      if( now-aArrive[i]>HTTP_KEEPALIVE_TIMEOUT && aPoll[i+3].revents==0 ){
+        if( !isPolled ) cgi_reply_busy(connection);
+        close(connection);
+        continue;
+      }
+      aPoll[j+3].fd = connection;
+      aArrive[j] = aArrive[i];
+      j++;
     }
-    /* Bury dead children */
-    while( waitpid(0, 0, WNOHANG)>0 ){
-      nchildren--;
+    nWait = j;
+
+    /* Queue new connections, or turn them away if the queue is full */
+    while( (aPoll[0].revents & POLLIN)!=0 ){
+      lenaddr = sizeof(inaddr);
+      connection = accept(listener, (struct sockaddr*)&inaddr, &lenaddr);
+      if( connection<0 ) break;
+      fcntl(connection, F_SETFL, 0);  /* Not inherited from listener */
+      if( nWait>=nQueue ){
+        cgi_reply_busy(connection);
+        close(connection);
+      }else{
+        aPoll[nWait+3].fd = connection;
+        aArrive[nWait] = now;
+        nWait++;
+      }
     }
+    metrics_workers(nchildren-nIdle, MAX_PARALLEL, nWait);
   }
   /* NOT REACHED */  
   fossil_exit(1);
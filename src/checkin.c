@@ -188,6 +188,7 @@ void status_cmd(void){
   if( vid ){
     show_common_info(vid, "checkout:", 1, 1);
   }
+  autosync_show_status();
   db_record_repository_filename(0);
   changes_cmd();
 }
@@ -636,7 +637,8 @@ static void create_manifest(
   const char *zBranch,        /* Branch name.  May be 0 */
   const char *zBgColor,       /* Background color.  May be 0 */
   const char *zTag,           /* Tag to apply to this check-in */
-  int *pnFBcard               /* Number of generated B- and F-cards */
+  int *pnFBcard,              /* Number of generated B- and F-cards */
+  int *pnFile                 /* Number of F-cards in a baseline manifest */
 ){
   char *zDate;                /* Date of the check-in */
   char *zParentUuid;          /* UUID of parent check-in */
@@ -647,6 +649,7 @@ static void create_manifest(
   Blob mcksum;                /* Manifest checksum */
   ManifestFile *pFile;        /* File from the baseline */
   int nFBcard = 0;            /* Number of B-cards and F-cards */
+  int nFile = 0;              /* Number of files in the check-in */
 
   assert( pBaseline==0 || pBaseline->zBaseline==0 );
   assert( pBaseline==0 || zBaselineUuid!=0 );
@@ -666,11 +669,15 @@ static void create_manifest(
   zDate[10] = ' ';
   db_prepare(&q,
     "SELECT pathname, uuid, origname, blob.rid, isexe, islink,"
-    "       file_is_selected(vfile.id)"
+    "       file_is_selected(vfile.id), 0"
     "  FROM vfile JOIN blob ON vfile.mrid=blob.rid"
     " WHERE (NOT deleted OR NOT file_is_selected(vfile.id))"
     "   AND vfile.vid=%d"
-    " ORDER BY 1", vid);
+    "%s"
+    " ORDER BY 1", vid,
+    vfile_sparse_carry(vid) ?
+      " UNION ALL SELECT pathname, uuid, NULL, rid, isexe, islink, 0, 1"
+      " FROM sparse_carry" : "");
   blob_zero(&filename);
   blob_appendf(&filename, "%s", g.zLocalRoot);
   nBasename = blob_size(&filename);
@@ -682,22 +689,27 @@ static void create_manifest(
     int isExe = db_column_int(&q, 4);
     int isLink = db_column_int(&q, 5);
     int isSelected = db_column_int(&q, 6);
+    int isCarried = db_column_int(&q, 7);
     const char *zPerm;
     int cmp;
+    nFile++;
 #if !defined(_WIN32)
     int mPerm;
 
     /* For unix, extract the "executable" and "symlink" permissions
     ** directly from the filesystem.  On windows, permissions are
-    ** unchanged from the original. 
+    ** unchanged from the original.  Files outside of a sparse checkout
+    ** are not on disk and keep their permissions too.
     */
 
-    blob_resize(&filename, nBasename);
-    blob_append(&filename, zName, -1);
+    if( !isCarried ){
+      blob_resize(&filename, nBasename);
+      blob_append(&filename, zName, -1);
 
-    mPerm = file_wd_perm(blob_str(&filename));
-    isExe = ( mPerm==PERM_EXE );
-    isLink = ( mPerm==PERM_LNK );
+      mPerm = file_wd_perm(blob_str(&filename));
+      isExe = ( mPerm==PERM_EXE );
+      isLink = ( mPerm==PERM_LNK );
+    }
 #endif
     if( isExe ){
       zPerm = " x";
@@ -792,6 +804,35 @@ static void create_manifest(
   md5sum_blob(pOut, &mcksum);
   blob_appendf(pOut, "Z %b\n", &mcksum);
   if( pnFBcard ) *pnFBcard = nFBcard;
+  if( pnFile ) *pnFile = nFile;
+}
+
+/*
+** The maximum number of delta-manifests in a row, counted along primary
+** parents, that share a single baseline manifest.  The next check-in
+** after that many gets a new baseline, so that the F-cards repeated by
+** every delta-manifest in the chain stay few.
+*/
+#define MAX_DELTA_MANIFEST_CHAIN 50
+
+/*
+** Return the number of check-ins from vid back to its ancestor baseRid
+** along primary parents, counting vid but not baseRid.  The search
+** stops at MAX_DELTA_MANIFEST_CHAIN, which is also returned if baseRid
+** is not found.
+*/
+static int commit_delta_chain(int vid, int baseRid){
+  Stmt q;
+  int n = 0;
+  db_prepare(&q, "SELECT pid FROM plink WHERE cid=:cid AND isprim");
+  while( vid!=baseRid && vid>0 && n<MAX_DELTA_MANIFEST_CHAIN ){
+    n++;
+    db_bind_int(&q, ":cid", vid);
+    vid = db_step(&q)==SQLITE_ROW ? db_column_int(&q, 0) : 0;
+    db_reset(&q);
+  }
+  db_finalize(&q);
+  return vid==baseRid ? n : MAX_DELTA_MANIFEST_CHAIN;
 }
 
 /*
@@ -847,6 +888,91 @@ static void cr_warning(const Blob *p, const char *zFilename){
   }
 }
 
+/*
+** A modified file that is being stored by "fossil commit".  The content
+** is read, and checked for CR/NL line endings, by the main thread.  A
+** worker thread then computes the hash and the compressed content, so
+** that only the insert into the BLOB table is left for the main thread.
+*/
+typedef struct CommitFile CommitFile;
+struct CommitFile {
+  int id;                 /* vfile.id of the file */
+  int rid;                /* vfile.mrid.  Prior version of the file, or 0 */
+  int nByte;              /* Size of the uncompressed content */
+  Blob content;           /* Content.  Compressed in place by the worker */
+  Blob hash;              /* SHA1 hash of the content */
+  int nrid;               /* New version, if already stored from disk */
+};
+
+/*
+** Store files once this many are waiting, or once this many bytes of
+** content are waiting.
+*/
+#define COMMIT_BATCH_FILES   500
+#define COMMIT_BATCH_BYTES   50000000
+
+/*
+** WorkPool task:  Hash and compress the content of a CommitFile.
+*/
+static void commit_file_task(void *pArg){
+  CommitFile *p = (CommitFile*)pArg;
+  Blob cmpr;
+  if( p->nrid ) return;
+  sha1sum_blob(&p->content, &p->hash);
+  if( p->nByte>0 ){
+    blob_zero(&cmpr);
+    content_compress(&p->content, &cmpr);
+    blob_reset(&p->content);
+    p->content = cmpr;
+  }
+}
+
+/*
+** Hash and compress the nFile files of aFile[] using the threads of pPool,
+** then store them in order.  Append a request to convert the prior version
+** of each file into a delta of the new version to *paReq.
+*/
+static void commit_store_files(
+  CommitFile *aFile,      /* Files to be stored */
+  int nFile,              /* Number of entries in aFile[] */
+  WorkPool *pPool,        /* Threads that do the hashing and compression */
+  DeltifyReq **paReq,     /* Append delta requests to this array */
+  int *pnReq,             /* Number of entries in *paReq */
+  int *pnReqAlloc         /* Slots allocated for *paReq */
+){
+  int i;
+  for(i=0; i<nFile; i++){
+    workpool_add(pPool, commit_file_task, &aFile[i]);
+  }
+  workpool_wait(pPool);
+  for(i=0; i<nFile; i++){
+    CommitFile *p = &aFile[i];
+    int nrid;
+    if( p->nrid ){
+      nrid = p->nrid;
+    }else if( p->nByte>0 ){
+      nrid = content_put_ex(&p->content, blob_str(&p->hash), 0, p->nByte, 0);
+    }else{
+      nrid = content_put(&p->content);
+    }
+    blob_reset(&p->content);
+    blob_reset(&p->hash);
+    if( p->rid>0 ){
+      if( *pnReq>=*pnReqAlloc ){
+        *pnReqAlloc = *pnReqAlloc*2 + 100;
+        *paReq = fossil_realloc(*paReq, *pnReqAlloc*sizeof(DeltifyReq));
+      }
+      (*paReq)[*pnReq].rid = p->rid;
+      (*paReq)[*pnReq].aSrc[0] = nrid;
+      (*paReq)[*pnReq].aSrc[1] = 0;
+      (*pnReq)++;
+    }
+    db_multi_exec("UPDATE vfile SET mrid=%d, rid=%d WHERE id=%d",
+                  nrid, nrid, p->id);
+    db_multi_exec("INSERT OR IGNORE INTO unsent VALUES(%d)", nrid);
+  }
+}
+
 /*
 ** COMMAND: ci*
 ** COMMAND: commit
@@ -894,7 +1020,6 @@ static void cr_warning(const Blob *p, const char *zFilename){
 void commit_cmd(void){
   int hasChanges;        /* True if unsaved changes exist */
   int vid;               /* blob-id of parent version */
-  int nrid;              /* blob-id of a modified file */
   int nvid;              /* Blob-id of the new check-in */
   Blob comment;          /* Check-in comment */
   const char *zComment;  /* Check-in comment */
@@ -918,9 +1043,17 @@ void commit_cmd(void){
   Blob manifest;         /* Manifest in baseline form */
   Blob muuid;            /* Manifest uuid */
   Blob cksum1, cksum2;   /* Before and after commit checksums */
+  Blob cksum3;           /* Checksum of the new manifest */
   Blob cksum1b;          /* Checksum recorded in the manifest */
   int szD;               /* Size of the delta manifest */
   int szB;               /* Size of the baseline manifest */
+  WorkPool *pPool;       /* Threads that hash and compress modified files */
+  CommitFile *aFile;     /* Modified files waiting to be stored */
+  int nFile = 0;         /* Number of entries in aFile[] */
+  i64 szFile = 0;        /* Bytes of content in aFile[] */
+  DeltifyReq *aReq = 0;  /* Prior versions to be converted into deltas */
+  int nReq = 0;          /* Number of entries in aReq[] */
+  int nReqAlloc = 0;     /* Slots allocated for aReq[] */
  
   url_proxy_options();
   noSign = find_option("nosign",0,0)!=0;
@@ -947,23 +1080,33 @@ void commit_cmd(void){
   noSign = db_get_boolean("omitsign", 0)|noSign;
   if( db_get_boolean("clearsign", 0)==0 ){ noSign = 1; }
   useCksum = db_get_boolean("repo-cksum", 1);
+  if( vfile_sparse_glob() ){
+    /* The R-card covers files that a sparse checkout does not have */
+    useCksum = 0;
+  }
   outputManifest = db_get_boolean("manifest", 0);
   verify_all_options();
 
+  /* Get the ID of the parent manifest artifact */
+  vid = db_lget_int("checkout", 0);
+  if( content_is_private(vid) ){
+    g.markPrivate = 1;
+  }
+
   /* So that older versions of Fossil (that do not understand delta-
   ** manifest) can continue to use this repository, do not create a new
   ** delta-manifest unless this repository already contains one or more
   ** delta-manifets, or unless the delta-manifest is explicitly requested
-  ** by the --delta option.
+  ** by the --delta option, or unless the tree is so large that the
+  ** "delta-manifest-files" setting asks for them.
   */
   if( !forceDelta && !db_get_boolean("seen-delta-manifest",0) ){
-    forceBaseline = 1;
-  }
-
-  /* Get the ID of the parent manifest artifact */
-  vid = db_lget_int("checkout", 0);
-  if( content_is_private(vid) ){
-    g.markPrivate = 1;
+    int nMin = db_get_int("delta-manifest-files", 10000);
+    if( nMin<=0
+     || db_int(0, "SELECT count(*) FROM vfile WHERE vid=%d", vid)<nMin
+    ){
+      forceBaseline = 1;
+    }
   }
 
   /*
@@ -1084,54 +1227,86 @@ void commit_cmd(void){
   /* Step 1: Insert records for all modified files into the blob 
   ** table. If there were arguments passed to this command, only
   ** the identified fils are inserted (if they have been modified).
+  ** Files are read a batch at a time and hashed and compressed by
+  ** the threads of pPool.  The prior versions are converted into
+  ** deltas once all of the new versions are stored.
   */
+  content_compression_init();
+  chunk_begin();
+  pPool = workpool_new(workpool_size(0));
+  aFile = fossil_malloc(COMMIT_BATCH_FILES*sizeof(aFile[0]));
   db_prepare(&q,
     "SELECT id, %Q || pathname, mrid, %s FROM vfile "
     "WHERE chnged==1 AND NOT deleted AND file_is_selected(id)",
     g.zLocalRoot, glob_expr("pathname", db_get("crnl-glob",""))
   );
   while( db_step(&q)==SQLITE_ROW ){
-    int id, rid;
+    CommitFile *p = &aFile[nFile];
     const char *zFullname;
-    Blob content;
     int crnlOk;
+    i64 sz;
 
-    id = db_column_int(&q, 0);
+    p->id = db_column_int(&q, 0);
     zFullname = db_column_text(&q, 1);
-    rid = db_column_int(&q, 2);
+    p->rid = db_column_int(&q, 2);
     crnlOk = db_column_int(&q, 3);
 
-    blob_zero(&content);
+    blob_zero(&p->content);
+    blob_zero(&p->hash);
+    p->nrid = 0;
     if( file_wd_islink(zFullname) ){
       /* Instead of file content, put link destination path */
-      blob_read_link(&content, zFullname);
+      blob_read_link(&p->content, zFullname);
+    }else if( (sz = file_wd_size(zFullname))>=CONTENT_STREAM_SIZE
+           || chunk_wanted(sz) ){
+      /* Very large files are stored a chunk at a time or streamed, without
+      ** reading them into memory.  Only the first megabyte is checked for
+      ** CR/NL line endings. */
+      if( !crnlOk ){
+        FILE *in = fossil_fopen(zFullname, "rb");
+        if( in ){
+          blob_read_from_channel(&p->content, in, 1048576);
+          fclose(in);
+          cr_warning(&p->content, zFullname);
+          blob_reset(&p->content);
+        }
+      }
+      if( chunk_wanted(sz) ){
+        p->nrid = chunk_put_file(zFullname, 0);
+      }else{
+        p->nrid = content_put_file(zFullname, 0);
+      }
     }else{
-      blob_read_from_file(&content, zFullname);        
+      blob_read_from_file(&p->content, zFullname);        
     }
-    if( !crnlOk ) cr_warning(&content, zFullname);
-    nrid = content_put(&content);
-    blob_reset(&content);
-    if( rid>0 ){
-      content_deltify(rid, nrid, 0);
+    if( !crnlOk && !p->nrid ) cr_warning(&p->content, zFullname);
+    p->nByte = blob_size(&p->content);
+    szFile += p->nByte;
+    nFile++;
+    if( nFile>=COMMIT_BATCH_FILES || szFile>=COMMIT_BATCH_BYTES ){
+      commit_store_files(aFile, nFile, pPool, &aReq, &nReq, &nReqAlloc);
+      nFile = 0;
+      szFile = 0;
     }
-    db_multi_exec("UPDATE vfile SET mrid=%d, rid=%d WHERE id=%d", nrid,nrid,id);
-    db_multi_exec("INSERT OR IGNORE INTO unsent VALUES(%d)", nrid);
   }
   db_finalize(&q);
+  commit_store_files(aFile, nFile, pPool, &aReq, &nReq, &nReqAlloc);
+  content_deltify_many(nReq, aReq, pPool);
+  workpool_delete(pPool);
+  fossil_free(aFile);
+  fossil_free(aReq);
 
   /* Create the new manifest */
   if( blob_size(&comment)==0 ){
     blob_append(&comment, "(no comment)", -1);
   }
-  if( forceDelta ){
-    blob_zero(&manifest);
-  }else{
-    create_manifest(&manifest, 0, 0, &comment, vid,
-                    !forceFlag, useCksum ? &cksum1 : 0,
-                    zDateOvrd, zUserOvrd, zBranch, zBgColor, zTag, &szB);
-  }
+  blob_zero(&manifest);
 
-  /* See if a delta-manifest would be more appropriate */
+  /* See if a delta-manifest would be more appropriate.  The delta is
+  ** built first, since it also reports the number of F-cards that a
+  ** baseline manifest would need, and building the baseline manifest
+  ** of a large tree is then avoided if the delta is chosen.
+  */
   if( !forceBaseline ){
     const char *zBaselineUuid;
     Manifest *pParent;
@@ -1140,21 +1315,27 @@ void commit_cmd(void){
     if( pParent && pParent->zBaseline ){
       zBaselineUuid = pParent->zBaseline;
       pBaseline = manifest_get_by_name(zBaselineUuid, 0);
+      if( pBaseline && !forceDelta
+       && commit_delta_chain(vid, pBaseline->rid)>=MAX_DELTA_MANIFEST_CHAIN
+      ){
+        /* Too many delta-manifests since the last baseline.  Write a
+        ** full baseline manifest for this check-in instead. */
+        manifest_destroy(pBaseline);
+        pBaseline = 0;
+      }
     }else{
       zBaselineUuid = db_text(0, "SELECT uuid FROM blob WHERE rid=%d", vid);
       pBaseline = pParent;
     }
     if( pBaseline ){
-      Blob delta;
-      create_manifest(&delta, zBaselineUuid, pBaseline, &comment, vid,
+      create_manifest(&manifest, zBaselineUuid, pBaseline, &comment, vid,
                       !forceFlag, useCksum ? &cksum1 : 0,
-                      zDateOvrd, zUserOvrd, zBranch, zBgColor, zTag, &szD);
+                      zDateOvrd, zUserOvrd, zBranch, zBgColor, zTag,
+                      &szD, &szB);
       /*
-      ** At this point, two manifests have been constructed, either of
-      ** which would work for this checkin.  The first manifest (held
-      ** in the "manifest" variable) is a baseline manifest and the second
-      ** (held in variable named "delta") is a delta manifest.  The
-      ** question now is: which manifest should we use?
+      ** At this point, a delta manifest (held in the "manifest" variable)
+      ** has been constructed.  The question now is whether to use it or
+      ** to construct a baseline manifest instead.
       **
       ** Let B be the number of F-cards in the baseline manifest and
       ** let D be the number of F-cards in the delta manifest, plus one for
@@ -1168,15 +1349,22 @@ void commit_cmd(void){
       ** X is an unknown here, but for most repositories, we will not be
       ** far wrong if we assume X=3.
       */
-      if( forceDelta || (szD*szD)<(szB*3-9) ){
+      if( !forceDelta && (szD*szD)>=(szB*3-9) ){
         blob_reset(&manifest);
-        manifest = delta;
-      }else{
-        blob_reset(&delta);
       }
     }else if( forceDelta ){
       fossil_panic("unable to find a baseline-manifest for the delta");
     }
+
+    /* Keep the baseline in the manifest cache, so that crosslinking the
+    ** new delta-manifest below does not parse it a second time */
+    if( pParent!=pBaseline ) manifest_destroy(pParent);
+    manifest_destroy(pBaseline);
+  }
+  if( blob_size(&manifest)==0 ){
+    create_manifest(&manifest, 0, 0, &comment, vid,
+                    !forceFlag, useCksum ? &cksum1 : 0,
+                    zDateOvrd, zUserOvrd, zBranch, zBgColor, zTag, &szB, 0);
   }
   if( !noSign && !g.markPrivate && clearsign(&manifest, &manifest) ){
     Blob ans;
@@ -1235,9 +1423,10 @@ void commit_cmd(void){
   if( useCksum ){
     /* Verify that the repository checksum matches the expected checksum
     ** calculated before the checkin started (and stored as the R record
-    ** of the manifest file).
+    ** of the manifest file).  The checksum of the new manifest is
+    ** computed in the same pass, into cksum3.
     */
-    vfile_aggregate_checksum_repository(nvid, &cksum2);
+    vfile_aggregate_checksum_pair(nvid, &cksum2, &cksum3, &cksum1b);
     if( blob_compare(&cksum1, &cksum2) ){
       vfile_compare_repository_to_disk(nvid);
       fossil_fatal("working checkout does not match what would have ended "
@@ -1246,15 +1435,14 @@ void commit_cmd(void){
     }
   
     /* Verify that the manifest checksum matches the expected checksum */
-    vfile_aggregate_checksum_manifest(nvid, &cksum2, &cksum1b);
     if( blob_compare(&cksum1, &cksum1b) ){
       fossil_fatal("manifest checksum self-test failed: "
                    "%b versus %b", &cksum1, &cksum1b);
     }
-    if( blob_compare(&cksum1, &cksum2) ){
+    if( blob_compare(&cksum1, &cksum3) ){
       fossil_fatal(
          "working checkout does not match manifest after commit: "
-         "%b versus %b", &cksum1, &cksum2);
+         "%b versus %b", &cksum1, &cksum3);
     }
   
     /* Verify that the commit did not modify any disk images. */
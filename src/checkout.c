@@ -244,7 +244,7 @@ void checkout_cmd(void){
   db_lset_int("checkout", vid);
   undo_reset();
   db_multi_exec("DELETE FROM vmerge");
-  if( !keepFlag && db_get_boolean("repo-cksum",1) ){
+  if( !keepFlag && db_get_boolean("repo-cksum",1) && !vfile_sparse_glob() ){
     vfile_aggregate_checksum_manifest(vid, &cksum1, &cksum1b);
     vfile_aggregate_checksum_disk(vid, &cksum2);
     if( blob_compare(&cksum1, &cksum2) ){
@@ -257,6 +257,122 @@ void checkout_cmd(void){
   db_end_transaction(0);
 }
 
+/*
+** Remove each directory that holds the file zName, which is relative
+** to the root of the checkout, if it has been left empty.
+*/
+static void sparse_remove_empty_dirs(const char *zName){
+  char *zDir = mprintf("%s%s", g.zLocalRoot, zName);
+  int nRoot = strlen(g.zLocalRoot);
+  int i;
+  for(i=strlen(zDir)-1; i>nRoot; i--){
+    if( zDir[i]!='/' ) continue;
+    zDir[i] = 0;
+    if( file_rmdir(zDir) ) break;
+  }
+  free(zDir);
+}
+
+/*
+** COMMAND: sparse
+**
+** Usage: %fossil sparse ?PATTERN ...? ?--clear?
+**
+** Show or change the sparse-checkout profile of the current checkout.
+** A sparse checkout holds only the files whose names, or the names of
+** the directories that hold them, match one of the GLOB patterns of its
+** profile.  Other files are not written to disk and are not examined
+** by commands such as "status", "changes", and "extras".  A commit
+** carries them forward unchanged.  Merges are not possible in a sparse
+** checkout.
+**
+** With no arguments, show the profile.  With PATTERN arguments, make
+** them the new profile, add the files that now match it, and remove
+** the files that no longer do, along with any directories that this
+** leaves empty.  Files with uncommitted changes cannot be removed from
+** the checkout.
+**
+** Options:
+**   --clear    Check out every file again
+**
+** See also: open
+*/
+void sparse_cmd(void){
+  int clearFlag;
+  int vid, i;
+  int mxId;
+  char *zGlob;
+  Stmt q;
+
+  db_must_be_within_tree();
+  clearFlag = find_option("clear",0,0)!=0;
+  vid = db_lget_int("checkout", 0);
+  if( !clearFlag && g.argc<3 ){
+    zGlob = db_lget("sparse-glob", 0);
+    if( zGlob ){
+      fossil_print("%s\n", zGlob);
+    }else{
+      fossil_print("not a sparse checkout\n");
+    }
+    free(zGlob);
+    return;
+  }
+  if( clearFlag && g.argc>2 ){
+    usage("?PATTERN ...? ?--clear?");
+  }
+  db_begin_transaction();
+  if( db_exists("SELECT 1 FROM vmerge") ){
+    fossil_fatal("cannot change the profile of an uncommitted merge");
+  }
+  vfile_check_signature(vid, 0, 0);
+  if( clearFlag ){
+    db_multi_exec("DELETE FROM vvar WHERE name='sparse-glob'");
+  }else{
+    Blob x;
+    blob_zero(&x);
+    for(i=2; i<g.argc; i++){
+      blob_appendf(&x, "%s%s", i>2 ? "," : "", g.argv[i]);
+    }
+    db_lset("sparse-glob", blob_str(&x));
+    blob_reset(&x);
+  }
+  vfile_sparse_reset();
+
+  /* Remove the files that are no longer part of the checkout */
+  db_prepare(&q, "SELECT id, pathname, chnged OR deleted OR rid=0"
+                 "  FROM vfile WHERE vid=%d", vid);
+  while( db_step(&q)==SQLITE_ROW ){
+    const char *zName = db_column_text(&q, 1);
+    if( vfile_in_sparse_profile(zName) ) continue;
+    if( db_column_int(&q, 2) ){
+      fossil_fatal("cannot remove %s: it has uncommitted changes", zName);
+    }
+  }
+  db_reset(&q);
+  while( db_step(&q)==SQLITE_ROW ){
+    const char *zName = db_column_text(&q, 1);
+    char *zFull;
+    if( vfile_in_sparse_profile(zName) ) continue;
+    zFull = mprintf("%s%s", g.zLocalRoot, zName);
+    file_delete(zFull);
+    free(zFull);
+    sparse_remove_empty_dirs(zName);
+    db_multi_exec("DELETE FROM vfile WHERE id=%d", db_column_int(&q, 0));
+  }
+  db_finalize(&q);
+
+  /* Add the files that are now part of the checkout */
+  mxId = db_int(0, "SELECT max(id) FROM vfile");
+  vfile_add_missing(vid);
+  db_prepare(&q, "SELECT id FROM vfile WHERE id>%d", mxId);
+  while( db_step(&q)==SQLITE_ROW ){
+    vfile_to_disk(0, db_column_int(&q, 0), 1, 1);
+  }
+  db_finalize(&q);
+  checkout_set_all_exe(vid);
+  db_end_transaction(0);
+}
+
 /*
 ** Unlink the local database file
 */
@@ -0,0 +1,443 @@
+/*
+** Copyright (c) 2012 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*******************************************************************************
+**
+** This file contains code used to store very large artifacts in pieces.
+**
+** An artifact of at least "chunk-threshold" bytes is cut into chunks at
+** places chosen by a rolling hash of its content, so that an edit to
+** one part of a file moves only the nearby boundaries and most chunks
+** are the same as those of the prior version.  Each distinct chunk is
+** compressed and stored once in the CHUNK table, and CHUNKMAP lists the
+** chunks of every chunked artifact in order.
+**
+** The BLOB table entry of a chunked artifact keeps its usual uuid and
+** size, but its content is a zero-length blob.  Compressed content is
+** never that short, so a zero-length BLOB.CONTENT with a positive
+** BLOB.SIZE is all that is needed to recognize a chunked artifact.
+**
+** A chunked artifact can be stored from a file, and content_stream_ex()
+** passes it on a chunk at a time for checkouts, verification and the
+** network, so it is never held in memory in its entirety on those
+** paths.  Chunked artifacts are never made into deltas nor used as
+** delta sources:  the shared chunks already hold what two versions have
+** in common.  They are sent to other repositories as ordinary full
+** text, and the CHUNK and CHUNKMAP tables are local to each repository,
+** like the DELTA table.
+**
+** Once the chunk tables exist, the "aux-schema" of the repository has
+** the AUX_FEATURE_CHUNKED feature, so that versions of fossil that do
+** not know about chunks refuse to open it rather than read chunked
+** artifacts as empty.
+*/
+#include "config.h"
+#include "chunk.h"
+#include <assert.h>
+
+/*
+** Schema for chunked storage.  Created the first time an artifact is
+** chunked.
+*/
+static const char zChunkSchema[] =
+@ CREATE TABLE IF NOT EXISTS %s.chunk(
+@   cid INTEGER PRIMARY KEY,       -- Chunk ID
+@   hash TEXT UNIQUE NOT NULL,     -- SHA1 hash of the uncompressed chunk
+@   size INTEGER,                  -- Size of the uncompressed chunk
+@   content BLOB                   -- Compressed chunk
+@ );
+@ CREATE TABLE IF NOT EXISTS %s.chunkmap(
+@   rid INTEGER,                   -- BLOB.RID of a chunked artifact
+@   seq INTEGER,                   -- Position of the chunk in the artifact
+@   cid INTEGER,                   -- The chunk
+@   PRIMARY KEY(rid, seq)
+@ );
+;
+
+/*
+** Chunks are at least CHUNK_MIN and at most CHUNK_MAX bytes, except
+** for the last chunk of an artifact, which can be shorter.  A boundary
+** is placed wherever the rolling hash has all of the bits of CHUNK_MASK
+** clear, so past CHUNK_MIN a boundary is found on average every 1MB.
+** The "chunk-threshold" setting is never less than CHUNK_THRESHOLD_MIN.
+*/
+#define CHUNK_MIN             262144
+#define CHUNK_MAX             4194304
+#define CHUNK_MASK            0xfffff000
+#define CHUNK_THRESHOLD_MIN   1048576
+
+/*
+** Random values for the rolling hash, one for each byte value.
+*/
+static unsigned int aChunkGear[256];
+
+/*
+** Fill aChunkGear[].  The values come from a fixed xorshift sequence,
+** so that every build of fossil cuts the same content at the same
+** places.
+*/
+static void chunk_gear_init(void){
+  static int isInit = 0;
+  unsigned int x = 0x2545f491;
+  int i;
+  if( isInit ) return;
+  for(i=0; i<256; i++){
+    x ^= x<<13;
+    x ^= x>>17;
+    x ^= x<<5;
+    aChunkGear[i] = x;
+  }
+  isInit = 1;
+}
+
+/*
+** Return the length of the chunk that starts at z[0], where n bytes are
+** available.  The caller must supply at least CHUNK_MAX bytes unless z[]
+** holds the rest of the artifact, so that the result is the same however
+** the content is read.
+**
+** The rolling hash is a "gear" hash:  each byte shifts the hash left and
+** adds a random value, so the high bits tested by CHUNK_MASK depend only
+** on the last 32 bytes.
+*/
+static int chunk_cut(const unsigned char *z, int n){
+  unsigned int h = 0;
+  int i, mx;
+  if( n<=CHUNK_MIN ) return n;
+  mx = n<CHUNK_MAX ? n : CHUNK_MAX;
+  for(i=CHUNK_MIN; i<mx; i++){
+    h = (h<<1) + aChunkGear[z[i]];
+    if( (h & CHUNK_MASK)==0 ) return i+1;
+  }
+  return mx;
+}
+
+/*
+** Return true if the CHUNK and CHUNKMAP tables exist.
+*/
+static int chunk_tables_exist(void){
+  static Stmt q;
+  int rc;
+  db_static_prepare(&q,
+    "SELECT 1 FROM %s.sqlite_master WHERE name='chunkmap'",
+    db_name("repository")
+  );
+  rc = db_step(&q)==SQLITE_ROW;
+  db_reset(&q);
+  return rc;
+}
+
+/*
+** Return true if an artifact of n bytes should be chunked.
+*/
+int chunk_wanted(i64 n){
+  int mn;
+  if( n<CHUNK_THRESHOLD_MIN ) return 0;
+  mn = db_get_int("chunk-threshold", 0);
+  if( mn<=0 ) return 0;
+  if( mn<CHUNK_THRESHOLD_MIN ) mn = CHUNK_THRESHOLD_MIN;
+  return n>=mn;
+}
+
+/*
+** Return true if artifact rid is stored in chunks.
+*/
+int chunk_is_chunked(int rid){
+  static Stmt q;
+  int rc;
+  if( !chunk_tables_exist() ) return 0;
+  db_static_prepare(&q, "SELECT 1 FROM chunkmap WHERE rid=:rid");
+  db_bind_int(&q, ":rid", rid);
+  rc = db_step(&q)==SQLITE_ROW;
+  db_reset(&q);
+  return rc;
+}
+
+/*
+** An artifact being stored a chunk at a time.
+*/
+typedef struct ChunkWriter ChunkWriter;
+struct ChunkWriter {
+  SHA1Context ctx;        /* Hash of the whole artifact */
+  i64 size;               /* Bytes stored so far */
+  int nCid;               /* Number of entries in aCid[] */
+  int nAlloc;             /* Slots allocated for aCid[] */
+  int *aCid;              /* The chunks, in order */
+};
+
+/*
+** Return the "aux-schema" value for the repository:  with the chunked
+** feature if it has chunk tables.  The zstd feature is kept as it is,
+** since artifacts compressed with zstd do not go away.
+*/
+const char *chunk_aux_schema(void){
+  char *zValue = db_get("aux-schema", 0);
+  int m = zValue ? db_aux_schema_features(zValue) : 0;
+  fossil_free(zValue);
+  m = m>0 ? (m & AUX_FEATURE_ZSTD) : 0;
+  if( chunk_tables_exist() ) m |= AUX_FEATURE_CHUNKED;
+  return db_aux_schema_value(m);
+}
+
+/*
+** Create the chunk tables if they do not exist yet and the
+** "chunk-threshold" setting is enabled, and mark the repository so
+** that older versions of fossil will not open it.  Commands that might
+** chunk an artifact while a query is running should call this first,
+** since a change to the schema stops running queries.
+*/
+void chunk_begin(void){
+  if( db_get_int("chunk-threshold", 0)>0 ){
+    if( !chunk_tables_exist() ){
+      const char *zDb = db_name("repository");
+      char *zSql = mprintf(zChunkSchema, zDb, zDb);
+      db_multi_exec("%s", zSql);
+      fossil_free(zSql);
+    }
+    db_aux_schema_add(AUX_FEATURE_CHUNKED);
+  }
+}
+
+/*
+** Begin storing a chunked artifact.
+*/
+static void chunk_writer_init(ChunkWriter *p){
+  memset(p, 0, sizeof(*p));
+  sha1_ctx_init(&p->ctx);
+  chunk_gear_init();
+  chunk_begin();
+}
+
+/*
+** Append the n bytes of z[] to the artifact being stored by p as its
+** next chunk.  The chunk is only stored if it is not there already.
+*/
+static void chunk_writer_add(ChunkWriter *p, const char *z, int n){
+  static Stmt ins;
+  Blob x, hash, cmpr;
+  int cid;
+  blob_init(&x, z, n);
+  sha1_ctx_step(&p->ctx, z, n);
+  p->size += n;
+  if( p->size>0x7fffffff ){
+    fossil_fatal("artifact is too large: more than 2GB");
+  }
+  sha1sum_blob(&x, &hash);
+  cid = db_int(0, "SELECT cid FROM chunk WHERE hash=%B", &hash);
+  if( cid==0 ){
+    content_compress(&x, &cmpr);
+    db_static_prepare(&ins,
+      "INSERT INTO chunk(hash,size,content) VALUES(:hash,:size,:content)"
+    );
+    db_bind_text(&ins, ":hash", blob_str(&hash));
+    db_bind_int(&ins, ":size", n);
+    db_bind_blob(&ins, ":content", &cmpr);
+    db_step(&ins);
+    db_reset(&ins);
+    cid = db_last_insert_rowid();
+    blob_reset(&cmpr);
+  }
+  blob_reset(&hash);
+  if( p->nCid>=p->nAlloc ){
+    p->nAlloc = p->nAlloc*2 + 100;
+    p->aCid = fossil_realloc(p->aCid, p->nAlloc*sizeof(p->aCid[0]));
+  }
+  p->aCid[p->nCid++] = cid;
+}
+
+/*
+** Record the chunks of p as the content of artifact rid.
+*/
+static void chunk_writer_map(ChunkWriter *p, int rid){
+  static Stmt ins;
+  int i;
+  db_multi_exec("DELETE FROM chunkmap WHERE rid=%d", rid);
+  db_static_prepare(&ins,
+    "INSERT INTO chunkmap(rid,seq,cid) VALUES(:rid,:seq,:cid)"
+  );
+  for(i=0; i<p->nCid; i++){
+    db_bind_int(&ins, ":rid", rid);
+    db_bind_int(&ins, ":seq", i);
+    db_bind_int(&ins, ":cid", p->aCid[i]);
+    db_step(&ins);
+    db_reset(&ins);
+  }
+}
+
+/*
+** Finish storing the artifact of p and return its rid.  zUuid is the
+** hash of the artifact, or NULL to use the hash computed from the
+** chunks.
+**
+** If the artifact is already in the repository as something other than
+** a phantom, it is left as it is, and any chunks that were added for
+** nothing are removed.
+*/
+static int chunk_writer_finish(
+  ChunkWriter *p,         /* The artifact being stored */
+  const char *zUuid,      /* Hash of the artifact, or NULL */
+  int isPrivate           /* The artifact should be marked private */
+){
+  char zHash[UUID_SIZE+1];
+  Blob empty;
+  Stmt q;
+  int rid = 0, size = -1;
+
+  sha1_ctx_finish(&p->ctx, zHash);
+  if( zUuid==0 ) zUuid = zHash;
+  db_prepare(&q, "SELECT rid, size FROM blob WHERE uuid=%Q", zUuid);
+  if( db_step(&q)==SQLITE_ROW ){
+    rid = db_column_int(&q, 0);
+    size = db_column_int(&q, 1);
+  }
+  db_finalize(&q);
+  if( rid>0 && size>=0 ){
+    chunk_delete_unused();
+  }else{
+    /* The chunk map of a phantom is made first, so that the artifact
+    ** can be read by the crosslinking that follows its dephantomization
+    ** within content_put_ex(). */
+    if( rid>0 ) chunk_writer_map(p, rid);
+    blob_init(&empty, "", 0);
+    rid = content_put_ex(&empty, zUuid, 0, (int)p->size, isPrivate);
+    chunk_writer_map(p, rid);
+  }
+  fossil_free(p->aCid);
+  return rid;
+}
+
+/*
+** Store the content of pBlob as a chunked artifact and return its rid.
+** zUuid is the hash of pBlob, or NULL to compute it.  This is called by
+** content_put_ex() when chunk_wanted() is true.
+*/
+int chunk_put(Blob *pBlob, const char *zUuid, int isPrivate){
+  ChunkWriter w;
+  const char *z = blob_buffer(pBlob);
+  int n = blob_size(pBlob);
+  int i = 0;
+  int rid;
+  db_begin_transaction();
+  chunk_writer_init(&w);
+  while( i<n ){
+    int nCut = chunk_cut((const unsigned char*)&z[i], n-i);
+    chunk_writer_add(&w, &z[i], nCut);
+    i += nCut;
+  }
+  rid = chunk_writer_finish(&w, zUuid, isPrivate);
+  db_end_transaction(0);
+  return rid;
+}
+
+/*
+** Store the content of file zFilename as a chunked artifact and return
+** its rid.  The file is read a chunk at a time.
+*/
+int chunk_put_file(const char *zFilename, int isPrivate){
+  ChunkWriter w;
+  FILE *in;
+  char *zBuf;
+  int n = 0;
+  int rid;
+  in = fossil_fopen(zFilename, "rb");
+  if( in==0 ){
+    fossil_fatal("cannot open %s for reading", zFilename);
+  }
+  zBuf = fossil_malloc(CHUNK_MAX);
+  db_begin_transaction();
+  chunk_writer_init(&w);
+  for(;;){
+    int nCut;
+    n += fread(&zBuf[n], 1, CHUNK_MAX-n, in);
+    if( n==0 ) break;
+    nCut = chunk_cut((const unsigned char*)zBuf, n);
+    chunk_writer_add(&w, zBuf, nCut);
+    n -= nCut;
+    memmove(zBuf, &zBuf[nCut], n);
+  }
+  if( ferror(in) ){
+    fossil_fatal("error reading %s", zFilename);
+  }
+  fclose(in);
+  fossil_free(zBuf);
+  rid = chunk_writer_finish(&w, 0, isPrivate);
+  db_end_transaction(0);
+  return rid;
+}
+
+/*
+** Pass the content of chunked artifact rid to xWrite(pArg, z, n), in
+** order, a chunk at a time.  Return the number of bytes passed to
+** xWrite, or -1 if rid is not chunked.
+*/
+int chunk_stream(
+  int rid,
+  void (*xWrite)(void*, const unsigned char*, int),
+  void *pArg
+){
+  Stmt q;
+  i64 n = 0;
+  int nChunk = 0;
+  if( !chunk_tables_exist() ) return -1;
+  db_prepare(&q,
+    "SELECT chunk.content FROM chunkmap, chunk"
+    " WHERE chunkmap.rid=%d AND chunk.cid=chunkmap.cid"
+    " ORDER BY chunkmap.seq", rid
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    Blob x;
+    db_ephemeral_blob(&q, 0, &x);
+    blob_uncompress(&x, &x);
+    perf_count(PERF_UNCOMPRESS, blob_size(&x));
+    nChunk++;
+    n += blob_size(&x);
+    xWrite(pArg, (const unsigned char*)blob_buffer(&x), blob_size(&x));
+    blob_reset(&x);
+  }
+  db_finalize(&q);
+  return nChunk>0 ? (int)n : -1;
+}
+
+/*
+** chunk_stream() callback for chunk_get().
+*/
+static void chunk_append(void *pArg, const unsigned char *z, int n){
+  blob_append((Blob*)pArg, (const char*)z, n);
+}
+
+/*
+** Put the content of chunked artifact rid into pBlob, which must be
+** zeroed.  Return 1 on success or 0 if rid is not chunked.
+*/
+int chunk_get(int rid, Blob *pBlob){
+  if( chunk_stream(rid, chunk_append, pBlob)<0 ){
+    blob_reset(pBlob);
+    return 0;
+  }
+  return 1;
+}
+
+/*
+** Remove the chunk maps of artifacts that are no longer in the BLOB
+** table, and the chunks that no artifact uses.  Call this after
+** deleting from the BLOB table.
+*/
+void chunk_delete_unused(void){
+  if( !chunk_tables_exist() ) return;
+  db_multi_exec(
+    "DELETE FROM chunkmap WHERE rid NOT IN (SELECT rid FROM blob);"
+    "DELETE FROM chunk WHERE cid NOT IN (SELECT cid FROM chunkmap);"
+  );
+}
@@ -75,6 +75,7 @@ void delete_private_content(void){
     "DELETE FROM delta wHERE rid IN private;"
     "DELETE FROM private;"
   );
+  chunk_delete_unused();
 }
 
 
@@ -92,9 +93,16 @@ void delete_private_content(void){
 **
 ** Options:
 **    --admin-user|-A USERNAME   Make USERNAME the administrator
+**    --jobs|-j N                Fetch artifacts over N connections at once
 **    --private                  Also clone private branches 
+**    --resume                   Continue an interrupted clone into FILENAME
 **    --ssl-identity=filename    Use the SSL identity if requested by the server
 **
+** A clone over the network saves its progress as it goes.  If it is
+** interrupted, the partial repository is kept and running the same
+** command again with --resume fetches only the artifacts that are
+** still missing.
+**
 ** See also: init
 */
 void clone_cmd(void){
@@ -103,20 +111,32 @@ void clone_cmd(void){
   const char *zPw;     /* The user clone password */
   int nErr = 0;
   int bPrivate;               /* Also clone private branches */
+  const char *zJobs;          /* Value of the --jobs option */
+  int bResume;                /* Continue an interrupted clone */
 
   bPrivate = find_option("private",0,0)!=0;
+  bResume = find_option("resume",0,0)!=0;
+  zJobs = find_option("jobs","j",1);
+  g.nCloneJob = zJobs ? atoi(zJobs) : 1;
   url_proxy_options();
   if( g.argc < 4 ){
     usage("?OPTIONS? FILE-OR-URL NEW-REPOSITORY");
   }
   db_open_config(0);
-  if( file_size(g.argv[3])>0 ){
+  if( bResume ){
+    if( file_size(g.argv[3])<=0 ){
+      fossil_fatal("no interrupted clone to resume: %s", g.argv[3]);
+    }
+  }else if( file_size(g.argv[3])>0 ){
     fossil_panic("file already exists: %s", g.argv[3]);
   }
 
   zDefaultUser = find_option("admin-user","A",1);
 
   url_parse(g.argv[2]);
+  if( bResume && g.urlIsFile ){
+    fossil_fatal("--resume is only for clones over the network");
+  }
   if( g.urlIsFile ){
     file_copy(g.urlName, g.argv[3]);
     db_close(1);
@@ -139,36 +159,57 @@ void clone_cmd(void){
     }
     fossil_print("Repository cloned into %s\n", g.argv[3]);
   }else{
-    db_create_repository(g.argv[3]);
-    db_open_repository(g.argv[3]);
-    db_begin_transaction();
-    db_record_repository_filename(g.argv[3]);
-    db_initial_setup(0, zDefaultUser, 0);
-    user_select();
-    db_set("content-schema", CONTENT_SCHEMA, 0);
-    db_set("aux-schema", AUX_SCHEMA, 0);
-    db_set("last-sync-url", g.argv[2], 0);
-    if( g.zSSLIdentity!=0 ){
-      /* If the --ssl-identity option was specified, store it as a setting */
-      Blob fn;
-      blob_zero(&fn);
-      file_canonical_name(g.zSSLIdentity, &fn);
-      db_set("ssl-identity", blob_str(&fn), 0);
-      blob_reset(&fn);
+    int bSaved;               /* True if some progress has been saved */
+    if( bResume ){
+      db_open_repository(g.argv[3]);
+      if( db_get_int("clone-resume", 0)<=0 ){
+        fossil_fatal("not an interrupted clone: %s", g.argv[3]);
+      }
+      db_begin_transaction();
+      db_set("last-sync-url", g.argv[2], 0);
+      if( zDefaultUser ){
+        g.zLogin = zDefaultUser;
+      }else{
+        g.zLogin = db_text(0, "SELECT login FROM user WHERE cap LIKE '%%s%%'");
+      }
+    }else{
+      db_create_repository(g.argv[3]);
+      db_open_repository(g.argv[3]);
+      db_begin_transaction();
+      db_record_repository_filename(g.argv[3]);
+      db_initial_setup(0, zDefaultUser, 0);
+      user_select();
+      db_set("content-schema", CONTENT_SCHEMA, 0);
+      db_set("aux-schema", AUX_SCHEMA, 0);
+      db_set("last-sync-url", g.argv[2], 0);
+      if( g.zSSLIdentity!=0 ){
+        /* If the --ssl-identity option was specified, store it as a setting */
+        Blob fn;
+        blob_zero(&fn);
+        file_canonical_name(g.zSSLIdentity, &fn);
+        db_set("ssl-identity", blob_str(&fn), 0);
+        blob_reset(&fn);
+      }
+      db_multi_exec(
+        "REPLACE INTO config(name,value,mtime)"
+        " VALUES('server-code', lower(hex(randomblob(20))), now());"
+      );
     }
-    db_multi_exec(
-      "REPLACE INTO config(name,value,mtime)"
-      " VALUES('server-code', lower(hex(randomblob(20))), now());"
-    );
     url_enable_proxy(0);
     url_get_password_if_needed();
     g.xlinkClusterOnly = 1;
     nErr = client_sync(0,0,1,bPrivate,CONFIGSET_ALL,0);
     g.xlinkClusterOnly = 0;
     verify_cancel();
+    bSaved = db_get_int("clone-resume", 0)>0;
+    if( nErr==0 ) db_unset("clone-resume", 0);
     db_end_transaction(0);
     db_close(1);
     if( nErr ){
+      if( bSaved ){
+        fossil_fatal("clone interrupted - use \"fossil clone --resume %s %s\""
+                     " to continue", g.argv[2], g.argv[3]);
+      }
       file_delete(g.argv[3]);
       fossil_fatal("server returned an error - clone aborted");
     }
@@ -348,6 +348,7 @@ void configure_finalize_receive(void){
     @ DROP TABLE _xfer_reportfmt;
   ;
   db_multi_exec(zSQL);
+  shun_cache_reset();
 }
 
 /*
@@ -438,6 +439,7 @@ static int safeInt(const char *z){
 ** information received into the true target table.
 */
 void configure_receive(const char *zName, Blob *pContent, int groupMask){
+  shun_cache_reset();
   if( zName[0]=='/' ){
     /* The new format */
     char *azToken[12];
@@ -896,6 +898,7 @@ void configuration_cmd(void){
         db_multi_exec("DELETE FROM concealed");
       }else if( fossil_strcmp(zName,"@shun")==0 ){
         db_multi_exec("DELETE FROM shun");
+        shun_cache_reset();
       }else if( fossil_strcmp(zName,"@reportfmt")==0 ){
         db_multi_exec("DELETE FROM reportfmt");
       }
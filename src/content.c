@@ -23,19 +23,35 @@
 
 /*
 ** The artifact retrival cache
+**
+** Cache lines live in the a[] array.  Each line is a member of exactly
+** one of two lists threaded through the iPrev and iNext fields: the
+** LRU list of live entries (most recently used at iHead, least recently
+** used at iTail) or the free list of unused slots.  A separate hash table
+** aHash[] maps an artifact ID onto the first line in a collision chain,
+** and the chain continues through the iHashNext fields.  All slot
+** indexes are stored as index+1 so that zero means "none".
+**
+** The cache is bounded by the total number of bytes of content that it
+** holds.  The limit comes from the "content-cache-size" setting and is
+** read the first time an entry is inserted.
 */
 static struct {
   i64 szTotal;         /* Total size of all entries in the cache */
-  int n;               /* Current number of eache entries */
+  i64 szLimit;         /* Maximum value for szTotal.  0 if not yet known */
+  int n;               /* Current number of cache entries */
   int nAlloc;          /* Number of slots allocated in a[] */
-  int nextAge;         /* Age counter for implementing LRU */
-  int skipCnt;         /* Used to limit entries expelled from cache */
+  int iHead;           /* Most recently used entry (index+1) */
+  int iTail;           /* Least recently used entry (index+1) */
+  int iFree;           /* First unused slot (index+1) */
+  int nHash;           /* Number of slots in aHash[] */
+  int *aHash;          /* Hash table mapping rid into a[] (index+1) */
   struct cacheLine {   /* One instance of this for each cache entry */
-    int rid;                  /* Artifact id */
-    int age;                  /* Age.  Newer is larger */
+    int rid;                  /* Artifact id.  0 for unused slots */
+    int iPrev, iNext;         /* LRU list or free list (index+1) */
+    int iHashNext;            /* Next entry in the same hash bucket */
     Blob content;             /* Content of the artifact */
   } *a;                /* The positive cache */
-  Bag inCache;         /* Set of artifacts currently in cache */
 
   /*
   ** The missing artifact cache.
@@ -51,27 +67,126 @@ static struct {
 } contentCache;
 
 /*
-** Remove the oldest element from the content cache
+** The most recent delta source used by content_deltify().  Callers such
+** as extra_deltification() often try many targets against the same
+** source, so the expanded source and its delta index are kept around.
 */
-static void content_cache_expire_oldest(void){
+static struct {
+  int rid;             /* The source artifact.  0 if none */
+  Blob content;        /* Expanded content of rid */
+  DeltaIndex idx;      /* Delta index over content */
+} deltaSrc;
+
+/*
+** Forget the cached delta source.
+*/
+static void content_delta_source_reset(void){
+  if( deltaSrc.rid ){
+    delta_index_reset(&deltaSrc.idx);
+    blob_reset(&deltaSrc.content);
+    deltaSrc.rid = 0;
+  }
+}
+
+/*
+** The default value of the "content-cache-size" setting, in bytes.
+*/
+#define CONTENT_CACHE_DFLT 50000000
+
+/*
+** Hash bucket for artifact rid.
+*/
+#define content_cache_hash(rid)  (((unsigned)(rid)*101)%contentCache.nHash)
+
+/*
+** Unlink the cache line at index i from the LRU list.
+*/
+static void content_cache_unlink(int i){
+  struct cacheLine *p = &contentCache.a[i];
+  if( p->iPrev ){
+    contentCache.a[p->iPrev-1].iNext = p->iNext;
+  }else{
+    contentCache.iHead = p->iNext;
+  }
+  if( p->iNext ){
+    contentCache.a[p->iNext-1].iPrev = p->iPrev;
+  }else{
+    contentCache.iTail = p->iPrev;
+  }
+  p->iPrev = p->iNext = 0;
+}
+
+/*
+** Make the cache line at index i the most recently used entry.
+*/
+static void content_cache_link_head(int i){
+  struct cacheLine *p = &contentCache.a[i];
+  p->iPrev = 0;
+  p->iNext = contentCache.iHead;
+  if( contentCache.iHead ){
+    contentCache.a[contentCache.iHead-1].iPrev = i+1;
+  }else{
+    contentCache.iTail = i+1;
+  }
+  contentCache.iHead = i+1;
+}
+
+/*
+** Return the index into contentCache.a[] of the entry for artifact rid,
+** or -1 if rid is not in the cache.
+*/
+static int content_cache_find(int rid){
   int i;
-  int mnAge = contentCache.nextAge;
-  int mn = -1;
-  for(i=0; i<contentCache.n; i++){
-    if( contentCache.a[i].age<mnAge ){
-      mnAge = contentCache.a[i].age;
-      mn = i;
-    }
+  if( contentCache.n==0 ) return -1;
+  for(i=contentCache.aHash[content_cache_hash(rid)]; i;
+      i=contentCache.a[i-1].iHashNext){
+    if( contentCache.a[i-1].rid==rid ) return i-1;
   }
-  if( mn>=0 ){
-    bag_remove(&contentCache.inCache, contentCache.a[mn].rid);
-    contentCache.szTotal -= blob_size(&contentCache.a[mn].content);
-    blob_reset(&contentCache.a[mn].content);
-    contentCache.n--;
-    contentCache.a[mn] = contentCache.a[contentCache.n];
+  return -1;
+}
+
+/*
+** Resize the hash table so that it has at least twice as many buckets
+** as there are slots in a[], and rehash every live entry.
+*/
+static void content_cache_rehash(void){
+  int i;
+  contentCache.nHash = contentCache.nAlloc*2 + 1;
+  free(contentCache.aHash);
+  contentCache.aHash = fossil_malloc(contentCache.nHash*sizeof(int));
+  memset(contentCache.aHash, 0, contentCache.nHash*sizeof(int));
+  for(i=0; i<contentCache.nAlloc; i++){
+    struct cacheLine *p = &contentCache.a[i];
+    if( p->rid ){
+      int h = content_cache_hash(p->rid);
+      p->iHashNext = contentCache.aHash[h];
+      contentCache.aHash[h] = i+1;
+    }
   }
 }
 
+/*
+** Remove the oldest element from the content cache
+*/
+static void content_cache_expire_oldest(void){
+  int i, *pi;
+  struct cacheLine *p;
+  if( contentCache.iTail==0 ) return;
+  i = contentCache.iTail - 1;
+  p = &contentCache.a[i];
+  for(pi=&contentCache.aHash[content_cache_hash(p->rid)]; *pi!=i+1;
+      pi=&contentCache.a[*pi-1].iHashNext){}
+  *pi = p->iHashNext;
+  content_cache_unlink(i);
+  contentCache.szTotal -= blob_size(&p->content);
+  blob_reset(&p->content);
+  p->rid = 0;
+  p->iHashNext = 0;
+  p->iNext = contentCache.iFree;
+  contentCache.iFree = i+1;
+  contentCache.n--;
+}
+
 /*
 ** Add an entry to the content cache.
 **
@@ -80,42 +195,109 @@ static void content_cache_expire_oldest(void){
 */
 void content_cache_insert(int rid, Blob *pBlob){
   struct cacheLine *p;
-  if( contentCache.n>500 || contentCache.szTotal>50000000 ){
-    i64 szBefore;
-    do{
-      szBefore = contentCache.szTotal;
-      content_cache_expire_oldest();
-    }while( contentCache.szTotal>50000000 && contentCache.szTotal<szBefore );
-  }
-  if( contentCache.n>=contentCache.nAlloc ){
-    contentCache.nAlloc = contentCache.nAlloc*2 + 10;
+  int i, h;
+  if( contentCache.szLimit==0 ){
+    contentCache.szLimit = db_get_int("content-cache-size", CONTENT_CACHE_DFLT);
+    if( contentCache.szLimit<=0 ) contentCache.szLimit = CONTENT_CACHE_DFLT;
+  }
+  if( content_cache_find(rid)>=0 ){
+    blob_reset(pBlob);
+    return;
+  }
+  while( contentCache.n>0
+      && contentCache.szTotal+blob_size(pBlob)>contentCache.szLimit ){
+    content_cache_expire_oldest();
+  }
+  if( contentCache.iFree==0 ){
+    int nOld = contentCache.nAlloc;
+    contentCache.nAlloc = nOld*2 + 10;
     contentCache.a = fossil_realloc(contentCache.a,
                              contentCache.nAlloc*sizeof(contentCache.a[0]));
+    memset(&contentCache.a[nOld], 0,
+           (contentCache.nAlloc-nOld)*sizeof(contentCache.a[0]));
+    for(i=contentCache.nAlloc-1; i>=nOld; i--){
+      contentCache.a[i].iNext = contentCache.iFree;
+      contentCache.iFree = i+1;
+    }
+    content_cache_rehash();
   }
-  p = &contentCache.a[contentCache.n++];
+  i = contentCache.iFree - 1;
+  p = &contentCache.a[i];
+  contentCache.iFree = p->iNext;
   p->rid = rid;
-  p->age = contentCache.nextAge++;
+  h = content_cache_hash(rid);
+  p->iHashNext = contentCache.aHash[h];
+  contentCache.aHash[h] = i+1;
+  content_cache_link_head(i);
   contentCache.szTotal += blob_size(pBlob);
   p->content = *pBlob;
   blob_zero(pBlob);
-  bag_insert(&contentCache.inCache, rid);
+  contentCache.n++;
 }
 
 /*
 ** Clear the content cache.
 */
 void content_clear_cache(void){
-  int i;
-  for(i=0; i<contentCache.n; i++){
-    blob_reset(&contentCache.a[i].content);
+  while( contentCache.iTail ){
+    content_cache_expire_oldest();
   }
   bag_clear(&contentCache.missing);
   bag_clear(&contentCache.available);
-  bag_clear(&contentCache.inCache);
+  content_delta_source_reset();
   contentCache.n = 0;
   contentCache.szTotal = 0;
 }
 
+/*
+** How new content is compressed, from the "compression" and
+** "compression-level" settings.  The settings are read once, by the
+** main thread, so that worker threads can compress content without
+** consulting the database.
+*/
+static struct {
+  int isInit;          /* True once the settings have been read */
+  int eMethod;         /* BLOB_COMPRESS_ZLIB or BLOB_COMPRESS_ZSTD */
+  int iLevel;          /* Compression level.  0 for the default */
+} contentCmpr;
+
+/*
+** Read the compression settings, if that has not been done already.
+** The main thread must call this before any worker thread uses
+** content_compress().
+**
+** If new content is to be compressed with zstd, the repository is
+** marked so that versions of fossil that cannot read it refuse it.
+*/
+void content_compression_init(void){
+  char *zMethod;
+  if( contentCmpr.isInit ) return;
+  zMethod = db_get("compression", 0);
+  if( fossil_strcmp(zMethod, "zstd")==0 && blob_have_zstd() ){
+    contentCmpr.eMethod = BLOB_COMPRESS_ZSTD;
+    db_aux_schema_add(AUX_FEATURE_ZSTD);
+  }else{
+    contentCmpr.eMethod = BLOB_COMPRESS_ZLIB;
+  }
+  free(zMethod);
+  contentCmpr.iLevel = db_get_int("compression-level", 0);
+  contentCmpr.isInit = 1;
+}
+
+/*
+** Compress pIn into pOut for storage in the BLOB table, using the
+** method and level chosen by the repository settings.  pOut must be
+** either uninitialized or the same as pIn.
+**
+** Content compressed by any supported method can be read back by
+** blob_uncompress(), so changing the settings affects only content
+** stored afterwards.
+*/
+void content_compress(Blob *pIn, Blob *pOut){
+  content_compression_init();
+  blob_compress_ex(pIn, pOut, contentCmpr.eMethod, contentCmpr.iLevel);
+}
+
 /*
 ** Return the srcid associated with rid.  Or return 0 if rid is 
 ** original content and not a delta.
@@ -206,17 +388,33 @@ static void content_mark_available(int rid){
 }
 
 /*
-** Get the blob.content value for blob.rid=rid.  Return 1 on success or
-** 0 on failure.
+** Get the uncompressed blob.content value for blob.rid=rid together with
+** the delta source of rid, using a single query.  *pSrcid is set to zero
+** if rid is full text.  Return 1 on success or 0 if rid is a phantom.
+**
+** The content of an artifact stored in chunks is assembled from its
+** chunks.  See chunk.c.
 */
-static int content_of_blob(int rid, Blob *pBlob){
+static int content_of_link(int rid, int *pSrcid, Blob *pBlob){
   static Stmt q;
   int rc = 0;
-  db_static_prepare(&q, "SELECT content FROM blob WHERE rid=:rid AND size>=0");
+  db_static_prepare(&q,
+    "SELECT blob.content, delta.srcid, blob.size"
+    "  FROM blob LEFT JOIN delta ON delta.rid=blob.rid"
+    " WHERE blob.rid=:rid AND blob.size>=0"
+  );
   db_bind_int(&q, ":rid", rid);
   if( db_step(&q)==SQLITE_ROW ){
+    *pSrcid = db_column_int(&q, 1);
+    if( db_column_bytes(&q, 0)==0 && db_column_int(&q, 2)>0 ){
+      db_reset(&q);
+      blob_zero(pBlob);
+      return chunk_get(rid, pBlob);
+    }
     db_ephemeral_blob(&q, 0, pBlob);
     blob_uncompress(pBlob, pBlob);
+    if( blob_is_ephemeral(pBlob) ) blob_materialize(pBlob);
+    perf_count(PERF_UNCOMPRESS, blob_size(pBlob));
     rc = 1;
   }
   db_reset(&q);
@@ -227,11 +425,24 @@ static int content_of_blob(int rid, Blob *pBlob){
 ** Extract the content for ID rid and put it into the
 ** uninitialized blob.  Return 1 on success.  If the record
 ** is a phantom, zero pBlob and return 0.
+**
+** The delta chain is resolved in two phases.  First the chain is walked
+** from rid toward its full-text root (or toward the first artifact found
+** in the cache), loading each delta and the next link of the chain with
+** one query per hop.  Then the deltas are applied in reverse order
+** without further database access.  The result of applying deltas is
+** also offered to the cache shared between server processes, if there
+** is one.  See shmcache.c.
 */
 int content_get(int rid, Blob *pBlob){
-  int rc;
+  int rc = 1;
   int i;
-  int nextRid;
+  int n = 0;           /* Number of entries in aRid[] and aDelta[] */
+  int nAlloc = 0;      /* Slots allocated in aRid[] and aDelta[] */
+  int *aRid = 0;       /* Artifacts of the chain, starting with rid */
+  Blob *aDelta = 0;    /* Content of each entry in aRid[] */
+  int x, srcid;
+  Blob next;
 
   assert( g.repositoryOpen );
   blob_zero(pBlob);
@@ -243,59 +454,68 @@ int content_get(int rid, Blob *pBlob){
   }
 
   /* Look for the artifact in the cache first */
-  if( bag_find(&contentCache.inCache, rid) ){
-    for(i=0; i<contentCache.n; i++){
-      if( contentCache.a[i].rid==rid ){
-        blob_copy(pBlob, &contentCache.a[i].content);
-        contentCache.a[i].age = contentCache.nextAge++;
-        return 1;
-      }
+  if( (i = content_cache_find(rid))>=0 ){
+    blob_copy(pBlob, &contentCache.a[i].content);
+    content_cache_unlink(i);
+    content_cache_link_head(i);
+    perf_count(PERF_CACHE_HIT, 1);
+    return 1;
+  }
+
+  /* Then in the cache shared with other server processes */
+  if( shmcache_get(rid, pBlob) ){
+    perf_count(PERF_CACHE_HIT, 1);
+    bag_insert(&contentCache.available, rid);
+    return 1;
+  }
+  perf_count(PERF_CACHE_MISS, 1);
+
+  /* Gather the delta chain */
+  for(x=rid; rc; x=srcid){
+    if( n>=nAlloc ){
+      nAlloc = nAlloc*2 + 10;
+      aRid = fossil_realloc(aRid, nAlloc*sizeof(aRid[0]));
+      aDelta = fossil_realloc(aDelta, nAlloc*sizeof(aDelta[0]));
+    }
+    if( bag_find(&contentCache.missing, x)
+     || !content_of_link(x, &srcid, &aDelta[n]) ){
+      rc = 0;
+      break;
+    }
+    aRid[n++] = x;
+    if( srcid==0 ){
+      *pBlob = aDelta[--n];
+      break;
+    }
+    if( (i = content_cache_find(srcid))>=0 ){
+      blob_copy(pBlob, &contentCache.a[i].content);
+      content_cache_unlink(i);
+      content_cache_link_head(i);
+      break;
     }
   }
 
-  nextRid = findSrcid(rid);
-  if( nextRid==0 ){
-    rc = content_of_blob(rid, pBlob);
-  }else{
-    int n = 1;
-    int nAlloc = 10;
-    int *a = 0;
-    int mx;
-    Blob delta, next;
-
-    a = fossil_malloc( sizeof(a[0])*nAlloc );
-    a[0] = rid;
-    a[1] = nextRid;
-    n = 1;
-    while( !bag_find(&contentCache.inCache, nextRid)
-        && (nextRid = findSrcid(nextRid))>0 ){
-      n++;
-      if( n>=nAlloc ){
-        nAlloc = nAlloc*2 + 10;
-        a = fossil_realloc(a, nAlloc*sizeof(a[0]));
-      }
-      a[n] = nextRid;
-    }
-    mx = n;
-    rc = content_get(a[n], pBlob);
-    n--;
-    while( rc && n>=0 ){
-      rc = content_of_blob(a[n], &delta);
-      if( rc ){
-        blob_delta_apply(pBlob, &delta, &next);
-        blob_reset(&delta);
-        if( (mx-n)%8==0 ){
-          content_cache_insert(a[n+1], pBlob);
-        }else{
-          blob_reset(pBlob);
-        }
-        *pBlob = next;
+  /* Apply the deltas, caching every 8th intermediate result */
+  if( rc ){
+    perf_delta_chain(rid, n);
+    for(i=n-1; i>=0; i--){
+      blob_delta_apply(pBlob, &aDelta[i], &next);
+      blob_reset(&aDelta[i]);
+      perf_count(PERF_DELTA_APPLY, 1);
+      if( (n-i)%8==0 ){
+        content_cache_insert(aRid[i+1], pBlob);
+      }else{
+        blob_reset(pBlob);
       }
-      n--;
+      *pBlob = next;
     }
-    free(a);
-    if( !rc ) blob_reset(pBlob);
+    if( n>0 ) shmcache_insert(rid, pBlob);
+  }else{
+    for(i=0; i<n; i++) blob_reset(&aDelta[i]);
+    blob_reset(pBlob);
   }
+  free(aRid);
+  free(aDelta);
   if( rc==0 ){
     bag_insert(&contentCache.missing, rid);
   }else{
@@ -304,6 +524,137 @@ int content_get(int rid, Blob *pBlob){
   return rc;
 }
 
+#if INTERFACE
+/*
+** Artifacts of at least this many bytes that are stored as full text are
+** written to checkouts and verified by content_stream_ex() rather than
+** content_get(), and files of this size are stored by content_put_file(),
+** so that they are never held in memory in their entirety.
+*/
+#define CONTENT_STREAM_SIZE  10000000
+#endif
+
+/*
+** If artifact rid is stored as full text, so that its content can be
+** written by content_stream() without expanding any deltas, return
+** the size of the artifact.  Otherwise return -1.
+*/
+int content_stream_size(int rid){
+  static Stmt q;
+  int sz = -1;
+  db_static_prepare(&q,
+    "SELECT size FROM blob"
+    " WHERE rid=:rid AND size>=0"
+    "   AND NOT EXISTS(SELECT 1 FROM delta WHERE delta.rid=blob.rid)"
+  );
+  db_bind_int(&q, ":rid", rid);
+  if( db_step(&q)==SQLITE_ROW ) sz = db_column_int(&q, 0);
+  db_reset(&q);
+  return sz;
+}
+
+/*
+** State of a content_stream() operation.
+*/
+typedef struct ContentStream ContentStream;
+struct ContentStream {
+  sqlite3_blob *pBlob;     /* Handle on blob.content */
+  int iOfst;               /* Next byte to read */
+  int nByte;               /* Total size of blob.content */
+};
+
+/*
+** xRead callback for blob_uncompress_incr() that reads from an
+** incremental blob handle.
+*/
+static int content_stream_read(void *pArg, unsigned char *zBuf, int n){
+  ContentStream *p = (ContentStream*)pArg;
+  if( n>p->nByte-p->iOfst ) n = p->nByte - p->iOfst;
+  if( n<=0 || sqlite3_blob_read(p->pBlob, zBuf, n, p->iOfst)!=SQLITE_OK ){
+    return 0;
+  }
+  p->iOfst += n;
+  return n;
+}
+
+/*
+** Pass the content of full-text artifact rid to xWrite(pArg, z, n) a
+** piece at a time.  The compressed content is read using SQLite's
+** incremental blob I/O and uncompressed as it goes, so neither the
+** compressed nor the expanded artifact is ever held in memory in its
+** entirety.  As with blob_uncompress_incr(), xWrite might first be
+** called with a NULL z to announce the total size.
+**
+** The caller must have checked content_stream_size(rid) first.  Return
+** the number of bytes passed to xWrite or -1 on error.
+*/
+int content_stream_ex(
+  int rid,
+  void (*xWrite)(void*, const unsigned char*, int),
+  void *pArg
+){
+  ContentStream x;
+  int rc;
+  if( sqlite3_blob_open(g.db, db_name("repository"), "blob", "content",
+                        rid, 0, &x.pBlob)!=SQLITE_OK ){
+    return -1;
+  }
+  x.iOfst = 0;
+  x.nByte = sqlite3_blob_bytes(x.pBlob);
+  if( x.nByte==0 ){
+    /* A chunked artifact.  See chunk.c */
+    sqlite3_blob_close(x.pBlob);
+    return chunk_stream(rid, xWrite, pArg);
+  }
+  rc = blob_uncompress_incr(content_stream_read, &x, xWrite, pArg);
+  if( rc>0 ) perf_count(PERF_UNCOMPRESS, rc);
+  sqlite3_blob_close(x.pBlob);
+  return rc;
+}
+
+/*
+** xWrite callback for content_stream_ex() that writes on a channel.
+*/
+static void content_stream_to_channel(
+  void *pArg,
+  const unsigned char *z,
+  int n
+){
+  if( z ) fwrite(z, 1, n, (FILE*)pArg);
+}
+
+/*
+** Write the content of full-text artifact rid on channel out, using
+** content_stream_ex().  This is intended for large artifacts, such as
+** binary attachments, that are merely copied to the output.
+**
+** The caller must have checked content_stream_size(rid) first.  Return
+** the number of bytes written or -1 on error.
+*/
+int content_stream(int rid, FILE *out){
+  return content_stream_ex(rid, content_stream_to_channel, out);
+}
+
+/*
+** Write the content of full-text artifact rid to file zFilename, whose
+** directory must already exist, using content_stream().
+*/
+void content_write_to_file(int rid, const char *zFilename){
+  FILE *out;
+  int n;
+  if( file_unshare(zFilename) ){
+    fossil_fatal("unable to copy \"%s\" out of the cache", zFilename);
+  }
+  out = fossil_fopen(zFilename, "wb");
+  if( out==0 ){
+    fossil_fatal("unable to open file \"%s\" for writing", zFilename);
+  }
+  n = content_stream(rid, out);
+  if( fclose(out) || n<0 ){
+    fossil_fatal("unable to write file \"%s\"", zFilename);
+  }
+}
+
 /*
 ** COMMAND: artifact*
 **
@@ -329,6 +680,16 @@ void artifact_cmd(void){
   if( rid==0 ){
     fossil_fatal("%s",g.zErrMsg);
   }
+#ifndef _WIN32
+  /* Large artifacts sent to standard output need not be held in memory.
+  ** (On Windows, blob_write_to_file() translates console output.) */
+  if( zFile[0]=='-' && zFile[1]==0 && content_stream_size(rid)>=0 ){
+    if( content_stream(rid, stdout)<0 ){
+      fossil_fatal("cannot extract artifact %s", g.argv[2]);
+    }
+    return;
+  }
+#endif
   content_get(rid, &content);
   blob_write_to_file(&content, zFile);
 }
@@ -362,6 +723,24 @@ void test_content_rawget_cmd(void){
 */
 static int ignoreDephantomizations = 0;
 
+/*
+** While a batch of artifacts is being received, between calls to
+** manifest_crosslink_begin() and manifest_crosslink_end(), records that
+** are dephantomized are only collected here.  Their dependents are
+** processed once when the batch ends, when the bases of any deltas
+** that arrived out of order are also present.
+*/
+static int deferDephantomizations = 0;
+static Bag pendingDephantomize;
+
+/*
+** One node of the delta tree that after_dephantomize() walks.
+*/
+struct DephantomNode {
+  int rid;           /* The artifact */
+  int linkFlag;      /* True to crosslink rid itself */
+};
+
 /*
 ** When a record is converted from a phantom to a real record,
 ** if that record has other records that are derived by delta,
@@ -372,75 +751,152 @@ static int ignoreDephantomizations = 0;
 ** then also invoke manifest_crosslink() on the delta-manifests
 ** associated with that baseline.
 **
-** Tail recursion is used to minimize stack depth.
+** The tree of records derived by delta is walked depth first using a
+** stack on the heap.  A record with delta children is left expanded
+** in the content cache, so that each child costs a single delta.
+** Records already walked are skipped when found again through
+** another record of the same batch.
 */
-void after_dephantomize(int rid, int linkFlag){
-  Stmt q;
+static void after_dephantomize_batch(int nRid, int *aRid, int linkFlag){
+  Stmt q1, q2;
+  int nStack = 0;
+  int nStackAlloc = 0;
+  struct DephantomNode *aStack = 0;
+  int nChild = 0;
   int nChildAlloc = 0;
   int *aChild = 0;
+  Bag done;
   Blob content;
+  int i;
 
-  if( ignoreDephantomizations ) return;
-  while( rid ){
-    int nChildUsed = 0;
-    int i;
-
-    /* Parse the object rid itself */
-    if( linkFlag ){
-      content_get(rid, &content);
-      manifest_crosslink(rid, &content);
-      assert( blob_is_reset(&content) );
+  bag_init(&done);
+  db_prepare(&q1, "SELECT rid FROM orphan WHERE baseline=:rid");
+  db_prepare(&q2,
+     "SELECT rid FROM delta"
+     " WHERE srcid=:rid"
+     "   AND NOT EXISTS(SELECT 1 FROM mlink WHERE mid=delta.rid)"
+  );
+  for(i=nRid-1; i>=0; i--){
+    if( nStack>=nStackAlloc ){
+      nStackAlloc = nStackAlloc*2 + 10;
+      aStack = fossil_realloc(aStack, nStackAlloc*sizeof(aStack[0]));
     }
+    aStack[nStack].rid = aRid[i];
+    aStack[nStack].linkFlag = linkFlag;
+    nStack++;
+  }
+  while( nStack>0 ){
+    int rid = aStack[--nStack].rid;
+    int isLink = aStack[nStack].linkFlag;
+    if( !bag_insert(&done, rid) ) continue;
 
-    /* Parse all delta-manifests that depend on baseline-manifest rid */
-    db_prepare(&q, "SELECT rid FROM orphan WHERE baseline=%d", rid);
-    while( db_step(&q)==SQLITE_ROW ){
-      int child = db_column_int(&q, 0);
-      if( nChildUsed>=nChildAlloc ){
+    /* Find all artifacts that are derived by delta from artifact rid
+    ** and which have not already been cross-linked */
+    nChild = 0;
+    db_bind_int(&q2, ":rid", rid);
+    while( db_step(&q2)==SQLITE_ROW ){
+      if( nChild>=nChildAlloc ){
         nChildAlloc = nChildAlloc*2 + 10;
-        aChild = fossil_realloc(aChild, nChildAlloc*sizeof(aChild));
+        aChild = fossil_realloc(aChild, nChildAlloc*sizeof(aChild[0]));
       }
-      aChild[nChildUsed++] = child;
+      aChild[nChild++] = db_column_int(&q2, 0);
     }
-    db_finalize(&q);
-    for(i=0; i<nChildUsed; i++){
-      content_get(aChild[i], &content);
-      manifest_crosslink(aChild[i], &content);
-      assert( blob_is_reset(&content) );
+    db_reset(&q2);
+
+    /* Parse the object rid itself, keeping its content for the
+    ** children */
+    if( isLink || nChild>0 ){
+      content_get(rid, &content);
+      if( nChild>0 && blob_size(&content)>0 ){
+        Blob copy;
+        blob_copy(&copy, &content);
+        content_cache_insert(rid, &copy);
+      }
+      if( isLink ){
+        manifest_crosslink(rid, &content);
+        assert( blob_is_reset(&content) );
+      }else{
+        blob_reset(&content);
+      }
     }
-    if( nChildUsed ){
+
+    /* Parse all delta-manifests that depend on baseline-manifest rid */
+    db_bind_int(&q1, ":rid", rid);
+    if( db_step(&q1)==SQLITE_ROW ){
+      int nOrphan = 0;
+      int *aOrphan = 0;
+      do{
+        if( (nOrphan%10)==0 ){
+          aOrphan = fossil_realloc(aOrphan, (nOrphan+10)*sizeof(aOrphan[0]));
+        }
+        aOrphan[nOrphan++] = db_column_int(&q1, 0);
+      }while( db_step(&q1)==SQLITE_ROW );
+      db_reset(&q1);
+      for(i=0; i<nOrphan; i++){
+        content_get(aOrphan[i], &content);
+        manifest_crosslink(aOrphan[i], &content);
+        assert( blob_is_reset(&content) );
+      }
+      fossil_free(aOrphan);
       db_multi_exec("DELETE FROM orphan WHERE baseline=%d", rid);
+    }else{
+      db_reset(&q1);
     }
 
-    /* Recursively dephantomize all artifacts that are derived by
-    ** delta from artifact rid and which have not already been
-    ** cross-linked.  */
-    nChildUsed = 0;
-    db_prepare(&q, 
-       "SELECT rid FROM delta"
-       " WHERE srcid=%d"
-       "   AND NOT EXISTS(SELECT 1 FROM mlink WHERE mid=delta.rid)",
-       rid
-    );
-    while( db_step(&q)==SQLITE_ROW ){
-      int child = db_column_int(&q, 0);
-      if( nChildUsed>=nChildAlloc ){
-        nChildAlloc = nChildAlloc*2 + 10;
-        aChild = fossil_realloc(aChild, nChildAlloc*sizeof(aChild));
+    /* Walk the children next, the first one first */
+    for(i=nChild-1; i>=0; i--){
+      if( nStack>=nStackAlloc ){
+        nStackAlloc = nStackAlloc*2 + 10;
+        aStack = fossil_realloc(aStack, nStackAlloc*sizeof(aStack[0]));
       }
-      aChild[nChildUsed++] = child;
-    }
-    db_finalize(&q);
-    for(i=1; i<nChildUsed; i++){
-      after_dephantomize(aChild[i], 1);
+      aStack[nStack].rid = aChild[i];
+      aStack[nStack].linkFlag = 1;
+      nStack++;
     }
+  }
+  db_finalize(&q1);
+  db_finalize(&q2);
+  bag_clear(&done);
+  fossil_free(aStack);
+  fossil_free(aChild);
+}
 
-    /* Tail recursion for the common case where only a single artifact
-    ** is derived by delta from rid... */
-    rid = nChildUsed>0 ? aChild[0] : 0;
-    linkFlag = 1;
+/*
+** Process the dependents of record rid, which has just been converted
+** from a phantom into a real record.  If linkFlag is true, then also
+** crosslink rid itself.  Within a batch, the work is put off until
+** the end of the batch.
+*/
+void after_dephantomize(int rid, int linkFlag){
+  if( ignoreDephantomizations ) return;
+  if( deferDephantomizations && !linkFlag ){
+    bag_insert(&pendingDephantomize, rid);
+    return;
+  }
+  after_dephantomize_batch(1, &rid, linkFlag);
+}
+
+/*
+** Start (onoff true) or finish (onoff false) a batch of received
+** artifacts.  Finishing a batch processes the dependents of every
+** record that was dephantomized during the batch.
+*/
+void content_batch_dephantomize(int onoff){
+  deferDephantomizations = onoff;
+  if( !onoff && bag_count(&pendingDephantomize)>0 ){
+    int n = 0;
+    int *aRid = fossil_malloc(bag_count(&pendingDephantomize)*sizeof(int));
+    int rid;
+    for(rid=bag_first(&pendingDephantomize); rid;
+        rid=bag_next(&pendingDephantomize, rid)){
+      aRid[n++] = rid;
+    }
+    bag_clear(&pendingDephantomize);
+    if( !ignoreDephantomizations ){
+      after_dephantomize_batch(n, aRid, 0);
+    }
+    fossil_free(aRid);
   }
-  free(aChild);
 }
 
 /*
@@ -468,6 +924,9 @@ void content_enable_dephantomize(int onoff){
 ** If the record already exists but is a phantom, the pBlob content
 ** is inserted and the phatom becomes a real record.
 **
+** Full text of at least "chunk-threshold" bytes is stored in chunks
+** by chunk_put().
+**
 ** The original content of pBlob is not disturbed.  The caller continues
 ** to be responsible for pBlob.  This routine does *not* take over
 ** responsiblity for freeing pBlob.
@@ -490,6 +949,9 @@ int content_put_ex(
   assert( g.repositoryOpen );
   assert( pBlob!=0 );
   assert( srcId==0 || zUuid!=0 );
+  if( nBlob==0 && srcId==0 && chunk_wanted(blob_size(pBlob)) ){
+    return chunk_put(pBlob, zUuid, isPrivate);
+  }
   if( zUuid==0 ){
     assert( pBlob!=0 );
     assert( nBlob==0 );
@@ -540,7 +1002,7 @@ int content_put_ex(
   if( nBlob ){
     cmpr = pBlob[0];
   }else{
-    blob_compress(pBlob, &cmpr);
+    content_compress(pBlob, &cmpr);
   }
   if( rid>0 ){
     /* We are just adding data to a phantom */
@@ -565,6 +1027,7 @@ int content_put_ex(
     db_bind_blob(&s1, ":data", &cmpr);
     db_exec(&s1);
     rid = db_last_insert_rowid();
+    name_cache_clear();
     if( !pBlob ){
       db_multi_exec("INSERT OR IGNORE INTO phantom VALUES(%d)", rid);
     }
@@ -603,7 +1066,11 @@ int content_put_ex(
 
   /* Make arrangements to verify that the data can be recovered
   ** before we commit */
-  verify_before_commit(rid);
+  if( zUuid==0 ){
+    verify_note_content(rid, pBlob);
+  }else{
+    verify_before_commit(rid);
+  }
   return rid;
 }
 
@@ -623,6 +1090,93 @@ int content_put(Blob *pBlob){
 }
 
 
+/*
+** xStep callback for blob_compress_channel() used by content_put_file().
+*/
+static void content_put_file_step(void *pArg, const char *z, int n){
+  sha1_ctx_step((SHA1Context*)pArg, z, n);
+}
+
+/*
+** Store the content of file zFilename in the repository as full text
+** and return its rid, in the same way as content_put().
+**
+** The file is hashed and compressed as it is read, and the compressed
+** content is spooled through a temporary file into the BLOB table using
+** incremental blob I/O, so that neither the file nor its compressed
+** form is ever held in memory in its entirety.  The content is always
+** compressed with zlib, whatever the "compression" setting.
+*/
+int content_put_file(const char *zFilename, int isPrivate){
+  FILE *in, *tmp;
+  SHA1Context ctx;
+  char zUuid[UUID_SIZE+1];
+  char zBuf[65536];
+  i64 nByte;
+  long nCmpr, iOfst;
+  int rid;
+  Blob x;
+  sqlite3_blob *pBlob;
+
+  in = fossil_fopen(zFilename, "rb");
+  if( in==0 ){
+    fossil_fatal("cannot open %s for reading", zFilename);
+  }
+  tmp = tmpfile();
+  if( tmp==0 ){
+    fossil_fatal("cannot create a temporary file");
+  }
+  content_compression_init();
+  sha1_ctx_init(&ctx);
+  nByte = blob_compress_channel(in, tmp, contentCmpr.iLevel,
+                                content_put_file_step, &ctx);
+  fclose(in);
+  if( nByte<0 ){
+    fossil_fatal("cannot read or compress %s", zFilename);
+  }
+  sha1_ctx_finish(&ctx, zUuid);
+  nCmpr = ftell(tmp);
+  rewind(tmp);
+  db_begin_transaction();
+  rid = db_int(0, "SELECT rid FROM blob WHERE uuid='%s' AND size>=0", zUuid);
+  if( rid>0 ){
+    /* Already stored */
+  }else if( nByte==0
+         || db_exists("SELECT 1 FROM blob WHERE uuid='%s'", zUuid) ){
+    /* An empty file or a phantom.  Phantoms are rare enough that the
+    ** compressed content is simply read into memory. */
+    blob_read_from_channel(&x, tmp, nCmpr);
+    if( nByte==0 ){
+      blob_reset(&x);
+      rid = content_put_ex(&x, 0, 0, 0, isPrivate);
+    }else{
+      rid = content_put_ex(&x, zUuid, 0, (int)nByte, isPrivate);
+    }
+    blob_reset(&x);
+  }else{
+    /* Make the BLOB table entry with empty content, then fill it in */
+    blob_init(&x, "", 0);
+    rid = content_put_ex(&x, zUuid, 0, (int)nByte, isPrivate);
+    db_multi_exec("UPDATE blob SET content=zeroblob(%ld) WHERE rid=%d",
+                  nCmpr, rid);
+    if( sqlite3_blob_open(g.db, db_name("repository"), "blob", "content",
+                          rid, 1, &pBlob)!=SQLITE_OK ){
+      fossil_fatal("cannot write artifact %s", zUuid);
+    }
+    for(iOfst=0; iOfst<nCmpr; ){
+      int n = (int)fread(zBuf, 1, sizeof(zBuf), tmp);
+      if( n<=0 || sqlite3_blob_write(pBlob, zBuf, n, iOfst)!=SQLITE_OK ){
+        fossil_fatal("cannot write artifact %s", zUuid);
+      }
+      iOfst += n;
+    }
+    sqlite3_blob_close(pBlob);
+  }
+  db_end_transaction(0);
+  fclose(tmp);
+  return rid;
+}
+
 /*
 ** Create a new phantom with the given UUID and return its artifact ID.
 */
@@ -643,6 +1197,7 @@ int content_new(const char *zUuid, int isPrivate){
   db_bind_text(&s1, ":uuid", zUuid);
   db_exec(&s1);
   rid = db_last_insert_rowid();
+  name_cache_clear();
   db_static_prepare(&s2,
     "INSERT INTO phantom VALUES(:rid)"
   );
@@ -690,7 +1245,7 @@ void content_undelta(int rid){
       Stmt s;
       db_prepare(&s, "UPDATE blob SET content=:c, size=%d WHERE rid=%d",
                      blob_size(&x), rid);
-      blob_compress(&x, &x);
+      content_compress(&x, &x);
       db_bind_blob(&s, ":c", &x);
       db_exec(&s);
       db_finalize(&s);
@@ -740,6 +1295,262 @@ void content_make_public(int rid){
   db_exec(&s1);
 }
 
+/*
+** Return the number of delta hops needed to reconstruct artifact rid.
+** Full-text artifacts have a depth of zero.
+*/
+static int content_delta_depth(int rid){
+  int n = 0;
+  while( (rid = findSrcid(rid))>0 ){
+    if( ++n>10000000 ) fossil_panic("delta-loop in repository");
+  }
+  return n;
+}
+
+/*
+** Return the length of the longest chain of deltas that use rid as
+** their ultimate source.  Stop looking once the answer exceeds mx.
+*/
+static int content_delta_height(int rid, int mx){
+  static Stmt q;
+  Bag cur, next;
+  int h = 0;
+  bag_init(&cur);
+  bag_init(&next);
+  bag_insert(&cur, rid);
+  db_static_prepare(&q, "SELECT rid FROM delta WHERE srcid=:rid");
+  while( h<=mx ){
+    int x;
+    for(x=bag_first(&cur); x; x=bag_next(&cur, x)){
+      db_bind_int(&q, ":rid", x);
+      while( db_step(&q)==SQLITE_ROW ){
+        bag_insert(&next, db_column_int(&q, 0));
+      }
+      db_reset(&q);
+    }
+    if( bag_count(&next)==0 ) break;
+    h++;
+    bag_clear(&cur);
+    cur = next;
+    bag_init(&next);
+  }
+  bag_clear(&cur);
+  bag_clear(&next);
+  return h;
+}
+
+/*
+** Make sure that no artifact in the repository is more than mxChain
+** deltas away from full text.  This is done by converting every
+** artifact whose depth is a multiple of mxChain+1 back into full text.
+** Return the number of artifacts that were undeltaed.
+*/
+int content_limit_delta_chains(int mxChain){
+  Stmt q;
+  Bag toUndelta;
+  int depth;
+  int rid;
+  int n;
+  if( mxChain<=0 ) return 0;
+  db_begin_transaction();
+  db_multi_exec(
+    "CREATE TEMP TABLE dchain(rid INTEGER PRIMARY KEY, depth INT);"
+    "CREATE INDEX dchain_depth ON dchain(depth);"
+    "INSERT INTO dchain"
+    "  SELECT rid, 1 FROM delta WHERE srcid NOT IN (SELECT rid FROM delta);"
+  );
+  for(depth=1; db_changes()>0; depth++){
+    db_multi_exec(
+      "INSERT OR IGNORE INTO dchain"
+      "  SELECT delta.rid, %d FROM delta, dchain"
+      "   WHERE dchain.depth=%d AND delta.srcid=dchain.rid",
+      depth+1, depth
+    );
+  }
+  bag_init(&toUndelta);
+  db_prepare(&q, "SELECT rid FROM dchain WHERE depth%%%d==0", mxChain+1);
+  while( db_step(&q)==SQLITE_ROW ){
+    bag_insert(&toUndelta, db_column_int(&q, 0));
+  }
+  db_finalize(&q);
+  db_multi_exec("DROP TABLE dchain");
+  n = bag_count(&toUndelta);
+  for(rid=bag_first(&toUndelta); rid; rid=bag_next(&toUndelta, rid)){
+    content_undelta(rid);
+  }
+  bag_clear(&toUndelta);
+  db_end_transaction(0);
+  return n;
+}
+
+/*
+** Decide which artifact content_deltify(rid,srcid,force) should really
+** use as the delta source for rid.  Return 0 if no delta should be
+** attempted.  This routine enforces the private->public rule and the
+** "max-delta-chain" setting, and breaks delta loops by converting srcid
+** to full text if it is currently derived from rid.  Artifacts stored
+** in chunks are never deltified, nor used as a delta source.
+*/
+static int content_deltify_source(int rid, int srcid, int force){
+  int s;
+  int mxChain;
+  if( srcid==rid ) return 0;
+  if( !force && findSrcid(rid)>0 ) return 0;
+  if( chunk_is_chunked(rid) || chunk_is_chunked(srcid) ) return 0;
+  if( content_is_private(srcid) && !content_is_private(rid) ){
+    return 0;
+  }
+  s = srcid;
+  while( (s = findSrcid(s))>0 ){
+    if( s==rid ){
+      content_undelta(srcid);
+      break;
+    }
+  }
+  mxChain = db_get_int("max-delta-chain", 0);
+  if( mxChain>0 ){
+    int nHeight = content_delta_height(rid, mxChain);
+    int nDepth = content_delta_depth(srcid);
+    while( srcid>0 && nDepth+1+nHeight>mxChain ){
+      srcid = findSrcid(srcid);
+      nDepth--;
+    }
+    if( srcid<=0 ) return 0;
+    if( content_is_private(srcid) && !content_is_private(rid) ){
+      return 0;
+    }
+  }
+  return srcid;
+}
+
+/*
+** Replace the content of rid with pDelta, an already compressed delta
+** against srcid.
+*/
+static void content_deltify_store(int rid, int srcid, Blob *pDelta){
+  Stmt s1, s2;
+  db_prepare(&s1, "UPDATE blob SET content=:data WHERE rid=%d", rid);
+  db_prepare(&s2, "REPLACE INTO delta(rid,srcid)VALUES(%d,%d)", rid, srcid);
+  db_bind_blob(&s1, ":data", pDelta);
+  db_begin_transaction();
+  db_exec(&s1);
+  db_exec(&s2);
+  db_end_transaction(0);
+  db_finalize(&s1);
+  db_finalize(&s2);
+  verify_before_commit(rid);
+}
+
+/*
+** Write into aCand[] other artifacts that might make a better delta
+** source for rid than srcid, and return how many were written.  At
+** most mx artifacts are chosen from each of these groups:
+**
+**    *  Other versions of the same file, including versions on other
+**       branches.  Versions stored as full text come first.
+**
+**    *  Artifacts received near rid whose size is close to the size
+**       of rid.
+**
+** Artifacts that are themselves derived from rid are left out, since
+** converting them back into full text would cost more than it saves.
+** So are private artifacts when rid is public.
+*/
+static int content_delta_candidates(int rid, int srcid, int mx, int *aCand){
+  Stmt q;
+  int n = 0;
+  int sz = db_int(0, "SELECT size FROM blob WHERE rid=%d", rid);
+  db_prepare(&q,
+    "SELECT fid FROM ("
+    "  SELECT DISTINCT m2.fid AS fid FROM mlink AS m1, mlink AS m2"
+    "   WHERE m1.fid=%d AND m2.fnid=m1.fnid AND m2.fid NOT IN (0,%d,%d)"
+    "   ORDER BY m2.fid IN (SELECT rid FROM delta), abs(m2.fid-%d)"
+    "   LIMIT %d)"
+    " UNION ALL "
+    "SELECT rid FROM ("
+    "  SELECT rid FROM blob"
+    "   WHERE rid BETWEEN %d AND %d AND rid NOT IN (%d,%d)"
+    "     AND size BETWEEN %d AND %d"
+    "   ORDER BY abs(size-%d) LIMIT %d)",
+    rid, rid, srcid, rid, mx,
+    rid-100, rid+100, rid, srcid, sz-sz/4, sz+sz/3, sz, mx
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    int x = db_column_int(&q, 0);
+    int s, i;
+    for(i=0; i<n && aCand[i]!=x; i++){}
+    if( i<n ) continue;
+    if( content_is_private(x) && !content_is_private(rid) ) continue;
+    for(s=x; s>0 && s!=rid; s=findSrcid(s)){}
+    if( s==rid ) continue;
+    if( db_int(-1, "SELECT size FROM blob WHERE rid=%d", x)<0 ) continue;
+    aCand[n++] = x;
+  }
+  db_finalize(&q);
+  return n;
+}
+
+/*
+** Implementation of content_deltify() used when the "delta-candidates"
+** setting is positive.  A delta is computed against srcid and against
+** each artifact from content_delta_candidates(), and the one with the
+** lowest cost is stored.  The cost is the compressed size of the delta
+** increased by 1/16th for every delta hop already needed to reconstruct
+** its source, so that a slightly larger delta on a short chain wins over
+** a smaller one that makes reads slower.
+*/
+static int content_deltify_best(int rid, int srcid, int mx){
+  int *aCand;
+  int nCand, i, j;
+  int bestid = 0;
+  i64 bestCost = 0;
+  Blob data, src, delta, best;
+
+  content_get(rid, &data);
+  if( blob_size(&data)<50 ){
+    blob_reset(&data);
+    return 0;
+  }
+  aCand = fossil_malloc( sizeof(aCand[0])*(mx*2+1) );
+  aCand[0] = srcid;
+  nCand = 1 + content_delta_candidates(rid, srcid, mx, &aCand[1]);
+  blob_zero(&best);
+  for(i=0; i<nCand; i++){
+    int s = i==0 ? srcid : content_deltify_source(rid, aCand[i], 1);
+    i64 cost;
+    if( s==0 ) continue;
+    for(j=0; j<i && aCand[j]!=s; j++){}
+    if( j<i ) continue;
+    aCand[i] = s;
+    content_get(s, &src);
+    if( blob_size(&src)<50 ){
+      blob_reset(&src);
+      continue;
+    }
+    blob_delta_create(&src, &data, &delta);
+    blob_reset(&src);
+    if( blob_size(&delta) <= blob_size(&data)*0.75 ){
+      content_compress(&delta, &delta);
+      cost = blob_size(&delta)*(i64)(16+content_delta_depth(s))/16;
+      if( bestid==0 || cost<bestCost ){
+        blob_reset(&best);
+        best = delta;
+        blob_zero(&delta);
+        bestid = s;
+        bestCost = cost;
+      }
+    }
+    blob_reset(&delta);
+  }
+  if( bestid ){
+    content_deltify_store(rid, bestid, &best);
+  }
+  blob_reset(&best);
+  blob_reset(&data);
+  free(aCand);
+  return bestid!=0;
+}
+
 /*
 ** Change the storage of rid so that it is a delta of srcid.
 **
@@ -759,58 +1570,190 @@ void content_make_public(int rid){
 ** resulting delta does not achieve a compression of at least 25% 
 ** the rid is left untouched.
 **
+** If the "max-delta-chain" setting is positive, the delta is never
+** allowed to make any artifact more than that many deltas away from
+** full text.  When srcid is too deep, the delta is re-based onto the
+** shallowest suitable artifact in the delta chain of srcid instead.
+**
+** If the "delta-candidates" setting is positive, srcid is only the first
+** of several delta sources that are tried, and the best is used.
+**
 ** Return 1 if a delta is made and 0 if no delta occurs.
 */
 int content_deltify(int rid, int srcid, int force){
-  int s;
-  Blob data, src, delta;
-  Stmt s1, s2;
+  Blob data, delta;
   int rc = 0;
+  int mxCand;
 
-  if( srcid==rid ) return 0;
-  if( !force && findSrcid(rid)>0 ) return 0;
-  if( content_is_private(srcid) && !content_is_private(rid) ){
-    return 0;
+  srcid = content_deltify_source(rid, srcid, force);
+  if( srcid==0 ) return 0;
+  mxCand = db_get_int("delta-candidates", 0);
+  if( mxCand>0 ){
+    return content_deltify_best(rid, srcid, mxCand);
   }
-  s = srcid;
-  while( (s = findSrcid(s))>0 ){
-    if( s==rid ){
-      content_undelta(srcid);
-      break;
-    }
+  if( deltaSrc.rid!=srcid ){
+    content_delta_source_reset();
+    content_get(srcid, &deltaSrc.content);
+    delta_index_init(&deltaSrc.idx, blob_buffer(&deltaSrc.content),
+                     blob_size(&deltaSrc.content));
+    deltaSrc.rid = srcid;
   }
-  content_get(srcid, &src);
-  if( blob_size(&src)<50 ){
-    blob_reset(&src);
+  if( blob_size(&deltaSrc.content)<50 ){
     return 0;
   }
   content_get(rid, &data);
   if( blob_size(&data)<50 ){
-    blob_reset(&src);
     blob_reset(&data);
     return 0;
   }
-  blob_delta_create(&src, &data, &delta);
+  blob_delta_create_indexed(&deltaSrc.idx, &data, &delta);
   if( blob_size(&delta) <= blob_size(&data)*0.75 ){
-    blob_compress(&delta, &delta);
-    db_prepare(&s1, "UPDATE blob SET content=:data WHERE rid=%d", rid);
-    db_prepare(&s2, "REPLACE INTO delta(rid,srcid)VALUES(%d,%d)", rid, srcid);
-    db_bind_blob(&s1, ":data", &delta);
-    db_begin_transaction();
-    db_exec(&s1);
-    db_exec(&s2);
-    db_end_transaction(0);
-    db_finalize(&s1);
-    db_finalize(&s2);
-    verify_before_commit(rid);
+    content_compress(&delta, &delta);
+    content_deltify_store(rid, srcid, &delta);
     rc = 1;
   }
-  blob_reset(&src);
   blob_reset(&data);
   blob_reset(&delta);
   return rc;
 }
 
+#if INTERFACE
+/*
+** A request to convert artifact rid into a delta, for use with
+** content_deltify_many().  The first of the candidate sources in aSrc[]
+** that gives an acceptable delta is used.  Unused entries of aSrc[]
+** are zero.
+*/
+struct DeltifyReq {
+  int rid;              /* The artifact to be converted into a delta */
+  int aSrc[2];          /* Candidate delta sources, in order of preference */
+};
+#endif
+
+/*
+** The inputs and outputs of one delta computation for
+** content_deltify_many().  Everything a worker thread needs is loaded
+** here by the main thread before the task is started.
+*/
+typedef struct DeltifyTask DeltifyTask;
+struct DeltifyTask {
+  int rid;              /* The artifact to be converted into a delta */
+  int aSrc[2];          /* Candidate sources after content_deltify_source() */
+  Blob target;          /* Content of rid */
+  Blob aSrcContent[2];  /* Content of each aSrc[] */
+  int srcid;            /* The source chosen by the worker.  0 for none */
+  Blob delta;           /* Compressed delta from srcid to rid */
+};
+
+/*
+** Worker-thread half of content_deltify_many().  This routine must not
+** use the database.  It makes the same decisions as content_deltify().
+*/
+static void content_deltify_task(void *pArg){
+  DeltifyTask *p = (DeltifyTask*)pArg;
+  int i;
+  p->srcid = 0;
+  if( blob_size(&p->target)<50 ) return;
+  for(i=0; i<2; i++){
+    Blob *pSrc = &p->aSrcContent[i];
+    if( p->aSrc[i]==0 || blob_size(pSrc)<50 ) continue;
+    blob_delta_create(pSrc, &p->target, &p->delta);
+    if( blob_size(&p->delta) <= blob_size(&p->target)*0.75 ){
+      content_compress(&p->delta, &p->delta);
+      p->srcid = p->aSrc[i];
+      return;
+    }
+    blob_reset(&p->delta);
+  }
+}
+
+/*
+** Process many content_deltify() requests, spreading the computation of
+** deltas and their compression across the threads of pPool.  The
+** database is only accessed by the calling thread.  Requests are handled
+** in batches so that memory usage stays bounded.
+**
+** Conversions made by earlier requests in a batch can change what a later
+** request is allowed to do (for example by deepening a delta chain).  So
+** each result is checked again before it is stored, and if the check no
+** longer passes the request is redone serially by content_deltify().
+**
+** Return the number of artifacts that were converted into deltas.
+*/
+int content_deltify_many(int nReq, const DeltifyReq *aReq, WorkPool *pPool){
+  const i64 mxBatchSize = 50000000;  /* Content bytes loaded per batch */
+  const int mxBatch = 500;           /* Tasks per batch */
+  DeltifyTask *aTask;
+  int iReq = 0;
+  int nDelta = 0;
+
+  if( pPool==0 || workpool_nthread(pPool)==0 ){
+    for(iReq=0; iReq<nReq; iReq++){
+      const DeltifyReq *pReq = &aReq[iReq];
+      if( content_deltify(pReq->rid, pReq->aSrc[0], 0)
+       || (pReq->aSrc[1] && content_deltify(pReq->rid, pReq->aSrc[1], 0)) ){
+        nDelta++;
+      }
+    }
+    return nDelta;
+  }
+  content_compression_init();
+  aTask = fossil_malloc(mxBatch*sizeof(aTask[0]));
+  while( iReq<nReq ){
+    int nTask = 0;
+    i64 szBatch = 0;
+    int i, j;
+
+    /* Load the inputs for a batch of tasks and start them */
+    while( iReq<nReq && nTask<mxBatch && szBatch<mxBatchSize ){
+      const DeltifyReq *pReq = &aReq[iReq++];
+      DeltifyTask *p = &aTask[nTask];
+      int nSrc = 0;
+      memset(p, 0, sizeof(*p));
+      blob_zero(&p->target);
+      blob_zero(&p->aSrcContent[0]);
+      blob_zero(&p->aSrcContent[1]);
+      blob_zero(&p->delta);
+      p->rid = pReq->rid;
+      for(j=0; j<2; j++){
+        int srcid;
+        if( pReq->aSrc[j]==0 ) continue;
+        srcid = content_deltify_source(p->rid, pReq->aSrc[j], 0);
+        if( srcid==0 || (nSrc>0 && srcid==p->aSrc[0]) ) continue;
+        p->aSrc[nSrc] = srcid;
+        content_get(srcid, &p->aSrcContent[nSrc]);
+        szBatch += blob_size(&p->aSrcContent[nSrc]);
+        nSrc++;
+      }
+      if( nSrc==0 ) continue;
+      content_get(p->rid, &p->target);
+      szBatch += blob_size(&p->target);
+      workpool_add(pPool, content_deltify_task, p);
+      nTask++;
+    }
+    workpool_wait(pPool);
+
+    /* Store the results */
+    for(i=0; i<nTask; i++){
+      DeltifyTask *p = &aTask[i];
+      if( p->srcid ){
+        if( content_deltify_source(p->rid, p->srcid, 0)==p->srcid ){
+          content_deltify_store(p->rid, p->srcid, &p->delta);
+          nDelta++;
+        }else if( content_deltify(p->rid, p->aSrc[0], 0)
+               || (p->aSrc[1] && content_deltify(p->rid, p->aSrc[1], 0)) ){
+          nDelta++;
+        }
+      }
+      blob_reset(&p->delta);
+      blob_reset(&p->target);
+      for(j=0; j<2; j++) blob_reset(&p->aSrcContent[j]);
+    }
+  }
+  free(aTask);
+  return nDelta;
+}
+
 /*
 ** COMMAND:  test-content-deltify
 **
@@ -1751,12 +1751,12 @@ char const * cson_rc_string(int rc)
    get the declarations.
  */
 #if defined(CSON_FOSSIL_MODE)
-void *fossil_malloc(size_t n);
-void fossil_free(void *p);
-void *fossil_realloc(void *p, size_t n);
-#  define CSON_MALLOC_IMPL fossil_malloc
-#  define CSON_FREE_IMPL fossil_free
-#  define CSON_REALLOC_IMPL fossil_realloc
+void *json_pool_malloc(size_t n);
+void json_pool_free(void *p);
+void *json_pool_realloc(void *p, size_t n);
+#  define CSON_MALLOC_IMPL json_pool_malloc
+#  define CSON_FREE_IMPL json_pool_free
+#  define CSON_REALLOC_IMPL json_pool_realloc
 #endif
 
 #if !defined CSON_MALLOC_IMPL
@@ -0,0 +1,559 @@
+/*
+** Copyright (c) 2012 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*******************************************************************************
+**
+** This file implements an in-memory index of the directed acyclic graph
+** (DAG) of check-ins, as recorded in the PLINK table.
+**
+** Routines that walk a long way through history, such as pivot_find(),
+** path_shortest() and compute_leaves(), would otherwise run a query
+** against PLINK for every check-in they visit.  Instead, the whole graph
+** is loaded into memory the first time it is needed, and the walk runs
+** over arrays of parents and children.  Each check-in is also given a
+** generation number: one more than the largest generation number of its
+** parents.  A check-in can only be an ancestor of check-ins that have a
+** larger generation number.
+**
+** A compressed copy of the graph is kept in the DAGCACHE table of the
+** repository, together with the number of PLINK rows it covers and the
+** largest PLINK rowid it has seen.  Loading the graph reads that copy,
+** then adds any PLINK rows that were inserted after it was saved.  If
+** the row count does not then match, the copy is stale and the graph
+** is loaded from PLINK in full.  Check-ins that are crosslinked while
+** the graph is in memory are added to it by manifest_crosslink().
+**
+** The DAGCACHE table is not part of the repository schema.  It is
+** dropped by "fossil rebuild".  Updates to it are made on a best-effort
+** basis, so that a read-only repository can still be used.
+*/
+#include "config.h"
+#include "dag.h"
+#include <assert.h>
+
+#if INTERFACE
+/*
+** A link to a parent or child of a check-in, as returned by dag_parents()
+** and dag_children().
+*/
+struct DagLink {
+  int rid;            /* The check-in at the other end of the link */
+  int isPrim;         /* True if the parent is the primary parent */
+};
+#endif
+
+/*
+** Walks that are expected to visit fewer than this many check-ins
+** keep using queries against PLINK unless the DAG is already in memory,
+** since loading the whole graph would cost more than the walk.
+*/
+#define DAG_MIN_WALK  1000
+
+/*
+** A check-in in the graph
+*/
+typedef struct DagNode DagNode;
+struct DagNode {
+  int rid;              /* Record ID of the check-in */
+  int gen;              /* Generation number.  0 if part of a cycle */
+  double mtime;         /* PLINK.MTIME of the check-in.  0.0 if none */
+  int iParent;          /* Parents are dag.aLink[iParent..iParent+nParent-1] */
+  int nParent;          /* Number of parents */
+  int iChild;           /* Children are dag.aLink[iChild..iChild+nChild-1] */
+  int nChild;           /* Number of children */
+};
+
+/*
+** One row of PLINK
+*/
+typedef struct DagEdge DagEdge;
+struct DagEdge {
+  int iParent;          /* Index of the parent in dag.aNode[] */
+  int iChild;           /* Index of the child in dag.aNode[] */
+  int isPrim;           /* True if this is the primary parent of the child */
+};
+
+/*
+** Local variables for this module
+*/
+static struct {
+  int isLoaded;         /* True if the graph has been loaded */
+  int isIndexed;        /* True if aLink[] and the generations are current */
+  int nNode;            /* Number of entries in aNode[] */
+  int nNodeAlloc;       /* Slots allocated for aNode[] */
+  DagNode *aNode;       /* All check-ins */
+  int nHash;            /* Number of slots in aHash[].  A power of two */
+  int *aHash;           /* Maps rid to one more than an index in aNode[] */
+  int nEdge;            /* Number of entries in aEdge[] */
+  int nEdgeAlloc;       /* Slots allocated for aEdge[] */
+  DagEdge *aEdge;       /* All links, in the order they were added */
+  DagLink *aLink;       /* Parents and children of every node */
+} dag;
+
+/*
+** Forget the graph.  It is loaded again when next needed.
+*/
+void dag_reset(void){
+  fossil_free(dag.aNode);
+  fossil_free(dag.aHash);
+  fossil_free(dag.aEdge);
+  fossil_free(dag.aLink);
+  memset(&dag, 0, sizeof(dag));
+}
+
+/*
+** Return the index in dag.aNode[] of check-in rid, or -1 if rid is not
+** in the graph.
+*/
+static int dag_find(int rid){
+  int h;
+  if( dag.nHash==0 ) return -1;
+  h = (unsigned)rid & (dag.nHash-1);
+  while( dag.aHash[h] ){
+    int i = dag.aHash[h]-1;
+    if( dag.aNode[i].rid==rid ) return i;
+    h = (h+1) & (dag.nHash-1);
+  }
+  return -1;
+}
+
+/*
+** Return the index in dag.aNode[] of check-in rid, adding it if it is
+** not already in the graph.
+*/
+static int dag_node(int rid){
+  int i = dag_find(rid);
+  int h;
+  if( i>=0 ) return i;
+  if( dag.nNode*2>=dag.nHash ){
+    int j;
+    fossil_free(dag.aHash);
+    dag.nHash = dag.nHash ? dag.nHash*2 : 1024;
+    dag.aHash = fossil_malloc( sizeof(dag.aHash[0])*dag.nHash );
+    memset(dag.aHash, 0, sizeof(dag.aHash[0])*dag.nHash);
+    for(j=0; j<dag.nNode; j++){
+      h = (unsigned)dag.aNode[j].rid & (dag.nHash-1);
+      while( dag.aHash[h] ) h = (h+1) & (dag.nHash-1);
+      dag.aHash[h] = j+1;
+    }
+  }
+  if( dag.nNode>=dag.nNodeAlloc ){
+    dag.nNodeAlloc = dag.nNodeAlloc*2 + 1000;
+    dag.aNode = fossil_realloc(dag.aNode, sizeof(dag.aNode[0])*dag.nNodeAlloc);
+  }
+  i = dag.nNode++;
+  memset(&dag.aNode[i], 0, sizeof(dag.aNode[i]));
+  dag.aNode[i].rid = rid;
+  h = (unsigned)rid & (dag.nHash-1);
+  while( dag.aHash[h] ) h = (h+1) & (dag.nHash-1);
+  dag.aHash[h] = i+1;
+  return i;
+}
+
+/*
+** Add a link from parent pid to child cid.  mtime is the time of cid.
+*/
+static void dag_add_edge(int pid, int cid, int isPrim, double mtime){
+  DagEdge *p;
+  int iParent = dag_node(pid);
+  int iChild = dag_node(cid);
+  dag.aNode[iChild].mtime = mtime;
+  if( dag.nEdge>=dag.nEdgeAlloc ){
+    dag.nEdgeAlloc = dag.nEdgeAlloc*2 + 1000;
+    dag.aEdge = fossil_realloc(dag.aEdge, sizeof(dag.aEdge[0])*dag.nEdgeAlloc);
+  }
+  p = &dag.aEdge[dag.nEdge++];
+  p->iParent = iParent;
+  p->iChild = iChild;
+  p->isPrim = isPrim!=0;
+  dag.isIndexed = 0;
+}
+
+/*
+** Comparison function for sorting DagLink objects by rid.
+*/
+static int dag_link_cmp(const void *a, const void *b){
+  int ridA = ((const DagLink*)a)->rid;
+  int ridB = ((const DagLink*)b)->rid;
+  return ridA<ridB ? -1 : ridA>ridB;
+}
+
+/*
+** Build the lists of parents and children of every node from
+** dag.aEdge[], then compute the generation numbers.  The lists are
+** sorted by rid, which is the order in which queries against PLINK
+** return them.
+*/
+static void dag_index(void){
+  int i, n;
+  int *aWait;           /* Number of parents not yet given a generation */
+  int *aQueue;          /* Nodes whose parents all have a generation */
+  int nQueue;
+
+  for(i=0; i<dag.nNode; i++){
+    dag.aNode[i].nParent = 0;
+    dag.aNode[i].nChild = 0;
+    dag.aNode[i].gen = 0;
+  }
+  for(i=0; i<dag.nEdge; i++){
+    dag.aNode[dag.aEdge[i].iParent].nChild++;
+    dag.aNode[dag.aEdge[i].iChild].nParent++;
+  }
+  for(i=n=0; i<dag.nNode; i++){
+    dag.aNode[i].iParent = n;
+    n += dag.aNode[i].nParent;
+    dag.aNode[i].iChild = n;
+    n += dag.aNode[i].nChild;
+    dag.aNode[i].nParent = 0;
+    dag.aNode[i].nChild = 0;
+  }
+  fossil_free(dag.aLink);
+  dag.aLink = fossil_malloc( sizeof(dag.aLink[0])*(n+1) );
+  for(i=0; i<dag.nEdge; i++){
+    DagEdge *pE = &dag.aEdge[i];
+    DagNode *pP = &dag.aNode[pE->iParent];
+    DagNode *pC = &dag.aNode[pE->iChild];
+    DagLink *pL;
+    pL = &dag.aLink[pC->iParent + pC->nParent++];
+    pL->rid = pP->rid;
+    pL->isPrim = pE->isPrim;
+    pL = &dag.aLink[pP->iChild + pP->nChild++];
+    pL->rid = pC->rid;
+    pL->isPrim = pE->isPrim;
+  }
+  for(i=0; i<dag.nNode; i++){
+    DagNode *p = &dag.aNode[i];
+    if( p->nParent>1 ){
+      qsort(&dag.aLink[p->iParent], p->nParent, sizeof(DagLink), dag_link_cmp);
+    }
+    if( p->nChild>1 ){
+      qsort(&dag.aLink[p->iChild], p->nChild, sizeof(DagLink), dag_link_cmp);
+    }
+  }
+
+  /* Generation numbers, visiting each node once all of its parents
+  ** have been visited.  Nodes on a cycle are never visited and keep a
+  ** generation number of zero. */
+  aWait = fossil_malloc( sizeof(int)*(dag.nNode+1) );
+  aQueue = fossil_malloc( sizeof(int)*(dag.nNode+1) );
+  for(i=nQueue=0; i<dag.nNode; i++){
+    aWait[i] = dag.aNode[i].nParent;
+    if( aWait[i]==0 ){
+      dag.aNode[i].gen = 1;
+      aQueue[nQueue++] = i;
+    }
+  }
+  for(n=0; n<nQueue; n++){
+    DagNode *p = &dag.aNode[aQueue[n]];
+    for(i=0; i<p->nChild; i++){
+      int iChild = dag_find(dag.aLink[p->iChild+i].rid);
+      DagNode *pC = &dag.aNode[iChild];
+      if( pC->gen<=p->gen ) pC->gen = p->gen+1;
+      if( --aWait[iChild]==0 ) aQueue[nQueue++] = iChild;
+    }
+  }
+  for(i=0; i<dag.nNode; i++){
+    if( aWait[i]>0 ) dag.aNode[i].gen = 0;
+  }
+  fossil_free(aWait);
+  fossil_free(aQueue);
+  dag.isIndexed = 1;
+}
+
+/*
+** Append a 4-byte or 8-byte big-endian integer to pOut.
+*/
+static void dag_put32(Blob *pOut, unsigned int v){
+  char z[4];
+  z[0] = (v>>24) & 0xff;
+  z[1] = (v>>16) & 0xff;
+  z[2] = (v>>8) & 0xff;
+  z[3] = v & 0xff;
+  blob_append(pOut, z, 4);
+}
+static void dag_put64(Blob *pOut, u64 v){
+  dag_put32(pOut, (unsigned int)(v>>32));
+  dag_put32(pOut, (unsigned int)v);
+}
+
+/*
+** Read a 4-byte or 8-byte big-endian integer from z.
+*/
+static unsigned int dag_get32(const unsigned char *z){
+  return ((unsigned int)z[0]<<24) | (z[1]<<16) | (z[2]<<8) | z[3];
+}
+static u64 dag_get64(const unsigned char *z){
+  return ((u64)dag_get32(z)<<32) | dag_get32(&z[4]);
+}
+
+/*
+** Load the graph from the DAGCACHE table.  Set *pMxRowid to the largest
+** PLINK rowid that it covers.  Return true on success, or false if there
+** is no usable copy of the graph.
+*/
+static int dag_cache_read(i64 *pMxRowid){
+  const char *zDb = db_name("repository");
+  Stmt q;
+  Blob graph;
+  const unsigned char *z;
+  int nNode, nEdge, i;
+  int rc = 0;
+
+  if( !db_exists("SELECT 1 FROM %s.sqlite_master WHERE name='dagcache'",
+                 zDb) ){
+    return 0;
+  }
+  blob_zero(&graph);
+  db_prepare(&q, "SELECT mxrowid, graph FROM %s.dagcache WHERE id=1", zDb);
+  if( db_step(&q)==SQLITE_ROW ){
+    *pMxRowid = db_column_int64(&q, 0);
+    db_column_blob(&q, 1, &graph);
+  }
+  db_finalize(&q);
+  if( blob_size(&graph)==0 || blob_uncompress(&graph, &graph)
+   || blob_size(&graph)<8
+  ){
+    blob_reset(&graph);
+    return 0;
+  }
+  z = (const unsigned char*)blob_buffer(&graph);
+  nNode = (int)dag_get32(z);
+  nEdge = (int)dag_get32(&z[4]);
+  if( nNode<0 || nEdge<0
+   || blob_size(&graph)!=8 + (i64)nNode*12 + (i64)nEdge*9
+  ){
+    blob_reset(&graph);
+    return 0;
+  }
+  z += 8;
+  for(i=0; i<nNode; i++, z+=12){
+    u64 x = dag_get64(&z[4]);
+    int iNode = dag_node((int)dag_get32(z));
+    memcpy(&dag.aNode[iNode].mtime, &x, sizeof(x));
+  }
+  for(i=0; i<nEdge; i++, z+=9){
+    int iParent = (int)dag_get32(z);
+    int iChild = (int)dag_get32(&z[4]);
+    if( iParent>=nNode || iChild>=nNode ) break;
+    dag_add_edge(dag.aNode[iParent].rid, dag.aNode[iChild].rid, z[8],
+                 dag.aNode[iChild].mtime);
+  }
+  rc = i==nEdge && dag.nNode==nNode;
+  blob_reset(&graph);
+  if( !rc ) dag_reset();
+  return rc;
+}
+
+/*
+** Save the graph in the DAGCACHE table.  mxRowid is the largest PLINK
+** rowid that it covers.
+*/
+static void dag_cache_write(i64 mxRowid){
+  const char *zDb = db_name("repository");
+  Blob graph, z;
+  char *zSql;
+  int i;
+
+  blob_zero(&graph);
+  dag_put32(&graph, dag.nNode);
+  dag_put32(&graph, dag.nEdge);
+  for(i=0; i<dag.nNode; i++){
+    u64 x;
+    memcpy(&x, &dag.aNode[i].mtime, sizeof(x));
+    dag_put32(&graph, dag.aNode[i].rid);
+    dag_put64(&graph, x);
+  }
+  for(i=0; i<dag.nEdge; i++){
+    char c = dag.aEdge[i].isPrim;
+    dag_put32(&graph, dag.aEdge[i].iParent);
+    dag_put32(&graph, dag.aEdge[i].iChild);
+    blob_append(&graph, &c, 1);
+  }
+  blob_compress_ex(&graph, &z, BLOB_COMPRESS_ZLIB, 1);
+  blob_reset(&graph);
+  zSql = mprintf(
+    "CREATE TABLE IF NOT EXISTS %s.dagcache(\n"
+    "  id INTEGER PRIMARY KEY,  -- Always 1\n"
+    "  nlink INTEGER,           -- Number of PLINK rows in the graph\n"
+    "  mxrowid INTEGER,         -- Largest PLINK rowid in the graph\n"
+    "  graph BLOB               -- Compressed nodes and links\n"
+    ");"
+    "REPLACE INTO %s.dagcache(id,nlink,mxrowid,graph)"
+    " VALUES(1,%d,%lld,:content);",
+    zDb, zDb, dag.nEdge, mxRowid
+  );
+  db_multi_exec_ignore_error(zSql, &z);
+  free(zSql);
+  blob_reset(&z);
+}
+
+/*
+** Make sure the graph is loaded and indexed.
+*/
+static void dag_load(void){
+  i64 mxRowid = 0;
+  int needSave = 0;
+  Stmt q;
+
+  if( dag.isLoaded ){
+    if( !dag.isIndexed ) dag_index();
+    return;
+  }
+  if( !dag_cache_read(&mxRowid) ) mxRowid = 0;
+  db_prepare(&q,
+    "SELECT pid, cid, isprim, mtime, rowid FROM plink WHERE rowid>%lld",
+    mxRowid
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    dag_add_edge(db_column_int(&q,0), db_column_int(&q,1),
+                 db_column_int(&q,2), db_column_double(&q,3));
+    mxRowid = db_column_int64(&q, 4);
+    needSave = 1;
+  }
+  db_finalize(&q);
+  if( dag.nEdge!=db_int(0, "SELECT count(*) FROM plink") ){
+    /* The saved graph is out of date.  Load the whole of PLINK. */
+    dag_reset();
+    mxRowid = 0;
+    db_prepare(&q, "SELECT pid, cid, isprim, mtime, rowid FROM plink");
+    while( db_step(&q)==SQLITE_ROW ){
+      dag_add_edge(db_column_int(&q,0), db_column_int(&q,1),
+                   db_column_int(&q,2), db_column_double(&q,3));
+      if( db_column_int64(&q, 4)>mxRowid ) mxRowid = db_column_int64(&q, 4);
+    }
+    db_finalize(&q);
+    needSave = 1;
+  }
+  if( needSave ) dag_cache_write(mxRowid);
+  dag.isLoaded = 1;
+  dag_index();
+}
+
+/*
+** Record that manifest_crosslink() has added a link from parent pid to
+** child cid to PLINK.  Nothing needs to be done unless the graph has
+** already been loaded.
+*/
+void dag_add_link(int pid, int cid, int isPrim, double mtime){
+  if( dag.isLoaded ) dag_add_edge(pid, cid, isPrim, mtime);
+}
+
+/*
+** Return true if a walk through history that is expected to visit
+** about nStep check-ins should use the in-memory graph.  Use zero for
+** walks with no fixed bound.
+*/
+int dag_use(int nStep){
+  return dag.isLoaded || nStep<=0 || nStep>=DAG_MIN_WALK;
+}
+
+/*
+** Set *paLink to the parents of check-in rid, sorted by rid, and return
+** the number of parents.
+*/
+int dag_parents(int rid, const DagLink **paLink){
+  int i;
+  dag_load();
+  i = dag_find(rid);
+  if( i<0 ){
+    *paLink = 0;
+    return 0;
+  }
+  *paLink = &dag.aLink[dag.aNode[i].iParent];
+  return dag.aNode[i].nParent;
+}
+
+/*
+** Set *paLink to the children of check-in rid, sorted by rid, and
+** return the number of children.
+*/
+int dag_children(int rid, const DagLink **paLink){
+  int i;
+  dag_load();
+  i = dag_find(rid);
+  if( i<0 ){
+    *paLink = 0;
+    return 0;
+  }
+  *paLink = &dag.aLink[dag.aNode[i].iChild];
+  return dag.aNode[i].nChild;
+}
+
+/*
+** Return the primary parent of check-in rid, or 0 if it has none.
+*/
+int dag_primary_parent(int rid){
+  const DagLink *aLink;
+  int i, n;
+  n = dag_parents(rid, &aLink);
+  for(i=0; i<n; i++){
+    if( aLink[i].isPrim ) return aLink[i].rid;
+  }
+  return 0;
+}
+
+/*
+** Return the time of check-in rid as recorded in PLINK, or 0.0 if it
+** has no parents.
+*/
+double dag_mtime(int rid){
+  int i;
+  dag_load();
+  i = dag_find(rid);
+  return i<0 ? 0.0 : dag.aNode[i].mtime;
+}
+
+/*
+** Return the generation number of check-in rid.  Check-ins without
+** parents are generation 1.  Zero is returned if rid is not in the
+** graph or if its generation is unknown because of a cycle.
+*/
+int dag_generation(int rid){
+  int i;
+  dag_load();
+  i = dag_find(rid);
+  return i<0 ? 0 : dag.aNode[i].gen;
+}
+
+/*
+** COMMAND: test-dag
+**
+** Usage: %fossil test-dag ?VERSION ...?
+**
+** Load the graph of check-ins and report its size.  Then show the
+** generation number, parents and children of each VERSION.
+*/
+void test_dag_cmd(void){
+  int i, j, n;
+  const DagLink *aLink;
+
+  db_find_and_open_repository(0,0);
+  dag_load();
+  fossil_print("%d check-ins, %d links\n", dag.nNode, dag.nEdge);
+  for(i=2; i<g.argc; i++){
+    int rid = name_to_typed_rid(g.argv[i], "ci");
+    fossil_print("%s: rid=%d gen=%d\n", g.argv[i], rid, dag_generation(rid));
+    n = dag_parents(rid, &aLink);
+    for(j=0; j<n; j++){
+      fossil_print("  parent %d%s\n", aLink[j].rid,
+                   aLink[j].isPrim ? " (primary)" : "");
+    }
+    n = dag_children(rid, &aLink);
+    for(j=0; j<n; j++){
+      fossil_print("  child %d%s\n", aLink[j].rid,
+                   aLink[j].isPrim ? " (primary)" : "");
+    }
+  }
+}
@@ -49,6 +49,8 @@ struct Stmt {
   sqlite3_stmt *pStmt;    /* The results of sqlite3_prepare() */
   Stmt *pNext, *pPrev;    /* List of all unfinalized statements */
   int nStep;              /* Number of sqlite3_step() calls */
+  int iPerf;              /* Timing slot from perf_sql_slot(), or 0 */
+  int isReused;           /* True if cached or from db_static_prepare() */
 };
 
 /*
@@ -56,7 +58,7 @@ struct Stmt {
 ** is useful to help avoid assertions when performing cleanup in some
 ** error handling cases.
 */
-#define empty_Stmt_m {BLOB_INITIALIZER,NULL, NULL, NULL, 0}
+#define empty_Stmt_m {BLOB_INITIALIZER,NULL, NULL, NULL, 0, 0, 0}
 #endif /* INTERFACE */
 const struct Stmt empty_Stmt = empty_Stmt_m;
 
@@ -101,6 +103,12 @@ static void db_err(const char *zFormat, ...){
   fossil_exit(rc);
 }
 
+/*
+** Maximum number of idle prepared statements kept by db_finalize() for
+** reuse by a later db_prepare() of the same SQL text.
+*/
+#define DB_STMT_CACHE 50
+
 /*
 ** All static variable that a used by only this file are gathered into
 ** the following structure.
@@ -111,12 +119,21 @@ static struct DbLocalData {
   int nCommitHook;          /* Number of commit hooks */
   Stmt *pAllStmt;           /* List of all unfinalized statements */
   int nPrepare;             /* Number of calls to sqlite3_prepare() */
+  int nReuse;               /* Number of statements reused from aCache[] */
+  int nCache;               /* Number of entries in aCache[] */
+  int inReusedStep;         /* True while stepping a reused statement */
+  struct sStmtCache {
+    char *zSql;                 /* Text of the statement */
+    int nSql;                   /* Length of zSql */
+    sqlite3_stmt *pStmt;        /* The statement, reset and unbound */
+  } aCache[DB_STMT_CACHE];  /* Idle statements, most recently used first */
   int nDeleteOnFail;        /* Number of entries in azDeleteOnFail[] */
   struct sCommitHook {
     int (*xHook)(void);         /* Functions to call at db_end_transaction() */
     int sequence;               /* Call functions in sequence order */
   } aHook[5];
   char *azDeleteOnFail[3];  /* Files to delete on a failure */
+  int isDisowned;           /* True if db_disown() has been called */
 } db = {0, 0, 0, 0, 0, 0, };
 
 /*
@@ -168,11 +185,69 @@ void db_end_transaction(int rollbackFlag){
     while( db.pAllStmt ){
       db_finalize(db.pAllStmt);
     }
+    if( db.doRollback ){
+      dag_reset();
+      name_cache_clear();
+    }
     db_multi_exec(db.doRollback ? "ROLLBACK" : "COMMIT");
+    if( db.doRollback ){
+      db_config_snapshot_clear();
+      archive_cache_forget_pending();
+    }else{
+      archive_cache_fill_pending();
+    }
     db.doRollback = 0;
   }
 }
 
+/*
+** Return the nesting depth of the current transaction, or 0 if there
+** is no transaction.
+*/
+int db_transaction_nesting_depth(void){
+  return db.nBegin;
+}
+
+/*
+** Commit everything done so far by the current transaction and begin
+** a new one at the same nesting depth, as if every pending
+** db_end_transaction() had been called and then matched again by
+** db_begin_transaction().  Commit hooks run as they would on a normal
+** commit.  Nothing is done if a rollback has already been requested.
+**
+** This lets a long-running operation such as a clone or pull save its
+** progress, so that work already done is not lost if it fails later.
+*/
+void db_checkpoint_transaction(void){
+  int i;
+  int nBegin = db.nBegin;
+  if( g.db==0 || nBegin<=0 || db.doRollback ) return;
+  leaf_do_pending_checks();
+  for(i=0; db.doRollback==0 && i<db.nCommitHook; i++){
+    db.doRollback |= db.aHook[i].xHook();
+  }
+  if( db.doRollback ) return;
+  db.nBegin = 0;
+  db_multi_exec("COMMIT");
+  db_multi_exec("BEGIN");
+  db.nBegin = nBegin;
+}
+
+/*
+** Stop deleting zFilename on a failure, undoing a prior call to
+** db_delete_on_failure().
+*/
+void db_keep_on_failure(const char *zFilename){
+  int i;
+  for(i=0; i<db.nDeleteOnFail; i++){
+    if( fossil_strcmp(db.azDeleteOnFail[i], zFilename)==0 ){
+      fossil_free(db.azDeleteOnFail[i]);
+      db.azDeleteOnFail[i] = db.azDeleteOnFail[--db.nDeleteOnFail];
+      return;
+    }
+  }
+}
+
 /*
 ** Force a rollback and shutdown the database
 */
@@ -180,7 +255,7 @@ void db_force_rollback(void){
   int i;
   static int busy = 0;
   sqlite3_stmt *pStmt = 0;
-  if( busy || g.db==0 ) return;
+  if( busy || g.db==0 || db.isDisowned ) return;
   busy = 1;
   undo_rollback();
   while( (pStmt = sqlite3_next_stmt(g.db,pStmt))!=0 ){
@@ -229,25 +304,108 @@ void db_commit_hook(int (*x)(void), int sequence){
   db.nCommitHook++;
 }
 
+/*
+** Remove and return an idle statement for the SQL text zSql on the
+** g.db connection from the statement cache.  Return NULL if there is
+** no such statement.
+*/
+static sqlite3_stmt *db_stmt_cache_take(const char *zSql, int nSql){
+  int i;
+  for(i=0; i<db.nCache; i++){
+    struct sStmtCache *p = &db.aCache[i];
+    if( p->nSql==nSql && sqlite3_db_handle(p->pStmt)==g.db
+     && memcmp(p->zSql, zSql, nSql)==0
+    ){
+      sqlite3_stmt *pStmt = p->pStmt;
+      fossil_free(p->zSql);
+      db.nCache--;
+      memmove(p, p+1, (db.nCache-i)*sizeof(*p));
+      db.nReuse++;
+      return pStmt;
+    }
+  }
+  return 0;
+}
+
+/*
+** Reset the statement that pStmt holds and add it to the front of the
+** statement cache, finalizing the least recently used statement if
+** the cache is full.  Return the result of resetting the statement.
+*/
+static int db_stmt_cache_put(Stmt *pStmt){
+  int rc = sqlite3_reset(pStmt->pStmt);
+  if( rc!=SQLITE_OK ){
+    sqlite3_finalize(pStmt->pStmt);
+    return rc;
+  }
+  sqlite3_clear_bindings(pStmt->pStmt);
+  if( db.nCache==DB_STMT_CACHE ){
+    db.nCache--;
+    fossil_free(db.aCache[db.nCache].zSql);
+    sqlite3_finalize(db.aCache[db.nCache].pStmt);
+  }
+  memmove(&db.aCache[1], &db.aCache[0], db.nCache*sizeof(db.aCache[0]));
+  db.aCache[0].nSql = blob_size(&pStmt->sql);
+  db.aCache[0].zSql = fossil_strdup(blob_str(&pStmt->sql));
+  db.aCache[0].pStmt = pStmt->pStmt;
+  db.nCache++;
+  return rc;
+}
+
+/*
+** Return true while sqlite3_step() runs on a statement that was taken
+** from the statement cache or that db_static_prepare() keeps for the
+** life of the process.  Such a statement may have been prepared before
+** a change to the schema, and SQLite logs SQLITE_SCHEMA as it prepares
+** the statement again.
+*/
+int db_in_reused_step(void){
+  return db.inReusedStep;
+}
+
+/*
+** Finalize every statement in the statement cache.  This must be done
+** before a database connection is closed.
+*/
+void db_stmt_cache_clear(void){
+  while( db.nCache>0 ){
+    db.nCache--;
+    fossil_free(db.aCache[db.nCache].zSql);
+    sqlite3_finalize(db.aCache[db.nCache].pStmt);
+  }
+}
+
 /*
 ** Prepare a Stmt.  Assume that the Stmt is previously uninitialized.
 ** If the input string contains multiple SQL statements, only the first
 ** one is processed.  All statements beyond the first are silently ignored.
+**
+** Statements are usually taken from the cache of statements that have
+** been finalized by db_finalize(), so SQL that is prepared many times
+** should use bind parameters rather than values formatted into the
+** text, so that the text is the same each time.
 */
 int db_vprepare(Stmt *pStmt, int errOk, const char *zFormat, va_list ap){
-  int rc;
+  int rc = SQLITE_OK;
   char *zSql;
+  i64 iStart = perf_timer_start(PERF_SQL_PREPARE);
   blob_zero(&pStmt->sql);
   blob_vappendf(&pStmt->sql, zFormat, ap);
   va_end(ap);
   zSql = blob_str(&pStmt->sql);
-  db.nPrepare++;
-  rc = sqlite3_prepare_v2(g.db, zSql, -1, &pStmt->pStmt, 0);
+  pStmt->pStmt = db_stmt_cache_take(zSql, blob_size(&pStmt->sql));
+  pStmt->isReused = pStmt->pStmt!=0;
+  if( pStmt->pStmt==0 ){
+    db.nPrepare++;
+    rc = sqlite3_prepare_v2(g.db, zSql, -1, &pStmt->pStmt, 0);
+  }
   if( rc!=0 && !errOk ){
     db_err("%s\n%s", sqlite3_errmsg(g.db), zSql);
   }
   pStmt->pNext = pStmt->pPrev = 0;
   pStmt->nStep = 0;
+  pStmt->iPerf = perf_sql_slot(zSql);
+  perf_timer_stop(PERF_SQL_PREPARE, iStart);
   return rc;
 }
 int db_prepare(Stmt *pStmt, const char *zFormat, ...){
@@ -272,6 +430,7 @@ int db_static_prepare(Stmt *pStmt, const char *zFormat, ...){
     va_list ap;
     va_start(ap, zFormat);
     rc = db_vprepare(pStmt, 0, zFormat, ap);
+    pStmt->isReused = 1;
     pStmt->pNext = db.pAllStmt;
     pStmt->pPrev = 0;
     if( db.pAllStmt ) db.pAllStmt->pPrev = pStmt;
@@ -330,7 +489,11 @@ int db_bind_str(Stmt *pStmt, const char *zParamName, Blob *pBlob){
 */
 int db_step(Stmt *pStmt){
   int rc;
+  i64 iStart = perf_timer_start(PERF_SQL_STEP);
+  db.inReusedStep = pStmt->isReused;
   rc = sqlite3_step(pStmt->pStmt);
+  db.inReusedStep = 0;
+  perf_sql_step(pStmt->iPerf, perf_timer_stop(PERF_SQL_STEP, iStart));
   pStmt->nStep++;
   return rc;
 }
@@ -368,10 +531,12 @@ int db_reset(Stmt *pStmt){
   return rc;
 }
 int db_finalize(Stmt *pStmt){
-  int rc;
+  int rc = SQLITE_OK;
   db_stats(pStmt);
+  if( pStmt->pStmt ){
+    rc = db_stmt_cache_put(pStmt);
+  }
   blob_reset(&pStmt->sql);
-  rc = sqlite3_finalize(pStmt->pStmt);
   db_check_result(rc);
   pStmt->pStmt = 0;
   if( pStmt->pNext ){
@@ -490,6 +655,28 @@ int db_multi_exec(const char *zSql, ...){
   return rc;
 }
 
+/*
+** Run the SQL statements in zSql, binding pContent to ":content" where
+** it appears if pContent is not NULL.  Any error is ignored.  This is
+** for caches that are updated on a best-effort basis.
+*/
+void db_multi_exec_ignore_error(const char *zSql, Blob *pContent){
+  while( zSql && zSql[0] ){
+    sqlite3_stmt *pStmt = 0;
+    if( sqlite3_prepare_v2(g.db, zSql, -1, &pStmt, &zSql)!=SQLITE_OK ) break;
+    if( pStmt==0 ) break;
+    if( pContent ){
+      int i = sqlite3_bind_parameter_index(pStmt, ":content");
+      if( i>0 ){
+        sqlite3_bind_blob(pStmt, i, blob_buffer(pContent), blob_size(pContent),
+                          SQLITE_TRANSIENT);
+      }
+    }
+    while( sqlite3_step(pStmt)==SQLITE_ROW ){}
+    sqlite3_finalize(pStmt);
+  }
+}
+
 /*
 ** Execute a query and return a single integer value.
 */
@@ -608,6 +795,11 @@ char *db_text(char const *zDefault, const char *zSql, ...){
 /*
 ** Initialize a new database file with the given schema.  If anything
 ** goes wrong, call db_err() to exit.
+**
+** A new database file uses incremental auto-vacuum, so that the space
+** freed by later deletions can be given back a little at a time by
+** "fossil compact" rather than only by a full VACUUM.  This must be
+** set before the first write.  It has no effect on an existing file.
 */
 void db_init_database(
   const char *zFileName,   /* Name of database file to create */
@@ -624,6 +816,7 @@ void db_init_database(
     db_err(sqlite3_errmsg(db));
   }
   sqlite3_busy_timeout(db, 5000);
+  sqlite3_exec(db, "PRAGMA auto_vacuum=INCREMENTAL", 0, 0, 0);
   sqlite3_exec(db, "BEGIN EXCLUSIVE", 0, 0, 0);
   rc = sqlite3_exec(db, zSchema, 0, 0, 0);
   if( rc!=SQLITE_OK ){
@@ -763,21 +956,64 @@ void db_open_config(int useAttach){
 
 
 /*
- * * Returns TRUE if zTable exists in the local database.
- */
-static int db_local_table_exists(const char *zTable){
-  return db_exists("SELECT 1 FROM %s.sqlite_master"
-                   " WHERE name=='%s' /*scan*/",
-                   db_name("localdb"), zTable);
-}
+** Columns that older versions of Fossil did not have, and the statement
+** that adds each one to a local database that lacks it.  The column is
+** looked for as a word of the CREATE TABLE statement.  Tables that do
+** not exist are left alone.
+*/
+static const struct {
+  const char *zTable;          /* Table in the local database */
+  const char *zColumn;         /* Column that might be missing */
+  const char *zAlter;          /* Statement that adds the column */
+} aLocalColumn[] = {
+  /* Added on 2010-03-06 */
+  { "vfile",      "isexe",
+    "ALTER TABLE vfile ADD COLUMN isexe BOOLEAN DEFAULT 0" },
+  /* Added on 2011-01-17 and 2011-08-27 */
+  { "vfile",      "islink",
+    "ALTER TABLE vfile ADD COLUMN islink BOOLEAN DEFAULT 0" },
+  { "stashfile",  "isLink",
+    "ALTER TABLE stashfile ADD COLUMN isLink BOOLEAN DEFAULT 0" },
+  { "undo",       "isLink",
+    "ALTER TABLE undo ADD COLUMN isLink BOOLEAN DEFAULT 0" },
+  { "undo_vfile", "islink",
+    "ALTER TABLE undo_vfile ADD COLUMN islink BOOLEAN DEFAULT 0" },
+};
 
 /*
-** Returns TRUE if zColumn exists in zTable in the local database.
+** Add any of the columns in aLocalColumn[] that are missing from the
+** local database.  The CREATE TABLE statements of all the tables are
+** read with a single query, since this runs on every command.
 */
-static int db_local_column_exists(const char *zTable, const char *zColumn){
-  return db_exists("SELECT 1 FROM %s.sqlite_master"
-                   " WHERE name=='%s' AND sql GLOB '* %s *' /*scan*/",
-                   db_name("localdb"), zTable, zColumn);
+static void db_local_add_columns(void){
+  Stmt q;
+  Blob alter;
+  int i;
+  blob_zero(&alter);
+  db_prepare(&q,
+    "SELECT name, sql FROM %s.sqlite_master"
+    " WHERE name IN ('vfile','stashfile','undo','undo_vfile') /*scan*/",
+    db_name("localdb")
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    const char *zName = db_column_text(&q, 0);
+    const char *zSql = db_column_text(&q, 1);
+    if( zSql==0 ) continue;
+    for(i=0; i<sizeof(aLocalColumn)/sizeof(aLocalColumn[0]); i++){
+      char *zWord;
+      if( fossil_strcmp(zName, aLocalColumn[i].zTable)!=0 ) continue;
+      zWord = mprintf(" %s ", aLocalColumn[i].zColumn);
+      if( strstr(zSql, zWord)==0 ){
+        blob_appendf(&alter, "%s;\n", aLocalColumn[i].zAlter);
+      }
+      free(zWord);
+    }
+  }
+  db_finalize(&q);
+  if( blob_size(&alter)>0 ){
+    db_multi_exec("%s", blob_str(&alter));
+  }
+  blob_reset(&alter);
 }
 
 /*
@@ -791,37 +1027,7 @@ static int isValidLocalDb(const char *zDbName){
   lsize = file_size(zDbName);
   if( lsize%1024!=0 || lsize<4096 ) return 0;
   db_open_or_attach(zDbName, "localdb");
-
-  /* If the "isexe" column is missing from the vfile table, then
-  ** add it now.   This code added on 2010-03-06.  After all users have
-  ** upgraded, this code can be safely deleted. 
-  */
-  if( !db_local_column_exists("vfile", "isexe") ){
-    db_multi_exec("ALTER TABLE vfile ADD COLUMN isexe BOOLEAN DEFAULT 0");
-  }
-
-  /* If "islink"/"isLink" columns are missing from tables, then
-  ** add them now.   This code added on 2011-01-17 and 2011-08-27.
-  ** After all users have upgraded, this code can be safely deleted. 
-  */
-  if( !db_local_column_exists("vfile", "islink") ){
-    db_multi_exec("ALTER TABLE vfile ADD COLUMN islink BOOLEAN DEFAULT 0");
-  }
-  
-  if( !db_local_column_exists("stashfile", "isLink") &&
-       db_local_table_exists("stashfile") ){
-    db_multi_exec("ALTER TABLE stashfile ADD COLUMN isLink BOOLEAN DEFAULT 0");
-  }
-
-  if( !db_local_column_exists("undo", "isLink") &&
-       db_local_table_exists("undo") ){
-    db_multi_exec("ALTER TABLE undo ADD COLUMN isLink BOOLEAN DEFAULT 0");
-  }
-  
-  if( !db_local_column_exists("undo_vfile", "islink") &&
-       db_local_table_exists("undo_vfile") ){
-    db_multi_exec("ALTER TABLE undo_vfile ADD COLUMN islink BOOLEAN DEFAULT 0");
-  }
+  db_local_add_columns();
   return 1;
 }
 
@@ -897,6 +1103,48 @@ const char *db_repository_filename(void){
   return zRepo;
 }
 
+/*
+** Apply the "sqlite-*" settings to the repository database that has
+** just been opened.  Settings that are unset or zero leave the SQLite
+** defaults alone.
+**
+** The journal mode is stored in the database file itself, so it is
+** changed only when it differs from the setting.  Changing it needs
+** an exclusive lock on the repository, so if that fails because some
+** other process is using the repository the change is just tried
+** again on a later open.
+*/
+static void db_repository_tuning(void){
+  static const char *azJournal[] = { "delete", "truncate", "persist", "wal" };
+  const char *zDb = db_name("repository");
+  char *z;
+  int i, n;
+
+  n = db_get_int("sqlite-cache-size", 0);
+  if( n!=0 ){
+    db_multi_exec("PRAGMA %s.cache_size=%d", zDb, n);
+  }
+  z = db_get("sqlite-temp-store", 0);
+  if( fossil_stricmp(z, "memory")==0 || fossil_stricmp(z, "file")==0 ){
+    db_multi_exec("PRAGMA temp_store=%s", z);
+  }
+  free(z);
+  z = db_get("sqlite-journal-mode", 0);
+  for(i=0; z && i<sizeof(azJournal)/sizeof(azJournal[0]); i++){
+    if( fossil_stricmp(z, azJournal[i])==0 ){
+      char *zCur = db_text(0, "PRAGMA %s.journal_mode", zDb);
+      if( fossil_stricmp(zCur, azJournal[i])!=0 ){
+        char *zSql = mprintf("PRAGMA %s.journal_mode=%s", zDb, azJournal[i]);
+        sqlite3_exec(g.db, zSql, 0, 0, 0);
+        free(zSql);
+      }
+      free(zCur);
+      break;
+    }
+  }
+  free(z);
+}
+
 /*
 ** Open the repository database given by zDbName.  If zDbName==NULL then
 ** get the name from the already open local database.
@@ -933,8 +1181,11 @@ void db_open_repository(const char *zDbName){
   db_open_or_attach(zDbName, "repository");
   g.repositoryOpen = 1;
   g.zRepositoryName = mprintf("%s", zDbName);
+  search_db_attach(0);
   /* Cache "allow-symlinks" option, because we'll need it on every stat call */
   g.allowSymlinks = db_get_boolean("allow-symlinks", 0);
+  perf_slow_log_setup();
+  db_repository_tuning();
 }
 
 /*
@@ -992,12 +1243,192 @@ const char *db_name(const char *zDb){
 }
 
 /*
-** Return TRUE if the schema is out-of-date
+** Snapshots of the CONFIG and GLOBAL_CONFIG tables, so that reading the
+** many settings that a command consults costs one query per table
+** rather than one or two per setting.  A snapshot is loaded by the
+** first lookup and used for as long as the connection it came from has
+** made no changes, according to sqlite3_total_changes().  Values longer
+** than CONFIG_SNAP_MAXVALUE bytes, such as the skin, are left out and
+** are still looked up one at a time.  A table of more than
+** CONFIG_SNAP_MAXROW rows is not kept at all.
+**
+** Changes made by other processes are not noticed, so the snapshots are
+** dropped by db_close() and at the start of each web request.  They are
+** also dropped when a transaction rolls back, since that undoes changes
+** without counting as any.
+*/
+#define CONFIG_SNAP_MAXVALUE 1000
+#define CONFIG_SNAP_MAXROW   1000
+static struct ConfigSnap {
+  const char *zTable;          /* "config" or "global_config" */
+  sqlite3 *db;                 /* Connection it was loaded from.  0 if none */
+  int nChange;                 /* sqlite3_total_changes(db) when loaded */
+  int n;                       /* Entries in a[].  -1 if the table is big */
+  struct ConfigSnapEntry {
+    char *zName;                 /* Name of the value */
+    char *zValue;                /* The value, or NULL if not kept */
+  } *a;                        /* Entries in order of zName */
+} aConfigSnap[] = {
+  { "config",        0, 0, 0, 0 },
+  { "global_config", 0, 0, 0, 0 },
+};
+
+/*
+** Drop the snapshots of the CONFIG and GLOBAL_CONFIG tables.
+*/
+void db_config_snapshot_clear(void){
+  int i, j;
+  for(i=0; i<sizeof(aConfigSnap)/sizeof(aConfigSnap[0]); i++){
+    struct ConfigSnap *p = &aConfigSnap[i];
+    for(j=0; j<p->n; j++){
+      free(p->a[j].zName);
+      free(p->a[j].zValue);
+    }
+    free(p->a);
+    p->a = 0;
+    p->n = 0;
+    p->db = 0;
+  }
+}
+
+/*
+** Load the snapshot p of its table from the connection g.db.
+*/
+static void db_config_snapshot_load(struct ConfigSnap *p){
+  Stmt q;
+  int j;
+  for(j=0; j<p->n; j++){
+    free(p->a[j].zName);
+    free(p->a[j].zValue);
+  }
+  p->n = 0;
+  p->db = g.db;
+  p->nChange = sqlite3_total_changes(g.db);
+  if( p->a==0 ){
+    p->a = fossil_malloc( sizeof(p->a[0])*CONFIG_SNAP_MAXROW );
+  }
+  db_prepare(&q,
+    "SELECT name, CASE WHEN length(value)<=%d THEN value END"
+    "  FROM %s ORDER BY name LIMIT %d",
+    CONFIG_SNAP_MAXVALUE, p->zTable, CONFIG_SNAP_MAXROW+1
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    const char *zValue = db_column_text(&q, 1);
+    if( p->n>=CONFIG_SNAP_MAXROW ){
+      for(j=0; j<p->n; j++){
+        free(p->a[j].zName);
+        free(p->a[j].zValue);
+      }
+      p->n = -1;
+      break;
+    }
+    p->a[p->n].zName = fossil_strdup(db_column_text(&q, 0));
+    p->a[p->n].zValue = zValue ? fossil_strdup(zValue) : 0;
+    p->n++;
+  }
+  db_finalize(&q);
+}
+
+/*
+** Look up the value named zName in the snapshot of table zTable, loading
+** the snapshot first if it is missing or out of date.  Return 1 and set
+** *pzValue if the value exists, 0 if it does not, or -1 if the database
+** has to be asked.
+*/
+static int db_config_snapshot_find(
+  const char *zTable,          /* "config", "global_config" or "vvar" */
+  const char *zName,           /* Name of the value */
+  const char **pzValue         /* OUT: The value */
+){
+  struct ConfigSnap *p = 0;
+  int i, lwr, upr;
+  for(i=0; i<sizeof(aConfigSnap)/sizeof(aConfigSnap[0]); i++){
+    if( strcmp(zTable, aConfigSnap[i].zTable)==0 ) p = &aConfigSnap[i];
+  }
+  if( p==0 || g.db==0 ) return -1;
+  if( p->db!=g.db || p->nChange!=sqlite3_total_changes(g.db) ){
+    db_config_snapshot_load(p);
+  }
+  if( p->n<0 ) return -1;
+  lwr = 0;
+  upr = p->n-1;
+  while( lwr<=upr ){
+    int c;
+    i = (lwr+upr)/2;
+    c = strcmp(zName, p->a[i].zName);
+    if( c==0 ){
+      if( p->a[i].zValue==0 ) return -1;
+      *pzValue = p->a[i].zValue;
+      return 1;
+    }else if( c<0 ){
+      upr = i-1;
+    }else{
+      lwr = i+1;
+    }
+  }
+  return 0;
+}
+
+/*
+** Return the "aux-schema" value of a repository with the AUX_FEATURE_*
+** features in mFeature.
+*/
+const char *db_aux_schema_value(int mFeature){
+  static const char *const azValue[] = {
+    AUX_SCHEMA,
+    AUX_SCHEMA_CHUNKED,
+    AUX_SCHEMA AUX_SCHEMA_ZSTD,
+    AUX_SCHEMA_CHUNKED AUX_SCHEMA_ZSTD,
+  };
+  return azValue[mFeature & (AUX_FEATURE_CHUNKED|AUX_FEATURE_ZSTD)];
+}
+
+/*
+** Return the AUX_FEATURE_* features of the "aux-schema" value zValue,
+** or -1 if zValue is not a value that this version of fossil knows.
+*/
+int db_aux_schema_features(const char *zValue){
+  int m;
+  for(m=0; m<=(AUX_FEATURE_CHUNKED|AUX_FEATURE_ZSTD); m++){
+    if( strcmp(zValue, db_aux_schema_value(m))==0 ) return m;
+  }
+  return -1;
+}
+
+/*
+** Add the AUX_FEATURE_* features in mFeature to the "aux-schema" of the
+** repository, unless it has them already.
+*/
+void db_aux_schema_add(int mFeature){
+  char *zValue = db_get("aux-schema", 0);
+  int m = zValue ? db_aux_schema_features(zValue) : 0;
+  if( m>=0 && (m & mFeature)!=mFeature ){
+    db_set("aux-schema", db_aux_schema_value(m|mFeature), 0);
+  }
+  fossil_free(zValue);
+}
+
+/*
+** Return TRUE if the schema is out-of-date, or if the repository uses a
+** feature that this build of fossil does not support.
 */
 int db_schema_is_outofdate(void){
-  return db_exists("SELECT 1 FROM config"
-                   " WHERE name='aux-schema'"
-                   "   AND value<>'%s'", AUX_SCHEMA);
+  const char *zValue;
+  char *zFree = 0;
+  int m;
+  switch( db_config_snapshot_find("config", "aux-schema", &zValue) ){
+    case 0:  return 0;
+    case 1:  break;
+    default: {
+      zValue = zFree = db_text(0,
+          "SELECT value FROM config WHERE name='aux-schema'");
+      if( zValue==0 ) return 0;
+      break;
+    }
+  }
+  m = db_aux_schema_features(zValue);
+  fossil_free(zFree);
+  return m<0 || ((m & AUX_FEATURE_ZSTD)!=0 && !blob_have_zstd());
 }
 
 /*
@@ -1006,6 +1437,11 @@ int db_schema_is_outofdate(void){
 */
 void db_verify_schema(void){
   if( db_schema_is_outofdate() ){
+    char *zValue = db_get("aux-schema", 0);
+    if( zValue && db_aux_schema_features(zValue)>=0 ){
+      fossil_fatal("this repository holds artifacts compressed with zstd,"
+                   " which this build of fossil does not support");
+    }
 #ifdef FOSSIL_ENABLE_JSON
     g.json.resultCode = FSL_JSON_E_DB_NEEDS_REBUILD;
 #endif
@@ -1067,7 +1503,7 @@ void db_must_be_within_tree(void){
 */
 void db_close(int reportErrors){
   sqlite3_stmt *pStmt;
-  if( g.db==0 ) return;
+  if( g.db==0 || db.isDisowned ) return;
   if( g.fSqlStats ){
     int cur, hiwtr;
     sqlite3_db_status(g.db, SQLITE_DBSTATUS_LOOKASIDE_USED, &cur, &hiwtr, 0);
@@ -1093,11 +1529,19 @@ void db_close(int reportErrors){
     sqlite3_status(SQLITE_STATUS_PAGECACHE_OVERFLOW, &cur, &hiwtr, 0);
     fprintf(stderr, "-- PCACHE_OVFLOW          %10d %10d\n", cur, hiwtr);
     fprintf(stderr, "-- prepared statements    %10d\n", db.nPrepare);
+    fprintf(stderr, "-- reused statements      %10d\n", db.nReuse);
   }
   while( db.pAllStmt ){
     db_finalize(db.pAllStmt);
   }
   db_end_transaction(1);
+  search_db_detach();
+  db_stmt_cache_clear();
+  db_config_snapshot_clear();
+  manifest_cache_clear();
+  content_clear_cache();
+  name_cache_clear();
+  shun_cache_reset();
   pStmt = 0;
   if( reportErrors ){
     while( (pStmt = sqlite3_next_stmt(g.db, pStmt))!=0 ){
@@ -1116,6 +1560,17 @@ void db_close(int reportErrors){
   }
 }
 
+/*
+** Promise never to close, commit, or roll back the database connections
+** of this process.  This is for use in a child process created by
+** fork() that may still read the databases it shares with its parent
+** but must leave the parent's open transaction alone, even when it
+** exits with an error.
+*/
+void db_disown(void){
+  db.isDisowned = 1;
+  db.nDeleteOnFail = 0;
+}
 
 /*
 ** Create a new empty repository database with the given name.
@@ -1210,13 +1665,15 @@ void db_initial_setup(
 
   if( zInitialDate ){
     int rid;
+    MD5Context ctx;
+    char zCksum[33];
     blob_zero(&manifest);
     blob_appendf(&manifest, "C initial\\sempty\\scheck-in\n");
     zDate = date_in_standard_format(zInitialDate);
     blob_appendf(&manifest, "D %s\n", zDate);
     blob_appendf(&manifest, "P\n");
-    md5sum_init();
-    blob_appendf(&manifest, "R %s\n", md5sum_finish(0));
+    md5_ctx_init(&ctx);
+    blob_appendf(&manifest, "R %s\n", md5_ctx_finish(&ctx, zCksum));
     blob_appendf(&manifest, "T *branch * trunk\n");
     blob_appendf(&manifest, "T *sym-trunk *\n");
     blob_appendf(&manifest, "U %F\n", g.zLogin);
@@ -1380,15 +1837,14 @@ static void file_is_selected(
 */
 char *db_conceal(const char *zContent, int n){
   static char zHash[42];
-  Blob out;
+  SHA1Context ctx;
   if( n==40 && validate16(zContent, n) ){
     memcpy(zHash, zContent, n);
     zHash[n] = 0;
   }else{
-    sha1sum_step_text(zContent, n);
-    sha1sum_finish(&out);
-    sqlite3_snprintf(sizeof(zHash), zHash, "%s", blob_str(&out));
-    blob_reset(&out);
+    sha1_ctx_init(&ctx);
+    sha1_ctx_step(&ctx, zContent, n);
+    sha1_ctx_finish(&ctx, zHash);
     db_multi_exec(
        "INSERT OR IGNORE INTO concealed(hash,content,mtime)"
        " VALUES(%Q,%#Q,now())",
@@ -1552,6 +2008,40 @@ static char *db_get_do_versionable(const char *zName, char *zNonVersionedSetting
 }
 
 
+/*
+** Prepare pQ to look up the value named zName in table zTable, which
+** is one of CONFIG, GLOBAL_CONFIG or VVAR, and step it.  Return true if
+** the value exists, in which case it is column 0 of pQ.  The caller
+** must finalize pQ either way.
+**
+** The name is bound rather than formatted into the SQL so that the
+** statement is reused from the statement cache.
+*/
+static int db_config_find(Stmt *pQ, const char *zTable, const char *zName){
+  db_prepare(pQ, "SELECT value FROM %s WHERE name=:name", zTable);
+  db_bind_text(pQ, ":name", zName);
+  return db_step(pQ)==SQLITE_ROW;
+}
+
+/*
+** Return the text of the value named zName in table zTable, in memory
+** obtained from malloc(), or NULL if there is no such value.
+*/
+static char *db_config_text(const char *zTable, const char *zName){
+  Stmt q;
+  char *z = 0;
+  const char *zValue;
+  switch( db_config_snapshot_find(zTable, zName, &zValue) ){
+    case 0:  return 0;
+    case 1:  return mprintf("%s", zValue);
+  }
+  if( db_config_find(&q, zTable, zName) ){
+    z = mprintf("%s", db_column_text(&q, 0));
+  }
+  db_finalize(&q);
+  return z;
+}
+
 /*
 ** Get and set values from the CONFIG, GLOBAL_CONFIG and VVAR table in the
 ** repository and local databases.
@@ -1568,11 +2058,11 @@ char *db_get(const char *zName, char *zDefault){
     }
   }
   if( g.repositoryOpen ){
-    z = db_text(0, "SELECT value FROM config WHERE name=%Q", zName);
+    z = db_config_text("config", zName);
   }
   if( z==0 && g.configOpen ){
     db_swap_connections();
-    z = db_text(0, "SELECT value FROM global_config WHERE name=%Q", zName);
+    z = db_config_text("global_config", zName);
     db_swap_connections();
   }
   if( ctrlSetting!=0 && ctrlSetting->versionable && g.localOpen ){
@@ -1623,23 +2113,32 @@ int db_is_global(const char *zName){
   }
   return rc;
 }
+/*
+** Look up the integer value named zName in table zTable.  Return true
+** and set *pV if the value exists.
+*/
+static int db_config_int(const char *zTable, const char *zName, int *pV){
+  Stmt q;
+  int found;
+  const char *zValue;
+  switch( db_config_snapshot_find(zTable, zName, &zValue) ){
+    case 0:  return 0;
+    case 1:  *pV = atoi(zValue);  return 1;
+  }
+  found = db_config_find(&q, zTable, zName);
+  if( found ) *pV = db_column_int(&q, 0);
+  db_finalize(&q);
+  return found;
+}
 int db_get_int(const char *zName, int dflt){
   int v = dflt;
-  int rc;
+  int found = 0;
   if( g.repositoryOpen ){
-    Stmt q;
-    db_prepare(&q, "SELECT value FROM config WHERE name=%Q", zName);
-    rc = db_step(&q);
-    if( rc==SQLITE_ROW ){
-      v = db_column_int(&q, 0);
-    }
-    db_finalize(&q);
-  }else{
-    rc = SQLITE_DONE;
+    found = db_config_int("config", zName, &v);
   }
-  if( rc==SQLITE_DONE && g.configOpen ){
+  if( !found && g.configOpen ){
     db_swap_connections();
-    v = db_int(dflt, "SELECT value FROM global_config WHERE name=%Q", zName);
+    db_config_int("global_config", zName, &v);
     db_swap_connections();
   }
   return v;
@@ -1665,14 +2164,23 @@ int db_get_boolean(const char *zName, int dflt){
   return dflt;
 }
 char *db_lget(const char *zName, char *zDefault){
-  return db_text((char*)zDefault,
-                 "SELECT value FROM vvar WHERE name=%Q", zName);
+  char *z = db_config_text("vvar", zName);
+  if( z==0 && zDefault ){
+    z = mprintf("%s", zDefault);
+  }
+  return z;
 }
 void db_lset(const char *zName, const char *zValue){
   db_multi_exec("REPLACE INTO vvar(name,value) VALUES(%Q,%Q)", zName, zValue);
 }
 int db_lget_int(const char *zName, int dflt){
-  return db_int(dflt, "SELECT value FROM vvar WHERE name=%Q", zName);
+  Stmt q;
+  int v = dflt;
+  if( db_config_find(&q, "vvar", zName) ){
+    v = db_column_int(&q, 0);
+  }
+  db_finalize(&q);
+  return v;
 }
 void db_lset_int(const char *zName, int value){
   db_multi_exec("REPLACE INTO vvar(name,value) VALUES(%Q,%d)", zName, value);
@@ -1732,6 +2240,8 @@ void db_record_repository_filename(const char *zName){
 ** Options:
 **   --keep     Only modify the manifest and manifest.uuid files
 **   --nested   Allow opening a repository inside an opened checkout
+**   --sparse PATTERNS  Only check out files that match the comma-separated
+**              GLOB PATTERNS.  See the "sparse" command.
 **
 ** See also: close
 */
@@ -1740,11 +2250,13 @@ void cmd_open(void){
   int vid;
   int keepFlag;
   int allowNested;
+  const char *zSparse;
   static char *azNewArgv[] = { 0, "checkout", "--prompt", 0, 0, 0 };
 
   url_proxy_options();
   keepFlag = find_option("keep",0,0)!=0;
   allowNested = find_option("nested",0,0)!=0;
+  zSparse = find_option("sparse",0,1);
   if( g.argc!=3 && g.argc!=4 ){
     usage("REPOSITORY-FILENAME ?VERSION?");
   }
@@ -1757,6 +2269,7 @@ void cmd_open(void){
   db_delete_on_failure("./_FOSSIL_");
   db_open_local();
   db_lset("repository", g.argv[2]);
+  if( zSparse ) db_lset("sparse-glob", zSparse);
   db_record_repository_filename(blob_str(&path));
   vid = db_int(0, "SELECT pid FROM plink y"
                   " WHERE NOT EXISTS(SELECT 1 FROM plink x WHERE x.cid=y.pid)");
@@ -1841,17 +2354,31 @@ struct stControlSettings {
 struct stControlSettings const ctrlSettings[] = {
   { "access-log",    0,                0, 0, "off"                 },
   { "allow-symlinks",0,                0, 1, "off"                 },
+  { "annotation-cache-size",0,        10, 0, "10000"               },
+  { "archive-cache-size",0,           10, 0, "0"                   },
+  { "archive-compression-level",0,    10, 0, "9"                   },
   { "auto-captcha",  "autocaptcha",    0, 0, "on"                  },
   { "auto-shun",     0,                0, 0, "on"                  },
   { "autosync",      0,                0, 0, "on"                  },
   { "binary-glob",   0,               32, 1, ""                    },
   { "clearsign",     0,                0, 0, "off"                 },
   { "case-sensitive",0,                0, 0, "on"                  },
+  { "checkout-cache",0,               40, 0, ""                    },
+  { "checkout-cache-link",0,           0, 0, "off"                 },
+  { "chunk-threshold",0,              10, 0, "0"                   },
+  { "compression",   0,               10, 0, "zlib"                },
+  { "compression-level",0,            10, 0, "0"                   },
+  { "content-cache-size",0,           10, 0, "50000000"            },
   { "crnl-glob",     0,               16, 1, ""                    },
   { "default-perms", 0,               16, 0, "u"                   },
+  { "delta-cache-size",0,             10, 0, "0"                   },
+  { "delta-candidates",0,             10, 0, "0"                   },
+  { "delta-manifest-files",0,         10, 0, "10000"               },
+  { "diff-cache-size",0,              10, 0, "0"                   },
   { "diff-command",  0,               16, 0, ""                    },
   { "dont-push",     0,                0, 0, "off"                 },
   { "editor",        0,               16, 0, ""                    },
+  { "fsmonitor-command",0,           40, 0, ""                    },
   { "gdiff-command", 0,               16, 0, "gdiff"               },
   { "gmerge-command",0,               40, 0, ""                    },
   { "https-login",   0,                0, 0, "off"                 },
@@ -1861,21 +2388,35 @@ struct stControlSettings const ctrlSettings[] = {
   { "localauth",     0,                0, 0, "off"                 },
   { "main-branch",   0,               40, 0, "trunk"               },
   { "manifest",      0,                0, 1, "off"                 },
+  { "manifest-cache-size",0,          10, 0, "10000000"            },
+  { "max-delta-chain",0,              10, 0, "0"                   },
   { "max-upload",    0,               25, 0, "250000"              },
   { "mtime-changes", 0,                0, 0, "on"                  },
+  { "page-cache-size",0,              10, 0, "0"                   },
   { "pgp-command",   0,               32, 0, "gpg --clearsign -o " },
   { "proxy",         0,               32, 0, "off"                 },
   { "relative-paths",0,                0, 0, "on"                  },
   { "repo-cksum",    0,                0, 0, "on"                  },
+  { "report-cache-size",0,            10, 0, "0"                   },
+  { "search-file-glob",0,             40, 0, ""                    },
   { "self-register", 0,                0, 0, "off"                 },
+  { "server-timing", 0,                0, 0, "off"                 },
+  { "slow-log",      0,               40, 0, ""                    },
+  { "slow-log-threshold",0,           10, 0, "1000"                },
+  { "sqlite-cache-size",0,            10, 0, "0"                   },
+  { "sqlite-journal-mode",0,          10, 0, ""                    },
+  { "sqlite-temp-store",0,            10, 0, ""                    },
   { "ssl-ca-location",0,              40, 0, ""                    },
   { "ssl-identity",  0,               40, 0, ""                    },
+  { "ssl-session-cache",0,             0, 0, "off"                 },
   { "ssh-command",   0,               32, 0, ""                    },
+  { "ssh-persist",   0,               10, 0, "0"                   },
 #ifdef FOSSIL_ENABLE_TCL
   { "tcl",           0,                0, 0, "off"                 },
 #endif
   { "web-browser",   0,               32, 0, ""                    },
   { "white-foreground", 0,             0, 0, "off"                 },
+  { "wiki-cache-size",0,              10, 0, "0"                   },
   { 0,0,0,0,0 }
 };
 
@@ -1903,6 +2444,31 @@ struct stControlSettings const ctrlSettings[] = {
 **                     plain-text files with link destination path inside).
 **                     Default: off
 **
+**    annotation-cache-size  The maximum number of file annotations that
+**                     "fossil annotate" and the /annotate page keep in
+**                     the repository, so that annotating a newer version
+**                     of a file only diffs the versions added since.
+**                     Zero disables the cache.  Default: 10000
+**
+**    archive-cache-size  The maximum number of bytes of ZIP archives and
+**                     tarballs that the /zip and /tarball pages keep, so
+**                     that popular downloads are built only once.  They
+**                     are kept in a directory named after the repository
+**                     with "-archivecache" added.  Archives of check-ins
+**                     tagged "release" are added as soon as the tag
+**                     arrives.  The least recently downloaded archives
+**                     are removed first.  Zero disables the cache, which
+**                     is not available on Windows.  Default: 0
+**
+**    archive-compression-level  The zlib compression level, 0 to 9, of
+**                     the ZIP archives and tarballs made by the "zip" and
+**                     "tarball" commands and web pages.  Lower levels use
+**                     much less CPU time for slightly larger archives,
+**                     and tarballs below level 9 are compressed by all
+**                     worker threads.  Level 9 tarballs are compressed as
+**                     one stream, the same bytes as in older versions.
+**                     Default: 9
+**
 **    auto-captcha     If enabled, the Login page provides a button to
 **                     fill in the captcha password.  Default: on
 **
@@ -1914,6 +2480,9 @@ struct stControlSettings const ctrlSettings[] = {
 **                     or update and automatically push after commit or
 **                     tag or branch creation.  If the value is "pullonly"
 **                     then only pull operations occur automatically.
+**                     If the value is "background" then the push after
+**                     a commit runs in the background, with retries,
+**                     and "fossil status" shows if it failed.
 **                     Default: on
 **
 **    binary-glob      The VALUE is a comma or newline-separated list of
@@ -1925,10 +2494,53 @@ struct stControlSettings const ctrlSettings[] = {
 **                     differ only in case are the same file.  Defaults to
 **                     TRUE for unix and FALSE for windows and mac.
 **
+**    checkout-cache   A directory where checkout and update keep a copy of
+**                     each file they write, named by its artifact ID, so
+**                     that checkouts sharing this directory also share
+**                     the storage of their common files.  Files in the
+**                     checkout are copy-on-write clones of the cached
+**                     copies where the filesystem supports that (Btrfs,
+**                     XFS, APFS) and ordinary copies elsewhere.  Set this
+**                     with --global to share it between repositories.
+**                     Empty disables the cache.  Default: ""
+**
+**    checkout-cache-link  If enabled, files in the checkout are read-only
+**                     hard links to the copies in checkout-cache, which
+**                     works on any filesystem.  Fossil replaces a linked
+**                     file with a private copy before writing it, but
+**                     other programs must not write a linked file in
+**                     place.  Executable files are never linked.
+**                     Default: off
+**
+**    chunk-threshold  Files of at least this many bytes are stored as a
+**                     sequence of chunks cut by a rolling hash, so that
+**                     the chunks shared by two versions are stored only
+**                     once and the file is committed and checked out a
+**                     chunk at a time rather than in one piece.  Such
+**                     files are not stored as deltas.  Values below
+**                     1048576 are treated as 1048576.  Zero disables
+**                     chunking.  Default: 0
+**
 **    clearsign        When enabled, fossil will attempt to sign all commits
 **                     with gpg.  When disabled (the default), commits will
 **                     be unsigned.  Default: off
 **
+**    compression      The method used to compress artifacts as they are
+**                     stored: "zlib" or "zstd".  Content stored earlier
+**                     remains readable whatever this is set to.  zstd
+**                     requires fossil built --with-zstd; otherwise zlib
+**                     is used.  Default: zlib
+**
+**    compression-level  The compression level for new artifacts.  0 means
+**                     the default for the method: the zlib default of 6,
+**                     as in older versions, and 3 for zstd.  Default: 0
+**
+**    content-cache-size  The maximum number of bytes of expanded artifact
+**                     content held in memory while resolving delta chains.
+**                     Larger values speed up operations that walk long
+**                     delta chains at the cost of memory.
+**                     Default: 50000000
+**
 **    crnl-glob        A comma or newline-separated list of GLOB patterns for
 **     (versionable)   text files in which it is ok to have CR+NL line endings.
 **                     Set to "*" to disable CR+NL checking.
@@ -1937,6 +2549,34 @@ struct stControlSettings const ctrlSettings[] = {
 **                     information on permissions see Users page in Server
 **                     Administration of the HTTP UI. Default: u.
 **
+**    delta-cache-size  The maximum number of bytes of deltas that the
+**                     server keeps after computing them for a pull, so
+**                     that later clients pulling the same artifacts get
+**                     them without the deltas being computed again.
+**                     Zero disables the cache.  Default: 0
+**
+**    delta-candidates  When an artifact is converted into a delta, also
+**                     try up to this many other versions of the same file
+**                     and up to this many artifacts of similar size, and
+**                     keep the smallest delta, favoring sources that are
+**                     close to full text.  Zero tries only the usual
+**                     source.  Default: 0
+**
+**    delta-manifest-files  A check-in of at least this many files is
+**                     recorded as a delta-manifest against an earlier
+**                     baseline manifest when that makes it smaller, even
+**                     if the repository has no delta-manifests yet.
+**                     Fossil 1.17 and earlier cannot read such a
+**                     repository.  Zero disables this.  Default: 10000
+**
+**    diff-cache-size  The maximum number of bytes of rendered diffs that
+**                     the /fdiff, /vdiff, /info and /ci pages keep, so
+**                     that a diff shown to many readers is computed only
+**                     once.  The diffs are kept in the same file as the
+**                     page-cache-size pages, and the least recently used
+**                     ones are removed first.  Zero disables the cache.
+**                     Default: 0
+**
 **    diff-command     External command to run when performing a diff.
 **                     If undefined, the internal text diff will be used.
 **
@@ -1950,6 +2590,15 @@ struct stControlSettings const ctrlSettings[] = {
 **
 **    editor           Text editor command used for check-in comments.
 **
+**    fsmonitor-command  A command that reports which files of the
+**                     checkout have changed, so that commands such as
+**                     "status" and "commit" need not examine every file.
+**                     It is run with the token it printed last time as
+**                     its argument, and prints a new token on the first
+**                     line followed by the changed pathnames, one per
+**                     line.  Use it with a filesystem monitor such as
+**                     Watchman.  Default: none
+**
 **    gdiff-command    External command to run when performing a graphical
 **                     diff. If undefined, text diff will be used.
 **
@@ -1980,12 +2629,31 @@ struct stControlSettings const ctrlSettings[] = {
 **     (versionable)   "manifest.uuid" in every checkout.  The SQLite and
 **                     Fossil repositories both require this.  Default: off.
 **
+**    manifest-cache-size  The maximum number of bytes of memory used to keep
+**                     parsed check-in manifests for reuse within one
+**                     process.  Larger values help long-running servers
+**                     and rebuilds of large repositories.
+**                     Default: 10000000
+**
+**    max-delta-chain  The maximum number of deltas that may separate any
+**                     artifact from full text.  New deltas that would exceed
+**                     this limit are re-based on a shallower source, and
+**                     "fossil rebuild" converts over-deep artifacts back
+**                     into full text.  Zero means no limit.  Default: 0
+**
 **    max-upload       A limit on the size of uplink HTTP requests.  The
 **                     default is 250000 bytes.
 **
 **    mtime-changes    Use file modification times (mtimes) to detect when
 **                     files have been modified.  (Default "on".)
 **
+**    page-cache-size  The maximum number of bytes of rendered pages such
+**                     as /timeline and /tree that the server keeps, so
+**                     that identical requests are answered without
+**                     building the page again.  The pages are kept in
+**                     a file named after the repository with "-pagecache"
+**                     added.  Zero disables the cache.  Default: 0
+**
 **    pgp-command      Command used to clear-sign manifests at check-in.
 **                     The default is "gpg --clearsign -o ".
 **
@@ -2002,11 +2670,63 @@ struct stControlSettings const ctrlSettings[] = {
 **                     Disable on large repositories for a performance
 **                     improvement.
 **
+**    report-cache-size  The maximum number of bytes of ticket report
+**                     tables shown by /rptview to keep, so that a report
+**                     viewed again is not run again until an artifact
+**                     arrives or a setting changes.  Reports that use
+**                     the current time or random numbers are not kept.
+**                     The tables are kept in the same file as the
+**                     page-cache-size pages.  Zero disables the cache.
+**                     Default: 0
+**
+**    search-file-glob  The files on the main branch whose content is
+**                     searched by the "search" command and the /search
+**                     page, as a comma or newline-separated list of GLOB
+**                     patterns.  Binary files are never searched.
+**                     Default: "", which searches no files.
+**
 **    self-register    Allow users to register themselves through the HTTP UI.
 **                     This is useful if you want to see other names than
 **                     "Anonymous" in e.g. ticketing system. On the other hand
 **                     users can not be deleted. Default: off.
 **
+**    server-timing    If enabled, every web page is sent with a
+**                     "Server-Timing" reply header that gives the time
+**                     spent in SQL, in TH1 and generating the page, and
+**                     the content cache hit counts.  Browser developer
+**                     tools show these figures.  See also /stat/perf
+**                     and the --perf option.  Default: off.
+**
+**    slow-log         The name of a file to which a report is appended for
+**                     each web page or command that takes longer than
+**                     slow-log-threshold milliseconds.  The report gives
+**                     the URL or command line, the user, the SQL statements
+**                     that took the most time, the number of artifacts
+**                     read and the longest delta chain expanded.  When
+**                     the file grows past 10MB it is renamed with ".1"
+**                     added to its name and a new file is started.  For
+**                     a server in a chroot jail, the name is inside the
+**                     jail.  Default: "", which keeps no log.
+**
+**    slow-log-threshold  Web pages and commands that take at least this
+**                     many milliseconds are reported in the slow-log
+**                     file.  Default: 1000
+**
+**    sqlite-cache-size  The number of database pages that SQLite keeps in
+**                     memory for the repository, or if negative, the
+**                     size of that cache in KiB.  Default: 0, which uses
+**                     the SQLite default.
+**
+**    sqlite-journal-mode  One of "delete", "truncate", "persist" or
+**                     "wal".  The repository is switched to this journal
+**                     mode when it is opened.  With "wal", web pages can
+**                     still be read while a sync writes the repository.
+**                     Default: unset, which leaves the mode unchanged.
+**
+**    sqlite-temp-store  "memory" or "file" to choose where SQLite keeps
+**                     temporary tables and indices.  Default: unset,
+**                     which uses the SQLite default.
+**
 **    ssl-ca-location  The full pathname to a file containing PEM encoded
 **                     CA root certificates, or a directory of certificates
 **                     with filenames formed from the certificate hashes as
@@ -2025,9 +2745,25 @@ struct stControlSettings const ctrlSettings[] = {
 **                     authenticate this client, in addition to the normal
 **                     password authentication.
 **
+**    ssl-session-cache  If enabled, the TLS session of each HTTPS server
+**                     is saved in the global configuration, so that later
+**                     commands, such as the syncs of "fossil all", resume
+**                     it instead of doing a full handshake.  The session
+**                     secrets are then as safe as the ~/.fossil file.
+**                     Otherwise sessions are resumed only within one
+**                     command.  Default: off
+**
 **    ssh-command      Command used to talk to a remote machine with
 **                     the "ssh://" protocol.
 **
+**    ssh-persist      If greater than zero, ssh:// syncs to the same host
+**                     share one OpenSSH connection, which stays open for
+**                     this many seconds after the last sync ends.  Set it
+**                     globally so that "fossil all sync" makes only one
+**                     connection per host.  Needs a ~/.ssh directory
+**                     and OpenSSH 6.7 or later.  Ignored if ssh-command
+**                     is set.  Unix only.  Default: 0
+**
 **    tcl              If enabled, Tcl integration commands will be added to
 **                     the TH1 interpreter, allowing Tcl expressions and
 **                     scripts to be evaluated from TH1.  Additionally, the
@@ -2039,6 +2775,14 @@ struct stControlSettings const ctrlSettings[] = {
 **                     Defaults to "start" on windows, "open" on Mac,
 **                     and "firefox" on Unix.
 **
+**    wiki-cache-size  The maximum number of bytes of rendered wiki pages,
+**                     documents and tickets to keep, so that long wiki
+**                     text shown to many readers is rendered only once.
+**                     The HTML is kept in the same file as the
+**                     page-cache-size pages, and the least recently used
+**                     entries are removed first.  Zero disables the
+**                     cache.  Default: 0
+**
 ** Options:
 **   --global   set or unset the given property globally instead of
 **              setting or unsetting it for the open repository only.
@@ -2133,6 +2877,7 @@ void test_timespan_cmd(void){
   sqlite3_open(":memory:", &g.db);  
   rDiff = db_double(0.0, "SELECT julianday('now') - julianday(%Q)", g.argv[2]);
   fossil_print("Time differences: %s\n", db_timespan_name(rDiff));
+  db_stmt_cache_clear();
   sqlite3_close(g.db);
   g.db = 0;
 }
@@ -71,6 +71,25 @@ typedef unsigned int u32;
 typedef short int s16;
 typedef unsigned short int u16;
 
+/*
+** A precomputed index of landmark hashes for a delta source file.
+**
+** Building the index is the most expensive part of delta_create() for
+** large sources.  When the same source is to be compared against many
+** targets, build the index once with delta_index_init() and then call
+** delta_create_indexed() for each target.  The index holds a pointer to
+** the source text, which must not change or be freed while the index
+** is in use.
+*/
+typedef struct DeltaIndex DeltaIndex;
+struct DeltaIndex {
+  const char *zSrc;      /* The source file */
+  unsigned int lenSrc;   /* Length of the source file */
+  int nHash;             /* Number of hash table entries */
+  int *landmark;         /* Primary hash table */
+  int *collide;          /* Collision chain */
+};
+
 #endif /* INTERFACE */
 
 /*
@@ -227,6 +246,73 @@ static unsigned int checksum(const char *zIn, size_t N){
   return sum3;
 }
 
+/*
+** Return the number of leading bytes that zA[] and zB[] have in common,
+** looking at no more than n bytes.  Comparison is done a machine word
+** at a time for as long as possible.
+*/
+static int match_forward(const char *zA, const char *zB, int n){
+  int i = 0;
+  while( i+(int)sizeof(size_t)<=n ){
+    size_t x, y;
+    memcpy(&x, &zA[i], sizeof(x));
+    memcpy(&y, &zB[i], sizeof(y));
+    if( x!=y ) break;
+    i += sizeof(size_t);
+  }
+  while( i<n && zA[i]==zB[i] ) i++;
+  return i;
+}
+
+/*
+** Return the number of bytes immediately prior to zA[0] and zB[0] that
+** are the same in both buffers, looking back no more than n bytes.
+*/
+static int match_backward(const char *zA, const char *zB, int n){
+  int i = 0;
+  while( i+(int)sizeof(size_t)<=n ){
+    size_t x, y;
+    memcpy(&x, &zA[-i-(int)sizeof(x)], sizeof(x));
+    memcpy(&y, &zB[-i-(int)sizeof(y)], sizeof(y));
+    if( x!=y ) break;
+    i += sizeof(size_t);
+  }
+  while( i<n && zA[-i-1]==zB[-i-1] ) i++;
+  return i;
+}
+
+/*
+** Build the landmark hash table for source file zSrc[] into *p.
+*/
+void delta_index_init(DeltaIndex *p, const char *zSrc, unsigned int lenSrc){
+  int i;
+  hash h;
+  memset(p, 0, sizeof(*p));
+  p->zSrc = zSrc;
+  p->lenSrc = lenSrc;
+  if( lenSrc<=NHASH ) return;
+  p->nHash = lenSrc/NHASH;
+  p->collide = fossil_malloc( p->nHash*2*sizeof(int) );
+  p->landmark = &p->collide[p->nHash];
+  memset(p->landmark, -1, p->nHash*sizeof(int));
+  memset(p->collide, -1, p->nHash*sizeof(int));
+  for(i=0; i<lenSrc-NHASH; i+=NHASH){
+    int hv;
+    hash_init(&h, &zSrc[i]);
+    hv = hash_32bit(&h) % p->nHash;
+    p->collide[i/NHASH] = p->landmark[hv];
+    p->landmark[hv] = i/NHASH;
+  }
+}
+
+/*
+** Free the memory held by a DeltaIndex.
+*/
+void delta_index_reset(DeltaIndex *p){
+  free(p->collide);
+  memset(p, 0, sizeof(*p));
+}
+
 /*
 ** Create a new delta.
 **
@@ -294,13 +380,33 @@ int delta_create(
   const char *zOut,      /* The target file */
   unsigned int lenOut,   /* Length of the target file */
   char *zDelta           /* Write the delta into this buffer */
+){
+  DeltaIndex idx;
+  int n;
+  delta_index_init(&idx, zSrc, lenSrc);
+  n = delta_create_indexed(&idx, zOut, lenOut, zDelta);
+  delta_index_reset(&idx);
+  return n;
+}
+
+/*
+** Create a new delta using a source file that has already been indexed
+** by delta_index_init().  The output is identical to delta_create().
+*/
+int delta_create_indexed(
+  const DeltaIndex *pIdx, /* Index of the source file */
+  const char *zOut,       /* The target file */
+  unsigned int lenOut,    /* Length of the target file */
+  char *zDelta            /* Write the delta into this buffer */
 ){
   int i, base;
   char *zOrigDelta = zDelta;
   hash h;
-  int nHash;                 /* Number of hash table entries */
-  int *landmark;             /* Primary hash table */
-  int *collide;              /* Collision chain */
+  const char *zSrc = pIdx->zSrc;      /* The source file */
+  unsigned int lenSrc = pIdx->lenSrc; /* Length of the source file */
+  int nHash = pIdx->nHash;            /* Number of hash table entries */
+  const int *landmark = pIdx->landmark;  /* Primary hash table */
+  const int *collide = pIdx->collide;    /* Collision chain */
   int lastRead = -1;         /* Last byte of zSrc read by a COPY command */
 
   /* Add the target file size to the beginning of the delta
@@ -322,22 +428,6 @@ int delta_create(
     return zDelta - zOrigDelta;
   }
 
-  /* Compute the hash table used to locate matching sections in the
-  ** source file.
-  */
-  nHash = lenSrc/NHASH;
-  collide = fossil_malloc( nHash*2*sizeof(int) );
-  landmark = &collide[nHash];
-  memset(landmark, -1, nHash*sizeof(int));
-  memset(collide, -1, nHash*sizeof(int));
-  for(i=0; i<lenSrc-NHASH; i+=NHASH){
-    int hv;
-    hash_init(&h, &zSrc[i]);
-    hv = hash_32bit(&h) % nHash;
-    collide[i/NHASH] = landmark[hv];
-    landmark[hv] = i/NHASH;
-  }
-
   /* Begin scanning the target file and generating copy commands and
   ** literal sections of the delta.
   */
@@ -372,23 +462,22 @@ int delta_create(
         ** copy command is less than the amount of literal text to be copied.
         */
         int cnt, ofst, litsz;
-        int j, k, x, y;
+        int j, k, n;
         int sz;
 
         /* Beginning at iSrc, match forwards as far as we can.  j counts
         ** the number of characters that match */
         iSrc = iBlock*NHASH;
-        for(j=0, x=iSrc, y=base+i; x<lenSrc && y<lenOut; j++, x++, y++){
-          if( zSrc[x]!=zOut[y] ) break;
-        }
+        n = lenSrc-iSrc;
+        if( n>lenOut-(base+i) ) n = lenOut-(base+i);
+        j = match_forward(&zSrc[iSrc], &zOut[base+i], n);
         j--;
 
         /* Beginning at iSrc-1, match backwards as far as we can.  k counts
         ** the number of characters that match */
-        for(k=1; k<iSrc && k<=i; k++){
-          if( zSrc[iSrc-k]!=zOut[base+i-k] ) break;
-        }
-        k--;
+        n = iSrc-1;
+        if( n>i ) n = i;
+        k = n>0 ? match_backward(&zSrc[iSrc], &zOut[base+i], n) : 0;
 
         /* Compute the offset and size of the matching region */
         ofst = iSrc-k;
@@ -468,7 +557,6 @@ int delta_create(
   /* Output the final checksum record. */
   putInt(checksum(zOut, lenOut), &zDelta);
   *(zDelta++) = ';';
-  free(collide);
   return zDelta - zOrigDelta; 
 }
 
@@ -42,6 +42,27 @@ int blob_delta_create(Blob *pOriginal, Blob *pTarget, Blob *pDelta){
   return 0;
 }
 
+/*
+** Create a delta that carries the source previously indexed into pIdx
+** into pTarget.  The pDelta blob is assumed to be uninitialized.  Use
+** this routine instead of blob_delta_create() when the same original
+** is to be compared against many different targets.
+*/
+int blob_delta_create_indexed(DeltaIndex *pIdx, Blob *pTarget, Blob *pDelta){
+  const char *zTarg;
+  int lenTarg;
+  int len;
+  char *zRes;
+  blob_zero(pDelta);
+  zTarg = blob_buffer(pTarget);
+  lenTarg = blob_size(pTarget);
+  blob_resize(pDelta, lenTarg+16);
+  zRes = blob_buffer(pDelta);
+  len = delta_create_indexed(pIdx, zTarg, lenTarg, zRes);
+  blob_resize(pDelta, len);
+  return 0;
+}
+
 /*
 ** COMMAND:  test-delta-create
 **
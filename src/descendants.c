@@ -62,7 +62,7 @@ void compute_leaves(int iBase, int closeMode){
   if( iBase>0 ){
     Bag seen;     /* Descendants seen */
     Bag pending;  /* Unpropagated descendants */
-    Stmt q1;      /* Query to find children of a check-in */
+    Stmt sameBr;  /* Query to check if two check-ins are on the same branch */
     Stmt isBr;    /* Query to check to see if a check-in starts a new branch */
     Stmt ins;     /* INSERT statement for a new record */
 
@@ -71,19 +71,17 @@ void compute_leaves(int iBase, int closeMode){
     bag_init(&pending);
     bag_insert(&pending, iBase);
 
-    /* This query returns all non-branch-merge children of check-in :rid.
-    **
-    ** If a a child is a merge of a fork within the same branch, it is 
-    ** returned.  Only merge children in different branches are excluded.
+    /* This query returns a single row if check-ins :pid and :cid are
+    ** on the same branch.  It is used to tell whether a merge child
+    ** counts as a descendant.  Only merge children in different
+    ** branches are excluded.
     */
-    db_prepare(&q1,
-      "SELECT cid FROM plink"
-      " WHERE pid=:rid"
-      "   AND (isprim"
-      "        OR coalesce((SELECT value FROM tagxref"
-                        "   WHERE tagid=%d AND rid=plink.pid), 'trunk')"
-                 "=coalesce((SELECT value FROM tagxref"
-                        "   WHERE tagid=%d AND rid=plink.cid), 'trunk'))",
+    db_prepare(&sameBr,
+      "SELECT 1"
+      " WHERE coalesce((SELECT value FROM tagxref"
+                     "   WHERE tagid=%d AND rid=:pid), 'trunk')"
+             "=coalesce((SELECT value FROM tagxref"
+                     "   WHERE tagid=%d AND rid=:cid), 'trunk')",
       TAG_BRANCH, TAG_BRANCH
     );
   
@@ -104,10 +102,20 @@ void compute_leaves(int iBase, int closeMode){
     while( bag_count(&pending) ){
       int rid = bag_first(&pending);
       int cnt = 0;
+      const DagLink *aChild;
+      int nChild, i;
       bag_remove(&pending, rid);
-      db_bind_int(&q1, ":rid", rid);
-      while( db_step(&q1)==SQLITE_ROW ){
-        int cid = db_column_int(&q1, 0);
+      nChild = dag_children(rid, &aChild);
+      for(i=0; i<nChild; i++){
+        int cid = aChild[i].rid;
+        if( !aChild[i].isPrim ){
+          int rc;
+          db_bind_int(&sameBr, ":pid", rid);
+          db_bind_int(&sameBr, ":cid", cid);
+          rc = db_step(&sameBr);
+          db_reset(&sameBr);
+          if( rc!=SQLITE_ROW ) continue;
+        }
         if( bag_insert(&seen, cid) ){
           bag_insert(&pending, cid);
         }
@@ -117,7 +125,6 @@ void compute_leaves(int iBase, int closeMode){
         }
         db_reset(&isBr);
       }
-      db_reset(&q1);
       if( cnt==0 && !is_a_leaf(rid) ){
         cnt++;
       }
@@ -129,7 +136,7 @@ void compute_leaves(int iBase, int closeMode){
     }
     db_finalize(&ins);
     db_finalize(&isBr);
-    db_finalize(&q1);
+    db_finalize(&sameBr);
     bag_clear(&pending);
     bag_clear(&seen);
   }
@@ -163,19 +170,33 @@ void compute_ancestors(int rid, int N){
   PQueue queue;
   Stmt ins;
   Stmt q;
+  int useDag = dag_use(N);
   bag_init(&seen);
   pqueue_init(&queue);
   bag_insert(&seen, rid);
   pqueue_insert(&queue, rid, 0.0, 0);
   db_prepare(&ins, "INSERT OR IGNORE INTO ok VALUES(:rid)");
-  db_prepare(&q,
-    "SELECT a.pid, b.mtime FROM plink a LEFT JOIN plink b ON b.cid=a.pid"
-    " WHERE a.cid=:rid"
-  );
+  if( !useDag ){
+    db_prepare(&q,
+      "SELECT a.pid, b.mtime FROM plink a LEFT JOIN plink b ON b.cid=a.pid"
+      " WHERE a.cid=:rid"
+    );
+  }
   while( (N--)>0 && (rid = pqueue_extract(&queue, 0))!=0 ){
     db_bind_int(&ins, ":rid", rid);
     db_step(&ins);
     db_reset(&ins);
+    if( useDag ){
+      const DagLink *aParent;
+      int i, n = dag_parents(rid, &aParent);
+      for(i=0; i<n; i++){
+        int pid = aParent[i].rid;
+        if( bag_insert(&seen, pid) ){
+          pqueue_insert(&queue, pid, -dag_mtime(pid), 0);
+        }
+      }
+      continue;
+    }
     db_bind_int(&q, ":rid", rid);
     while( db_step(&q)==SQLITE_ROW ){
       int pid = db_column_int(&q, 0);
@@ -189,7 +210,7 @@ void compute_ancestors(int rid, int N){
   bag_clear(&seen);
   pqueue_clear(&queue);
   db_finalize(&ins);
-  db_finalize(&q);
+  if( !useDag ) db_finalize(&q);
 }
 
 /*
@@ -203,21 +224,29 @@ void compute_direct_ancestors(int rid, int N){
   Stmt ins;
   Stmt q;
   int gen = 0;
+  int useDag = dag_use(N);
   db_multi_exec(
     "CREATE TEMP TABLE IF NOT EXISTS ancestor(rid INTEGER, generation INTEGER PRIMARY KEY);"
     "DELETE FROM ancestor;"
     "INSERT INTO ancestor VALUES(%d, 0);", rid
   );
   db_prepare(&ins, "INSERT INTO ancestor VALUES(:rid, :gen)");
-  db_prepare(&q, 
-    "SELECT pid FROM plink"
-    " WHERE cid=:rid AND isprim"
-  );
+  if( !useDag ){
+    db_prepare(&q, 
+      "SELECT pid FROM plink"
+      " WHERE cid=:rid AND isprim"
+    );
+  }
   while( (N--)>0 ){
-    db_bind_int(&q, ":rid", rid);
-    if( db_step(&q)!=SQLITE_ROW ) break;
-    rid = db_column_int(&q, 0);
-    db_reset(&q);
+    if( useDag ){
+      rid = dag_primary_parent(rid);
+      if( rid==0 ) break;
+    }else{
+      db_bind_int(&q, ":rid", rid);
+      if( db_step(&q)!=SQLITE_ROW ) break;
+      rid = db_column_int(&q, 0);
+      db_reset(&q);
+    }
     gen++;
     db_bind_int(&ins, ":rid", rid);
     db_bind_int(&ins, ":gen", gen);
@@ -225,7 +254,7 @@ void compute_direct_ancestors(int rid, int N){
     db_reset(&ins);
   }
   db_finalize(&ins);
-  db_finalize(&q);
+  if( !useDag ) db_finalize(&q);
 }
 
 /*
@@ -237,17 +266,31 @@ void compute_descendants(int rid, int N){
   PQueue queue;
   Stmt ins;
   Stmt q;
+  int useDag = dag_use(N);
 
   bag_init(&seen);
   pqueue_init(&queue);
   bag_insert(&seen, rid);
   pqueue_insert(&queue, rid, 0.0, 0);
   db_prepare(&ins, "INSERT OR IGNORE INTO ok VALUES(:rid)");
-  db_prepare(&q, "SELECT cid, mtime FROM plink WHERE pid=:rid");
+  if( !useDag ){
+    db_prepare(&q, "SELECT cid, mtime FROM plink WHERE pid=:rid");
+  }
   while( (N--)>0 && (rid = pqueue_extract(&queue, 0))!=0 ){
     db_bind_int(&ins, ":rid", rid);
     db_step(&ins);
     db_reset(&ins);
+    if( useDag ){
+      const DagLink *aChild;
+      int i, n = dag_children(rid, &aChild);
+      for(i=0; i<n; i++){
+        int cid = aChild[i].rid;
+        if( bag_insert(&seen, cid) ){
+          pqueue_insert(&queue, cid, dag_mtime(cid), 0);
+        }
+      }
+      continue;
+    }
     db_bind_int(&q, ":rid", rid);
     while( db_step(&q)==SQLITE_ROW ){
       int pid = db_column_int(&q, 0);
@@ -261,7 +304,7 @@ void compute_descendants(int rid, int N){
   bag_clear(&seen);
   pqueue_clear(&queue);
   db_finalize(&ins);
-  db_finalize(&q);
+  if( !useDag ) db_finalize(&q);
 }
 
 /*
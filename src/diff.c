@@ -27,25 +27,26 @@
 /*
 ** Allowed flag parameters to the text_diff() and html_sbsdiff() funtions:
 */
-#define DIFF_CONTEXT_MASK  0x0000ffff  /* Lines of context.  Default if 0 */
-#define DIFF_WIDTH_MASK    0x00ff0000  /* side-by-side column width */
-#define DIFF_IGNORE_EOLWS  0x01000000  /* Ignore end-of-line whitespace */
-#define DIFF_SIDEBYSIDE    0x02000000  /* Generate a side-by-side diff */
-#define DIFF_NEWFILE       0x04000000  /* Missing files are as empty files */
-#define DIFF_BRIEF         0x08000000  /* Show filenames only */
-#define DIFF_INLINE        0x00000000  /* Inline (not side-by-side) diff */
-#define DIFF_HTML          0x10000000  /* Render for HTML */
-#define DIFF_LINENO        0x20000000  /* Show line numbers in context diff */
-#define DIFF_NOOPT         0x40000000  /* Suppress optimizations for debug */
-#define DIFF_INVERT        0x80000000  /* Invert the diff for debug */
-
-#endif /* INTERFACE */
+#define DIFF_CONTEXT_MASK ((u64)0x0000ffff) /* Lines of context. Default if 0 */
+#define DIFF_WIDTH_MASK   ((u64)0x00ff0000) /* side-by-side column width */
+#define DIFF_IGNORE_EOLWS ((u64)0x01000000) /* Ignore end-of-line whitespace */
+#define DIFF_SIDEBYSIDE   ((u64)0x02000000) /* Generate a side-by-side diff */
+#define DIFF_NEWFILE      ((u64)0x04000000) /* Missing files are as empty files */
+#define DIFF_BRIEF        ((u64)0x08000000) /* Show filenames only */
+#define DIFF_INLINE       ((u64)0x00000000) /* Inline (not side-by-side) diff */
+#define DIFF_HTML         ((u64)0x10000000) /* Render for HTML */
+#define DIFF_LINENO       ((u64)0x20000000) /* Show line numbers in context diff */
+#define DIFF_NOOPT        ((u64)0x40000000) /* Suppress optimizations for debug */
+#define DIFF_INVERT       ((u64)0x80000000) /* Invert the diff for debug */
+#define DIFF_PATIENCE     (((u64)0x01)<<32) /* Use the patience algorithm */
+#define DIFF_BUDGET       (((u64)0x02)<<32) /* Coarse diff if too costly */
 
 /*
-** Maximum length of a line in a text file.  (8192)
+** Files whose two versions add up to more than this many bytes have
+** their diff streamed by text_diff_stream() rather than collected in
+** memory, where the caller allows it.
 */
-#define LENGTH_MASK_SZ  13
-#define LENGTH_MASK     ((1<<LENGTH_MASK_SZ)-1)
+#define DIFF_STREAM_SIZE  10000000
 
 /*
 ** Information about each line of a file being diffed.
@@ -66,6 +67,27 @@ struct DLine {
   unsigned int iHash;   /* 1+(first entry in the hash chain) */
 };
 
+#endif /* INTERFACE */
+
+/*
+** Amount of work, measured in lines examined, that text_diff() will do
+** before giving up when DIFF_BUDGET is set.  Differences not yet computed
+** at that point are shown as whole blocks of deleted and inserted lines.
+*/
+#define DIFF_MAX_WORK  100000000
+
+/*
+** sbsAlignment() does not try to pair up similar lines within a change
+** block larger than this many lines on the left times lines on the right.
+*/
+#define DIFF_MAX_ALIGN 100000
+
+/*
+** Maximum length of a line in a text file.  (8192)
+*/
+#define LENGTH_MASK_SZ  13
+#define LENGTH_MASK     ((1<<LENGTH_MASK_SZ)-1)
+
 /*
 ** Length of a dline
 */
@@ -93,8 +115,58 @@ struct DContext {
   int nFrom;         /* Number of lines in aFrom[] */
   DLine *aTo;        /* File on right side of the diff */
   int nTo;           /* Number of lines in aTo[] */
+  int usePatience;   /* Use diff_patience() rather than diff_step() */
+  i64 nWork;         /* Work done so far, in lines examined */
+  i64 mxWork;        /* Give up when nWork exceeds this.  0 for no limit */
+  void (*xOut)(void*,const char*,int);  /* Stream output here, if not NULL */
+  void *pOutArg;     /* First argument to xOut() */
 };
 
+/*
+** When output is streamed, contextDiff() and sbsDiff() hand their output
+** to the xOut() callback whenever this many bytes have accumulated.
+*/
+#define DIFF_STREAM_CHUNK 65536
+
+/*
+** If the diff output of p is being streamed, pass the text accumulated
+** in pOut to the output callback, and empty pOut, once it has grown to
+** at least mn bytes.
+*/
+static void diff_stream(DContext *p, Blob *pOut, int mn){
+  if( p->xOut && blob_size(pOut)>=mn && blob_size(pOut)>0 ){
+    p->xOut(p->pOutArg, blob_buffer(pOut), blob_size(pOut));
+    blob_truncate(pOut, 0);
+  }
+}
+
+/*
+** Return true if the diff in p has used up its work budget.
+*/
+static int diff_over_budget(DContext *p){
+  return p->mxWork>0 && p->nWork>p->mxWork;
+}
+
+/*
+** Hash the n bytes of text at z, eight bytes at a time.
+*/
+static unsigned int dline_hash(const char *z, int n){
+  u64 h = 0;
+  u64 w;
+  while( n>=8 ){
+    memcpy(&w, z, 8);
+    h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+    z += 8;
+    n -= 8;
+  }
+  if( n>0 ){
+    w = 0;
+    memcpy(&w, z, n);
+    h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+  }
+  return (unsigned int)(h ^ (h>>32));
+}
+
 /*
 ** Return an array of DLine objects containing a pointer to the
 ** start of each line and a hash of that line.  The lower 
@@ -106,29 +178,33 @@ struct DContext {
 **
 ** Return 0 if the file is binary or contains a line that is
 ** too long.
+**
+** Newlines are located using memchr(), which the C library implements
+** with vector instructions on most platforms.  A first pass counts
+** the lines so that the array is allocated once, at its final size.
 */
 static DLine *break_into_lines(const char *z, int n, int *pnLine, int ignoreWS){
-  int nLine, i, j, k, x;
+  int nLine, i, j, k;
   unsigned int h, h2;
+  const char *zEnd = &z[n];   /* End of the text */
+  const char *zLine;          /* Start of the current line */
+  const char *zNL;            /* Newline at the end of the current line */
   DLine *a;
 
   /* Count the number of lines.  Allocate space to hold
   ** the returned array.
   */
-  for(i=j=0, nLine=1; i<n; i++, j++){
-    int c = z[i];
-    if( c==0 ){
+  if( memchr(z, 0, n)!=0 ){
+    return 0;
+  }
+  nLine = 1;
+  for(zLine=z; (zNL = memchr(zLine, '\n', zEnd-zLine))!=0; zLine=zNL+1){
+    if( zNL-zLine>LENGTH_MASK ){
       return 0;
     }
-    if( c=='\n' && z[i+1]!=0 ){
-      nLine++;
-      if( j>LENGTH_MASK ){
-        return 0;
-      }
-      j = 0;
-    }
+    if( zNL+1<zEnd ) nLine++;
   }
-  if( j>LENGTH_MASK ){
+  if( zEnd-zLine>LENGTH_MASK ){
     return 0;
   }
   a = fossil_malloc( nLine*sizeof(a[0]) );
@@ -141,13 +217,12 @@ static DLine *break_into_lines(const char *z, int n, int *pnLine, int ignoreWS){
   /* Fill in the array */
   for(i=0; i<nLine; i++){
     a[i].z = z;
-    for(j=0; z[j] && z[j]!='\n'; j++){}
+    zNL = memchr(z, '\n', zEnd-z);
+    j = zNL ? zNL-z : zEnd-z;
     k = j;
     while( ignoreWS && k>0 && fossil_isspace(z[k-1]) ){ k--; }
-    for(h=0, x=0; x<k; x++){
-      h = h ^ (h<<2) ^ z[x];
-    }
-    a[i].h = h = (h<<LENGTH_MASK_SZ) | k;;
+    h = dline_hash(z, k);
+    a[i].h = h = (h<<LENGTH_MASK_SZ) | k;
     h2 = h % nLine;
     a[i].iNext = a[h2].iHash;
     a[h2].iHash = i+1;
@@ -313,6 +388,7 @@ static void contextDiff(
     for(j=0; j<m; j++){
       if( showLn ) appendDiffLineno(pOut, a+j+1, b+j+1, html);
       appendDiffLine(pOut, ' ', &A[a+j], html);
+      diff_stream(p, pOut, DIFF_STREAM_CHUNK);
     }
     a += m;
     b += m;
@@ -323,12 +399,14 @@ static void contextDiff(
       for(j=0; j<m; j++){
         if( showLn ) appendDiffLineno(pOut, a+j+1, 0, html);
         appendDiffLine(pOut, '-', &A[a+j], html);
+        diff_stream(p, pOut, DIFF_STREAM_CHUNK);
       }
       a += m;
       m = R[r+i*3+2];
       for(j=0; j<m; j++){
         if( showLn ) appendDiffLineno(pOut, 0, b+j+1, html);
         appendDiffLine(pOut, '+', &B[b+j], html);
+        diff_stream(p, pOut, DIFF_STREAM_CHUNK);
       }
       b += m;
       if( i<nr-1 ){
@@ -336,6 +414,7 @@ static void contextDiff(
         for(j=0; j<m; j++){
           if( showLn ) appendDiffLineno(pOut, a+j+1, b+j+1, html);
           appendDiffLine(pOut, ' ', &B[b+j], html);
+          diff_stream(p, pOut, DIFF_STREAM_CHUNK);
         }
         b += m;
         a += m;
@@ -350,7 +429,9 @@ static void contextDiff(
       if( showLn ) appendDiffLineno(pOut, a+j+1, b+j+1, html);
       appendDiffLine(pOut, ' ', &B[b+j], html);
     }
+    diff_stream(p, pOut, DIFF_STREAM_CHUNK);
   }
+  diff_stream(p, pOut, 0);
 }
 
 /*
@@ -771,7 +852,8 @@ static int match_dline(DLine *pA, DLine *pB){
 ** adding a cost to each match based on how well the two rows match
 ** each other.  Insertion and deletion costs are 50.  Match costs
 ** are between 0 and 100 where 0 is a perfect match 100 is a complete
-** mismatch.
+** mismatch.  That is O(nLeft*nRight), so blocks larger than
+** DIFF_MAX_ALIGN simply pair off lines in order.
 */
 static unsigned char *sbsAlignment(
    DLine *aLeft, int nLeft,       /* Text on the left */
@@ -783,6 +865,14 @@ static unsigned char *sbsAlignment(
   unsigned char *aM;           /* Wagner result matrix */
   int aBuf[100];               /* Stack space for a[] if nRight not to big */
 
+  if( (i64)nLeft*nRight>DIFF_MAX_ALIGN ){
+    /* Too big to align.  Pair lines off in order. */
+    k = minInt(nLeft, nRight);
+    aM = fossil_malloc( nLeft+nRight+1 );
+    memset(aM, 2, k);
+    memset(&aM[k], nLeft>nRight ? 1 : 3, nLeft+nRight-2*k);
+    return aM;
+  }
   aM = fossil_malloc( (nLeft+1)*(nRight+1) );
   if( nLeft==0 ){
     memset(aM, 3, nRight);
@@ -953,6 +1043,7 @@ static void sbsDiff(
       sbsWriteLineno(&s, b+j);
       sbsWriteText(&s, &B[b+j], SBS_NEWLINE);
       blob_append(pOut, s.zLine, s.n);
+      diff_stream(p, pOut, DIFF_STREAM_CHUNK);
     }
     a += m;
     b += m;
@@ -973,6 +1064,7 @@ static void sbsDiff(
           sbsWriteText(&s, &A[a], SBS_PAD);
           sbsWrite(&s, " <\n", 3);
           blob_append(pOut, s.zLine, s.n);
+          diff_stream(p, pOut, DIFF_STREAM_CHUNK);
           assert( ma>0 );
           ma--;
           a++;
@@ -980,6 +1072,7 @@ static void sbsDiff(
           s.n = 0;
           sbsWriteLineChange(&s, &A[a], a, &B[b], b);
           blob_append(pOut, s.zLine, s.n);
+          diff_stream(p, pOut, DIFF_STREAM_CHUNK);
           assert( ma>0 && mb>0 );
           ma--;
           mb--;
@@ -995,6 +1088,7 @@ static void sbsDiff(
           s.iEnd = s.width;
           sbsWriteText(&s, &B[b], SBS_NEWLINE);
           blob_append(pOut, s.zLine, s.n);
+          diff_stream(p, pOut, DIFF_STREAM_CHUNK);
           assert( mb>0 );
           mb--;
           b++;
@@ -1012,6 +1106,7 @@ static void sbsDiff(
           sbsWriteLineno(&s, b+j);
           sbsWriteText(&s, &B[b+j], SBS_NEWLINE);
           blob_append(pOut, s.zLine, s.n);
+          diff_stream(p, pOut, DIFF_STREAM_CHUNK);
         }
         b += m;
         a += m;
@@ -1031,8 +1126,10 @@ static void sbsDiff(
       sbsWriteLineno(&s, b+j);
       sbsWriteText(&s, &B[b+j], SBS_NEWLINE);
       blob_append(pOut, s.zLine, s.n);
+      diff_stream(p, pOut, DIFF_STREAM_CHUNK);
     }
   }
+  diff_stream(p, pOut, 0);
   free(s.zLine);
 }
 
@@ -1095,6 +1192,9 @@ static void optimalLCS(
 ** as well.  But if the O(N) algorithm doesn't get a good solution
 ** and N is not too large, we fall back to an exact solution by
 ** calling optimalLCS().
+**
+** On repetitive input the search can approach O(N*N), so it stops
+** with the best sequence found so far if the work budget runs out.
 */
 static void longestCommonSequence(
   DContext *p,               /* Two files being compared */
@@ -1145,6 +1245,7 @@ static void longestCommonSequence(
     for(k=0; k<n && same_dline(pA,pB); k++, pA--, pB--){}
     iSX -= k;
     iSY -= k;
+    p->nWork += k;
     iEX = i+1;
     iEY = j;
     pA = &p->aFrom[iEX];
@@ -1153,6 +1254,7 @@ static void longestCommonSequence(
     for(k=0; k<n && same_dline(pA,pB); k++, pA++, pB++){}
     iEX += k;
     iEY += k;
+    p->nWork += k;
     skew = (iSX-iS1) - (iSY-iS2);
     if( skew<0 ) skew = -skew;
     dist = (iSX+iEX)/2 - mid;
@@ -1170,8 +1272,9 @@ static void longestCommonSequence(
       iEXp = iEX;
       iEYp = iEY;
     }
+    if( diff_over_budget(p) ) break;
   }
-  if( iSXb==iEXb && (iE1-iS1)*(iE2-iS2)<400 ){
+  if( iSXb==iEXb && (i64)(iE1-iS1)*(iE2-iS2)<400 ){
     /* If no common sequence is found using the hashing heuristic and
     ** the input is not too big, use the expensive exact solution */
     optimalLCS(p, iS1, iE1, iS2, iE2, piSX, piEX, piSY, piEY);
@@ -1253,6 +1356,12 @@ static void diff_step(DContext *p, int iS1, int iE1, int iS2, int iE2){
     appendTriple(p, 0, iE1-iS1, 0);
     return;
   }
+  p->nWork += (iE1-iS1) + (iE2-iS2);
+  if( diff_over_budget(p) ){
+    /* Out of time.  Show the rest of the segment as one change */
+    appendTriple(p, 0, iE1-iS1, iE2-iS2);
+    return;
+  }
 
   /* Find the longest matching segment between the two sequences */
   longestCommonSequence(p, iS1, iE1, iS2, iE2, &iSX, &iEX, &iSY, &iEY);
@@ -1272,6 +1381,318 @@ static void diff_step(DContext *p, int iS1, int iE1, int iS2, int iE2){
   }
 }
 
+/*
+** Find the "middle snake" of the shortest edit script that converts
+** lines iS1 through iE1-1 of p->aFrom[] into lines iS2 through iE2-1
+** of p->aTo[], using the linear-space algorithm of Eugene Myers, "An
+** O(ND) Difference Algorithm and Its Variations", 1986.  The snake is
+** a run of matching lines: aFrom[*piSX..*piEX-1] equals
+** aTo[*piSY..*piEY-1].  The edits before and after the snake each cost
+** no more than half of the whole.
+**
+** If the edit script needs more than 2*mxCost insertions and deletions
+** the search stops, and an empty snake at the point that the forward
+** search reached furthest is returned instead, the way GNU diff and git
+** do.  That splits the problem without finding the best split.
+**
+** Return 0 if the work budget runs out first, or 1 otherwise.
+*/
+static int diff_middle_snake(
+  DContext *p,               /* Two files being compared */
+  int iS1, int iE1,          /* Range of lines in p->aFrom[] */
+  int iS2, int iE2,          /* Range of lines in p->aTo[] */
+  int mxCost,                /* Stop searching after this many edits */
+  int *piSX, int *piEX,      /* Write p->aFrom[] snake here */
+  int *piSY, int *piEY       /* Write p->aTo[] snake here */
+){
+  DLine *A = &p->aFrom[iS1]; /* Left side */
+  DLine *B = &p->aTo[iS2];   /* Right side */
+  int N = iE1 - iS1;         /* Lines on the left */
+  int M = iE2 - iS2;         /* Lines on the right */
+  int delta = N - M;         /* Diagonal on which the two searches meet */
+  int odd = delta & 1;       /* True if the forward search finds the snake */
+  int mxD;                   /* Largest D examined in each direction */
+  int *aF, *aB;              /* Furthest x on each diagonal, each direction */
+  int bestX = 0, bestY = 0;  /* Furthest point reached by forward search */
+  int d, k, x, y, x0, y0;
+  int rc = -1;
+
+  mxD = (N + M + 1)/2;
+  if( mxD>mxCost ) mxD = mxCost;
+  aF = fossil_malloc( sizeof(aF[0])*2*(2*mxD+3) );
+  aB = &aF[2*mxD+3];
+  aF += mxD+1;
+  aB += mxD+1;
+  aF[1] = 0;
+  aB[1] = 0;
+  for(d=0; d<=mxD && rc<0; d++){
+    p->nWork += 2*d + 2;
+    if( diff_over_budget(p) ){
+      rc = 0;
+      break;
+    }
+
+    /* Forward search along diagonals k = x-y.  Points that fall off the
+    ** edge of the edit graph are kept, but are never used as a result */
+    for(k=-d; k<=d; k+=2){
+      if( k==-d || (k!=d && aF[k-1]<aF[k+1]) ){
+        x = aF[k+1];
+      }else{
+        x = aF[k-1]+1;
+      }
+      y = x - k;
+      x0 = x;
+      y0 = y;
+      while( x<N && y<M && y>=0 && same_dline(&A[x], &B[y]) ){ x++; y++; }
+      p->nWork += x - x0;
+      aF[k] = x;
+      if( x>N || y>M || y0<0 ) continue;
+      if( x+y>bestX+bestY ){
+        bestX = x;
+        bestY = y;
+      }
+      if( odd && k-delta>=1-d && k-delta<=d-1 && x+aB[delta-k]>=N
+       && (x>0 || y>0) && (x0<N || y0<M)
+      ){
+        *piSX = iS1 + x0;
+        *piSY = iS2 + y0;
+        *piEX = iS1 + x;
+        *piEY = iS2 + y;
+        rc = 1;
+        break;
+      }
+    }
+    if( rc>=0 ) break;
+
+    /* Reverse search, from the end of both sides */
+    for(k=-d; k<=d; k+=2){
+      if( k==-d || (k!=d && aB[k-1]<aB[k+1]) ){
+        x = aB[k+1];
+      }else{
+        x = aB[k-1]+1;
+      }
+      y = x - k;
+      x0 = x;
+      y0 = y;
+      while( x<N && y<M && y>=0 && same_dline(&A[N-1-x], &B[M-1-y]) ){
+        x++;
+        y++;
+      }
+      p->nWork += x - x0;
+      aB[k] = x;
+      if( x>N || y>M || y0<0 ) continue;
+      if( !odd && delta-k>=-d && delta-k<=d && x+aF[delta-k]>=N
+       && (x0>0 || y0>0) && (x<N || y<M)
+      ){
+        *piSX = iS1 + N - x;
+        *piSY = iS2 + M - y;
+        *piEX = iS1 + N - x0;
+        *piEY = iS2 + M - y0;
+        rc = 1;
+        break;
+      }
+    }
+  }
+  if( rc<0 ){
+    /* Too costly.  Split where the forward search got furthest */
+    if( bestX+bestY==0 || (bestX==N && bestY==M) ){
+      rc = 0;
+    }else{
+      *piSX = *piEX = iS1 + bestX;
+      *piSY = *piEY = iS2 + bestY;
+      rc = 1;
+    }
+  }
+  fossil_free(&aF[-(mxD+1)]);
+  return rc;
+}
+
+/*
+** Compute the difference between lines iS1 through iE1-1 of p->aFrom[]
+** and lines iS2 through iE2-1 of p->aTo[] using the Myers algorithm.
+** This is the fallback of diff_patience() for segments that have no
+** unique lines in common.
+**
+** Each step of the Myers algorithm costs time proportional to the
+** number of differences.  mxCost bounds that, at the price of a result
+** that is not always minimal.  If the work budget runs out, the rest
+** of the segment is shown as one block of deleted lines followed by
+** one block of inserted lines.
+*/
+static void diff_myers(
+  DContext *p,
+  int iS1, int iE1,
+  int iS2, int iE2,
+  int mxCost
+){
+  int iSX, iEX, iSY, iEY;
+  int nSuffix = 0;
+
+  while( iS1<iE1 && iS2<iE2 && same_dline(&p->aFrom[iS1], &p->aTo[iS2]) ){
+    appendTriple(p, 1, 0, 0);
+    iS1++;
+    iS2++;
+  }
+  while( iS1<iE1 && iS2<iE2
+      && same_dline(&p->aFrom[iE1-1], &p->aTo[iE2-1]) ){
+    nSuffix++;
+    iE1--;
+    iE2--;
+  }
+  if( iE1<=iS1 || iE2<=iS2 ){
+    appendTriple(p, 0, iE1-iS1, iE2-iS2);
+  }else if( diff_middle_snake(p, iS1, iE1, iS2, iE2, mxCost,
+                              &iSX, &iEX, &iSY, &iEY) ){
+    diff_myers(p, iS1, iSX, iS2, iSY, mxCost);
+    if( iEX>iSX ) appendTriple(p, iEX - iSX, 0, 0);
+    diff_myers(p, iEX, iE1, iEY, iE2, mxCost);
+  }else{
+    appendTriple(p, 0, iE1-iS1, iE2-iS2);
+  }
+  if( nSuffix ) appendTriple(p, nSuffix, 0, 0);
+}
+
+/*
+** An entry in the hash table of distinct lines used by diff_patience().
+*/
+typedef struct PatienceLine PatienceLine;
+struct PatienceLine {
+  DLine *pLine;     /* Text of the line.  NULL for an empty slot */
+  int nFrom;        /* Number of copies in the aFrom[] segment */
+  int nTo;          /* Number of copies in the aTo[] segment */
+  int iTo;          /* Index in aTo[] of the last copy */
+};
+
+/*
+** Slot for line X in a PatienceLine hash table of N slots.  N is a power
+** of two.  The low bits of DLine.h are the length of the line, so the
+** rest of the hash is folded in.
+*/
+#define PATIENCE_HASH(X,N) (((X)->h ^ ((X)->h>>LENGTH_MASK_SZ)) & ((N)-1))
+
+/*
+** Compute the difference between lines iS1 through iE1-1 of p->aFrom[]
+** and lines iS2 through iE2-1 of p->aTo[] using the "patience diff"
+** algorithm of Bram Cohen.
+**
+** Lines that occur exactly once in each segment are candidate anchors.
+** The longest sequence of anchors that occur in the same order on both
+** sides is kept as unchanged, and the gaps between anchors are diffed
+** recursively.  A gap with no unique lines in common is handed to
+** diff_myers().  Because anchors must be unique, the result tends to
+** line up on distinctive lines such as function headers, rather than
+** on blank lines and closing braces.
+*/
+static void diff_patience(DContext *p, int iS1, int iE1, int iS2, int iE2){
+  int nSuffix = 0;           /* Common lines at the end of the segment */
+  int nSlot;                 /* Slots in aSlot[].  A power of two */
+  PatienceLine *aSlot;       /* Hash table of distinct lines */
+  int *aIdx;                 /* Slot of each line of aFrom[iS1..iE1-1] */
+  int *aCandX, *aCandY;      /* Candidate anchors in aFrom[] order */
+  int *aTail;                /* Candidate ending the best run of each size */
+  int *aPrev;                /* Previous candidate in the best run */
+  int nCand = 0;             /* Number of candidates */
+  int nRun = 0;              /* Length of the longest run of candidates */
+  int i, j, h, lo, hi;
+
+  while( iS1<iE1 && iS2<iE2 && same_dline(&p->aFrom[iS1], &p->aTo[iS2]) ){
+    appendTriple(p, 1, 0, 0);
+    iS1++;
+    iS2++;
+  }
+  while( iS1<iE1 && iS2<iE2
+      && same_dline(&p->aFrom[iE1-1], &p->aTo[iE2-1]) ){
+    nSuffix++;
+    iE1--;
+    iE2--;
+  }
+  p->nWork += (iE1-iS1) + (iE2-iS2);
+  if( iE1<=iS1 || iE2<=iS2 || diff_over_budget(p) ){
+    appendTriple(p, 0, iE1-iS1, iE2-iS2);
+    if( nSuffix ) appendTriple(p, nSuffix, 0, 0);
+    return;
+  }
+
+  /* Count the copies of each distinct line on both sides */
+  for(nSlot=64; nSlot<2*(iE1-iS1); nSlot*=2){}
+  aSlot = fossil_malloc( sizeof(aSlot[0])*nSlot );
+  memset(aSlot, 0, sizeof(aSlot[0])*nSlot);
+  aIdx = fossil_malloc( sizeof(aIdx[0])*(iE1-iS1) );
+  for(i=iS1; i<iE1; i++){
+    DLine *pA = &p->aFrom[i];
+    for(h=PATIENCE_HASH(pA, nSlot); aSlot[h].pLine; h=(h+1) & (nSlot-1)){
+      if( same_dline(aSlot[h].pLine, pA) ) break;
+    }
+    if( aSlot[h].pLine==0 ) aSlot[h].pLine = pA;
+    aSlot[h].nFrom++;
+    aIdx[i-iS1] = h;
+  }
+  for(j=iS2; j<iE2; j++){
+    DLine *pB = &p->aTo[j];
+    for(h=PATIENCE_HASH(pB, nSlot); aSlot[h].pLine; h=(h+1) & (nSlot-1)){
+      if( same_dline(aSlot[h].pLine, pB) ){
+        aSlot[h].nTo++;
+        aSlot[h].iTo = j;
+        break;
+      }
+    }
+  }
+
+  /* Find the longest run of unique lines that are in the same order
+  ** on both sides, by patience sorting */
+  aCandX = fossil_malloc( sizeof(int)*4*(iE1-iS1) );
+  aCandY = &aCandX[iE1-iS1];
+  aTail = &aCandY[iE1-iS1];
+  aPrev = &aTail[iE1-iS1];
+  for(i=iS1; i<iE1; i++){
+    PatienceLine *pSlot = &aSlot[aIdx[i-iS1]];
+    if( pSlot->nFrom!=1 || pSlot->nTo!=1 ) continue;
+    aCandX[nCand] = i;
+    aCandY[nCand] = pSlot->iTo;
+    lo = 0;
+    hi = nRun;
+    while( lo<hi ){
+      int mid = (lo+hi)/2;
+      if( aCandY[aTail[mid]]<pSlot->iTo ){
+        lo = mid+1;
+      }else{
+        hi = mid;
+      }
+    }
+    aPrev[nCand] = lo>0 ? aTail[lo-1] : -1;
+    aTail[lo] = nCand;
+    if( lo==nRun ) nRun++;
+    nCand++;
+  }
+  fossil_free(aSlot);
+  fossil_free(aIdx);
+
+  if( nRun==0 ){
+    int mxCost;
+    for(mxCost=256; mxCost*mxCost<(iE1-iS1)+(iE2-iS2); mxCost*=2){}
+    diff_myers(p, iS1, iE1, iS2, iE2, mxCost);
+  }else{
+    /* Put the anchors in order in aTail[], then diff the gaps between
+    ** them */
+    j = aTail[nRun-1];
+    for(i=nRun-1; i>=0; i--){
+      aTail[i] = j;
+      j = aPrev[j];
+    }
+    for(i=0; i<nRun; i++){
+      int x = aCandX[aTail[i]];
+      int y = aCandY[aTail[i]];
+      diff_patience(p, iS1, x, iS2, y);
+      appendTriple(p, 1, 0, 0);
+      iS1 = x+1;
+      iS2 = y+1;
+    }
+    diff_patience(p, iS1, iE1, iS2, iE2);
+  }
+  fossil_free(aCandX);
+  if( nSuffix ) appendTriple(p, nSuffix, 0, 0);
+}
+
 /*
 ** Compute the differences between two files already loaded into
 ** the DContext structure.
@@ -1304,7 +1725,11 @@ static void diff_all(DContext *p){
   if( iS>0 ){
     appendTriple(p, iS, 0, 0);
   }
-  diff_step(p, iS, iE1, iS, iE2);
+  if( p->usePatience ){
+    diff_patience(p, iS, iE1, iS, iE2);
+  }else{
+    diff_step(p, iS, iE1, iS, iE2);
+  }
   if( iE1<p->nFrom ){
     appendTriple(p, p->nFrom - iE1, 0, 0);
   }
@@ -1424,7 +1849,7 @@ static void diff_optimize(DContext *p){
 ** Extract the number of lines of context from diffFlags.  Supply an
 ** appropriate default if no context width is specified.
 */
-int diff_context_lines(int diffFlags){
+int diff_context_lines(u64 diffFlags){
   int n = diffFlags & DIFF_CONTEXT_MASK;
   if( n==0 ) n = 5;
   return n;
@@ -1434,31 +1859,52 @@ int diff_context_lines(int diffFlags){
 ** Extract the width of columns for side-by-side diff.  Supply an
 ** appropriate default if no width is given.
 */
-int diff_width(int diffFlags){
+int diff_width(u64 diffFlags){
   int w = (diffFlags & DIFF_WIDTH_MASK)/(DIFF_CONTEXT_MASK+1);
   if( w==0 ) w = 80;
   return w;
 }
 
 /*
-** Generate a report of the differences between files pA and pB.
-** If pOut is not NULL then a unified diff is appended there.  It
-** is assumed that pOut has already been initialized.  If pOut is
-** NULL, then a pointer to an array of integers is returned.  
-** The integers come in triples.  For each triple,
-** the elements are the number of lines copied, the number of
-** lines deleted, and the number of lines inserted.  The vector
-** is terminated by a triple of all zeros.
-**
-** This diff utility does not work on binary files.  If a binary
-** file is encountered, 0 is returned and pOut is written with
-** text "cannot compute difference between binary files".
+** Split the text of pBlob into lines, for use with diff_lines().
+** Return NULL if the text is binary.  The lines point into the
+** buffer of pBlob, which must not be changed while they are in use.
 */
-int *text_diff(
+DLine *diff_break_lines(Blob *pBlob, int *pnLine){
+  return break_into_lines(blob_str(pBlob), blob_size(pBlob), pnLine, 0);
+}
+
+/*
+** Return the array of COPY/DELETE/INSERT triples that transforms the
+** lines aFrom[] into the lines aTo[], as text_diff() does when it is
+** not given an output blob.  Neither array is changed, so the same
+** array can be used in several diffs.
+*/
+int *diff_lines(DLine *aFrom, int nFrom, DLine *aTo, int nTo){
+  DContext c;
+  memset(&c, 0, sizeof(c));
+  c.aFrom = aFrom;
+  c.nFrom = nFrom;
+  c.aTo = aTo;
+  c.nTo = nTo;
+  diff_all(&c);
+  diff_optimize(&c);
+  return c.aEdit;
+}
+
+/*
+** Worker for text_diff() and text_diff_stream().  Compute the
+** differences between pA_Blob and pB_Blob.  If pOut is not NULL the
+** diff text is written there, and if xOut is also not NULL, it is
+** passed on to xOut() in pieces as it is generated.
+*/
+static int *text_diff_ex(
   Blob *pA_Blob,   /* FROM file */
   Blob *pB_Blob,   /* TO file */
   Blob *pOut,      /* Write diff here if not NULL */
-  int diffFlags    /* DIFF_* flags defined above */
+  u64 diffFlags,   /* DIFF_* flags defined above */
+  void (*xOut)(void*,const char*,int),  /* Stream the diff here */
+  void *pOutArg    /* First argument to xOut() */
 ){
   int ignoreEolWs; /* Ignore whitespace at the end of lines */
   int nContext;    /* Amount of context to display */	
@@ -1474,6 +1920,8 @@ int *text_diff(
 
   /* Prepare the input files */
   memset(&c, 0, sizeof(c));
+  c.xOut = xOut;
+  c.pOutArg = pOutArg;
   c.aFrom = break_into_lines(blob_str(pA_Blob), blob_size(pA_Blob),
                              &c.nFrom, ignoreEolWs);
   c.aTo = break_into_lines(blob_str(pB_Blob), blob_size(pB_Blob),
@@ -1483,11 +1931,14 @@ int *text_diff(
     free(c.aTo);
     if( pOut ){
       blob_appendf(pOut, "cannot compute difference between binary files\n");
+      diff_stream(&c, pOut, 0);
     }
     return 0;
   }
 
   /* Compute the difference */
+  c.usePatience = (diffFlags & DIFF_PATIENCE)!=0;
+  if( diffFlags & DIFF_BUDGET ) c.mxWork = DIFF_MAX_WORK;
   diff_all(&c);
   if( (diffFlags & DIFF_NOOPT)==0 ) diff_optimize(&c);
 
@@ -1515,6 +1966,49 @@ int *text_diff(
   }
 }
 
+/*
+** Generate a report of the differences between files pA and pB.
+** If pOut is not NULL then a unified diff is appended there.  It
+** is assumed that pOut has already been initialized.  If pOut is
+** NULL, then a pointer to an array of integers is returned.  
+** The integers come in triples.  For each triple,
+** the elements are the number of lines copied, the number of
+** lines deleted, and the number of lines inserted.  The vector
+** is terminated by a triple of all zeros.
+**
+** This diff utility does not work on binary files.  If a binary
+** file is encountered, 0 is returned and pOut is written with
+** text "cannot compute difference between binary files".
+*/
+int *text_diff(
+  Blob *pA_Blob,   /* FROM file */
+  Blob *pB_Blob,   /* TO file */
+  Blob *pOut,      /* Write diff here if not NULL */
+  u64 diffFlags    /* DIFF_* flags defined above */
+){
+  return text_diff_ex(pA_Blob, pB_Blob, pOut, diffFlags, 0, 0);
+}
+
+/*
+** Like text_diff() with an output blob, except that the text of the
+** diff is passed to xOut() a piece at a time as it is generated,
+** rather than being collected in memory.  No piece is more than a few
+** lines longer than DIFF_STREAM_CHUNK bytes.  xOut() is not called at
+** all if the two files are the same.
+*/
+void text_diff_stream(
+  Blob *pA_Blob,   /* FROM file */
+  Blob *pB_Blob,   /* TO file */
+  u64 diffFlags,   /* DIFF_* flags defined above */
+  void (*xOut)(void*,const char*,int),  /* Send the diff text here */
+  void *pOutArg    /* First argument to xOut() */
+){
+  Blob out;
+  blob_zero(&out);
+  text_diff_ex(pA_Blob, pB_Blob, &out, diffFlags, xOut, pOutArg);
+  blob_reset(&out);
+}
+
 /*
 ** Process diff-related command-line options and return an appropriate
 ** "diffFlags" integer.  
@@ -1525,11 +2019,12 @@ int *text_diff(
 **   --invert               Invert the diff        DIFF_INVERT
 **   --linenum|-n           Show line numbers      DIFF_LINENO
 **   --noopt                Disable optimization   DIFF_NOOPT
+**   --patience             Patience algorithm     DIFF_PATIENCE
 **   --side-by-side|-y      Side-by-side diff.     DIFF_SIDEBYSIDE
 **   --width|-W N           N character lines.     DIFF_WIDTH_MASK
 */
-int diff_options(void){
-  int diffFlags = 0;
+u64 diff_options(void){
+  u64 diffFlags = 0;
   const char *z;
   int f;
   if( find_option("side-by-side","y",0)!=0 ) diffFlags |= DIFF_SIDEBYSIDE;
@@ -1545,6 +2040,7 @@ int diff_options(void){
   if( find_option("html",0,0)!=0 ) diffFlags |= DIFF_HTML;
   if( find_option("linenum","n",0)!=0 ) diffFlags |= DIFF_LINENO;
   if( find_option("noopt",0,0)!=0 ) diffFlags |= DIFF_NOOPT;
+  if( find_option("patience",0,0)!=0 ) diffFlags |= DIFF_PATIENCE;
   if( find_option("invert",0,0)!=0 ) diffFlags |= DIFF_INVERT;
   if( find_option("brief",0,0)!=0 ) diffFlags |= DIFF_BRIEF;
   return diffFlags;
@@ -1558,7 +2054,7 @@ void test_rawdiff_cmd(void){
   int r;
   int i;
   int *R;
-  int diffFlags = diff_options();
+  u64 diffFlags = diff_options();
   if( g.argc<4 ) usage("FILE1 FILE2 ...");
   blob_read_from_file(&a, g.argv[2]);
   for(i=3; i<g.argc; i++){
@@ -1580,7 +2076,7 @@ void test_rawdiff_cmd(void){
 */
 void test_udiff_cmd(void){
   Blob a, b, out;
-  int diffFlag = diff_options();
+  u64 diffFlag = diff_options();
 
   if( g.argc!=4 ) usage("FILE1 FILE2");
   blob_read_from_file(&a, g.argv[2]);
@@ -1598,85 +2094,120 @@ void test_udiff_cmd(void){
 /*
 ** The status of an annotation operation is recorded by an instance
 ** of the following structure.
+**
+** The annotation is computed forward in time.  It starts with the
+** oldest version of the file, every line of which is attributed to
+** that version.  Each step diffs the current version against the next
+** newer one.  Lines copied across keep their attribution and inserted
+** lines are attributed to the newer version.
 */
 typedef struct Annotator Annotator;
 struct Annotator {
   DContext c;       /* The diff-engine context */
-  struct AnnLine {  /* Lines of the original files... */
+  struct AnnLine {  /* Lines of the current version of the file... */
     const char *z;       /* The text of the line */
     short int n;         /* Number of bytes (omitting trailing space and \n) */
-    short int iLevel;    /* Level at which tag was set */
+    int mid;             /* Check-in that contributed the line, or 0 */
     const char *zSrc;    /* Tag showing origin of this line */
   } *aOrig;
   int nOrig;        /* Number of elements in aOrig[] */
-  int nNoSrc;       /* Number of entries where aOrig[].zSrc==NULL */
-  int iLevel;       /* Current level */
+  Blob cur;         /* Text of the current version of the file */
   int nVers;        /* Number of versions analyzed */
   char **azVers;    /* Names of versions analyzed */
 };
 
 /*
-** Initialize the annotation process by specifying the file that is
-** to be annotated.  The annotator takes control of the input Blob and
-** will release it when it is finished with it.
+** Initialize the annotation process by specifying the oldest version
+** of the file to be annotated.  Every line is attributed to zLabel
+** and to check-in mid.  The annotator takes control of the input Blob
+** and will release it when it is finished with it.  Return non-zero
+** if the file is binary, in which case it is treated as empty.
 */
-static int annotation_start(Annotator *p, Blob *pInput){
+static int annotation_start(
+  Annotator *p,         /* The annotator */
+  Blob *pInput,         /* Oldest version of the file */
+  const char *zLabel,   /* Tag for every line of pInput */
+  int mid               /* Check-in for every line of pInput */
+){
   int i;
 
   memset(p, 0, sizeof(*p));
-  p->c.aTo = break_into_lines(blob_str(pInput), blob_size(pInput),&p->c.nTo,1);
+  p->cur = *pInput;
+  p->c.aTo = break_into_lines(blob_str(&p->cur), blob_size(&p->cur),
+                              &p->c.nTo, 1);
   if( p->c.aTo==0 ){
+    p->c.nTo = 0;
     return 1;
   }
-  p->aOrig = fossil_malloc( sizeof(p->aOrig[0])*p->c.nTo );
+  p->aOrig = fossil_malloc( sizeof(p->aOrig[0])*(p->c.nTo+1) );
   for(i=0; i<p->c.nTo; i++){
     p->aOrig[i].z = p->c.aTo[i].z;
     p->aOrig[i].n = p->c.aTo[i].h & LENGTH_MASK;
-    p->aOrig[i].zSrc = 0;
+    p->aOrig[i].mid = mid;
+    p->aOrig[i].zSrc = zLabel;
   }
   p->nOrig = p->c.nTo;
   return 0;
 }
 
 /*
-** The input pParent is the next most recent ancestor of the file
-** being annotated.  Do another step of the annotation.  Return true
-** if additional annotation is required.  zPName is the tag to insert
-** on each line of the file being annotated that was contributed by
-** pParent.  Memory to hold zPName is leaked.
+** The input pChild is the next newer version of the file being
+** annotated.  Do another step of the annotation.  zLabel and mid
+** identify the version that pChild comes from, and are recorded as
+** the source of each line that pChild inserts.  The annotator takes
+** control of pChild.  Memory to hold zLabel is leaked.
+**
+** Return non-zero if pChild is binary.  It is then treated as empty,
+** so that every line of the next version is attributed to that
+** version.
 */
-static int annotation_step(Annotator *p, Blob *pParent, char *zPName){
+static int annotation_step(
+  Annotator *p,         /* The annotator */
+  Blob *pChild,         /* Next newer version of the file */
+  const char *zLabel,   /* Tag for lines inserted by pChild */
+  int mid               /* Check-in for lines inserted by pChild */
+){
   int i, j;
-  int lnTo;
-  int iPrevLevel;
-  int iThisLevel;
-
-  /* Prepare the parent file to be diffed */
-  p->c.aFrom = break_into_lines(blob_str(pParent), blob_size(pParent),
-                                &p->c.nFrom, 1);
-  if( p->c.aFrom==0 ){
-    return 1;
+  int lnFrom, lnTo;
+  struct AnnLine *aNew;
+  int rc = 0;
+
+  /* The current version becomes the "from" side of the diff */
+  p->c.aFrom = p->c.aTo;
+  p->c.nFrom = p->c.nTo;
+  p->c.aTo = break_into_lines(blob_str(pChild), blob_size(pChild),
+                              &p->c.nTo, 1);
+  if( p->c.aTo==0 ){
+    p->c.nTo = 0;
+    rc = 1;
   }
 
-  /* Compute the differences going from pParent to the file being
-  ** annotated. */
+  /* Compute the differences going from the current version to pChild */
+  p->c.nWork = 0;
   diff_all(&p->c);
 
-  /* Where new lines are inserted on this difference, record the
-  ** zPName as the source of the new line.
+  /* Carry the source of each copied line across, and record zLabel
+  ** as the source of each inserted line.
   */
-  iPrevLevel = p->iLevel;
-  p->iLevel++;
-  iThisLevel = p->iLevel;
-  for(i=lnTo=0; i<p->c.nEdit; i+=3){
-    struct AnnLine *x = &p->aOrig[lnTo];
-    for(j=0; j<p->c.aEdit[i]; j++, lnTo++, x++){
-      if( x->zSrc==0 || x->iLevel==iPrevLevel ){
-         x->zSrc = zPName;
-         x->iLevel = iThisLevel;
-      }
+  aNew = fossil_malloc( sizeof(aNew[0])*(p->c.nTo+1) );
+  for(i=lnFrom=lnTo=0; i<p->c.nEdit && lnTo<p->c.nTo; i+=3){
+    for(j=0; j<p->c.aEdit[i] && lnTo<p->c.nTo; j++, lnFrom++, lnTo++){
+      aNew[lnTo].mid = p->aOrig[lnFrom].mid;
+      aNew[lnTo].zSrc = p->aOrig[lnFrom].zSrc;
     }
-    lnTo += p->c.aEdit[i+2];
+    lnFrom += p->c.aEdit[i+1];
+    for(j=0; j<p->c.aEdit[i+2] && lnTo<p->c.nTo; j++, lnTo++){
+      aNew[lnTo].mid = mid;
+      aNew[lnTo].zSrc = zLabel;
+    }
+  }
+  for(; lnTo<p->c.nTo; lnTo++){
+    aNew[lnTo].mid = mid;
+    aNew[lnTo].zSrc = zLabel;
+  }
+  for(i=0; i<p->c.nTo; i++){
+    aNew[i].z = p->c.aTo[i].z;
+    aNew[i].n = p->c.aTo[i].h & LENGTH_MASK;
   }
 
   /* Clear out the diff results */
@@ -1685,46 +2216,302 @@ static int annotation_step(Annotator *p, Blob *pParent, char *zPName){
   p->c.nEdit = 0;
   p->c.nEditAlloc = 0;
 
-  /* Clear out the from file */
-  free(p->c.aFrom);    
-
-  /* Return no errors */
-  return 0;
+  /* Clear out the from file, and make pChild the current version */
+  free(p->c.aFrom);
+  p->c.aFrom = 0;
+  p->c.nFrom = 0;
+  free(p->aOrig);
+  p->aOrig = aNew;
+  p->nOrig = p->c.nTo;
+  blob_reset(&p->cur);
+  p->cur = *pChild;
+  return rc;
 }
 
 
 /*
 ** COMMAND: test-annotate-step
+**
+** Usage: %fossil test-annotate-step RID1 RID2 ...
+**
+** Annotate RID1, where RID2 is its parent, RID3 the parent of RID2,
+** and so forth.
 */
 void test_annotate_step_cmd(void){
-  Blob orig, b;
+  Blob b;
   Annotator x;
   int i;
 
-  if( g.argc<4 ) usage("RID1 RID2 ...");
+  if( g.argc<3 ) usage("RID1 RID2 ...");
   db_must_be_within_tree();
-  blob_zero(&b);
-  content_get(name_to_rid(g.argv[2]), &orig);
-  if( annotation_start(&x, &orig) ){
+  i = g.argc-1;
+  content_get(name_to_rid(g.argv[i]), &b);
+  if( annotation_start(&x, &b, g.argv[i], 0) ){
     fossil_fatal("binary file");
   }
-  for(i=3; i<g.argc; i++){
-    blob_zero(&b);
+  for(i--; i>=2; i--){
     content_get(name_to_rid(g.argv[i]), &b);
-    if( annotation_step(&x, &b, g.argv[i-1]) ){
+    if( annotation_step(&x, &b, g.argv[i], 0) ){
       fossil_fatal("binary file");
     }
   }
   for(i=0; i<x.nOrig; i++){
-    const char *zSrc = x.aOrig[i].zSrc;
-    if( zSrc==0 ) zSrc = g.argv[g.argc-1];
-    fossil_print("%10s: %.*s\n", zSrc, x.aOrig[i].n, x.aOrig[i].z);
+    fossil_print("%10s: %.*s\n", x.aOrig[i].zSrc, x.aOrig[i].n, x.aOrig[i].z);
   }
 }
 
 /* Annotation flags */
 #define ANN_FILE_VERS  0x001  /* Show file version rather than commit version */
 
+/*
+** Complete annotations are kept in the ANNCACHE table of the
+** repository, one row for each file version that has been annotated.
+** A row is keyed by the check-in that introduced the file version
+** (mlink.mid) and the name of the file (mlink.fnid), since these two
+** determine the chain of ancestors that the annotation follows.  The
+** file artifact (mlink.fid) is recorded as well and must match.  The
+** SRC column holds the rid of the check-in that contributed each line
+** of the file, as a compressed list of decimal integers.
+**
+** When a file version is annotated, the ancestors are examined from
+** newest to oldest until one with a cached annotation is found.  Only
+** the versions newer than that ancestor need to be diffed.  A new
+** version of a file that was annotated before thus costs a single
+** diff step.  Annotations with a --limit are neither read from nor
+** saved to the cache, as they do not cover the complete history.
+**
+** The VERS column records the ANNOTATION_CACHE_VERSION of the code
+** that computed an annotation.  Rows of any other version are ignored
+** and eventually replaced, so that a change to the annotation algorithm
+** never shows annotations computed by the old one.  The table holds no
+** more than "annotation-cache-size" rows.  Since a REPLACE always gives
+** the new row the largest rowid, the rows with the smallest rowids are
+** the least recently saved and are removed first.
+**
+** The ANNCACHE table is not part of the repository schema.  It is
+** dropped by "fossil rebuild".  Entries that refer to shunned
+** artifacts are removed by shun_artifacts().  Updates to the cache are
+** made on a best-effort basis, so that a read-only or locked
+** repository can still be annotated.
+*/
+
+/*
+** Increase this whenever a change to annotate_file() or to the diff
+** it uses can attribute a line to a different check-in.
+*/
+#define ANNOTATION_CACHE_VERSION 1
+
+/*
+** Create the ANNCACHE table if it does not already exist, or add the
+** VERS column to a table created before it existed.  Return true if
+** the table is available.
+*/
+static int annotation_cache_init(void){
+  const char *zDb = db_name("repository");
+  char *zSql;
+  if( db_get_int("annotation-cache-size", 10000)<=0 ) return 0;
+  if( db_exists("SELECT 1 FROM %s.sqlite_master WHERE name='anncache'"
+                "   AND sql GLOB '* vers *'", zDb) ){
+    return 1;
+  }
+  if( db_exists("SELECT 1 FROM %s.sqlite_master WHERE name='anncache'",
+                zDb) ){
+    zSql = mprintf("ALTER TABLE %s.anncache ADD COLUMN vers INTEGER;", zDb);
+  }else{
+    zSql = mprintf(
+      "CREATE TABLE IF NOT EXISTS %s.anncache(\n"
+      "  mid INTEGER,       -- Check-in that introduced the file version\n"
+      "  fnid INTEGER,      -- Name of the file\n"
+      "  fid INTEGER,       -- The file version\n"
+      "  src BLOB,          -- Compressed check-in rid for each line\n"
+      "  vers INTEGER,      -- ANNOTATION_CACHE_VERSION that computed src\n"
+      "  PRIMARY KEY(mid,fnid)\n"
+      ");", zDb
+    );
+  }
+  db_multi_exec_ignore_error(zSql, 0);
+  free(zSql);
+  return db_exists("SELECT 1 FROM %s.sqlite_master WHERE name='anncache'"
+                   "   AND sql GLOB '* vers *'", zDb);
+}
+
+/*
+** Save the annotation in p as the cached annotation of file version
+** fid of file fnid as introduced by check-in mid, and remove the least
+** recently saved annotations beyond the "annotation-cache-size" limit.
+*/
+static void annotation_cache_put(Annotator *p, int mid, int fnid, int fid){
+  Blob src;
+  Blob z;
+  char *zSql;
+  int i;
+
+  blob_zero(&src);
+  for(i=0; i<p->nOrig; i++){
+    blob_appendf(&src, "%d\n", p->aOrig[i].mid);
+  }
+  blob_compress(&src, &z);
+  zSql = mprintf(
+    "REPLACE INTO %s.anncache(mid,fnid,fid,src,vers)"
+    " VALUES(%d,%d,%d,:content,%d);"
+    "DELETE FROM %s.anncache"
+    " WHERE rowid<=(SELECT max(rowid) FROM %s.anncache)-%d;",
+    db_name("repository"), mid, fnid, fid, ANNOTATION_CACHE_VERSION,
+    db_name("repository"), db_name("repository"),
+    db_get_int("annotation-cache-size", 10000)
+  );
+  db_multi_exec_ignore_error(zSql, &z);
+  free(zSql);
+  blob_reset(&z);
+  blob_reset(&src);
+}
+
+/*
+** Read the cached annotation of file version fid of file fnid as
+** introduced by check-in mid.  Return an array holding the rid of the
+** check-in that contributed each line, and set *pN to the number of
+** lines.  Return NULL if there is no usable cached annotation.
+*/
+static int *annotation_cache_get(int mid, int fnid, int fid, int *pN){
+  Blob src;
+  Stmt q;
+  int *aMid = 0;
+  int n = 0;
+  const char *z;
+  int i;
+
+  *pN = 0;
+  db_prepare(&q,
+    "SELECT src FROM %s.anncache"
+    " WHERE mid=%d AND fnid=%d AND fid=%d AND vers=%d",
+    db_name("repository"), mid, fnid, fid, ANNOTATION_CACHE_VERSION
+  );
+  blob_zero(&src);
+  if( db_step(&q)==SQLITE_ROW ) db_column_blob(&q, 0, &src);
+  db_finalize(&q);
+  if( blob_size(&src)==0 || blob_uncompress(&src, &src) ){
+    blob_reset(&src);
+    return 0;
+  }
+  z = blob_str(&src);
+  for(i=0; z[i]; i++){
+    if( z[i]=='\n' ) n++;
+  }
+  aMid = fossil_malloc( sizeof(aMid[0])*(n+1) );
+  for(i=0; i<n; i++){
+    aMid[i] = atoi(z);
+    if( aMid[i]<=0 ) break;
+    z = strchr(z, '\n') + 1;
+  }
+  blob_reset(&src);
+  if( i<n ){
+    free(aMid);
+    return 0;
+  }
+  *pN = n;
+  return aMid;
+}
+
+/*
+** Return the label for lines of file fnid that were contributed by
+** check-in mid.  Return NULL if mid is not a check-in that changed
+** fnid.
+*/
+static char *annotation_label(
+  int fnid,            /* The file being annotated */
+  int mid,             /* The check-in to label */
+  int webLabel,        /* Use web-style annotations if true */
+  int annFlags         /* Flags to alter the annotation */
+){
+  Stmt q;
+  char *zLabel = 0;
+
+  db_prepare(&q,
+    "SELECT (SELECT uuid FROM blob WHERE rid=mlink.%s),"
+    "       date(event.mtime), "
+    "       coalesce(event.euser,event.user) "
+    "  FROM mlink, event"
+    " WHERE mlink.mid=%d"
+    "   AND mlink.fnid=%d"
+    "   AND event.objid=mlink.mid",
+    (annFlags & ANN_FILE_VERS)!=0 ? "fid" : "mid",
+    mid, fnid
+  );
+  if( db_step(&q)==SQLITE_ROW ){
+    const char *zUuid = db_column_text(&q, 0);
+    const char *zDate = db_column_text(&q, 1);
+    const char *zUser = db_column_text(&q, 2);
+    if( webLabel ){
+      zLabel = mprintf(
+          "<a href='%s/info/%s' target='infowindow'>%.10s</a> %s %13.13s", 
+          g.zTop, zUuid, zUuid, zDate, zUser
+      );
+    }else{
+      zLabel = mprintf("%.10s %s %13.13s", zUuid, zDate, zUser);
+    }
+  }
+  db_finalize(&q);
+  return zLabel;
+}
+
+/*
+** Start the annotation in p from the cached annotation of file version
+** fid of file fnid as introduced by check-in mid.  Return non-zero if
+** there is no usable cached annotation, in which case p is not
+** initialized.
+*/
+static int annotation_start_cached(
+  Annotator *p,        /* The annotator */
+  int fnid,            /* The file being annotated */
+  int mid,             /* Check-in that introduced the file version */
+  int fid,             /* The file version */
+  const char *zLabel,  /* Label for check-in mid */
+  int webLabel,        /* Use web-style annotations if true */
+  int annFlags         /* Flags to alter the annotation */
+){
+  int *aMid;
+  int n, i, j;
+  Blob content;
+  int nLabel = 0;
+  int *aLabelMid = 0;
+  const char **azLabel = 0;
+
+  aMid = annotation_cache_get(mid, fnid, fid, &n);
+  if( aMid==0 ) return 1;
+  if( !content_get(fid, &content)
+   || annotation_start(p, &content, zLabel, mid)
+   || p->nOrig!=n
+  ){
+    free(aMid);
+    return 1;
+  }
+  for(i=0; i<n; i++){
+    if( aMid[i]==mid ) continue;
+    for(j=0; j<nLabel && aLabelMid[j]!=aMid[i]; j++){}
+    if( j==nLabel ){
+      char *z = annotation_label(fnid, aMid[i], webLabel, annFlags);
+      if( z==0 ) break;
+      nLabel++;
+      aLabelMid = fossil_realloc(aLabelMid, nLabel*sizeof(aLabelMid[0]));
+      azLabel = fossil_realloc((void*)azLabel, nLabel*sizeof(azLabel[0]));
+      aLabelMid[j] = aMid[i];
+      azLabel[j] = z;
+    }
+    p->aOrig[i].mid = aMid[i];
+    p->aOrig[i].zSrc = azLabel[j];
+  }
+  free(aMid);
+  free(aLabelMid);
+  free((void*)azLabel);
+  if( i<n ){
+    free(p->aOrig);
+    free(p->c.aTo);
+    blob_reset(&p->cur);
+    return 1;
+  }
+  return 0;
+}
+
 /*
 ** Compute a complete annotation on a file.  The file is identified
 ** by its filename number (filename.fnid) and the baseline in which
@@ -1738,27 +2525,35 @@ static void annotate_file(
   int iLimit,          /* Limit the number of levels if greater than zero */
   int annFlags         /* Flags to alter the annotation */
 ){
-  Blob toAnnotate;     /* Text of the final (mid) version of the file */
-  Blob step;           /* Text of previous revision */
+  Blob step;           /* Text of a version of the file */
   int rid;             /* Artifact ID of the file being annotated */
-  char *zLabel;        /* Label to apply to a line */
+  int useCache;        /* True to use the ANNCACHE table */
+  int nVers = 0;       /* Number of versions to diff */
+  int *aMid = 0;       /* Check-in of each version, newest first */
+  int *aFid = 0;       /* File artifact of each version */
+  int started = 0;     /* True once the annotation is started */
+  int isComplete = 1;  /* False if the content of some version is missing */
   Stmt q;              /* Query returning all ancestor versions */
+  int i;
 
   /* Initialize the annotation */
+  memset(p, 0, sizeof(*p));
   rid = db_int(0, "SELECT fid FROM mlink WHERE mid=%d AND fnid=%d",mid,fnid);
   if( rid==0 ){
     fossil_panic("file #%d is unchanged in manifest #%d", fnid, mid);
   }
-  if( !content_get(rid, &toAnnotate) ){
+  if( !content_is_available(rid) ){
     fossil_panic("unable to retrieve content of artifact #%d", rid);
   }
   db_multi_exec("CREATE TEMP TABLE ok(rid INTEGER PRIMARY KEY)");
+  useCache = iLimit<=0 && annotation_cache_init();
   if( iLimit<=0 ) iLimit = 1000000000;
   compute_direct_ancestors(mid, iLimit);
-  annotation_start(p, &toAnnotate);
 
+  /* Collect the versions of the file, newest first, stopping at the
+  ** first one whose annotation is cached. */
   db_prepare(&q, 
-    "SELECT mlink.fid,"
+    "SELECT mlink.mid, mlink.fid,"
     "       (SELECT uuid FROM blob WHERE rid=mlink.%s),"
     "       date(event.mtime), "
     "       coalesce(event.euser,event.user) "
@@ -1773,10 +2568,12 @@ static void annotate_file(
     iLimit>0 ? iLimit : 10000000
   );
   while( db_step(&q)==SQLITE_ROW ){
-    int pid = db_column_int(&q, 0);
-    const char *zUuid = db_column_text(&q, 1);
-    const char *zDate = db_column_text(&q, 2);
-    const char *zUser = db_column_text(&q, 3);
+    int vid = db_column_int(&q, 0);
+    int fid = db_column_int(&q, 1);
+    const char *zUuid = db_column_text(&q, 2);
+    const char *zDate = db_column_text(&q, 3);
+    const char *zUser = db_column_text(&q, 4);
+    char *zLabel;
     if( webLabel ){
       zLabel = mprintf(
           "<a href='%s/info/%s' target='infowindow'>%.10s</a> %s %13.13s", 
@@ -1788,11 +2585,50 @@ static void annotate_file(
     p->nVers++;
     p->azVers = fossil_realloc(p->azVers, p->nVers*sizeof(p->azVers[0]) );
     p->azVers[p->nVers-1] = zLabel;
-    content_get(pid, &step);
-    annotation_step(p, &step, zLabel);
-    blob_reset(&step);
+    nVers++;
+    aMid = fossil_realloc(aMid, nVers*sizeof(aMid[0]));
+    aFid = fossil_realloc(aFid, nVers*sizeof(aFid[0]));
+    aMid[nVers-1] = vid;
+    aFid[nVers-1] = fid;
+    if( useCache && fid>0 ){
+      Annotator x;
+      if( annotation_start_cached(&x, fnid, vid, fid, zLabel,
+                                  webLabel, annFlags)==0 ){
+        x.nVers = p->nVers;
+        x.azVers = p->azVers;
+        *p = x;
+        started = 1;
+        break;
+      }
+    }
   }
   db_finalize(&q);
+
+  /* Diff forward in time from the oldest version collected */
+  if( !started ){
+    char **azVers = p->azVers;
+    int n = p->nVers;
+    if( nVers>0 ){
+      if( !content_get(aFid[nVers-1], &step) && aFid[nVers-1]>0 ){
+        isComplete = 0;
+      }
+      annotation_start(p, &step, azVers[nVers-1], aMid[nVers-1]);
+    }else{
+      content_get(rid, &step);
+      annotation_start(p, &step, "", mid);
+    }
+    p->nVers = n;
+    p->azVers = azVers;
+  }
+  for(i=nVers-2; i>=0; i--){
+    if( !content_get(aFid[i], &step) && aFid[i]>0 ) isComplete = 0;
+    annotation_step(p, &step, p->azVers[i], aMid[i]);
+  }
+  if( useCache && isComplete && nVers>1 && aMid[0]==mid ){
+    annotation_cache_put(p, mid, fnid, rid);
+  }
+  free(aMid);
+  free(aFid);
 }
 
 /*
@@ -1896,8 +2732,7 @@ void annotate_cmd(void){
   if (cid == 0){
     fossil_fatal("Not in a checkout");
   }
-  if( iLimit<=0 ) iLimit = 1000000000;
-  compute_direct_ancestors(cid, iLimit);
+  compute_direct_ancestors(cid, iLimit>0 ? iLimit : 1000000000);
   mid = db_int(0, "SELECT mlink.mid FROM mlink, ancestor "
           " WHERE mlink.fid=%d AND mlink.fnid=%d AND mlink.mid=ancestor.rid"
           " ORDER BY ancestor.generation ASC LIMIT 1",
@@ -24,7 +24,7 @@
 /*
 ** Print the "Index:" message that patches wants to see at the top of a diff.
 */
-void diff_print_index(const char *zFile, int diffFlags){
+void diff_print_index(const char *zFile, u64 diffFlags){
   if( (diffFlags & (DIFF_SIDEBYSIDE|DIFF_BRIEF))==0 ){
     char *z = mprintf("Index: %s\n%.66c\n", zFile, '=');
     fossil_print("%s", z);
@@ -35,7 +35,7 @@ void diff_print_index(const char *zFile, int diffFlags){
 /*
 ** Print the +++/--- filename lines for a diff operation.
 */
-void diff_print_filenames(const char *zLeft, const char *zRight, int diffFlags){
+void diff_print_filenames(const char *zLeft, const char *zRight, u64 diffFlags){
   char *z = 0;
   if( diffFlags & DIFF_BRIEF ){
     /* no-op */
@@ -54,6 +54,30 @@ void diff_print_filenames(const char *zLeft, const char *zRight, int diffFlags){
   fossil_free(z);
 }
 
+/*
+** State of diff_print_text(), which prints diff text as text_diff_stream()
+** produces it.  If zName is not NULL, the file names are printed ahead
+** of the first piece of diff text.
+*/
+typedef struct DiffPrint DiffPrint;
+struct DiffPrint {
+  const char *zName;     /* Name of the left file, or NULL */
+  const char *zName2;    /* Name of the right file */
+  u64 diffFlags;         /* Flags passed to diff_print_filenames() */
+  int nPrint;            /* Number of pieces of diff text printed */
+};
+
+/*
+** Output callback for text_diff_stream().  Print one piece of the diff.
+*/
+static void diff_print_text(void *pArg, const char *z, int n){
+  DiffPrint *p = (DiffPrint*)pArg;
+  if( p->nPrint++==0 && p->zName ){
+    diff_print_filenames(p->zName, p->zName2, p->diffFlags);
+  }
+  fossil_print("%.*s", n, z);
+}
+
 /*
 ** Show the difference between two files, one in memory and one on disk.
 **
@@ -68,10 +92,9 @@ void diff_file(
   const char *zFile2,       /* On disk content to compare to */
   const char *zName,        /* Display name of the file */
   const char *zDiffCmd,     /* Command for comparison */
-  int diffFlags             /* Flags to control the diff */
+  u64 diffFlags             /* Flags to control the diff */
 ){
   if( zDiffCmd==0 ){
-    Blob out;                 /* Diff output text */
     Blob file2;               /* Content of zFile2 */
     const char *zName2;       /* Name of zFile2 for display */
 
@@ -94,13 +117,13 @@ void diff_file(
         fossil_print("CHANGED  %s\n", zName);
       }
     }else{
-      blob_zero(&out);
-      text_diff(pFile1, &file2, &out, diffFlags);
-      if( blob_size(&out) ){
-        diff_print_filenames(zName, zName2, diffFlags);
-        fossil_print("%s\n", blob_str(&out));
-      }
-      blob_reset(&out);
+      DiffPrint x;
+      x.zName = zName;
+      x.zName2 = zName2;
+      x.diffFlags = diffFlags;
+      x.nPrint = 0;
+      text_diff_stream(pFile1, &file2, diffFlags, diff_print_text, &x);
+      if( x.nPrint ) fossil_print("\n");
     }
 
     /* Release memory resources */
@@ -150,19 +173,15 @@ void diff_file_mem(
   Blob *pFile2,             /* In memory content to compare to */
   const char *zName,        /* Display name of the file */
   const char *zDiffCmd,     /* Command for comparison */
-  int diffFlags             /* Diff flags */
+  u64 diffFlags             /* Diff flags */
 ){
   if( diffFlags & DIFF_BRIEF ) return;
   if( zDiffCmd==0 ){
-    Blob out;      /* Diff output text */
-
-    blob_zero(&out);
-    text_diff(pFile1, pFile2, &out, diffFlags);
+    DiffPrint x;
+    memset(&x, 0, sizeof(x));
     diff_print_filenames(zName, zName, diffFlags);
-    fossil_print("%s\n", blob_str(&out));
-
-    /* Release memory resources */
-    blob_reset(&out);
+    text_diff_stream(pFile1, pFile2, diffFlags, diff_print_text, &x);
+    fossil_print("\n");
   }else{
     Blob cmd;
     char zTemp1[300];
@@ -198,7 +217,7 @@ void diff_file_mem(
 static void diff_one_against_disk(
   const char *zFrom,        /* Name of file */
   const char *zDiffCmd,     /* Use this "diff" command */
-  int diffFlags,            /* Diff control flags */
+  u64 diffFlags,            /* Diff control flags */
   const char *zFileTreeName
 ){
   Blob fname;
@@ -224,7 +243,7 @@ static void diff_one_against_disk(
 static void diff_all_against_disk(
   const char *zFrom,        /* Version to difference from */
   const char *zDiffCmd,     /* Use this diff command.  NULL for built-in */
-  int diffFlags             /* Flags controlling diff output */
+  u64 diffFlags             /* Flags controlling diff output */
 ){
   int vid;
   Blob sql;
@@ -330,7 +349,7 @@ static void diff_one_two_versions(
   const char *zFrom,
   const char *zTo,
   const char *zDiffCmd,
-  int diffFlags,
+  u64 diffFlags,
   const char *zFileTreeName
 ){
   char *zName;
@@ -355,49 +374,137 @@ static void diff_one_two_versions(
 }
 
 /*
-** Show the difference between two files identified by ManifestFile
-** entries.
+** One step of diff_all_two_versions(): a line to print and, optionally,
+** the difference of one file.  Files are diffed on worker threads and
+** the output is printed in order.
+*/
+typedef struct DiffJob DiffJob;
+struct DiffJob {
+  char *zMsg;            /* Line to print first, or NULL */
+  const char *zName;     /* Name of the file to diff, or NULL for none */
+  u64 diffFlags;         /* Flags for text_diff() */
+  int useWorker;         /* True if a worker thread computes the diff */
+  Blob f1, f2;           /* Content of the two versions of the file */
+  Blob out;              /* The diff, if computed by a worker thread */
+};
+
+/*
+** A batch of DiffJob objects in progress.
+*/
+typedef struct DiffBatch DiffBatch;
+struct DiffBatch {
+  WorkPool *pPool;       /* Workers computing the diffs */
+  const char *zDiffCmd;  /* External diff command, or NULL */
+  DiffJob *aJob;         /* The jobs */
+  int nJob;              /* Number of entries in aJob[] */
+  i64 nContent;          /* Bytes of file content held by aJob[] */
+};
+
+/*
+** diff_all_two_versions() hands this many files to the workers at once,
+** or fewer if their content adds up to DIFF_BATCH_CONTENT bytes.
+*/
+#define DIFF_BATCH_JOBS     100
+#define DIFF_BATCH_CONTENT  50000000
+
+/*
+** Worker-thread half of diff_all_two_versions().  Compute one diff.
+*/
+static void diff_job_task(void *pArg){
+  DiffJob *p = (DiffJob*)pArg;
+  text_diff(&p->f1, &p->f2, &p->out, p->diffFlags);
+}
+
+/*
+** Wait for the diffs in pBatch to finish, then print the batch in order.
+*/
+static void diff_batch_flush(DiffBatch *pBatch){
+  int i;
+  workpool_wait(pBatch->pPool);
+  for(i=0; i<pBatch->nJob; i++){
+    DiffJob *p = &pBatch->aJob[i];
+    if( p->zMsg ){
+      fossil_print("%s", p->zMsg);
+      free(p->zMsg);
+    }
+    if( p->zName==0 ) continue;
+    diff_print_index(p->zName, p->diffFlags);
+    if( p->useWorker ){
+      diff_print_filenames(p->zName, p->zName, p->diffFlags);
+      fossil_print("%s\n", blob_str(&p->out));
+      blob_reset(&p->out);
+    }else{
+      diff_file_mem(&p->f1, &p->f2, p->zName, pBatch->zDiffCmd, p->diffFlags);
+    }
+    blob_reset(&p->f1);
+    blob_reset(&p->f2);
+  }
+  pBatch->nJob = 0;
+  pBatch->nContent = 0;
+}
+
+/*
+** Add a step to pBatch.  zMsg, if not NULL, is printed first.  Then
+** the difference between pFrom and pTo is shown, unless both are NULL.
+** Take ownership of zMsg.
 */
-static void diff_manifest_entry(
+static void diff_batch_add(
+  DiffBatch *pBatch,
+  char *zMsg,
   struct ManifestFile *pFrom,
   struct ManifestFile *pTo,
-  const char *zDiffCmd,
-  int diffFlags
+  u64 diffFlags
 ){
-  Blob f1, f2;
-  int rid;
-  const char *zName =  pFrom ? pFrom->zName : pTo->zName;
-  if( diffFlags & DIFF_BRIEF ) return;
-  diff_print_index(zName, diffFlags);
+  DiffJob *p;
+  if( pBatch->nJob>=DIFF_BATCH_JOBS
+   || pBatch->nContent>=DIFF_BATCH_CONTENT
+  ){
+    diff_batch_flush(pBatch);
+  }
+  p = &pBatch->aJob[pBatch->nJob++];
+  memset(p, 0, sizeof(*p));
+  p->zMsg = zMsg;
+  if( (pFrom==0 && pTo==0) || (diffFlags & DIFF_BRIEF)!=0 ) return;
+  p->zName = pFrom ? pFrom->zName : pTo->zName;
+  p->diffFlags = diffFlags;
   if( pFrom ){
-    rid = uuid_to_rid(pFrom->zUuid, 0);
-    content_get(rid, &f1);
+    content_get(uuid_to_rid(pFrom->zUuid, 0), &p->f1);
   }else{
-    blob_zero(&f1);
+    blob_zero(&p->f1);
   }
   if( pTo ){
-    rid = uuid_to_rid(pTo->zUuid, 0);
-    content_get(rid, &f2);
+    content_get(uuid_to_rid(pTo->zUuid, 0), &p->f2);
   }else{
-    blob_zero(&f2);
+    blob_zero(&p->f2);
+  }
+  pBatch->nContent += blob_size(&p->f1) + blob_size(&p->f2);
+  if( pBatch->zDiffCmd==0
+   && blob_size(&p->f1)+blob_size(&p->f2)<=DIFF_STREAM_SIZE
+  ){
+    p->useWorker = 1;
+    blob_zero(&p->out);
+    workpool_add(pBatch->pPool, diff_job_task, p);
   }
-  diff_file_mem(&f1, &f2, zName, zDiffCmd, diffFlags);
-  blob_reset(&f1);
-  blob_reset(&f2);
 }
 
 /*
 ** Output the differences between two check-ins.
+**
+** The content of the changed files is loaded one batch at a time.
+** When the internal diff is used, the files of each batch are diffed
+** on worker threads, except for very large files, whose diffs are
+** printed as they are computed.  The output is printed in order.
 */
 static void diff_all_two_versions(
   const char *zFrom,
   const char *zTo,
   const char *zDiffCmd,
-  int diffFlags
+  u64 diffFlags
 ){
   Manifest *pFrom, *pTo;
   ManifestFile *pFromFile, *pToFile;
   int asNewFlag = (diffFlags & DIFF_NEWFILE)!=0 ? 1 : 0;
+  DiffBatch batch;
 
   pFrom = manifest_get_by_name(zFrom, 0);
   manifest_file_rewind(pFrom);
@@ -405,6 +512,10 @@ static void diff_all_two_versions(
   pTo = manifest_get_by_name(zTo, 0);
   manifest_file_rewind(pTo);
   pToFile = manifest_file_next(pTo,0);
+  memset(&batch, 0, sizeof(batch));
+  batch.pPool = workpool_new(workpool_size(0));
+  batch.zDiffCmd = zDiffCmd;
+  batch.aJob = fossil_malloc(DIFF_BATCH_JOBS*sizeof(batch.aJob[0]));
 
   while( pFromFile || pToFile ){
     int cmp;
@@ -416,16 +527,12 @@ static void diff_all_two_versions(
       cmp = fossil_strcmp(pFromFile->zName, pToFile->zName);
     }
     if( cmp<0 ){
-      fossil_print("DELETED %s\n", pFromFile->zName);
-      if( asNewFlag ){
-        diff_manifest_entry(pFromFile, 0, zDiffCmd, diffFlags);
-      }
+      diff_batch_add(&batch, mprintf("DELETED %s\n", pFromFile->zName),
+                     asNewFlag ? pFromFile : 0, 0, diffFlags);
       pFromFile = manifest_file_next(pFrom,0);
     }else if( cmp>0 ){
-      fossil_print("ADDED   %s\n", pToFile->zName);
-      if( asNewFlag ){
-        diff_manifest_entry(0, pToFile, zDiffCmd, diffFlags);
-      }
+      diff_batch_add(&batch, mprintf("ADDED   %s\n", pToFile->zName),
+                     0, asNewFlag ? pToFile : 0, diffFlags);
       pToFile = manifest_file_next(pTo,0);
     }else if( fossil_strcmp(pFromFile->zUuid, pToFile->zUuid)==0 ){
       /* No changes */
@@ -433,14 +540,18 @@ static void diff_all_two_versions(
       pToFile = manifest_file_next(pTo,0);
     }else{
       if( diffFlags & DIFF_BRIEF ){
-        fossil_print("CHANGED %s\n", pFromFile->zName);
+        diff_batch_add(&batch, mprintf("CHANGED %s\n", pFromFile->zName),
+                       0, 0, diffFlags);
       }else{
-        diff_manifest_entry(pFromFile, pToFile, zDiffCmd, diffFlags);
+        diff_batch_add(&batch, 0, pFromFile, pToFile, diffFlags);
       }
       pFromFile = manifest_file_next(pFrom,0);
       pToFile = manifest_file_next(pTo,0);
     }
   }
+  diff_batch_flush(&batch);
+  workpool_delete(batch.pPool);
+  free(batch.aJob);
   manifest_destroy(pFrom);
   manifest_destroy(pTo);
 }
@@ -479,6 +590,7 @@ static void diff_all_two_versions(
 **   --from|-r VERSION   select VERSION as source for the diff
 **   -i                  use internal diff logic
 **   --new-file|-N       output complete text of added or deleted files
+**   --patience          use the patience diff algorithm
 **   --to VERSION        select VERSION as target for the diff
 **   --side-by-side|-y   side-by-side diff
 **   --width|-W N        Width of lines in side-by-side diff 
@@ -490,7 +602,7 @@ void diff_cmd(void){
   const char *zFrom;         /* Source version number */
   const char *zTo;           /* Target version number */
   const char *zDiffCmd = 0;  /* External diff command. NULL for internal diff */
-  int diffFlags = 0;         /* Flags to control the DIFF */
+  u64 diffFlags = 0;         /* Flags to control the DIFF */
   int f;
 
   isGDiff = g.argv[1][0]=='g';
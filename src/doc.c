@@ -467,6 +467,23 @@ void doc_page(void){
       goto doc_not_found;
     }
 
+    /* Files that are not rendered are sent straight from the
+    ** repository */
+    zMime = P("mimetype");
+    if( zMime==0 ){
+      zMime = mimetype_from_name(zName);
+    }
+    if( fossil_strcmp(zMime, "application/x-fossil-wiki")!=0
+     && fossil_strcmp(zMime, "text/plain")!=0
+    ){
+      cgi_set_content_type(zMime);
+      if( deliver_artifact(rid)==0 ){
+        goto doc_not_found;
+      }
+      db_end_transaction(0);
+      return;
+    }
+
     /* Get the file content */
     if( content_get(rid, &filebody)==0 ){
       goto doc_not_found;
@@ -504,7 +521,7 @@ void doc_page(void){
     style_footer();
   }else{
     cgi_set_content_type(zMime);
-    cgi_set_content(&filebody);
+    cgi_set_content_ranged(&filebody);
   }
   return;
 
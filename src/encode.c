@@ -20,6 +20,54 @@
 #include "config.h"
 #include "encode.h"
 
+/*
+** The encoders below classify each byte with a single lookup in the
+** following table.  Each ENC_ bit is set for the bytes that need
+** attention from one kind of encoding.  The NUL byte is marked for all
+** of them.  Each encoder finds the exact size of its output first and
+** then fills it in without any further checks for space.
+*/
+#define ENC_HTML    0x01   /* < > & " for htmlize() */
+#define ENC_HTTP    0x02   /* All but [a-zA-Z0-9.$~_-] for httpize() */
+#define ENC_URL     0x04   /* As ENC_HTTP, but "/" is allowed, for urlize() */
+#define ENC_FOSSIL  0x08   /* Whitespace and backslash for fossilize() */
+static const unsigned char aEncode[256] = {
+  15, 6, 6, 6, 6, 6, 6, 6, 6, 14, 14, 14, 14, 14, 6, 6,  /* 00..0f */
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  /* 10..1f */
+  14, 6, 7, 6, 0, 6, 7, 6, 6, 6, 6, 6, 6, 0, 0, 2,  /* 20..2f */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 6, 6, 7, 6, 7, 6,  /* 30..3f */
+  6, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* 40..4f */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 6, 14, 6, 6, 0,  /* 50..5f */
+  6, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* 60..6f */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 6, 6, 6, 0, 6,  /* 70..7f */
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  /* 80..8f */
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  /* 90..9f */
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  /* a0..af */
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  /* b0..bf */
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  /* c0..cf */
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  /* d0..df */
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  /* e0..ef */
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  /* f0..ff */
+};
+
+/*
+** Return the number of bytes at the start of the n bytes of z that do
+** not have any of the mask bits in aEncode[].  Four bytes are checked
+** at a time.  This is for text such as file content where long runs
+** need no encoding, so that the runs can be copied with memcpy().
+*/
+static int encode_clean_run(const char *z, int n, int mask){
+  const unsigned char *u = (const unsigned char*)z;
+  int i = 0;
+  while( i+4<=n
+      && ((aEncode[u[i]]|aEncode[u[i+1]]|aEncode[u[i+2]]|aEncode[u[i+3]])
+           & mask)==0 ){
+    i += 4;
+  }
+  while( i<n && (aEncode[u[i]] & mask)==0 ) i++;
+  return i;
+}
+
 /*
 ** Make the given string safe for HTML by converting every "<" into "&lt;",
 ** every ">" into "&gt;" and every "&" into "&amp;".  Return a pointer
@@ -29,108 +77,101 @@
 ** to markup.
 */
 char *htmlize(const char *zIn, int n){
-  int c;
-  int i = 0;
-  int count = 0;
+  Blob out;
+  blob_zero(&out);
+  htmlize_to_blob(&out, zIn, n);
+  return blob_materialize(&out);
+}
+
+/*
+** Append the first n bytes of zIn, or all of it if n is negative, to
+** pOut, encoded as by htmlize().  Encoding stops at the first NUL.
+** Return the number of bytes appended.
+*/
+int htmlize_to_blob(Blob *pOut, const char *zIn, int n){
+  int i, j;
+  int nExtra = 0;
   char *zOut;
 
   if( n<0 ) n = strlen(zIn);
-  while( i<n && (c = zIn[i])!=0 ){
-    switch( c ){
-      case '<':   count += 4;       break;
-      case '>':   count += 4;       break;
-      case '&':   count += 5;       break;
-      case '"':   count += 6;       break;
-      default:    count++;          break;
+  for(i=0; (i += encode_clean_run(&zIn[i], n-i, ENC_HTML))<n; i++){
+    switch( zIn[i] ){
+      case '<':   nExtra += 3;  break;
+      case '>':   nExtra += 3;  break;
+      case '&':   nExtra += 4;  break;
+      case '"':   nExtra += 5;  break;
+      default:    n = i;        break;   /* A NUL ends the input */
     }
-    i++;
   }
-  i = 0;
-  zOut = fossil_malloc( count+1 );
-  while( n-->0 && (c = *zIn)!=0 ){
-    switch( c ){
-      case '<':   
-        zOut[i++] = '&';
-        zOut[i++] = 'l';
-        zOut[i++] = 't';
-        zOut[i++] = ';';
-        break;
-      case '>':   
-        zOut[i++] = '&';
-        zOut[i++] = 'g';
-        zOut[i++] = 't';
-        zOut[i++] = ';';
-        break;
-      case '&':   
-        zOut[i++] = '&';
-        zOut[i++] = 'a';
-        zOut[i++] = 'm';
-        zOut[i++] = 'p';
-        zOut[i++] = ';';
-        break;
-      case '"':   
-        zOut[i++] = '&';
-        zOut[i++] = 'q';
-        zOut[i++] = 'u';
-        zOut[i++] = 'o';
-        zOut[i++] = 't';
-        zOut[i++] = ';';
-        break;
-      default:
-        zOut[i++] = c;
-        break;
+  zOut = blob_append_space(pOut, n+nExtra);
+  for(i=j=0; i<n; i++){
+    int nRun = encode_clean_run(&zIn[i], n-i, ENC_HTML);
+    memcpy(&zOut[j], &zIn[i], nRun);
+    i += nRun;
+    j += nRun;
+    if( i>=n ) break;
+    switch( zIn[i] ){
+      case '<':   memcpy(&zOut[j], "&lt;", 4);    j += 4;  break;
+      case '>':   memcpy(&zOut[j], "&gt;", 4);    j += 4;  break;
+      case '&':   memcpy(&zOut[j], "&amp;", 5);   j += 5;  break;
+      case '"':   memcpy(&zOut[j], "&quot;", 6);  j += 6;  break;
     }
-    zIn++;
   }
-  zOut[i] = 0;
-  return zOut;
+  return n+nExtra;
 }
 
 
 /*
-** Encode a string for HTTP.  This means converting lots of
-** characters into the "%HH" where H is a hex digit.  It also
-** means converting spaces to "+".
+** Append the first n bytes of zIn, or all of it if n is negative, to
+** pOut, encoded for HTTP.  This means converting lots of characters
+** into the "%HH" where H is a hex digit.  It also means converting
+** spaces to "+".  "/" is converted only if encodeSlash is true.
+** Encoding stops at the first NUL.  Return the number of bytes
+** appended.
 **
 ** This is the opposite of DeHttpizeString below.
 */
-static char *EncodeHttp(const char *zIn, int n, int encodeSlash){
-  int c;
-  int i = 0;
-  int count = 0;
+int httpize_to_blob(Blob *pOut, const char *zIn, int n, int encodeSlash){
+  int mask = encodeSlash ? ENC_HTTP : ENC_URL;
+  int i, j;
+  int nExtra = 0;
   char *zOut;
-  int other;
-# define IsSafeChar(X)  \
-     (fossil_isalnum(X) || (X)=='.' || (X)=='$' \
-      || (X)=='~' || (X)=='-' || (X)=='_' || (X)==other)
 
-  if( zIn==0 ) return 0;
   if( n<0 ) n = strlen(zIn);
-  other = encodeSlash ? 'a' : '/';
-  while( i<n && (c = zIn[i])!=0 ){
-    if( IsSafeChar(c) || c==' ' ){
-      count++;
-    }else{
-      count += 3;
+  for(i=0; i<n; i++){
+    int c = (unsigned char)zIn[i];
+    if( (aEncode[c] & mask)==0 ) continue;
+    if( c==0 ){
+      n = i;
+    }else if( c!=' ' ){
+      nExtra += 2;
     }
-    i++;
   }
-  i = 0;
-  zOut = fossil_malloc( count+1 );
-  while( n-->0 && (c = *zIn)!=0 ){
-    if( IsSafeChar(c) ){
-      zOut[i++] = c;
+  zOut = blob_append_space(pOut, n+nExtra);
+  for(i=j=0; i<n; i++){
+    int c = (unsigned char)zIn[i];
+    if( (aEncode[c] & mask)==0 ){
+      zOut[j++] = c;
     }else if( c==' ' ){
-      zOut[i++] = '+';
+      zOut[j++] = '+';
     }else{
-      zOut[i++] = '%';
-      zOut[i++] = "0123456789ABCDEF"[(c>>4)&0xf];
-      zOut[i++] = "0123456789ABCDEF"[c&0xf];
+      zOut[j++] = '%';
+      zOut[j++] = "0123456789ABCDEF"[(c>>4)&0xf];
+      zOut[j++] = "0123456789ABCDEF"[c&0xf];
     }
-    zIn++;
   }
-  zOut[i] = 0;
-  return zOut;
+  return n+nExtra;
+}
+
+/*
+** Encode a string for HTTP into memory obtained from malloc().
+*/
+static char *EncodeHttp(const char *zIn, int n, int encodeSlash){
+  Blob out;
+  if( zIn==0 ) return 0;
+  blob_zero(&out);
+  httpize_to_blob(&out, zIn, n, encodeSlash);
+  return blob_materialize(&out);
 }
 
 /*
@@ -225,70 +266,70 @@ int dehttpize(char *z){
 ** malloc.
 */
 char *fossilize(const char *zIn, int nIn){
-  int n, i, j, c;
+  int i, j;
+  int nExtra = 0;
+  Blob out;
   char *zOut;
+
   if( nIn<0 ) nIn = strlen(zIn);
-  for(i=n=0; i<nIn; i++){
-    c = zIn[i];
-    if( c==0 || c==' ' || c=='\n' || c=='\t' || c=='\r' || c=='\f' || c=='\v'
-             || c=='\\' ) n++;
+  for(i=0; i<nIn; i++){
+    if( aEncode[(unsigned char)zIn[i]] & ENC_FOSSIL ) nExtra++;
   }
-  n += nIn;
-  zOut = fossil_malloc( n+1 );
-  if( zOut ){
-    for(i=j=0; i<nIn; i++){
-      int c = zIn[i];
-      if( c==0 ){
-        zOut[j++] = '\\';
-        zOut[j++] = '0';
-      }else if( c=='\\' ){
-        zOut[j++] = '\\';
-        zOut[j++] = '\\';
-      }else if( fossil_isspace(c) ){
-        zOut[j++] = '\\';
-        switch( c ){
-          case '\n':  c = 'n'; break;
-          case ' ':   c = 's'; break;
-          case '\t':  c = 't'; break;
-          case '\r':  c = 'r'; break;
-          case '\v':  c = 'v'; break;
-          case '\f':  c = 'f'; break;
-        }
-        zOut[j++] = c;
-      }else{
-        zOut[j++] = c;
-      }
+  blob_zero(&out);
+  zOut = blob_append_space(&out, nIn+nExtra);
+  for(i=j=0; i<nIn; i++){
+    int c = (unsigned char)zIn[i];
+    if( (aEncode[c] & ENC_FOSSIL)==0 ){
+      zOut[j++] = c;
+      continue;
     }
-    zOut[j] = 0;
+    switch( c ){
+      case 0:     c = '0';   break;
+      case '\n':  c = 'n';   break;
+      case ' ':   c = 's';   break;
+      case '\t':  c = 't';   break;
+      case '\r':  c = 'r';   break;
+      case '\v':  c = 'v';   break;
+      case '\f':  c = 'f';   break;
+      default:    c = '\\';  break;
+    }
+    zOut[j++] = '\\';
+    zOut[j++] = c;
   }
-  return zOut;
+  return blob_materialize(&out);
 }
 
 /*
-** Decode a fossilized string in-place.
+** Decode a fossilized string in-place.  The text between escapes is
+** moved down in bulk.
 */
 void defossilize(char *z){
-  int i, j, c;
-  for(i=0; (c=z[i])!=0 && c!='\\'; i++){}
-  if( c==0 ) return;
-  for(j=i; (c=z[i])!=0; i++){
-    if( c=='\\' && z[i+1] ){
-      i++;
-      switch( z[i] ){
-        case 'n':  c = '\n';  break;
-        case 's':  c = ' ';   break;
-        case 't':  c = '\t';  break;
-        case 'r':  c = '\r';  break;
-        case 'v':  c = '\v';  break;
-        case 'f':  c = '\f';  break;
-        case '0':  c = 0;     break;
-        case '\\': c = '\\';  break;
-        default:   c = z[i];  break;
-      }
+  char *zIn, *zOut, *zEsc;
+  int c;
+  zIn = zOut = strchr(z, '\\');
+  if( zIn==0 ) return;
+  while( (zEsc = strchr(zIn, '\\'))!=0 ){
+    if( zEsc>zIn ){
+      if( zOut<zIn ) memmove(zOut, zIn, zEsc-zIn);
+      zOut += zEsc-zIn;
+    }
+    c = zEsc[1];
+    zIn = zEsc+2;
+    switch( c ){
+      case 'n':  c = '\n';  break;
+      case 's':  c = ' ';   break;
+      case 't':  c = '\t';  break;
+      case 'r':  c = '\r';  break;
+      case 'v':  c = '\v';  break;
+      case 'f':  c = '\f';  break;
+      case '0':  c = 0;     break;
+      case '\\': c = '\\';  break;
+      case 0:    c = '\\'; zIn--;  break;
     }
-    z[j++] = c;
+    *(zOut++) = c;
   }
-  if( z[j] ) z[j] = 0;
+  c = strlen(zIn);
+  memmove(zOut, zIn, c+1);
 }
 
 
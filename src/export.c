@@ -83,6 +83,172 @@ static void print_person(const char *zUser){
 #define BLOBMARK(rid)   ((rid) * 2)
 #define COMMITMARK(rid) ((rid) * 2 + 1)
 
+/*
+** Write a "blob" record for artifact rid with content pContent.
+*/
+static void export_blob(int rid, Blob *pContent){
+  printf("blob\nmark :%d\ndata %d\n", BLOBMARK(rid), blob_size(pContent));
+  fwrite(blob_buffer(pContent), 1, blob_size(pContent), stdout);
+  printf("\n");
+}
+
+/*
+** Walk the delta tree below artifact rid, whose full text is pBase,
+** writing a "blob" record for each artifact of the tree that is marked
+** as new in the EXPTREE table.  Only artifacts in EXPTREE are visited.
+** pBase is cleared before returning.
+**
+** Each delta is applied to the already expanded text of its source, so
+** every artifact in the tree is expanded only once.  This routine
+** recurses in the same way as rebuild_step().
+*/
+static void export_blob_tree(int rid, int isNew, Blob *pBase){
+  static Stmt q1, q2;
+  Bag children;
+  int nChild, i, cid;
+
+  while( rid>0 ){
+    if( isNew ) export_blob(rid, pBase);
+
+    db_static_prepare(&q1, "SELECT rid FROM exptree WHERE srcid=:rid");
+    db_bind_int(&q1, ":rid", rid);
+    bag_init(&children);
+    while( db_step(&q1)==SQLITE_ROW ){
+      bag_insert(&children, db_column_int(&q1, 0));
+    }
+    db_reset(&q1);
+    nChild = bag_count(&children);
+
+    rid = 0;
+    for(cid=bag_first(&children), i=1; cid; cid=bag_next(&children, cid), i++){
+      Blob delta, next;
+      int cidIsNew;
+      db_static_prepare(&q2,
+        "SELECT blob.content, exptree.isNew FROM blob, exptree"
+        " WHERE blob.rid=:rid AND exptree.rid=:rid"
+      );
+      db_bind_int(&q2, ":rid", cid);
+      if( db_step(&q2)!=SQLITE_ROW ){
+        db_reset(&q2);
+        continue;
+      }
+      blob_zero(&delta);
+      db_column_blob(&q2, 0, &delta);
+      cidIsNew = db_column_int(&q2, 1);
+      db_reset(&q2);
+      blob_uncompress(&delta, &delta);
+      blob_delta_apply(pBase, &delta, &next);
+      blob_reset(&delta);
+      if( i<nChild ){
+        export_blob_tree(cid, cidIsNew, &next);
+      }else{
+        /* Tail recursion */
+        rid = cid;
+        isNew = cidIsNew;
+        blob_reset(pBase);
+        *pBase = next;
+      }
+    }
+    bag_clear(&children);
+  }
+  blob_reset(pBase);
+}
+
+/*
+** Write a "blob" record for every artifact in the NEWBLOB table and
+** add each to the pDone bag.
+**
+** Expanding each artifact with content_get() in turn would expand a
+** long delta chain once for every artifact on it.  Instead, the
+** artifacts are gathered into the EXPTREE table together with all of
+** the delta sources needed to reach them, and each delta tree is
+** walked from its root by export_blob_tree().  An artifact that is
+** stored as full text and is not the source of any delta needed here
+** is copied to the output without being held in memory.
+*/
+static void export_blobs(Bag *pDone){
+  Stmt q;
+  Bag inTree;
+  int *aSrc = 0;
+  int nSrc = 0;
+  int nAlloc = 0;
+  int i;
+
+  db_multi_exec(
+    "CREATE TEMPORARY TABLE exptree("
+    "  rid INTEGER PRIMARY KEY,"     /* An artifact to be expanded */
+    "  srcid INTEGER,"               /* Its delta source, or 0 */
+    "  isNew BOOLEAN"                /* True if it is in NEWBLOB */
+    ");"
+    "INSERT INTO exptree"
+    " SELECT rid, coalesce((SELECT srcid FROM delta"
+    "                        WHERE delta.rid=newblob.rid),0), 1"
+    "   FROM newblob;"
+    "CREATE INDEX exptree_src ON exptree(srcid);"
+  );
+
+  /* Add the delta sources of the new artifacts, recursively */
+  bag_init(&inTree);
+  db_prepare(&q, "SELECT rid, srcid FROM exptree");
+  while( db_step(&q)==SQLITE_ROW ){
+    bag_insert(&inTree, db_column_int(&q, 0));
+    if( nSrc>=nAlloc ){
+      nAlloc = nAlloc*2 + 100;
+      aSrc = fossil_realloc(aSrc, nAlloc*sizeof(aSrc[0]));
+    }
+    aSrc[nSrc++] = db_column_int(&q, 1);
+  }
+  db_finalize(&q);
+  db_prepare(&q,
+    "INSERT INTO exptree"
+    " VALUES(:rid, coalesce((SELECT srcid FROM delta WHERE rid=:rid),0), 0)"
+  );
+  for(i=0; i<nSrc; i++){
+    int rid = aSrc[i];
+    while( rid>0 && !bag_find(&inTree, rid) ){
+      bag_insert(&inTree, rid);
+      db_bind_int(&q, ":rid", rid);
+      db_step(&q);
+      db_reset(&q);
+      rid = db_int(0, "SELECT srcid FROM exptree WHERE rid=%d", rid);
+    }
+  }
+  db_finalize(&q);
+  fossil_free(aSrc);
+  bag_clear(&inTree);
+
+  /* Walk each tree from its root */
+  db_prepare(&q,
+    "SELECT rid, isNew,"
+    "       EXISTS(SELECT 1 FROM exptree AS x WHERE x.srcid=exptree.rid)"
+    "  FROM exptree WHERE srcid=0"
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    int rid = db_column_int(&q, 0);
+    int isNew = db_column_int(&q, 1);
+    int hasChild = db_column_int(&q, 2);
+    int sz;
+    Blob content;
+    if( !hasChild && isNew && (sz = content_stream_size(rid))>=0 ){
+      printf("blob\nmark :%d\ndata %d\n", BLOBMARK(rid), sz);
+      if( content_stream(rid, stdout)!=sz ){
+        fossil_fatal("cannot extract artifact %d", rid);
+      }
+      printf("\n");
+    }else{
+      content_get(rid, &content);
+      export_blob_tree(rid, isNew, &content);
+    }
+  }
+  db_finalize(&q);
+
+  db_prepare(&q, "SELECT rid FROM newblob");
+  while( db_step(&q)==SQLITE_ROW ){
+    bag_insert(pDone, db_column_int(&q, 0));
+  }
+  db_finalize(&q);
+}
+
 /*
 ** COMMAND: export
 **
@@ -105,6 +271,9 @@ static void print_person(const char *zUser){
 **
 ** If the "--export-marks FILE" option is used, the rid of all commits and
 ** blobs written on exit for use with "--import-marks" on the next run.
+** Used together, these options make an incremental export: only the
+** check-ins not listed in the imported marks, and the file content they
+** introduce, are written.
 **
 ** Options:
 **   --export-marks FILE          export rids of exported data to FILE
@@ -142,6 +311,7 @@ void export_cmd(void){
     if( f==0 ){
       fossil_panic("cannot open %s for reading", markfile_in);
     }
+    db_begin_transaction();
     db_prepare(&qb, "INSERT OR IGNORE INTO oldblob VALUES (:rid)");
     db_prepare(&qc, "INSERT OR IGNORE INTO oldcommit VALUES (:rid)");
     while( fgets(line, sizeof(line), f)!=0 ){
@@ -161,56 +331,27 @@ void export_cmd(void){
     }
     db_finalize(&qb);
     db_finalize(&qc);
+    db_end_transaction(0);
     fclose(f);
   }
 
   /* Step 1:  Generate "blob" records for every artifact that is part
-  ** of a check-in 
+  ** of a check-in that has not been exported before.
   */
   fossil_binary_mode(stdout);
-  db_multi_exec("CREATE TEMPORARY TABLE newblob(rid INTEGER KEY, srcid INTEGER)");
-  db_multi_exec("CREATE INDEX newblob_src ON newblob(srcid)");
   db_multi_exec(
-    "INSERT INTO newblob"
-    " SELECT DISTINCT fid,"
-    "  CASE WHEN EXISTS(SELECT 1 FROM delta WHERE rid=fid AND NOT EXISTS(SELECT 1 FROM oldblob WHERE srcid=fid))"
-    "   THEN (SELECT srcid FROM delta WHERE rid=fid)"
-    "   ELSE 0"
-    "  END"
-    " FROM mlink"
-    " WHERE fid>0 AND NOT EXISTS(SELECT 1 FROM oldblob WHERE rid=fid)");
-  db_prepare(&q,
-    "SELECT DISTINCT fid FROM mlink"
-    " WHERE fid>0 AND NOT EXISTS(SELECT 1 FROM oldblob WHERE rid=fid)");
-  db_prepare(&q2, "INSERT INTO oldblob VALUES (:rid)");
-  db_prepare(&q3, "SELECT rid FROM newblob WHERE srcid= (:srcid)");
-  while( db_step(&q)==SQLITE_ROW ){
-    int rid = db_column_int(&q, 0);
-    Blob content;
-
-    while( !bag_find(&blobs, rid) ){
-      content_get(rid, &content);
-      db_bind_int(&q2, ":rid", rid);
-      db_step(&q2);
-      db_reset(&q2);
-      printf("blob\nmark :%d\ndata %d\n", BLOBMARK(rid), blob_size(&content));
-      bag_insert(&blobs, rid);
-      fwrite(blob_buffer(&content), 1, blob_size(&content), stdout);
-      printf("\n");
-      blob_reset(&content);
-
-      db_bind_int(&q3, ":srcid", rid);
-      if( db_step(&q3) != SQLITE_ROW ){
-        db_reset(&q3);
-        break;
-      }
-      rid = db_column_int(&q3, 0);
-      db_reset(&q3);
-    }
-  }
-  db_finalize(&q);
-  db_finalize(&q2);
-  db_finalize(&q3);
+    "CREATE TEMPORARY TABLE newcommit(rid INTEGER PRIMARY KEY);"
+    "INSERT INTO newcommit"
+    " SELECT objid FROM event"
+    "  WHERE type='ci' AND NOT EXISTS(SELECT 1 FROM oldcommit WHERE rid=objid);"
+    "CREATE TEMPORARY TABLE newblob(rid INTEGER PRIMARY KEY);"
+    "INSERT OR IGNORE INTO newblob"
+    " SELECT fid FROM mlink"
+    "  WHERE mid IN (SELECT rid FROM newcommit) AND fid>0"
+    "    AND NOT EXISTS(SELECT 1 FROM oldblob WHERE rid=fid);"
+  );
+  export_blobs(&blobs);
+  db_multi_exec("INSERT OR IGNORE INTO oldblob SELECT rid FROM newblob");
 
   /* Output the commit records.
   */
@@ -219,7 +360,7 @@ void export_cmd(void){
     "       coalesce(user,euser),"
     "       (SELECT value FROM tagxref WHERE rid=objid AND tagid=%d)"
     "  FROM event"
-    " WHERE type='ci' AND NOT EXISTS (SELECT 1 FROM oldcommit WHERE objid=rid)"
+    " WHERE objid IN (SELECT rid FROM newcommit)"
     " ORDER BY mtime ASC",
     TAG_BRANCH
   );
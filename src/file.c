@@ -28,6 +28,15 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#if defined(__linux__)
+# include <sys/ioctl.h>
+# include <sys/sendfile.h>
+# include <linux/fs.h>
+# include <fcntl.h>
+#endif
+#if defined(__APPLE__)
+# include <sys/clonefile.h>
+#endif
 #include "file.h"
 
 /*
@@ -136,6 +145,44 @@ int file_wd_isfile_or_link(const char *zFilename){
                                      S_ISLNK(fileStat.st_mode);
 }
 
+#if INTERFACE
+/*
+** The state of a file in the working directory, as filled in by
+** file_wd_status().
+*/
+struct FileWdStatus {
+  i64 size;              /* Size in bytes.  -1 if the file does not exist */
+  i64 mtime;             /* Modification time.  -1 if it does not exist */
+  int isFileOrLink;      /* Same as file_wd_isfile_or_link() */
+  int isLink;            /* Same as file_wd_islink() */
+  int isDir;             /* True if file_wd_isdir() would return 1 */
+};
+#endif
+
+/*
+** Fill in *p with what file_wd_size(), file_wd_mtime(),
+** file_wd_isfile_or_link(), file_wd_islink() and file_wd_isdir() would
+** return for zFilename, using a single stat() call.  The fileStat
+** variable is not used, so this routine is safe to call from a worker
+** thread.
+*/
+void file_wd_status(const char *zFilename, FileWdStatus *p){
+  struct stat buf;
+  if( fossil_stat(zFilename, &buf, 1)!=0 ){
+    p->size = -1;
+    p->mtime = -1;
+    p->isFileOrLink = 0;
+    p->isLink = 0;
+    p->isDir = 0;
+  }else{
+    p->size = buf.st_size;
+    p->mtime = buf.st_mtime;
+    p->isFileOrLink = S_ISREG(buf.st_mode) || S_ISLNK(buf.st_mode);
+    p->isLink = g.allowSymlinks && S_ISLNK(buf.st_mode);
+    p->isDir = S_ISDIR(buf.st_mode);
+  }
+}
+
 /*
 ** Return TRUE if the named file is an ordinary file.  Return false
 ** for directories, devices, fifos, symlinks, etc.
@@ -357,28 +404,208 @@ void file_copy(const char *zFrom, const char *zTo){
 /*
 ** Set or clear the execute bit on a file.  Return true if a change
 ** occurred and false if this routine is a no-op.
+**
+** A file that shares its storage with other hard links, as made from
+** the checkout cache, is first made into a private copy, so that the
+** cached file keeps its permissions.
 */
 int file_wd_setexe(const char *zFilename, int onoff){
   int rc = 0;
 #if !defined(_WIN32)
   struct stat buf;
+  int newMode;
   if( fossil_stat(zFilename, &buf, 1)!=0 || S_ISLNK(buf.st_mode) ) return 0;
   if( onoff ){
-    int targetMode = (buf.st_mode & 0444)>>2;
-    if( (buf.st_mode & 0111)!=targetMode ){
-      chmod(zFilename, buf.st_mode | targetMode);
-      rc = 1;
-    }
+    newMode = buf.st_mode | ((buf.st_mode & 0444)>>2);
   }else{
-    if( (buf.st_mode & 0111)!=0 ){
-      chmod(zFilename, buf.st_mode & ~0111);
-      rc = 1;
+    newMode = buf.st_mode & ~0111;
+  }
+  if( newMode!=buf.st_mode ){
+    if( buf.st_nlink>1 ){
+      file_unshare(zFilename);
+      if( fossil_stat(zFilename, &buf, 1)!=0 ) return 0;
+      newMode = onoff ? buf.st_mode | ((buf.st_mode & 0444)>>2)
+                      : buf.st_mode & ~0111;
     }
+    chmod(zFilename, newMode);
+    rc = 1;
   }
 #endif /* _WIN32 */
   return rc;
 }
 
+/*
+** If zFilename has more than one hard link, as made from the checkout
+** cache, replace it with a private writable copy.  Fossil writes files
+** in the checkout through this routine so that a write never changes
+** the cached file or the other checkouts that link to it.  Return the
+** number of errors.
+**
+** This routine does not use fileStat, so worker threads may call it.
+*/
+int file_unshare(const char *zFilename){
+#if !defined(_WIN32)
+  struct stat buf;
+  FILE *in;
+  char *z;
+  int rc = 0;
+  if( lstat(zFilename, &buf)!=0 || !S_ISREG(buf.st_mode)
+   || buf.st_nlink<2 ){
+    return 0;
+  }
+  in = fossil_fopen(zFilename, "rb");
+  if( in==0 ) return 1;
+  z = fossil_malloc(buf.st_size+1);
+  if( fread(z, 1, buf.st_size, in)!=buf.st_size ) rc = 1;
+  fclose(in);
+  if( rc==0 && unlink(zFilename)==0 ){
+    FILE *out = fossil_fopen(zFilename, "wb");
+    if( out==0 || fwrite(z, 1, buf.st_size, out)!=buf.st_size ) rc = 1;
+    if( out ) fclose(out);
+    if( rc==0 ) chmod(zFilename, (buf.st_mode & 0777) | 0200);
+  }
+  free(z);
+  return rc;
+#else
+  return 0;
+#endif
+}
+
+/*
+** Return true if file zFilename holds exactly the content of pContent.
+*/
+static int file_has_content(const char *zFilename, Blob *pContent){
+  FILE *in = fossil_fopen(zFilename, "rb");
+  char zBuf[8192];
+  const char *z = blob_buffer(pContent);
+  int n = blob_size(pContent);
+  int got, isSame = 1;
+  if( in==0 ) return 0;
+  while( isSame && (got = fread(zBuf, 1, sizeof(zBuf), in))>0 ){
+    isSame = got<=n && memcmp(zBuf, z, got)==0;
+    z += got;
+    n -= got;
+  }
+  fclose(in);
+  return isSame && n==0;
+}
+
+/*
+** Make sure the checkout cache holds pContent in the file zCacheFile.
+** The cached file is read-only, since it may be shared through hard
+** links.  A file already in the cache is kept only if its content is
+** correct, so that a damaged entry is never handed out again.  Return
+** the number of errors.
+**
+** This routine does not use fileStat, so worker threads may call it.
+*/
+int file_cache_put(const char *zCacheFile, Blob *pContent){
+#if !defined(_WIN32)
+  struct stat buf;
+  char *zTmp;
+  FILE *out;
+  int i, rc = 0;
+  if( stat(zCacheFile, &buf)==0 && buf.st_size==blob_size(pContent)
+   && file_has_content(zCacheFile, pContent)
+  ){
+    if( (buf.st_mode & 0222)!=0 ) chmod(zCacheFile, 0444);
+    return 0;
+  }
+  zTmp = mprintf("%s-%d-%p", zCacheFile, (int)getpid(), (void*)pContent);
+  for(i=1; zTmp[i]; i++){
+    if( zTmp[i]=='/' ){
+      zTmp[i] = 0;
+      mkdir(zTmp, 0755);
+      zTmp[i] = '/';
+    }
+  }
+  out = fossil_fopen(zTmp, "wb");
+  if( out==0 ){
+    free(zTmp);
+    return 1;
+  }
+  if( fwrite(blob_buffer(pContent), 1, blob_size(pContent), out)
+        !=blob_size(pContent) ){
+    rc = 1;
+  }
+  fclose(out);
+  if( rc==0 ) chmod(zTmp, 0444);
+  if( rc || rename(zTmp, zCacheFile)!=0 ){
+    unlink(zTmp);
+    rc = 1;
+  }
+  free(zTmp);
+  return rc;
+#else
+  return 1;
+#endif
+}
+
+/*
+** Replace file zFilename with a file that shares the storage of
+** zCacheFile from the checkout cache.  If useLink is true, zFilename
+** becomes a hard link.  Otherwise it becomes a copy-on-write clone,
+** where the operating system and filesystem support that.  Return 0 on
+** success, or non-zero if the file must be written in the usual way.
+**
+** This routine does not use fileStat, so worker threads may call it.
+*/
+int file_clone(const char *zCacheFile, const char *zFilename, int useLink){
+#if !defined(_WIN32)
+  unlink(zFilename);
+  if( useLink ){
+    return link(zCacheFile, zFilename)!=0;
+  }
+#if defined(__APPLE__)
+  if( clonefile(zCacheFile, zFilename, 0)!=0 ) return 1;
+  chmod(zFilename, 0644);
+  return 0;
+#elif defined(FICLONE)
+  {
+    int rc = 1;
+    int fdIn = open(zCacheFile, O_RDONLY);
+    if( fdIn>=0 ){
+      int fdOut = open(zFilename, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+      if( fdOut>=0 ){
+        rc = ioctl(fdOut, FICLONE, fdIn)!=0;
+        close(fdOut);
+        if( rc ) unlink(zFilename);
+      }
+      close(fdIn);
+    }
+    return rc;
+  }
+#endif
+#endif /* _WIN32 */
+  return 1;
+}
+
+/*
+** Copy the rest of the open file in onto the channel out and return
+** the number of bytes copied.  Where sendfile() is available the
+** kernel moves the data directly, without it passing through this
+** process.
+*/
+i64 file_send(FILE *in, FILE *out){
+  i64 nSent = 0;
+  char zBuf[65536];
+  size_t n;
+#if defined(__linux__)
+  ssize_t got;
+  fflush(out);
+  while( (got = sendfile(fileno(out), fileno(in), 0, 1<<30))>0 ){
+    nSent += got;
+  }
+  if( got==0 ) return nSent;
+  /* sendfile() does not work for this channel.  Copy the rest below. */
+#endif
+  while( (n = fread(zBuf, 1, sizeof(zBuf), in))>0 ){
+    if( fwrite(zBuf, 1, n, out)!=n ) break;
+    nSent += n;
+  }
+  return nSent;
+}
+
 /*
 ** Delete a file.
 */
@@ -388,6 +615,17 @@ void file_delete(const char *zFilename){
   fossil_mbcs_free(z);
 }
 
+/*
+** Delete the directory zName if it is empty.  Return zero on success.
+*/
+int file_rmdir(const char *zName){
+  int rc;
+  char *z = fossil_utf8_to_mbcs(zName);
+  rc = rmdir(z);
+  fossil_mbcs_free(z);
+  return rc;
+}
+
 /*
 ** Create the directory named in the argument, if it does not already
 ** exist.  If forceFlag is 1, delete any prior non-directory object 
@@ -20,6 +20,106 @@
 #include "config.h"
 #include "finfo.h"
 
+/*
+** The FILEHIST table holds the check-in time of every MLINK entry,
+** indexed by filename, so that the history of a single file can be
+** read newest first with a range scan rather than by sorting every
+** change to the file.  Renames are followed through MLINK.PFNID as
+** before.  The table is created and brought up to date with MLINK by
+** filehist_sync(), and filehist_update_mtime() keeps it in step when
+** the time of a check-in changes.
+*/
+static const char zFilehistSchema[] =
+@ CREATE TABLE IF NOT EXISTS %s.filehist(
+@   id INTEGER PRIMARY KEY,        -- ROWID of the MLINK entry
+@   fnid INTEGER,                  -- MLINK.FNID
+@   mtime DATETIME                 -- EVENT.MTIME of the check-in MLINK.MID
+@ );
+@ CREATE INDEX IF NOT EXISTS %s.filehist_i1 ON filehist(fnid, mtime);
+;
+
+/*
+** Return true if the FILEHIST table exists.
+*/
+static int filehist_exists(void){
+  return db_exists("SELECT 1 FROM %s.sqlite_master WHERE name='filehist'",
+                   db_name("repository"));
+}
+
+/*
+** Create the FILEHIST table if it does not exist and add to it every
+** MLINK entry that it is missing.  Return true if the table is then
+** complete.  This might fail for a read-only repository, in which case
+** the caller must read MLINK directly.
+*/
+static int filehist_sync(void){
+  const char *zDb = db_name("repository");
+  int mxRowid = db_int(0, "SELECT max(rowid) FROM mlink");
+  int mxId;
+  if( !filehist_exists() ){
+    char *zSql = mprintf(zFilehistSchema, zDb, zDb);
+    db_multi_exec_ignore_error(zSql, 0);
+    fossil_free(zSql);
+    if( !filehist_exists() ) return 0;
+  }
+  mxId = db_int(0, "SELECT max(id) FROM filehist");
+  if( mxId<mxRowid ){
+    char *zSql = mprintf(
+      "INSERT INTO filehist(id,fnid,mtime)"
+      " SELECT mlink.rowid, mlink.fnid, event.mtime"
+      "   FROM mlink LEFT JOIN event ON event.objid=mlink.mid"
+      "  WHERE mlink.rowid>%d", mxId
+    );
+    db_begin_transaction();
+    db_multi_exec_ignore_error(zSql, 0);
+    db_end_transaction(0);
+    fossil_free(zSql);
+    mxId = db_int(0, "SELECT max(id) FROM filehist");
+  }
+  return mxId>=mxRowid;
+}
+
+/*
+** The check-in times of the check-ins in the one-column table or
+** subquery zMids have changed.  Update their FILEHIST entries, if
+** that table exists.
+*/
+void filehist_update_mtime(const char *zMids){
+  if( !filehist_exists() ) return;
+  db_multi_exec(
+    "UPDATE filehist"
+    "   SET mtime=(SELECT event.mtime FROM mlink, event"
+    "               WHERE mlink.rowid=filehist.id"
+    "                 AND event.objid=mlink.mid)"
+    " WHERE id IN (SELECT rowid FROM mlink WHERE mid IN (%s))",
+    zMids
+  );
+}
+
+/*
+** Return an SQL expression, in memory obtained from fossil_malloc(),
+** that is true if column zCol holds the fnid of file zFilename under
+** the filename collation.  When there is just one such fnid, the
+** expression is an equality so that an index on zCol can also give
+** the order of the rows.
+*/
+static char *finfo_fnid_sql(const char *zCol, const char *zFilename){
+  char *zList = db_text(0,
+    "SELECT group_concat(fnid) FROM filename WHERE name=%Q %s",
+    zFilename, filename_collation()
+  );
+  char *zSql;
+  if( zList==0 ){
+    zSql = mprintf("%s=0", zCol);
+  }else if( strchr(zList, ',')==0 ){
+    zSql = mprintf("%s=%s", zCol, zList);
+  }else{
+    zSql = mprintf("%s IN (%s)", zCol, zList);
+  }
+  fossil_free(zList);
+  return zSql;
+}
+
 /*
 ** COMMAND: finfo
 ** 
@@ -157,19 +257,35 @@ void finfo_cmd(void){
       fossil_fatal("no history for file: %b", &fname);
     }
     zFilename = blob_str(&fname);
-    db_prepare(&q,
-        "SELECT b.uuid, ci.uuid, date(event.mtime,'localtime'),"
-        "       coalesce(event.ecomment, event.comment),"
-        "       coalesce(event.euser, event.user)"
-        "  FROM mlink, blob b, event, blob ci, filename"
-        " WHERE filename.name=%Q %s"
-        "   AND mlink.fnid=filename.fnid"
-        "   AND b.rid=mlink.fid"
-        "   AND event.objid=mlink.mid"
-        "   AND event.objid=ci.rid"
-        " ORDER BY event.mtime DESC LIMIT %d OFFSET %d",
-        zFilename, filename_collation(), iLimit, iOffset
-    );
+    if( filehist_sync() ){
+      db_prepare(&q,
+          "SELECT b.uuid, ci.uuid, date(event.mtime,'localtime'),"
+          "       coalesce(event.ecomment, event.comment),"
+          "       coalesce(event.euser, event.user)"
+          "  FROM filehist, mlink, blob b, event, blob ci"
+          " WHERE %z"
+          "   AND mlink.rowid=filehist.id"
+          "   AND b.rid=mlink.fid"
+          "   AND event.objid=mlink.mid"
+          "   AND event.objid=ci.rid"
+          " ORDER BY filehist.mtime DESC LIMIT %d OFFSET %d",
+          finfo_fnid_sql("filehist.fnid", zFilename), iLimit, iOffset
+      );
+    }else{
+      db_prepare(&q,
+          "SELECT b.uuid, ci.uuid, date(event.mtime,'localtime'),"
+          "       coalesce(event.ecomment, event.comment),"
+          "       coalesce(event.euser, event.user)"
+          "  FROM mlink, blob b, event, blob ci, filename"
+          " WHERE filename.name=%Q %s"
+          "   AND mlink.fnid=filename.fnid"
+          "   AND b.rid=mlink.fid"
+          "   AND event.objid=mlink.mid"
+          "   AND event.objid=ci.rid"
+          " ORDER BY event.mtime DESC LIMIT %d OFFSET %d",
+          zFilename, filename_collation(), iLimit, iOffset
+      );
+    }
     blob_zero(&line);
     if( iBrief ){
       fossil_print("History of %s\n", blob_str(&fname));
@@ -222,6 +338,7 @@ void finfo_page(void){
   char zPrevDate[20];
   const char *zA;
   const char *zB;
+  const char *zTime;
   int n;
   Blob title;
   Blob sql;
@@ -249,20 +366,34 @@ void finfo_page(void){
     " (SELECT uuid FROM blob WHERE rid=mlink.mid),"  /* Check-in uuid */
     " event.bgcolor,"                                /* Background color */
     " (SELECT value FROM tagxref WHERE tagid=%d AND tagtype>0"
-                                " AND tagxref.rid=mlink.mid)" /* Tags */
-    "  FROM mlink, event"
-    " WHERE mlink.fnid IN (SELECT fnid FROM filename WHERE name=%Q %s)"
-    "   AND event.objid=mlink.mid",
-    TAG_BRANCH,
-    zFilename, filename_collation()
+                                " AND tagxref.rid=mlink.mid)", /* Tags */
+    TAG_BRANCH
   );
+  if( filehist_sync() ){
+    zTime = "filehist.mtime";
+    blob_appendf(&sql,
+      "  FROM filehist, mlink, event"
+      " WHERE %z"
+      "   AND mlink.rowid=filehist.id"
+      "   AND event.objid=mlink.mid",
+      finfo_fnid_sql("filehist.fnid", zFilename)
+    );
+  }else{
+    zTime = "event.mtime";
+    blob_appendf(&sql,
+      "  FROM mlink, event"
+      " WHERE mlink.fnid IN (SELECT fnid FROM filename WHERE name=%Q %s)"
+      "   AND event.objid=mlink.mid",
+      zFilename, filename_collation()
+    );
+  }
   if( (zA = P("a"))!=0 ){
-    blob_appendf(&sql, " AND event.mtime>=julianday('%q')", zA);
+    blob_appendf(&sql, " AND %s>=julianday('%q')", zTime, zA);
   }
   if( (zB = P("b"))!=0 ){
-    blob_appendf(&sql, " AND event.mtime<=julianday('%q')", zB);
+    blob_appendf(&sql, " AND %s<=julianday('%q')", zTime, zB);
   }
-  blob_appendf(&sql," ORDER BY event.mtime DESC /*sort*/");
+  blob_appendf(&sql," ORDER BY %s DESC /*sort*/", zTime);
   if( (n = atoi(PD("n","0")))>0 ){
     blob_appendf(&sql, " LIMIT %d", n);
   }
@@ -66,9 +66,12 @@ struct GraphContext {
   GraphRow *pLast;           /* Last row in the list */
   int nBranch;               /* Number of distinct branches */
   char **azBranch;           /* Names of the branches */
+  int nBranchHash;           /* Number of slots in aiBranchHash[] */
+  int *aiBranchHash;         /* Hash of azBranch[].  Value: 1 + index */
   int nRow;                  /* Number of rows */
   int nHash;                 /* Number of slots in apHash[] */
   GraphRow **apHash;         /* Hash table of GraphRow objects.  Key: rid */
+  GraphRow **apRow;          /* apRow[i] is the row with idx==i */
 };
 
 #endif
@@ -103,7 +106,9 @@ static void graph_clear(GraphContext *p){
   }
   for(i=0; i<p->nBranch; i++) free(p->azBranch[i]);
   free(p->azBranch);
+  free(p->aiBranchHash);
   free(p->apHash);
+  free(p->apRow);
   memset(p, 0, sizeof(*p));
   p->nErr = 1;
 }
@@ -145,6 +150,15 @@ static GraphRow *hashFind(GraphContext *p, int rid){
   return p->apHash[h];
 }
 
+/*
+** Hash a branch name for the aiBranchHash[] table.
+*/
+static unsigned int branchHash(const char *z){
+  unsigned int h = 0;
+  while( *z ){ h = (h<<3) ^ h ^ (unsigned char)*(z++); }
+  return h;
+}
+
 /*
 ** Return the canonical pointer for a given branch name.
 ** Multiple calls to this routine with equivalent strings
@@ -157,13 +171,31 @@ static GraphRow *hashFind(GraphContext *p, int rid){
 ** Note: also used for background color names.
 */
 static char *persistBranchName(GraphContext *p, const char *zBranch){
-  int i;
-  for(i=0; i<p->nBranch; i++){
-    if( fossil_strcmp(zBranch, p->azBranch[i])==0 ) return p->azBranch[i];
+  unsigned int h = branchHash(zBranch);
+  int i, k;
+  if( p->nBranchHash ){
+    for(k=h%p->nBranchHash; (i = p->aiBranchHash[k])!=0;
+        k=(k+1)%p->nBranchHash){
+      if( fossil_strcmp(zBranch, p->azBranch[i-1])==0 ){
+        return p->azBranch[i-1];
+      }
+    }
+  }
+  if( (p->nBranch+1)*2>p->nBranchHash ){
+    int n = p->nBranchHash*2 + 64;
+    free(p->aiBranchHash);
+    p->aiBranchHash = safeMalloc( sizeof(p->aiBranchHash[0])*n );
+    p->nBranchHash = n;
+    for(i=0; i<p->nBranch; i++){
+      for(k=branchHash(p->azBranch[i])%n; p->aiBranchHash[k]; k=(k+1)%n){}
+      p->aiBranchHash[k] = i+1;
+    }
   }
   p->nBranch++;
   p->azBranch = fossil_realloc(p->azBranch, sizeof(char*)*p->nBranch);
   p->azBranch[p->nBranch-1] = mprintf("%s", zBranch);
+  for(k=h%p->nBranchHash; p->aiBranchHash[k]; k=(k+1)%p->nBranchHash){}
+  p->aiBranchHash[k] = p->nBranch;
   return p->azBranch[p->nBranch-1];
 }
 
@@ -220,7 +252,8 @@ static int findFreeRail(
   int i;
   int iBest = 0;
   int iBestDist = 9999;
-  for(pRow=p->pFirst; pRow && pRow->idx<top; pRow=pRow->pNext){}
+  if( top<1 ) top = 1;
+  pRow = top<=p->nRow ? p->apRow[top] : 0;
   while( pRow && pRow->idx<=btm ){
     inUseMask |= pRow->railInUse;
     pRow = pRow->pNext;
@@ -341,8 +374,10 @@ void graph_finish(GraphContext *p, int omitDescenders){
   /* Initialize all rows */
   p->nHash = p->nRow*2 + 1;
   p->apHash = safeMalloc( sizeof(p->apHash[0])*p->nHash );
+  p->apRow = safeMalloc( sizeof(p->apRow[0])*(p->nRow+1) );
   for(pRow=p->pFirst; pRow; pRow=pRow->pNext){
     if( pRow->pNext ) pRow->pNext->pPrev = pRow;
+    p->apRow[pRow->idx] = pRow;
     pRow->iRail = -1;
     pRow->mergeOut = -1;
     if( (pDup = hashFind(p, pRow->rid))!=0 ){
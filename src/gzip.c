@@ -26,13 +26,54 @@
 #include "config.h"
 #include "gzip.h"
 
+/*
+** The deflate stream of a GZIP file is built from blocks of
+** GZIP_BLOCK_SIZE bytes of input, in the manner of "pigz".  Each block
+** is compressed separately, using the GZIP_DICT_SIZE bytes of input
+** that precede it as a preset dictionary, and all but the last block
+** end with a sync flush so that the compressed blocks can simply be
+** concatenated.  This lets the blocks be compressed by a pool of worker
+** threads.  The output depends only on the input and the compression
+** level, never on the number of threads.
+**
+** At the default level of 9 the input is instead compressed as a single
+** deflate stream by the calling thread, exactly as older versions of
+** fossil did, so that the tarball of a check-in stays byte-for-byte the
+** same from one version of fossil to the next.  Only the lower levels,
+** which produce different archives anyway, are compressed in parallel.
+*/
+#define GZIP_BLOCK_SIZE 131072
+#define GZIP_DICT_SIZE   32768
+
+/*
+** One block of input and its compressed form.
+*/
+typedef struct GzipBlock GzipBlock;
+struct GzipBlock {
+  const unsigned char *zIn;   /* Input to be compressed */
+  int nIn;                    /* Bytes of input */
+  const unsigned char *zDict; /* Preset dictionary */
+  int nDict;                  /* Bytes of dictionary */
+  int isLast;                 /* True for the final block of the file */
+  int level;                  /* zlib compression level */
+  unsigned long iCRC;         /* CRC of the input */
+  Blob out;                   /* Compressed output */
+};
+
 /*
 ** State information for the GZIP file under construction.
 */
 struct gzip_state {
-  int eState;           /* 0: idle   1: header  2: compressing */
-  int iCRC;             /* The checksum */
-  z_stream stream;      /* The working compressor */
+  int eState;           /* 0: idle   1: compressing */
+  int level;            /* zlib compression level */
+  int isSerial;         /* Use stream rather than blocks */
+  z_stream stream;      /* The single deflate stream, if isSerial */
+  unsigned long iCRC;   /* The checksum */
+  i64 nTotal;           /* Total bytes of input */
+  WorkPool *pPool;      /* Workers that compress blocks */
+  int nBatch;           /* Number of blocks to compress at once */
+  Blob in;              /* Input.  The first nDict bytes are dictionary */
+  int nDict;            /* Bytes of dictionary at the start of in */
   Blob out;             /* Results stored here */
 } gzip;
 
@@ -47,12 +88,14 @@ static void put32(char *z, int v){
 }
 
 /*
-** Begin constructing a gzip file.
+** Begin constructing a gzip file, compressed at the given zlib level.
 */
-void gzip_begin(sqlite3_int64 now){
+void gzip_begin(sqlite3_int64 now, int level){
   char aHdr[10];
+  int nThread;
   assert( gzip.eState==0 );
   blob_zero(&gzip.out);
+  blob_zero(&gzip.in);
   aHdr[0] = 0x1f;
   aHdr[1] = 0x8b;
   aHdr[2] = 8;
@@ -61,43 +104,152 @@ void gzip_begin(sqlite3_int64 now){
     now = db_int64(0, "SELECT (julianday('now') - 2440587.5)*86400.0");
   }
   put32(&aHdr[4], now&0xffffffff);
-  aHdr[8] = 2;
+  aHdr[8] = level==9 ? 2 : level==1 ? 4 : 0;
   aHdr[9] = 255;
   blob_append(&gzip.out, aHdr, 10);
-  gzip.iCRC = 0;
+  gzip.level = level;
+  gzip.iCRC = crc32(0, 0, 0);
+  gzip.nTotal = 0;
+  gzip.nDict = 0;
+  gzip.isSerial = level==9;
+  if( gzip.isSerial ){
+    memset(&gzip.stream, 0, sizeof(gzip.stream));
+    deflateInit2(&gzip.stream, level, Z_DEFLATED, -MAX_WBITS, 8,
+                 Z_DEFAULT_STRATEGY);
+    gzip.pPool = 0;
+    gzip.nBatch = 1;
+  }else{
+    gzip.pPool = workpool_new(workpool_size(0));
+    nThread = workpool_nthread(gzip.pPool);
+    gzip.nBatch = nThread>0 ? 2*nThread : 1;
+  }
   gzip.eState = 1;
 }
 
 /*
-** Add nIn bytes of content from pIn to the gzip file.
+** Pass nIn bytes of input to the single deflate stream and append the
+** output it produces to gzip.out.  flush is Z_NO_FLUSH, or Z_FINISH to
+** end the stream.
 */
-#define GZIP_BUFSZ 100000
-void gzip_step(const char *pIn, int nIn){
-  char *zOutBuf;
-  int nOut;
-  
-  nOut = nIn + nIn/10 + 100;
-  if( nOut<100000 ) nOut = 100000;
-  zOutBuf = fossil_malloc(nOut);
+static void gzip_deflate_serial(const char *pIn, int nIn, int flush){
+  unsigned char aOut[16384];
+  gzip.iCRC = crc32(gzip.iCRC, (const unsigned char*)pIn, nIn);
+  gzip.nTotal += nIn;
   gzip.stream.avail_in = nIn;
   gzip.stream.next_in = (unsigned char*)pIn;
-  gzip.stream.avail_out = nOut;
-  gzip.stream.next_out = (unsigned char*)zOutBuf;
-  if( gzip.eState==1 ){
-    gzip.stream.zalloc = (alloc_func)0;
-    gzip.stream.zfree = (free_func)0;
-    gzip.stream.opaque = 0;
-    deflateInit2(&gzip.stream, 9, Z_DEFLATED, -MAX_WBITS,8,Z_DEFAULT_STRATEGY);
-    gzip.eState = 2;
-  }
-  gzip.iCRC = crc32(gzip.iCRC, gzip.stream.next_in, gzip.stream.avail_in);
   do{
-    deflate(&gzip.stream, nIn==0 ? Z_FINISH : 0);
-    blob_append(&gzip.out, zOutBuf, nOut - gzip.stream.avail_out);
-    gzip.stream.avail_out = nOut;
-    gzip.stream.next_out = (unsigned char*)zOutBuf;
-  }while( gzip.stream.avail_in>0 );
-  fossil_free(zOutBuf);
+    gzip.stream.avail_out = sizeof(aOut);
+    gzip.stream.next_out = aOut;
+    deflate(&gzip.stream, flush);
+    blob_append(&gzip.out, (char*)aOut, sizeof(aOut)-gzip.stream.avail_out);
+  }while( gzip.stream.avail_out==0 );
+}
+
+/*
+** Worker-thread routine that compresses a single block.
+*/
+static void gzip_block_task(void *pArg){
+  GzipBlock *p = (GzipBlock*)pArg;
+  z_stream stream;
+  int nOut;
+  p->iCRC = crc32(crc32(0, 0, 0), p->zIn, p->nIn);
+  memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, p->level, Z_DEFLATED, -MAX_WBITS, 8,
+               Z_DEFAULT_STRATEGY);
+  if( p->nDict>0 ){
+    deflateSetDictionary(&stream, p->zDict, p->nDict);
+  }
+  nOut = deflateBound(&stream, p->nIn) + 64;
+  blob_zero(&p->out);
+  blob_resize(&p->out, nOut);
+  stream.avail_in = p->nIn;
+  stream.next_in = (unsigned char*)p->zIn;
+  stream.avail_out = nOut;
+  stream.next_out = (unsigned char*)blob_buffer(&p->out);
+  while( 1 ){
+    deflate(&stream, p->isLast ? Z_FINISH : Z_SYNC_FLUSH);
+    if( stream.avail_out>0 ) break;
+    blob_resize(&p->out, nOut*2);
+    stream.avail_out = nOut;
+    stream.next_out = (unsigned char*)&blob_buffer(&p->out)[nOut];
+    nOut *= 2;
+  }
+  blob_resize(&p->out, stream.total_out);
+  deflateEnd(&stream);
+}
+
+/*
+** Compress the input that has accumulated in gzip.in.  Only whole
+** blocks are compressed unless isFinal is true, in which case all of
+** the remaining input is compressed and the deflate stream is ended.
+*/
+static void gzip_compress_pending(int isFinal){
+  const unsigned char *zBase = (const unsigned char*)blob_buffer(&gzip.in);
+  int nAvail = blob_size(&gzip.in) - gzip.nDict;
+  int nBlock, i, iEnd;
+  GzipBlock *aBlock;
+  Blob rest;
+
+  nBlock = nAvail/GZIP_BLOCK_SIZE;
+  if( isFinal && (nBlock==0 || nAvail%GZIP_BLOCK_SIZE) ) nBlock++;
+  if( nBlock==0 ) return;
+  aBlock = fossil_malloc(sizeof(aBlock[0])*nBlock);
+  for(i=0; i<nBlock; i++){
+    GzipBlock *p = &aBlock[i];
+    int iStart = gzip.nDict + i*GZIP_BLOCK_SIZE;
+    p->zIn = &zBase[iStart];
+    p->nIn = nAvail - i*GZIP_BLOCK_SIZE;
+    if( p->nIn>GZIP_BLOCK_SIZE ) p->nIn = GZIP_BLOCK_SIZE;
+    p->nDict = iStart<GZIP_DICT_SIZE ? iStart : GZIP_DICT_SIZE;
+    p->zDict = p->zIn - p->nDict;
+    p->isLast = isFinal && i==nBlock-1;
+    p->level = gzip.level;
+    workpool_add(gzip.pPool, gzip_block_task, p);
+  }
+  workpool_wait(gzip.pPool);
+  for(i=0; i<nBlock; i++){
+    GzipBlock *p = &aBlock[i];
+    blob_append(&gzip.out, blob_buffer(&p->out), blob_size(&p->out));
+    blob_reset(&p->out);
+    gzip.iCRC = crc32_combine(gzip.iCRC, p->iCRC, p->nIn);
+    gzip.nTotal += p->nIn;
+  }
+  iEnd = aBlock[nBlock-1].zIn + aBlock[nBlock-1].nIn - zBase;
+  fossil_free(aBlock);
+
+  /* Keep the unused input, preceded by the dictionary for the next block */
+  gzip.nDict = iEnd<GZIP_DICT_SIZE ? iEnd : GZIP_DICT_SIZE;
+  blob_zero(&rest);
+  blob_append(&rest, (char*)&zBase[iEnd-gzip.nDict],
+              blob_size(&gzip.in) - (iEnd-gzip.nDict));
+  blob_reset(&gzip.in);
+  gzip.in = rest;
+}
+
+/*
+** Add nIn bytes of content from pIn to the gzip file.
+*/
+void gzip_step(const char *pIn, int nIn){
+  assert( gzip.eState==1 );
+  if( gzip.isSerial ){
+    gzip_deflate_serial(pIn, nIn, Z_NO_FLUSH);
+    return;
+  }
+  blob_append(&gzip.in, pIn, nIn);
+  if( blob_size(&gzip.in)-gzip.nDict >= gzip.nBatch*GZIP_BLOCK_SIZE ){
+    gzip_compress_pending(0);
+  }
+}
+
+/*
+** Append the compressed output generated so far to pOut and discard
+** it from the gzip file under construction.  This lets a large gzip
+** file be sent on as it is built instead of being held in memory.
+*/
+void gzip_drain(Blob *pOut){
+  assert( gzip.eState>0 );
+  blob_append(pOut, blob_buffer(&gzip.out), blob_size(&gzip.out));
+  blob_reset(&gzip.out);
 }
 
 /*
@@ -106,16 +258,74 @@ void gzip_step(const char *pIn, int nIn){
 void gzip_finish(Blob *pOut){
   char aTrailer[8];
   assert( gzip.eState>0 );
-  gzip_step("", 0);
-  deflateEnd(&gzip.stream);
+  if( gzip.isSerial ){
+    gzip_deflate_serial("", 0, Z_FINISH);
+    deflateEnd(&gzip.stream);
+  }else{
+    gzip_compress_pending(1);
+    workpool_delete(gzip.pPool);
+    gzip.pPool = 0;
+  }
+  blob_reset(&gzip.in);
   put32(aTrailer, gzip.iCRC);
-  put32(&aTrailer[4], gzip.stream.total_in);
+  put32(&aTrailer[4], gzip.nTotal&0xffffffff);
   blob_append(&gzip.out, aTrailer, 8);
   *pOut = gzip.out;
   blob_zero(&gzip.out);
   gzip.eState = 0;
 }
 
+/*
+** Compress the content of pIn into a complete GZIP file in pOut, at
+** the given zlib compression level.  This is independent of the
+** incremental routines above.  pOut must be different from pIn.
+*/
+void gzip_compress_blob(Blob *pIn, Blob *pOut, int level){
+  z_stream stream;
+  int nOut;
+  memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, level, Z_DEFLATED, MAX_WBITS+16, 8,
+               Z_DEFAULT_STRATEGY);
+  nOut = deflateBound(&stream, blob_size(pIn)) + 18;
+  blob_zero(pOut);
+  blob_resize(pOut, nOut);
+  stream.avail_in = blob_size(pIn);
+  stream.next_in = (unsigned char*)blob_buffer(pIn);
+  stream.avail_out = nOut;
+  stream.next_out = (unsigned char*)blob_buffer(pOut);
+  deflate(&stream, Z_FINISH);
+  blob_resize(pOut, stream.total_out);
+  deflateEnd(&stream);
+}
+
+/*
+** Uncompress the GZIP file in pIn into pOut.  Return non-zero if pIn
+** is not a complete and valid GZIP file.  pOut must be different from
+** pIn.
+*/
+int gzip_uncompress_blob(Blob *pIn, Blob *pOut){
+  z_stream stream;
+  char aBuf[16384];
+  int rc;
+  memset(&stream, 0, sizeof(stream));
+  if( inflateInit2(&stream, MAX_WBITS+16)!=Z_OK ) return 1;
+  blob_zero(pOut);
+  stream.avail_in = blob_size(pIn);
+  stream.next_in = (unsigned char*)blob_buffer(pIn);
+  do{
+    stream.avail_out = sizeof(aBuf);
+    stream.next_out = (unsigned char*)aBuf;
+    rc = inflate(&stream, Z_NO_FLUSH);
+    blob_append(pOut, aBuf, sizeof(aBuf)-stream.avail_out);
+  }while( rc==Z_OK );
+  inflateEnd(&stream);
+  if( rc!=Z_STREAM_END ){
+    blob_reset(pOut);
+    return 1;
+  }
+  return 0;
+}
+
 /*
 ** COMMAND: test-gzip
 **
@@ -128,7 +338,7 @@ void test_gzip_cmd(void){
   char *zOut;
   if( g.argc!=3 ) usage("FILENAME");
   sqlite3_open(":memory:", &g.db);
-  gzip_begin(0);
+  gzip_begin(0, 9);
   blob_read_from_file(&b, g.argv[2]);
   zOut = mprintf("%s.gz", g.argv[2]);
   gzip_step(blob_buffer(&b), blob_size(&b));
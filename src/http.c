@@ -100,7 +100,7 @@ static void http_build_header(Blob *pPayload, Blob *pHdr){
   }else{
     zSep = "/";
   }
-  blob_appendf(pHdr, "POST %s%sxfer/xfer HTTP/1.0\r\n", g.urlPath, zSep);
+  blob_appendf(pHdr, "POST %s%sxfer/xfer HTTP/1.1\r\n", g.urlPath, zSep);
   if( g.urlProxyAuth ){
     blob_appendf(pHdr, "Proxy-Authorization: %s\r\n", g.urlProxyAuth);
   }
@@ -112,6 +112,7 @@ static void http_build_header(Blob *pPayload, Blob *pHdr){
     fossil_free(zCredentials);
   }
   blob_appendf(pHdr, "Host: %s\r\n", g.urlHostname);
+  blob_appendf(pHdr, "Connection: keep-alive\r\n");
   blob_appendf(pHdr, "User-Agent: Fossil/" RELEASE_VERSION 
                      " (" MANIFEST_DATE " " MANIFEST_VERSION ")\r\n");
   if( g.fHttpTrace ){
@@ -122,6 +123,32 @@ static void http_build_header(Blob *pPayload, Blob *pHdr){
   blob_appendf(pHdr, "Content-Length: %d\r\n\r\n", blob_size(pPayload));
 }
 
+/*
+** Read a reply body sent with "Transfer-Encoding: chunked" and append
+** it to pReply.  Return 0 on success or 1 if the body is malformed or
+** the connection closes early.
+*/
+static int http_receive_chunked(Blob *pReply){
+  char *zLine;
+  while( 1 ){
+    int n, got;
+    int iOfst = blob_size(pReply);
+    zLine = transport_receive_line();
+    if( zLine==0 || zLine[0]==0 ) return 1;
+    n = (int)strtol(zLine, 0, 16);
+    if( n<0 ) return 1;
+    if( n==0 ) break;
+    blob_resize(pReply, iOfst+n);
+    got = transport_receive(blob_buffer(pReply)+iOfst, n);
+    if( got!=n ) return 1;
+    zLine = transport_receive_line();
+    if( zLine==0 || zLine[0]!=0 ) return 1;
+  }
+  /* Skip any trailer fields up to the final blank line */
+  while( (zLine = transport_receive_line())!=0 && zLine[0]!=0 ){}
+  return 0;
+}
+
 /*
 ** Sign the content in pSend, compress it, and send it to the server
 ** via HTTP or HTTPS.  Get a reply, uncompress the reply, and store the reply
@@ -131,6 +158,10 @@ static void http_build_header(Blob *pPayload, Blob *pHdr){
 ** The server address is contain in the "g" global structure.  The
 ** url_parse() routine should have been called prior to this routine
 ** in order to fill this structure appropriately.
+**
+** The connection is kept open for the next call if the server allows
+** it.  If a kept connection turns out to have been closed by the
+** server in the meantime, the request is sent again on a new one.
 */
 int http_exchange(Blob *pSend, Blob *pReply, int useLogin){
   Blob login;           /* The login card */
@@ -144,7 +175,12 @@ int http_exchange(Blob *pSend, Blob *pReply, int useLogin){
   int i;                /* Loop counter */
   int isError = 0;      /* True if the reply is an error message */
   int isCompressed = 1; /* True if the reply is compressed */
+  int isStream = 0;     /* True if the reply is a zlib stream without prefix */
+  int isChunked = 0;    /* True for "Transfer-Encoding: chunked" */
+  int isReused;         /* True if the connection was already open */
+  int nLine = 0;        /* Number of reply header lines seen */
 
+  isReused = transport_is_open();
   if( transport_open() ){
     fossil_warning(transport_errmsg());
     return 1;
@@ -205,6 +241,7 @@ int http_exchange(Blob *pSend, Blob *pReply, int useLogin){
   iLength = -1;
   while( (zLine = transport_receive_line())!=0 && zLine[0]!=0 ){
     /* printf("[%s]\n", zLine); fflush(stdout); */
+    nLine++;
     if( fossil_strnicmp(zLine, "http/1.", 7)==0 ){
       if( sscanf(zLine, "HTTP/1.%d %d", &iHttpVersion, &rc)!=2 ) goto write_err;
       if( rc!=200 && rc!=302 ){
@@ -222,6 +259,9 @@ int http_exchange(Blob *pSend, Blob *pReply, int useLogin){
     }else if( fossil_strnicmp(zLine, "content-length:", 15)==0 ){
       for(i=15; fossil_isspace(zLine[i]); i++){}
       iLength = atoi(&zLine[i]);
+    }else if( fossil_strnicmp(zLine, "transfer-encoding:", 18)==0 ){
+      for(i=18; fossil_isspace(zLine[i]); i++){}
+      isChunked = fossil_strnicmp(&zLine[i], "chunked", 7)==0;
     }else if( fossil_strnicmp(zLine, "connection:", 11)==0 ){
       char c;
       for(i=11; fossil_isspace(zLine[i]); i++){}
@@ -250,12 +290,20 @@ int http_exchange(Blob *pSend, Blob *pReply, int useLogin){
       }else if( fossil_strnicmp(&zLine[14], 
                           "application/x-fossil-uncompressed", -1)==0 ){
         isCompressed = 0;
+      }else if( fossil_strnicmp(&zLine[14],
+                          "application/x-fossil-stream", -1)==0 ){
+        isStream = 1;
       }else if( fossil_strnicmp(&zLine[14], "application/x-fossil", -1)!=0 ){
         isError = 1;
       }
     }
   }
-  if( iLength<0 ){
+  if( nLine==0 && isReused ){
+    /* The server closed the kept connection.  Try a new one. */
+    transport_close();
+    return http_exchange(pSend, pReply, useLogin);
+  }
+  if( iLength<0 && !isChunked && (rc!=200 || !closeConnection) ){
     fossil_fatal("server did not reply");
     goto write_err;
   }
@@ -265,12 +313,34 @@ int http_exchange(Blob *pSend, Blob *pReply, int useLogin){
   }
 
   /*
-  ** Extract the reply payload that follows the header
+  ** Extract the reply payload that follows the header.  A server that
+  ** sends its reply while still generating it omits the Content-Length
+  ** and closes the connection at the end of the reply.
   */
   blob_zero(pReply);
-  blob_resize(pReply, iLength);
-  iLength = transport_receive(blob_buffer(pReply), iLength);
-  blob_resize(pReply, iLength);
+  if( isChunked ){
+    if( http_receive_chunked(pReply) ){
+      fossil_warning("malformed reply from server");
+      goto write_err;
+    }
+  }else if( iLength>=0 ){
+    blob_resize(pReply, iLength);
+    iLength = transport_receive(blob_buffer(pReply), iLength);
+    blob_resize(pReply, iLength);
+  }else{
+    int nAlloc = 0;
+    iLength = 0;
+    do{
+      if( iLength>=nAlloc ){
+        nAlloc = nAlloc*2 + 100000;
+        blob_resize(pReply, nAlloc);
+      }
+      i = transport_receive(blob_buffer(pReply)+iLength, nAlloc-iLength);
+      iLength += i;
+    }while( i>0 );
+    blob_resize(pReply, iLength);
+    closeConnection = 1;
+  }
   if( isError ){
     char *z;
     int i, j;
@@ -285,16 +355,18 @@ int http_exchange(Blob *pSend, Blob *pReply, int useLogin){
     z[j] = 0;
     fossil_fatal("server sends error: %s", z);
   }
-  if( isCompressed ) blob_uncompress(pReply, pReply);
+  if( isStream ){
+    if( blob_uncompress_stream(pReply, pReply) ){
+      fossil_warning("malformed reply from server");
+      goto write_err;
+    }
+  }else if( isCompressed ){
+    blob_uncompress(pReply, pReply);
+  }
 
   /*
   ** Close the connection to the server if appropriate.
-  **
-  ** FIXME:  There is some bug in the lower layers that prevents the
-  ** connection from remaining open.  The easiest fix for now is to
-  ** simply close and restart the connection for each round-trip.
   */
-  closeConnection = 1; /* FIX ME */
   if( closeConnection ){
     transport_close();
   }else{
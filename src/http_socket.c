@@ -199,9 +199,16 @@ size_t socket_send(void *NotUsed, void *pContent, size_t N){
 }
 
 /*
-** Receive content back from the open socket connection.
+** Receive content back from the open socket connection.  If bDontBlock
+** is true, return as soon as some content has been received, even if
+** it is less than N bytes.
 */
-size_t socket_receive(void *NotUsed, void *pContent, size_t N){
+size_t socket_receive(
+  void *NotUsed,
+  void *pContent,
+  size_t N,
+  int bDontBlock
+){
   ssize_t got;
   size_t total = 0;
   while( N>0 ){
@@ -210,6 +217,7 @@ size_t socket_receive(void *NotUsed, void *pContent, size_t N){
     total += (size_t)got;
     N -= (size_t)got;
     pContent = (void*)&((char*)pContent)[got];
+    if( bDontBlock ) break;
   }
   return total;
 }
@@ -54,6 +54,19 @@ static char *sslErrMsg = 0;  /* Text of most recent OpenSSL error */
 static SSL_CTX *sslCtx;      /* SSL context */
 static SSL *ssl;
 
+/*
+** The TLS session most recently established with the server, so that
+** later connections can resume it instead of doing a full handshake.
+** If the "ssl-session-cache" setting is on, sessions are also saved in
+** the global configuration, one per server, so that the next fossil
+** command resumes them too.
+*/
+static SSL_SESSION *sslSession = 0;  /* Session to resume, or NULL */
+static char *zSessionKey = 0;        /* Config name for sslSession */
+static int sslSessionIsNew = 0;      /* sslSession is not saved yet */
+static int sslSessionSave = 0;       /* Save sessions in the config */
+static int sslIsVerified = 0;        /* Open connection passed verification */
+
 
 /*
 ** Clear the SSL error message
@@ -93,6 +106,86 @@ static int ssl_client_cert_callback(SSL *ssl, X509 **x509, EVP_PKEY **pkey){
   return 0; /* no cert available */    
 }
 
+/*
+** Called by OpenSSL when the server hands out a new session, which for
+** TLS 1.3 can be after the handshake.  Keep it to resume later.
+*/
+static int ssl_new_session_callback(SSL *ssl, SSL_SESSION *pSession){
+  if( sslSession ) SSL_SESSION_free(sslSession);
+  sslSession = pSession;
+  sslSessionIsNew = 1;
+  return 1;  /* The reference to pSession is kept */
+}
+
+/*
+** Load the saved session for g.urlName and g.urlPort, unless it is the
+** one already in memory or sessions are not saved.
+*/
+static void ssl_load_session(void){
+  char *zKey = mprintf("session:%s:%d", g.urlName, g.urlPort);
+  char *z64;
+  if( zSessionKey && fossil_strcmp(zKey, zSessionKey)==0 ){
+    free(zKey);
+    return;
+  }
+  if( sslSession ) SSL_SESSION_free(sslSession);
+  sslSession = 0;
+  sslSessionIsNew = 0;
+  free(zSessionKey);
+  zSessionKey = zKey;
+  sslSessionSave = db_get_boolean("ssl-session-cache", 0);
+  z64 = sslSessionSave ? db_get(zSessionKey, 0) : 0;
+  if( z64 ){
+    int n;
+    char *zDer = decode64(z64, &n);
+    const unsigned char *p = (const unsigned char*)zDer;
+    sslSession = d2i_SSL_SESSION(0, &p, n);
+    free(zDer);
+    free(z64);
+  }
+}
+
+/*
+** Keep a session that the server handed out since the last save, if
+** the connection it came from passed verification, and save it in the
+** configuration if sessions are saved.  A resumed session keeps the
+** verification result of the connection that created it, so a session
+** from a connection whose certificate was only accepted by the user for
+** that one time is dropped rather than being reused.
+*/
+static void ssl_save_session(void){
+  unsigned char *zDer, *p;
+  char *z64;
+  int n;
+  if( !sslSessionIsNew ) return;
+  sslSessionIsNew = 0;
+  if( !sslIsVerified ){
+    SSL_SESSION_free(sslSession);
+    sslSession = 0;
+    return;
+  }
+  if( zSessionKey==0 || !sslSessionSave ) return;
+  n = i2d_SSL_SESSION(sslSession, 0);
+  if( n<=0 ) return;
+  zDer = p = fossil_malloc(n);
+  i2d_SSL_SESSION(sslSession, &p);
+  z64 = encode64((const char*)zDer, n);
+  db_set(zSessionKey, z64, 1);
+  free(z64);
+  free(zDer);
+}
+
+/*
+** Forget the session for the current server, so that the next
+** connection does a full handshake.
+*/
+static void ssl_forget_session(void){
+  if( sslSession ) SSL_SESSION_free(sslSession);
+  sslSession = 0;
+  sslSessionIsNew = 0;
+  if( zSessionKey && sslSessionSave ) db_unset(zSessionKey, 1);
+}
+
 /*
 ** Call this routine once before any other use of the SSL interface.
 ** This routine does initial configuration of the SSL module.
@@ -156,6 +249,12 @@ void ssl_global_init(void){
     ** for a cert */
     SSL_CTX_set_client_cert_cb(sslCtx, ssl_client_cert_callback);
 
+    /* Keep sessions for resumption.  OpenSSL does not look them up on
+    ** the client side, so they are handed to each connection by hand */
+    SSL_CTX_set_session_cache_mode(sslCtx,
+        SSL_SESS_CACHE_CLIENT|SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(sslCtx, ssl_new_session_callback);
+
     sslIsInit = 1;
   }
 }
@@ -165,6 +264,10 @@ void ssl_global_init(void){
 */
 void ssl_global_shutdown(void){
   if( sslIsInit ){
+    if( sslSession ) SSL_SESSION_free(sslSession);
+    sslSession = 0;
+    free(zSessionKey);
+    zSessionKey = 0;
     SSL_CTX_free(sslCtx);
     ssl_clear_errmsg();
     sslIsInit = 0;
@@ -177,8 +280,11 @@ void ssl_global_shutdown(void){
 */
 void ssl_close(void){
   if( iBio!=NULL ){
+    ssl_save_session();
+    sslIsVerified = 0;
     (void)BIO_reset(iBio);
     BIO_free_all(iBio);
+    iBio = NULL;
   }
 }
 
@@ -198,6 +304,8 @@ int ssl_open(void){
   unsigned long e;
 
   ssl_global_init();
+  ssl_load_session();
+  sslIsVerified = 0;
 
   /* Get certificate for current server from global config and
    * (if we have it in config) add it to certificate store.
@@ -220,6 +328,7 @@ int ssl_open(void){
 #endif
 
   SSL_set_mode(ssl, SSL_MODE_AUTO_RETRY);
+  if( sslSession ) SSL_set_session(ssl, sslSession);
   if( iBio==NULL ) {
     ssl_set_errmsg("SSL: cannot open SSL (%s)", 
                     ERR_reason_error_string(ERR_get_error()));
@@ -239,6 +348,7 @@ int ssl_open(void){
   if( BIO_do_handshake(iBio)<=0 ) {
     ssl_set_errmsg("Error establishing SSL connection %s:%d (%s)", 
         g.urlName, g.urlPort, ERR_reason_error_string(ERR_get_error()));
+    ssl_forget_session();
     ssl_close();
     return 1;
   }
@@ -251,7 +361,8 @@ int ssl_open(void){
     return 1;
   }
 
-  if( trusted<=0 && (e = SSL_get_verify_result(ssl)) != X509_V_OK ){
+  e = SSL_get_verify_result(ssl);
+  if( trusted<=0 && e!=X509_V_OK ){
     char *desc, *prompt;
     char *warning = "";
     Blob ans;
@@ -323,6 +434,7 @@ int ssl_open(void){
   }
 
   X509_free(cert);
+  sslIsVerified = trusted>0 || e==X509_V_OK;
   return 0;
 }
 
@@ -392,9 +504,16 @@ size_t ssl_send(void *NotUsed, void *pContent, size_t N){
 }
 
 /*
-** Receive content back from the SSL connection.
+** Receive content back from the SSL connection.  If bDontBlock is true,
+** return as soon as some content has been received, even if it is less
+** than N bytes.
 */
-size_t ssl_receive(void *NotUsed, void *pContent, size_t N){
+size_t ssl_receive(
+  void *NotUsed,
+  void *pContent,
+  size_t N,
+  int bDontBlock
+){
   size_t got;
   size_t total = 0;
   while( N>0 ){
@@ -403,6 +522,7 @@ size_t ssl_receive(void *NotUsed, void *pContent, size_t N){
     total += got;
     N -= got;
     pContent = (void*)&((char*)pContent)[got];
+    if( bDontBlock ) break;
   }
   return total;
 }
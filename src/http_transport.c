@@ -100,6 +100,40 @@ static char zDefaultSshCmd[] = "ssh -T";
 static char zDefaultSshCmd[] = "ssh -e none -T";
 #endif
 
+/*
+** If the "ssh-persist" setting is a positive number of seconds, append
+** options to the SSH command in pCmd that share one connection to each
+** host among all ssh:// syncs, and keep it open for that long after the
+** last of them ends.  So a sequence of syncs, such as "fossil all sync",
+** pays for the SSH handshake once per host rather than once per
+** repository.  The control socket goes in ~/.ssh, named by the "%C"
+** hash of the connection so that the name is short enough for a Unix
+** socket, and nothing is added if that directory does not exist.
+**
+** These are OpenSSH options, so they are added only to the default SSH
+** command, never to an "ssh-command" setting, which might name some
+** other program or already choose its own control socket.  Nor are
+** they added for PLINK.EXE.
+*/
+static void ssh_add_persist_options(Blob *pCmd){
+#ifndef __MINGW32__
+  int nSec = db_get_int("ssh-persist", 0);
+  const char *zHome = fossil_getenv("HOME");
+  char *zDir;
+  char *zPath;
+  if( nSec<=0 || zHome==0 || zHome[0]==0 ) return;
+  zDir = mprintf("%s/.ssh", zHome);
+  if( file_isdir(zDir)==1 ){
+    zPath = mprintf("ControlPath=%s/fossil-%%C", zDir);
+    blob_appendf(pCmd, " -o ControlMaster=auto -o ControlPersist=%d -o ",
+                 nSec);
+    shell_escape(pCmd, zPath);
+    fossil_free(zPath);
+  }
+  fossil_free(zDir);
+#endif
+}
+
 /*
 ** Global initialization of the transport layer
 */
@@ -113,8 +147,8 @@ void transport_global_startup(void){
     char *zHost;       /* The host name to contact */
     char *zIn;         /* An input line received back from remote */
 
-    zSsh = db_get("ssh-command", zDefaultSshCmd);
-    blob_init(&zCmd, zSsh, -1);
+    zSsh = db_get("ssh-command", 0);
+    blob_init(&zCmd, zSsh ? zSsh : zDefaultSshCmd, -1);
     if( g.urlPort!=g.urlDfltPort ){
 #ifdef __MINGW32__
       blob_appendf(&zCmd, " -P %d", g.urlPort);
@@ -122,6 +156,7 @@ void transport_global_startup(void){
       blob_appendf(&zCmd, " -p %d", g.urlPort);
 #endif
     }
+    if( zSsh==0 ) ssh_add_persist_options(&zCmd);
     fossil_print("%s", blob_str(&zCmd));  /* Show the base of the SSH command */
     if( g.urlUser && g.urlUser[0] ){
       zHost = mprintf("%s@%s", g.urlUser, g.urlName);
@@ -223,6 +258,14 @@ int transport_open(void){
   return rc;
 }
 
+/*
+** Return true if a connection to the server is open, such as one left
+** open by the previous request for reuse.
+*/
+int transport_is_open(void){
+  return transport.isOpen;
+}
+
 /*
 ** Close the current connection
 */
@@ -335,9 +378,10 @@ void transport_rewind(void){
 
 /*
 ** Read N bytes of content directly from the wire and write into
-** the buffer.
+** the buffer.  If bDontBlock is true, return once some content is
+** available, which might be less than N bytes.
 */
-static int transport_fetch(char *zBuf, int N){
+static int transport_fetch(char *zBuf, int N, int bDontBlock){
   int got;
   if( sshIn ){
     int x;
@@ -352,14 +396,14 @@ static int transport_fetch(char *zBuf, int N){
     }
   }else if( g.urlIsHttps ){
     #ifdef FOSSIL_ENABLE_SSL
-    got = ssl_receive(0, zBuf, N);
+    got = ssl_receive(0, zBuf, N, bDontBlock);
     #else
     got = 0;
     #endif
   }else if( g.urlIsFile ){
     got = fread(zBuf, 1, N, transport.pFile);
   }else{
-    got = socket_receive(0, zBuf, N);
+    got = socket_receive(0, zBuf, N, bDontBlock);
   }
   /* printf("received %d of %d bytes\n", got, N); fflush(stdout); */
   if( transport.pLog ){
@@ -394,7 +438,7 @@ int transport_receive(char *zBuf, int N){
     nByte += toMove;
   }
   if( N>0 ){
-    int got = transport_fetch(zBuf, N);
+    int got = transport_fetch(zBuf, N, 0);
     if( got>0 ){
       nByte += got;
       transport.nRcvd += got;
@@ -430,7 +474,7 @@ static void transport_load_buffer(int N){
     transport.pBuf = pNew;
   }
   if( N>0 ){
-    i = transport_fetch(&transport.pBuf[transport.nUsed], N);
+    i = transport_fetch(&transport.pBuf[transport.nUsed], N, 1);
     if( i>0 ){
       transport.nRcvd += i;
       transport.nUsed += i;
@@ -0,0 +1,338 @@
+/*
+** Copyright (c) 2012 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*******************************************************************************
+**
+** This file implements an invertible Bloom lookup table (IBLT) over
+** artifact IDs.  An IBLT summarizes a set of artifacts in a fixed
+** number of cells.  Subtracting the IBLT that one side of a sync built
+** for its own artifacts from the IBLT the other side built for its
+** artifacts leaves a table that holds only the artifacts that are on
+** one side but not the other.  If there are not too many of those
+** (about two thirds of the number of cells or fewer) they can all be
+** recovered from the difference.  So the two sides of a sync can find
+** out what the other side is missing with a message whose size depends
+** on the number of differences rather than on the size of the
+** repository.
+*/
+#include "config.h"
+#include "iblt.h"
+#include <assert.h>
+
+/*
+** Each artifact ID is added to one cell in each of IBLT_NHASH
+** sub-tables.  Three is the usual choice.
+*/
+#define IBLT_NHASH 3
+
+/*
+** Number of bytes in a key.  Keys are SHA1 artifact IDs.
+*/
+#define IBLT_KEYSZ 20
+
+/*
+** Number of bytes in the serialized form of one cell.
+*/
+#define IBLT_CELLSZ (8+IBLT_KEYSZ)
+
+#if INTERFACE
+/*
+** One cell of an IBLT.
+*/
+struct IbltCell {
+  int n;                     /* Keys added less keys removed */
+  unsigned int chk;          /* XOR of iblt_check() for every key */
+  unsigned char k[20];       /* XOR of every key */
+};
+
+/*
+** An IBLT.  nCell is always a multiple of the number of sub-tables.
+*/
+struct Iblt {
+  int nCell;                 /* Number of cells in a[] */
+  IbltCell *a;               /* The cells */
+};
+#endif
+
+/*
+** Read a 32-bit big-endian integer.
+*/
+static unsigned int iblt_get32(const unsigned char *z){
+  return (z[0]<<24) | (z[1]<<16) | (z[2]<<8) | z[3];
+}
+
+/*
+** Write a 32-bit big-endian integer.
+*/
+static void iblt_put32(unsigned char *z, unsigned int v){
+  z[0] = v>>24;
+  z[1] = v>>16;
+  z[2] = v>>8;
+  z[3] = v;
+}
+
+/*
+** Compute the checksum of a key.  The checksum is used to tell a cell
+** that holds a single key apart from a cell that holds the XOR of
+** several.  Keys are already random, so the checksum only needs to
+** depend on bytes of the key that do not select the cells.
+*/
+static unsigned int iblt_check(const unsigned char *k){
+  unsigned int h;
+  h = iblt_get32(&k[12])*0x9e3779b1;
+  h ^= h>>15;
+  h += iblt_get32(&k[16])*0x85ebca77;
+  h ^= h>>13;
+  return h*0xc2b2ae3d;
+}
+
+/*
+** Return the index of the cell that key k goes to in sub-table j.
+*/
+static int iblt_cell(const Iblt *p, const unsigned char *k, int j){
+  int m = p->nCell/IBLT_NHASH;
+  return j*m + iblt_get32(&k[j*4])%m;
+}
+
+/*
+** Initialize an IBLT with at least nCell cells.
+*/
+void iblt_init(Iblt *p, int nCell){
+  if( nCell<IBLT_NHASH ) nCell = IBLT_NHASH;
+  nCell = (nCell + IBLT_NHASH - 1)/IBLT_NHASH*IBLT_NHASH;
+  p->nCell = nCell;
+  p->a = fossil_malloc( sizeof(p->a[0])*nCell );
+  memset(p->a, 0, sizeof(p->a[0])*nCell);
+}
+
+/*
+** Free all memory held by an IBLT.
+*/
+void iblt_reset(Iblt *p){
+  fossil_free(p->a);
+  p->a = 0;
+  p->nCell = 0;
+}
+
+/*
+** Add key k to the IBLT if n is 1 or remove it if n is -1.
+*/
+static void iblt_update(Iblt *p, const unsigned char *k, int n){
+  unsigned int chk = iblt_check(k);
+  int i, j;
+  for(i=0; i<IBLT_NHASH; i++){
+    IbltCell *pCell = &p->a[iblt_cell(p, k, i)];
+    pCell->n += n;
+    pCell->chk ^= chk;
+    for(j=0; j<IBLT_KEYSZ; j++) pCell->k[j] ^= k[j];
+  }
+}
+
+/*
+** Add the artifact whose ID is zUuid to the IBLT.  Artifact IDs that
+** are not 40-character SHA1 hashes are ignored.
+*/
+void iblt_insert(Iblt *p, const char *zUuid){
+  unsigned char k[IBLT_KEYSZ];
+  if( strlen(zUuid)!=IBLT_KEYSZ*2 ) return;
+  if( decode16((const unsigned char*)zUuid, k, IBLT_KEYSZ*2) ) return;
+  iblt_update(p, k, 1);
+}
+
+/*
+** Subtract pOther from p, leaving in p only the keys that are in one
+** of the two IBLTs but not both.  Both must have the same size.
+*/
+void iblt_subtract(Iblt *p, const Iblt *pOther){
+  int i, j;
+  assert( p->nCell==pOther->nCell );
+  for(i=0; i<p->nCell; i++){
+    IbltCell *pCell = &p->a[i];
+    const IbltCell *pO = &pOther->a[i];
+    pCell->n -= pO->n;
+    pCell->chk ^= pO->chk;
+    for(j=0; j<IBLT_KEYSZ; j++) pCell->k[j] ^= pO->k[j];
+  }
+}
+
+/*
+** Return true if cell i holds exactly one key.  The key must also be
+** one that goes to cell i, which a table received over the network
+** need not honor.
+*/
+static int iblt_is_pure(const Iblt *p, int i){
+  const IbltCell *pCell = &p->a[i];
+  return (pCell->n==1 || pCell->n==-1)
+      && pCell->chk==iblt_check(pCell->k)
+      && iblt_cell(p, pCell->k, i/(p->nCell/IBLT_NHASH))==i;
+}
+
+/*
+** List the keys in an IBLT that is the difference of two others.
+** xKey is called once for each key, with the artifact ID in hex and
+** with sign 1 for keys that were only in the first IBLT or -1 for keys
+** that were only in the second.
+**
+** Return 1 if every key was recovered.  Return 0 if there were too
+** many differences for the size of the IBLT, or if the IBLT is not the
+** difference of two valid ones.  In that case some keys may have been
+** reported already and others were not.  The IBLT is used up either way.
+**
+** A cell is on the stack of pure cells at most once.  In a valid IBLT
+** a cell gives up at most one key, since peeling a key only ever takes
+** keys out of cells, so no more than nCell keys are recovered.  An IBLT
+** from the network that breaks either bound is rejected.
+*/
+int iblt_decode(
+  Iblt *p,
+  void (*xKey)(void*, const char*, int),
+  void *pArg
+){
+  int *aStack;
+  char *aOnStack;
+  int nStack = 0;
+  int nKey = 0;
+  int rc = 1;
+  int i;
+  char zUuid[IBLT_KEYSZ*2+1];
+
+  aStack = fossil_malloc( sizeof(aStack[0])*p->nCell );
+  aOnStack = fossil_malloc( p->nCell );
+  memset(aOnStack, 0, p->nCell);
+  for(i=0; i<p->nCell; i++){
+    if( iblt_is_pure(p, i) ){
+      aStack[nStack++] = i;
+      aOnStack[i] = 1;
+    }
+  }
+  while( nStack>0 && rc ){
+    unsigned char k[IBLT_KEYSZ];
+    int n, j;
+    i = aStack[--nStack];
+    aOnStack[i] = 0;
+    if( !iblt_is_pure(p, i) ) continue;
+    if( ++nKey>p->nCell ){
+      rc = 0;
+      break;
+    }
+    n = p->a[i].n;
+    memcpy(k, p->a[i].k, IBLT_KEYSZ);
+    encode16(k, (unsigned char*)zUuid, IBLT_KEYSZ);
+    xKey(pArg, zUuid, n);
+    iblt_update(p, k, -n);
+    for(j=0; j<IBLT_NHASH; j++){
+      int x = iblt_cell(p, k, j);
+      if( aOnStack[x] || !iblt_is_pure(p, x) ) continue;
+      if( nStack>=p->nCell ){
+        rc = 0;
+        break;
+      }
+      aStack[nStack++] = x;
+      aOnStack[x] = 1;
+    }
+  }
+  fossil_free(aStack);
+  fossil_free(aOnStack);
+  if( rc==0 ) return 0;
+  for(i=0; i<p->nCell; i++){
+    static const IbltCell empty;
+    if( memcmp(&p->a[i], &empty, sizeof(empty))!=0 ) return 0;
+  }
+  return 1;
+}
+
+/*
+** Append the serialized form of an IBLT to pOut.
+*/
+void iblt_serialize(const Iblt *p, Blob *pOut){
+  int i;
+  for(i=0; i<p->nCell; i++){
+    unsigned char z[IBLT_CELLSZ];
+    iblt_put32(z, (unsigned int)p->a[i].n);
+    iblt_put32(&z[4], p->a[i].chk);
+    memcpy(&z[8], p->a[i].k, IBLT_KEYSZ);
+    blob_append(pOut, (const char*)z, IBLT_CELLSZ);
+  }
+}
+
+/*
+** Return the number of bytes in the serialized form of an IBLT
+** with nCell cells.
+*/
+int iblt_serialized_size(int nCell){
+  return nCell*IBLT_CELLSZ;
+}
+
+/*
+** Initialize p from the serialized form of an IBLT with nCell cells.
+** Return 0 on success or 1 if pIn is not a valid IBLT of that size, in
+** which case p is left empty.
+*/
+int iblt_deserialize(Iblt *p, int nCell, Blob *pIn){
+  const unsigned char *z = (const unsigned char*)blob_buffer(pIn);
+  int i;
+  if( nCell<=0 || nCell%IBLT_NHASH!=0
+   || blob_size(pIn)!=iblt_serialized_size(nCell)
+  ){
+    p->nCell = 0;
+    p->a = 0;
+    return 1;
+  }
+  iblt_init(p, nCell);
+  for(i=0; i<nCell; i++, z+=IBLT_CELLSZ){
+    p->a[i].n = (int)iblt_get32(z);
+    p->a[i].chk = iblt_get32(&z[4]);
+    memcpy(p->a[i].k, &z[8], IBLT_KEYSZ);
+  }
+  return 0;
+}
+
+/*
+** Callback for test_iblt_cmd().
+*/
+static void iblt_print_key(void *pArg, const char *zUuid, int n){
+  fossil_print("%c %s\n", n>0 ? '+' : '-', zUuid);
+}
+
+/*
+** COMMAND: test-iblt
+**
+** Usage: %fossil test-iblt NCELL FILE1 FILE2
+**
+** Read artifact IDs, one per line, from FILE1 and FILE2.  Build an IBLT
+** with NCELL cells for each, subtract them, then show the IDs that are
+** only in FILE1 (marked with "+") or only in FILE2 (marked with "-").
+*/
+void test_iblt_cmd(void){
+  Iblt a, b;
+  Blob f, line;
+  int i, rc;
+  if( g.argc!=5 ) usage("NCELL FILE1 FILE2");
+  iblt_init(&a, atoi(g.argv[2]));
+  iblt_init(&b, a.nCell);
+  for(i=0; i<2; i++){
+    blob_read_from_file(&f, g.argv[3+i]);
+    while( blob_line(&f, &line) ){
+      blob_trim(&line);
+      iblt_insert(i==0 ? &a : &b, blob_str(&line));
+    }
+    blob_reset(&f);
+  }
+  iblt_subtract(&a, &b);
+  rc = iblt_decode(&a, iblt_print_key, 0);
+  fossil_print("%s\n", rc ? "complete" : "incomplete");
+  iblt_reset(&a);
+  iblt_reset(&b);
+}
@@ -65,6 +65,49 @@ static struct {
   int tagCommit;              /* True if the commit adds a tag */
 } gg;
 
+/*
+** A file from a "blob" record that is waiting to be compressed and
+** stored in the BLOB table.
+*/
+typedef struct ImportBlob ImportBlob;
+struct ImportBlob {
+  char *zMark;                /* The mark of the blob, or NULL */
+  int nByte;                  /* Size of the uncompressed content */
+  Blob hash;                  /* SHA1 hash of the content */
+  Blob content;               /* The content.  Compressed by a worker */
+};
+
+/*
+** Work that is deferred so that it can be done a batch at a time.
+**
+** The hash of each file is computed as soon as it is read, since later
+** records refer to the file by its hash, but compression is left to the
+** threads of pPool.  The prior version of each file that a check-in
+** changes is converted into a delta of the new version, which is what
+** manifest_crosslink() would otherwise do one file at a time, and then
+** the new check-ins are crosslinked.
+*/
+static struct {
+  WorkPool *pPool;            /* Threads for compression and deltas */
+  int nBlob;                  /* Number of entries in aBlob[] */
+  int nBlobAlloc;             /* Slots allocated for aBlob[] */
+  ImportBlob *aBlob;          /* Files not yet stored */
+  i64 szBlob;                 /* Bytes of content in aBlob[] */
+  int nDelta;                 /* Number of pairs in azDelta[] */
+  int nDeltaAlloc;            /* Pairs allocated for azDelta[] */
+  char **azDelta;             /* Old and new UUID pairs to be deltified */
+  int nXlink;                 /* Number of entries in aXlink[] */
+  int nXlinkAlloc;            /* Slots allocated for aXlink[] */
+  int *aXlink;                /* Artifacts waiting to be crosslinked */
+} ingest;
+
+/*
+** Store files once this many bytes are waiting.  Crosslink once this
+** many artifacts are waiting.
+*/
+#define IMPORT_BLOB_BATCH    50000000
+#define IMPORT_XLINK_BATCH   1000
+
 /*
 ** Duplicate a string.
 */
@@ -122,6 +165,48 @@ static void import_reset(int freeAll){
   gg.xFinish = finish_noop;
 }
 
+/*
+** Store an artifact with hash pHash and compressed content pCmpr in the
+** BLOB table, unless it is there already.  Return its rid.
+*/
+static int import_store(Blob *pHash, Blob *pCmpr, int nByte){
+  static Stmt ins;
+  int rid;
+
+  rid = db_int(0, "SELECT rid FROM blob WHERE uuid=%B", pHash);
+  if( rid==0 ){
+    db_static_prepare(&ins,
+        "INSERT INTO blob(uuid, size, content) VALUES(:uuid, :size, :content)"
+    );
+    db_bind_text(&ins, ":uuid", blob_str(pHash));
+    db_bind_int(&ins, ":size", nByte);
+    db_bind_blob(&ins, ":content", pCmpr);
+    db_step(&ins);
+    db_reset(&ins);
+    rid = db_last_insert_rowid();
+    db_multi_exec("INSERT OR IGNORE INTO unclustered VALUES(%d)", rid);
+  }
+  return rid;
+}
+
+/*
+** Create cross-references from zMark, and from the hash itself, back to
+** the artifact with hash pHash.  The rid is zero for a file that has not
+** been stored yet.
+*/
+static void import_add_mark(const char *zMark, int rid, Blob *pHash){
+  db_multi_exec(
+      "INSERT OR IGNORE INTO xmark(tname, trid, tuuid)"
+      "VALUES(%Q,%d,%B)",
+      zMark, rid, pHash
+  );
+  db_multi_exec(
+      "INSERT OR IGNORE INTO xmark(tname, trid, tuuid)"
+      "VALUES(%B,%d,%B)",
+      pHash, rid, pHash
+  );
+}
+
 /*
 ** Insert an artifact into the BLOB table if it isn't there already.
 ** If zMark is not zero, create a cross-reference from that mark back
@@ -136,32 +221,11 @@ static int fast_insert_content(Blob *pContent, const char *zMark, int saveUuid){
   int rid;
 
   sha1sum_blob(pContent, &hash);
-  rid = db_int(0, "SELECT rid FROM blob WHERE uuid=%B", &hash);
-  if( rid==0 ){
-    static Stmt ins;
-    db_static_prepare(&ins,
-        "INSERT INTO blob(uuid, size, content) VALUES(:uuid, :size, :content)"
-    );
-    db_bind_text(&ins, ":uuid", blob_str(&hash));
-    db_bind_int(&ins, ":size", gg.nData);
-    blob_compress(pContent, &cmpr);
-    db_bind_blob(&ins, ":content", &cmpr);
-    db_step(&ins);
-    db_reset(&ins);
-    blob_reset(&cmpr);
-    rid = db_last_insert_rowid();
-  }
+  content_compress(pContent, &cmpr);
+  rid = import_store(&hash, &cmpr, blob_size(pContent));
+  blob_reset(&cmpr);
   if( zMark ){
-    db_multi_exec(
-        "INSERT OR IGNORE INTO xmark(tname, trid, tuuid)"
-        "VALUES(%Q,%d,%B)", 
-        zMark, rid, &hash
-    );
-    db_multi_exec(
-        "INSERT OR IGNORE INTO xmark(tname, trid, tuuid)"
-        "VALUES(%B,%d,%B)", 
-        &hash, rid, &hash
-    );
+    import_add_mark(zMark, rid, &hash);
   }
   if( saveUuid ){
     fossil_free(gg.zPrevCheckin);
@@ -171,15 +235,133 @@ static int fast_insert_content(Blob *pContent, const char *zMark, int saveUuid){
   return rid;
 }
 
+/*
+** Worker-thread half of import_flush_blobs().  Compress one file.  This
+** routine must not use the database.
+*/
+static void import_blob_task(void *pArg){
+  ImportBlob *p = (ImportBlob*)pArg;
+  content_compress(&p->content, &p->content);
+}
+
+/*
+** Store every file in ingest.aBlob[], compressing them on the threads
+** of ingest.pPool first.
+*/
+static void import_flush_blobs(void){
+  int i;
+  for(i=0; i<ingest.nBlob; i++){
+    workpool_add(ingest.pPool, import_blob_task, &ingest.aBlob[i]);
+  }
+  workpool_wait(ingest.pPool);
+  for(i=0; i<ingest.nBlob; i++){
+    ImportBlob *p = &ingest.aBlob[i];
+    int rid = import_store(&p->hash, &p->content, p->nByte);
+    if( p->zMark ){
+      db_multi_exec("UPDATE xmark SET trid=%d WHERE tname IN (%Q,%B)",
+                    rid, p->zMark, &p->hash);
+    }
+    fossil_free(p->zMark);
+    blob_reset(&p->hash);
+    blob_reset(&p->content);
+  }
+  ingest.nBlob = 0;
+  ingest.szBlob = 0;
+}
+
+/*
+** Arrange for the artifact with UUID zOld to be converted into a delta
+** of the artifact with UUID zNew.
+*/
+static void import_add_delta(const char *zOld, const char *zNew){
+  if( zOld==0 || zNew==0 || fossil_strcmp(zOld, zNew)==0 ) return;
+  if( ingest.nDelta>=ingest.nDeltaAlloc ){
+    ingest.nDeltaAlloc = ingest.nDeltaAlloc*2 + 100;
+    ingest.azDelta = fossil_realloc(ingest.azDelta,
+                               2*ingest.nDeltaAlloc*sizeof(ingest.azDelta[0]));
+  }
+  ingest.azDelta[2*ingest.nDelta] = fossil_strdup(zOld);
+  ingest.azDelta[2*ingest.nDelta+1] = fossil_strdup(zNew);
+  ingest.nDelta++;
+}
+
+/*
+** Do all of the deferred work: store the waiting files, make the
+** waiting deltas, and crosslink the waiting artifacts.
+*/
+static void import_flush(void){
+  DeltifyReq *aReq;
+  int nReq = 0;
+  int i;
+
+  import_flush_blobs();
+  aReq = fossil_malloc((ingest.nDelta+1)*sizeof(aReq[0]));
+  for(i=0; i<ingest.nDelta; i++){
+    int rid = fast_uuid_to_rid(ingest.azDelta[2*i]);
+    int srcid = fast_uuid_to_rid(ingest.azDelta[2*i+1]);
+    if( rid && srcid ){
+      aReq[nReq].rid = rid;
+      aReq[nReq].aSrc[0] = srcid;
+      aReq[nReq].aSrc[1] = 0;
+      nReq++;
+    }
+    fossil_free(ingest.azDelta[2*i]);
+    fossil_free(ingest.azDelta[2*i+1]);
+  }
+  ingest.nDelta = 0;
+  content_deltify_many(nReq, aReq, ingest.pPool);
+  free(aReq);
+
+  manifest_crosslink_begin();
+  for(i=0; i<ingest.nXlink; i++){
+    Blob content;
+    content_get(ingest.aXlink[i], &content);
+    manifest_crosslink(ingest.aXlink[i], &content);
+  }
+  manifest_crosslink_end();
+  ingest.nXlink = 0;
+}
+
+/*
+** Arrange for the control artifact rid to be crosslinked.  If enough
+** artifacts are waiting and flushOk is true, do all of the deferred
+** work now.  flushOk must be false while a statement is pending,
+** since crosslinking creates and drops temporary tables.
+*/
+static void import_add_xlink(int rid, int flushOk){
+  if( ingest.nXlink>=ingest.nXlinkAlloc ){
+    ingest.nXlinkAlloc = ingest.nXlinkAlloc*2 + 100;
+    ingest.aXlink = fossil_realloc(ingest.aXlink,
+                                   ingest.nXlinkAlloc*sizeof(ingest.aXlink[0]));
+  }
+  ingest.aXlink[ingest.nXlink++] = rid;
+  if( flushOk && ingest.nXlink>=IMPORT_XLINK_BATCH ) import_flush();
+}
+
 /*
 ** Use data accumulated in gg from a "blob" record to add a new file
-** to the BLOB table.
+** to the BLOB table.  The file is only hashed here.  It is compressed
+** and stored later, along with others, by import_flush_blobs().
 */
 static void finish_blob(void){
-  Blob content;
-  blob_init(&content, gg.aData, gg.nData);
-  fast_insert_content(&content, gg.zMark, 0);
-  blob_reset(&content);
+  ImportBlob *p;
+  if( ingest.nBlob>=ingest.nBlobAlloc ){
+    ingest.nBlobAlloc = ingest.nBlobAlloc*2 + 100;
+    ingest.aBlob = fossil_realloc(ingest.aBlob,
+                                  ingest.nBlobAlloc*sizeof(ingest.aBlob[0]));
+  }
+  p = &ingest.aBlob[ingest.nBlob++];
+  p->zMark = gg.zMark;
+  gg.zMark = 0;
+  p->nByte = gg.nData;
+  blob_zero(&p->content);
+  blob_append(&p->content, gg.aData, gg.nData);
+  sha1sum_blob(&p->content, &p->hash);
+  if( p->zMark ){
+    import_add_mark(p->zMark, 0, &p->hash);
+  }
+  ingest.szBlob += gg.nData;
+  if( ingest.szBlob>=IMPORT_BLOB_BATCH ) import_flush_blobs();
   import_reset(0);
 }
 
@@ -196,7 +378,7 @@ static void finish_tag(void){
     blob_appendf(&record, "U %F\n", gg.zUser);
     md5sum_blob(&record, &cksum);
     blob_appendf(&record, "Z %b\n", &cksum);
-    fast_insert_content(&record, 0, 0);
+    import_add_xlink(fast_insert_content(&record, 0, 0), 1);
     blob_reset(&record);
     blob_reset(&cksum);
   }
@@ -229,7 +411,7 @@ static void import_prior_files(void);
 ** manifest artifact to the BLOB table.
 */
 static void finish_commit(void){
-  int i;
+  int i, rid;
   char *zFromBranch;
   char *aTCard[4];                /* Array of T cards for manifest */
   int nTCard = 0;                 /* Entries used in aTCard[] */
@@ -292,7 +474,9 @@ static void finish_commit(void){
   blob_appendf(&record, "U %F\n", gg.zUser);
   md5sum_blob(&record, &cksum);
   blob_appendf(&record, "Z %b\n", &cksum);
-  fast_insert_content(&record, gg.zMark, 1);
+  rid = fast_insert_content(&record, gg.zMark, 1);
+  import_add_delta(gg.zFrom, gg.zPrevCheckin);
+  import_add_xlink(rid, 1);
   blob_reset(&record);
   blob_reset(&cksum);
 
@@ -606,8 +790,10 @@ static void git_fast_import(FILE *pIn){
       }
       pFile->isExe = (fossil_strcmp(zPerm, "100755")==0);
       pFile->isLink = (fossil_strcmp(zPerm, "120000")==0);      
+      zUuid = resolve_committish(zUuid);
+      if( pFile->isFrom ) import_add_delta(pFile->zUuid, zUuid);
       fossil_free(pFile->zUuid);
-      pFile->zUuid = resolve_committish(zUuid);
+      pFile->zUuid = zUuid;
       pFile->isFrom = 0;
     }else
     if( memcmp(zLine, "D ", 2)==0 ){
@@ -716,8 +902,14 @@ malformed_line:
 ** The --incremental option allows an existing repository to be extended
 ** with new content.
 **
+** Each version of a file is stored as a delta of the next version of
+** the same file, and check-ins are crosslinked as the import proceeds,
+** so no rebuild is needed afterwards.
+**
 ** Options:
 **   --incremental  allow importing into an existing repository
+**   --threads N    use N threads to compress files and compute deltas.
+**                  The default is one thread per CPU.
 **
 ** See also: export
 */
@@ -727,6 +919,7 @@ void git_import_cmd(void){
   Stmt q;
   int forceFlag = find_option("force", "f", 0)!=0;
   int incrFlag = find_option("incremental", "i", 0)!=0;
+  const char *zThreads = find_option("threads", 0, 1);
 
   find_option("git",0,0);  /* Skip the --git option for now */
   verify_all_options();
@@ -745,6 +938,7 @@ void git_import_cmd(void){
   }
   db_open_repository(g.argv[2]);
   db_open_config(0);
+  ingest.pPool = workpool_new(workpool_size(zThreads));
 
   /* The following temp-tables are used to hold information needed for
   ** the import.
@@ -774,21 +968,25 @@ void git_import_cmd(void){
 
   db_begin_transaction();
   if( !incrFlag ) db_initial_setup(0, 0, 1);
+  content_compression_init();
   git_fast_import(pIn);
   db_prepare(&q, "SELECT tcontent FROM xtag");
   while( db_step(&q)==SQLITE_ROW ){
     Blob record;
     db_ephemeral_blob(&q, 0, &record);
-    fast_insert_content(&record, 0, 0);
+    import_add_xlink(fast_insert_content(&record, 0, 0), 0);
     import_reset(0);
   }
   db_finalize(&q);
-  db_end_transaction(0);
-  db_begin_transaction();
-  fossil_print("Rebuilding repository meta-data...\n");
-  rebuild_db(0, 1, !incrFlag);
+  import_flush();
+  if( !incrFlag ) create_cluster();
   verify_cancel();
   db_end_transaction(0);
+  workpool_delete(ingest.pPool);
+  fossil_free(ingest.aBlob);
+  fossil_free(ingest.azDelta);
+  fossil_free(ingest.aXlink);
+  memset(&ingest, 0, sizeof(ingest));
   fossil_print("Vacuuming..."); fflush(stdout);
   db_multi_exec("VACUUM");
   fossil_print(" ok\n");
@@ -253,38 +253,82 @@ static void showTags(int rid, const char *zNotGlob){
 
 
 /*
-** Append the difference between two RIDs to the output
+** Load the content of the files with UUIDs zFrom and zTo into pFrom
+** and pTo.  Either UUID may be NULL for an empty file.
 */
-static void append_diff(const char *zFrom, const char *zTo, int diffFlags){
-  int fromid;
-  int toid;
-  Blob from, to, out;
+static void append_diff_load(
+  const char *zFrom,
+  const char *zTo,
+  Blob *pFrom,
+  Blob *pTo
+){
   if( zFrom ){
-    fromid = uuid_to_rid(zFrom, 0);
-    content_get(fromid, &from);
+    content_get(uuid_to_rid(zFrom, 0), pFrom);
   }else{
-    blob_zero(&from);
+    blob_zero(pFrom);
   }
   if( zTo ){
-    toid = uuid_to_rid(zTo, 0);
-    content_get(toid, &to);
+    content_get(uuid_to_rid(zTo, 0), pTo);
   }else{
-    blob_zero(&to);
+    blob_zero(pTo);
   }
-  blob_zero(&out);
+}
+
+/*
+** Return the flags that append_diff_compute() passes to text_diff()
+** for diffFlags.  These are also the flags of the cached diff.
+*/
+static u64 append_diff_flags(u64 diffFlags){
+  if( diffFlags & DIFF_SIDEBYSIDE ){
+    return diffFlags | DIFF_HTML;
+  }else{
+    return diffFlags | DIFF_LINENO | DIFF_HTML;
+  }
+}
+
+/*
+** Compute the HTML difference between pFrom and pTo into pOut, which
+** must not be an arena blob.  This routine does not use the database
+** so that it can run on a worker thread.
+*/
+static void append_diff_compute(
+  Blob *pFrom,
+  Blob *pTo,
+  Blob *pOut,
+  u64 diffFlags
+){
+  text_diff(pFrom, pTo, pOut, append_diff_flags(diffFlags));
+}
+
+/*
+** Output the difference pOut computed by append_diff_compute().
+*/
+static void append_diff_output(Blob *pOut, u64 diffFlags){
   if( diffFlags & DIFF_SIDEBYSIDE ){
-    text_diff(&from, &to, &out, diffFlags | DIFF_HTML);
     @ <div class="sbsdiff">
-    @ %s(blob_str(&out))
+    @ %s(blob_str(pOut))
     @ </div>
   }else{
-    text_diff(&from, &to, &out, diffFlags | DIFF_LINENO | DIFF_HTML);
     @ <div class="udiff">
-    @ %s(blob_str(&out))
+    @ %s(blob_str(pOut))
     @ </div>
   }
-  blob_reset(&from);
-  blob_reset(&to);
+}
+
+/*
+** Append the difference between two RIDs to the output
+*/
+static void append_diff(const char *zFrom, const char *zTo, u64 diffFlags){
+  Blob from, to, out;
+  blob_zero_arena(&out);
+  if( !diff_cache_get(zFrom, zTo, append_diff_flags(diffFlags), &out) ){
+    append_diff_load(zFrom, zTo, &from, &to);
+    append_diff_compute(&from, &to, &out, diffFlags);
+    diff_cache_put(zFrom, zTo, append_diff_flags(diffFlags), &out);
+    blob_reset(&from);
+    blob_reset(&to);
+  }
+  append_diff_output(&out, diffFlags);
   blob_reset(&out);  
 }
 
@@ -298,8 +342,9 @@ static void append_file_change_line(
   const char *zOld,     /* blob.uuid before change.  NULL for added files */
   const char *zNew,     /* blob.uuid after change.  NULL for deletes */
   const char *zOldName, /* Prior name.  NULL if no name change. */
-  int diffFlags,        /* Flags for text_diff().  Zero to omit diffs */
-  int mperm             /* executable or symlink permission for zNew */
+  u64 diffFlags,        /* Flags for text_diff().  Zero to omit diffs */
+  int mperm,            /* executable or symlink permission for zNew */
+  Blob *pDiff           /* The diff if already computed, or NULL */
 ){
   if( !g.perm.History ){
     if( zNew==0 ){
@@ -316,7 +361,11 @@ static void append_file_change_line(
     }
     if( diffFlags ){
       @ <pre style="white-space:pre;">
-      append_diff(zOld, zNew, diffFlags);
+      if( pDiff ){
+        append_diff_output(pDiff, diffFlags);
+      }else{
+        append_diff(zOld, zNew, diffFlags);
+      }
       @ </pre>
     }
   }else{
@@ -342,7 +391,11 @@ static void append_file_change_line(
     }
     if( diffFlags ){
       @ <pre style="white-space:pre;">
-      append_diff(zOld, zNew, diffFlags);
+      if( pDiff ){
+        append_diff_output(pDiff, diffFlags);
+      }else{
+        append_diff(zOld, zNew, diffFlags);
+      }
       @ </pre>
     }else if( zOld && zNew && fossil_strcmp(zOld,zNew)!=0 ){
       @ &nbsp;&nbsp;
@@ -356,8 +409,8 @@ static void append_file_change_line(
 ** Construct an appropriate diffFlag for text_diff() based on query
 ** parameters and the to boolean arguments.
 */
-int construct_diff_flags(int showDiff, int sideBySide){
-  int diffFlags;
+u64 construct_diff_flags(int showDiff, int sideBySide){
+  u64 diffFlags;
   if( showDiff==0 ){
     diffFlags = 0;  /* Zero means do not show any diff */
   }else{
@@ -380,10 +433,33 @@ int construct_diff_flags(int showDiff, int sideBySide){
 
     /* The "noopt" parameter disables diff optimization */
     if( PD("noopt",0)!=0 ) diffFlags |= DIFF_NOOPT;
+
+    /* The "patience" parameter selects the patience diff algorithm */
+    if( PD("patience",0)!=0 ) diffFlags |= DIFF_PATIENCE;
+
+    /* Do not let a costly diff tie up the server */
+    diffFlags |= DIFF_BUDGET;
   }
   return diffFlags;
 }
 
+/*
+** Return the value of tag tagid on artifact rid, in memory obtained
+** from malloc(), or NULL if the tag has no value.
+*/
+static char *info_tag_value(int tagid, int rid){
+  Stmt q;
+  char *z = 0;
+  db_prepare(&q, "SELECT value FROM tagxref WHERE tagid=:tagid AND rid=:rid");
+  db_bind_int(&q, ":tagid", tagid);
+  db_bind_int(&q, ":rid", rid);
+  if( db_step(&q)==SQLITE_ROW ){
+    z = mprintf("%s", db_column_text(&q, 0));
+  }
+  db_finalize(&q);
+  return z;
+}
+
 
 /*
 ** WEBPAGE: vinfo
@@ -406,7 +482,7 @@ void ci_page(void){
   int isLeaf;
   int showDiff;        /* True to show diffs */
   int sideBySide;      /* True for side-by-side diffs */
-  int diffFlags;       /* Flag parameter for text_diff() */
+  u64 diffFlags;       /* Flag parameter for text_diff() */
   const char *zName;   /* Name of the checkin to be displayed */
   const char *zUuid;   /* UUID of zName */
   const char *zParent; /* UUID of the parent checkin (if any) */
@@ -448,12 +524,8 @@ void ci_page(void){
     style_header(zTitle);
     login_anonymous_available();
     free(zTitle);
-    zEUser = db_text(0,
-                   "SELECT value FROM tagxref WHERE tagid=%d AND rid=%d",
-                    TAG_USER, rid);
-    zEComment = db_text(0, 
-                   "SELECT value FROM tagxref WHERE tagid=%d AND rid=%d",
-                   TAG_COMMENT, rid);
+    zEUser = info_tag_value(TAG_USER, rid);
+    zEComment = info_tag_value(TAG_COMMENT, rid);
     zUser = db_column_text(&q, 2);
     zComment = db_column_text(&q, 3);
     zDate = db_column_text(&q,1);
@@ -610,7 +682,8 @@ void ci_page(void){
       const char *zOld = db_column_text(&q,2);
       const char *zNew = db_column_text(&q,3);
       const char *zOldName = db_column_text(&q, 4);
-      append_file_change_line(zName, zOld, zNew, zOldName, diffFlags, mperm);
+      append_file_change_line(zName, zOld, zNew, zOldName, diffFlags,
+                              mperm, 0);
     }
     db_finalize(&q);
   }
@@ -758,19 +831,65 @@ void checkin_description(int rid){
 }
 
 
+/*
+** One changed file on the /vdiff page.  The main thread loads the
+** content of the file, a worker thread computes the diff, and the main
+** thread outputs the results in order.
+*/
+typedef struct VdiffFile VdiffFile;
+struct VdiffFile {
+  const char *zName;     /* Name of the file */
+  const char *zOld;      /* UUID before the change.  NULL for added files */
+  const char *zNew;      /* UUID after the change.  NULL for deletes */
+  int mperm;             /* Executable or symlink permission for zNew */
+  u64 diffFlags;         /* Flags for text_diff().  Zero to omit the diff */
+  int isCached;          /* True if out was taken from the diff cache */
+  Blob from, to;         /* Content of zOld and zNew */
+  Blob out;              /* The diff, computed by a worker thread */
+};
+
+/*
+** Worker-thread half of vdiff_page().  Compute the diff of one file.
+*/
+static void vdiff_task(void *pArg){
+  VdiffFile *p = (VdiffFile*)pArg;
+  append_diff_compute(&p->from, &p->to, &p->out, p->diffFlags);
+}
+
+/*
+** The /vdiff page loads and diffs this many files at a time.
+*/
+#define VDIFF_BATCH  64
+
+/*
+** The /vdiff page stops showing diffs once the files it has diffed add
+** up to this many bytes.  The remaining files are listed with a link to
+** a page that continues the diffs from that point.
+*/
+#define VDIFF_MAX_CONTENT  20000000
+
 /*
 ** WEBPAGE: vdiff
 ** URL: /vdiff?from=UUID&amp;to=UUID&amp;detail=BOOLEAN;sbs=BOOLEAN
 **
-** Show all differences between two checkins.  
+** Show all differences between two checkins.  The optional "start=N"
+** query parameter skips the first N changed files.
 */
 void vdiff_page(void){
   int ridFrom, ridTo;
   int showDetail = 0;
   int sideBySide = 0;
-  int diffFlags = 0;
+  u64 diffFlags = 0;
   Manifest *pFrom, *pTo;
   ManifestFile *pFileFrom, *pFileTo;
+  VdiffFile *aFile = 0;  /* The changed files */
+  int nFile = 0;         /* Number of entries in aFile[] */
+  int nAlloc = 0;        /* Space allocated for aFile[] */
+  int iStart;            /* Index of the first file to show */
+  int iTrunc = -1;       /* Index of the first file not diffed, or -1 */
+  i64 nContent = 0;      /* Bytes of content diffed so far */
+  WorkPool *pPool;       /* Workers computing the diffs */
+  int i, j, n;
 
   login_check_credentials();
   if( !g.perm.Read ){ login_needed(); return; }
@@ -783,6 +902,8 @@ void vdiff_page(void){
   sideBySide = atoi(PD("sbs","1"));
   showDetail = atoi(PD("detail","0"));
   if( !showDetail && sideBySide ) showDetail = 1;
+  iStart = atoi(PD("start","0"));
+  if( iStart<0 ) iStart = 0;
   if( !sideBySide ){
     style_submenu_element("Side-by-side Diff", "sbsdiff",
                           "%s/vdiff?from=%T&to=%T&detail=%d&sbs=1",
@@ -799,6 +920,7 @@ void vdiff_page(void){
   checkin_description(ridTo);
   @ </blockquote><hr /><p>
 
+  /* Collect the changed files */
   manifest_file_rewind(pFrom);
   pFileFrom = manifest_file_next(pFrom, 0);
   manifest_file_rewind(pTo);
@@ -806,6 +928,7 @@ void vdiff_page(void){
   diffFlags = construct_diff_flags(showDetail, sideBySide);
   while( pFileFrom || pFileTo ){
     int cmp;
+    VdiffFile *p;
     if( pFileFrom==0 ){
       cmp = +1;
     }else if( pFileTo==0 ){
@@ -813,28 +936,94 @@ void vdiff_page(void){
     }else{
       cmp = fossil_strcmp(pFileFrom->zName, pFileTo->zName);
     }
-    if( cmp<0 ){
-      append_file_change_line(pFileFrom->zName, 
-                              pFileFrom->zUuid, 0, 0, 0, 0);
+    if( cmp==0 && fossil_strcmp(pFileFrom->zUuid, pFileTo->zUuid)==0 ){
+      /* No changes */
       pFileFrom = manifest_file_next(pFrom, 0);
-    }else if( cmp>0 ){
-      append_file_change_line(pFileTo->zName, 
-                              0, pFileTo->zUuid, 0, 0,
-                              manifest_file_mperm(pFileTo));
       pFileTo = manifest_file_next(pTo, 0);
-    }else if( fossil_strcmp(pFileFrom->zUuid, pFileTo->zUuid)==0 ){
-      /* No changes */
+      continue;
+    }
+    if( nFile>=nAlloc ){
+      nAlloc = nAlloc*2 + 100;
+      aFile = fossil_realloc(aFile, nAlloc*sizeof(aFile[0]));
+    }
+    p = &aFile[nFile++];
+    memset(p, 0, sizeof(*p));
+    if( cmp<0 ){
+      p->zName = pFileFrom->zName;
+      p->zOld = pFileFrom->zUuid;
       pFileFrom = manifest_file_next(pFrom, 0);
+    }else if( cmp>0 ){
+      p->zName = pFileTo->zName;
+      p->zNew = pFileTo->zUuid;
+      p->mperm = manifest_file_mperm(pFileTo);
       pFileTo = manifest_file_next(pTo, 0);
     }else{
-      append_file_change_line(pFileFrom->zName, 
-                              pFileFrom->zUuid,
-                              pFileTo->zUuid, 0, diffFlags,
-                              manifest_file_mperm(pFileTo));
+      p->zName = pFileFrom->zName;
+      p->zOld = pFileFrom->zUuid;
+      p->zNew = pFileTo->zUuid;
+      p->mperm = manifest_file_mperm(pFileTo);
+      p->diffFlags = diffFlags;
       pFileFrom = manifest_file_next(pFrom, 0);
       pFileTo = manifest_file_next(pTo, 0);
     }
   }
+  if( iStart>0 && iStart<nFile ){
+    @ <p>Showing changes starting with file %d(iStart+1) of %d(nFile).</p>
+  }
+
+  /* Diff each batch of files on the workers, then output it in order */
+  pPool = workpool_new(workpool_size(0));
+  for(i=iStart; i<nFile; i+=n){
+    n = nFile-i<VDIFF_BATCH ? nFile-i : VDIFF_BATCH;
+    for(j=i; j<i+n; j++){
+      VdiffFile *p = &aFile[j];
+      i64 sz;
+      blob_zero(&p->from);
+      blob_zero(&p->to);
+      blob_zero(&p->out);
+      if( p->diffFlags==0 ) continue;
+      if( iTrunc>=0 ){
+        p->diffFlags = 0;
+        continue;
+      }
+      sz = content_size(uuid_to_rid(p->zOld, 0), 0)
+         + content_size(uuid_to_rid(p->zNew, 0), 0);
+      if( nContent>0 && nContent+sz>VDIFF_MAX_CONTENT ){
+        iTrunc = j;
+        p->diffFlags = 0;
+        continue;
+      }
+      nContent += sz;
+      if( diff_cache_get(p->zOld, p->zNew, append_diff_flags(p->diffFlags),
+                         &p->out) ){
+        p->isCached = 1;
+        continue;
+      }
+      append_diff_load(p->zOld, p->zNew, &p->from, &p->to);
+      workpool_add(pPool, vdiff_task, p);
+    }
+    workpool_wait(pPool);
+    for(j=i; j<i+n; j++){
+      VdiffFile *p = &aFile[j];
+      if( j==iTrunc ){
+        @ <p><b>Diff truncated.</b>
+        cgi_printf("<a href=\"%s/vdiff?from=%T&amp;to=%T&amp;detail=%d"
+                   "&amp;sbs=%d&amp;start=%d\">Show more</a></p>\n",
+                   g.zTop, P("from"), P("to"), showDetail, sideBySide, j);
+      }
+      if( p->diffFlags && !p->isCached ){
+        diff_cache_put(p->zOld, p->zNew, append_diff_flags(p->diffFlags),
+                       &p->out);
+      }
+      append_file_change_line(p->zName, p->zOld, p->zNew, 0, p->diffFlags,
+                              p->mperm, &p->out);
+      blob_reset(&p->from);
+      blob_reset(&p->to);
+      blob_reset(&p->out);
+    }
+  }
+  workpool_delete(pPool);
+  free(aFile);
   manifest_destroy(pFrom);
   manifest_destroy(pTo);
 
@@ -1065,6 +1254,15 @@ void object_description(
 }
 
 
+/*
+** Output callback for text_diff_stream() that sends the diff text
+** to the client as it is generated.
+*/
+static void diff_page_stream(void *NotUsed, const char *z, int n){
+  cgi_append_content(z, n);
+  cgi_flush_content();
+}
+
 /*
 ** WEBPAGE: fdiff
 ** URL: fdiff?v1=UUID&v2=UUID&patch&sbs=BOOLEAN
@@ -1080,7 +1278,7 @@ void diff_page(void){
   Blob c1, c2, diff, *pOut;
   char *zV1;
   char *zV2;
-  int diffFlags;
+  u64 diffFlags;
   const char *zStyle = "sbsdiff";
 
   login_check_credentials();
@@ -1095,7 +1293,7 @@ void diff_page(void){
   if( isPatch ){
     pOut = cgi_output_blob();
     cgi_set_content_type("text/plain");
-    diffFlags = 4;
+    diffFlags = 4 | DIFF_BUDGET;
   }else{
     blob_zero(&diff);
     pOut = &diff;
@@ -1107,11 +1305,25 @@ void diff_page(void){
       zStyle = "udiff";
     }
   }
-  content_get(v1, &c1);
-  content_get(v2, &c2);
-  text_diff(&c1, &c2, pOut, diffFlags | DIFF_HTML );
-  blob_reset(&c1);
-  blob_reset(&c2);
+  if( !diff_cache_get(zV1, zV2, diffFlags | DIFF_HTML, pOut) ){
+    content_get(v1, &c1);
+    content_get(v2, &c2);
+    if( isPatch && blob_size(&c1)+blob_size(&c2)>DIFF_STREAM_SIZE ){
+      /* Too big to hold in memory or in the cache.  Send the patch
+      ** as it is computed. */
+      cgi_allow_incremental_reply();
+      text_diff_stream(&c1, &c2, diffFlags | DIFF_HTML, diff_page_stream, 0);
+    }else{
+      Blob d;
+      blob_zero(&d);
+      text_diff(&c1, &c2, &d, diffFlags | DIFF_HTML );
+      diff_cache_put(zV1, zV2, diffFlags | DIFF_HTML, &d);
+      blob_append(pOut, blob_buffer(&d), blob_size(&d));
+      blob_reset(&d);
+    }
+    blob_reset(&c1);
+    blob_reset(&c2);
+  }
   if( !isPatch ){
     style_header("Diff");
     style_submenu_element("Patch", "Patch", "%s/fdiff?v1=%T&v2=%T&patch",
@@ -1147,12 +1359,74 @@ void diff_page(void){
   }
 }
 
+/*
+** The part of a full-text artifact that rawartifact_stream() sends
+*/
+static struct {
+  int rid;               /* The artifact */
+  int iFirst;            /* Offset of the first byte to send */
+  int nByte;             /* Number of bytes to send */
+  int iOfst;             /* Offset of the next byte from content_stream_ex() */
+  FILE *out;             /* Where to send them */
+} rawStream;
+
+/*
+** xWrite callback for content_stream_ex() that sends the bytes of the
+** artifact that fall within the range of rawStream.
+*/
+static void rawartifact_write(void *pArg, const unsigned char *z, int n){
+  int iStart, iEnd;
+  if( z==0 ) return;
+  iStart = rawStream.iFirst - rawStream.iOfst;
+  iEnd = rawStream.iFirst + rawStream.nByte - rawStream.iOfst;
+  if( iStart<0 ) iStart = 0;
+  if( iEnd>n ) iEnd = n;
+  if( iEnd>iStart ) fwrite(&z[iStart], 1, iEnd-iStart, rawStream.out);
+  rawStream.iOfst += n;
+}
+
+/*
+** Write the body of a /raw reply for a full-text artifact.
+*/
+static void rawartifact_stream(void *pArg, FILE *out){
+  rawStream.iOfst = 0;
+  rawStream.out = out;
+  content_stream_ex(rawStream.rid, rawartifact_write, 0);
+}
+
+/*
+** Make the content of artifact rid the body of the reply, or just the
+** part of it that the Range header of the request asks for.  A
+** full-text artifact is copied from the repository as the reply is
+** sent, without first being held in memory.  The caller must set the
+** content type.  Return 0 if the content cannot be read.
+*/
+int deliver_artifact(int rid){
+  int sz;
+  Blob content;
+  if( (sz = content_stream_size(rid))>=0 ){
+    rawStream.rid = rid;
+    rawStream.iFirst = 0;
+    rawStream.nByte = sz;
+    if( cgi_byte_range(sz, &rawStream.iFirst, &rawStream.nByte)!=2 ){
+      cgi_set_content_stream(rawStream.nByte, rawartifact_stream, 0);
+    }
+    return 1;
+  }
+  if( content_get(rid, &content)==0 ) return 0;
+  cgi_set_content_ranged(&content);
+  return 1;
+}
+
 /*
 ** WEBPAGE: raw
 ** URL: /raw?name=ARTIFACTID&m=TYPE
 ** 
 ** Return the uninterpreted content of an artifact.  Used primarily
 ** to view artifacts that are images.
+**
+** Artifacts stored as full text are streamed out of the repository
+** without being loaded into memory.
 */
 void rawartifact_page(void){
   int rid;
@@ -1164,8 +1438,12 @@ void rawartifact_page(void){
   login_check_credentials();
   if( !g.perm.Read ){ login_needed(); return; }
   if( rid==0 ) fossil_redirect_home();
-  content_get(rid, &content);
   cgi_set_content_type(zMime);
+  if( fossil_strcmp(zMime, "application/x-fossil")!=0 ){
+    deliver_artifact(rid);
+    return;
+  }
+  content_get(rid, &content);
   cgi_set_content(&content);
 }
 
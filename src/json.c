@@ -245,6 +245,122 @@ static char const * json_err_cstr( int errCode ){
   }
 }
 
+/*
+** Allocator for cson, which allocates every value, string, key/value
+** pair and list separately and frees each one as its reference count
+** drops to zero.  Once json_main_bootstrap() has started a JSON
+** request, allocations of up to JSON_POOL_MAX bytes are carved from
+** large chunks and recycled through per-size free lists, so building
+** and freeing a response tree costs no malloc() or free() per node.
+** The chunks are released together by json_pool_release().
+**
+** Each block is preceded by a header holding its size class, or 0
+** for a block that came directly from fossil_malloc().
+*/
+#define JSON_POOL_GRAIN  16      /* Size classes are multiples of this */
+#define JSON_POOL_MAX    256     /* Largest pooled allocation */
+#define JSON_POOL_CHUNK  65536   /* Size of a chunk */
+
+typedef union JsonPoolHdr JsonPoolHdr;
+union JsonPoolHdr {
+  sqlite3_int64 iClass;          /* Size class.  0 if not pooled */
+  double rAlign;                 /* Alignment for the block body */
+  void *pAlign;
+};
+
+typedef struct JsonPoolChunk JsonPoolChunk;
+struct JsonPoolChunk {
+  JsonPoolChunk *pNext;          /* Next chunk in the list */
+  JsonPoolHdr aAlign[1];         /* Blocks start here */
+};
+
+static struct {
+  int isActive;                  /* True between start and release */
+  JsonPoolChunk *pChunk;         /* All chunks, most recent first */
+  char *zAvail;                  /* Unused space in pChunk */
+  size_t nAvail;                 /* Bytes available at zAvail */
+  void *aFree[JSON_POOL_MAX/JSON_POOL_GRAIN+1];  /* Free lists by class */
+} jsonPool;
+
+/*
+** Start pooling cson allocations.
+*/
+static void json_pool_start(void){
+  jsonPool.isActive = 1;
+}
+
+/*
+** Release all pooled memory.  Every pooled cson value must already
+** have been freed.
+*/
+void json_pool_release(void){
+  JsonPoolChunk *p, *pNext;
+  for(p=jsonPool.pChunk; p; p=pNext){
+    pNext = p->pNext;
+    fossil_free(p);
+  }
+  memset(&jsonPool, 0, sizeof(jsonPool));
+}
+
+/*
+** The allocation routines cson uses in CSON_FOSSIL_MODE.
+*/
+void *json_pool_malloc(size_t n){
+  JsonPoolHdr *pHdr;
+  if( !jsonPool.isActive || n>JSON_POOL_MAX ){
+    pHdr = fossil_malloc(sizeof(JsonPoolHdr)+n);
+    pHdr->iClass = 0;
+  }else{
+    int iClass = n ? (int)(n+JSON_POOL_GRAIN-1)/JSON_POOL_GRAIN : 1;
+    if( jsonPool.aFree[iClass] ){
+      pHdr = (JsonPoolHdr*)jsonPool.aFree[iClass] - 1;
+      jsonPool.aFree[iClass] = *(void**)jsonPool.aFree[iClass];
+    }else{
+      size_t nBlock = sizeof(JsonPoolHdr) + iClass*JSON_POOL_GRAIN;
+      if( jsonPool.nAvail<nBlock ){
+        JsonPoolChunk *pNew = fossil_malloc(JSON_POOL_CHUNK);
+        pNew->pNext = jsonPool.pChunk;
+        jsonPool.pChunk = pNew;
+        jsonPool.zAvail = (char*)pNew->aAlign;
+        jsonPool.nAvail = JSON_POOL_CHUNK - (jsonPool.zAvail - (char*)pNew);
+      }
+      pHdr = (JsonPoolHdr*)jsonPool.zAvail;
+      jsonPool.zAvail += nBlock;
+      jsonPool.nAvail -= nBlock;
+    }
+    pHdr->iClass = iClass;
+  }
+  return (void*)(pHdr+1);
+}
+void json_pool_free(void *p){
+  JsonPoolHdr *pHdr;
+  if( p==0 ) return;
+  pHdr = (JsonPoolHdr*)p - 1;
+  if( pHdr->iClass==0 ){
+    fossil_free(pHdr);
+  }else{
+    *(void**)p = jsonPool.aFree[pHdr->iClass];
+    jsonPool.aFree[pHdr->iClass] = p;
+  }
+}
+void *json_pool_realloc(void *p, size_t n){
+  JsonPoolHdr *pHdr;
+  void *pNew;
+  size_t nOld;
+  if( p==0 ) return json_pool_malloc(n);
+  pHdr = (JsonPoolHdr*)p - 1;
+  if( pHdr->iClass==0 ){
+    pHdr = fossil_realloc(pHdr, sizeof(JsonPoolHdr)+n);
+    return (void*)(pHdr+1);
+  }
+  nOld = pHdr->iClass*JSON_POOL_GRAIN;
+  if( n<=nOld ) return p;
+  pNew = json_pool_malloc(n);
+  memcpy(pNew, p, nOld);
+  json_pool_free(p);
+  return pNew;
+}
+
 /*
 ** Implements the cson_data_dest_f() interface and outputs the data to
 ** a fossil Blob object.  pState must be-a initialized (Blob*), to
@@ -692,6 +808,189 @@ char const * json_guess_content_type(){
   }
 }
 
+/*
+** A JSON array whose elements are generated and written one at a
+** time while the response is being sent, so that a large result never
+** has to be held in memory as a single cson tree.  See
+** json_stream_array().
+*/
+static struct {
+  cson_value *(*xRow)(void*);   /* Return the next element, or NULL */
+  void (*xDone)(void*);         /* Release pArg.  May be NULL */
+  void *pArg;                   /* Argument to xRow() and xDone() */
+  char *zMarker;                /* Quoted placeholder in the response */
+  char *zIndent;                /* Indentation of the placeholder */
+  int bNoStream;                /* True to collect arrays immediately */
+} jsonStream;
+
+/*
+** Discard the streamed array, if any, without sending it.
+*/
+static void json_stream_reset(void){
+  void (*xDone)(void*) = jsonStream.xDone;
+  void *pArg = jsonStream.pArg;
+  fossil_free(jsonStream.zMarker);
+  fossil_free(jsonStream.zIndent);
+  jsonStream.xRow = 0;
+  jsonStream.xDone = 0;
+  jsonStream.pArg = 0;
+  jsonStream.zMarker = 0;
+  jsonStream.zIndent = 0;
+  if( xDone ) xDone(pArg);
+}
+
+/*
+** Returns a placeholder value which stands for an array whose
+** elements are produced by calls to xRow(pArg) while the response is
+** sent.  xRow() returns a new value, which is freed once it has been
+** written, or NULL when there are no more elements.  xDone(pArg), if
+** not NULL, is called after the last element or when the response is
+** discarded.
+**
+** The caller puts the returned value wherever the array belongs in
+** the payload, exactly as it would an ordinary array.  Only one array
+** per response is streamed.  If a streamed array is already pending,
+** or while /json/batch runs its sub-requests, the elements are
+** collected into an ordinary array immediately.
+*/
+cson_value * json_stream_array(cson_value *(*xRow)(void*),
+                               void (*xDone)(void*), void *pArg){
+  cson_value *pV;
+  if( jsonStream.xRow || jsonStream.bNoStream ){
+    cson_array *a = cson_new_array();
+    while( (pV = xRow(pArg))!=0 ){
+      cson_array_append(a, pV);
+    }
+    if( xDone ) xDone(pArg);
+    return cson_array_value(a);
+  }else{
+    unsigned char aRand[8];
+    char zHex[17];
+    sqlite3_randomness(sizeof(aRand), aRand);
+    encode16(aRand, (unsigned char*)zHex, sizeof(aRand));
+    jsonStream.xRow = xRow;
+    jsonStream.xDone = xDone;
+    jsonStream.pArg = pArg;
+    jsonStream.zMarker = mprintf("fossil-stream-%s", zHex);
+    return json_new_string(jsonStream.zMarker);
+  }
+}
+
+/*
+** Write n bytes of z to the response: the CGI content in HTTP mode,
+** stdout in CLI mode.
+*/
+static void json_stream_out(const char *z, int n){
+  if( n<=0 ) return;
+  if( g.isHTTP ){
+    cgi_append_content(z, n);
+  }else{
+    fwrite(z, 1, n, stdout);
+  }
+}
+
+/*
+** Implements the cson_data_dest_f() interface for one element of a
+** streamed array.  Every newline is followed by the indentation of
+** the element, so that indented output lines up with the rest of the
+** response.
+*/
+static int json_stream_dest(void *pState, void const *src, unsigned int n){
+  const char *z = (const char*)src;
+  unsigned int i, j;
+  for(i=j=0; i<n; i++){
+    if( z[i]=='\n' ){
+      json_stream_out(&z[j], i+1-j);
+      json_stream_out(jsonStream.zIndent, strlen(jsonStream.zIndent));
+      j = i+1;
+    }
+  }
+  json_stream_out(&z[j], n-j);
+  return 0;
+}
+
+/*
+** Write the elements of the streamed array, with the same layout
+** cson_output() gives an ordinary array.  The array is zIndent deep
+** in the response.
+*/
+static void json_stream_rows(const char *zIndent){
+  cson_output_opt opt = g.json.outOpt;
+  cson_value *pRow, *pNext;
+  const char *zSep;
+  int doIndent = opt.indentation!=0;
+  opt.addNewline = 0;
+  pRow = jsonStream.xRow(jsonStream.pArg);
+  if( pRow==0 ){
+    json_stream_out("[]", 2);
+    return;
+  }
+  pNext = jsonStream.xRow(jsonStream.pArg);
+  if( pNext==0 && !opt.indentSingleMemberValues ) doIndent = 0;
+  if( opt.indentation ){
+    /* Nested lines are indented one level deeper than zIndent, even
+    ** when a single element is not put on a line of its own. */
+    char c = opt.indentation==1 ? '\t' : ' ';
+    int n = opt.indentation==1 ? 1 : opt.indentation;
+    jsonStream.zIndent = mprintf("%s%.*c", zIndent, n, c);
+  }else{
+    jsonStream.zIndent = fossil_strdup("");
+  }
+  zSep = doIndent ? "\n" : " ";
+  json_stream_out("[", 1);
+  if( doIndent ) json_stream_dest(0, "\n", 1);
+  while( pRow ){
+    cson_output(pRow, json_stream_dest, 0, &opt);
+    cson_value_free(pRow);
+    pRow = pNext;
+    if( pRow ){
+      json_stream_out(",", 1);
+      json_stream_dest(0, zSep, 1);
+      pNext = jsonStream.xRow(jsonStream.pArg);
+    }
+    if( g.isHTTP ) cgi_flush_content();
+  }
+  if( doIndent ){
+    json_stream_out("\n", 1);
+    json_stream_out(zIndent, strlen(zIndent));
+  }
+  json_stream_out("]", 1);
+}
+
+/*
+** Write pResponse, in which the placeholder returned by
+** json_stream_array() is replaced by the elements of the streamed
+** array as they are generated.
+*/
+static void json_send_streamed(cson_value const * pResponse){
+  cson_output_opt opt = g.json.outOpt;
+  Blob out = empty_blob;
+  char *zQuoted = mprintf("\"%s\"", jsonStream.zMarker);
+  const char *z;
+  const char *zAt;
+  if( !g.isHTTP ) opt.addNewline = 1;  /* As cson_output_FILE() does */
+  cson_output_Blob(pResponse, &out, &opt);
+  z = blob_str(&out);
+  zAt = strstr(z, zQuoted);
+  if( zAt==0 ){
+    json_stream_out(z, blob_size(&out));
+  }else{
+    const char *zLine = zAt;
+    char *zIndent;
+    while( zLine>z && zLine[-1]!='\n' ) zLine--;
+    zIndent = mprintf("%.*s", (int)(zAt-zLine), zLine);
+    zIndent[strspn(zIndent, " \t")] = 0;
+    if( g.isHTTP ) cgi_allow_incremental_reply();
+    json_stream_out(z, (int)(zAt-z));
+    json_stream_rows(zIndent);
+    z = zAt + strlen(zQuoted);
+    json_stream_out(z, strlen(z));
+    fossil_free(zIndent);
+  }
+  fossil_free(zQuoted);
+  blob_reset(&out);
+}
+
 /*
 ** Sends pResponse to the output stream as the response object.  This
 ** function does no validation of pResponse except to assert() that it
@@ -705,6 +1004,9 @@ char const * json_guess_content_type(){
 ** If g.json.jsonp is not NULL then the content type is set to
 ** application/javascript and the output is wrapped in a jsonp
 ** wrapper.
+**
+** If the payload contains an array from json_stream_array(), its
+** elements are generated and written here.
 */
 void json_send_response( cson_value const * pResponse ){
   assert( NULL != pResponse );
@@ -713,7 +1015,11 @@ void json_send_response( cson_value const * pResponse ){
     if( g.json.jsonp ){
       cgi_printf("%s(",g.json.jsonp);
     }
-    cson_output( pResponse, cson_data_dest_cgi, NULL, &g.json.outOpt );
+    if( jsonStream.xRow ){
+      json_send_streamed(pResponse);
+    }else{
+      cson_output( pResponse, cson_data_dest_cgi, NULL, &g.json.outOpt );
+    }
     if( g.json.jsonp ){
       cgi_append_content(")",1);
     }
@@ -721,11 +1027,16 @@ void json_send_response( cson_value const * pResponse ){
     if( g.json.jsonp ){
       fprintf(stdout,"%s(",g.json.jsonp);
     }
-    cson_output_FILE( pResponse, stdout, &g.json.outOpt );
+    if( jsonStream.xRow ){
+      json_send_streamed(pResponse);
+    }else{
+      cson_output_FILE( pResponse, stdout, &g.json.outOpt );
+    }
     if( g.json.jsonp ){
       fwrite(")\n", 2, 1, stdout);
     }
   }
+  json_stream_reset();
 }
 
 /*
@@ -810,6 +1121,7 @@ cson_value * json_req_payload_get(char const *pKey){
 void json_main_bootstrap(){
   cson_value * v;
   assert( (NULL == g.json.gc.v) && "cgi_json_bootstrap() was called twice!" );
+  json_pool_start();
 
   /* g.json.gc is our "garbage collector" - where we put JSON values
      which need a long lifetime but don't have a logical parent to put
@@ -1646,6 +1958,7 @@ void json_err( int code, char const * msg, char alsoOutput ){
       if( g.json.jsonp ){
         cgi_append_content(")",1);
       }
+      json_stream_reset();
     }
   }else{
     json_send_response(resp);
@@ -2248,6 +2561,10 @@ cson_value * json_page_user();
 cson_value * json_page_config();
 /* Impl in json_finfo.c. */
 cson_value * json_page_finfo();
+/* Impl in json_changes.c. */
+cson_value * json_page_changes();
+/* Impl below. */
+static cson_value * json_page_batch();
 
 /*
 ** Mapping of names to JSON pages/commands.  Each name is a subpath of
@@ -2257,8 +2574,10 @@ static const JsonPageDef JsonPageDefs[] = {
 /* please keep alphabetically sorted (case-insensitive) for maintenance reasons. */
 {"anonymousPassword", json_page_anon_password, 0},
 {"artifact", json_page_artifact, 0},
+{"batch", json_page_batch, 0},
 {"branch", json_page_branch,0},
 {"cap", json_page_cap, 0},
+{"changes", json_page_changes, 0},
 {"config", json_page_config, 0 },
 {"diff", json_page_diff, 0},
 {"dir", json_page_dir, 0},
@@ -2284,40 +2603,159 @@ static const JsonPageDef JsonPageDefs[] = {
 };
 
 /*
-** Internal helper for json_cmd_top() and json_page_top().
-**
-** Searches JsonPageDefs for a command with the given name. If found,
-** it is used to generate and output a JSON response. If not found, it
-** generates a JSON-style error response. Returns 0 on success, non-0
-** on error. On error it will set g.json's error state.
+** Runs the root-level command zCommand from JsonPageDefs and returns
+** its payload, or NULL.  If the command is unknown or may not be run
+** in the current mode, *pRc is set to the error code and g.json's
+** error state is set.  Otherwise *pRc is set to 0.
 */
-static int json_dispatch_root_command( char const * zCommand ){
-  int rc = 0;
-  cson_value * payload = NULL;
+static cson_value * json_run_root_command( char const * zCommand, int *pRc ){
   JsonPageDef const * pageDef = NULL;
   pageDef = json_handler_for_name(zCommand,&JsonPageDefs[0]);
+  *pRc = 0;
   if( ! pageDef ){
-    rc = FSL_JSON_E_UNKNOWN_COMMAND;
-    json_set_err( rc, "Unknown command: %s", zCommand );
+    *pRc = FSL_JSON_E_UNKNOWN_COMMAND;
+    json_set_err( *pRc, "Unknown command: %s", zCommand );
   }else if( pageDef->runMode < 0 /*CLI only*/){
-    rc = FSL_JSON_E_WRONG_MODE;
+    *pRc = FSL_JSON_E_WRONG_MODE;
   }else if( (g.isHTTP && (pageDef->runMode < 0 /*CLI only*/))
             ||
             (!g.isHTTP && (pageDef->runMode > 0 /*HTTP only*/))
             ){
-    rc = FSL_JSON_E_WRONG_MODE;
+    *pRc = FSL_JSON_E_WRONG_MODE;
   }
   else{
-    rc = 0;
     g.json.dispatchDepth = 1;
-    payload = (*pageDef->func)();
+    return (*pageDef->func)();
   }
+  return NULL;
+}
+
+/*
+** Internal helper for json_cmd_top() and json_page_top().
+**
+** Searches JsonPageDefs for a command with the given name. If found,
+** it is used to generate and output a JSON response. If not found, it
+** generates a JSON-style error response. Returns 0 on success, non-0
+** on error. On error it will set g.json's error state.
+*/
+static int json_dispatch_root_command( char const * zCommand ){
+  int rc = 0;
+  cson_value * payload = NULL;
+  payload = json_run_root_command(zCommand, &rc);
   payload = json_create_response(rc, NULL, payload);
   json_send_response(payload);
   cson_value_free(payload);
   return rc;
 }
 
+/*
+** Impl of /json/batch.
+**
+** The request payload is an array of sub-requests, each an object
+** with the "command", "payload" and "requestId" properties of an
+** ordinary request.  The sub-requests run in order in this process,
+** inside a single transaction, so the repository is opened and the
+** user logged in only once for all of them.  The response payload is
+** an array holding the response envelope of each sub-request, in the
+** same order.  A failed sub-request gets an error envelope and does
+** not stop the others.
+**
+** Options missing from a sub-request's payload are looked up in the
+** batch request, as they would be for an ordinary request.
+*/
+static cson_value * json_page_batch(){
+  cson_array * pReqs = cson_value_get_array(g.json.reqPayload.v);
+  cson_array * pOut;
+  unsigned int i, n;
+  /* Per-request state, restored once the batch is done. */
+  cson_value * cmdV = g.json.cmd.v;
+  cson_array * cmdA = g.json.cmd.a;
+  int cmdOffset = g.json.cmd.offset;
+  char const * zCmdStr = g.json.cmd.commandStr;
+  cson_value * reqV = g.json.reqPayload.v;
+  cson_object * reqO = g.json.reqPayload.o;
+  cson_value * warnV = g.json.warnings.v;
+  cson_array * warnA = g.json.warnings.a;
+
+  if( !pReqs ){
+    json_set_err(FSL_JSON_E_MISSING_ARGS,
+                 "Batch payload must be an array of requests.");
+    return NULL;
+  }
+  pOut = cson_new_array();
+  n = cson_array_length_get(pReqs);
+  /* A sub-request's arrays must be complete before the next one runs,
+  ** since they may be read from the same temporary tables. */
+  jsonStream.bNoStream = 1;
+  db_begin_transaction();
+  for(i=0; i<n; ++i){
+    cson_object * pSub = cson_value_get_object(cson_array_get(pReqs,i));
+    char const * zCmd = NULL;
+    char const * zRoot;
+    cson_value * payload = NULL;
+    cson_value * resp;
+    int rc = 0;
+    if( pSub ){
+      zCmd = cson_value_get_cstr(cson_object_get(pSub,"command"));
+    }
+    g.json.resultCode = 0;
+    free(g.zErrMsg);
+    g.zErrMsg = NULL;
+    g.json.warnings.v = NULL;
+    g.json.warnings.a = NULL;
+    g.json.cmd.v = cson_value_new_array();
+    g.json.cmd.a = cson_value_get_array(g.json.cmd.v);
+    g.json.cmd.offset = 0;
+    g.json.cmd.commandStr = zCmd;
+    g.json.reqPayload.v = pSub ? cson_object_get(pSub,"payload") : NULL;
+    g.json.reqPayload.o = cson_value_get_object(g.json.reqPayload.v);
+    g.json.dispatchDepth = 0;
+    cson_array_append(g.json.cmd.a, json_new_string("json"));
+    if( zCmd ){
+      json_string_split(zCmd, '/', 0, g.json.cmd.a);
+    }
+    zRoot = json_command_arg(1);
+    if( !zRoot || !*zRoot ){
+      rc = FSL_JSON_E_MISSING_ARGS;
+      json_set_err(rc, "Sub-request #%u has no command.", i);
+    }else if( 0==fossil_strcmp(zRoot,"batch") ){
+      rc = FSL_JSON_E_INVALID_ARGS;
+      json_set_err(rc, "Batches cannot be nested.");
+    }else{
+      payload = json_run_root_command(zRoot, &rc);
+    }
+    resp = json_create_response(rc, NULL, payload);
+    if( resp ){
+      cson_object * o = cson_value_get_object(resp);
+      cson_value * reqId = pSub
+        ? cson_object_get(pSub, FossilJsonKeys.requestId) : NULL;
+      if( reqId ){
+        cson_object_set(o, FossilJsonKeys.requestId, reqId);
+      }else{
+        cson_object_unset(o, FossilJsonKeys.requestId);
+      }
+      cson_array_append(pOut, resp);
+    }
+    cson_value_free(g.json.cmd.v);
+  }
+  db_end_transaction(0);
+  jsonStream.bNoStream = 0;
+
+  g.json.cmd.v = cmdV;
+  g.json.cmd.a = cmdA;
+  g.json.cmd.offset = cmdOffset;
+  g.json.cmd.commandStr = zCmdStr;
+  g.json.reqPayload.v = reqV;
+  g.json.reqPayload.o = reqO;
+  g.json.warnings.v = warnV;
+  g.json.warnings.a = warnA;
+  g.json.resultCode = 0;
+  free(g.zErrMsg);
+  g.zErrMsg = NULL;
+  g.json.dispatchDepth = 1;
+  return cson_array_value(pOut);
+}
+
 #ifdef FOSSIL_ENABLE_JSON /* dupe ifdef needed for mkindex */
 /*
 ** WEBPAGE: json
@@ -2358,8 +2796,10 @@ void json_page_top(void){
 **
 **   anonymousPassord
 **   artifact
+**   batch
 **   branch
 **   cap
+**   changes
 **   diff
 **   g
 **   login
@@ -0,0 +1,162 @@
+#ifdef FOSSIL_ENABLE_JSON
+/*
+** Copyright (c) 2011 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+**
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*/
+#include "VERSION.h"
+#include "config.h"
+#include "json_changes.h"
+
+#if INTERFACE
+#include "json_detail.h"
+#endif
+
+/*
+** Longest time, in seconds, that /json/changes waits for a change.
+*/
+#define JSON_CHANGES_MAX_WAIT 60
+
+/*
+** Implements the /json/changes page/command.
+**
+** Returns the artifacts crosslinked since the point named by the
+** "since" token, oldest first, and a new token to pass as "since" on
+** the next call.  This lets a polling client do work in proportion to
+** what changed rather than refetching a whole timeline.  Options:
+**
+**   since=TOKEN    A token from an earlier response.  Without it, no
+**                  changes are returned, only the current token.
+**   limit=N        Return at most N changes (default 100, at most
+**                  1000).  "more" is true if further changes remain.
+**   wait=SECONDS   If there are no changes yet, wait up to this long
+**                  (at most 60) for one to arrive.
+**
+** A token cannot be honored once the change log has been recreated,
+** for example by a rebuild.  Then "reset" is true, and the client must
+** refetch whatever it mirrors before polling from the new token.
+*/
+cson_value * json_page_changes(){
+  cson_object * pay = NULL;
+  cson_array * changes = NULL;
+  char const * zSince = NULL;
+  char * zEpoch = NULL;
+  int limit;
+  int nWait;
+  int iSince = -1;
+  int mxSeq;
+  int nRow = 0;
+  int isReset = 0;
+  int hasMore = 0;
+  Stmt q = empty_Stmt;
+  if(!g.perm.Read){
+    json_set_err(FSL_JSON_E_DENIED,"Requires 'o' privileges.");
+    return NULL;
+  }
+  if( !xlinklog_exists() && !xlinklog_create() ){
+    json_set_err(FSL_JSON_E_DB,
+                 "The change log cannot be created in this repository.");
+    return NULL;
+  }
+  zSince = json_find_option_cstr("since",NULL,"s");
+  limit = json_find_option_int("limit",NULL,"n",100);
+  if( limit<=0 ) limit = 100;
+  if( limit>1000 ) limit = 1000;
+  nWait = json_find_option_int("wait",NULL,"w",0);
+  if( nWait>JSON_CHANGES_MAX_WAIT ) nWait = JSON_CHANGES_MAX_WAIT;
+  if( !sqlite3_get_autocommit(g.db) ){
+    /* Inside a transaction (e.g. /json/batch) new changes would
+    ** never become visible, and writers would be held up. */
+    nWait = 0;
+  }
+  zEpoch = db_get("xlinklog-epoch", "");
+  mxSeq = db_int(0, "SELECT max(seq) FROM xlinklog");
+  if( zSince ){
+    int n = strlen(zEpoch);
+    char *zEnd = 0;
+    if( strncmp(zSince, zEpoch, n)==0 && zSince[n]==':' ){
+      long v = strtol(&zSince[n+1], &zEnd, 10);
+      if( zEnd!=&zSince[n+1] && *zEnd==0 && v>=0 && v<=mxSeq ){
+        iSince = (int)v;
+      }
+    }
+    if( iSince<0 ) isReset = 1;
+  }
+
+  pay = cson_new_object();
+  changes = cson_new_array();
+  while( iSince>=0 ){
+    db_prepare(&q,
+      "SELECT x.seq, b.uuid, e.type,"
+      "       cast(strftime('%%s',e.mtime) AS INTEGER),"
+      "       coalesce(e.euser, e.user),"
+      "       coalesce(e.ecomment, e.comment)"
+      "  FROM xlinklog x JOIN blob b ON b.rid=x.rid"
+      "       LEFT JOIN event e ON e.objid=x.rid"
+      " WHERE x.seq>%d AND x.seq<=%d"
+      "   AND (e.type IS NULL OR e.type NOT IN ('w','t')"
+      "        OR (e.type='w' AND %d) OR (e.type='t' AND %d))"
+      " ORDER BY x.seq",
+      iSince, mxSeq, g.perm.RdWiki, g.perm.RdTkt
+    );
+    while( db_step(&q)==SQLITE_ROW ){
+      cson_object * row;
+      char const * zType = db_column_text(&q,2);
+      if( nRow>=limit ){
+        hasMore = 1;
+        break;
+      }
+      row = cson_new_object();
+      cson_array_append( changes, cson_object_value(row) );
+      nRow++;
+      iSince = db_column_int(&q,0);
+      cson_object_set(row, "seq", json_new_int(iSince));
+      cson_object_set(row, "uuid", json_new_string(db_column_text(&q,1)));
+      if( zType==0 ){
+        zType = "artifact";
+      }else if( 0==strcmp(zType,"ci") ){
+        zType = "checkin";
+      }else if( 0==strcmp(zType,"w") ){
+        zType = "wiki";
+      }else if( 0==strcmp(zType,"t") ){
+        zType = "ticket";
+      }else if( 0==strcmp(zType,"g") ){
+        zType = "tag";
+      }else if( 0==strcmp(zType,"e") ){
+        zType = "event";
+      }
+      cson_object_set(row, "type", json_new_string(zType));
+      if( db_column_text(&q,2)!=0 ){
+        cson_object_set(row, "mtime", json_new_int(db_column_int(&q,3)));
+        cson_object_set(row, "user", json_new_string(db_column_text(&q,4)));
+        cson_object_set(row, "comment",
+                        json_new_string(db_column_text(&q,5)));
+      }
+    }
+    db_finalize(&q);
+    if( !hasMore ) iSince = mxSeq;
+    if( nRow>0 || nWait<=0 ) break;
+    sqlite3_sleep(1000);
+    nWait--;
+    mxSeq = db_int(0, "SELECT max(seq) FROM xlinklog");
+  }
+  if( iSince<0 ) iSince = mxSeq;
+  cson_object_set(pay, "token", json_new_string_f("%s:%d", zEpoch, iSince));
+  cson_object_set(pay, "reset", cson_value_new_bool(isReset));
+  cson_object_set(pay, "more", cson_value_new_bool(hasMore));
+  cson_object_set(pay, "changes", cson_array_value(changes));
+  return cson_object_value(pay);
+}
+
+#endif /* FOSSIL_ENABLE_JSON */
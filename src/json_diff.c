@@ -39,8 +39,8 @@ cson_value * json_generate_diff(const char *zFrom, const char *zTo,
   int outLen;
   Blob from = empty_blob, to = empty_blob, out = empty_blob;
   cson_value * rc = NULL;
-  int flags = (DIFF_CONTEXT_MASK & nContext)
-      | (fSbs ? DIFF_SIDEBYSIDE : 0);
+  u64 flags = (DIFF_CONTEXT_MASK & nContext)
+      | (fSbs ? DIFF_SIDEBYSIDE : 0) | DIFF_BUDGET;
   fromid = name_to_typed_rid(zFrom, "*");
   if(fromid<=0){
       json_set_err(FSL_JSON_E_UNRESOLVED_UUID,
@@ -43,17 +43,63 @@ static char const * json_dir_path_extra(){
   return zP;
 }
 
+/*
+** State of the /json/dir "entries" array while it is streamed.
+*/
+typedef struct JsonDirStream JsonDirStream;
+struct JsonDirStream {
+  Stmt q;                   /* Names (and UUIDs) from localfiles */
+  int hasUuid;              /* True if q has a uuid column */
+  int hasRow;               /* True if q holds a row not yet returned */
+  cson_string * zKeyName;   /* Shared key strings */
+  cson_string * zKeyUuid;
+  cson_string * zKeyIsDir;
+};
+
+/*
+** json_stream_array() callbacks for the /json/dir entries.
+*/
+static cson_value * json_dir_entry_row(void *pArg){
+  JsonDirStream *p = (JsonDirStream*)pArg;
+  cson_object * zEntry;
+  cson_value * name = NULL;
+  char const * n;
+  char const * u;
+  if( !p->hasRow && SQLITE_ROW!=db_step(&p->q) ){
+    return NULL;
+  }
+  p->hasRow = 0;
+  n = db_column_text(&p->q,0);
+  u = p->hasUuid ? db_column_text(&p->q,1) : NULL;
+  zEntry = cson_new_object();
+  if('/'==*n){
+    name = json_new_string( n+1 );
+    cson_object_set_s(zEntry, p->zKeyIsDir, cson_value_true() );
+  } else{
+    name = json_new_string( n );
+  }
+  if(u && *u){
+    cson_object_set_s(zEntry, p->zKeyUuid, json_new_string( u ) );
+  }
+  cson_object_set_s(zEntry, p->zKeyName, name );
+  return cson_object_value(zEntry);
+}
+static void json_dir_entry_done(void *pArg){
+  JsonDirStream *p = (JsonDirStream*)pArg;
+  db_finalize(&p->q);
+  cson_value_free( cson_string_value( p->zKeyName  ) );
+  cson_value_free( cson_string_value( p->zKeyUuid  ) );
+  cson_value_free( cson_string_value( p->zKeyIsDir  ) );
+  fossil_free(p);
+}
+
 /*
 ** Impl of /json/dir. 98% of it was taken directly
 ** from browse.c::page_dir()
 */
 static cson_value * json_page_dir_list(){
   cson_object * zPayload = NULL;
-  cson_array * zEntries = NULL;
-  cson_object * zEntry = NULL;
-  cson_string * zKeyName = NULL;
-  cson_string * zKeyIsDir = NULL;
-  cson_string * zKeyUuid = NULL;
+  JsonDirStream * pStream = NULL;
   char * zD = NULL;
   char const * zDX = NULL;
   cson_value const * zDV = NULL;
@@ -61,7 +107,6 @@ static cson_value * json_page_dir_list(){
   char * zUuid = NULL;
   char const * zCI = NULL;
   Manifest * pM = NULL;
-  Stmt q = empty_Stmt;
   int rid = 0;
   char * zPrefix = NULL;
   if( !g.perm.History ){
@@ -123,6 +168,7 @@ static cson_value * json_page_dir_list(){
   ** from directories in the loop that follows.
   */
   db_multi_exec(
+     "DROP TABLE IF EXISTS localfiles;"
      "CREATE TEMP TABLE localfiles(x UNIQUE NOT NULL %s, u);",
      filename_collation()
   );
@@ -183,57 +229,43 @@ static cson_value * json_page_dir_list(){
     );
   }
 
+  pStream = fossil_malloc(sizeof(*pStream));
+  memset(pStream, 0, sizeof(*pStream));
   if(zCI){
-    db_prepare( &q, "SELECT x as name, u as uuid  FROM localfiles ORDER BY x");
+    db_prepare( &pStream->q, "SELECT x as name, u as uuid  FROM localfiles ORDER BY x");
   }else{/* UUIDs are all NULL. */
-    db_prepare( &q, "SELECT x as name FROM localfiles ORDER BY x");
+    db_prepare( &pStream->q, "SELECT x as name FROM localfiles ORDER BY x");
   }
+  pStream->hasUuid = zCI!=0;
 
-  zKeyName = cson_new_string("name",4);
-  cson_value_add_reference( cson_string_value(zKeyName) );
-  zKeyUuid = cson_new_string("uuid",4);
-  cson_value_add_reference( cson_string_value(zKeyUuid) );
-  zKeyIsDir = cson_new_string("isDir",5);
-  cson_value_add_reference( cson_string_value(zKeyIsDir) );
+  pStream->zKeyName = cson_new_string("name",4);
+  cson_value_add_reference( cson_string_value(pStream->zKeyName) );
+  pStream->zKeyUuid = cson_new_string("uuid",4);
+  cson_value_add_reference( cson_string_value(pStream->zKeyUuid) );
+  pStream->zKeyIsDir = cson_new_string("isDir",5);
+  cson_value_add_reference( cson_string_value(pStream->zKeyIsDir) );
 
   zPayload = cson_new_object();
-  cson_object_set_s( zPayload, zKeyName, json_new_string((zD&&*zD) ? zD : "/") );
+  cson_object_set_s( zPayload, pStream->zKeyName, json_new_string((zD&&*zD) ? zD : "/") );
   if(zUuid){
-    cson_object_set_s( zPayload, zKeyUuid, cson_string_value(cson_new_string(zUuid, strlen(zUuid))) );
+    cson_object_set_s( zPayload, pStream->zKeyUuid, cson_string_value(cson_new_string(zUuid, strlen(zUuid))) );
   }
   if( zCI ){
     cson_object_set( zPayload, "checkin", json_new_string(zCI) );
   }
 
-  while( (SQLITE_ROW==db_step(&q)) ){
-    cson_value * name = NULL;
-    char const * n = db_column_text(&q,0);
-    char const * u = zCI ? db_column_text(&q,1) : NULL;
-    zEntry = cson_new_object();
-    if(!zEntries){
-      zEntries = cson_new_array();
-      cson_object_set( zPayload, "entries", cson_array_value(zEntries) );
-    }
-    if('/'==*n){
-      name = json_new_string( n+1 );
-      cson_object_set_s(zEntry, zKeyIsDir, cson_value_true() );
-
-    } else{
-      name = json_new_string( n );
-    }
-    if(u && *u){
-      cson_object_set_s(zEntry, zKeyUuid, json_new_string( u ) );
-    }
-    cson_object_set_s(zEntry, zKeyName, name );
-    cson_array_append(zEntries, cson_object_value(zEntry) );
+  /* The "entries" property is left out when the directory is empty. */
+  if( SQLITE_ROW==db_step(&pStream->q) ){
+    pStream->hasRow = 1;
+    cson_object_set( zPayload, "entries",
+                     json_stream_array(json_dir_entry_row,
+                                       json_dir_entry_done, pStream) );
+  }else{
+    json_dir_entry_done(pStream);
   }
-  db_finalize(&q);
   if(pM){
     manifest_destroy(pM);
   }
-  cson_value_free( cson_string_value( zKeyName  ) );
-  cson_value_free( cson_string_value( zKeyUuid  ) );
-  cson_value_free( cson_string_value( zKeyIsDir  ) );
   free( zUuid );
   free( zD );
   return cson_object_value(zPayload);
@@ -64,7 +64,9 @@ cson_value * json_page_timeline(){
 }
 
 /*
-** Create a temporary table suitable for storing timeline data.
+** Create a temporary table suitable for storing timeline data, or
+** empty it if an earlier request in this process (see /json/batch)
+** already created it.
 */
 static void json_timeline_temp_table(void){
   /* Field order MUST match that from json_timeline_query()!!! */
@@ -83,7 +85,8 @@ static void json_timeline_temp_table(void){
     @   tags TEXT,
     @   tagId INTEGER,
     @   brief TEXT
-    @ )
+    @ );
+    @ DELETE FROM json_timeline;
   ;
   db_multi_exec(zSql);
 }
@@ -347,10 +350,52 @@ cson_value * json_get_changed_files(int rid){
   return rowsV;
 }
 
+/*
+** State of the /json/timeline/branch array while it is streamed.
+*/
+typedef struct TimelineBranchStream TimelineBranchStream;
+struct TimelineBranchStream {
+  Stmt q;                  /* The branch check-ins */
+  cson_value * colNamesV;  /* Column names of q */
+};
+
+/*
+** json_stream_array() callbacks for /json/timeline/branch.  Each row
+** gets the array-form tags of its check-in.
+*/
+static cson_value * json_timeline_branch_row(void *pArg){
+  TimelineBranchStream *p = (TimelineBranchStream*)pArg;
+  while( SQLITE_ROW==db_step(&p->q) ){
+    cson_value * rowV;
+    cson_object * row;
+    int rid;
+    if( !p->colNamesV ){
+      p->colNamesV = cson_sqlite3_column_names(p->q.pStmt);
+      cson_value_add_reference(p->colNamesV);
+    }
+    rowV = cson_sqlite3_row_to_object2(p->q.pStmt,
+                                       cson_value_get_array(p->colNamesV));
+    row = cson_value_get_object(rowV);
+    if( !row ) continue;
+    rid = cson_value_get_integer(cson_object_get(row,"rid"));
+    assert( rid > 0 );
+    cson_object_set(row, "tags", json_tags_for_checkin_rid(rid,0));
+    cson_object_set(row, "isLeaf",
+                    json_value_to_bool(cson_object_get(row,"isLeaf")));
+    return rowV;
+  }
+  return NULL;
+}
+static void json_timeline_branch_done(void *pArg){
+  TimelineBranchStream *p = (TimelineBranchStream*)pArg;
+  db_finalize(&p->q);
+  cson_value_free(p->colNamesV);
+  fossil_free(p);
+}
+
 static cson_value * json_timeline_branch(){
-  cson_value * pay = NULL;
   Blob sql = empty_blob;
-  Stmt q = empty_Stmt;
+  TimelineBranchStream *pStream;
   int limit = 0;
   if(!g.perm.Read){
     json_set_err(FSL_JSON_E_DENIED,
@@ -381,31 +426,41 @@ static cson_value * json_timeline_branch(){
   if(limit>0){
     blob_appendf(&sql," LIMIT %d ",limit);
   }
-  db_prepare(&q,"%s", blob_str(&sql));
+  pStream = fossil_malloc(sizeof(*pStream));
+  memset(pStream, 0, sizeof(*pStream));
+  db_prepare(&pStream->q,"%s", blob_str(&sql));
   blob_reset(&sql);
-  pay = json_stmt_to_array_of_obj(&q, NULL);
-  db_finalize(&q);
-  assert(NULL != pay);
-  if(pay){
-    /* get the array-form tags of each record. */
-    cson_string * tags = cson_new_string("tags",4);
-    cson_string * isLeaf = cson_new_string("isLeaf",6);
-    cson_array * ar = cson_value_get_array(pay);
-    unsigned int i = 0;
-    unsigned int len = cson_array_length_get(ar);
-    cson_value_add_reference( cson_string_value(tags) );
-    cson_value_add_reference( cson_string_value(isLeaf) );
-    for( ; i < len; ++i ){
-      cson_object * row = cson_value_get_object(cson_array_get(ar,i));
-      int rid = cson_value_get_integer(cson_object_get(row,"rid"));
-      assert( rid > 0 );
-      cson_object_set_s(row, tags, json_tags_for_checkin_rid(rid,0));
-      cson_object_set_s(row, isLeaf, json_value_to_bool(cson_object_get(row,"isLeaf")));
-    }
-    cson_value_free( cson_string_value(tags) );
-    cson_value_free( cson_string_value(isLeaf) );
+  return json_stream_array(json_timeline_branch_row,
+                           json_timeline_branch_done, pStream);
+}
+
+/*
+** State of the /json/timeline/checkin array while it is streamed.
+*/
+typedef struct TimelineCiStream TimelineCiStream;
+struct TimelineCiStream {
+  Stmt q;               /* Rids from the json_timeline table */
+  char showFiles;       /* Passed on to json_artifact_for_ci() */
+};
+
+/*
+** json_stream_array() callbacks for /json/timeline/checkin.  Rows
+** which cannot be converted to JSON are skipped.
+*/
+static cson_value * json_timeline_ci_row(void *pArg){
+  TimelineCiStream *p = (TimelineCiStream*)pArg;
+  while( SQLITE_ROW==db_step(&p->q) ){
+    int const rid = db_column_int(&p->q,0);
+    cson_value * rowV = json_artifact_for_ci(rid, p->showFiles);
+    if( cson_value_get_object(rowV) ) return rowV;
+    cson_value_free(rowV);
   }
-  return pay;
+  return NULL;
+}
+static void json_timeline_ci_done(void *pArg){
+  TimelineCiStream *p = (TimelineCiStream*)pArg;
+  db_finalize(&p->q);
+  fossil_free(p);
 }
 
 /*
@@ -418,12 +473,9 @@ static cson_value * json_timeline_ci(){
   cson_value * payV = NULL;
   cson_object * pay = NULL;
   cson_value * tmp = NULL;
-  cson_value * listV = NULL;
-  cson_array * list = NULL;
   int check = 0;
   char showFiles = -1/*magic number*/;
-  Stmt q = empty_Stmt;
-  char warnRowToJsonFailed = 0;
+  TimelineCiStream *pStream;
   Blob sql = empty_blob;
   if( !g.perm.History ){
     /* Reminder to self: HTML impl requires 'o' (Read)
@@ -454,29 +506,15 @@ static cson_value * json_timeline_ci(){
 #endif
   db_multi_exec(blob_buffer(&sql));
   blob_reset(&sql);
-  db_prepare(&q, "SELECT "
+  pStream = fossil_malloc(sizeof(*pStream));
+  pStream->showFiles = showFiles;
+  db_prepare(&pStream->q, "SELECT "
              " rid AS rid"
              " FROM json_timeline"
              " ORDER BY rowid");
-  listV = cson_value_new_array();
-  list = cson_value_get_array(listV);
-  tmp = listV;
+  tmp = json_stream_array(json_timeline_ci_row, json_timeline_ci_done,
+                          pStream);
   SET("timeline");
-  while( (SQLITE_ROW == db_step(&q) )){
-    /* convert each row into a JSON object...*/
-    int const rid = db_column_int(&q,0);
-    cson_value * rowV = json_artifact_for_ci(rid, showFiles);
-    cson_object * row = cson_value_get_object(rowV);
-    if(!row){
-      if( !warnRowToJsonFailed ){
-        warnRowToJsonFailed = 1;
-        json_warn( FSL_JSON_W_ROW_TO_JSON_FAILED,
-                   "Could not convert at least one timeline result row to JSON." );
-      }
-      continue;
-    }
-    cson_array_append(list, rowV);
-  }
 #undef SET
   goto ok;
   error:
@@ -484,7 +522,6 @@ static cson_value * json_timeline_ci(){
   cson_value_free(payV);
   payV = NULL;
   ok:
-  db_finalize(&q);
   return payV;
 }
 
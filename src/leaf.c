@@ -75,6 +75,31 @@ int count_nonbranch_children(int pid){
 }
 
 
+/*
+** Make the LEAF table entries for every check-in whose rid is in
+** the one-column table or subquery zRids correct.  Each check-in costs
+** only indexed lookups on PLINK and TAGXREF.
+*/
+static void leaf_check_set(const char *zRids){
+  static const char zHasChild[] =
+    @ EXISTS(SELECT 1 FROM plink
+    @         WHERE pid=x.rid
+    @           AND coalesce((SELECT value FROM tagxref
+    @                          WHERE tagid=%d AND rid=x.rid),'trunk')
+    @            == coalesce((SELECT value FROM tagxref
+    @                          WHERE tagid=%d AND rid=plink.cid),'trunk'))
+  ;
+  char *zHas = mprintf(zHasChild, TAG_BRANCH, TAG_BRANCH);
+  db_multi_exec(
+    "DELETE FROM leaf WHERE rid IN"
+    " (SELECT x.rid FROM (%s) AS x WHERE %s);"
+    "INSERT OR IGNORE INTO leaf"
+    " SELECT x.rid FROM (%s) AS x WHERE NOT %s;",
+    zRids, zHas, zRids, zHas
+  );
+  fossil_free(zHas);
+}
+
 /*
 ** Recompute the entire LEAF table.  
 **
@@ -82,18 +107,9 @@ int count_nonbranch_children(int pid){
 ** So it is only done for things like a rebuild.
 */
 void leaf_rebuild(void){
-  db_multi_exec(
-    "DELETE FROM leaf;"
-    "INSERT OR IGNORE INTO leaf"
-    "  SELECT cid FROM plink"
-    "  EXCEPT"
-    "  SELECT pid FROM plink"
-    "   WHERE coalesce((SELECT value FROM tagxref"
-                       " WHERE tagid=%d AND rid=plink.pid),'trunk')"
-         " == coalesce((SELECT value FROM tagxref"
-                       " WHERE tagid=%d AND rid=plink.cid),'trunk')",
-    TAG_BRANCH, TAG_BRANCH
-  );
+  db_multi_exec("DELETE FROM leaf");
+  leaf_check_set("SELECT objid AS rid FROM event WHERE type='ci'");
+  branch_summary_rebuild();
 }
 
 /*
@@ -101,41 +117,6 @@ void leaf_rebuild(void){
 */
 static Bag needToCheck;
 
-/*
-** Check to see if checkin "rid" is a leaf and either add it to the LEAF
-** table if it is, or remove it if it is not.
-*/
-void leaf_check(int rid){
-  static Stmt checkIfLeaf;
-  static Stmt addLeaf;
-  static Stmt removeLeaf;
-  int rc;
-
-  db_static_prepare(&checkIfLeaf,
-    "SELECT 1 FROM plink"
-    " WHERE pid=:rid"
-    "   AND coalesce((SELECT value FROM tagxref"
-                    " WHERE tagid=%d AND rid=:rid),'trunk')"
-       " == coalesce((SELECT value FROM tagxref"
-                    " WHERE tagid=%d AND rid=plink.cid),'trunk');",
-    TAG_BRANCH, TAG_BRANCH
-  );
-  db_bind_int(&checkIfLeaf, ":rid", rid);
-  rc = db_step(&checkIfLeaf);
-  db_reset(&checkIfLeaf);
-  if( rc==SQLITE_ROW ){
-    db_static_prepare(&removeLeaf, "DELETE FROM leaf WHERE rid=:rid");
-    db_bind_int(&removeLeaf, ":rid", rid);
-    db_step(&removeLeaf);
-    db_reset(&removeLeaf);
-  }else{
-    db_static_prepare(&addLeaf, "INSERT OR IGNORE INTO leaf VALUES(:rid)");
-    db_bind_int(&addLeaf, ":rid", rid);
-    db_step(&addLeaf);
-    db_reset(&addLeaf);
-  }
-}
-
 /*
 ** Return an SQL expression (stored in memory obtained from fossil_malloc())
 ** that is true if the SQL variable named "zVar" contains the rid with
@@ -155,29 +136,45 @@ char *leaf_is_closed_sql(const char *zVar){
 }
 
 /*
-** Schedule a leaf check for "rid" and its parents.
+** Schedule a leaf check for "rid" and its parents.  The parents are
+** looked up when the checks are done.
 */
 void leaf_eventually_check(int rid){
-  static Stmt parentsOf;
-
-  db_static_prepare(&parentsOf, 
-     "SELECT pid FROM plink WHERE cid=:rid AND pid>0"
-  );
-  db_bind_int(&parentsOf, ":rid", rid);
   bag_insert(&needToCheck, rid);
-  while( db_step(&parentsOf)==SQLITE_ROW ){
-    bag_insert(&needToCheck, db_column_int(&parentsOf, 0));
-  }
-  db_reset(&parentsOf);
 }
 
 /*
 ** Do all pending leaf checks.
+**
+** The scheduled check-ins and their parents are collected into a
+** temporary table and the LEAF table is brought up to date for all of
+** them at once, so that a sync or rebuild that touches many check-ins
+** does not have to test them one by one.  The BRANCH_SUMMARY rows of
+** their branches are then recomputed.
 */
 void leaf_do_pending_checks(void){
+  static Stmt ins;
   int rid;
+  if( bag_count(&needToCheck)==0 ) return;
+  /* Normally made by manifest_crosslink_begin(), so that no statement
+  ** of a rebuild or sync is expired by a schema change mid-batch. */
+  db_multi_exec(
+    "CREATE TEMP TABLE IF NOT EXISTS leaf_pending(rid INTEGER PRIMARY KEY);"
+    "DELETE FROM leaf_pending;"
+  );
+  db_static_prepare(&ins, "INSERT OR IGNORE INTO leaf_pending VALUES(:rid)");
   for(rid=bag_first(&needToCheck); rid; rid=bag_next(&needToCheck,rid)){
-    leaf_check(rid);
+    db_bind_int(&ins, ":rid", rid);
+    db_step(&ins);
+    db_reset(&ins);
   }
   bag_clear(&needToCheck);
+  db_multi_exec(
+    "INSERT OR IGNORE INTO leaf_pending"
+    " SELECT pid FROM plink"
+    "  WHERE cid IN (SELECT rid FROM leaf_pending) AND pid>0;"
+  );
+  leaf_check_set("SELECT rid FROM leaf_pending");
+  branch_summary_update("SELECT rid FROM leaf_pending");
+  db_multi_exec("DELETE FROM leaf_pending");
 }
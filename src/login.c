@@ -758,6 +758,154 @@ static int login_find_user(
   return uid;
 }
 
+/*
+** Memory of settings
+*/
+static int login_anon_once = 1;
+
+/*
+** On a keep-alive connection to "fossil server", each request runs in
+** a new process.  So that the requests of a logged-in browser do not
+** all repeat the cookie check and the capability lookups, the outcome
+** of the check is left for the next request with
+** cgi_set_connection_state().  It is reused for at most
+** LOGIN_SESSION_TTL seconds, and only while a fingerprint of the user
+** table rows it depends on is unchanged.  The state is the text:
+**
+**     KEY EXPIRE UID FINGERPRINT CSRF PERM LOGIN
+**
+** KEY is a hash of the repository, cookie and remote address, EXPIRE
+** is a unix time, PERM is g.perm in hex, and LOGIN is httpized.
+*/
+#define LOGIN_SESSION_TTL 60
+
+/*
+** Compute into pKey the hash that identifies the session of cookie
+** zCookie from address zIpAddr.
+*/
+static void login_session_key(
+  const char *zCookie,           /* Login cookie value */
+  const char *zIpAddr,           /* Raw IP address of the requestor */
+  Blob *pKey                     /* Write the hash here */
+){
+  Blob in;
+  blob_zero(&in);
+  blob_appendf(&in, "%s/%s/%s", g.zRepositoryName, zCookie, zIpAddr);
+  sha1sum_blob(&in, pKey);
+  blob_reset(&in);
+}
+
+/*
+** Compute into pFp a hash of everything that a login of user uid
+** depends on: the user's own row, the rows of the users whose
+** capabilities are inherited, and the secret of anonymous cookies.
+** Any change to these, such as a logout or an edit of capabilities,
+** changes the hash.
+*/
+static void login_session_fingerprint(int uid, Blob *pFp){
+  Blob in;
+  blob_zero(&in);
+  db_blob(&in,
+    "SELECT group_concat(quote(uid)||quote(login)||quote(cap)"
+    "                    ||quote(cookie)||quote(ipaddr)||quote(cexpire)"
+    "                    ||quote(length(pw)>0), ',')"
+    "       || coalesce((SELECT quote(value) FROM config"
+    "                     WHERE name='captcha-secret'),'')"
+    "  FROM (SELECT * FROM user"
+    "         WHERE uid=%d"
+    "            OR login IN ('nobody','anonymous','developer','reader')"
+    "         ORDER BY uid)",
+    uid
+  );
+  sha1sum_blob(&in, pFp);
+  blob_reset(&in);
+}
+
+/*
+** If an earlier request on this connection left a session for the
+** same cookie and it is still valid, restore g.userUid, g.zLogin,
+** g.perm and g.zCsrfToken from it and return true.  Otherwise return
+** false and change nothing.
+*/
+static int login_session_restore(const char *zCookie, const char *zIpAddr){
+  const char *zState = cgi_connection_state();
+  char zKey[41], zFp[41], zCsrf[12], zPerm[100], zLogin[300];
+  sqlite3_int64 iExpire;
+  int uid;
+  int rc = 0;
+  Blob key, fp;
+  if( zState==0 || zState[0]==0 ) return 0;
+  if( sscanf(zState, "%40s %lld %d %40s %11s %99s %299s",
+             zKey, &iExpire, &uid, zFp, zCsrf, zPerm, zLogin)!=7 ){
+    return 0;
+  }
+  if( iExpire<time(0) || uid<=0 ) return 0;
+  if( strlen(zPerm)!=2*sizeof(g.perm) ) return 0;
+  login_session_key(zCookie, zIpAddr, &key);
+  if( fossil_strcmp(zKey, blob_str(&key))==0 ){
+    login_session_fingerprint(uid, &fp);
+    if( fossil_strcmp(zFp, blob_str(&fp))==0
+     && decode16((unsigned char*)zPerm, (unsigned char*)&g.perm,
+                 2*sizeof(g.perm))==0
+    ){
+      dehttpize(zLogin);
+      g.userUid = uid;
+      g.zLogin = fossil_strdup(zLogin);
+      sqlite3_snprintf(sizeof(g.zCsrfToken), g.zCsrfToken, "%s", zCsrf);
+      login_anon_once = 0;
+      rc = 1;
+    }
+    blob_reset(&fp);
+  }
+  blob_reset(&key);
+  return rc;
+}
+
+/*
+** Leave the login of the current request, which was made with cookie
+** zCookie from address zIpAddr, for the next request on this
+** connection.  The cookie itself expires at julian day rExpire.
+*/
+static void login_session_save(
+  const char *zCookie,           /* Login cookie value */
+  const char *zIpAddr,           /* Raw IP address of the requestor */
+  double rExpire                 /* Julian day when the cookie expires */
+){
+  sqlite3_int64 iExpire = time(0) + LOGIN_SESSION_TTL;
+  sqlite3_int64 iCookieExpire = (sqlite3_int64)((rExpire-2440587.5)*86400.0);
+  char zPerm[2*sizeof(g.perm)+1];
+  char *zLogin;
+  char *zState;
+  Blob key, fp;
+  if( cgi_connection_state()==0 || g.zLogin==0 || g.zCsrfToken[0]==0 ){
+    return;
+  }
+  if( iCookieExpire<iExpire ) iExpire = iCookieExpire;
+  login_session_key(zCookie, zIpAddr, &key);
+  login_session_fingerprint(g.userUid, &fp);
+  encode16((unsigned char*)&g.perm, (unsigned char*)zPerm, sizeof(g.perm));
+  zLogin = httpize(g.zLogin, -1);
+  zState = mprintf("%s %lld %d %s %s %s %s", blob_str(&key), iExpire,
+                   g.userUid, blob_str(&fp), g.zCsrfToken, zPerm, zLogin);
+  cgi_set_connection_state(zState);
+  fossil_free(zState);
+  fossil_free(zLogin);
+  blob_reset(&fp);
+  blob_reset(&key);
+}
+
+/*
+** Give a user who has some capabilities (hasCap) hyperlinks if they
+** appear to be a person rather than a spider, when the
+** "auto-enable-hyperlinks" setting allows it.
+*/
+static void login_auto_enable_hyperlinks(int hasCap){
+  if( hasCap && !g.perm.History && db_get_boolean("auto-enable-hyperlinks",1)
+      && isHuman(P("HTTP_USER_AGENT")) ){
+    g.perm.History = 1;
+  }
+}
+
 /*
 ** This routine examines the login cookie to see if it exists and and
 ** is valid.  If the login cookie checks out, it then sets global
@@ -766,10 +914,11 @@ static int login_find_user(
 */
 void login_check_credentials(void){
   int uid = 0;                  /* User id */
-  const char *zCookie;          /* Text of the login cookie */
+  const char *zCookie = 0;      /* Text of the login cookie */
   const char *zIpAddr;          /* Raw IP address of the requestor */
   char *zRemoteAddr;            /* Abbreviated IP address of the requestor */
   const char *zCap = 0;         /* Capability string */
+  double rCookieExpire = 0.0;   /* Expiration of a valid login cookie */
 
   /* Only run this check once.  */
   if( g.userUid!=0 ) return;
@@ -800,11 +949,20 @@ void login_check_credentials(void){
   /* Check the login cookie to see if it matches a known valid user.
   */
   if( uid==0 && (zCookie = P(login_cookie_name()))!=0 ){
-    /* Parse the cookie value up into HASH/ARG/USER */
-    char *zHash = fossil_strdup(zCookie);
+    char *zHash;
     char *zArg = 0;
     char *zUser = 0;
     int i, c;
+    if( login_session_restore(zCookie, zIpAddr) ){
+      if( g.fHttpTrace ){
+        fprintf(stderr, "# login: [%s] from the connection session\n",
+                g.zLogin);
+      }
+      login_auto_enable_hyperlinks(1);
+      return;
+    }
+    /* Parse the cookie value up into HASH/ARG/USER */
+    zHash = fossil_strdup(zCookie);
     for(i=0; (c = zHash[i])!=0; i++){
       if( c=='/' ){
         zHash[i++] = 0;
@@ -837,6 +995,7 @@ void login_check_credentials(void){
             " AND %.17g+0.25>julianday('now')",
             rTime
         );
+        if( uid ) rCookieExpire = rTime+0.25;
       }
       blob_reset(&b);
     }else{
@@ -849,6 +1008,10 @@ void login_check_credentials(void){
         uid = login_find_user(zUser, zHash, zRemoteAddr);
         if( uid ) record_login_attempt(zUser, zIpAddr, 1);
       }
+      if( uid && cgi_connection_state()!=0 ){
+        rCookieExpire = db_double(0.0,
+                                  "SELECT cexpire FROM user WHERE uid=%d", uid);
+      }
     }
     sqlite3_snprintf(sizeof(g.zCsrfToken), g.zCsrfToken, "%.10s", zHash);
   }
@@ -906,17 +1069,12 @@ void login_check_credentials(void){
   /* Set the capabilities */
   login_replace_capabilities(zCap, 0);
   login_set_anon_nobody_capabilities();
-  if( zCap[0] && !g.perm.History && db_get_boolean("auto-enable-hyperlinks",1)
-      && isHuman(P("HTTP_USER_AGENT")) ){
-    g.perm.History = 1;
+  if( rCookieExpire>0.0 && zCookie!=0 ){
+    login_session_save(zCookie, zIpAddr, rCookieExpire);
   }
+  login_auto_enable_hyperlinks(zCap[0]!=0);
 }
 
-/*
-** Memory of settings
-*/
-static int login_anon_once = 1;
-
 /*
 ** Add the default privileges of users "nobody" and "anonymous" as appropriate
 ** for the user g.zLogin.
@@ -112,6 +112,7 @@ struct Global {
   int minPrefix;          /* Number of digits needed for a distinct UUID */
   int fSqlTrace;          /* True if --sqltrace flag is present */
   int fSqlStats;          /* True if --sqltrace or --sqlstats are present */
+  int fPerf;              /* True if --perf is present */
   int fSqlPrint;          /* True if -sqlprint flag is present */
   int fQuiet;             /* True if -quiet flag is present */
   int fHttpTrace;         /* Trace outbound HTTP requests */
@@ -133,6 +134,7 @@ struct Global {
   FILE *httpIn;           /* Accept HTTP input from here */
   FILE *httpOut;          /* Send HTTP output here */
   int xlinkClusterOnly;   /* Set when cloning.  Only process clusters */
+  int nCloneJob;          /* Number of connections to use for a clone */
   int fTimeFormat;        /* 1 for UTC.  2 for localtime.  0 not yet selected */
   int *aCommitFile;       /* Array of files to be committed */
   int markPrivate;        /* All new artifacts are private if true */
@@ -323,11 +325,13 @@ void fossil_atexit(void) {
 #ifdef FOSSIL_ENABLE_JSON
   cson_value_free(g.json.gc.v);
   memset(&g.json, 0, sizeof(g.json));
+  json_pool_release();
 #endif
   free(g.zErrMsg);
   if(g.db){
     db_close(0);
   }
+  if( g.fPerf ) perf_print();
 }
 
 /*
@@ -422,6 +426,7 @@ int main(int argc, char **argv){
   sqlite3_config(SQLITE_CONFIG_LOG, fossil_sqlite_log, 0);
   memset(&g, 0, sizeof(g));
   g.now = time(0);
+  perf_init();
   g.argc = argc;
   g.argv = argv;
 #ifdef FOSSIL_ENABLE_JSON
@@ -456,6 +461,7 @@ int main(int argc, char **argv){
     g.fQuiet = find_option("quiet", 0, 0)!=0;
     g.fSqlTrace = find_option("sqltrace", 0, 0)!=0;
     g.fSqlStats = find_option("sqlstats", 0, 0)!=0;
+    g.fPerf = find_option("perf", 0, 0)!=0;
     g.fSystemTrace = find_option("systemtrace", 0, 0)!=0;
     if( g.fSqlTrace ) g.fSqlStats = 1;
     g.fSqlPrint = find_option("sqlprint", 0, 0)!=0;
@@ -498,7 +504,9 @@ int main(int argc, char **argv){
     fossil_exit(1);
   }
   atexit( fossil_atexit );
+  blob_arena_begin();
   aCommand[idx].xFunc();
+  blob_arena_end();
   fossil_exit(0);
   /*NOT_REACHED*/
   return 0;
@@ -526,6 +534,7 @@ const char *fossil_nameofexe(void){
 ** Exit.  Take care to close the database first.
 */
 NORETURN void fossil_exit(int rc){
+  perf_slow_log();
   db_close(1);
   exit(rc);
 }
@@ -755,6 +764,9 @@ static const char *sqlite_error_code_name(int iCode){
 
 /* Error logs from SQLite */
 void fossil_sqlite_log(void *notUsed, int iCode, const char *zErrmsg){
+  /* A cached prepared statement that outlives a schema change is
+  ** recompiled automatically by sqlite3_step().  Not an error. */
+  if( iCode==SQLITE_SCHEMA && db_in_reused_step() ) return;
   fossil_warning("%s: %s", sqlite_error_code_name(iCode), zErrmsg);
 }
 
@@ -793,7 +805,6 @@ const char *find_option(const char *zLong, const char *zShort, int hasArg){
   nLong = strlen(zLong);
   for(i=1; i<g.argc; i++){
     char *z;
-    if (i+hasArg >= g.argc) break;
     z = g.argv[i];
     if( z[0]!='-' ) continue;
     z++;
@@ -810,11 +821,13 @@ const char *find_option(const char *zLong, const char *zShort, int hasArg){
         remove_from_argv(i, 1);
         break;
       }else if( z[nLong]==0 ){
+        if( i+hasArg >= g.argc ) break;
         zReturn = g.argv[i+hasArg];
         remove_from_argv(i, 1+hasArg);
         break;
       }
     }else if( fossil_strcmp(z,zShort)==0 ){
+      if( i+hasArg >= g.argc ) break;
       zReturn = g.argv[i+hasArg];
       remove_from_argv(i, 1+hasArg);
       break;
@@ -1145,6 +1158,53 @@ static char *enter_chroot_jail(char *zRepo){
   return zRepo;
 }
 
+/*
+** When serving a directory of repositories, the name of that directory.
+** NULL if serving a single repository, or before the first request.
+*/
+static char *zRepoDir = 0;
+
+/*
+** Called by a "fossil server" process that outlives its requests, after
+** a request has opened the repository zRepo from a directory of
+** repositories.  Open the same repository here, closing any other, so
+** that later requests forked from this process find it open already.
+** A no-op when serving a single repository.
+*/
+void server_keep_repository(const char *zRepo){
+  if( g.repositoryOpen && fossil_strcmp(g.zRepositoryName, zRepo)==0 ){
+    return;
+  }
+  if( zRepoDir==0 ){
+    if( g.repositoryOpen || g.zRepositoryName==0 ) return;
+    zRepoDir = g.zRepositoryName;
+  }
+  if( g.repositoryOpen ) db_close(0);
+  if( file_access(zRepo, R_OK)==0 && file_size(zRepo)>=1024 ){
+    db_open_repository(zRepo);
+    server_preload();
+  }
+}
+
+/*
+** Number of recent check-ins whose manifests server_preload() parses.
+*/
+#define SERVER_PRELOAD_CKIN 10
+
+/*
+** Called by a "fossil server" process that outlives its requests, each
+** time it opens a repository.  Build the state that most requests for
+** that repository need: the parsed skin and the manifests of the most
+** recent check-ins.  Each request runs in a process forked from this
+** one and so starts with that state already in memory, without any of
+** them having to rebuild it.  The caches are per repository and are
+** dropped by db_close().
+*/
+void server_preload(void){
+  style_preload();
+  manifest_preload(SERVER_PRELOAD_CKIN);
+}
+
 /*
 ** Preconditions:
 **
@@ -1153,6 +1213,8 @@ static char *enter_chroot_jail(char *zRepo){
 ** If the repository is known, it has already been opened.  If unknown,
 ** then g.zRepositoryName holds the directory that contains the repository
 ** and the actual repository is taken from the first element of PATH_INFO.
+** A repository from that directory might be open already because an
+** earlier request used it.  See server_keep_repository().
 ** 
 ** Process the webpage specified by the PATH_INFO or REQUEST_URI
 ** environment variable.
@@ -1163,26 +1225,31 @@ static void process_one_web_page(const char *zNotFound){
   int idx;
   int i;
 
+  /* Settings read ahead of the request, as by server_preload(), might
+  ** have been changed since by another process */
+  db_config_snapshot_clear();
+
   /* If the repository has not been opened already, then find the
   ** repository based on the first element of PATH_INFO and open it.
   */
   zPathInfo = PD("PATH_INFO","");
-  if( !g.repositoryOpen ){
+  if( !g.repositoryOpen || zRepoDir ){
     char *zRepo, *zToFree;
     const char *zOldScript = PD("SCRIPT_NAME", "");
     char *zNewScript;
     int j, k;
     i64 szFile;
 
+    if( zRepoDir==0 ) zRepoDir = g.zRepositoryName;
     i = zPathInfo[0]!=0;
     while( 1 ){
       while( zPathInfo[i] && zPathInfo[i]!='/' ){ i++; }
-      zRepo = zToFree = mprintf("%s%.*s.fossil",g.zRepositoryName,i,zPathInfo);
+      zRepo = zToFree = mprintf("%s%.*s.fossil",zRepoDir,i,zPathInfo);
 
       /* To avoid mischief, make sure the repository basename contains no
       ** characters other than alphanumerics, "-", "/", and "_".
       */
-      for(j=strlen(g.zRepositoryName)+1, k=0; zRepo[j] && k<i-1; j++, k++){
+      for(j=strlen(zRepoDir)+1, k=0; zRepo[j] && k<i-1; j++, k++){
         if( !fossil_isalnum(zRepo[j]) && zRepo[j]!='-' && zRepo[j]!='/' ){
           zRepo[j] = '_';
         }
@@ -1224,7 +1291,11 @@ static void process_one_web_page(const char *zNotFound){
     cgi_replace_parameter("PATH_INFO", &zPathInfo[i+1]);
     zPathInfo += i;
     cgi_replace_parameter("SCRIPT_NAME", zNewScript);
+    if( g.repositoryOpen && fossil_strcmp(g.zRepositoryName, zRepo)!=0 ){
+      db_close(0);
+    }
     db_open_repository(zRepo);
+    cgi_set_connection_repository(zRepo);
     if( g.fHttpTrace ){
       fprintf(stderr, 
           "# repository: [%s]\n"
@@ -1318,10 +1389,13 @@ static void process_one_web_page(const char *zNotFound){
   }
 
   /* Locate the method specified by the path and execute the function
-  ** that implements that method.
+  ** that implements that method.  Arena blobs created while generating
+  ** the page are released once the reply has been sent.
   */
+  blob_arena_begin();
   if( name_search(g.zPath, aWebpage, count(aWebpage), &idx) &&
       name_search("not_found", aWebpage, count(aWebpage), &idx) ){
+    metrics_set_page("not_found");
 #ifdef FOSSIL_ENABLE_JSON
     if(g.json.isJsonMode){
       json_err(FSL_JSON_E_RESOURCE_NOT_FOUND,NULL,0);
@@ -1332,24 +1406,39 @@ static void process_one_web_page(const char *zNotFound){
       @ <h1>Not Found</h1>
       @ <p>Page not found: %h(g.zPath)</p>
     }
-  }else if( aWebpage[idx].xFunc!=page_xfer && db_schema_is_outofdate() ){
+  }else{
+    metrics_set_page(aWebpage[idx].zName);
+    if( aWebpage[idx].xFunc!=page_xfer && db_schema_is_outofdate() ){
 #ifdef FOSSIL_ENABLE_JSON
-    if(g.json.isJsonMode){
-      json_err(FSL_JSON_E_DB_NEEDS_REBUILD,NULL,0);
-    }else
+      if(g.json.isJsonMode){
+        json_err(FSL_JSON_E_DB_NEEDS_REBUILD,NULL,0);
+      }else
 #endif
-    {
-      @ <h1>Server Configuration Error</h1>
-      @ <p>The database schema on the server is out-of-date.  Please ask
-      @ the administrator to run <b>fossil rebuild</b>.</p>
+      {
+        @ <h1>Server Configuration Error</h1>
+        @ <p>The database schema on the server is out-of-date.  Please ask
+        @ the administrator to run <b>fossil rebuild</b>.</p>
+      }
+    }else if( !page_cache_begin(g.zPath) ){
+      i64 iStart = perf_timer_start(PERF_PAGE);
+      aWebpage[idx].xFunc();
+      page_cache_end();
+      perf_timer_stop(PERF_PAGE, iStart);
     }
-  }else{
-    aWebpage[idx].xFunc();
   }
 
-  /* Return the result.
+  /* Return the result, with the performance counters in a Server-Timing
+  ** header if the "server-timing" setting asks for them.
   */
+  if( g.repositoryOpen && db_get_boolean("server-timing", 0) ){
+    char *zTiming = perf_server_timing();
+    char *zHdr = mprintf("Server-Timing: %s\r\n", zTiming);
+    cgi_append_header(zHdr);
+    fossil_free(zHdr);
+    fossil_free(zTiming);
+  }
   cgi_reply();
+  blob_arena_end();
 }
 
 /*
@@ -1566,12 +1655,26 @@ static void find_server_repository(int disallowDir){
 ** for requests coming from localhost, if the "localauth" setting is not
 ** enabled.
 **
+** The --ipaddr option gives the IP address of the client when the request
+** is not read directly from a socket.  If the address is "-" then it is
+** read from the first line of standard input, ahead of the request.
+**
 ** Options:
 **   --localauth    enable automatic login for local connections
+**   --content-cache N  share up to N megabytes of expanded artifact
+**                  content with other "fossil http" processes, in a file
+**                  named after the repository.  Unix only.
 **   --host NAME    specify hostname of the server
 **   --https        signal a request coming in via https
+**   --ipaddr ADDR  the IP address of the client, or "-"
 **   --nossl        signal that no SSL connections are available
 **   --notfound URL use URL as "HTTP 404, object not found" page.
+**   --metrics      keep the statistics shown by the /metrics page, in a
+**                  file named after the repository.  Unix only.
+**   --throttle N   answer each client IP address with at most N requests
+**                  per minute, counting expensive pages such as /zip or
+**                  /annotate as several requests.  Others get a 429
+**                  reply.  Unix only.
 **
 ** See also: cgi, server, winsrv
 */
@@ -1579,12 +1682,19 @@ void cmd_http(void){
   const char *zIpAddr;
   const char *zNotFound;
   const char *zHost;
+  const char *zThrottle;
+  const char *zContentCache;
+  int useMetrics;
   zNotFound = find_option("notfound", 0, 1);
   g.useLocalauth = find_option("localauth", 0, 0)!=0;
   g.sslNotAvailable = find_option("nossl", 0, 0)!=0;
   if( find_option("https",0,0)!=0 ) cgi_replace_parameter("HTTPS","on");
   zHost = find_option("host", 0, 1);
   if( zHost ) cgi_replace_parameter("HTTP_HOST",zHost);
+  zIpAddr = find_option("ipaddr", 0, 1);
+  zThrottle = find_option("throttle", 0, 1);
+  zContentCache = find_option("content-cache", 0, 1);
+  useMetrics = find_option("metrics", 0, 0)!=0;
   g.cgiOutput = 1;
   if( g.argc!=2 && g.argc!=3 && g.argc!=6 ){
     fossil_fatal("no repository specified");
@@ -1597,11 +1707,32 @@ void cmd_http(void){
   }else{
     g.httpIn = stdin;
     g.httpOut = stdout;
-    zIpAddr = 0;
+    fossil_binary_mode(g.httpIn);
+    fossil_binary_mode(g.httpOut);
   }
   find_server_repository(0);
+  if( zIpAddr && fossil_strcmp(zIpAddr,"-")==0 ){
+    /* The server started this process ahead of the request */
+    static char zAddr[100];
+    int i;
+    if( fgets(zAddr, sizeof(zAddr), g.httpIn)==0 ) fossil_exit(0);
+    for(i=0; zAddr[i] && zAddr[i]!='\n' && zAddr[i]!='\r'; i++){}
+    zAddr[i] = 0;
+    zIpAddr = zAddr;
+  }
+  if( zThrottle ){
+    throttle_init(atoi(zThrottle), mprintf("%s-throttle", g.zRepositoryName));
+  }
+  if( useMetrics ){
+    metrics_init(mprintf("%s-metrics", g.zRepositoryName));
+  }
+  if( zContentCache ){
+    shmcache_init(atoi(zContentCache),
+                  mprintf("%s-contentcache", g.zRepositoryName));
+  }
   g.zRepositoryName = enter_chroot_jail(g.zRepositoryName);
   cgi_handle_http_request(zIpAddr);
+  throttle_check();
   process_one_web_page(zNotFound);
 }
 
@@ -1678,9 +1809,27 @@ static int binaryOnPath(const char *zBinary){
 ** and the connection is from localhost.
 **
 ** Options:
+**   --content-cache N   share up to N megabytes of expanded artifact
+**                       content between the processes that answer
+**                       requests.  Unix only.
 **   --localauth         enable automatic login for requests from localhost
+**   --metrics           keep the statistics shown by the /metrics page.
+**                       Unix only.
 **   -P|--port TCPPORT   listen to request on port TCPPORT
+**   --queue N           hold up to N new connections while waiting for
+**                       a free process, and answer any more with a 503
+**                       reply.  Default 64.  Unix only.
 **   --th-trace          trace TH1 execution (for debugging purposes)
+**   --throttle N        answer each client IP address with at most N
+**                       requests per minute, counting expensive pages such
+**                       as /zip or /annotate as several requests.  Others
+**                       get a 429 reply.  Unix only.
+**   --workers N         keep N worker processes ready for new connections,
+**                       with the repository already open.  Each worker
+**                       serves many connections in turn, and when serving
+**                       a directory it keeps open the repository last
+**                       used.  A good value is the number of CPU cores.
+**                       Unix only.
 **
 ** See also: cgi, http, winsrv
 */
@@ -1692,6 +1841,11 @@ void cmd_webserver(void){
   int isUiCmd;              /* True if command is "ui", not "server' */
   const char *zNotFound;    /* The --notfound option or NULL */
   int flags = 0;            /* Server flags */
+  const char *zWorkers;     /* The --workers option or NULL */
+  const char *zQueue;       /* The --queue option or NULL */
+  const char *zThrottle;    /* The --throttle option or NULL */
+  const char *zContentCache; /* The --content-cache option or NULL */
+  int useMetrics;           /* True if the --metrics option is present */
 
 #if defined(_WIN32)
   const char *zStopperFile;    /* Name of file used to terminate server */
@@ -1705,6 +1859,11 @@ void cmd_webserver(void){
   }
   zPort = find_option("port", "P", 1);
   zNotFound = find_option("notfound", 0, 1);
+  zWorkers = find_option("workers", 0, 1);
+  zQueue = find_option("queue", 0, 1);
+  zThrottle = find_option("throttle", 0, 1);
+  zContentCache = find_option("content-cache", 0, 1);
+  useMetrics = find_option("metrics", 0, 0)!=0;
   if( g.argc!=2 && g.argc!=3 ) usage("?REPOSITORY?");
   isUiCmd = g.argv[1][0]=='u';
   if( isUiCmd ){
@@ -1740,7 +1899,12 @@ void cmd_webserver(void){
     zBrowserCmd = mprintf("%s http://localhost:%%d/ &", zBrowser);
   }
   db_close(1);
-  if( cgi_http_server(iPort, mxPort, zBrowserCmd, flags) ){
+  if( zThrottle ) throttle_init(atoi(zThrottle), 0);
+  if( useMetrics ) metrics_init(0);
+  if( zContentCache ) shmcache_init(atoi(zContentCache), 0);
+  if( cgi_http_server(iPort, mxPort, zBrowserCmd,
+                      zWorkers ? atoi(zWorkers) : 0,
+                      zQueue ? atoi(zQueue) : 0, flags) ){
     fossil_fatal("unable to listen on TCP socket %d", iPort);
   }
   g.sslNotAvailable = 1;
@@ -1752,7 +1916,10 @@ void cmd_webserver(void){
   g.cgiOutput = 1;
   find_server_repository(isUiCmd);
   g.zRepositoryName = enter_chroot_jail(g.zRepositoryName);
+  if( zWorkers && g.repositoryOpen ) server_preload();
+  cgi_http_accept();
   cgi_handle_http_request(0);
+  throttle_check();
   process_one_web_page(zNotFound);
 #else
   /* Win32 implementation */
@@ -18,19 +18,23 @@ SRC = \
   $(SRCDIR)/allrepo.c \
   $(SRCDIR)/attach.c \
   $(SRCDIR)/bag.c \
+  $(SRCDIR)/bench.c \
   $(SRCDIR)/bisect.c \
   $(SRCDIR)/blob.c \
   $(SRCDIR)/branch.c \
   $(SRCDIR)/browse.c \
+  $(SRCDIR)/bundle.c \
   $(SRCDIR)/captcha.c \
   $(SRCDIR)/cgi.c \
   $(SRCDIR)/checkin.c \
   $(SRCDIR)/checkout.c \
+  $(SRCDIR)/chunk.c \
   $(SRCDIR)/clearsign.c \
   $(SRCDIR)/clone.c \
   $(SRCDIR)/comformat.c \
   $(SRCDIR)/configure.c \
   $(SRCDIR)/content.c \
+  $(SRCDIR)/dag.c \
   $(SRCDIR)/db.c \
   $(SRCDIR)/delta.c \
   $(SRCDIR)/deltacmd.c \
@@ -50,11 +54,13 @@ SRC = \
   $(SRCDIR)/http_socket.c \
   $(SRCDIR)/http_ssl.c \
   $(SRCDIR)/http_transport.c \
+  $(SRCDIR)/iblt.c \
   $(SRCDIR)/import.c \
   $(SRCDIR)/info.c \
   $(SRCDIR)/json.c \
   $(SRCDIR)/json_artifact.c \
   $(SRCDIR)/json_branch.c \
+  $(SRCDIR)/json_changes.c \
   $(SRCDIR)/json_config.c \
   $(SRCDIR)/json_diff.c \
   $(SRCDIR)/json_dir.c \
@@ -73,8 +79,11 @@ SRC = \
   $(SRCDIR)/md5.c \
   $(SRCDIR)/merge.c \
   $(SRCDIR)/merge3.c \
+  $(SRCDIR)/metrics.c \
   $(SRCDIR)/name.c \
+  $(SRCDIR)/pagecache.c \
   $(SRCDIR)/path.c \
+  $(SRCDIR)/perf.c \
   $(SRCDIR)/pivot.c \
   $(SRCDIR)/popen.c \
   $(SRCDIR)/pqueue.c \
@@ -86,6 +95,7 @@ SRC = \
   $(SRCDIR)/search.c \
   $(SRCDIR)/setup.c \
   $(SRCDIR)/sha1.c \
+  $(SRCDIR)/shmcache.c \
   $(SRCDIR)/shun.c \
   $(SRCDIR)/skins.c \
   $(SRCDIR)/sqlcmd.c \
@@ -96,6 +106,7 @@ SRC = \
   $(SRCDIR)/tag.c \
   $(SRCDIR)/tar.c \
   $(SRCDIR)/th_main.c \
+  $(SRCDIR)/throttle.c \
   $(SRCDIR)/timeline.c \
   $(SRCDIR)/tkt.c \
   $(SRCDIR)/tktsetup.c \
@@ -108,6 +119,7 @@ SRC = \
   $(SRCDIR)/wiki.c \
   $(SRCDIR)/wikiformat.c \
   $(SRCDIR)/winhttp.c \
+  $(SRCDIR)/workpool.c \
   $(SRCDIR)/xfer.c \
   $(SRCDIR)/xfersetup.c \
   $(SRCDIR)/zip.c
@@ -117,19 +129,23 @@ TRANS_SRC = \
   $(OBJDIR)/allrepo_.c \
   $(OBJDIR)/attach_.c \
   $(OBJDIR)/bag_.c \
+  $(OBJDIR)/bench_.c \
   $(OBJDIR)/bisect_.c \
   $(OBJDIR)/blob_.c \
   $(OBJDIR)/branch_.c \
   $(OBJDIR)/browse_.c \
+  $(OBJDIR)/bundle_.c \
   $(OBJDIR)/captcha_.c \
   $(OBJDIR)/cgi_.c \
   $(OBJDIR)/checkin_.c \
   $(OBJDIR)/checkout_.c \
+  $(OBJDIR)/chunk_.c \
   $(OBJDIR)/clearsign_.c \
   $(OBJDIR)/clone_.c \
   $(OBJDIR)/comformat_.c \
   $(OBJDIR)/configure_.c \
   $(OBJDIR)/content_.c \
+  $(OBJDIR)/dag_.c \
   $(OBJDIR)/db_.c \
   $(OBJDIR)/delta_.c \
   $(OBJDIR)/deltacmd_.c \
@@ -149,11 +165,13 @@ TRANS_SRC = \
   $(OBJDIR)/http_socket_.c \
   $(OBJDIR)/http_ssl_.c \
   $(OBJDIR)/http_transport_.c \
+  $(OBJDIR)/iblt_.c \
   $(OBJDIR)/import_.c \
   $(OBJDIR)/info_.c \
   $(OBJDIR)/json_.c \
   $(OBJDIR)/json_artifact_.c \
   $(OBJDIR)/json_branch_.c \
+  $(OBJDIR)/json_changes_.c \
   $(OBJDIR)/json_config_.c \
   $(OBJDIR)/json_diff_.c \
   $(OBJDIR)/json_dir_.c \
@@ -172,8 +190,11 @@ TRANS_SRC = \
   $(OBJDIR)/md5_.c \
   $(OBJDIR)/merge_.c \
   $(OBJDIR)/merge3_.c \
+  $(OBJDIR)/metrics_.c \
   $(OBJDIR)/name_.c \
+  $(OBJDIR)/pagecache_.c \
   $(OBJDIR)/path_.c \
+  $(OBJDIR)/perf_.c \
   $(OBJDIR)/pivot_.c \
   $(OBJDIR)/popen_.c \
   $(OBJDIR)/pqueue_.c \
@@ -185,6 +206,7 @@ TRANS_SRC = \
   $(OBJDIR)/search_.c \
   $(OBJDIR)/setup_.c \
   $(OBJDIR)/sha1_.c \
+  $(OBJDIR)/shmcache_.c \
   $(OBJDIR)/shun_.c \
   $(OBJDIR)/skins_.c \
   $(OBJDIR)/sqlcmd_.c \
@@ -195,6 +217,7 @@ TRANS_SRC = \
   $(OBJDIR)/tag_.c \
   $(OBJDIR)/tar_.c \
   $(OBJDIR)/th_main_.c \
+  $(OBJDIR)/throttle_.c \
   $(OBJDIR)/timeline_.c \
   $(OBJDIR)/tkt_.c \
   $(OBJDIR)/tktsetup_.c \
@@ -207,6 +230,7 @@ TRANS_SRC = \
   $(OBJDIR)/wiki_.c \
   $(OBJDIR)/wikiformat_.c \
   $(OBJDIR)/winhttp_.c \
+  $(OBJDIR)/workpool_.c \
   $(OBJDIR)/xfer_.c \
   $(OBJDIR)/xfersetup_.c \
   $(OBJDIR)/zip_.c
@@ -216,19 +240,23 @@ OBJ = \
  $(OBJDIR)/allrepo.o \
  $(OBJDIR)/attach.o \
  $(OBJDIR)/bag.o \
+ $(OBJDIR)/bench.o \
  $(OBJDIR)/bisect.o \
  $(OBJDIR)/blob.o \
  $(OBJDIR)/branch.o \
  $(OBJDIR)/browse.o \
+ $(OBJDIR)/bundle.o \
  $(OBJDIR)/captcha.o \
  $(OBJDIR)/cgi.o \
  $(OBJDIR)/checkin.o \
  $(OBJDIR)/checkout.o \
+ $(OBJDIR)/chunk.o \
  $(OBJDIR)/clearsign.o \
  $(OBJDIR)/clone.o \
  $(OBJDIR)/comformat.o \
  $(OBJDIR)/configure.o \
  $(OBJDIR)/content.o \
+ $(OBJDIR)/dag.o \
  $(OBJDIR)/db.o \
  $(OBJDIR)/delta.o \
  $(OBJDIR)/deltacmd.o \
@@ -248,11 +276,13 @@ OBJ = \
  $(OBJDIR)/http_socket.o \
  $(OBJDIR)/http_ssl.o \
  $(OBJDIR)/http_transport.o \
+ $(OBJDIR)/iblt.o \
  $(OBJDIR)/import.o \
  $(OBJDIR)/info.o \
  $(OBJDIR)/json.o \
  $(OBJDIR)/json_artifact.o \
  $(OBJDIR)/json_branch.o \
+ $(OBJDIR)/json_changes.o \
  $(OBJDIR)/json_config.o \
  $(OBJDIR)/json_diff.o \
  $(OBJDIR)/json_dir.o \
@@ -271,8 +301,11 @@ OBJ = \
  $(OBJDIR)/md5.o \
  $(OBJDIR)/merge.o \
  $(OBJDIR)/merge3.o \
+ $(OBJDIR)/metrics.o \
  $(OBJDIR)/name.o \
+ $(OBJDIR)/pagecache.o \
  $(OBJDIR)/path.o \
+ $(OBJDIR)/perf.o \
  $(OBJDIR)/pivot.o \
  $(OBJDIR)/popen.o \
  $(OBJDIR)/pqueue.o \
@@ -284,6 +317,7 @@ OBJ = \
  $(OBJDIR)/search.o \
  $(OBJDIR)/setup.o \
  $(OBJDIR)/sha1.o \
+ $(OBJDIR)/shmcache.o \
  $(OBJDIR)/shun.o \
  $(OBJDIR)/skins.o \
  $(OBJDIR)/sqlcmd.o \
@@ -294,6 +328,7 @@ OBJ = \
  $(OBJDIR)/tag.o \
  $(OBJDIR)/tar.o \
  $(OBJDIR)/th_main.o \
+ $(OBJDIR)/throttle.o \
  $(OBJDIR)/timeline.o \
  $(OBJDIR)/tkt.o \
  $(OBJDIR)/tktsetup.o \
@@ -306,6 +341,7 @@ OBJ = \
  $(OBJDIR)/wiki.o \
  $(OBJDIR)/wikiformat.o \
  $(OBJDIR)/winhttp.o \
+ $(OBJDIR)/workpool.o \
  $(OBJDIR)/xfer.o \
  $(OBJDIR)/xfersetup.o \
  $(OBJDIR)/zip.o
@@ -340,6 +376,13 @@ $(OBJDIR)/mkversion:	$(SRCDIR)/mkversion.c
 test:	$(OBJDIR) $(APPNAME)
 	$(TCLSH) $(SRCDIR)/../test/tester.tcl $(APPNAME)
 
+# Time the hot code paths against a synthetic repository built in a
+# temporary directory.  Results are printed one per line as JSON.  Set
+# BENCHFLAGS to choose the repository size, for example
+# BENCHFLAGS="-files 2000 -checkins 500".
+bench:	$(OBJDIR) $(APPNAME)
+	$(TCLSH) $(SRCDIR)/../test/bench.tcl $(APPNAME) $(BENCHFLAGS)
+
 $(OBJDIR)/VERSION.h:	$(SRCDIR)/../manifest.uuid $(SRCDIR)/../manifest $(SRCDIR)/../VERSION $(OBJDIR)/mkversion
 	$(OBJDIR)/mkversion $(SRCDIR)/../manifest.uuid  $(SRCDIR)/../manifest  $(SRCDIR)/../VERSION >$(OBJDIR)/VERSION.h
 
@@ -376,10 +419,10 @@ clean:
 $(OBJDIR)/page_index.h: $(TRANS_SRC) $(OBJDIR)/mkindex
 	$(OBJDIR)/mkindex $(TRANS_SRC) >$@
 $(OBJDIR)/headers:	$(OBJDIR)/page_index.h $(OBJDIR)/makeheaders $(OBJDIR)/VERSION.h
-	$(OBJDIR)/makeheaders  $(OBJDIR)/add_.c:$(OBJDIR)/add.h $(OBJDIR)/allrepo_.c:$(OBJDIR)/allrepo.h $(OBJDIR)/attach_.c:$(OBJDIR)/attach.h $(OBJDIR)/bag_.c:$(OBJDIR)/bag.h $(OBJDIR)/bisect_.c:$(OBJDIR)/bisect.h $(OBJDIR)/blob_.c:$(OBJDIR)/blob.h $(OBJDIR)/branch_.c:$(OBJDIR)/branch.h $(OBJDIR)/browse_.c:$(OBJDIR)/browse.h $(OBJDIR)/captcha_.c:$(OBJDIR)/captcha.h $(OBJDIR)/cgi_.c:$(OBJDIR)/cgi.h $(OBJDIR)/checkin_.c:$(OBJDIR)/checkin.h $(OBJDIR)/checkout_.c:$(OBJDIR)/checkout.h $(OBJDIR)/clearsign_.c:$(OBJDIR)/clearsign.h $(OBJDIR)/clone_.c:$(OBJDIR)/clone.h $(OBJDIR)/comformat_.c:$(OBJDIR)/comformat.h $(OBJDIR)/configure_.c:$(OBJDIR)/configure.h $(OBJDIR)/content_.c:$(OBJDIR)/content.h $(OBJDIR)/db_.c:$(OBJDIR)/db.h $(OBJDIR)/delta_.c:$(OBJDIR)/delta.h $(OBJDIR)/deltacmd_.c:$(OBJDIR)/deltacmd.h $(OBJDIR)/descendants_.c:$(OBJDIR)/descendants.h $(OBJDIR)/diff_.c:$(OBJDIR)/diff.h $(OBJDIR)/diffcmd_.c:$(OBJDIR)/diffcmd.h $(OBJDIR)/doc_.c:$(OBJDIR)/doc.h $(OBJDIR)/encode_.c:$(OBJDIR)/encode.h $(OBJDIR)/event_.c:$(OBJDIR)/event.h $(OBJDIR)/export_.c:$(OBJDIR)/export.h $(OBJDIR)/file_.c:$(OBJDIR)/file.h $(OBJDIR)/finfo_.c:$(OBJDIR)/finfo.h $(OBJDIR)/glob_.c:$(OBJDIR)/glob.h $(OBJDIR)/graph_.c:$(OBJDIR)/graph.h $(OBJDIR)/gzip_.c:$(OBJDIR)/gzip.h $(OBJDIR)/http_.c:$(OBJDIR)/http.h $(OBJDIR)/http_socket_.c:$(OBJDIR)/http_socket.h $(OBJDIR)/http_ssl_.c:$(OBJDIR)/http_ssl.h $(OBJDIR)/http_transport_.c:$(OBJDIR)/http_transport.h $(OBJDIR)/import_.c:$(OBJDIR)/import.h $(OBJDIR)/info_.c:$(OBJDIR)/info.h $(OBJDIR)/json_.c:$(OBJDIR)/json.h $(OBJDIR)/json_artifact_.c:$(OBJDIR)/json_artifact.h $(OBJDIR)/json_branch_.c:$(OBJDIR)/json_branch.h $(OBJDIR)/json_config_.c:$(OBJDIR)/json_config.h $(OBJDIR)/json_diff_.c:$(OBJDIR)/json_diff.h $(OBJDIR)/json_dir_.c:$(OBJDIR)/json_dir.h $(OBJDIR)/json_finfo_.c:$(OBJDIR)/json_finfo.h $(OBJDIR)/json_login_.c:$(OBJDIR)/json_login.h $(OBJDIR)/json_query_.c:$(OBJDIR)/json_query.h $(OBJDIR)/json_report_.c:$(OBJDIR)/json_report.h $(OBJDIR)/json_tag_.c:$(OBJDIR)/json_tag.h $(OBJDIR)/json_timeline_.c:$(OBJDIR)/json_timeline.h $(OBJDIR)/json_user_.c:$(OBJDIR)/json_user.h $(OBJDIR)/json_wiki_.c:$(OBJDIR)/json_wiki.h $(OBJDIR)/leaf_.c:$(OBJDIR)/leaf.h $(OBJDIR)/login_.c:$(OBJDIR)/login.h $(OBJDIR)/main_.c:$(OBJDIR)/main.h $(OBJDIR)/manifest_.c:$(OBJDIR)/manifest.h $(OBJDIR)/md5_.c:$(OBJDIR)/md5.h $(OBJDIR)/merge_.c:$(OBJDIR)/merge.h $(OBJDIR)/merge3_.c:$(OBJDIR)/merge3.h $(OBJDIR)/name_.c:$(OBJDIR)/name.h $(OBJDIR)/path_.c:$(OBJDIR)/path.h $(OBJDIR)/pivot_.c:$(OBJDIR)/pivot.h $(OBJDIR)/popen_.c:$(OBJDIR)/popen.h $(OBJDIR)/pqueue_.c:$(OBJDIR)/pqueue.h $(OBJDIR)/printf_.c:$(OBJDIR)/printf.h $(OBJDIR)/rebuild_.c:$(OBJDIR)/rebuild.h $(OBJDIR)/report_.c:$(OBJDIR)/report.h $(OBJDIR)/rss_.c:$(OBJDIR)/rss.h $(OBJDIR)/schema_.c:$(OBJDIR)/schema.h $(OBJDIR)/search_.c:$(OBJDIR)/search.h $(OBJDIR)/setup_.c:$(OBJDIR)/setup.h $(OBJDIR)/sha1_.c:$(OBJDIR)/sha1.h $(OBJDIR)/shun_.c:$(OBJDIR)/shun.h $(OBJDIR)/skins_.c:$(OBJDIR)/skins.h $(OBJDIR)/sqlcmd_.c:$(OBJDIR)/sqlcmd.h $(OBJDIR)/stash_.c:$(OBJDIR)/stash.h $(OBJDIR)/stat_.c:$(OBJDIR)/stat.h $(OBJDIR)/style_.c:$(OBJDIR)/style.h $(OBJDIR)/sync_.c:$(OBJDIR)/sync.h $(OBJDIR)/tag_.c:$(OBJDIR)/tag.h $(OBJDIR)/tar_.c:$(OBJDIR)/tar.h $(OBJDIR)/th_main_.c:$(OBJDIR)/th_main.h $(OBJDIR)/timeline_.c:$(OBJDIR)/timeline.h $(OBJDIR)/tkt_.c:$(OBJDIR)/tkt.h $(OBJDIR)/tktsetup_.c:$(OBJDIR)/tktsetup.h $(OBJDIR)/undo_.c:$(OBJDIR)/undo.h $(OBJDIR)/update_.c:$(OBJDIR)/update.h $(OBJDIR)/url_.c:$(OBJDIR)/url.h $(OBJDIR)/user_.c:$(OBJDIR)/user.h $(OBJDIR)/verify_.c:$(OBJDIR)/verify.h $(OBJDIR)/vfile_.c:$(OBJDIR)/vfile.h $(OBJDIR)/wiki_.c:$(OBJDIR)/wiki.h $(OBJDIR)/wikiformat_.c:$(OBJDIR)/wikiformat.h $(OBJDIR)/winhttp_.c:$(OBJDIR)/winhttp.h $(OBJDIR)/xfer_.c:$(OBJDIR)/xfer.h $(OBJDIR)/xfersetup_.c:$(OBJDIR)/xfersetup.h $(OBJDIR)/zip_.c:$(OBJDIR)/zip.h $(SRCDIR)/sqlite3.h $(SRCDIR)/th.h $(OBJDIR)/VERSION.h
+	$(OBJDIR)/makeheaders  $(OBJDIR)/add_.c:$(OBJDIR)/add.h $(OBJDIR)/allrepo_.c:$(OBJDIR)/allrepo.h $(OBJDIR)/attach_.c:$(OBJDIR)/attach.h $(OBJDIR)/bag_.c:$(OBJDIR)/bag.h $(OBJDIR)/bench_.c:$(OBJDIR)/bench.h $(OBJDIR)/bisect_.c:$(OBJDIR)/bisect.h $(OBJDIR)/blob_.c:$(OBJDIR)/blob.h $(OBJDIR)/branch_.c:$(OBJDIR)/branch.h $(OBJDIR)/browse_.c:$(OBJDIR)/browse.h $(OBJDIR)/bundle_.c:$(OBJDIR)/bundle.h $(OBJDIR)/captcha_.c:$(OBJDIR)/captcha.h $(OBJDIR)/cgi_.c:$(OBJDIR)/cgi.h $(OBJDIR)/checkin_.c:$(OBJDIR)/checkin.h $(OBJDIR)/checkout_.c:$(OBJDIR)/checkout.h $(OBJDIR)/chunk_.c:$(OBJDIR)/chunk.h $(OBJDIR)/clearsign_.c:$(OBJDIR)/clearsign.h $(OBJDIR)/clone_.c:$(OBJDIR)/clone.h $(OBJDIR)/comformat_.c:$(OBJDIR)/comformat.h $(OBJDIR)/configure_.c:$(OBJDIR)/configure.h $(OBJDIR)/content_.c:$(OBJDIR)/content.h $(OBJDIR)/dag_.c:$(OBJDIR)/dag.h $(OBJDIR)/db_.c:$(OBJDIR)/db.h $(OBJDIR)/delta_.c:$(OBJDIR)/delta.h $(OBJDIR)/deltacmd_.c:$(OBJDIR)/deltacmd.h $(OBJDIR)/descendants_.c:$(OBJDIR)/descendants.h $(OBJDIR)/diff_.c:$(OBJDIR)/diff.h $(OBJDIR)/diffcmd_.c:$(OBJDIR)/diffcmd.h $(OBJDIR)/doc_.c:$(OBJDIR)/doc.h $(OBJDIR)/encode_.c:$(OBJDIR)/encode.h $(OBJDIR)/event_.c:$(OBJDIR)/event.h $(OBJDIR)/export_.c:$(OBJDIR)/export.h $(OBJDIR)/file_.c:$(OBJDIR)/file.h $(OBJDIR)/finfo_.c:$(OBJDIR)/finfo.h $(OBJDIR)/glob_.c:$(OBJDIR)/glob.h $(OBJDIR)/graph_.c:$(OBJDIR)/graph.h $(OBJDIR)/gzip_.c:$(OBJDIR)/gzip.h $(OBJDIR)/http_.c:$(OBJDIR)/http.h $(OBJDIR)/http_socket_.c:$(OBJDIR)/http_socket.h $(OBJDIR)/http_ssl_.c:$(OBJDIR)/http_ssl.h $(OBJDIR)/http_transport_.c:$(OBJDIR)/http_transport.h $(OBJDIR)/iblt_.c:$(OBJDIR)/iblt.h $(OBJDIR)/import_.c:$(OBJDIR)/import.h $(OBJDIR)/info_.c:$(OBJDIR)/info.h $(OBJDIR)/json_.c:$(OBJDIR)/json.h $(OBJDIR)/json_artifact_.c:$(OBJDIR)/json_artifact.h $(OBJDIR)/json_branch_.c:$(OBJDIR)/json_branch.h $(OBJDIR)/json_changes_.c:$(OBJDIR)/json_changes.h $(OBJDIR)/json_config_.c:$(OBJDIR)/json_config.h $(OBJDIR)/json_diff_.c:$(OBJDIR)/json_diff.h $(OBJDIR)/json_dir_.c:$(OBJDIR)/json_dir.h $(OBJDIR)/json_finfo_.c:$(OBJDIR)/json_finfo.h $(OBJDIR)/json_login_.c:$(OBJDIR)/json_login.h $(OBJDIR)/json_query_.c:$(OBJDIR)/json_query.h $(OBJDIR)/json_report_.c:$(OBJDIR)/json_report.h $(OBJDIR)/json_tag_.c:$(OBJDIR)/json_tag.h $(OBJDIR)/json_timeline_.c:$(OBJDIR)/json_timeline.h $(OBJDIR)/json_user_.c:$(OBJDIR)/json_user.h $(OBJDIR)/json_wiki_.c:$(OBJDIR)/json_wiki.h $(OBJDIR)/leaf_.c:$(OBJDIR)/leaf.h $(OBJDIR)/login_.c:$(OBJDIR)/login.h $(OBJDIR)/main_.c:$(OBJDIR)/main.h $(OBJDIR)/manifest_.c:$(OBJDIR)/manifest.h $(OBJDIR)/md5_.c:$(OBJDIR)/md5.h $(OBJDIR)/merge_.c:$(OBJDIR)/merge.h $(OBJDIR)/merge3_.c:$(OBJDIR)/merge3.h $(OBJDIR)/metrics_.c:$(OBJDIR)/metrics.h $(OBJDIR)/name_.c:$(OBJDIR)/name.h $(OBJDIR)/pagecache_.c:$(OBJDIR)/pagecache.h $(OBJDIR)/path_.c:$(OBJDIR)/path.h $(OBJDIR)/perf_.c:$(OBJDIR)/perf.h $(OBJDIR)/pivot_.c:$(OBJDIR)/pivot.h $(OBJDIR)/popen_.c:$(OBJDIR)/popen.h $(OBJDIR)/pqueue_.c:$(OBJDIR)/pqueue.h $(OBJDIR)/printf_.c:$(OBJDIR)/printf.h $(OBJDIR)/rebuild_.c:$(OBJDIR)/rebuild.h $(OBJDIR)/report_.c:$(OBJDIR)/report.h $(OBJDIR)/rss_.c:$(OBJDIR)/rss.h $(OBJDIR)/schema_.c:$(OBJDIR)/schema.h $(OBJDIR)/search_.c:$(OBJDIR)/search.h $(OBJDIR)/setup_.c:$(OBJDIR)/setup.h $(OBJDIR)/sha1_.c:$(OBJDIR)/sha1.h $(OBJDIR)/shmcache_.c:$(OBJDIR)/shmcache.h $(OBJDIR)/shun_.c:$(OBJDIR)/shun.h $(OBJDIR)/skins_.c:$(OBJDIR)/skins.h $(OBJDIR)/sqlcmd_.c:$(OBJDIR)/sqlcmd.h $(OBJDIR)/stash_.c:$(OBJDIR)/stash.h $(OBJDIR)/stat_.c:$(OBJDIR)/stat.h $(OBJDIR)/style_.c:$(OBJDIR)/style.h $(OBJDIR)/sync_.c:$(OBJDIR)/sync.h $(OBJDIR)/tag_.c:$(OBJDIR)/tag.h $(OBJDIR)/tar_.c:$(OBJDIR)/tar.h $(OBJDIR)/th_main_.c:$(OBJDIR)/th_main.h $(OBJDIR)/throttle_.c:$(OBJDIR)/throttle.h $(OBJDIR)/timeline_.c:$(OBJDIR)/timeline.h $(OBJDIR)/tkt_.c:$(OBJDIR)/tkt.h $(OBJDIR)/tktsetup_.c:$(OBJDIR)/tktsetup.h $(OBJDIR)/undo_.c:$(OBJDIR)/undo.h $(OBJDIR)/update_.c:$(OBJDIR)/update.h $(OBJDIR)/url_.c:$(OBJDIR)/url.h $(OBJDIR)/user_.c:$(OBJDIR)/user.h $(OBJDIR)/verify_.c:$(OBJDIR)/verify.h $(OBJDIR)/vfile_.c:$(OBJDIR)/vfile.h $(OBJDIR)/wiki_.c:$(OBJDIR)/wiki.h $(OBJDIR)/wikiformat_.c:$(OBJDIR)/wikiformat.h $(OBJDIR)/winhttp_.c:$(OBJDIR)/winhttp.h $(OBJDIR)/workpool_.c:$(OBJDIR)/workpool.h $(OBJDIR)/xfer_.c:$(OBJDIR)/xfer.h $(OBJDIR)/xfersetup_.c:$(OBJDIR)/xfersetup.h $(OBJDIR)/zip_.c:$(OBJDIR)/zip.h $(SRCDIR)/sqlite3.h $(SRCDIR)/th.h $(OBJDIR)/VERSION.h
 	touch $(OBJDIR)/headers
 $(OBJDIR)/headers: Makefile
-$(OBJDIR)/json.o $(OBJDIR)/json_artifact.o $(OBJDIR)/json_branch.o $(OBJDIR)/json_config.o $(OBJDIR)/json_diff.o $(OBJDIR)/json_dir.o $(OBJDIR)/json_finfo.o $(OBJDIR)/json_login.o $(OBJDIR)/json_query.o $(OBJDIR)/json_report.o $(OBJDIR)/json_tag.o $(OBJDIR)/json_timeline.o $(OBJDIR)/json_user.o $(OBJDIR)/json_wiki.o : $(SRCDIR)/json_detail.h
+$(OBJDIR)/json.o $(OBJDIR)/json_artifact.o $(OBJDIR)/json_branch.o $(OBJDIR)/json_changes.o $(OBJDIR)/json_config.o $(OBJDIR)/json_diff.o $(OBJDIR)/json_dir.o $(OBJDIR)/json_finfo.o $(OBJDIR)/json_login.o $(OBJDIR)/json_query.o $(OBJDIR)/json_report.o $(OBJDIR)/json_tag.o $(OBJDIR)/json_timeline.o $(OBJDIR)/json_user.o $(OBJDIR)/json_wiki.o : $(SRCDIR)/json_detail.h
 Makefile:
 $(OBJDIR)/add_.c:	$(SRCDIR)/add.c $(OBJDIR)/translate
 	$(OBJDIR)/translate $(SRCDIR)/add.c >$(OBJDIR)/add_.c
@@ -409,6 +452,13 @@ $(OBJDIR)/bag.o:	$(OBJDIR)/bag_.c $(OBJDIR)/bag.h  $(SRCDIR)/config.h
 	$(XTCC) -o $(OBJDIR)/bag.o -c $(OBJDIR)/bag_.c
 
 $(OBJDIR)/bag.h:	$(OBJDIR)/headers
+$(OBJDIR)/bench_.c:	$(SRCDIR)/bench.c $(OBJDIR)/translate
+	$(OBJDIR)/translate $(SRCDIR)/bench.c >$(OBJDIR)/bench_.c
+
+$(OBJDIR)/bench.o:	$(OBJDIR)/bench_.c $(OBJDIR)/bench.h  $(SRCDIR)/config.h
+	$(XTCC) -o $(OBJDIR)/bench.o -c $(OBJDIR)/bench_.c
+
+$(OBJDIR)/bench.h:	$(OBJDIR)/headers
 $(OBJDIR)/bisect_.c:	$(SRCDIR)/bisect.c $(OBJDIR)/translate
 	$(OBJDIR)/translate $(SRCDIR)/bisect.c >$(OBJDIR)/bisect_.c
 
@@ -437,6 +487,13 @@ $(OBJDIR)/browse.o:	$(OBJDIR)/browse_.c $(OBJDIR)/browse.h  $(SRCDIR)/config.h
 	$(XTCC) -o $(OBJDIR)/browse.o -c $(OBJDIR)/browse_.c
 
 $(OBJDIR)/browse.h:	$(OBJDIR)/headers
+$(OBJDIR)/bundle_.c:	$(SRCDIR)/bundle.c $(OBJDIR)/translate
+	$(OBJDIR)/translate $(SRCDIR)/bundle.c >$(OBJDIR)/bundle_.c
+
+$(OBJDIR)/bundle.o:	$(OBJDIR)/bundle_.c $(OBJDIR)/bundle.h  $(SRCDIR)/config.h
+	$(XTCC) -o $(OBJDIR)/bundle.o -c $(OBJDIR)/bundle_.c
+
+$(OBJDIR)/bundle.h:	$(OBJDIR)/headers
 $(OBJDIR)/captcha_.c:	$(SRCDIR)/captcha.c $(OBJDIR)/translate
 	$(OBJDIR)/translate $(SRCDIR)/captcha.c >$(OBJDIR)/captcha_.c
 
@@ -465,6 +522,13 @@ $(OBJDIR)/checkout.o:	$(OBJDIR)/checkout_.c $(OBJDIR)/checkout.h  $(SRCDIR)/conf
 	$(XTCC) -o $(OBJDIR)/checkout.o -c $(OBJDIR)/checkout_.c
 
 $(OBJDIR)/checkout.h:	$(OBJDIR)/headers
+$(OBJDIR)/chunk_.c:	$(SRCDIR)/chunk.c $(OBJDIR)/translate
+	$(OBJDIR)/translate $(SRCDIR)/chunk.c >$(OBJDIR)/chunk_.c
+
+$(OBJDIR)/chunk.o:	$(OBJDIR)/chunk_.c $(OBJDIR)/chunk.h  $(SRCDIR)/config.h
+	$(XTCC) -o $(OBJDIR)/chunk.o -c $(OBJDIR)/chunk_.c
+
+$(OBJDIR)/chunk.h:	$(OBJDIR)/headers
 $(OBJDIR)/clearsign_.c:	$(SRCDIR)/clearsign.c $(OBJDIR)/translate
 	$(OBJDIR)/translate $(SRCDIR)/clearsign.c >$(OBJDIR)/clearsign_.c
 
@@ -500,6 +564,13 @@ $(OBJDIR)/content.o:	$(OBJDIR)/content_.c $(OBJDIR)/content.h  $(SRCDIR)/config.
 	$(XTCC) -o $(OBJDIR)/content.o -c $(OBJDIR)/content_.c
 
 $(OBJDIR)/content.h:	$(OBJDIR)/headers
+$(OBJDIR)/dag_.c:	$(SRCDIR)/dag.c $(OBJDIR)/translate
+	$(OBJDIR)/translate $(SRCDIR)/dag.c >$(OBJDIR)/dag_.c
+
+$(OBJDIR)/dag.o:	$(OBJDIR)/dag_.c $(OBJDIR)/dag.h  $(SRCDIR)/config.h
+	$(XTCC) -o $(OBJDIR)/dag.o -c $(OBJDIR)/dag_.c
+
+$(OBJDIR)/dag.h:	$(OBJDIR)/headers
 $(OBJDIR)/db_.c:	$(SRCDIR)/db.c $(OBJDIR)/translate
 	$(OBJDIR)/translate $(SRCDIR)/db.c >$(OBJDIR)/db_.c
 
@@ -633,6 +704,13 @@ $(OBJDIR)/http_transport.o:	$(OBJDIR)/http_transport_.c $(OBJDIR)/http_transport
 	$(XTCC) -o $(OBJDIR)/http_transport.o -c $(OBJDIR)/http_transport_.c
 
 $(OBJDIR)/http_transport.h:	$(OBJDIR)/headers
+$(OBJDIR)/iblt_.c:	$(SRCDIR)/iblt.c $(OBJDIR)/translate
+	$(OBJDIR)/translate $(SRCDIR)/iblt.c >$(OBJDIR)/iblt_.c
+
+$(OBJDIR)/iblt.o:	$(OBJDIR)/iblt_.c $(OBJDIR)/iblt.h  $(SRCDIR)/config.h
+	$(XTCC) -o $(OBJDIR)/iblt.o -c $(OBJDIR)/iblt_.c
+
+$(OBJDIR)/iblt.h:	$(OBJDIR)/headers
 $(OBJDIR)/import_.c:	$(SRCDIR)/import.c $(OBJDIR)/translate
 	$(OBJDIR)/translate $(SRCDIR)/import.c >$(OBJDIR)/import_.c
 
@@ -668,6 +746,13 @@ $(OBJDIR)/json_branch.o:	$(OBJDIR)/json_branch_.c $(OBJDIR)/json_branch.h  $(SRC
 	$(XTCC) -o $(OBJDIR)/json_branch.o -c $(OBJDIR)/json_branch_.c
 
 $(OBJDIR)/json_branch.h:	$(OBJDIR)/headers
+$(OBJDIR)/json_changes_.c:	$(SRCDIR)/json_changes.c $(OBJDIR)/translate
+	$(OBJDIR)/translate $(SRCDIR)/json_changes.c >$(OBJDIR)/json_changes_.c
+
+$(OBJDIR)/json_changes.o:	$(OBJDIR)/json_changes_.c $(OBJDIR)/json_changes.h  $(SRCDIR)/config.h
+	$(XTCC) -o $(OBJDIR)/json_changes.o -c $(OBJDIR)/json_changes_.c
+
+$(OBJDIR)/json_changes.h:	$(OBJDIR)/headers
 $(OBJDIR)/json_config_.c:	$(SRCDIR)/json_config.c $(OBJDIR)/translate
 	$(OBJDIR)/translate $(SRCDIR)/json_config.c >$(OBJDIR)/json_config_.c
 
@@ -794,6 +879,13 @@ $(OBJDIR)/merge3.o:	$(OBJDIR)/merge3_.c $(OBJDIR)/merge3.h  $(SRCDIR)/config.h
 	$(XTCC) -o $(OBJDIR)/merge3.o -c $(OBJDIR)/merge3_.c
 
 $(OBJDIR)/merge3.h:	$(OBJDIR)/headers
+$(OBJDIR)/metrics_.c:	$(SRCDIR)/metrics.c $(OBJDIR)/translate
+	$(OBJDIR)/translate $(SRCDIR)/metrics.c >$(OBJDIR)/metrics_.c
+
+$(OBJDIR)/metrics.o:	$(OBJDIR)/metrics_.c $(OBJDIR)/metrics.h  $(SRCDIR)/config.h
+	$(XTCC) -o $(OBJDIR)/metrics.o -c $(OBJDIR)/metrics_.c
+
+$(OBJDIR)/metrics.h:	$(OBJDIR)/headers
 $(OBJDIR)/name_.c:	$(SRCDIR)/name.c $(OBJDIR)/translate
 	$(OBJDIR)/translate $(SRCDIR)/name.c >$(OBJDIR)/name_.c
 
@@ -801,6 +893,13 @@ $(OBJDIR)/name.o:	$(OBJDIR)/name_.c $(OBJDIR)/name.h  $(SRCDIR)/config.h
 	$(XTCC) -o $(OBJDIR)/name.o -c $(OBJDIR)/name_.c
 
 $(OBJDIR)/name.h:	$(OBJDIR)/headers
+$(OBJDIR)/pagecache_.c:	$(SRCDIR)/pagecache.c $(OBJDIR)/translate
+	$(OBJDIR)/translate $(SRCDIR)/pagecache.c >$(OBJDIR)/pagecache_.c
+
+$(OBJDIR)/pagecache.o:	$(OBJDIR)/pagecache_.c $(OBJDIR)/pagecache.h  $(SRCDIR)/config.h
+	$(XTCC) -o $(OBJDIR)/pagecache.o -c $(OBJDIR)/pagecache_.c
+
+$(OBJDIR)/pagecache.h:	$(OBJDIR)/headers
 $(OBJDIR)/path_.c:	$(SRCDIR)/path.c $(OBJDIR)/translate
 	$(OBJDIR)/translate $(SRCDIR)/path.c >$(OBJDIR)/path_.c
 
@@ -808,6 +907,13 @@ $(OBJDIR)/path.o:	$(OBJDIR)/path_.c $(OBJDIR)/path.h  $(SRCDIR)/config.h
 	$(XTCC) -o $(OBJDIR)/path.o -c $(OBJDIR)/path_.c
 
 $(OBJDIR)/path.h:	$(OBJDIR)/headers
+$(OBJDIR)/perf_.c:	$(SRCDIR)/perf.c $(OBJDIR)/translate
+	$(OBJDIR)/translate $(SRCDIR)/perf.c >$(OBJDIR)/perf_.c
+
+$(OBJDIR)/perf.o:	$(OBJDIR)/perf_.c $(OBJDIR)/perf.h  $(SRCDIR)/config.h
+	$(XTCC) -o $(OBJDIR)/perf.o -c $(OBJDIR)/perf_.c
+
+$(OBJDIR)/perf.h:	$(OBJDIR)/headers
 $(OBJDIR)/pivot_.c:	$(SRCDIR)/pivot.c $(OBJDIR)/translate
 	$(OBJDIR)/translate $(SRCDIR)/pivot.c >$(OBJDIR)/pivot_.c
 
@@ -885,6 +991,13 @@ $(OBJDIR)/sha1.o:	$(OBJDIR)/sha1_.c $(OBJDIR)/sha1.h  $(SRCDIR)/config.h
 	$(XTCC) -o $(OBJDIR)/sha1.o -c $(OBJDIR)/sha1_.c
 
 $(OBJDIR)/sha1.h:	$(OBJDIR)/headers
+$(OBJDIR)/shmcache_.c:	$(SRCDIR)/shmcache.c $(OBJDIR)/translate
+	$(OBJDIR)/translate $(SRCDIR)/shmcache.c >$(OBJDIR)/shmcache_.c
+
+$(OBJDIR)/shmcache.o:	$(OBJDIR)/shmcache_.c $(OBJDIR)/shmcache.h  $(SRCDIR)/config.h
+	$(XTCC) -o $(OBJDIR)/shmcache.o -c $(OBJDIR)/shmcache_.c
+
+$(OBJDIR)/shmcache.h:	$(OBJDIR)/headers
 $(OBJDIR)/shun_.c:	$(SRCDIR)/shun.c $(OBJDIR)/translate
 	$(OBJDIR)/translate $(SRCDIR)/shun.c >$(OBJDIR)/shun_.c
 
@@ -955,6 +1068,13 @@ $(OBJDIR)/th_main.o:	$(OBJDIR)/th_main_.c $(OBJDIR)/th_main.h  $(SRCDIR)/config.
 	$(XTCC) -o $(OBJDIR)/th_main.o -c $(OBJDIR)/th_main_.c
 
 $(OBJDIR)/th_main.h:	$(OBJDIR)/headers
+$(OBJDIR)/throttle_.c:	$(SRCDIR)/throttle.c $(OBJDIR)/translate
+	$(OBJDIR)/translate $(SRCDIR)/throttle.c >$(OBJDIR)/throttle_.c
+
+$(OBJDIR)/throttle.o:	$(OBJDIR)/throttle_.c $(OBJDIR)/throttle.h  $(SRCDIR)/config.h
+	$(XTCC) -o $(OBJDIR)/throttle.o -c $(OBJDIR)/throttle_.c
+
+$(OBJDIR)/throttle.h:	$(OBJDIR)/headers
 $(OBJDIR)/timeline_.c:	$(SRCDIR)/timeline.c $(OBJDIR)/translate
 	$(OBJDIR)/translate $(SRCDIR)/timeline.c >$(OBJDIR)/timeline_.c
 
@@ -1039,6 +1159,13 @@ $(OBJDIR)/winhttp.o:	$(OBJDIR)/winhttp_.c $(OBJDIR)/winhttp.h  $(SRCDIR)/config.
 	$(XTCC) -o $(OBJDIR)/winhttp.o -c $(OBJDIR)/winhttp_.c
 
 $(OBJDIR)/winhttp.h:	$(OBJDIR)/headers
+$(OBJDIR)/workpool_.c:	$(SRCDIR)/workpool.c $(OBJDIR)/translate
+	$(OBJDIR)/translate $(SRCDIR)/workpool.c >$(OBJDIR)/workpool_.c
+
+$(OBJDIR)/workpool.o:	$(OBJDIR)/workpool_.c $(OBJDIR)/workpool.h  $(SRCDIR)/config.h
+	$(XTCC) -o $(OBJDIR)/workpool.o -c $(OBJDIR)/workpool_.c
+
+$(OBJDIR)/workpool.h:	$(OBJDIR)/headers
 $(OBJDIR)/xfer_.c:	$(SRCDIR)/xfer.c $(OBJDIR)/translate
 	$(OBJDIR)/translate $(SRCDIR)/xfer.c >$(OBJDIR)/xfer_.c
 
@@ -1061,7 +1188,7 @@ $(OBJDIR)/zip.o:	$(OBJDIR)/zip_.c $(OBJDIR)/zip.h  $(SRCDIR)/config.h
 
 $(OBJDIR)/zip.h:	$(OBJDIR)/headers
 $(OBJDIR)/sqlite3.o:	$(SRCDIR)/sqlite3.c
-	$(XTCC) -DSQLITE_OMIT_LOAD_EXTENSION=1 -DSQLITE_THREADSAFE=0 -DSQLITE_DEFAULT_FILE_FORMAT=4 -DSQLITE_ENABLE_STAT3 -Dlocaltime=fossil_localtime -DSQLITE_ENABLE_LOCKING_STYLE=0 -c $(SRCDIR)/sqlite3.c -o $(OBJDIR)/sqlite3.o
+	$(XTCC) -DSQLITE_OMIT_LOAD_EXTENSION=1 -DSQLITE_THREADSAFE=0 -DSQLITE_DEFAULT_FILE_FORMAT=4 -DSQLITE_ENABLE_FTS4 -DSQLITE_ENABLE_STAT3 -Dlocaltime=fossil_localtime -DSQLITE_ENABLE_LOCKING_STYLE=0 -c $(SRCDIR)/sqlite3.c -o $(OBJDIR)/sqlite3.o
 
 $(OBJDIR)/shell.o:	$(SRCDIR)/shell.c $(SRCDIR)/sqlite3.h
 	$(XTCC) -Dmain=sqlite3_shell -DSQLITE_OMIT_LOAD_EXTENSION=1 -c $(SRCDIR)/shell.c -o $(OBJDIR)/shell.o
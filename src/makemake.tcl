@@ -22,19 +22,23 @@ set src {
   allrepo
   attach
   bag
+  bench
   bisect
   blob
   branch
   browse
+  bundle
   captcha
   cgi
   checkin
   checkout
+  chunk
   clearsign
   clone
   comformat
   configure
   content
+  dag
   db
   delta
   deltacmd
@@ -53,11 +57,13 @@ set src {
   http
   http_socket
   http_transport
+  iblt
   import
   info
   json
   json_artifact
   json_branch
+  json_changes
   json_config
   json_diff
   json_dir
@@ -76,8 +82,11 @@ set src {
   md5
   merge
   merge3
+  metrics
   name
+  pagecache
   path
+  perf
   pivot
   popen
   pqueue
@@ -89,6 +98,7 @@ set src {
   search
   setup
   sha1
+  shmcache
   shun
   skins
   sqlcmd
@@ -99,6 +109,7 @@ set src {
   tag
   tar
   th_main
+  throttle
   timeline
   tkt
   tktsetup
@@ -111,6 +122,7 @@ set src {
   wiki
   wikiformat
   winhttp
+  workpool
   xfer
   xfersetup
   zip
@@ -205,6 +217,13 @@ $(OBJDIR)/mkversion:	$(SRCDIR)/mkversion.c
 test:	$(OBJDIR) $(APPNAME)
 	$(TCLSH) $(SRCDIR)/../test/tester.tcl $(APPNAME)
 
+# Time the hot code paths against a synthetic repository built in a
+# temporary directory.  Results are printed one per line as JSON.  Set
+# BENCHFLAGS to choose the repository size, for example
+# BENCHFLAGS="-files 2000 -checkins 500".
+bench:	$(OBJDIR) $(APPNAME)
+	$(TCLSH) $(SRCDIR)/../test/bench.tcl $(APPNAME) $(BENCHFLAGS)
+
 $(OBJDIR)/VERSION.h:	$(SRCDIR)/../manifest.uuid $(SRCDIR)/../manifest $(SRCDIR)/../VERSION $(OBJDIR)/mkversion
 	$(OBJDIR)/mkversion $(SRCDIR)/../manifest.uuid \
 		$(SRCDIR)/../manifest \
@@ -262,7 +281,7 @@ writeln "\$(OBJDIR)/headers:\t\$(OBJDIR)/page_index.h \$(OBJDIR)/makeheaders \$(
 writeln "\t\$(OBJDIR)/makeheaders $mhargs"
 writeln "\ttouch \$(OBJDIR)/headers"
 writeln "\$(OBJDIR)/headers: Makefile"
-writeln "\$(OBJDIR)/json.o \$(OBJDIR)/json_artifact.o \$(OBJDIR)/json_branch.o \$(OBJDIR)/json_config.o \$(OBJDIR)/json_diff.o \$(OBJDIR)/json_dir.o \$(OBJDIR)/json_finfo.o \$(OBJDIR)/json_login.o \$(OBJDIR)/json_query.o \$(OBJDIR)/json_report.o \$(OBJDIR)/json_tag.o \$(OBJDIR)/json_timeline.o \$(OBJDIR)/json_user.o \$(OBJDIR)/json_wiki.o : \$(SRCDIR)/json_detail.h"
+writeln "\$(OBJDIR)/json.o \$(OBJDIR)/json_artifact.o \$(OBJDIR)/json_branch.o \$(OBJDIR)/json_changes.o \$(OBJDIR)/json_config.o \$(OBJDIR)/json_diff.o \$(OBJDIR)/json_dir.o \$(OBJDIR)/json_finfo.o \$(OBJDIR)/json_login.o \$(OBJDIR)/json_query.o \$(OBJDIR)/json_report.o \$(OBJDIR)/json_tag.o \$(OBJDIR)/json_timeline.o \$(OBJDIR)/json_user.o \$(OBJDIR)/json_wiki.o : \$(SRCDIR)/json_detail.h"
 writeln "Makefile:"
 set extra_h(main) \$(OBJDIR)/page_index.h
 
@@ -278,7 +297,7 @@ foreach s [lsort $src] {
 writeln "\$(OBJDIR)/sqlite3.o:\t\$(SRCDIR)/sqlite3.c"
 set opt {-DSQLITE_OMIT_LOAD_EXTENSION=1}
 append opt " -DSQLITE_THREADSAFE=0 -DSQLITE_DEFAULT_FILE_FORMAT=4"
-#append opt " -DSQLITE_ENABLE_FTS3=1"
+append opt " -DSQLITE_ENABLE_FTS4"
 append opt " -DSQLITE_ENABLE_STAT3"
 append opt " -Dlocaltime=fossil_localtime"
 append opt " -DSQLITE_ENABLE_LOCKING_STYLE=0"
@@ -545,6 +564,13 @@ $(VERSION): $(SRCDIR)/mkversion.c
 test:	$(OBJDIR) $(APPNAME)
 	$(TCLSH) $(SRCDIR)/../test/tester.tcl $(APPNAME)
 
+# Time the hot code paths against a synthetic repository built in a
+# temporary directory.  Results are printed one per line as JSON.  Set
+# BENCHFLAGS to choose the repository size, for example
+# BENCHFLAGS="-files 2000 -checkins 500".
+bench:	$(OBJDIR) $(APPNAME)
+	$(TCLSH) $(SRCDIR)/../test/bench.tcl $(APPNAME) $(BENCHFLAGS)
+
 $(OBJDIR)/VERSION.h:	$(SRCDIR)/../manifest.uuid $(SRCDIR)/../manifest $(VERSION)
 	$(VERSION) $(SRCDIR)/../manifest.uuid $(SRCDIR)/../manifest $(SRCDIR)/../VERSION >$(OBJDIR)/VERSION.h
 
@@ -756,6 +782,7 @@ realclean:
 $(OBJDIR)\json$O : $(SRCDIR)\json_detail.h
 $(OBJDIR)\json_artifact$O : $(SRCDIR)\json_detail.h
 $(OBJDIR)\json_branch$O : $(SRCDIR)\json_detail.h
+$(OBJDIR)\json_changes$O : $(SRCDIR)\json_detail.h
 $(OBJDIR)\json_config$O : $(SRCDIR)\json_detail.h
 $(OBJDIR)\json_diff$O : $(SRCDIR)\json_detail.h
 $(OBJDIR)\json_dir$O : $(SRCDIR)\json_detail.h
@@ -916,6 +943,7 @@ realclean:
 $(OBJDIR)\json$O : $(SRCDIR)\json_detail.h
 $(OBJDIR)\json_artifact$O : $(SRCDIR)\json_detail.h
 $(OBJDIR)\json_branch$O : $(SRCDIR)\json_detail.h
+$(OBJDIR)\json_changes$O : $(SRCDIR)\json_detail.h
 $(OBJDIR)\json_config$O : $(SRCDIR)\json_detail.h
 $(OBJDIR)\json_diff$O : $(SRCDIR)\json_detail.h
 $(OBJDIR)\json_dir$O : $(SRCDIR)\json_detail.h
@@ -1043,7 +1071,7 @@ UTILS_SRC=$(foreach uf,$(UTILS),$(SRCDIR)$(uf:.exe=.c))
 SQLITESRC=sqlite3.c
 ORIGSQLITESRC=$(foreach sf,$(SQLITESRC),$(SRCDIR)$(sf))
 SQLITEOBJ=$(foreach sf,$(SQLITESRC),$(sf:.c=.obj))
-SQLITEDEFINES=-DSQLITE_OMIT_LOAD_EXTENSION=1 -DSQLITE_THREADSAFE=0 -DSQLITE_DEFAULT_FILE_FORMAT=4 -Dlocaltime=fossil_localtime -DSQLITE_ENABLE_LOCKING_STYLE=0
+SQLITEDEFINES=-DSQLITE_OMIT_LOAD_EXTENSION=1 -DSQLITE_THREADSAFE=0 -DSQLITE_DEFAULT_FILE_FORMAT=4 -DSQLITE_ENABLE_FTS4 -Dlocaltime=fossil_localtime -DSQLITE_ENABLE_LOCKING_STYLE=0
 
 # define the sqlite shell files, which need special flags on compile
 SQLITESHELLSRC=shell.c
@@ -104,20 +104,53 @@ struct Manifest {
     char *zName;           /* Key or field name */
     char *zValue;          /* Value of the field */
   } *aField;            /* One for each J card */
+  int nRef;             /* Number of references to this object */
+  int iBaseFile;        /* Index of current file of pBaseline in iterator */
+  int isCached;         /* True if this object is in the manifest cache */
+  int nByte;            /* Approximate bytes of memory used.  For the cache */
+  Manifest *pCacheNext; /* Next older entry of the manifest cache */
+  Manifest *pCachePrev; /* Next newer entry of the manifest cache */
+  Manifest *pHashNext;  /* Next entry in the same manifest cache bucket */
 };
 #endif
 
 /*
-** A cache of parsed manifests.  This reduces the number of
-** calls to manifest_parse() when doing a rebuild.
+** A cache of parsed manifests.  This reduces the number of calls to
+** manifest_parse() when doing a rebuild, and in any process that looks
+** at the same check-ins more than once.
+**
+** Entries are kept on a list from most recently used (pHead) to least
+** recently used (pTail), and in a hash table on rid.  The cache is
+** bounded by the approximate number of bytes of memory held by its
+** entries.  The limit comes from the "manifest-cache-size" setting and
+** is read the first time an entry is inserted.
+**
+** The cache holds one reference to each of its entries.  A baseline
+** manifest is also shared by all of the delta-manifests that use it,
+** each of which holds a reference of its own.  Only manifest_file_next()
+** and manifest_file_seek() look at the baseline, and they keep their
+** position in the baseline in the delta-manifest, so sharing is safe.
+**
+** Any other manifest obtained from manifest_cache_find() or manifest_get()
+** belongs to the caller alone until it is handed back with
+** manifest_destroy().  Check-in manifests handed back are kept in the
+** cache for later use.
 */
-#define MX_MANIFEST_CACHE 6
 static struct {
-  int nxAge;
-  int aAge[MX_MANIFEST_CACHE];
-  Manifest *apManifest[MX_MANIFEST_CACHE];
+  i64 szTotal;          /* Sum of nByte over all entries */
+  i64 szLimit;          /* Maximum value for szTotal.  0 if not yet known */
+  int n;                /* Number of entries */
+  int nHash;            /* Number of slots in apHash[] */
+  Manifest **apHash;    /* Hash table of entries on rid */
+  Manifest *pHead;      /* Most recently used entry */
+  Manifest *pTail;      /* Least recently used entry */
 } manifestCache;
 
+/*
+** The default value of the "manifest-cache-size" setting, in bytes.
+*/
+#define MANIFEST_CACHE_DFLT 10000000
+
 /*
 ** True if manifest_crosslink_begin() has been called but
 ** manifest_crosslink_end() is still pending.
@@ -125,10 +158,28 @@ static struct {
 static int manifest_crosslink_busy = 0;
 
 /*
-** Clear the memory allocated in a manifest object
+** True if an artifact has been crosslinked since manifest_crosslink_begin()
+** and so the page cache must be invalidated by manifest_crosslink_end().
 */
-void manifest_destroy(Manifest *p){
+static int manifest_crosslink_changed = 0;
+
+/*
+** Check-ins whose propagating tags still have to be pushed down to
+** their children.  While manifest_crosslink_busy is true, this work is
+** put off until manifest_crosslink_end() so that it is done once for
+** each parent rather than once for every child that is crosslinked.
+*/
+static Bag pendingPropagate;
+
+/*
+** Drop one reference to a manifest object and free the memory it uses
+** once no references remain.
+*/
+static void manifest_unref(Manifest *p){
   if( p ){
+    assert( p->nRef>0 );
+    if( --p->nRef>0 ) return;
+    assert( !p->isCached );
     blob_reset(&p->content);
     free(p->aFile);
     free(p->azParent);
@@ -136,74 +187,190 @@ void manifest_destroy(Manifest *p){
     free(p->aTag);
     free(p->aField);
     free(p->aCherrypick);
-    if( p->pBaseline ) manifest_destroy(p->pBaseline);
+    manifest_unref(p->pBaseline);
     memset(p, 0, sizeof(*p));
     fossil_free(p);
   }
 }
 
 /*
-** Add an element to the manifest cache using LRU replacement.
+** Hand back a manifest object that the caller is finished with.  A
+** check-in manifest is kept in the manifest cache.  Anything else is
+** freed once no other references to it remain.
 */
-void manifest_cache_insert(Manifest *p){
-  while( p ){
-    int i;
-    Manifest *pBaseline = p->pBaseline;
-    p->pBaseline = 0;
-    for(i=0; i<MX_MANIFEST_CACHE; i++){
-      if( manifestCache.apManifest[i]==0 ) break;
+void manifest_destroy(Manifest *p){
+  if( p ){
+    if( p->type==CFTYPE_MANIFEST && p->rid>0 && !p->isCached
+     && g.repositoryOpen
+    ){
+      manifest_cache_insert(p);
+    }else{
+      manifest_unref(p);
     }
-    if( i>=MX_MANIFEST_CACHE ){
-      int oldest = 0;
-      int oldestAge = manifestCache.aAge[0];
-      for(i=1; i<MX_MANIFEST_CACHE; i++){
-        if( manifestCache.aAge[i]<oldestAge ){
-          oldest = i;
-          oldestAge = manifestCache.aAge[i];
-        }
-      }
-      manifest_destroy(manifestCache.apManifest[oldest]);
-      i = oldest;
+  }
+}
+
+/*
+** Return a pointer to the hash table slot that holds, or that ought
+** to hold, the cache entry for rid.
+*/
+static Manifest **manifest_cache_slot(int rid){
+  Manifest **pp;
+  pp = &manifestCache.apHash[((unsigned)rid*101)%manifestCache.nHash];
+  while( *pp && (*pp)->rid!=rid ) pp = &(*pp)->pHashNext;
+  return pp;
+}
+
+/*
+** Remove entry p from the LRU list of the manifest cache.
+*/
+static void manifest_cache_unlink(Manifest *p){
+  if( p->pCachePrev ){
+    p->pCachePrev->pCacheNext = p->pCacheNext;
+  }else{
+    manifestCache.pHead = p->pCacheNext;
+  }
+  if( p->pCacheNext ){
+    p->pCacheNext->pCachePrev = p->pCachePrev;
+  }else{
+    manifestCache.pTail = p->pCachePrev;
+  }
+  p->pCachePrev = p->pCacheNext = 0;
+}
+
+/*
+** Make entry p the most recently used entry of the manifest cache.
+*/
+static void manifest_cache_link_head(Manifest *p){
+  p->pCachePrev = 0;
+  p->pCacheNext = manifestCache.pHead;
+  if( manifestCache.pHead ){
+    manifestCache.pHead->pCachePrev = p;
+  }else{
+    manifestCache.pTail = p;
+  }
+  manifestCache.pHead = p;
+}
+
+/*
+** Remove entry p from the manifest cache and return the reference that
+** the cache held to the caller.
+*/
+static Manifest *manifest_cache_remove(Manifest *p){
+  Manifest **pp = manifest_cache_slot(p->rid);
+  assert( *pp==p );
+  *pp = p->pHashNext;
+  p->pHashNext = 0;
+  manifest_cache_unlink(p);
+  manifestCache.szTotal -= p->nByte;
+  manifestCache.n--;
+  p->isCached = 0;
+  return p;
+}
+
+/*
+** Return the approximate number of bytes of memory used by manifest p,
+** not counting its baseline.
+*/
+static int manifest_memory_used(Manifest *p){
+  return sizeof(*p) + blob_size(&p->content)
+       + p->nFileAlloc*sizeof(p->aFile[0])
+       + p->nParentAlloc*sizeof(p->azParent[0])
+       + p->nCherrypick*sizeof(p->aCherrypick[0])
+       + p->nCChildAlloc*sizeof(p->azCChild[0])
+       + p->nTagAlloc*sizeof(p->aTag[0])
+       + p->nFieldAlloc*sizeof(p->aField[0]);
+}
+
+/*
+** Add an element to the manifest cache using LRU replacement.  This
+** hands one reference to p over to the cache.
+*/
+void manifest_cache_insert(Manifest *p){
+  Manifest **pp;
+  if( p==0 ) return;
+  if( manifestCache.szLimit==0 ){
+    manifestCache.szLimit = db_get_int("manifest-cache-size",
+                                       MANIFEST_CACHE_DFLT);
+    if( manifestCache.szLimit<=0 ) manifestCache.szLimit = MANIFEST_CACHE_DFLT;
+  }
+  if( manifestCache.n>=manifestCache.nHash ){
+    /* Grow the hash table and rehash every entry */
+    Manifest *pE;
+    manifestCache.nHash = manifestCache.nHash*2 + 61;
+    free(manifestCache.apHash);
+    manifestCache.apHash = fossil_malloc(
+                         manifestCache.nHash*sizeof(manifestCache.apHash[0]));
+    memset(manifestCache.apHash, 0,
+           manifestCache.nHash*sizeof(manifestCache.apHash[0]));
+    for(pE=manifestCache.pHead; pE; pE=pE->pCacheNext){
+      pp = manifest_cache_slot(pE->rid);
+      pE->pHashNext = 0;
+      *pp = pE;
     }
-    manifestCache.aAge[i] = ++manifestCache.nxAge;
-    manifestCache.apManifest[i] = p;
-    p = pBaseline;
+  }
+  pp = manifest_cache_slot(p->rid);
+  if( *pp ){
+    /* Already in the cache.  Keep the older copy */
+    Manifest *pOld = *pp;
+    manifest_cache_unlink(pOld);
+    manifest_cache_link_head(pOld);
+    manifest_unref(p);
+    return;
+  }
+  assert( !p->isCached );
+  p->isCached = 1;
+  p->nByte = manifest_memory_used(p);
+  *pp = p;
+  manifest_cache_link_head(p);
+  manifestCache.szTotal += p->nByte;
+  manifestCache.n++;
+  while( manifestCache.szTotal>manifestCache.szLimit ){
+    manifest_unref(manifest_cache_remove(manifestCache.pTail));
   }
 }
 
 /*
-** Try to extract a line from the manifest cache. Return 1 if found.
-** Return 0 if not found.
+** Try to extract a line from the manifest cache.  Return a pointer to
+** the manifest, which now belongs to the caller, or NULL if not found.
 */
 static Manifest *manifest_cache_find(int rid){
-  int i;
   Manifest *p;
-  for(i=0; i<MX_MANIFEST_CACHE; i++){
-    if( manifestCache.apManifest[i] && manifestCache.apManifest[i]->rid==rid ){
-      p = manifestCache.apManifest[i];
-      manifestCache.apManifest[i] = 0;
-      return p;
-    }
-  }
-  return 0;
+  if( manifestCache.n==0 ) return 0;
+  p = *manifest_cache_slot(rid);
+  return p ? manifest_cache_remove(p) : 0;
 }
 
 /*
 ** Clear the manifest cache.
 */
 void manifest_cache_clear(void){
-  int i;
-  for(i=0; i<MX_MANIFEST_CACHE; i++){
-    if( manifestCache.apManifest[i] ){
-      manifest_destroy(manifestCache.apManifest[i]);
-    }
+  while( manifestCache.pTail ){
+    manifest_unref(manifest_cache_remove(manifestCache.pTail));
   }
+  free(manifestCache.apHash);
   memset(&manifestCache, 0, sizeof(manifestCache));
 }
 
+/*
+** Parse the manifests of the nCkin most recent check-ins into the
+** manifest cache.  A server process that forks a new process for each
+** request does this once, so that the requests share the work.
+*/
+void manifest_preload(int nCkin){
+  Stmt q;
+  db_prepare(&q,
+    "SELECT objid FROM event WHERE type='ci' ORDER BY mtime DESC LIMIT %d",
+    nCkin
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    manifest_cache_insert(manifest_get(db_column_int(&q, 0), CFTYPE_MANIFEST));
+  }
+  db_finalize(&q);
+}
+
 #ifdef FOSSIL_DONT_VERIFY_MANIFEST_MD5SUM
-# define md5sum_init(X)
-# define md5sum_step_text(X,Y)
+# define md5_ctx_step(X,Y,Z)
 #endif
 
 /*
@@ -250,11 +417,13 @@ static void remove_pgp_signature(char **pz, int *pn){
 **   Z aea84f4f863865a8d59d0384e4d2a41c
 */
 static int verify_z_card(const char *z, int n){
+  MD5Context ctx;
+  char zCksum[33];
   if( n<35 ) return 0;
   if( z[n-35]!='Z' || z[n-34]!=' ' ) return 0;
-  md5sum_init();
-  md5sum_step_text(z, n-35);
-  if( memcmp(&z[n-33], md5sum_finish(0), 32)==0 ){
+  md5_ctx_init(&ctx);
+  md5_ctx_step(&ctx, z, n-35);
+  if( memcmp(&z[n-33], md5_ctx_finish(&ctx, zCksum), 32)==0 ){
     return 1;
   }else{
     return 2;
@@ -336,7 +505,7 @@ static char next_card(ManifestText *p){
 ** The card type determines the other parameters to the card.
 ** Cards must occur in lexicographical order.
 */
-static Manifest *manifest_parse(Blob *pContent, int rid){
+Manifest *manifest_parse(Blob *pContent, int rid){
   Manifest *p;
   int seenZ = 0;
   int i, lineNo=0;
@@ -389,6 +558,7 @@ static Manifest *manifest_parse(Blob *pContent, int rid){
   */
   p = fossil_malloc( sizeof(*p) );
   memset(p, 0, sizeof(*p));
+  p->nRef = 1;
   memcpy(&p->content, pContent, sizeof(p->content));
   p->rid = rid;
   blob_zero(pContent);
@@ -896,14 +1066,12 @@ static Manifest *manifest_parse(Blob *pContent, int rid){
     if( p->zTicketUuid ) goto manifest_syntax_error;
     p->type = CFTYPE_MANIFEST;
   }
-  md5sum_init();
   if( !isRepeat ) g.parseCnt[p->type]++;
   return p;
 
 manifest_syntax_error:
   /*fprintf(stderr, "Manifest error on line %i\n", lineNo);fflush(stderr);*/
-  md5sum_init();
-  manifest_destroy(p);
+  manifest_unref(p);
   return 0;
 }
 
@@ -921,8 +1089,10 @@ Manifest *manifest_get(int rid, int cfType){
       manifest_cache_insert(p);
       p = 0;
     }
+    perf_count(PERF_MANIFEST_HIT, 1);
     return p;
   }
+  perf_count(PERF_MANIFEST_MISS, 1);
   content_get(rid, &content);
   p = manifest_parse(&content, rid);
   if( p && cfType!=CFTYPE_ANY && cfType!=p->type ){
@@ -988,7 +1158,19 @@ void manifest_test_parse_cmd(void){
 static int fetch_baseline(Manifest *p, int throwError){
   if( p->zBaseline!=0 && p->pBaseline==0 ){
     int rid = uuid_to_rid(p->zBaseline, 1);
-    p->pBaseline = manifest_get(rid, CFTYPE_MANIFEST);
+    Manifest *pB = manifestCache.n ? *manifest_cache_slot(rid) : 0;
+    if( pB && pB->type==CFTYPE_MANIFEST ){
+      /* Share the copy that is already in the cache */
+      manifest_cache_unlink(pB);
+      manifest_cache_link_head(pB);
+      pB->nRef++;
+    }else if( (pB = manifest_get(rid, CFTYPE_MANIFEST))!=0 ){
+      /* Keep a copy in the cache for other delta-manifests to share */
+      pB->nRef++;
+      manifest_cache_insert(pB);
+    }
+    p->pBaseline = pB;
+    p->iBaseFile = 0;
     if( p->pBaseline==0 ){
       if( !throwError ){
         db_multi_exec(
@@ -1008,10 +1190,8 @@ static int fetch_baseline(Manifest *p, int throwError){
 */
 void manifest_file_rewind(Manifest *p){
   p->iFile = 0;
+  p->iBaseFile = 0;
   fetch_baseline(p, 1);
-  if( p->pBaseline ){
-    p->pBaseline->iFile = 0;
-  }
 }
 
 /*
@@ -1037,7 +1217,7 @@ ManifestFile *manifest_file_next(
     Manifest *pB = p->pBaseline;
     int cmp;
     while(1){
-      if( pB->iFile>=pB->nFile ){
+      if( p->iBaseFile>=pB->nFile ){
         /* We have used all entries out of the baseline.  Return the next
         ** entry from the delta. */
         if( p->iFile<p->nFile ) pOut = &p->aFile[p->iFile++];
@@ -1045,13 +1225,13 @@ ManifestFile *manifest_file_next(
       }else if( p->iFile>=p->nFile ){
         /* We have used all entries from the delta.  Return the next
         ** entry from the baseline. */
-        if( pB->iFile<pB->nFile ) pOut = &pB->aFile[pB->iFile++];
+        if( p->iBaseFile<pB->nFile ) pOut = &pB->aFile[p->iBaseFile++];
         break;
-      }else if( (cmp = fossil_strcmp(pB->aFile[pB->iFile].zName,
+      }else if( (cmp = fossil_strcmp(pB->aFile[p->iBaseFile].zName,
                               p->aFile[p->iFile].zName)) < 0 ){
         /* The next baseline entry comes before the next delta entry.
         ** So return the baseline entry. */
-        pOut = &pB->aFile[pB->iFile++];
+        pOut = &pB->aFile[p->iBaseFile++];
         break;
       }else if( cmp>0 ){
         /* The next delta entry comes before the next baseline
@@ -1061,14 +1241,14 @@ ManifestFile *manifest_file_next(
       }else if( p->aFile[p->iFile].zUuid ){
         /* The next delta entry is a replacement for the next baseline
         ** entry.  Skip the baseline entry and return the delta entry */
-        pB->iFile++;
+        p->iBaseFile++;
         pOut = &p->aFile[p->iFile++];
         break;
       }else{
         /* The next delta entry is a delete of the next baseline
         ** entry.  Skip them both.  Repeat the loop to find the next
         ** non-delete entry. */
-        pB->iFile++;
+        p->iBaseFile++;
         p->iFile++;
         continue;
       }
@@ -1077,6 +1257,99 @@ ManifestFile *manifest_file_next(
   return pOut;
 }
 
+/*
+** While a sequence of manifest_crosslink() calls is in progress, the
+** filename-id of every filename that has been looked up is remembered
+** here, so that each distinct name costs only one query against the
+** FILENAME table no matter how many check-ins mention it.  The table
+** is discarded by manifest_crosslink_end().
+*/
+typedef struct FnidEntry FnidEntry;
+struct FnidEntry {
+  int fnid;              /* The filename-id */
+  FnidEntry *pNext;      /* Next entry in the same hash bucket */
+  char zName[1];         /* The filename.  Space allocated as needed */
+};
+static struct {
+  int n;                 /* Number of entries */
+  int nHash;             /* Number of slots in apHash[] */
+  FnidEntry **apHash;    /* Hash table of entries on name */
+} fnidCache;
+
+/*
+** Return the hash bucket in fnidCache for filename zName.
+*/
+static unsigned int fnid_cache_hash(const char *zName){
+  unsigned int h = 0;
+  while( *zName ){
+    h = (h<<3) ^ h ^ (unsigned char)*(zName++);
+  }
+  return h % fnidCache.nHash;
+}
+
+/*
+** Return the fnid remembered for zName, or 0 if it is not known.
+*/
+static int fnid_cache_find(const char *zName){
+  FnidEntry *p;
+  if( fnidCache.nHash==0 ) return 0;
+  for(p=fnidCache.apHash[fnid_cache_hash(zName)]; p; p=p->pNext){
+    if( strcmp(p->zName, zName)==0 ) return p->fnid;
+  }
+  return 0;
+}
+
+/*
+** Remember that the filename-id of zName is fnid.
+*/
+static void fnid_cache_insert(const char *zName, int fnid){
+  int n = strlen(zName);
+  unsigned int h;
+  FnidEntry *p;
+  if( fnidCache.n>=fnidCache.nHash ){
+    /* Grow the hash table and rehash every entry */
+    FnidEntry **apOld = fnidCache.apHash;
+    int i, nOld = fnidCache.nHash;
+    fnidCache.nHash = fnidCache.nHash*2 + 1021;
+    fnidCache.apHash = fossil_malloc(
+                               fnidCache.nHash*sizeof(fnidCache.apHash[0]));
+    memset(fnidCache.apHash, 0, fnidCache.nHash*sizeof(fnidCache.apHash[0]));
+    for(i=0; i<nOld; i++){
+      FnidEntry *pNext;
+      for(p=apOld[i]; p; p=pNext){
+        pNext = p->pNext;
+        h = fnid_cache_hash(p->zName);
+        p->pNext = fnidCache.apHash[h];
+        fnidCache.apHash[h] = p;
+      }
+    }
+    free(apOld);
+  }
+  p = fossil_malloc( sizeof(*p) + n );
+  p->fnid = fnid;
+  memcpy(p->zName, zName, n+1);
+  h = fnid_cache_hash(zName);
+  p->pNext = fnidCache.apHash[h];
+  fnidCache.apHash[h] = p;
+  fnidCache.n++;
+}
+
+/*
+** Forget every entry in fnidCache.
+*/
+static void fnid_cache_clear(void){
+  int i;
+  for(i=0; i<fnidCache.nHash; i++){
+    FnidEntry *p, *pNext;
+    for(p=fnidCache.apHash[i]; p; p=pNext){
+      pNext = p->pNext;
+      free(p);
+    }
+  }
+  free(fnidCache.apHash);
+  memset(&fnidCache, 0, sizeof(fnidCache));
+}
+
 /*
 ** Translate a filename into a filename-id (fnid).  Create a new fnid
 ** if no previously exists.
@@ -1084,6 +1357,10 @@ ManifestFile *manifest_file_next(
 static int filename_to_fnid(const char *zFilename){
   static Stmt q1, s1;
   int fnid;
+  if( manifest_crosslink_busy ){
+    fnid = fnid_cache_find(zFilename);
+    if( fnid ) return fnid;
+  }
   db_static_prepare(&q1, "SELECT fnid FROM filename WHERE name=:fn");
   db_bind_text(&q1, ":fn", zFilename);
   fnid = 0;
@@ -1097,6 +1374,7 @@ static int filename_to_fnid(const char *zFilename){
     db_exec(&s1);
     fnid = db_last_insert_rowid();
   }
+  if( manifest_crosslink_busy ) fnid_cache_insert(zFilename, fnid);
   return fnid;
 }
 
@@ -1167,26 +1445,32 @@ static void add_one_mlink(
 /*
 ** Do a binary search to find a file in the p->aFile[] array.  
 **
-** As an optimization, guess that the file we seek is at index p->iFile.
+** As an optimization, guess that the file we seek is at index *piFile.
 ** That will usually be the case.  If it is not found there, then do the
 ** actual binary search.
 **
-** Update p->iFile to be the index of the file that is found.
+** Update *piFile to be the index of the file that is found.  piFile
+** is &p->iFile, or when p is the baseline of a delta-manifest pDelta,
+** &pDelta->iBaseFile, so that a shared baseline is never changed.
 */
-static ManifestFile *manifest_file_seek_base(Manifest *p, const char *zName){
+static ManifestFile *manifest_file_seek_base(
+  Manifest *p,
+  int *piFile,
+  const char *zName
+){
   int lwr, upr;
   int c;
   int i;
   lwr = 0;
   upr = p->nFile - 1;
-  if( p->iFile>=lwr && p->iFile<upr ){
-    c = fossil_strcmp(p->aFile[p->iFile+1].zName, zName);
+  if( *piFile>=lwr && *piFile<upr ){
+    c = fossil_strcmp(p->aFile[*piFile+1].zName, zName);
     if( c==0 ){
-      return &p->aFile[++p->iFile];
+      return &p->aFile[++*piFile];
     }else if( c>0 ){
-      upr = p->iFile;
+      upr = *piFile;
     }else{
-      lwr = p->iFile+1;
+      lwr = *piFile+1;
     }
   }
   while( lwr<=upr ){
@@ -1197,7 +1481,7 @@ static ManifestFile *manifest_file_seek_base(Manifest *p, const char *zName){
     }else if( c>0 ){
       upr = i-1;
     }else{
-      p->iFile = i;
+      *piFile = i;
       return &p->aFile[i];
     }
   }
@@ -1217,11 +1501,11 @@ static ManifestFile *manifest_file_seek_base(Manifest *p, const char *zName){
 ManifestFile *manifest_file_seek(Manifest *p, const char *zName){
   ManifestFile *pFile;
   
-  pFile = manifest_file_seek_base(p, zName);
+  pFile = manifest_file_seek_base(p, &p->iFile, zName);
   if( pFile && pFile->zUuid==0 ) return 0;
   if( pFile==0 && p->zBaseline ){
     fetch_baseline(p, 1);
-    pFile = manifest_file_seek_base(p->pBaseline, zName);
+    pFile = manifest_file_seek_base(p->pBaseline, &p->iBaseFile, zName);
   }
   return pFile;
 }
@@ -1369,7 +1653,8 @@ static void add_mlink(int pid, Manifest *pParent, int cid, Manifest *pChild){
     ** in the child. */
     for(i=0, pParentFile=pParent->aFile; i<pParent->nFile; i++, pParentFile++){
       if( pParentFile->zUuid ){
-        pChildFile = manifest_file_seek_base(pChild, pParentFile->zName);
+        pChildFile = manifest_file_seek_base(pChild, &pChild->iFile,
+                                             pParentFile->zName);
         if( pChildFile==0 ){
           /* The child file reverts to baseline.  Show this as a change */
           pChildFile = manifest_file_seek(pChild, pParentFile->zName);
@@ -1404,6 +1689,59 @@ static void add_mlink(int pid, Manifest *pParent, int cid, Manifest *pChild){
   manifest_cache_insert(*ppOther);
 }
 
+/*
+** The XLINKLOG table gives every artifact a sequence number as it is
+** crosslinked.  Numbers only ever grow, so a client that remembers the
+** last one it saw can ask for just what has changed since (see
+** /json/changes).  The table is created by the first such request and
+** dropped by rebuild, which would otherwise log every artifact again.
+** The "xlinklog-epoch" setting is changed whenever the table is
+** created, so that a client can tell when its sequence number no
+** longer means anything.
+*/
+static const char zXlinklogSchema[] =
+@ CREATE TABLE IF NOT EXISTS %s.xlinklog(
+@   seq INTEGER PRIMARY KEY AUTOINCREMENT,  -- Order of crosslinking
+@   rid INTEGER                             -- The artifact
+@ );
+;
+static int xlinklogState = -1;  /* 1: exists. 0: does not. -1: unknown */
+
+/*
+** Return true if the XLINKLOG table exists.
+*/
+int xlinklog_exists(void){
+  if( xlinklogState<0 ){
+    xlinklogState = db_exists(
+      "SELECT 1 FROM %s.sqlite_master WHERE name='xlinklog'",
+      db_name("repository")
+    );
+  }
+  return xlinklogState;
+}
+
+/*
+** Create the XLINKLOG table, if it does not already exist, and start
+** a new epoch for it.  Return true if the table then exists.  This
+** fails for a repository that cannot be written.
+*/
+int xlinklog_create(void){
+  if( !xlinklog_exists() ){
+    char *zSql = mprintf(zXlinklogSchema, db_name("repository"));
+    db_begin_transaction();
+    db_multi_exec_ignore_error(zSql, 0);
+    fossil_free(zSql);
+    xlinklogState = -1;
+    if( xlinklog_exists() ){
+      char *zEpoch = db_text(0, "SELECT lower(hex(randomblob(4)))");
+      db_set("xlinklog-epoch", zEpoch, 0);
+      fossil_free(zEpoch);
+    }
+    db_end_transaction(0);
+  }
+  return xlinklog_exists();
+}
+
 /*
 ** Setup to do multiple manifest_crosslink() calls.
 ** This is only required if processing ticket changes.
@@ -1411,15 +1749,24 @@ static void add_mlink(int pid, Manifest *pParent, int cid, Manifest *pChild){
 void manifest_crosslink_begin(void){
   assert( manifest_crosslink_busy==0 );
   manifest_crosslink_busy = 1;
+  xlinklogState = -1;
+  content_batch_dephantomize(1);
   db_begin_transaction();
   db_multi_exec(
-     "CREATE TEMP TABLE pending_tkt(uuid TEXT UNIQUE);"
+     "CREATE TEMP TABLE pending_tkt("
+     "  uuid TEXT,"                  /* A ticket that has changed */
+     "  rid INTEGER,"                /* A new change artifact for uuid */
+     "  UNIQUE(uuid,rid)"
+     ");"
      "CREATE TEMP TABLE time_fudge("
      "  mid INTEGER PRIMARY KEY,"    /* The rid of a manifest */
      "  m1 REAL,"                    /* The timestamp on mid */
      "  cid INTEGER,"                /* A child or mid */
      "  m2 REAL"                     /* Timestamp on the child */
      ");"
+     "CREATE TEMP TABLE IF NOT EXISTS tag_pending(rid INTEGER PRIMARY KEY);"
+     "CREATE TEMP TABLE IF NOT EXISTS leaf_pending(rid INTEGER PRIMARY KEY);"
+     "CREATE TEMP TABLE IF NOT EXISTS branch_pending(name TEXT PRIMARY KEY);"
   );
 }
 
@@ -1444,14 +1791,26 @@ void manifest_crosslink_end(void){
   Stmt q, u;
   int i;
   assert( manifest_crosslink_busy==1 );
-  db_prepare(&q, "SELECT uuid FROM pending_tkt");
+  content_batch_dephantomize(0);
+  db_prepare(&q, "SELECT DISTINCT uuid FROM pending_tkt");
   while( db_step(&q)==SQLITE_ROW ){
     const char *zUuid = db_column_text(&q, 0);
-    ticket_rebuild_entry(zUuid);
+    ticket_update_entry(zUuid);
   }
   db_finalize(&q);
   db_multi_exec("DROP TABLE pending_tkt");
 
+  /* Push the propagating tags of every parent of a newly crosslinked
+  ** check-in down to its descendants.
+  */
+  for(i=bag_first(&pendingPropagate); i; i=bag_next(&pendingPropagate, i)){
+    tag_propagate_all(i);
+  }
+  bag_clear(&pendingPropagate);
+
+  /* Bring the LEAF table up to date for all check-ins touched above */
+  leaf_do_pending_checks();
+
   /* If multiple check-ins happen close together in time, adjust their
   ** times by a few milliseconds to make sure they appear in chronological
   ** order.
@@ -1474,11 +1833,24 @@ void manifest_crosslink_end(void){
   }
   db_finalize(&q);
   db_finalize(&u);
-  db_multi_exec(
-    "UPDATE event SET mtime=(SELECT m1 FROM time_fudge WHERE mid=objid)"
-    " WHERE objid IN (SELECT mid FROM time_fudge);"
-    "DROP TABLE time_fudge;"
-  );
+  /* Only touch the EVENT table if there is something to fix, so that a
+  ** read-only sync does not need a write lock on the repository and
+  ** several of them can run at once.
+  */
+  if( db_exists("SELECT 1 FROM time_fudge") ){
+    db_multi_exec(
+      "UPDATE event SET mtime=(SELECT m1 FROM time_fudge WHERE mid=objid)"
+      " WHERE objid IN (SELECT mid FROM time_fudge);"
+    );
+    filehist_update_mtime("SELECT mid FROM time_fudge");
+  }
+  db_multi_exec("DROP TABLE time_fudge;");
+  if( manifest_crosslink_changed ){
+    page_cache_invalidate();
+    manifest_crosslink_changed = 0;
+  }
+  fnid_cache_clear();
+  search_index_update();
 
   db_end_transaction(0);
   manifest_crosslink_busy = 0;
@@ -1593,6 +1965,7 @@ int manifest_crosslink(int rid, Blob *pContent){
   Manifest *p;
   Stmt q;
   int parentid = 0;
+  int rc;
 
   if( (p = manifest_cache_find(rid))!=0 ){
     blob_reset(pContent);
@@ -1612,18 +1985,30 @@ int manifest_crosslink(int rid, Blob *pContent){
   }
   db_begin_transaction();
   if( p->type==CFTYPE_MANIFEST ){
-    if( !db_exists("SELECT 1 FROM mlink WHERE mid=%d", rid) ){
+    db_prepare(&q, "SELECT 1 FROM mlink WHERE mid=:rid");
+    db_bind_int(&q, ":rid", rid);
+    rc = db_step(&q);
+    db_finalize(&q);
+    if( rc!=SQLITE_ROW ){
       char *zCom;
       for(i=0; i<p->nParent; i++){
         int pid = uuid_to_rid(p->azParent[i], 1);
-        db_multi_exec("INSERT OR IGNORE INTO plink(pid, cid, isprim, mtime)"
-                      "VALUES(%d, %d, %d, %.17g)", pid, rid, i==0, p->rDate);
+        db_prepare(&q, "INSERT OR IGNORE INTO plink(pid, cid, isprim, mtime)"
+                       "VALUES(:pid, :cid, :isprim, :mtime)");
+        db_bind_int(&q, ":pid", pid);
+        db_bind_int(&q, ":cid", rid);
+        db_bind_int(&q, ":isprim", i==0);
+        db_bind_double(&q, ":mtime", p->rDate);
+        db_exec(&q);
+        if( db_changes() ) dag_add_link(pid, rid, i==0, p->rDate);
+        db_finalize(&q);
         if( i==0 ){
           add_mlink(pid, 0, rid, p);
           parentid = pid;
         }
       }
-      db_prepare(&q, "SELECT cid FROM plink WHERE pid=%d AND isprim", rid);
+      db_prepare(&q, "SELECT cid FROM plink WHERE pid=:rid AND isprim");
+      db_bind_int(&q, ":rid", rid);
       while( db_step(&q)==SQLITE_ROW ){
         int cid = db_column_int(&q, 0);
         add_mlink(rid, p, cid, 0);
@@ -1638,24 +2023,32 @@ int manifest_crosslink(int rid, Blob *pContent){
                         isPublic, manifest_file_mperm(&p->aFile[i]));
         }
       }
-      db_multi_exec(
+      db_prepare(&q,
         "REPLACE INTO event(type,mtime,objid,user,comment,"
                            "bgcolor,euser,ecomment,omtime)"
         "VALUES('ci',"
         "  coalesce("
-        "    (SELECT julianday(value) FROM tagxref WHERE tagid=%d AND rid=%d),"
-        "    %.17g"
+        "    (SELECT julianday(value) FROM tagxref"
+        "      WHERE tagid=%d AND rid=:rid),"
+        "    :mtime"
         "  ),"
-        "  %d,%Q,%Q,"
-        "  (SELECT value FROM tagxref WHERE tagid=%d AND rid=%d AND tagtype>0),"
-        "  (SELECT value FROM tagxref WHERE tagid=%d AND rid=%d),"
-        "  (SELECT value FROM tagxref WHERE tagid=%d AND rid=%d),%.17g);",
-        TAG_DATE, rid, p->rDate,
-        rid, p->zUser, p->zComment, 
-        TAG_BGCOLOR, rid,
-        TAG_USER, rid,
-        TAG_COMMENT, rid, p->rDate
+        "  :rid,:user,:comment,"
+        "  (SELECT value FROM tagxref"
+        "    WHERE tagid=%d AND rid=:rid AND tagtype>0),"
+        "  (SELECT value FROM tagxref WHERE tagid=%d AND rid=:rid),"
+        "  (SELECT value FROM tagxref WHERE tagid=%d AND rid=:rid),:mtime);",
+        TAG_DATE, TAG_BGCOLOR, TAG_USER, TAG_COMMENT
       );
+      db_bind_int(&q, ":rid", rid);
+      db_bind_double(&q, ":mtime", p->rDate);
+      if( p->zUser ){
+        db_bind_text(&q, ":user", p->zUser);
+      }
+      if( p->zComment ){
+        db_bind_text(&q, ":comment", p->zComment);
+      }
+      db_exec(&q);
+      db_finalize(&q);
       zCom = db_text(0, "SELECT coalesce(ecomment, comment) FROM event"
                         " WHERE rowid=last_insert_rowid()");
       wiki_extract_links(zCom, rid, 0, p->rDate, 1, WIKI_INLINE);
@@ -1714,7 +2107,11 @@ int manifest_crosslink(int rid, Blob *pContent){
       }
     }
     if( parentid ){
-      tag_propagate_all(parentid);
+      if( manifest_crosslink_busy ){
+        bag_insert(&pendingPropagate, parentid);
+      }else{
+        tag_propagate_all(parentid);
+      }
     }
   }
   if( p->type==CFTYPE_WIKI ){
@@ -1812,8 +2209,8 @@ int manifest_crosslink(int rid, Blob *pContent){
     zTag = mprintf("tkt-%s", p->zTicketUuid);
     tag_insert(zTag, 1, 0, rid, p->rDate, rid);
     free(zTag);
-    db_multi_exec("INSERT OR IGNORE INTO pending_tkt VALUES(%Q)",
-                  p->zTicketUuid);
+    db_multi_exec("INSERT OR IGNORE INTO pending_tkt VALUES(%Q,%d)",
+                  p->zTicketUuid, rid);
   }
   if( p->type==CFTYPE_ATTACHMENT ){
     db_multi_exec(
@@ -1940,6 +2337,17 @@ int manifest_crosslink(int rid, Blob *pContent){
     );
     blob_reset(&comment);
   }
+  name_cache_clear();
+  search_index_note(rid);
+  if( p->type!=CFTYPE_CLUSTER && xlinklog_exists() ){
+    db_multi_exec("INSERT INTO xlinklog(rid) VALUES(%d)", rid);
+  }
+  if( manifest_crosslink_busy ){
+    manifest_crosslink_changed = 1;
+  }else{
+    page_cache_invalidate();
+    search_index_update();
+  }
   db_end_transaction(0);
   if( p->type==CFTYPE_MANIFEST ){
     manifest_cache_insert(p);
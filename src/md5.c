@@ -35,13 +35,20 @@
 #  define uint32 unsigned int
 #endif
 
-struct Context {
+#if INTERFACE
+/*
+** The state of an incremental MD5 checksum computation.  The caller
+** owns the object, so any number of checksums may be underway at once.
+** See md5_ctx_init(), md5_ctx_step() and md5_ctx_finish().
+*/
+typedef struct MD5Context MD5Context;
+struct MD5Context {
   int isInit;
-  uint32 buf[4];
-  uint32 bits[2];
+  unsigned int buf[4];
+  unsigned int bits[2];
   unsigned char in[64];
 };
-typedef struct Context MD5Context;
+#endif
 
 #if defined(__i386__) || defined(__x86_64__) || defined(_WIN32)
 # define byteReverse(A,B)
@@ -180,7 +187,7 @@ static void MD5Init(MD5Context *ctx){
  */
 static 
 void MD5Update(MD5Context *pCtx, const unsigned char *buf, unsigned int len){
-        struct Context *ctx = (struct Context *)pCtx;
+        MD5Context *ctx = pCtx;
         uint32 t;
 
         /* Update bitcount */
@@ -229,7 +236,7 @@ void MD5Update(MD5Context *pCtx, const unsigned char *buf, unsigned int len){
  * 1 0* (64-bit count of bits processed, MSB-first)
  */
 static void MD5Final(unsigned char digest[16], MD5Context *pCtx){
-        struct Context *ctx = (struct Context *)pCtx;
+        MD5Context *ctx = pCtx;
         unsigned count;
         unsigned char *p;
 
@@ -288,8 +295,49 @@ static void DigestToBase16(unsigned char *digest, char *zBuf){
 }
 
 /*
-** The state of a incremental MD5 checksum computation.  Only one
-** such computation can be underway at a time, of course.
+** Begin a new incremental MD5 checksum in the caller-supplied context.
+*/
+void md5_ctx_init(MD5Context *p){
+  MD5Init(p);
+}
+
+/*
+** Add nBytes of text from zText to the incremental checksum p.  If
+** nBytes is negative, zText is a zero-terminated string.
+*/
+void md5_ctx_step(MD5Context *p, const char *zText, int nBytes){
+  if( nBytes<=0 ){
+    if( nBytes==0 ) return;
+    nBytes = strlen(zText);
+  }
+  MD5Update(p, (unsigned char*)zText, nBytes);
+}
+
+/*
+** Add the content of a blob to the incremental checksum p.
+*/
+void md5_ctx_step_blob(MD5Context *p, Blob *pIn){
+  md5_ctx_step(p, blob_buffer(pIn), blob_size(pIn));
+}
+
+/*
+** Finish the incremental checksum p and write the result as 32
+** hexadecimal digits plus a terminator into zOut[], which must be
+** at least 33 bytes in size.  Return zOut.
+**
+** The context must be reinitialized before it is used again.
+*/
+char *md5_ctx_finish(MD5Context *p, char *zOut){
+  unsigned char zResult[16];
+  MD5Final(zResult, p);
+  DigestToBase16(zResult, zOut);
+  return zOut;
+}
+
+/*
+** The state of the legacy md5sum_step_text()/md5sum_finish() checksum.
+** Only one such computation can be underway at a time.  New code
+** should use a caller-owned MD5Context instead.
 */
 static MD5Context incrCtx;
 static int incrInit = 0;
@@ -306,14 +354,10 @@ void md5sum_init(void){
 */
 void md5sum_step_text(const char *zText, int nBytes){
   if( !incrInit ){
-    MD5Init(&incrCtx);
+    md5_ctx_init(&incrCtx);
     incrInit = 1;
   }
-  if( nBytes<=0 ){
-    if( nBytes==0 ) return;
-    nBytes = strlen(zText);
-  }
-  MD5Update(&incrCtx, (unsigned char*)zText, nBytes);
+  md5_ctx_step(&incrCtx, zText, nBytes);
 }
 
 /*
@@ -352,12 +396,10 @@ const char *md5sum_current_state(void){
 ** is overwritten by subsequent calls to this function.
 */
 char *md5sum_finish(Blob *pOut){
-  unsigned char zResult[16];
   static char zOut[33];
   md5sum_step_text(0,0);
-  MD5Final(zResult, &incrCtx);
+  md5_ctx_finish(&incrCtx, zOut);
   incrInit = 0;
-  DigestToBase16(zResult, zOut);
   if( pOut ){
     blob_zero(pOut);
     blob_append(pOut, zOut, 32);
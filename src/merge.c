@@ -55,6 +55,76 @@ void print_checkin_description(int rid, int indent, const char *zLabel){
   db_finalize(&q);
 }
 
+/*
+** One file of the three-way merge step of merge_cmd().
+*/
+typedef struct MergeJob MergeJob;
+struct MergeJob {
+  MergeFile f;           /* The merge itself, done by a worker thread */
+  char *zName;           /* Name of the file relative to the root */
+  int ridm, idv, ridp, ridv;  /* The file in M, V, P, and V again */
+  int isBinary;          /* Do not merge: the file is binary */
+  int isExe;             /* The result should be executable */
+  int isLink;            /* Do not merge: the file is a symlink */
+};
+
+/*
+** Wait for the merges in aJob[0..nJob-1] to finish, then report them
+** and write the results in order.  Return the number of conflicts.
+*/
+static int merge_finish_batch(
+  WorkPool *pPool,       /* Workers doing the merges */
+  MergeJob *aJob,        /* The merges */
+  int nJob,              /* Number of merges */
+  int detailFlag,        /* Show details of each merge */
+  int nochangeFlag       /* Do not change any files */
+){
+  int i;
+  int nConflict = 0;
+  workpool_wait(pPool);
+  for(i=0; i<nJob; i++){
+    MergeJob *p = &aJob[i];
+    if( detailFlag ){
+      fossil_print("MERGE %s  (pivot=%d v1=%d v2=%d)\n", 
+                   p->zName, p->ridp, p->ridm, p->ridv);
+    }else{
+      fossil_print("MERGE %s\n", p->zName);
+    }
+    if( p->isLink ){
+      fossil_print("***** Cannot merge symlink %s\n", p->zName);
+      nConflict++;        
+    }else{
+      undo_save(p->zName);
+      if( p->f.rc!=0 && !p->isBinary ){
+        merge_3way_conflict(&p->f.pivot, p->f.zV1, &p->f.v1, &p->f.v2,
+                            &p->f.out, p->f.rc);
+      }
+      if( p->f.rc>=0 ){
+        if( !nochangeFlag ){
+          blob_write_to_file(&p->f.out, p->f.zV1);
+          file_wd_setexe(p->f.zV1, p->isExe);
+        }
+        db_multi_exec("UPDATE vfile SET mtime=0 WHERE id=%d", p->idv);
+        if( p->f.rc>0 ){
+          fossil_print("***** %d merge conflicts in %s\n", p->f.rc, p->zName);
+          nConflict++;
+        }
+      }else{
+        fossil_print("***** Cannot merge binary file %s\n", p->zName);
+        nConflict++;
+      }
+    }
+    db_multi_exec("INSERT OR IGNORE INTO vmerge(id,merge) VALUES(%d,%d)",
+                  p->idv, p->ridm);
+    blob_reset(&p->f.pivot);
+    blob_reset(&p->f.v1);
+    blob_reset(&p->f.v2);
+    blob_reset(&p->f.out);
+    free(p->f.zV1);
+    free(p->zName);
+  }
+  return nConflict;
+}
 
 /*
 ** COMMAND: merge
@@ -111,6 +181,10 @@ void merge_cmd(void){
   int nOverwrite = 0;   /* Number of unmanaged files overwritten */
   int caseSensitive;    /* True for case-sensitive filenames */
   Stmt q;
+  const int mxJob = 100;  /* Number of merges handed to the workers at once */
+  MergeJob *aJob;       /* Merges in progress */
+  int nJob = 0;         /* Number of entries in aJob[] */
+  WorkPool *pPool;      /* Workers for the three-way merges */
 
 
   /* Notation:
@@ -133,6 +207,9 @@ void merge_cmd(void){
     usage("VERSION");
   }
   db_must_be_within_tree();
+  if( vfile_sparse_glob() ){
+    fossil_fatal("cannot merge into a sparse checkout");
+  }
   caseSensitive = filenames_are_case_sensitive();
   if( zBinGlob==0 ) zBinGlob = db_get("binary-glob",0);
   vid = db_lget_int("checkout", 0);
@@ -418,62 +495,46 @@ void merge_cmd(void){
     "   AND ridm!=ridp AND (ridv!=ridp OR chnged)",
     glob_expr("fv.fn", zBinGlob)
   );
+  pPool = workpool_new(workpool_size(0));
+  aJob = fossil_malloc(mxJob*sizeof(aJob[0]));
   while( db_step(&q)==SQLITE_ROW ){
-    int ridm = db_column_int(&q, 0);
-    int idv = db_column_int(&q, 1);
-    int ridp = db_column_int(&q, 2);
-    int ridv = db_column_int(&q, 3);
-    int isBinary = db_column_int(&q, 4);
-    const char *zName = db_column_text(&q, 5);
-    int isExe = db_column_int(&q, 6);
-    int islinkv = db_column_int(&q, 7);
-    int islinkm = db_column_int(&q, 8);
-    int rc;
-    char *zFullPath;
-    Blob m, p, r;
-    /* Do a 3-way merge of idp->idm into idp->idv.  The results go into idv. */
-    if( detailFlag ){
-      fossil_print("MERGE %s  (pivot=%d v1=%d v2=%d)\n", 
-                   zName, ridp, ridm, ridv);
-    }else{
-      fossil_print("MERGE %s\n", zName);
-    }
-    if( islinkv || islinkm /* || file_wd_islink(zFullPath) */ ){
-      fossil_print("***** Cannot merge symlink %s\n", zName);
-      nConflict++;        
-    }else{
-      undo_save(zName);
-      zFullPath = mprintf("%s/%s", g.zLocalRoot, zName);
-      content_get(ridp, &p);
-      content_get(ridm, &m);
-      if( isBinary ){
-        rc = -1;
-        blob_zero(&r);
-      }else{
-        rc = merge_3way(&p, zFullPath, &m, &r);
-      }
-      if( rc>=0 ){
-        if( !nochangeFlag ){
-          blob_write_to_file(&r, zFullPath);
-          file_wd_setexe(zFullPath, isExe);
-        }
-        db_multi_exec("UPDATE vfile SET mtime=0 WHERE id=%d", idv);
-        if( rc>0 ){
-          fossil_print("***** %d merge conflicts in %s\n", rc, zName);
-          nConflict++;
-        }
+    MergeJob *p = &aJob[nJob++];
+    /* Do a 3-way merge of idp->idm into idp->idv.  The results go into idv.
+    ** The main thread gathers the content and a worker does the merge. */
+    memset(p, 0, sizeof(*p));
+    p->ridm = db_column_int(&q, 0);
+    p->idv = db_column_int(&q, 1);
+    p->ridp = db_column_int(&q, 2);
+    p->ridv = db_column_int(&q, 3);
+    p->isBinary = db_column_int(&q, 4);
+    p->zName = fossil_strdup(db_column_text(&q, 5));
+    p->isExe = db_column_int(&q, 6);
+    p->isLink = db_column_int(&q, 7) || db_column_int(&q, 8);
+    p->f.zV1 = mprintf("%s/%s", g.zLocalRoot, p->zName);
+    blob_zero(&p->f.pivot);
+    blob_zero(&p->f.v1);
+    blob_zero(&p->f.v2);
+    blob_zero(&p->f.out);
+    if( !p->isLink ){
+      content_get(p->ridp, &p->f.pivot);
+      content_get(p->ridm, &p->f.v2);
+      if( p->isBinary ){
+        p->f.rc = -1;
       }else{
-        fossil_print("***** Cannot merge binary file %s\n", zName);
-        nConflict++;
+        blob_read_from_file(&p->f.v1, p->f.zV1);
+        workpool_add(pPool, merge_3way_task, &p->f);
       }
-      blob_reset(&p);
-      blob_reset(&m);
-      blob_reset(&r);
     }
-    db_multi_exec("INSERT OR IGNORE INTO vmerge(id,merge) VALUES(%d,%d)",
-                  idv,ridm);
+    if( nJob==mxJob ){
+      nConflict += merge_finish_batch(pPool, aJob, nJob,
+                                      detailFlag, nochangeFlag);
+      nJob = 0;
+    }
   }
   db_finalize(&q);
+  nConflict += merge_finish_batch(pPool, aJob, nJob, detailFlag, nochangeFlag);
+  workpool_delete(pPool);
+  free(aJob);
 
   /*
   ** Drop files that are in P and V but not in M
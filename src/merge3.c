@@ -33,28 +33,76 @@
 #  define min(A,B)  (A<B?A:B)
 #endif
 
+#if INTERFACE
 /*
-** Compare N lines of text from pV1 and pV2.  If the lines
-** are the same, return true.  Return false if one or more of the N
-** lines are different.
-**
-** The cursors on both pV1 and pV2 is unchanged by this comparison.
+** A merge conflict found by blob_merge().  Each pair of integers is
+** the index of the first line (counting from 0) and the number of lines
+** of the conflicting region in one of the files.  The region of the
+** merged output includes the conflict marks.
 */
-static int sameLines(Blob *pV1, Blob *pV2, int N){
-  char *z1, *z2;
+struct MergeConflict {
+  int iPivot, nPivot;    /* Lines of the common ancestor */
+  int iV1, nV1;          /* Lines of V1 */
+  int iV2, nV2;          /* Lines of V2 */
+  int iOut, nOut;        /* Lines of the merged output */
+};
+#endif
+
+/*
+** One of the three files of a merge, split into lines, together with
+** a cursor that counts the lines already used.
+*/
+typedef struct MergeText MergeText;
+struct MergeText {
+  DLine *a;              /* The lines of the file */
+  int n;                 /* Number of lines in a[] */
+  const char *zEnd;      /* End of the text of the file */
+  int i;                 /* Index of the next line to use */
+};
+
+/*
+** Return a pointer to the start of line i of p, or to the end of the
+** text if i is past the last line.
+*/
+static const char *merge_line_start(MergeText *p, int i){
+  return i<p->n ? p->a[i].z : p->zEnd;
+}
+
+/*
+** Advance the cursor of p by N lines.  If pOut is not NULL, append the
+** text of those lines, including their line endings, to pOut, and add
+** the number of lines to *pnOut.
+*/
+static void merge_copy_lines(Blob *pOut, int *pnOut, MergeText *p, int N){
+  if( N>p->n-p->i ) N = p->n-p->i;
+  if( N<=0 ) return;
+  if( pOut ){
+    const char *z = p->a[p->i].z;
+    blob_append(pOut, z, merge_line_start(p, p->i+N) - z);
+    *pnOut += N;
+  }
+  p->i += N;
+}
+
+/*
+** Return true if the N lines at the cursors of p1 and p2 are the same,
+** including their line endings.  The cursors are unchanged.
+*/
+static int sameLines(MergeText *p1, MergeText *p2, int N){
   int i;
-  char c;
-
-  if( N==0 ) return 1;
-  z1 = &blob_buffer(pV1)[blob_tell(pV1)];
-  z2 = &blob_buffer(pV2)[blob_tell(pV2)];
-  for(i=0; (c=z1[i])==z2[i]; i++){
-    if( c=='\n' || c==0 ){
-      N--;
-      if( N==0 || c==0 ) return 1;
+  if( p1->i+N>p1->n || p2->i+N>p2->n ) return 0;
+  for(i=0; i<N; i++){
+    int j1 = p1->i+i;
+    int j2 = p2->i+i;
+    const char *z1 = p1->a[j1].z;
+    const char *z2 = p2->a[j2].z;
+    int n1 = merge_line_start(p1, j1+1) - z1;
+    int n2 = merge_line_start(p2, j2+1) - z2;
+    if( p1->a[j1].h!=p2->a[j2].h || n1!=n2 || memcmp(z1, z2, n1)!=0 ){
+      return 0;
     }
   }
-  return 0;
+  return 1;
 }
 
 /*
@@ -67,8 +115,8 @@ static int sameLines(Blob *pV1, Blob *pV2, int N){
 static int sameEdit(
   int *aC1,      /* Array of edit integers for file 1 */
   int *aC2,      /* Array of edit integers for file 2 */
-  Blob *pV1,     /* Text of file 1 */
-  Blob *pV2      /* Text of file 2 */
+  MergeText *pV1,     /* Text of file 1 */
+  MergeText *pV2      /* Text of file 2 */
 ){
   if( aC1[0]!=aC2[0] ) return 0;
   if( aC1[1]!=aC2[1] ) return 0;
@@ -85,19 +133,30 @@ static int sameEdit(
 **   (1)  The number of lines to delete
 **   (2)  The number of liens to insert
 **
-** Suppose we want to advance over sz lines of the originl file.  This routine
-** returns true if that advance would land us on a copy operation.  It
-** returns false if the advance would end on a delete.
+** Suppose we want to advance over sz lines of the original file.  Return
+** the smallest advance of at least sz lines that lands us on a copy
+** operation rather than in the middle of a delete.
+**
+** *piC and *pnBase are the index of a triple in aC[] and the number of
+** lines of the original file that come before it.  They start at zero
+** and are advanced by this routine, so that a later call with a larger
+** sz does not need to look at the same triples again.
 */
-static int ends_at_CPY(int *aC, int sz){
-  while( sz>0 && (aC[0]>0 || aC[1]>0 || aC[2]>0) ){
-    if( aC[0]>=sz ) return 1;
-    sz -= aC[0];
-    if( aC[1]>sz ) return 0;
-    sz -= aC[1];
-    aC += 3;
+static int next_CPY(int *aC, int *piC, int *pnBase, int sz){
+  int i = *piC;
+  int nBase = *pnBase;
+  while( aC[i]>0 || aC[i+1]>0 || aC[i+2]>0 ){
+    if( nBase+aC[i]>=sz ) break;
+    if( nBase+aC[i]+aC[i+1]>sz ){
+      sz = nBase+aC[i]+aC[i+1];
+      break;
+    }
+    nBase += aC[i] + aC[i+1];
+    i += 3;
   }
-  return 1;
+  *piC = i;
+  *pnBase = nBase;
+  return sz;
 }
 
 /*
@@ -115,7 +174,8 @@ static int ends_at_CPY(int *aC, int sz){
 */
 static int output_one_side(
   Blob *pOut,     /* Write to this blob */
-  Blob *pSrc,     /* The edited file that is to be copied to pOut */
+  int *pnOut,     /* Add the number of lines written to this */
+  MergeText *pSrc,  /* The edited file that is to be copied to pOut */
   int *aC,        /* Array of integer triples describing the edit */
   int i,          /* Index in aC[] of current location in pSrc */
   int sz          /* Number of lines in unedited source to output */
@@ -123,20 +183,18 @@ static int output_one_side(
   while( sz>0 ){
     if( aC[i]==0 && aC[i+1]==0 && aC[i+2]==0 ) break;
     if( aC[i]>=sz ){
-      blob_copy_lines(pOut, pSrc, sz);
+      merge_copy_lines(pOut, pnOut, pSrc, sz);
       aC[i] -= sz;
       break;
     }
-    blob_copy_lines(pOut, pSrc, aC[i]);
-    blob_copy_lines(pOut, pSrc, aC[i+2]);
+    merge_copy_lines(pOut, pnOut, pSrc, aC[i]);
+    merge_copy_lines(pOut, pnOut, pSrc, aC[i+2]);
     sz -= aC[i] + aC[i+1];
     i += 3;
   }
   return i;
 }
 
-
-
 /*
 ** Do a three-way merge.  Initialize pOut to contain the result.
 **
@@ -144,18 +202,33 @@ static int output_one_side(
 ** common origin at pPivot.  Apply the changes of pPivot ==> pV1
 ** to pV2.
 **
+** The three files are split into lines once.  The lines of pPivot are
+** used by both diffs, and lines are compared by their hashes and
+** copied to pOut directly from the input text.
+**
 ** The return is 0 upon complete success. If any input file is binary,
 ** -1 is returned and pOut is unmodified.  If there are merge
 ** conflicts, the merge proceeds as best as it can and the number 
-** of conflicts is returns
+** of conflicts is returns.  If paConflict is not NULL, *paConflict is
+** then set to an array, obtained from malloc(), that describes each
+** conflict.
 */
-static int blob_merge(Blob *pPivot, Blob *pV1, Blob *pV2, Blob *pOut){
+static int blob_merge(
+  Blob *pPivot,          /* Common ancestor */
+  Blob *pV1,             /* Version merging into */
+  Blob *pV2,             /* Version merging from */
+  Blob *pOut,            /* Merge results stored here */
+  MergeConflict **paConflict  /* Write the conflicts here if not NULL */
+){
+  MergeText pivot, v1, v2;  /* The three input files */
   int *aC1;              /* Changes from pPivot to pV1 */
   int *aC2;              /* Changes from pPivot to pV2 */
   int i1, i2;            /* Index into aC1[] and aC2[] */
   int nCpy, nDel, nIns;  /* Number of lines to copy, delete, or insert */
   int limit1, limit2;    /* Sizes of aC1[] and aC2[] */
   int nConflict = 0;     /* Number of merge conflicts seen so far */
+  int nOut = 0;          /* Number of lines written to pOut */
+  MergeConflict *aConflict = 0;  /* Description of each conflict */
   static const char zBegin[] =
     "<<<<<<< BEGIN MERGE CONFLICT: local copy shown first <<<<<<<<<<<<<<<\n";
   static const char zMid1[]   =
@@ -166,6 +239,24 @@ static int blob_merge(Blob *pPivot, Blob *pV1, Blob *pV2, Blob *pOut){
     ">>>>>>> END MERGE CONFLICT >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>\n";
 
   blob_zero(pOut);         /* Merge results stored in pOut */
+  if( paConflict ) *paConflict = 0;
+
+  /* Split the three files into lines */
+  memset(&pivot, 0, sizeof(pivot));
+  memset(&v1, 0, sizeof(v1));
+  memset(&v2, 0, sizeof(v2));
+  pivot.a = diff_break_lines(pPivot, &pivot.n);
+  v1.a = diff_break_lines(pV1, &v1.n);
+  v2.a = diff_break_lines(pV2, &v2.n);
+  if( pivot.a==0 || v1.a==0 || v2.a==0 ){
+    free(pivot.a);
+    free(v1.a);
+    free(v2.a);
+    return -1;
+  }
+  pivot.zEnd = blob_buffer(pPivot) + blob_size(pPivot);
+  v1.zEnd = blob_buffer(pV1) + blob_size(pV1);
+  v2.zEnd = blob_buffer(pV2) + blob_size(pV2);
 
   /* Compute the edits that occur from pPivot => pV1 (into aC1)
   ** and pPivot => pV2 (into aC2).  Each of the aC1 and aC2 arrays is
@@ -175,17 +266,8 @@ static int blob_merge(Blob *pPivot, Blob *pV1, Blob *pV2, Blob *pOut){
   ** pivot, and the third integer is the number of lines of text that are
   ** inserted.  The edit array ends with a triple of 0,0,0.
   */
-  aC1 = text_diff(pPivot, pV1, 0, 0);
-  aC2 = text_diff(pPivot, pV2, 0, 0);
-  if( aC1==0 || aC2==0 ){
-    free(aC1);
-    free(aC2);
-    return -1;
-  }
-
-  blob_rewind(pV1);        /* Rewind inputs:  Needed to reconstruct output */
-  blob_rewind(pV2);
-  blob_rewind(pPivot);
+  aC1 = diff_lines(pivot.a, pivot.n, v1.a, v1.n);
+  aC2 = diff_lines(pivot.a, pivot.n, v2.a, v2.n);
 
   /* Determine the length of the aC1[] and aC2[] change vectors */
   for(i1=0; aC1[i1] || aC1[i1+1] || aC1[i1+2]; i1+=3){}
@@ -217,9 +299,9 @@ static int blob_merge(Blob *pPivot, Blob *pV1, Blob *pV2, Blob *pOut){
       /* Output text that is unchanged in both V1 and V2 */
       nCpy = min(aC1[i1], aC2[i2]);
       DEBUG( printf("COPY %d\n", nCpy); )
-      blob_copy_lines(pOut, pPivot, nCpy);
-      blob_copy_lines(0, pV1, nCpy);
-      blob_copy_lines(0, pV2, nCpy);
+      merge_copy_lines(pOut, &nOut, &pivot, nCpy);
+      merge_copy_lines(0, 0, &v1, nCpy);
+      merge_copy_lines(0, 0, &v2, nCpy);
       aC1[i1] -= nCpy;
       aC2[i2] -= nCpy;
     }else
@@ -228,9 +310,9 @@ static int blob_merge(Blob *pPivot, Blob *pV1, Blob *pV2, Blob *pOut){
       nDel = aC2[i2+1];
       nIns = aC2[i2+2];
       DEBUG( printf("EDIT -%d+%d left\n", nDel, nIns); )
-      blob_copy_lines(0, pPivot, nDel);
-      blob_copy_lines(0, pV1, nDel);
-      blob_copy_lines(pOut, pV2, nIns);
+      merge_copy_lines(0, 0, &pivot, nDel);
+      merge_copy_lines(0, 0, &v1, nDel);
+      merge_copy_lines(pOut, &nOut, &v2, nIns);
       aC1[i1] -= nDel;
       i2 += 3;
     }else
@@ -239,21 +321,21 @@ static int blob_merge(Blob *pPivot, Blob *pV1, Blob *pV2, Blob *pOut){
       nDel = aC1[i1+1];
       nIns = aC1[i1+2];
       DEBUG( printf("EDIT -%d+%d right\n", nDel, nIns); )
-      blob_copy_lines(0, pPivot, nDel);
-      blob_copy_lines(0, pV2, nDel);
-      blob_copy_lines(pOut, pV1, nIns);
+      merge_copy_lines(0, 0, &pivot, nDel);
+      merge_copy_lines(0, 0, &v2, nDel);
+      merge_copy_lines(pOut, &nOut, &v1, nIns);
       aC2[i2] -= nDel;
       i1 += 3;
     }else
-    if( sameEdit(&aC1[i1], &aC2[i2], pV1, pV2) ){
+    if( sameEdit(&aC1[i1], &aC2[i2], &v1, &v2) ){
       /* Output edits that are identical in both V1 and V2. */
       assert( aC1[i1]==0 );
       nDel = aC1[i1+1];
       nIns = aC1[i1+2];
       DEBUG( printf("EDIT -%d+%d both\n", nDel, nIns); )
-      blob_copy_lines(0, pPivot, nDel);
-      blob_copy_lines(pOut, pV1, nIns);
-      blob_copy_lines(0, pV2, nIns);
+      merge_copy_lines(0, 0, &pivot, nDel);
+      merge_copy_lines(pOut, &nOut, &v1, nIns);
+      merge_copy_lines(0, 0, &v2, nIns);
       i1 += 3;
       i2 += 3;
     }else
@@ -263,18 +345,45 @@ static int blob_merge(Blob *pPivot, Blob *pV1, Blob *pV2, Blob *pOut){
       ** output both possible edits separate by distinctive marks.
       */
       int sz = 1;    /* Size of the conflict in lines */
-      nConflict++;
-      while( !ends_at_CPY(&aC1[i1], sz) || !ends_at_CPY(&aC2[i2], sz) ){
-        sz++;
+      int sz0;       /* Value of sz before the last pass */
+      int j1 = i1, j2 = i2;  /* Cursors for next_CPY() */
+      int nBase1 = 0, nBase2 = 0;
+      MergeConflict *pC = 0; /* Description of this conflict */
+      if( paConflict ){
+        aConflict = fossil_realloc(aConflict,
+                                   (nConflict+1)*sizeof(aConflict[0]));
+        pC = &aConflict[nConflict];
       }
+      nConflict++;
+      do{
+        sz0 = sz;
+        sz = next_CPY(aC1, &j1, &nBase1, sz);
+        sz = next_CPY(aC2, &j2, &nBase2, sz);
+      }while( sz!=sz0 );
       DEBUG( printf("CONFLICT %d\n", sz); )
-      blob_appendf(pOut, zBegin);
-      i1 = output_one_side(pOut, pV1, aC1, i1, sz);
-      blob_appendf(pOut, zMid1);
-      blob_copy_lines(pOut, pPivot, sz);
-      blob_appendf(pOut, zMid2);
-      i2 = output_one_side(pOut, pV2, aC2, i2, sz);
-      blob_appendf(pOut, zEnd);
+      if( pC ){
+        pC->iPivot = pivot.i;
+        pC->nPivot = sz;
+        pC->iV1 = v1.i;
+        pC->iV2 = v2.i;
+        pC->iOut = nOut;
+      }
+      blob_append(pOut, zBegin, -1);
+      nOut++;
+      i1 = output_one_side(pOut, &nOut, &v1, aC1, i1, sz);
+      blob_append(pOut, zMid1, -1);
+      nOut++;
+      merge_copy_lines(pOut, &nOut, &pivot, sz);
+      blob_append(pOut, zMid2, -1);
+      nOut++;
+      i2 = output_one_side(pOut, &nOut, &v2, aC2, i2, sz);
+      blob_append(pOut, zEnd, -1);
+      nOut++;
+      if( pC ){
+        pC->nV1 = v1.i - pC->iV1;
+        pC->nV2 = v2.i - pC->iV2;
+        pC->nOut = nOut - pC->iOut;
+      }
    }
 
     /* If we are finished with an edit triple, advance to the next
@@ -293,29 +402,38 @@ static int blob_merge(Blob *pPivot, Blob *pV1, Blob *pV2, Blob *pOut){
          i2/3, aC2[i2], aC2[i2+1], aC2[i2+2]); )
   if( i1<limit1 && aC1[i1+2]>0 ){
     DEBUG( printf("INSERT +%d left\n", aC1[i1+2]); )
-    blob_copy_lines(pOut, pV1, aC1[i1+2]);
+    merge_copy_lines(pOut, &nOut, &v1, aC1[i1+2]);
   }else if( i2<limit2 && aC2[i2+2]>0 ){
     DEBUG( printf("INSERT +%d right\n", aC2[i2+2]); )
-    blob_copy_lines(pOut, pV2, aC2[i2+2]);
+    merge_copy_lines(pOut, &nOut, &v2, aC2[i2+2]);
   }
 
   free(aC1);
   free(aC2);
+  free(pivot.a);
+  free(v1.a);
+  free(v2.a);
+  if( paConflict ) *paConflict = aConflict;
   return nConflict;
 }
 
 /*
 ** COMMAND:  test-3-way-merge
 **
-** Usage: %fossil test-3-way-merge PIVOT V1 V2 MERGED
+** Usage: %fossil test-3-way-merge PIVOT V1 V2 MERGED ?--conflicts?
 **
 ** Combine change in going from PIVOT->VERSION1 with the change going
 ** from PIVOT->VERSION2 and write the combined changes into MERGED.
+** The --conflicts option lists the lines of each file covered by each
+** merge conflict.
 */
 void delta_3waymerge_cmd(void){
   Blob pivot, v1, v2, merged;
+  int showConflicts = find_option("conflicts",0,0)!=0;
+  MergeConflict *aConflict = 0;
+  int i, nConflict;
   if( g.argc!=6 ){
-    usage("PIVOT V1 V2 MERGED");
+    usage("PIVOT V1 V2 MERGED ?--conflicts?");
   }
   if( blob_read_from_file(&pivot, g.argv[2])<0 ){
     fossil_fatal("cannot read %s\n", g.argv[2]);
@@ -326,10 +444,18 @@ void delta_3waymerge_cmd(void){
   if( blob_read_from_file(&v2, g.argv[4])<0 ){
     fossil_fatal("cannot read %s\n", g.argv[4]);
   }
-  blob_merge(&pivot, &v1, &v2, &merged);
+  nConflict = blob_merge(&pivot, &v1, &v2, &merged,
+                         showConflicts ? &aConflict : 0);
   if( blob_write_to_file(&merged, g.argv[5])<blob_size(&merged) ){
     fossil_fatal("cannot write %s\n", g.argv[4]);
   }
+  for(i=0; i<nConflict && aConflict; i++){
+    MergeConflict *p = &aConflict[i];
+    fossil_print("conflict %d: pivot %d+%d v1 %d+%d v2 %d+%d merged %d+%d\n",
+                 i+1, p->iPivot+1, p->nPivot, p->iV1+1, p->nV1,
+                 p->iV2+1, p->nV2, p->iOut+1, p->nOut);
+  }
+  free(aConflict);
   blob_reset(&pivot);
   blob_reset(&v1);
   blob_reset(&v2);
@@ -372,47 +498,61 @@ char *string_subst(const char *zInput, int nSubst, const char **azSubst){
 }
 
 
+#if INTERFACE
 /*
-** This routine is a wrapper around blob_merge() with the following
-** enhancements:
-**
-**    (1) If the merge-command is defined, then use the external merging
-**        program specified instead of the built-in blob-merge to do the
-**        merging.  Panic if the external merger fails.
-**        ** Not currently implemented **
-**
-**    (2) If gmerge-command is defined and there are merge conflicts in
-**        blob_merge() then invoke the external graphical merger to resolve
-**        the conflicts.
+** One file of a merge whose blob_merge() step is done by a worker
+** thread.  The caller fills in everything but out and rc, runs
+** merge_3way_task() on it, and then calls merge_3way_conflict() from
+** the main thread if rc is not zero.
+*/
+struct MergeFile {
+  char *zV1;             /* Name of file for version merging into (mine) */
+  Blob pivot;            /* Common ancestor (older) */
+  Blob v1;               /* Content of zV1 */
+  Blob v2;               /* Version merging from (yours) */
+  Blob out;              /* Output written here */
+  int rc;                /* Result of blob_merge() */
+};
+#endif
+
+/*
+** Do the three-way merge of p on a worker thread.  This only reads and
+** writes the blobs of p.
+*/
+void merge_3way_task(void *pArg){
+  MergeFile *p = (MergeFile*)pArg;
+  p->rc = blob_merge(&p->pivot, &p->v1, &p->v2, &p->out, 0);
+}
+
+/*
+** Handle a merge of pPivot, pV1 from the file zV1, and pV2 for which
+** blob_merge() returned the non-zero rc:
 **
-**    (3) If a merge conflict occurs and gmerge-command is not defined,
-**        then write the pivot, original, and merge-in files to the
+**    (1) Write the pivot, original, and merge-in files to the
 **        filesystem.
+**
+**    (2) If there were merge conflicts and gmerge-command is defined,
+**        then invoke the external graphical merger to resolve them,
+**        reading its result into pOut.
 */
-int merge_3way(
+void merge_3way_conflict(
   Blob *pPivot,       /* Common ancestor (older) */
   const char *zV1,    /* Name of file for version merging into (mine) */
+  Blob *pV1,          /* Content of zV1 */
   Blob *pV2,          /* Version merging from (yours) */
-  Blob *pOut          /* Output written here */
+  Blob *pOut,         /* Output written here */
+  int rc              /* Result of blob_merge() */
 ){
-  Blob v1;            /* Content of zV1 */
-  int rc;             /* Return code of subroutines and this routine */
   char *zPivot;       /* Name of the pivot file */
   char *zOrig;        /* Name of the original content file */
   char *zOther;       /* Name of the merge file */
 
-  blob_read_from_file(&v1, zV1);
-  rc = blob_merge(pPivot, &v1, pV2, pOut);
-  if( rc!=0 ){
-    const char *zGMerge;   /* Name of the gmerge command */
-
-    zPivot = file_newname(zV1, "baseline", 1);
-    blob_write_to_file(pPivot, zPivot);
-    zOrig = file_newname(zV1, "original", 1);
-    blob_write_to_file(&v1, zOrig);
-    zOther = file_newname(zV1, "merge", 1);
-    blob_write_to_file(pV2, zOther);
-  }
+  zPivot = file_newname(zV1, "baseline", 1);
+  blob_write_to_file(pPivot, zPivot);
+  zOrig = file_newname(zV1, "original", 1);
+  blob_write_to_file(pV1, zOrig);
+  zOther = file_newname(zV1, "merge", 1);
+  blob_write_to_file(pV2, zOther);
   if( rc>0 ){
     const char *zGMerge;   /* Name of the gmerge command */
 
@@ -441,10 +581,41 @@ int merge_3way(
       fossil_free(zOut);
     }
   }
+  fossil_free(zPivot);
+  fossil_free(zOrig);
+  fossil_free(zOther);
+}
+
+/*
+** This routine is a wrapper around blob_merge() with the following
+** enhancements:
+**
+**    (1) If the merge-command is defined, then use the external merging
+**        program specified instead of the built-in blob-merge to do the
+**        merging.  Panic if the external merger fails.
+**        ** Not currently implemented **
+**
+**    (2) If gmerge-command is defined and there are merge conflicts in
+**        blob_merge() then invoke the external graphical merger to resolve
+**        the conflicts.
+**
+**    (3) If a merge conflict occurs and gmerge-command is not defined,
+**        then write the pivot, original, and merge-in files to the
+**        filesystem.
+*/
+int merge_3way(
+  Blob *pPivot,       /* Common ancestor (older) */
+  const char *zV1,    /* Name of file for version merging into (mine) */
+  Blob *pV2,          /* Version merging from (yours) */
+  Blob *pOut          /* Output written here */
+){
+  Blob v1;            /* Content of zV1 */
+  int rc;             /* Return code of subroutines and this routine */
+
+  blob_read_from_file(&v1, zV1);
+  rc = blob_merge(pPivot, &v1, pV2, pOut, 0);
   if( rc!=0 ){
-    fossil_free(zPivot);
-    fossil_free(zOrig);
-    fossil_free(zOther);
+    merge_3way_conflict(pPivot, zV1, &v1, pV2, pOut, rc);
   }
   blob_reset(&v1);
   return rc;
@@ -0,0 +1,409 @@
+/*
+** Copyright (c) 2012 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*******************************************************************************
+**
+** This file implements the /metrics page, which reports statistics
+** about all requests that a server has answered in the text format
+** read by Prometheus: the number of requests and a histogram of their
+** latency for each page, the bytes received and sent, the cards of
+** sync requests, how busy the server processes are, and the use of the
+** content, manifest and page caches.
+**
+** Every request runs in its own process, so the statistics are added
+** up in memory that all of these processes share, in the same way as
+** the buckets of throttle.c: an anonymous shared mapping that "fossil
+** server" creates before it forks, or a small file next to the
+** repository that each "fossil http" process maps.  A spin lock in the
+** shared memory protects the statistics.  Each process takes the lock
+** once, when its reply has been sent.  Unix only.
+*/
+#include "config.h"
+#include "metrics.h"
+#if !defined(_WIN32)
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <signal.h>
+# include <errno.h>
+# include <sched.h>
+#endif
+
+#if INTERFACE
+/*
+** Counters of sync cards, for metrics_xfer().
+*/
+#define METRICS_IGOT_SENT    0   /* "igot" cards sent */
+#define METRICS_GIMME_SENT   1   /* "gimme" cards sent */
+#define METRICS_FILE_SENT    2   /* Full-text "file" cards sent */
+#define METRICS_DELTA_SENT   3   /* Delta "file" cards sent */
+#define METRICS_FILE_RCVD    4   /* Full-text "file" cards received */
+#define METRICS_DELTA_RCVD   5   /* Delta "file" cards received */
+#define METRICS_NCARD        6
+#endif
+
+#if !defined(_WIN32)
+/*
+** Number of pages for which statistics are kept.  Requests for pages
+** beyond this many are counted as page "other".
+*/
+#define METRICS_NPAGE    200
+
+/*
+** Upper bounds, in seconds, of the buckets of the latency histograms.
+** A last bucket holds the requests slower than all of these.
+*/
+static const double aMetricsBucket[] = {
+  0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0
+};
+#define METRICS_NBUCKET  (sizeof(aMetricsBucket)/sizeof(aMetricsBucket[0]))
+
+/*
+** Statistics of one page.
+*/
+struct MetricsPage {
+  char zName[24];              /* Name of the page */
+  i64 nRequest;                /* Number of requests answered */
+  double rSeconds;             /* Total time taken by those requests */
+  i64 aBucket[METRICS_NBUCKET+1]; /* Requests in each latency bucket */
+};
+
+/*
+** The shared memory.
+*/
+struct MetricsTable {
+  volatile int lockPid;        /* Process that holds the lock, or 0 */
+  i64 nBytesIn;                /* Bytes of request content received */
+  i64 nBytesOut;               /* Bytes of reply content sent */
+  i64 aCard[METRICS_NCARD];    /* Sync cards, by METRICS_ value */
+  i64 nContentHit;             /* content_get() cache hits */
+  i64 nContentMiss;            /* content_get() cache misses */
+  i64 nManifestHit;            /* manifest_get() cache hits */
+  i64 nManifestMiss;           /* manifest_get() cache misses */
+  int nBusy;                   /* Server processes busy with a request */
+  int mxBusy;                  /* Most processes that may be busy */
+  int nQueue;                  /* Connections waiting for a process */
+  i64 nRejected;               /* Connections turned away with a 503 */
+  int nPage;                   /* Number of entries used in aPage[] */
+  struct MetricsPage aPage[METRICS_NPAGE+1];  /* Last one is "other" */
+};
+
+static struct MetricsTable *pMetrics = 0;  /* The shared statistics */
+
+/*
+** Statistics of the current request, added to the shared memory by
+** metrics_reply().
+*/
+static const char *zMetricsPage = 0;       /* Name of the page */
+static i64 aMetricsCard[METRICS_NCARD];    /* Sync cards */
+
+/*
+** Acquire the lock on the shared statistics.  A lock left behind by a
+** process that died while holding it is broken.
+*/
+static void metrics_lock(void){
+  int pid = getpid();
+  int nSpin = 0;
+  while( !__sync_bool_compare_and_swap(&pMetrics->lockPid, 0, pid) ){
+    if( ++nSpin>=1000 ){
+      int owner = pMetrics->lockPid;
+      if( owner && kill(owner, 0)<0 && errno==ESRCH ){
+        __sync_bool_compare_and_swap(&pMetrics->lockPid, owner, 0);
+      }
+      nSpin = 0;
+      sched_yield();
+    }
+  }
+}
+
+/*
+** Release the lock on the shared statistics.
+*/
+static void metrics_unlock(void){
+  __sync_lock_release(&pMetrics->lockPid);
+}
+
+/*
+** Return the statistics of page zPage, adding an entry for it if
+** there is none yet.  The lock must be held.
+*/
+static struct MetricsPage *metrics_find_page(const char *zPage){
+  struct MetricsPage *p;
+  int i;
+  for(i=0; i<pMetrics->nPage; i++){
+    p = &pMetrics->aPage[i];
+    if( strncmp(p->zName, zPage, sizeof(p->zName))==0 ) return p;
+  }
+  if( pMetrics->nPage>=METRICS_NPAGE || strlen(zPage)>=sizeof(p->zName) ){
+    p = &pMetrics->aPage[METRICS_NPAGE];
+    memcpy(p->zName, "other", 6);
+    return p;
+  }
+  p = &pMetrics->aPage[pMetrics->nPage++];
+  memcpy(p->zName, zPage, strlen(zPage)+1);
+  return p;
+}
+#endif
+
+/*
+** Start keeping statistics.  If zFile is NULL, they are kept in memory
+** that is shared with the processes that this process forks later.
+** Otherwise they are kept in the file zFile, shared with other
+** processes that use the same file.  If the shared memory cannot be
+** set up, no statistics are kept.
+*/
+void metrics_init(const char *zFile){
+#if !defined(_WIN32)
+  void *p;
+  if( zFile==0 ){
+    p = mmap(0, sizeof(*pMetrics), PROT_READ|PROT_WRITE,
+             MAP_SHARED|MAP_ANON, -1, 0);
+  }else{
+    struct stat st;
+    int fd = open(zFile, O_RDWR|O_CREAT, 0644);
+    if( fd<0 ) return;
+    if( fstat(fd, &st)!=0
+     || (st.st_size<(off_t)sizeof(*pMetrics)
+         && ftruncate(fd, sizeof(*pMetrics))!=0)
+    ){
+      close(fd);
+      return;
+    }
+    p = mmap(0, sizeof(*pMetrics), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+  }
+  if( p==MAP_FAILED ) return;
+  pMetrics = (struct MetricsTable *)p;
+#endif
+}
+
+/*
+** Record that the current request is for the page zPage.  zPage must
+** be a constant string.
+*/
+void metrics_set_page(const char *zPage){
+#if !defined(_WIN32)
+  zMetricsPage = zPage;
+#endif
+}
+
+/*
+** Record the number of sync cards of each kind sent and received by the
+** current request.
+*/
+void metrics_xfer(
+  int nIGotSent,
+  int nGimmeSent,
+  int nFileSent,
+  int nDeltaSent,
+  int nFileRcvd,
+  int nDeltaRcvd
+){
+#if !defined(_WIN32)
+  aMetricsCard[METRICS_IGOT_SENT] += nIGotSent;
+  aMetricsCard[METRICS_GIMME_SENT] += nGimmeSent;
+  aMetricsCard[METRICS_FILE_SENT] += nFileSent;
+  aMetricsCard[METRICS_DELTA_SENT] += nDeltaSent;
+  aMetricsCard[METRICS_FILE_RCVD] += nFileRcvd;
+  aMetricsCard[METRICS_DELTA_RCVD] += nDeltaRcvd;
+#endif
+}
+
+/*
+** Add the statistics of the current request to the shared memory.
+** nBytesOut is the size of the reply content.  This is called by
+** cgi_reply() once the reply has been sent.
+*/
+void metrics_reply(i64 nBytesOut){
+#if !defined(_WIN32)
+  struct MetricsPage *p;
+  double rSeconds;
+  int i;
+  if( pMetrics==0 ) return;
+  rSeconds = perf_elapsed()/1000.0;
+  metrics_lock();
+  p = metrics_find_page(zMetricsPage ? zMetricsPage : "none");
+  p->nRequest++;
+  p->rSeconds += rSeconds;
+  for(i=0; i<METRICS_NBUCKET && rSeconds>aMetricsBucket[i]; i++){}
+  p->aBucket[i]++;
+  pMetrics->nBytesIn += atoi(PD("CONTENT_LENGTH", "0"));
+  pMetrics->nBytesOut += nBytesOut;
+  for(i=0; i<METRICS_NCARD; i++){
+    pMetrics->aCard[i] += aMetricsCard[i];
+    aMetricsCard[i] = 0;
+  }
+  pMetrics->nContentHit += perf_value(PERF_CACHE_HIT);
+  pMetrics->nContentMiss += perf_value(PERF_CACHE_MISS);
+  pMetrics->nManifestHit += perf_value(PERF_MANIFEST_HIT);
+  pMetrics->nManifestMiss += perf_value(PERF_MANIFEST_MISS);
+  metrics_unlock();
+#endif
+}
+
+/*
+** Record how busy the server is: nBusy processes are answering
+** requests out of at most mxBusy, and nQueue connections are waiting.
+** Called by the parent process of "fossil server".
+*/
+void metrics_workers(int nBusy, int mxBusy, int nQueue){
+#if !defined(_WIN32)
+  if( pMetrics==0 ) return;
+  pMetrics->nBusy = nBusy;
+  pMetrics->mxBusy = mxBusy;
+  pMetrics->nQueue = nQueue;
+#endif
+}
+
+/*
+** Record that a connection was turned away because the server was
+** too busy.
+*/
+void metrics_rejected(void){
+#if !defined(_WIN32)
+  if( pMetrics==0 ) return;
+  __sync_fetch_and_add(&pMetrics->nRejected, 1);
+#endif
+}
+
+/*
+** WEBPAGE: metrics
+**
+** Show statistics about the requests answered by this server, in the
+** text format of Prometheus.  Statistics are only kept when the server
+** was started with the --metrics option.
+*/
+void metrics_page(void){
+#if !defined(_WIN32)
+  static const struct {
+    const char *zCard;
+    const char *zDir;
+  } aCardName[] = {
+    { "igot",  "sent" },
+    { "gimme", "sent" },
+    { "file",  "sent" },
+    { "delta", "sent" },
+    { "file",  "received" },
+    { "delta", "received" },
+  };
+  static const char *azCache[] = { "page", "diff", "wiki", "report" };
+  i64 aEntry[4];                    /* Entries in each table of azCache[] */
+  i64 aByte[4];                     /* Bytes in each table of azCache[] */
+  struct MetricsTable x;
+  int i, j;
+#endif
+
+  login_check_credentials();
+  if( !g.perm.Read ){ login_needed(); return; }
+  cgi_set_content_type("text/plain; version=0.0.4");
+#if !defined(_WIN32)
+  if( pMetrics==0 ){
+#endif
+    cgi_set_status(404, "Not Found");
+    cgi_printf("# statistics are not kept: start the server with --metrics\n");
+    return;
+#if !defined(_WIN32)
+  }
+  metrics_lock();
+  memcpy(&x, pMetrics, sizeof(x));
+  metrics_unlock();
+
+  cgi_printf("# HELP fossil_http_request_duration_seconds"
+             " Time taken to answer requests, by page.\n"
+             "# TYPE fossil_http_request_duration_seconds histogram\n");
+  for(i=0; i<=METRICS_NPAGE; i++){
+    struct MetricsPage *p = &x.aPage[i];
+    i64 n = 0;
+    if( i>=x.nPage && i<METRICS_NPAGE ) continue;
+    if( p->nRequest==0 ) continue;
+    for(j=0; j<METRICS_NBUCKET; j++){
+      n += p->aBucket[j];
+      cgi_printf("fossil_http_request_duration_seconds_bucket"
+                 "{page=\"%s\",le=\"%g\"} %lld\n",
+                 p->zName, aMetricsBucket[j], n);
+    }
+    cgi_printf("fossil_http_request_duration_seconds_bucket"
+               "{page=\"%s\",le=\"+Inf\"} %lld\n", p->zName, p->nRequest);
+    cgi_printf("fossil_http_request_duration_seconds_sum{page=\"%s\"} %.6f\n",
+               p->zName, p->rSeconds);
+    cgi_printf("fossil_http_request_duration_seconds_count{page=\"%s\"}"
+               " %lld\n", p->zName, p->nRequest);
+  }
+
+  cgi_printf("# HELP fossil_http_received_bytes_total"
+             " Bytes of request content received.\n"
+             "# TYPE fossil_http_received_bytes_total counter\n"
+             "fossil_http_received_bytes_total %lld\n", x.nBytesIn);
+  cgi_printf("# HELP fossil_http_sent_bytes_total"
+             " Bytes of reply content sent.\n"
+             "# TYPE fossil_http_sent_bytes_total counter\n"
+             "fossil_http_sent_bytes_total %lld\n", x.nBytesOut);
+
+  cgi_printf("# HELP fossil_sync_cards_total"
+             " Cards of sync requests, by card and direction.\n"
+             "# TYPE fossil_sync_cards_total counter\n");
+  for(i=0; i<METRICS_NCARD; i++){
+    cgi_printf("fossil_sync_cards_total{card=\"%s\",direction=\"%s\"} %lld\n",
+               aCardName[i].zCard, aCardName[i].zDir, x.aCard[i]);
+  }
+
+  cgi_printf("# HELP fossil_server_busy_processes"
+             " Server processes answering a request.\n"
+             "# TYPE fossil_server_busy_processes gauge\n"
+             "fossil_server_busy_processes %d\n", x.nBusy);
+  cgi_printf("# HELP fossil_server_max_busy_processes"
+             " Most server processes that may answer requests at once.\n"
+             "# TYPE fossil_server_max_busy_processes gauge\n"
+             "fossil_server_max_busy_processes %d\n", x.mxBusy);
+  cgi_printf("# HELP fossil_server_queued_connections"
+             " Connections waiting for a server process.\n"
+             "# TYPE fossil_server_queued_connections gauge\n"
+             "fossil_server_queued_connections %d\n", x.nQueue);
+  cgi_printf("# HELP fossil_server_rejected_connections_total"
+             " Connections turned away because the server was busy.\n"
+             "# TYPE fossil_server_rejected_connections_total counter\n"
+             "fossil_server_rejected_connections_total %lld\n", x.nRejected);
+
+  cgi_printf("# HELP fossil_cache_lookups_total"
+             " Lookups in the in-memory caches, by cache and result.\n"
+             "# TYPE fossil_cache_lookups_total counter\n");
+  cgi_printf("fossil_cache_lookups_total{cache=\"content\",result=\"hit\"}"
+             " %lld\n", x.nContentHit);
+  cgi_printf("fossil_cache_lookups_total{cache=\"content\",result=\"miss\"}"
+             " %lld\n", x.nContentMiss);
+  cgi_printf("fossil_cache_lookups_total{cache=\"manifest\",result=\"hit\"}"
+             " %lld\n", x.nManifestHit);
+  cgi_printf("fossil_cache_lookups_total{cache=\"manifest\",result=\"miss\"}"
+             " %lld\n", x.nManifestMiss);
+
+  for(i=0; i<4; i++){
+    page_cache_usage(azCache[i], &aEntry[i], &aByte[i]);
+  }
+  cgi_printf("# HELP fossil_page_cache_entries"
+             " Entries in the page cache database, by table.\n"
+             "# TYPE fossil_page_cache_entries gauge\n");
+  for(i=0; i<4; i++){
+    cgi_printf("fossil_page_cache_entries{cache=\"%s\"} %lld\n",
+               azCache[i], aEntry[i]);
+  }
+  cgi_printf("# HELP fossil_page_cache_bytes"
+             " Bytes in the page cache database, by table.\n"
+             "# TYPE fossil_page_cache_bytes gauge\n");
+  for(i=0; i<4; i++){
+    cgi_printf("fossil_page_cache_bytes{cache=\"%s\"} %lld\n",
+               azCache[i], aByte[i]);
+  }
+#endif
+}
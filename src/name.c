@@ -46,39 +46,67 @@ static int is_date(const char *z){
 }
 
 /*
-** Convert a symbolic name into a RID.  Acceptable forms:
-**
-**   *  SHA1 hash
-**   *  SHA1 hash prefix of at least 4 characters
-**   *  Symbolic Name
-**   *  "tag:" + symbolic name
-**   *  Date or date-time 
-**   *  "date:" + Date or date-time
-**   *  symbolic-name ":" date-time
-**   *  "tip"
-**
-** The following additional forms are available in local checkouts:
-**
-**   *  "current"
-**   *  "prev" or "previous"
-**   *  "next"
-**
-** Return the RID of the matching artifact.  Or return 0 if the name does not
-** match any known object.  Or return -1 if the name is ambiguious.
-**
-** The zType parameter specifies the type of artifact: ci, t, w, e, g. 
-** If zType is NULL or "" or "*" then any type of artifact will serve.
-** zType is "ci" in most use cases since we are usually searching for
-** a check-in.
+** Return the RID of the most recent artifact of type zType that has
+** the symbolic name zTag, or 0 if there is no such artifact.
 */
-int symbolic_name_to_rid(const char *zTag, const char *zType){
-  int vid;
+static int tagged_name_to_rid(const char *zTag, const char *zType){
+  Stmt q;
   int rid = 0;
-  int nTag;
+  db_prepare(&q,
+    "SELECT event.objid"
+    "  FROM tag, tagxref, event"
+    " WHERE tag.tagname='sym-'||:tag"
+    "   AND tagxref.tagid=tag.tagid AND tagxref.tagtype>0 "
+    "   AND event.objid=tagxref.rid "
+    "   AND event.type GLOB :type"
+    " ORDER BY event.mtime DESC /*sort*/ "
+  );
+  db_bind_text(&q, ":tag", zTag);
+  db_bind_text(&q, ":type", zType);
+  if( db_step(&q)==SQLITE_ROW ){
+    rid = db_column_int(&q, 0);
+  }
+  db_finalize(&q);
+  return rid;
+}
+
+/*
+** Names recently resolved by symbolic_name_to_rid(), so that a web page
+** which links to the same branch or hash prefix many times resolves it
+** only once.  The cache must be cleared by name_cache_clear() whenever
+** an artifact, tag, or event is added or removed.
+*/
+#define NAME_CACHE_SIZE 32
+static struct {
+  int nUsed;                  /* Number of entries in a[] that are valid */
+  int iNext;                  /* Entry to replace next once a[] is full */
+  struct {
+    char *zName;                /* The name as given */
+    char *zType;                /* The artifact type it was resolved for */
+    int rid;                    /* The result: a RID, 0, or -1 */
+  } a[NAME_CACHE_SIZE];
+} nameCache;
+
+/*
+** Forget all cached name resolutions.
+*/
+void name_cache_clear(void){
   int i;
+  for(i=0; i<nameCache.nUsed; i++){
+    fossil_free(nameCache.a[i].zName);
+    fossil_free(nameCache.a[i].zType);
+  }
+  memset(&nameCache, 0, sizeof(nameCache));
+}
 
-  if( zType==0 || zType[0]==0 ) zType = "*";
-  if( zTag==0 || zTag[0]==0 ) return 0;
+/*
+** Convert a symbolic name into a RID, without consulting the cache.
+** See symbolic_name_to_rid() for the forms accepted.
+*/
+static int resolve_name_to_rid(const char *zTag, const char *zType){
+  int rid = 0;
+  int nTag;
+  int i;
 
   /* special keyword: "tip" */
   if( fossil_strcmp(zTag, "tip")==0 && (zType[0]=='*' || zType[0]=='c') ){
@@ -91,20 +119,6 @@ int symbolic_name_to_rid(const char *zTag, const char *zType){
     if( rid ) return rid;
   }
 
-  /* special keywords: "prev", "previous", "current", and "next" */
-  if( g.localOpen && (vid=db_lget_int("checkout",0))!=0 ){
-    if( fossil_strcmp(zTag, "current")==0 ){
-      rid = vid;
-    }else if( fossil_strcmp(zTag, "prev")==0 
-              || fossil_strcmp(zTag, "previous")==0 ){
-      rid = db_int(0, "SELECT pid FROM plink WHERE cid=%d AND isprim", vid);
-    }else if( fossil_strcmp(zTag, "next")==0 ){
-      rid = db_int(0, "SELECT cid FROM plink WHERE pid=%d"
-                      "  ORDER BY isprim DESC, mtime DESC", vid);
-    }
-    if( rid ) return rid;
-  }
-
   /* Date and times */
   if( memcmp(zTag, "date:", 5)==0 ){
     rid = db_int(0, 
@@ -144,17 +158,7 @@ int symbolic_name_to_rid(const char *zTag, const char *zType){
 
   /* "tag:" + symbolic-name */
   if( memcmp(zTag, "tag:", 4)==0 ){
-    rid = db_int(0,
-       "SELECT event.objid"
-       "  FROM tag, tagxref, event"
-       " WHERE tag.tagname='sym-%q' "
-       "   AND tagxref.tagid=tag.tagid AND tagxref.tagtype>0 "
-       "   AND event.objid=tagxref.rid "
-       "   AND event.type GLOB '%q'"
-       " ORDER BY event.mtime DESC /*sort*/",
-       &zTag[4], zType
-    );
-    return rid;
+    return tagged_name_to_rid(&zTag[4], zType);
   }
 
   /* symbolic-name ":" date-time */
@@ -210,16 +214,7 @@ int symbolic_name_to_rid(const char *zTag, const char *zType){
   }
 
   /* Symbolic name */
-  rid = db_int(0,
-    "SELECT event.objid"
-    "  FROM tag, tagxref, event"
-    " WHERE tag.tagname='sym-%q' "
-    "   AND tagxref.tagid=tag.tagid AND tagxref.tagtype>0 "
-    "   AND event.objid=tagxref.rid "
-    "   AND event.type GLOB '%q'"
-    " ORDER BY event.mtime DESC /*sort*/ ",
-    zTag, zType
-  );
+  rid = tagged_name_to_rid(zTag, zType);
   if( rid>0 ) return rid;
 
   /* Undocumented:  numeric tags get translated directly into the RID */
@@ -234,6 +229,76 @@ int symbolic_name_to_rid(const char *zTag, const char *zType){
   return rid;
 }
 
+/*
+** Convert a symbolic name into a RID.  Acceptable forms:
+**
+**   *  SHA1 hash
+**   *  SHA1 hash prefix of at least 4 characters
+**   *  Symbolic Name
+**   *  "tag:" + symbolic name
+**   *  Date or date-time 
+**   *  "date:" + Date or date-time
+**   *  symbolic-name ":" date-time
+**   *  "tip"
+**
+** The following additional forms are available in local checkouts:
+**
+**   *  "current"
+**   *  "prev" or "previous"
+**   *  "next"
+**
+** Return the RID of the matching artifact.  Or return 0 if the name does not
+** match any known object.  Or return -1 if the name is ambiguious.
+**
+** The zType parameter specifies the type of artifact: ci, t, w, e, g. 
+** If zType is NULL or "" or "*" then any type of artifact will serve.
+** zType is "ci" in most use cases since we are usually searching for
+** a check-in.
+*/
+int symbolic_name_to_rid(const char *zTag, const char *zType){
+  int vid;
+  int rid = 0;
+  int i;
+
+  if( zType==0 || zType[0]==0 ) zType = "*";
+  if( zTag==0 || zTag[0]==0 ) return 0;
+
+  /* special keywords: "prev", "previous", "current", and "next" */
+  if( g.localOpen && (vid=db_lget_int("checkout",0))!=0 ){
+    if( fossil_strcmp(zTag, "current")==0 ){
+      rid = vid;
+    }else if( fossil_strcmp(zTag, "prev")==0 
+              || fossil_strcmp(zTag, "previous")==0 ){
+      rid = db_int(0, "SELECT pid FROM plink WHERE cid=%d AND isprim", vid);
+    }else if( fossil_strcmp(zTag, "next")==0 ){
+      rid = db_int(0, "SELECT cid FROM plink WHERE pid=%d"
+                      "  ORDER BY isprim DESC, mtime DESC", vid);
+    }
+    if( rid ) return rid;
+  }
+
+  for(i=0; i<nameCache.nUsed; i++){
+    if( fossil_strcmp(nameCache.a[i].zName, zTag)==0
+     && fossil_strcmp(nameCache.a[i].zType, zType)==0
+    ){
+      return nameCache.a[i].rid;
+    }
+  }
+  rid = resolve_name_to_rid(zTag, zType);
+  if( nameCache.nUsed<NAME_CACHE_SIZE ){
+    i = nameCache.nUsed++;
+  }else{
+    i = nameCache.iNext;
+    nameCache.iNext = (i+1)%NAME_CACHE_SIZE;
+    fossil_free(nameCache.a[i].zName);
+    fossil_free(nameCache.a[i].zType);
+  }
+  nameCache.a[i].zName = mprintf("%s", zTag);
+  nameCache.a[i].zType = mprintf("%s", zType);
+  nameCache.a[i].rid = rid;
+  return rid;
+}
+
 
 /*
 ** This routine takes a user-entered UUID which might be in mixed
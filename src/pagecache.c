@@ -0,0 +1,1097 @@
+/*
+** Copyright (c) 2012 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*******************************************************************************
+**
+** This file implements a cache of rendered web pages.
+**
+** Pages such as /timeline and /tree only change when new artifacts
+** arrive, so a server can save the reply to one request and send it
+** again for later requests that are the same.  Entries are kept in a
+** separate database named after the repository with "-pagecache"
+** appended, so that filling the cache never needs a write lock on the
+** repository itself.
+**
+** An entry is found using the SHA1 hash of everything that the page
+** might depend on: the URL, the cookies, the login and capabilities of
+** the user, and the "generation" of the repository.  The generation
+** changes whenever artifacts are crosslinked or shunned and whenever
+** a setting (including the skin) is changed, so old entries are never
+** used again.  They are removed as new ones are added.
+**
+** Replies are kept compressed with gzip, so that a client that accepts
+** gzip content-encoding is sent the saved bytes directly.
+**
+** The cache is disabled unless the "page-cache-size" setting is a
+** positive number of bytes.  It is best-effort: any error while using
+** the cache database just makes the request run in the usual way.
+*/
+#include "config.h"
+#include "pagecache.h"
+#if !defined(_WIN32)
+# include <sys/stat.h>
+# include <dirent.h>
+# include <utime.h>
+#endif
+
+/*
+** Pages that are eligible for caching.  Pages must be listed here
+** only if their content depends on nothing except the inputs that
+** go into the hash, so that a saved reply is still correct later.
+*/
+static const char *azCachePage[] = {
+  "brlist", "ci", "dir", "info", "leaves", "style.css", "tarball",
+  "timeline", "tree", "vinfo", "zip",
+};
+
+/*
+** State of the cache for the current request.
+*/
+static struct {
+  sqlite3 *db;           /* The cache database, or NULL */
+  int mxSize;            /* Maximum total bytes of cached pages */
+  char *zKey;            /* Hash of the current request */
+  char *zGen;            /* Generation of the repository */
+} pageCache;
+
+/*
+** Mark every page in the cache as out of date, by incrementing the
+** generation counter of the repository.  Call this whenever something
+** changes that might change the content of a cached page.
+*/
+void page_cache_invalidate(void){
+  db_multi_exec(
+    "REPLACE INTO config(name,value,mtime)"
+    " VALUES('page-generation',"
+    "  coalesce((SELECT value FROM config"
+    "             WHERE name='page-generation'),0)+1, now())"
+  );
+}
+
+/*
+** Version of the schema of the cache database, kept in its user_version.
+** Increase this whenever a table of the cache changes.  Everything in
+** the cache can be rebuilt, so a cache database of any other version
+** is simply emptied and created anew.
+*/
+#define PAGE_CACHE_VERSION 2
+
+/*
+** Open the cache database into *ppDb and create its tables if needed.
+** Return the number of errors.
+*/
+static int page_cache_open(sqlite3 **ppDb){
+  char *zName = mprintf("%s-pagecache", g.zRepositoryName);
+  int rc = sqlite3_open_v2(zName, ppDb,
+                   SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE, 0);
+  free(zName);
+  if( rc==SQLITE_OK ){
+    sqlite3_stmt *pStmt;
+    int iVersion = -1;
+    sqlite3_busy_timeout(*ppDb, 1000);
+    rc = sqlite3_prepare_v2(*ppDb, "PRAGMA user_version", -1, &pStmt, 0);
+    if( rc==SQLITE_OK ){
+      if( sqlite3_step(pStmt)==SQLITE_ROW ){
+        iVersion = sqlite3_column_int(pStmt, 0);
+      }
+      rc = sqlite3_finalize(pStmt);
+    }
+    if( rc==SQLITE_OK && iVersion!=PAGE_CACHE_VERSION ){
+      char *zSql = sqlite3_mprintf(
+        "DROP TABLE IF EXISTS page;\n"
+        "DROP TABLE IF EXISTS diff;\n"
+        "DROP TABLE IF EXISTS wiki;\n"
+        "DROP TABLE IF EXISTS report;\n"
+        "DROP TABLE IF EXISTS usage;\n"
+        "PRAGMA user_version=%d;", PAGE_CACHE_VERSION);
+      rc = sqlite3_exec(*ppDb, zSql, 0, 0, 0);
+      sqlite3_free(zSql);
+    }
+  }
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_exec(*ppDb,
+      "CREATE TABLE IF NOT EXISTS page(\n"
+      "  key TEXT PRIMARY KEY,  -- SHA1 hash of the request\n"
+      "  gen TEXT,              -- Generation of the repository\n"
+      "  mimetype TEXT,         -- Content type of the reply\n"
+      "  isconst BOOLEAN,       -- True if the page set g.isConst\n"
+      "  sz INTEGER,            -- Size of the content in bytes\n"
+      "  content BLOB           -- Reply compressed by gzip\n"
+      ");\n"
+      "CREATE TABLE IF NOT EXISTS diff(\n"
+      "  key TEXT PRIMARY KEY,  -- UUIDs of the two files and diff flags\n"
+      "  atime INTEGER,         -- Larger for more recently used entries\n"
+      "  sz INTEGER,            -- Size of the content in bytes\n"
+      "  content BLOB           -- Compressed text of the diff\n"
+      ");\n"
+      "CREATE INDEX IF NOT EXISTS diff_atime ON diff(atime);\n"
+      "CREATE TABLE IF NOT EXISTS wiki(\n"
+      "  key TEXT PRIMARY KEY,  -- SHA1 hash of the markup and render flags\n"
+      "  atime INTEGER,         -- Larger for more recently used entries\n"
+      "  sz INTEGER,            -- Size of the content in bytes\n"
+      "  deps TEXT,             -- Link targets and their state\n"
+      "  content BLOB           -- Compressed HTML\n"
+      ");\n"
+      "CREATE INDEX IF NOT EXISTS wiki_atime ON wiki(atime);\n"
+      "CREATE TABLE IF NOT EXISTS report(\n"
+      "  key TEXT PRIMARY KEY,  -- SHA1 hash of the query and generation\n"
+      "  gen TEXT,              -- Generation of the repository\n"
+      "  atime INTEGER,         -- Larger for more recently used entries\n"
+      "  sz INTEGER,            -- Size of the content in bytes\n"
+      "  content BLOB           -- Compressed HTML\n"
+      ");\n"
+      "CREATE INDEX IF NOT EXISTS report_atime ON report(atime);\n"
+      "CREATE TABLE IF NOT EXISTS usage(\n"
+      "  name TEXT PRIMARY KEY, -- Name of a table of the cache\n"
+      "  sz INTEGER             -- Total size of its entries in bytes\n"
+      ");\n"
+      "INSERT OR IGNORE INTO usage VALUES('diff',0);\n"
+      "INSERT OR IGNORE INTO usage VALUES('wiki',0);\n"
+      "INSERT OR IGNORE INTO usage VALUES('report',0);", 0, 0, 0);
+  }
+  if( rc!=SQLITE_OK ){
+    sqlite3_close(*ppDb);
+    *ppDb = 0;
+    return 1;
+  }
+  return 0;
+}
+
+/*
+** Write into *pnEntry and *pnByte the number of entries in table zTable
+** of the cache database and their total size.  Both are zero if there
+** is no cache database.  The database is not created.
+*/
+void page_cache_usage(const char *zTable, i64 *pnEntry, i64 *pnByte){
+  sqlite3 *db = 0;
+  sqlite3_stmt *pStmt = 0;
+  char *zName = mprintf("%s-pagecache", g.zRepositoryName);
+  char *zSql = mprintf("SELECT count(*), total(sz) FROM %s", zTable);
+  *pnEntry = *pnByte = 0;
+  if( file_size(zName)>0
+   && sqlite3_open_v2(zName, &db, SQLITE_OPEN_READONLY, 0)==SQLITE_OK
+   && sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0)==SQLITE_OK
+   && sqlite3_step(pStmt)==SQLITE_ROW
+  ){
+    *pnEntry = sqlite3_column_int64(pStmt, 0);
+    *pnByte = sqlite3_column_int64(pStmt, 1);
+  }
+  sqlite3_finalize(pStmt);
+  sqlite3_close(db);
+  free(zSql);
+  free(zName);
+}
+
+/*
+** Return the current generation of the repository, in memory obtained
+** from fossil_malloc().
+*/
+static char *page_cache_generation(void){
+  return db_text("0", "SELECT %d||'/'||max(mtime) FROM config",
+                 db_get_int("page-generation", 0));
+}
+
+/*
+** Compute the key for the current request in pageCache.zKey.
+*/
+static void page_cache_key(void){
+  Blob key;
+  blob_zero(&key);
+  blob_appendf(&key, "%s\n%s\n%s?%s\n%s\n%s\n%s\n",
+    pageCache.zGen, g.zBaseURL, PD("PATH_INFO",""), PD("QUERY_STRING",""),
+    PD("HTTP_COOKIE",""), g.zLogin ? g.zLogin : "", g.zCsrfToken
+  );
+  blob_append(&key, (const char*)&g.perm, sizeof(g.perm));
+  sha1sum_blob(&key, &key);
+  pageCache.zKey = mprintf("%s", blob_str(&key));
+  blob_reset(&key);
+}
+
+/*
+** Called before the page zPage is generated.  If the reply for the
+** current request is in the cache, make it the reply and return true.
+** Otherwise return false, and the caller should generate the page and
+** then call page_cache_end().
+*/
+int page_cache_begin(const char *zPage){
+  sqlite3_stmt *pStmt = 0;
+  int i;
+  int isHit = 0;
+
+  for(i=0; i<sizeof(azCachePage)/sizeof(azCachePage[0]); i++){
+    if( fossil_strcmp(zPage, azCachePage[i])==0 ) break;
+  }
+  if( i>=sizeof(azCachePage)/sizeof(azCachePage[0]) ) return 0;
+  if( fossil_strcmp(PD("REQUEST_METHOD",""),"GET")!=0 ) return 0;
+#ifdef FOSSIL_ENABLE_JSON
+  if( g.json.isJsonMode ) return 0;
+#endif
+  if( g.localOpen ) return 0;  /* Pages mark the current checkout */
+  pageCache.mxSize = db_get_int("page-cache-size", 0);
+  if( pageCache.mxSize<=0 ) return 0;
+  login_check_credentials();
+  pageCache.zGen = page_cache_generation();
+  if( page_cache_open(&pageCache.db) ) return 0;
+  page_cache_key();
+  if( sqlite3_prepare_v2(pageCache.db,
+        "SELECT mimetype, isconst, content FROM page WHERE key=?1", -1,
+        &pStmt, 0)==SQLITE_OK ){
+    sqlite3_bind_text(pStmt, 1, pageCache.zKey, -1, SQLITE_STATIC);
+    if( sqlite3_step(pStmt)==SQLITE_ROW ){
+      Blob content, x;
+      blob_init(&x, sqlite3_column_blob(pStmt, 2),
+                sqlite3_column_bytes(pStmt, 2));
+      cgi_set_content_type((const char*)sqlite3_column_text(pStmt, 0));
+      if( cgi_reply_gzip_ok() ){
+        blob_copy(&content, &x);
+        cgi_set_content_gzipped(&content);
+        isHit = 1;
+      }else if( gzip_uncompress_blob(&x, &content)==0 ){
+        cgi_set_content(&content);
+        isHit = 1;
+      }
+      if( isHit ) g.isConst = sqlite3_column_int(pStmt, 1);
+    }
+  }
+  sqlite3_finalize(pStmt);
+  if( isHit ){
+    sqlite3_close(pageCache.db);
+    pageCache.db = 0;
+  }
+  return isHit;
+}
+
+/*
+** Called after a page is generated following a call to
+** page_cache_begin() that returned false.  Save the reply in the cache
+** if it is a plain reply that could be sent again.  Then, if the cache
+** holds more than "page-cache-size" bytes, remove the older half of its
+** entries.
+*/
+void page_cache_end(void){
+  const char *zType;
+  Blob *pReply;
+  Blob x;
+  sqlite3_stmt *pStmt = 0;
+
+  if( pageCache.db==0 ) return;
+  pReply = cgi_reusable_reply(&zType);
+  if( pReply ){
+    gzip_compress_blob(pReply, &x, 9);
+    if( blob_size(&x)<=pageCache.mxSize
+     && sqlite3_prepare_v2(pageCache.db,
+          "REPLACE INTO page(key,gen,mimetype,isconst,sz,content)"
+          " VALUES(?1,?2,?3,?4,?5,?6)", -1, &pStmt, 0)==SQLITE_OK
+    ){
+      sqlite3_bind_text(pStmt, 1, pageCache.zKey, -1, SQLITE_STATIC);
+      sqlite3_bind_text(pStmt, 2, pageCache.zGen, -1, SQLITE_STATIC);
+      sqlite3_bind_text(pStmt, 3, zType, -1, SQLITE_STATIC);
+      sqlite3_bind_int(pStmt, 4, g.isConst);
+      sqlite3_bind_int(pStmt, 5, blob_size(&x));
+      sqlite3_bind_blob(pStmt, 6, blob_buffer(&x), blob_size(&x),
+                        SQLITE_STATIC);
+      sqlite3_step(pStmt);
+    }
+    sqlite3_finalize(pStmt);
+    blob_reset(&x);
+    pStmt = 0;
+    if( sqlite3_prepare_v2(pageCache.db,
+          "DELETE FROM page WHERE gen<>?1", -1, &pStmt, 0)==SQLITE_OK ){
+      sqlite3_bind_text(pStmt, 1, pageCache.zGen, -1, SQLITE_STATIC);
+      sqlite3_step(pStmt);
+    }
+    sqlite3_finalize(pStmt);
+    pStmt = 0;
+    if( sqlite3_prepare_v2(pageCache.db,
+          "DELETE FROM page"
+          " WHERE (SELECT total(sz) FROM page)>?1"
+          "   AND rowid<(SELECT rowid FROM page ORDER BY rowid DESC"
+          "               LIMIT 1 OFFSET (SELECT count(*)/2 FROM page))"
+          , -1, &pStmt, 0)==SQLITE_OK ){
+      sqlite3_bind_int(pStmt, 1, pageCache.mxSize);
+      sqlite3_step(pStmt);
+    }
+    sqlite3_finalize(pStmt);
+  }
+  sqlite3_close(pageCache.db);
+  pageCache.db = 0;
+}
+
+/*
+** Return the value of the cache size setting zName, in bytes.
+*/
+static i64 page_cache_setting(const char *zName){
+  char *zSize = db_get(zName, 0);
+  i64 mxSize = zSize ? strtoll(zSize, 0, 10) : 0;
+  free(zSize);
+  return mxSize;
+}
+
+/*
+** The DIFF, WIKI and REPORT tables are trimmed to a size limit using
+** the running total of the sizes of their entries that is kept in the
+** USAGE table, so that saving an entry never adds up the sizes of all
+** the others.  Each change to one of these tables is made within
+** cache_begin() and cache_end() so that the total stays right when
+** several processes share the cache.
+*/
+static int cache_begin(sqlite3 *db){
+  return sqlite3_exec(db, "BEGIN IMMEDIATE", 0, 0, 0)==SQLITE_OK;
+}
+static void cache_end(sqlite3 *db){
+  if( sqlite3_exec(db, "COMMIT", 0, 0, 0)!=SQLITE_OK ){
+    sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
+  }
+}
+
+/*
+** Add nDelta bytes to the running total of table zTable.
+*/
+static void cache_usage_add(sqlite3 *db, const char *zTable, i64 nDelta){
+  sqlite3_stmt *pStmt = 0;
+  if( nDelta!=0
+   && sqlite3_prepare_v2(db, "UPDATE usage SET sz=sz+?2 WHERE name=?1",
+                         -1, &pStmt, 0)==SQLITE_OK
+  ){
+    sqlite3_bind_text(pStmt, 1, zTable, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(pStmt, 2, nDelta);
+    sqlite3_step(pStmt);
+  }
+  sqlite3_finalize(pStmt);
+}
+
+/*
+** Return the size of the entry with key zKey of table zTable, or 0 if
+** there is no such entry.
+*/
+static i64 cache_entry_size(sqlite3 *db, const char *zTable,
+                            const char *zKey){
+  sqlite3_stmt *pStmt = 0;
+  char *zSql = mprintf("SELECT sz FROM %s WHERE key=?1", zTable);
+  i64 sz = 0;
+  if( sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0)==SQLITE_OK ){
+    sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+    if( sqlite3_step(pStmt)==SQLITE_ROW ) sz = sqlite3_column_int64(pStmt, 0);
+  }
+  sqlite3_finalize(pStmt);
+  free(zSql);
+  return sz;
+}
+
+/*
+** Run the REPLACE statement pStmt, which saves an entry of nByte bytes
+** under key zKey in table zTable, and finalize it.  Then, if the table
+** holds more than mxSize bytes, remove its least recently used entries,
+** walking the index on atime, until it holds no more than half of that.
+*/
+static void cache_replace_and_trim(
+  sqlite3 *db,            /* The cache database */
+  const char *zTable,     /* "diff", "wiki" or "report" */
+  const char *zKey,       /* Key of the new entry */
+  i64 nByte,              /* Size of the new entry */
+  sqlite3_stmt *pStmt,    /* REPLACE statement for the new entry */
+  i64 mxSize              /* Size limit of the table */
+){
+  i64 nOld = cache_entry_size(db, zTable, zKey);
+  i64 total = 0;
+  char *zSql;
+  if( sqlite3_step(pStmt)==SQLITE_DONE ){
+    cache_usage_add(db, zTable, nByte-nOld);
+  }
+  sqlite3_finalize(pStmt);
+  pStmt = 0;
+  if( sqlite3_prepare_v2(db, "SELECT sz FROM usage WHERE name=?1", -1,
+                         &pStmt, 0)==SQLITE_OK ){
+    sqlite3_bind_text(pStmt, 1, zTable, -1, SQLITE_STATIC);
+    if( sqlite3_step(pStmt)==SQLITE_ROW ){
+      total = sqlite3_column_int64(pStmt, 0);
+    }
+  }
+  sqlite3_finalize(pStmt);
+  pStmt = 0;
+  if( total<=mxSize ) return;
+  zSql = mprintf("SELECT atime, sz FROM %s ORDER BY atime", zTable);
+  if( sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0)==SQLITE_OK ){
+    i64 nFreed = 0;
+    sqlite3_int64 iCut = 0;
+    while( total-nFreed>mxSize/2 && sqlite3_step(pStmt)==SQLITE_ROW ){
+      iCut = sqlite3_column_int64(pStmt, 0);
+      nFreed += sqlite3_column_int64(pStmt, 1);
+    }
+    sqlite3_finalize(pStmt);
+    pStmt = 0;
+    free(zSql);
+    zSql = mprintf("SELECT total(sz) FROM %s WHERE atime<=?1", zTable);
+    nFreed = 0;
+    if( sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0)==SQLITE_OK ){
+      sqlite3_bind_int64(pStmt, 1, iCut);
+      if( sqlite3_step(pStmt)==SQLITE_ROW ){
+        nFreed = sqlite3_column_int64(pStmt, 0);
+      }
+    }
+    sqlite3_finalize(pStmt);
+    pStmt = 0;
+    free(zSql);
+    zSql = mprintf("DELETE FROM %s WHERE atime<=?1", zTable);
+    if( nFreed>0 && sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0)==SQLITE_OK ){
+      sqlite3_bind_int64(pStmt, 1, iCut);
+      if( sqlite3_step(pStmt)==SQLITE_DONE ){
+        cache_usage_add(db, zTable, -nFreed);
+      }
+    }
+  }
+  sqlite3_finalize(pStmt);
+  free(zSql);
+}
+
+/*
+** Rendered diffs are kept in the DIFF table of the same database, so
+** that the /fdiff, /vdiff, /info and /ci pages do not compute the same
+** diff again for each reader.  An entry is keyed by the UUIDs of the
+** two files and the flags passed to text_diff(), which include the
+** width and the amount of context.  Artifacts never change, so entries
+** never go out of date.  Once the table holds more than the
+** "diff-cache-size" setting in bytes, the least recently used half of
+** the entries is removed.
+*/
+static struct {
+  int isInit;            /* True once db and mxSize are set */
+  sqlite3 *db;           /* The cache database, or NULL if disabled */
+  i64 mxSize;            /* Maximum total bytes of cached diffs */
+} diffCache;
+
+/*
+** Return the cache database for diffs, or NULL if the cache is disabled
+** or cannot be opened.
+*/
+static sqlite3 *diff_cache_db(void){
+  if( !diffCache.isInit ){
+    diffCache.isInit = 1;
+    diffCache.mxSize = page_cache_setting("diff-cache-size");
+    if( diffCache.mxSize>0 ) page_cache_open(&diffCache.db);
+  }
+  return diffCache.db;
+}
+
+/*
+** Return the key for the diff from zFrom to zTo using diffFlags.
+*/
+static char *diff_cache_key(const char *zFrom, const char *zTo, u64 diffFlags){
+  return mprintf("%s/%s/%llu", zFrom ? zFrom : "", zTo ? zTo : "",
+                 diffFlags);
+}
+
+/*
+** If the diff from the file with UUID zFrom to the file with UUID zTo
+** using diffFlags is in the cache, append it to pOut and return true.
+** Either UUID may be NULL for an empty file.
+*/
+int diff_cache_get(
+  const char *zFrom,
+  const char *zTo,
+  u64 diffFlags,
+  Blob *pOut
+){
+  sqlite3 *db = diff_cache_db();
+  sqlite3_stmt *pStmt = 0;
+  char *zKey;
+  int isHit = 0;
+
+  if( db==0 ) return 0;
+  zKey = diff_cache_key(zFrom, zTo, diffFlags);
+  if( sqlite3_prepare_v2(db, "SELECT content FROM diff WHERE key=?1", -1,
+                         &pStmt, 0)==SQLITE_OK ){
+    sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+    if( sqlite3_step(pStmt)==SQLITE_ROW ){
+      Blob x, content;
+      blob_init(&x, sqlite3_column_blob(pStmt, 0),
+                sqlite3_column_bytes(pStmt, 0));
+      if( blob_uncompress(&x, &content)==0 ){
+        blob_append(pOut, blob_buffer(&content), blob_size(&content));
+        blob_reset(&content);
+        isHit = 1;
+      }
+    }
+  }
+  sqlite3_finalize(pStmt);
+  pStmt = 0;
+  if( isHit
+   && sqlite3_prepare_v2(db,
+        "UPDATE diff SET atime=(SELECT max(atime)+1 FROM diff) WHERE key=?1",
+        -1, &pStmt, 0)==SQLITE_OK
+  ){
+    sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+    sqlite3_step(pStmt);
+  }
+  sqlite3_finalize(pStmt);
+  free(zKey);
+  return isHit;
+}
+
+/*
+** Save pDiff as the diff from the file with UUID zFrom to the file
+** with UUID zTo using diffFlags.  Then, if the cache holds more than
+** "diff-cache-size" bytes, remove the least recently used half of its
+** entries.
+*/
+void diff_cache_put(
+  const char *zFrom,
+  const char *zTo,
+  u64 diffFlags,
+  Blob *pDiff
+){
+  sqlite3 *db = diff_cache_db();
+  sqlite3_stmt *pStmt = 0;
+  char *zKey;
+  Blob x;
+
+  if( db==0 ) return;
+  blob_compress(pDiff, &x);
+  if( blob_size(&x)>diffCache.mxSize ){
+    blob_reset(&x);
+    return;
+  }
+  zKey = diff_cache_key(zFrom, zTo, diffFlags);
+  if( cache_begin(db) ){
+    if( sqlite3_prepare_v2(db,
+          "REPLACE INTO diff(key,atime,sz,content)"
+          " VALUES(?1,(SELECT coalesce(max(atime),0)+1 FROM diff),?2,?3)",
+          -1, &pStmt, 0)==SQLITE_OK ){
+      sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+      sqlite3_bind_int(pStmt, 2, blob_size(&x));
+      sqlite3_bind_blob(pStmt, 3, blob_buffer(&x), blob_size(&x),
+                        SQLITE_STATIC);
+      cache_replace_and_trim(db, "diff", zKey, blob_size(&x), pStmt,
+                             diffCache.mxSize);
+    }
+    cache_end(db);
+  }
+  blob_reset(&x);
+  free(zKey);
+}
+
+/*
+** Rendered wiki is kept in the WIKI table of the same database, so that
+** wiki pages, documents and tickets are not parsed and rendered again
+** for each reader.  An entry is keyed by a hash of the markup and of
+** everything else that wiki_convert() depends on.  The rendering also
+** depends on whether the artifacts and tickets named by its links
+** exist and whether the tickets are closed, so those link targets are
+** saved with the entry in DEPS and wiki_convert() checks them again
+** before using it.  Once the table holds more than the "wiki-cache-size"
+** setting in bytes, the least recently used half of the entries is
+** removed.
+*/
+static struct {
+  int isInit;            /* True once db and mxSize are set */
+  sqlite3 *db;           /* The cache database, or NULL if disabled */
+  i64 mxSize;            /* Maximum total bytes of cached wiki */
+} wikiCache;
+
+/*
+** Return the cache database for rendered wiki, or NULL if the cache is
+** disabled or cannot be opened.
+*/
+static sqlite3 *wiki_cache_db(void){
+  if( !wikiCache.isInit ){
+    wikiCache.isInit = 1;
+    wikiCache.mxSize = page_cache_setting("wiki-cache-size");
+    if( wikiCache.mxSize>0 ) page_cache_open(&wikiCache.db);
+  }
+  return wikiCache.db;
+}
+
+/*
+** If the wiki rendering with key zKey is in the cache, append the HTML
+** to pHtml and the link targets that it depends on to pDeps, and return
+** true.  The caller must check the link targets before using the HTML.
+*/
+int wiki_cache_get(const char *zKey, Blob *pHtml, Blob *pDeps){
+  sqlite3 *db = wiki_cache_db();
+  sqlite3_stmt *pStmt = 0;
+  int isHit = 0;
+
+  if( db==0 ) return 0;
+  if( sqlite3_prepare_v2(db, "SELECT content, deps FROM wiki WHERE key=?1",
+                         -1, &pStmt, 0)==SQLITE_OK ){
+    sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+    if( sqlite3_step(pStmt)==SQLITE_ROW ){
+      Blob x, content;
+      blob_init(&x, sqlite3_column_blob(pStmt, 0),
+                sqlite3_column_bytes(pStmt, 0));
+      if( blob_uncompress(&x, &content)==0 ){
+        blob_append(pHtml, blob_buffer(&content), blob_size(&content));
+        blob_append(pDeps, (const char*)sqlite3_column_text(pStmt, 1),
+                    sqlite3_column_bytes(pStmt, 1));
+        blob_reset(&content);
+        isHit = 1;
+      }
+    }
+  }
+  sqlite3_finalize(pStmt);
+  pStmt = 0;
+  if( isHit
+   && sqlite3_prepare_v2(db,
+        "UPDATE wiki SET atime=(SELECT max(atime)+1 FROM wiki) WHERE key=?1",
+        -1, &pStmt, 0)==SQLITE_OK
+  ){
+    sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+    sqlite3_step(pStmt);
+  }
+  sqlite3_finalize(pStmt);
+  return isHit;
+}
+
+/*
+** Save pHtml as the wiki rendering with key zKey, which depends on the
+** link targets in pDeps.  Then, if the cache holds more than
+** "wiki-cache-size" bytes, remove the least recently used half of its
+** entries.
+*/
+void wiki_cache_put(const char *zKey, Blob *pHtml, Blob *pDeps){
+  sqlite3 *db = wiki_cache_db();
+  sqlite3_stmt *pStmt = 0;
+  Blob x;
+
+  if( db==0 ) return;
+  blob_compress(pHtml, &x);
+  if( blob_size(&x)>wikiCache.mxSize ){
+    blob_reset(&x);
+    return;
+  }
+  if( cache_begin(db) ){
+    if( sqlite3_prepare_v2(db,
+          "REPLACE INTO wiki(key,atime,sz,deps,content)"
+          " VALUES(?1,(SELECT coalesce(max(atime),0)+1 FROM wiki),?2,?3,?4)",
+          -1, &pStmt, 0)==SQLITE_OK ){
+      sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+      sqlite3_bind_int(pStmt, 2, blob_size(&x));
+      sqlite3_bind_text(pStmt, 3, blob_buffer(pDeps), blob_size(pDeps),
+                        SQLITE_STATIC);
+      sqlite3_bind_blob(pStmt, 4, blob_buffer(&x), blob_size(&x),
+                        SQLITE_STATIC);
+      cache_replace_and_trim(db, "wiki", zKey, blob_size(&x), pStmt,
+                             wikiCache.mxSize);
+    }
+    cache_end(db);
+  }
+  blob_reset(&x);
+}
+
+/*
+** The HTML tables of ticket reports are kept in the REPORT table of the
+** same database, so that a report viewed over and over, such as one on
+** a dashboard that refreshes itself, runs its query only once for each
+** generation of the repository.  The caller supplies the text of the
+** query along with anything else the HTML depends on, and the entry is
+** keyed by the hash of that text and the generation.  Entries for
+** older generations are removed as new ones are added, and once the
+** table holds more than the "report-cache-size" setting in bytes, the
+** least recently used half of the entries is removed.
+*/
+static struct {
+  int isInit;            /* True once db and mxSize are set */
+  sqlite3 *db;           /* The cache database, or NULL if disabled */
+  i64 mxSize;            /* Maximum total bytes of cached reports */
+  char *zGen;            /* Generation of the repository */
+} reportCache;
+
+/*
+** Return the cache database for reports, or NULL if the cache is
+** disabled or cannot be opened.
+*/
+static sqlite3 *report_cache_db(void){
+  if( !reportCache.isInit ){
+    reportCache.isInit = 1;
+    reportCache.mxSize = page_cache_setting("report-cache-size");
+    if( reportCache.mxSize>0 && page_cache_open(&reportCache.db)==0 ){
+      reportCache.zGen = page_cache_generation();
+    }
+  }
+  return reportCache.db;
+}
+
+/*
+** Return the key for the report described by zReport.
+*/
+static char *report_cache_key(const char *zReport){
+  Blob key;
+  char *zKey;
+  blob_zero(&key);
+  blob_appendf(&key, "%s\n%s", reportCache.zGen, zReport);
+  sha1sum_blob(&key, &key);
+  zKey = mprintf("%s", blob_str(&key));
+  blob_reset(&key);
+  return zKey;
+}
+
+/*
+** If the HTML for the report described by zReport is in the cache,
+** append it to pOut and return true.
+*/
+int report_cache_get(const char *zReport, Blob *pOut){
+  sqlite3 *db = report_cache_db();
+  sqlite3_stmt *pStmt = 0;
+  char *zKey;
+  int isHit = 0;
+
+  if( db==0 ) return 0;
+  zKey = report_cache_key(zReport);
+  if( sqlite3_prepare_v2(db, "SELECT content FROM report WHERE key=?1", -1,
+                         &pStmt, 0)==SQLITE_OK ){
+    sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+    if( sqlite3_step(pStmt)==SQLITE_ROW ){
+      Blob x, content;
+      blob_init(&x, sqlite3_column_blob(pStmt, 0),
+                sqlite3_column_bytes(pStmt, 0));
+      if( blob_uncompress(&x, &content)==0 ){
+        blob_append(pOut, blob_buffer(&content), blob_size(&content));
+        blob_reset(&content);
+        isHit = 1;
+      }
+    }
+  }
+  sqlite3_finalize(pStmt);
+  pStmt = 0;
+  if( isHit
+   && sqlite3_prepare_v2(db,
+        "UPDATE report SET atime=(SELECT max(atime)+1 FROM report)"
+        " WHERE key=?1", -1, &pStmt, 0)==SQLITE_OK
+  ){
+    sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+    sqlite3_step(pStmt);
+  }
+  sqlite3_finalize(pStmt);
+  free(zKey);
+  return isHit;
+}
+
+/*
+** Save pHtml as the HTML for the report described by zReport.  Remove
+** the entries of older generations and then, if the cache holds more
+** than "report-cache-size" bytes, the least recently used half of the
+** remaining entries.
+*/
+void report_cache_put(const char *zReport, Blob *pHtml){
+  sqlite3 *db = report_cache_db();
+  sqlite3_stmt *pStmt = 0;
+  char *zKey;
+  Blob x;
+
+  if( db==0 ) return;
+  blob_compress(pHtml, &x);
+  if( blob_size(&x)>reportCache.mxSize ){
+    blob_reset(&x);
+    return;
+  }
+  zKey = report_cache_key(zReport);
+  if( cache_begin(db) ){
+    if( sqlite3_prepare_v2(db,
+          "SELECT total(sz) FROM report WHERE gen<>?1", -1, &pStmt, 0)
+        ==SQLITE_OK ){
+      sqlite3_bind_text(pStmt, 1, reportCache.zGen, -1, SQLITE_STATIC);
+      if( sqlite3_step(pStmt)==SQLITE_ROW ){
+        cache_usage_add(db, "report", -sqlite3_column_int64(pStmt, 0));
+      }
+    }
+    sqlite3_finalize(pStmt);
+    pStmt = 0;
+    if( sqlite3_prepare_v2(db,
+          "DELETE FROM report WHERE gen<>?1", -1, &pStmt, 0)==SQLITE_OK ){
+      sqlite3_bind_text(pStmt, 1, reportCache.zGen, -1, SQLITE_STATIC);
+      sqlite3_step(pStmt);
+    }
+    sqlite3_finalize(pStmt);
+    pStmt = 0;
+    if( sqlite3_prepare_v2(db,
+          "REPLACE INTO report(key,gen,atime,sz,content)"
+          " VALUES(?1,?2,(SELECT coalesce(max(atime),0)+1 FROM report),?3,?4)",
+          -1, &pStmt, 0)==SQLITE_OK ){
+      sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+      sqlite3_bind_text(pStmt, 2, reportCache.zGen, -1, SQLITE_STATIC);
+      sqlite3_bind_int(pStmt, 3, blob_size(&x));
+      sqlite3_bind_blob(pStmt, 4, blob_buffer(&x), blob_size(&x),
+                        SQLITE_STATIC);
+      cache_replace_and_trim(db, "report", zKey, blob_size(&x), pStmt,
+                             reportCache.mxSize);
+    }
+    cache_end(db);
+  }
+  blob_reset(&x);
+  free(zKey);
+}
+
+/*
+** ZIP archives and tarballs of check-ins are kept as files in a
+** directory named after the repository with "-archivecache" appended,
+** so that popular downloads such as releases are built only once and
+** later sent straight from the file.  A check-in never changes, so each
+** file is named by the SHA1 hash of everything its archive depends on:
+** the check-in, the format, the name of the top-level directory, the
+** compression level and the "manifest" setting.  Check-ins are added
+** when first requested, and those tagged "release" as soon as the tag
+** arrives.  The modification time of a file is the time it was last
+** sent.  Once the files add up to more than the "archive-cache-size"
+** setting in bytes, the least recently sent ones are removed.
+**
+** The archive cache is not available on Windows.
+*/
+static struct {
+  int isInit;            /* True once zDir and mxSize are set */
+  char *zDir;            /* The cache directory, or NULL if disabled */
+  i64 mxSize;            /* Maximum total bytes of cached archives */
+  Bag pending;           /* Release check-ins to add to the cache */
+} archiveCache;
+
+/*
+** Return the archive cache directory, or NULL if the cache is disabled.
+*/
+static const char *archive_cache_dir(void){
+  if( !archiveCache.isInit ){
+    archiveCache.isInit = 1;
+#if !defined(_WIN32)
+    char *zSize = db_get("archive-cache-size", 0);
+    archiveCache.mxSize = zSize ? strtoll(zSize, 0, 10) : 0;
+    free(zSize);
+    if( archiveCache.mxSize>0 ){
+      archiveCache.zDir = mprintf("%s-archivecache", g.zRepositoryName);
+      file_mkdir(archiveCache.zDir, 0);
+    }
+#endif
+  }
+  return archiveCache.zDir;
+}
+
+/*
+** Return the name of the cache file for the archive of check-in rid
+** in format zExt ("zip" or "tar.gz") with top-level directory zDir.
+*/
+static char *archive_cache_name(int rid, const char *zExt, const char *zDir){
+  Blob key;
+  char *zName;
+  blob_zero(&key);
+  blob_appendf(&key, "%z\n%s\n%s\n%d\n%d\n",
+    db_text("", "SELECT uuid FROM blob WHERE rid=%d", rid),
+    zExt, zDir ? zDir : "", archive_level(), db_get_boolean("manifest", 0)
+  );
+  sha1sum_blob(&key, &key);
+  zName = mprintf("%s/%s.%s", archiveCache.zDir, blob_str(&key), zExt);
+  blob_reset(&key);
+  return zName;
+}
+
+#if !defined(_WIN32)
+/*
+** One file in the archive cache directory.
+*/
+struct ArchiveFile {
+  char *zName;           /* Full pathname */
+  i64 sz;                /* Size in bytes */
+  i64 mtime;             /* Time last sent */
+};
+
+/*
+** Comparison function for qsort() that puts the least recently sent
+** archives first.
+*/
+static int archive_file_cmp(const void *a, const void *b){
+  const struct ArchiveFile *pA = (const struct ArchiveFile*)a;
+  const struct ArchiveFile *pB = (const struct ArchiveFile*)b;
+  return pA->mtime<pB->mtime ? -1 : pA->mtime>pB->mtime;
+}
+#endif
+
+/*
+** If the archive cache holds more than "archive-cache-size" bytes,
+** remove the least recently sent archives until it does not.
+*/
+static void archive_cache_trim(void){
+#if !defined(_WIN32)
+  DIR *d;
+  struct dirent *pEntry;
+  struct ArchiveFile *a = 0;
+  int n = 0, nAlloc = 0, i;
+  i64 total = 0;
+
+  d = opendir(archiveCache.zDir);
+  if( d==0 ) return;
+  while( (pEntry = readdir(d))!=0 ){
+    struct stat st;
+    char *zName;
+    /* Skip "." and "..", and files that archive_cache_open() is writing */
+    if( pEntry->d_name[0]=='.' || strchr(pEntry->d_name, '-') ) continue;
+    zName = mprintf("%s/%s", archiveCache.zDir, pEntry->d_name);
+    if( stat(zName, &st)!=0 || !S_ISREG(st.st_mode) ){
+      free(zName);
+      continue;
+    }
+    if( n>=nAlloc ){
+      nAlloc = nAlloc*2 + 20;
+      a = fossil_realloc(a, nAlloc*sizeof(a[0]));
+    }
+    a[n].zName = zName;
+    a[n].sz = st.st_size;
+    a[n].mtime = st.st_mtime;
+    total += st.st_size;
+    n++;
+  }
+  closedir(d);
+  if( total>archiveCache.mxSize ){
+    qsort(a, n, sizeof(a[0]), archive_file_cmp);
+    for(i=0; i<n && total>archiveCache.mxSize; i++){
+      file_delete(a[i].zName);
+      total -= a[i].sz;
+    }
+  }
+  for(i=0; i<n; i++) free(a[i].zName);
+  free(a);
+#endif
+}
+
+/*
+** Make sure the archive cache holds the archive of check-in rid in
+** format zExt with top-level directory zDir, building it with xBuild()
+** if it does not.  Return the cache file opened for reading, or NULL
+** if the archive is not cached.
+**
+** The archive is built straight into a temporary file in the cache
+** directory, a part at a time, and renamed into place once complete.
+** So the whole archive is never held in memory, and a reader never
+** sees a partly written file.
+*/
+static FILE *archive_cache_open(
+  int rid,
+  const char *zExt,
+  const char *zDir,
+  void (*xBuild)(int, Blob*, const char*)
+){
+  char *zFile;
+  FILE *in = 0;
+
+  if( archive_cache_dir()==0 ) return 0;
+  zFile = archive_cache_name(rid, zExt, zDir);
+#if !defined(_WIN32)
+  in = fossil_fopen(zFile, "rb");
+  if( in ){
+    utime(zFile, 0);
+  }else{
+    char *zTmp = mprintf("%s-%d", zFile, (int)getpid());
+    FILE *out = fossil_fopen(zTmp, "wb");
+    if( out ){
+      i64 sz;
+      int nErr;
+      archive_output_to(out);
+      xBuild(rid, 0, zDir);
+      nErr = archive_output_to(0);
+      sz = ftell(out);
+      if( fclose(out)!=0 ) nErr++;
+      if( nErr==0 && sz>0 && sz<=archiveCache.mxSize
+       && rename(zTmp, zFile)==0
+      ){
+        archive_cache_trim();
+        in = fossil_fopen(zFile, "rb");
+      }else{
+        file_delete(zTmp);
+      }
+    }
+    free(zTmp);
+  }
+#endif
+  free(zFile);
+  return in;
+}
+
+/*
+** Write the body of a reply from an open archive cache file.
+*/
+static void archive_cache_stream(void *pArg, FILE *out){
+  FILE *in = (FILE*)pArg;
+  file_send(in, out);
+  fclose(in);
+}
+
+/*
+** Make the archive of check-in rid in format zExt ("zip" or "tar.gz"),
+** with top-level directory zDir, the reply to the current request,
+** using the archive cache.  xBuild() is zip_of_baseline() or
+** tarball_of_checkin(), and is called to build the archive if it is
+** not already cached.  Return false if the archive cache is disabled or
+** the archive could not be cached, in which case the caller should
+** generate the archive itself.
+*/
+int archive_cache_reply(
+  int rid,
+  const char *zExt,
+  const char *zDir,
+  void (*xBuild)(int, Blob*, const char*)
+){
+  FILE *in;
+  i64 sz;
+  if( archive_cache_dir()==0 ) return 0;
+  in = archive_cache_open(rid, zExt, zDir, xBuild);
+  if( in==0 ) return 0;
+  fseek(in, 0, SEEK_END);
+  sz = ftell(in);
+  rewind(in);
+  cgi_set_content_stream(sz, archive_cache_stream, in);
+  return 1;
+}
+
+/*
+** Check-in rid has just been tagged "release".  Arrange for its ZIP
+** archive and tarball to be added to the archive cache, if the cache
+** is enabled, by archive_cache_fill_pending() once the transaction
+** that added the tag has committed.
+*/
+void archive_cache_add_release(int rid){
+  if( archive_cache_dir() ) bag_insert(&archiveCache.pending, rid);
+}
+
+/*
+** Forget the release check-ins waiting to be added to the archive
+** cache.  This is done on a rollback, and by the rebuild command,
+** since all of the "release" tags it crosslinks are old.
+*/
+void archive_cache_forget_pending(void){
+  bag_clear(&archiveCache.pending);
+}
+
+/*
+** Add the archives of the release check-ins noted by
+** archive_cache_add_release() to the archive cache, under the names
+** used by the links on the /info page.  db_end_transaction() calls
+** this after each commit, so that building the archives never holds
+** the repository write lock.
+*/
+void archive_cache_fill_pending(void){
+  Bag pending;
+  int rid;
+  if( bag_count(&archiveCache.pending)==0 ) return;
+  pending = archiveCache.pending;
+  bag_init(&archiveCache.pending);
+  for(rid=bag_first(&pending); rid; rid=bag_next(&pending, rid)){
+    char *zDir = db_text(0,
+       "SELECT %Q||'-'||substr(uuid,1,16) FROM blob WHERE rid=%d",
+       db_get("project-name", "unnamed"), rid);
+    FILE *in;
+    if( zDir==0 ) continue;
+    in = archive_cache_open(rid, "tar.gz", zDir, tarball_of_checkin);
+    if( in ) fclose(in);
+    in = archive_cache_open(rid, "zip", zDir, zip_of_baseline);
+    if( in ) fclose(in);
+    free(zDir);
+  }
+  bag_clear(&pending);
+}
@@ -91,7 +91,7 @@ void path_reset(void){
     fossil_free(p);
   }
   bag_clear(&path.seen);
-  memset(&path, 0, sizeof(&path));
+  memset(&path, 0, sizeof(path));
 }
 
 /*
@@ -125,9 +125,9 @@ PathNode *path_shortest(
   int directOnly,     /* No merge links if true */
   int oneWayOnly      /* Parent->child only if true */
 ){
-  Stmt s;
   PathNode *pPrev;
   PathNode *p;
+  int genTo;
 
   path_reset();
   path.pStart = path_new_node(iFrom, 0, 0);
@@ -135,50 +135,43 @@ PathNode *path_shortest(
     path.pEnd = path.pStart;
     return path.pStart;
   }
-  if( oneWayOnly && directOnly ){
-    db_prepare(&s, 
-        "SELECT cid, 1 FROM plink WHERE pid=:pid AND isprim"
-    );
-  }else if( oneWayOnly ){
-    db_prepare(&s, 
-        "SELECT cid, 1 FROM plink WHERE pid=:pid "
-    );
-  }else if( directOnly ){
-    db_prepare(&s, 
-        "SELECT cid, 1 FROM plink WHERE pid=:pid AND isprim "
-        "UNION ALL "
-        "SELECT pid, 0 FROM plink WHERE cid=:pid AND isprim"
-    );
-  }else{
-    db_prepare(&s, 
-        "SELECT cid, 1 FROM plink WHERE pid=:pid "
-        "UNION ALL "
-        "SELECT pid, 0 FROM plink WHERE cid=:pid"
-    );
-  }
+
+  /* When only moving from parent to child, check-ins whose generation
+  ** is not less than that of iTo cannot lead to iTo. */
+  genTo = oneWayOnly ? dag_generation(iTo) : 0;
   while( path.pCurrent ){
     path.nStep++;
     pPrev = path.pCurrent;
     path.pCurrent = 0;
     while( pPrev ){
-      db_bind_int(&s, ":pid", pPrev->rid);
-      while( db_step(&s)==SQLITE_ROW ){
-        int cid = db_column_int(&s, 0);
-        int isParent = db_column_int(&s, 1);
-        if( bag_find(&path.seen, cid) ) continue;
-        p = path_new_node(cid, pPrev, isParent);
-        if( cid==iTo ){
-          db_finalize(&s);
-          path.pEnd = p;
-          path_reverse_path();
-          return path.pStart;
+      const DagLink *aLink;
+      int n, i, isParent;
+
+      /* Children of pPrev first, then its parents */
+      for(isParent=1; isParent>=0; isParent--){
+        if( isParent ){
+          n = dag_children(pPrev->rid, &aLink);
+        }else if( !oneWayOnly ){
+          n = dag_parents(pPrev->rid, &aLink);
+        }else{
+          break;
+        }
+        for(i=0; i<n; i++){
+          int cid = aLink[i].rid;
+          if( directOnly && !aLink[i].isPrim ) continue;
+          if( bag_find(&path.seen, cid) ) continue;
+          if( genTo>0 && cid!=iTo && dag_generation(cid)>=genTo ) continue;
+          p = path_new_node(cid, pPrev, isParent);
+          if( cid==iTo ){
+            path.pEnd = p;
+            path_reverse_path();
+            return path.pStart;
+          }
         }
       }
-      db_reset(&s);
       pPrev = pPrev->u.pPeer;
     }
   }
-  db_finalize(&s);
   path_reset();
   return 0;
 }
@@ -242,12 +235,20 @@ void shortest_path_test_cmd(void){
 /*
 ** Find the closest common ancestor of two nodes.  "Closest" means the
 ** fewest number of arcs.
+**
+** Both sides are walked one generation at a time.  Once one side has
+** run out of ancestors, the other side stops walking back from any
+** check-in whose generation number is no greater than the smallest
+** generation number on the exhausted side, since every ancestor of such
+** a check-in is older than all the check-ins that could be matched.
 */
 int path_common_ancestor(int iMe, int iYou){
-  Stmt s;
   PathNode *pPrev;
   PathNode *p;
   Bag me, you;
+  int nSide[2];         /* Nodes of the you (0) and me (1) sides to walk */
+  int nNext[2];         /* Nodes of each side for the next generation */
+  int mnGen[2];         /* Smallest generation number seen on each side */
 
   if( iMe==iYou ) return iMe;
   if( iMe==0 || iYou==0 ) return 0;
@@ -255,19 +256,31 @@ int path_common_ancestor(int iMe, int iYou){
   path.pStart = path_new_node(iMe, 0, 0);
   path.pStart->isPrim = 1;
   path.pEnd = path_new_node(iYou, 0, 0);
-  db_prepare(&s, "SELECT pid FROM plink WHERE cid=:cid");
   bag_init(&me);
   bag_insert(&me, iMe);
   bag_init(&you);
   bag_insert(&you, iYou);
+  nSide[0] = nSide[1] = 1;
+  mnGen[0] = dag_generation(iYou);
+  mnGen[1] = dag_generation(iMe);
   while( path.pCurrent ){
     pPrev = path.pCurrent;
     path.pCurrent = 0;
+    nNext[0] = nNext[1] = 0;
     while( pPrev ){
-      db_bind_int(&s, ":cid", pPrev->rid);
-      while( db_step(&s)==SQLITE_ROW ){
-        int pid = db_column_int(&s, 0);
-        if( bag_find(pPrev->isPrim ? &you : &me, pid) ){
+      const DagLink *aParent;
+      int i, n;
+      int s = pPrev->isPrim;
+      int gen = dag_generation(pPrev->rid);
+      if( nSide[!s]==0 && gen>0 && gen<=mnGen[!s] ){
+        /* No ancestor of pPrev can be on the other side */
+        pPrev = pPrev->u.pPeer;
+        continue;
+      }
+      n = dag_parents(pPrev->rid, &aParent);
+      for(i=0; i<n; i++){
+        int pid = aParent[i].rid;
+        if( bag_find(s ? &you : &me, pid) ){
           /* pid is the common ancestor */
           PathNode *pNext;
           for(p=path.pAll; p && p->rid!=pid; p=p->pAll){}
@@ -282,21 +295,27 @@ int path_common_ancestor(int iMe, int iYou){
           if( pPrev==path.pStart ) path.pStart = path.pEnd;
           path.pEnd = pPrev;
           path_reverse_path();
-          db_finalize(&s);
+          bag_clear(&me);
+          bag_clear(&you);
           return pid;
         }else if( bag_find(&path.seen, pid) ){
           /* pid is just an alternative path on one of the legs */
           continue;
         }
         p = path_new_node(pid, pPrev, 0);
-        p->isPrim = pPrev->isPrim;
-        bag_insert(pPrev->isPrim ? &me : &you, pid);
+        p->isPrim = s;
+        bag_insert(s ? &me : &you, pid);
+        gen = dag_generation(pid);
+        if( gen<mnGen[s] ) mnGen[s] = gen;
+        nNext[s]++;
       }
-      db_reset(&s);
       pPrev = pPrev->u.pPeer;
     }
+    nSide[0] = nNext[0];
+    nSide[1] = nNext[1];
   }
-  db_finalize(&s);
+  bag_clear(&me);
+  bag_clear(&you);
   path_reset();
   return 0;
 }
@@ -349,6 +368,64 @@ struct NameChange {
   NameChange *pNext;   /* List of all name changes */
 };
 
+/*
+** The NAMECHNG table holds the MLINK entries that rename or remove a
+** file.  There are few of them, so find_filename_changes() reads the
+** check-ins that have one into a bag and skips the MLINK query for
+** every other check-in on the path.  The table is brought up to date
+** with MLINK by namechng_sync(), the same way as the FILEHIST table.
+** The entry with the largest id always records the last MLINK entry
+** examined, even if that entry changes no name, in which case its mid
+** is zero.
+*/
+static const char zNamechngSchema[] =
+@ CREATE TABLE IF NOT EXISTS %s.namechng(
+@   id INTEGER PRIMARY KEY,        -- ROWID of the MLINK entry
+@   mid INTEGER                    -- MLINK.MID, or 0 for no name change
+@ );
+;
+
+/*
+** Return true if the NAMECHNG table exists.
+*/
+static int namechng_exists(void){
+  return db_exists("SELECT 1 FROM %s.sqlite_master WHERE name='namechng'",
+                   db_name("repository"));
+}
+
+/*
+** Create the NAMECHNG table if it does not exist and add to it every
+** MLINK entry that it is missing.  Return true if the table is then
+** complete.  This might fail for a read-only repository, in which case
+** every check-in must be examined.
+*/
+static int namechng_sync(void){
+  int mxRowid = db_int(0, "SELECT max(rowid) FROM mlink");
+  int mxId;
+  if( !namechng_exists() ){
+    char *zSql = mprintf(zNamechngSchema, db_name("repository"));
+    db_multi_exec_ignore_error(zSql, 0);
+    fossil_free(zSql);
+    if( !namechng_exists() ) return 0;
+  }
+  mxId = db_int(0, "SELECT max(id) FROM namechng");
+  if( mxId<mxRowid ){
+    char *zSql = mprintf(
+      "INSERT INTO namechng(id,mid)"
+      " SELECT rowid, mid FROM mlink"
+      "  WHERE rowid>%d AND (pfnid>0 OR fid==0);"
+      "INSERT OR IGNORE INTO namechng(id,mid) VALUES(%d,0);",
+      mxId, mxRowid
+    );
+    db_begin_transaction();
+    db_multi_exec_ignore_error(zSql, 0);
+    db_end_transaction(0);
+    fossil_free(zSql);
+    mxId = db_int(0, "SELECT max(id) FROM namechng");
+  }
+  return mxId>=mxRowid;
+}
+
 /*
 ** Compute all file name changes that occur going from checkin iFrom
 ** to checkin iTo.
@@ -380,6 +457,8 @@ void find_filename_changes(
   int *aChng;              /* Two integers per name change */
   int i;                   /* Loop counter */
   Stmt q1;                 /* Query of name changes */
+  Bag chng;                /* Check-ins that change a name */
+  int useChng;             /* True if chng is complete */
 
   *pnChng = 0;
   *aiChng = 0;
@@ -388,6 +467,15 @@ void find_filename_changes(
   p = path_shortest(iFrom, iTo, 1, revOk==0);
   if( p==0 ) return;
   path_reverse_path();
+  bag_init(&chng);
+  useChng = namechng_sync();
+  if( useChng ){
+    db_prepare(&q1, "SELECT mid FROM namechng WHERE mid>0");
+    while( db_step(&q1)==SQLITE_ROW ){
+      bag_insert(&chng, db_column_int(&q1, 0));
+    }
+    db_finalize(&q1);
+  }
   db_prepare(&q1,
      "SELECT pfnid, fnid FROM mlink"
      " WHERE mid=:mid AND (pfnid>0 OR fid==0)"
@@ -399,6 +487,7 @@ void find_filename_changes(
       /* Skip nodes where the parent is not on the path */
       continue;
     }
+    if( useChng && !bag_find(&chng, p->rid) ) continue;
     db_bind_int(&q1, ":mid", p->rid);
     while( db_step(&q1)==SQLITE_ROW ){
       fnid = db_column_int(&q1, 1);
@@ -443,6 +532,7 @@ void find_filename_changes(
     db_reset(&q1);
   }
   db_finalize(&q1);
+  bag_clear(&chng);
   if( nChng ){
     aChng = *aiChng = fossil_malloc( nChng*2*sizeof(int) );
     for(pChng=pAll, i=0; pChng; pChng=pChng->pNext){
@@ -0,0 +1,427 @@
+/*
+** Copyright (c) 2012 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*******************************************************************************
+**
+** This file implements counters and timers that show where a command
+** or a web request spends its time: SQL statements prepared and
+** stepped, content and manifest cache hits and misses, deltas applied,
+** bytes uncompressed, TH1 scripts evaluated, and the time spent
+** generating the page.
+**
+** The counters are always on.  They are cheap enough to keep in every
+** build, and they are only reported when asked for: by the --perf
+** option on the command line, by the /stat/perf page, or in a
+** "Server-Timing" reply header when the "server-timing" setting is on.
+**
+** Counters are updated only by the main thread.  Tasks run by a
+** WorkPool must not call into this module.
+*/
+#include "config.h"
+#include "perf.h"
+#include <time.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <sys/time.h>
+#endif
+
+#if INTERFACE
+/*
+** The counters.  Each is an index into aPerf[].
+*/
+#define PERF_SQL_PREPARE     0   /* Statements prepared */
+#define PERF_SQL_STEP        1   /* Calls to db_step() */
+#define PERF_CACHE_HIT       2   /* content_get() found in the cache */
+#define PERF_CACHE_MISS      3   /* content_get() read from the database */
+#define PERF_DELTA_APPLY     4   /* Deltas applied by content_get() */
+#define PERF_UNCOMPRESS      5   /* Bytes of artifact content uncompressed */
+#define PERF_MANIFEST_HIT    6   /* manifest_get() found in the cache */
+#define PERF_MANIFEST_MISS   7   /* manifest_get() parsed the artifact */
+#define PERF_TH1_EVAL        8   /* TH1 scripts evaluated */
+#define PERF_PAGE            9   /* Web pages generated */
+#define PERF_N              10   /* Number of counters */
+#endif
+
+/*
+** The value of each counter.  For timed counters, iTime accumulates the
+** microseconds spent between perf_timer_start() and perf_timer_stop().
+** Time spent in a nested start/stop pair of the same counter (a TH1
+** script that renders another, or an SQL function that steps another
+** statement) is counted only once, by the outermost pair.
+*/
+static struct {
+  const char *zName;   /* Name used in reports */
+  int isTimed;         /* True if iTime is meaningful */
+  int nDepth;          /* Nesting depth of perf_timer_start() */
+  i64 n;               /* Number of events */
+  i64 iTime;           /* Total elapsed microseconds */
+} aPerf[PERF_N] = {
+  { "sql-prepare",          1, 0, 0, 0 },
+  { "sql-step",             1, 0, 0, 0 },
+  { "content-cache-hit",    0, 0, 0, 0 },
+  { "content-cache-miss",   0, 0, 0, 0 },
+  { "delta-apply",          0, 0, 0, 0 },
+  { "uncompress-bytes",     0, 0, 0, 0 },
+  { "manifest-cache-hit",   0, 0, 0, 0 },
+  { "manifest-cache-miss",  0, 0, 0, 0 },
+  { "th1-eval",             1, 0, 0, 0 },
+  { "page",                 1, 0, 0, 0 },
+};
+
+/*
+** Time at which perf_init() was called.
+*/
+static i64 perfStart = 0;
+
+/*
+** The time spent stepping each distinct SQL statement.  A statement is
+** looked up by its text once, when it is prepared, and the slot number
+** is kept in the Stmt object.  Only the first PERF_NSQL distinct
+** statements of a process are timed.
+*/
+#define PERF_NSQL   250
+#define PERF_NHASH  512            /* Must be more than PERF_NSQL */
+static struct {
+  int n;                           /* Number of entries in a[] */
+  int aHash[PERF_NHASH];           /* Open-addressed hash into a[] (index+1) */
+  struct PerfSql {
+    char *zSql;                    /* Text of the statement */
+    unsigned int h;                /* Hash of zSql */
+    int nStep;                     /* Number of calls to db_step() */
+    i64 iTime;                     /* Microseconds in db_step() */
+  } a[PERF_NSQL];
+} perfSql;
+
+/*
+** The longest delta chain expanded by content_get().
+*/
+static struct {
+  int n;                           /* Number of deltas applied */
+  int rid;                         /* The artifact that was expanded */
+} perfChain;
+
+/*
+** Settings of the slow-request log, from perf_slow_log_setup().
+*/
+static struct {
+  char *zFile;                     /* The log file.  NULL for no log */
+  int mxTime;                      /* Threshold in milliseconds */
+  int isDone;                      /* True once the current entry is written */
+} perfLog;
+
+/*
+** The slow-request log file is renamed and a new one started when it
+** grows larger than this many bytes.
+*/
+#define PERF_LOG_MAX 10000000
+
+/*
+** Return a wall-clock time in microseconds.  Only differences between
+** two values are meaningful.
+*/
+i64 perf_clock(void){
+#ifdef _WIN32
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER now;
+  if( freq.QuadPart==0 ) QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  return (i64)(now.QuadPart*1000000.0/freq.QuadPart);
+#else
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return (i64)tv.tv_sec*1000000 + tv.tv_usec;
+#endif
+}
+
+/*
+** Zero all counters and note the start time.  The total elapsed time
+** in reports is measured from here.  This is called when the process
+** starts and again when a request arrives, because "fossil server"
+** forks the process that handles a request from one that has been
+** running for a long time.
+*/
+void perf_init(void){
+  int i;
+  for(i=0; i<PERF_N; i++){
+    aPerf[i].n = 0;
+    aPerf[i].iTime = 0;
+  }
+  for(i=0; i<perfSql.n; i++){
+    perfSql.a[i].nStep = 0;
+    perfSql.a[i].iTime = 0;
+  }
+  perfChain.n = perfChain.rid = 0;
+  perfLog.isDone = 0;
+  perfStart = perf_clock();
+}
+
+/*
+** Add n to counter eCounter.
+*/
+void perf_count(int eCounter, i64 n){
+  aPerf[eCounter].n += n;
+}
+
+/*
+** Count one event of the timed counter eCounter and start timing it.
+** Pass the return value to perf_timer_stop() when the event is over.
+*/
+i64 perf_timer_start(int eCounter){
+  aPerf[eCounter].n++;
+  if( aPerf[eCounter].nDepth++ ) return 0;
+  return perf_clock();
+}
+
+/*
+** Finish timing an event started by perf_timer_start().  Return the
+** number of microseconds added to the counter, which is zero for a
+** nested event.
+*/
+i64 perf_timer_stop(int eCounter, i64 iStart){
+  i64 iTime = 0;
+  if( --aPerf[eCounter].nDepth==0 ){
+    iTime = perf_clock() - iStart;
+    aPerf[eCounter].iTime += iTime;
+  }
+  return iTime;
+}
+
+/*
+** Return the timing slot for the SQL statement zSql, to be passed to
+** perf_sql_step() each time the statement is stepped.  Return 0 if
+** there is no room for another statement.
+*/
+int perf_sql_slot(const char *zSql){
+  unsigned int h = 0;
+  int i;
+  for(i=0; zSql[i]; i++) h = (h<<3) ^ h ^ (unsigned char)zSql[i];
+  for(i=h%PERF_NHASH; perfSql.aHash[i]; i=(i+1)%PERF_NHASH){
+    struct PerfSql *p = &perfSql.a[perfSql.aHash[i]-1];
+    if( p->h==h && strcmp(p->zSql, zSql)==0 ) return perfSql.aHash[i];
+  }
+  if( perfSql.n>=PERF_NSQL ) return 0;
+  perfSql.a[perfSql.n].zSql = fossil_strdup(zSql);
+  perfSql.a[perfSql.n].h = h;
+  perfSql.aHash[i] = ++perfSql.n;
+  return perfSql.n;
+}
+
+/*
+** Add one step taking iTime microseconds to the statement in timing
+** slot iSlot.
+*/
+void perf_sql_step(int iSlot, i64 iTime){
+  if( iSlot ){
+    perfSql.a[iSlot-1].nStep++;
+    perfSql.a[iSlot-1].iTime += iTime;
+  }
+}
+
+/*
+** Note that content_get() applied a chain of n deltas to expand
+** artifact rid.
+*/
+void perf_delta_chain(int rid, int n){
+  if( n>perfChain.n ){
+    perfChain.n = n;
+    perfChain.rid = rid;
+  }
+}
+
+/*
+** Return the value of counter eCounter.
+*/
+i64 perf_value(int eCounter){
+  return aPerf[eCounter].n;
+}
+
+/*
+** Return the number of milliseconds since perf_init().
+*/
+double perf_elapsed(void){
+  return (perf_clock() - perfStart)/1000.0;
+}
+
+/*
+** Write a report of all counters on stderr.  This is what the --perf
+** option shows when a command finishes.
+*/
+void perf_print(void){
+  int i;
+  Blob out;
+  blob_zero(&out);
+  for(i=0; i<PERF_N; i++){
+    blob_appendf(&out, "-- %-20s %10lld", aPerf[i].zName, aPerf[i].n);
+    if( aPerf[i].isTimed ){
+      blob_appendf(&out, " %10.3f ms", aPerf[i].iTime/1000.0);
+    }
+    blob_append(&out, "\n", 1);
+  }
+  blob_appendf(&out, "-- %-20s %10d\n", "delta-chain-max", perfChain.n);
+  blob_appendf(&out, "-- %-20s %10s %10.3f ms\n", "total", "", perf_elapsed());
+  fprintf(stderr, "%s", blob_str(&out));
+  blob_reset(&out);
+}
+
+/*
+** Return the value of a "Server-Timing" reply header, without the
+** header name or the line ending, that summarizes the counters for
+** the current request.  The caller must free the result.
+*/
+char *perf_server_timing(void){
+  return mprintf(
+    "sql;dur=%.3f;desc=\"%lld prepare %lld step\", "
+    "th1;dur=%.3f;desc=\"%lld eval\", "
+    "cache;desc=\"content %lld/%lld manifest %lld/%lld delta %lld\", "
+    "page;dur=%.3f, total;dur=%.3f",
+    (aPerf[PERF_SQL_PREPARE].iTime + aPerf[PERF_SQL_STEP].iTime)/1000.0,
+    aPerf[PERF_SQL_PREPARE].n, aPerf[PERF_SQL_STEP].n,
+    aPerf[PERF_TH1_EVAL].iTime/1000.0, aPerf[PERF_TH1_EVAL].n,
+    aPerf[PERF_CACHE_HIT].n,
+    aPerf[PERF_CACHE_HIT].n + aPerf[PERF_CACHE_MISS].n,
+    aPerf[PERF_MANIFEST_HIT].n,
+    aPerf[PERF_MANIFEST_HIT].n + aPerf[PERF_MANIFEST_MISS].n,
+    aPerf[PERF_DELTA_APPLY].n,
+    aPerf[PERF_PAGE].iTime/1000.0, perf_elapsed()
+  );
+}
+
+/*
+** Generate the body of the /stat/perf page: the counters for the
+** request that is generating this page, up to this point.  Because
+** every request runs in a fresh process, this shows the cost of
+** starting up, opening the repository and checking the login.
+*/
+void perf_page(void){
+  int i;
+  style_header("Performance Counters");
+  @ <table class="label-value">
+  @ <tr><th>Counter</th><th>Count</th><th>Milliseconds</th></tr>
+  for(i=0; i<PERF_N; i++){
+    cgi_printf("<tr><td>%h</td><td align=\"right\">%lld</td>\n",
+               aPerf[i].zName, aPerf[i].n);
+    if( aPerf[i].isTimed ){
+      cgi_printf("<td align=\"right\">%.3f</td></tr>\n",
+                 aPerf[i].iTime/1000.0);
+    }else{
+      @ <td></td></tr>
+    }
+  }
+  cgi_printf("<tr><td>total</td><td></td><td align=\"right\">%.3f</td></tr>\n",
+             perf_elapsed());
+  @ </table>
+  @ <p>These are the counters of the request that generated this page.
+  @ Turn on the "server-timing" setting to have the same figures sent
+  @ with every page in a <tt>Server-Timing</tt> reply header, or use the
+  @ --perf option to see them for a command.</p>
+  style_footer();
+}
+
+/*
+** Read the settings of the slow-request log.  This is called when the
+** repository is opened, because the log is written after the
+** repository has been closed at the end of a command.
+*/
+void perf_slow_log_setup(void){
+  const char *zFile = db_get("slow-log", 0);
+  fossil_free(perfLog.zFile);
+  perfLog.zFile = zFile && zFile[0] ? mprintf("%s", zFile) : 0;
+  perfLog.mxTime = db_get_int("slow-log-threshold", 1000);
+}
+
+/*
+** If the current web request or command has taken at least as long as
+** the "slow-log-threshold" setting, append a report about it to the
+** "slow-log" file.  The report is written at most once per request.
+*/
+void perf_slow_log(void){
+  double rTime = perf_elapsed();
+  Blob out;
+  int aTop[5];                     /* Slowest statements, slowest first */
+  int nTop = 0;                    /* Number of entries in aTop[] */
+  int mxTop = sizeof(aTop)/sizeof(aTop[0]);
+  int i, j;
+  time_t now;
+  char zDate[50];
+  char *zUuid = 0;
+  FILE *f;
+
+  if( perfLog.zFile==0 || perfLog.isDone || rTime<perfLog.mxTime ) return;
+  perfLog.isDone = 1;
+  blob_zero(&out);
+  now = time(0);
+  strftime(zDate, sizeof(zDate), "%Y-%m-%d %H:%M:%S", gmtime(&now));
+  blob_appendf(&out, "%s %.3fms", zDate, rTime);
+  if( g.isHTTP ){
+    blob_appendf(&out, " %s %s", PD("REQUEST_METHOD","GET"),
+                 PD("REQUEST_URI", PD("PATH_INFO","")));
+  }else{
+    for(i=0; i<g.argc; i++) blob_appendf(&out, " %s", g.argv[i]);
+  }
+  blob_appendf(&out, " user=%s repository=%s\n",
+               g.zLogin ? g.zLogin : "nobody",
+               g.zRepositoryName ? g.zRepositoryName : "");
+
+  if( perfChain.rid && g.repositoryOpen ){
+    zUuid = db_text(0, "SELECT uuid FROM blob WHERE rid=%d", perfChain.rid);
+  }
+  blob_appendf(&out,
+     "  sql %.3fms in %lld steps and %lld prepares;"
+     " content_get %lld calls, %lld cache hits;"
+     " longest delta chain %d",
+     (aPerf[PERF_SQL_PREPARE].iTime + aPerf[PERF_SQL_STEP].iTime)/1000.0,
+     aPerf[PERF_SQL_STEP].n, aPerf[PERF_SQL_PREPARE].n,
+     aPerf[PERF_CACHE_HIT].n + aPerf[PERF_CACHE_MISS].n,
+     aPerf[PERF_CACHE_HIT].n, perfChain.n);
+  if( zUuid ) blob_appendf(&out, " for [%.10s]", zUuid);
+  blob_append(&out, "\n", 1);
+  fossil_free(zUuid);
+
+  /* The statements that took the most time, slowest first */
+  for(i=0; i<perfSql.n; i++){
+    if( perfSql.a[i].nStep==0 ) continue;
+    for(j=nTop; j>0 && perfSql.a[aTop[j-1]].iTime<perfSql.a[i].iTime; j--){
+      if( j<mxTop ) aTop[j] = aTop[j-1];
+    }
+    if( j<mxTop ){
+      aTop[j] = i;
+      if( nTop<mxTop ) nTop++;
+    }
+  }
+  for(i=0; i<nTop; i++){
+    struct PerfSql *p = &perfSql.a[aTop[i]];
+    blob_appendf(&out, "  %.3fms %d steps: ", p->iTime/1000.0, p->nStep);
+    for(j=0; p->zSql[j] && j<200; j++){
+      char c = p->zSql[j];
+      blob_append(&out, fossil_isspace(c) ? " " : &p->zSql[j], 1);
+    }
+    if( p->zSql[j] ) blob_append(&out, "...", 3);
+    blob_append(&out, "\n", 1);
+  }
+
+  if( file_size(perfLog.zFile)>PERF_LOG_MAX ){
+    char *zOld = mprintf("%s.1", perfLog.zFile);
+    file_delete(zOld);
+    rename(perfLog.zFile, zOld);
+    fossil_free(zOld);
+  }
+  f = fossil_fopen(perfLog.zFile, "ab");
+  if( f ){
+    fwrite(blob_buffer(&out), 1, blob_size(&out), f);
+    fclose(f);
+  }
+  blob_reset(&out);
+}
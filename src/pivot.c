@@ -71,13 +71,39 @@ void pivot_set_secondary(int rid){
   );
 }
 
+/*
+** A check-in queued by pivot_find()
+*/
+typedef struct PivotNode PivotNode;
+struct PivotNode {
+  int rid;         /* The record id for this version */
+  double mtime;    /* Time when this version was created */
+  int src;         /* 1 for primary.  0 for others */
+};
+
 /*
 ** Find the most recent common ancestor of the primary and one of
 ** the secondaries.  Return its rid.  Return 0 if no common ancestor
 ** can be found.
+**
+** The starting versions are taken from the aqueue table.  The search
+** itself walks the in-memory graph of check-ins.  The queue holds
+** versions that have not been checked yet.  The most recent of them,
+** by mtime and then by rid, is checked next.
+**
+** Once the queue holds no versions from one side, nothing more can be
+** reached from that side, and so the only versions that can still turn
+** out to be the pivot are those already queued from the other side.
+** The walk stops there instead of continuing back to the root.
 */
 int pivot_find(void){
-  Stmt q1, q2, u1, i1;
+  Stmt q;
+  Bag seen;             /* Versions that have ever been queued */
+  Bag primary;          /* Queued versions reached from the primary */
+  PivotNode *aQueue = 0;
+  int nQueue = 0;
+  int nAlloc = 0;
+  int nSrc[2];          /* Queued versions from the secondaries and primary */
   int rid = 0;
   
   /* aqueue must contain at least one primary and one other.  Otherwise
@@ -87,64 +113,101 @@ int pivot_find(void){
     fossil_panic("lack both primary and secondary files");
   }
 
-  /* Prepare queries we will be needing
-  **
-  ** The first query finds the oldest pending version on the aqueue.  This
-  ** will be next one searched.
-  */
-  db_prepare(&q1, "SELECT rid FROM aqueue WHERE pending"
-                  " ORDER BY pending DESC, mtime DESC");
+  bag_init(&seen);
+  bag_init(&primary);
+  nSrc[0] = nSrc[1] = 0;
+  db_prepare(&q, "SELECT rid, mtime, src FROM aqueue");
+  while( db_step(&q)==SQLITE_ROW ){
+    if( nQueue>=nAlloc ){
+      nAlloc = nAlloc*2 + 10;
+      aQueue = fossil_realloc(aQueue, sizeof(aQueue[0])*nAlloc);
+    }
+    aQueue[nQueue].rid = db_column_int(&q, 0);
+    aQueue[nQueue].mtime = db_column_double(&q, 1);
+    aQueue[nQueue].src = db_column_int(&q, 2)!=0;
+    bag_insert(&seen, aQueue[nQueue].rid);
+    if( aQueue[nQueue].src ) bag_insert(&primary, aQueue[nQueue].rid);
+    nSrc[aQueue[nQueue].src]++;
+    nQueue++;
+  }
+  db_finalize(&q);
 
-  /* Check to see if the record :rid is a common ancestor.  The result
-  ** set contains one or more rows if it is and is the empty set if it
-  ** is not.
-  */
-  db_prepare(&q2,
-    "SELECT 1 FROM aqueue A, plink, aqueue B"
-    " WHERE plink.pid=:rid"
-    "   AND plink.cid=B.rid"
-    "   AND A.rid=:rid"
-    "   AND A.src!=B.src"
-  );
+  while( nQueue>0 ){
+    const DagLink *aLink;
+    int i, n, iBest = 0, src;
 
-  /* Mark the :rid record has having been checked.  It is not the
-  ** common ancestor.
-  */
-  db_prepare(&u1,
-    "UPDATE aqueue SET pending=0 WHERE rid=:rid"
-  );
+    if( nSrc[0]==0 || nSrc[1]==0 ){
+      /* One side is exhausted.  The pivot, if any, is the most recent
+      ** queued version with a child reached from the exhausted side. */
+      rid = 0;
+      for(i=0; i<nQueue; i++){
+        int j;
+        if( rid
+         && (aQueue[i].mtime<aQueue[iBest].mtime
+             || (aQueue[i].mtime==aQueue[iBest].mtime
+                 && aQueue[i].rid<aQueue[iBest].rid))
+        ){
+          continue;
+        }
+        n = dag_children(aQueue[i].rid, &aLink);
+        for(j=0; j<n; j++){
+          int cid = aLink[j].rid;
+          if( bag_find(&seen, cid) && bag_find(&primary, cid)!=aQueue[i].src ){
+            break;
+          }
+        }
+        if( j<n ){
+          iBest = i;
+          rid = aQueue[i].rid;
+        }
+      }
+      break;
+    }
 
-  /* Add to the queue all ancestors of :rid.
-  */
-  db_prepare(&i1,
-    "INSERT OR IGNORE INTO aqueue "
-    "SELECT plink.pid,"
-    "       coalesce((SELECT mtime FROM plink X WHERE X.cid=plink.pid), 0.0),"
-    "       1,"
-    "       aqueue.src "
-    "  FROM plink, aqueue"
-    " WHERE plink.cid=:rid"
-    "   AND aqueue.rid=:rid"
-  );
+    /* Take the most recent pending version off the queue */
+    for(i=1; i<nQueue; i++){
+      if( aQueue[i].mtime>aQueue[iBest].mtime
+       || (aQueue[i].mtime==aQueue[iBest].mtime
+           && aQueue[i].rid>aQueue[iBest].rid)
+      ){
+        iBest = i;
+      }
+    }
+    rid = aQueue[iBest].rid;
+    src = aQueue[iBest].src;
+    aQueue[iBest] = aQueue[--nQueue];
+    nSrc[src]--;
+
+    /* rid is a common ancestor if one of its children was reached
+    ** from the other side. */
+    n = dag_children(rid, &aLink);
+    for(i=0; i<n; i++){
+      int cid = aLink[i].rid;
+      if( bag_find(&seen, cid) && bag_find(&primary, cid)!=src ) break;
+    }
+    if( i<n ) break;
 
-  while( db_step(&q1)==SQLITE_ROW ){
-    rid = db_column_int(&q1, 0);
-    db_reset(&q1);
-    db_bind_int(&q2, ":rid", rid);
-    if( db_step(&q2)==SQLITE_ROW ){
-       break;
+    /* Add to the queue all parents of rid not already seen. */
+    n = dag_parents(rid, &aLink);
+    for(i=0; i<n; i++){
+      int pid = aLink[i].rid;
+      if( !bag_insert(&seen, pid) ) continue;
+      if( src ) bag_insert(&primary, pid);
+      if( nQueue>=nAlloc ){
+        nAlloc = nAlloc*2 + 10;
+        aQueue = fossil_realloc(aQueue, sizeof(aQueue[0])*nAlloc);
+      }
+      aQueue[nQueue].rid = pid;
+      aQueue[nQueue].mtime = dag_mtime(pid);
+      aQueue[nQueue].src = src;
+      nSrc[src]++;
+      nQueue++;
     }
-    db_reset(&q2);
-    db_bind_int(&i1, ":rid", rid);
-    db_exec(&i1);
-    db_bind_int(&u1, ":rid", rid);
-    db_exec(&u1);
     rid = 0;
   }
-  db_finalize(&q1);
-  db_finalize(&q2);
-  db_finalize(&i1);
-  db_finalize(&u1);
+  fossil_free(aQueue);
+  bag_clear(&seen);
+  bag_clear(&primary);
   return rid;
 }
 
@@ -20,10 +20,9 @@
 ** value.  We can insert integers with each integer tied to its
 ** value then extract the integer with the smallest value.
 **
-** The way this queue is used, we never expect it to contain more
-** than 2 or 3 elements, so a simple array is sufficient as the
-** implementation.  This could give worst case O(N) insert times,
-** but because of the nature of the problem we expect O(1) performance.
+** The queue is a binary heap, so that insert and extract are O(log N)
+** even for walks over very long histories.  Elements with equal values
+** come out in the order they went in.
 */
 #include "config.h"
 #include "pqueue.h"
@@ -32,16 +31,18 @@
 
 #if INTERFACE
 /*
-** An integer can appear in the bag at most once.
+** An integer can appear in the queue at most once.
 ** Integers must be positive.
 */
 struct PQueue {
   int cnt;   /* Number of entries in the queue */
   int sz;    /* Number of slots in a[] */
+  unsigned int iSeq;  /* Number of insertions so far */
   struct QueueElement {
     int id;          /* ID of the element */
+    unsigned int iSeq;  /* Insertion order, to break ties in value */
     void *p;         /* Content pointer */
-    double value;    /* Value of element.  Kept in ascending order */
+    double value;    /* Value of element.  a[] is a heap on this */
   } *a;
 };
 #endif
@@ -69,26 +70,58 @@ static void pqueue_resize(PQueue *p, int N){
   p->sz = N;
 }
 
+/*
+** Return true if element X belongs closer to the front of the queue
+** than element Y.
+*/
+static int pqueue_before(struct QueueElement *pX, struct QueueElement *pY){
+  if( pX->value!=pY->value ) return pX->value<pY->value;
+  return pX->iSeq<pY->iSeq;
+}
+
+/*
+** Move element X, which is to be stored at index i of the heap, toward
+** the front of the queue until it is in order.
+*/
+static void pqueue_sift_up(PQueue *p, int i, struct QueueElement *pX){
+  while( i>0 && pqueue_before(pX, &p->a[(i-1)/2]) ){
+    p->a[i] = p->a[(i-1)/2];
+    i = (i-1)/2;
+  }
+  p->a[i] = *pX;
+}
+
+/*
+** Move element X, which is to be stored at index i of the heap, toward
+** the back of the queue until it is in order.
+*/
+static void pqueue_sift_down(PQueue *p, int i, struct QueueElement *pX){
+  for(;;){
+    int j = i*2+1;
+    if( j>=p->cnt ) break;
+    if( j+1<p->cnt && pqueue_before(&p->a[j+1], &p->a[j]) ) j++;
+    if( !pqueue_before(&p->a[j], pX) ) break;
+    p->a[i] = p->a[j];
+    i = j;
+  }
+  p->a[i] = *pX;
+}
+
 /*
 ** Insert element e into the queue.
 */
 void pqueue_insert(PQueue *p, int e, double v, void *pData){
-  int i, j;
+  struct QueueElement x;
+  assert( e>0 );
   if( p->cnt+1>p->sz ){
-    pqueue_resize(p, p->cnt+5);
-  }
-  for(i=0; i<p->cnt; i++){
-    if( p->a[i].value>v ){
-      for(j=p->cnt; j>i; j--){
-        p->a[j] = p->a[j-1];
-      }
-      break;
-    }
+    pqueue_resize(p, p->sz*2+5);
   }
-  p->a[i].id = e;
-  p->a[i].p = pData;
-  p->a[i].value = v;
+  x.id = e;
+  x.iSeq = p->iSeq++;
+  x.p = pData;
+  x.value = v;
   p->cnt++;
+  pqueue_sift_up(p, p->cnt-1, &x);
 }
 
 /*
@@ -97,16 +130,16 @@ void pqueue_insert(PQueue *p, int e, double v, void *pData){
 ** is empty.
 */
 int pqueue_extract(PQueue *p, void **pp){
-  int e, i;
+  int e;
   if( p->cnt==0 ){
     if( pp ) *pp = 0;
     return 0;
   }
   e = p->a[0].id;
   if( pp ) *pp = p->a[0].p;
-  for(i=0; i<p->cnt-1; i++){
-    p->a[i] = p->a[i+1];
-  }
   p->cnt--;
+  if( p->cnt>0 ){
+    pqueue_sift_down(p, 0, &p->a[p->cnt]);
+  }
   return e;
 }
@@ -242,6 +242,46 @@ int vxprintf(
       count++;
       break;
     }
+    /* Fast paths for the most frequent conversions, when they have no
+    ** flags, width, or precision.  These give the same output as the
+    ** general code below. */
+    switch( c ){
+      case 's':
+      case 'z': {
+        bufpt = va_arg(ap,char*);
+        if( bufpt ){
+          length = (int)strlen(bufpt);
+          blob_append(pBlob,bufpt,length);
+          count += length;
+          if( c=='z' ) free(bufpt);
+        }
+        continue;
+      }
+      case 'h': {
+        bufpt = va_arg(ap,char*);
+        if( bufpt ) count += htmlize_to_blob(pBlob,bufpt,-1);
+        continue;
+      }
+      case 't': {
+        bufpt = va_arg(ap,char*);
+        if( bufpt ) count += httpize_to_blob(pBlob,bufpt,-1,1);
+        continue;
+      }
+      case 'd': {
+        int v = va_arg(ap,int);
+        u64 uv = v<0 ? -(i64)v : v;
+        bufpt = &buf[etBUFSIZE];
+        do{
+          *(--bufpt) = '0' + (char)(uv%10);
+          uv /= 10;
+        }while( uv );
+        if( v<0 ) *(--bufpt) = '-';
+        length = (int)(&buf[etBUFSIZE]-bufpt);
+        blob_append(pBlob,bufpt,length);
+        count += length;
+        continue;
+      }
+    }
     /* Find out what flags are present */
     flag_leftjustify = flag_plussign = flag_blanksign = 
      flag_alternateform = flag_altform2 = flag_zeropad = 0;
@@ -656,6 +696,12 @@ int vxprintf(
         int limit = flag_alternateform ? va_arg(ap,int) : -1;
         char *zMem = va_arg(ap,char*);
         if( zMem==0 ) zMem = "";
+        if( width==0 && precision<0 ){
+          /* No padding or truncation, so encode straight into pBlob */
+          count += htmlize_to_blob(pBlob, zMem, limit);
+          length = 0;
+          break;
+        }
         zExtra = bufpt = htmlize(zMem, limit);
         length = strlen(bufpt);
         if( precision>=0 && precision<length ) length = precision;
@@ -665,6 +711,12 @@ int vxprintf(
         int limit = flag_alternateform ? va_arg(ap,int) : -1;
         char *zMem = va_arg(ap,char*);
         if( zMem==0 ) zMem = "";
+        if( width==0 && precision<0 ){
+          /* No padding or truncation, so encode straight into pBlob */
+          count += httpize_to_blob(pBlob, zMem, limit, 1);
+          length = 0;
+          break;
+        }
         zExtra = bufpt = httpize(zMem, limit);
         length = strlen(bufpt);
         if( precision>=0 && precision<length ) length = precision;
@@ -674,6 +726,12 @@ int vxprintf(
         int limit = flag_alternateform ? va_arg(ap,int) : -1;
         char *zMem = va_arg(ap,char*);
         if( zMem==0 ) zMem = "";
+        if( width==0 && precision<0 ){
+          /* No padding or truncation, so encode straight into pBlob */
+          count += httpize_to_blob(pBlob, zMem, limit, 0);
+          length = 0;
+          break;
+        }
         zExtra = bufpt = urlize(zMem, limit);
         length = strlen(bufpt);
         if( precision>=0 && precision<length ) length = precision;
@@ -169,6 +169,7 @@ static Bag bagDone;         /* Bag of records rebuilt */
 
 static char *zFNameFormat;  /* Format string for filenames on deconstruct */
 static int prefixLength;    /* Length of directory prefix for deconstruct */
+static int nRebuildThread;  /* Worker threads.  0 means one per CPU */
 
 
 /*
@@ -199,6 +200,42 @@ static void rebuild_step_done(rid){
   }
 }
 
+/*
+** Fix up the "blob.size" field of artifact rid if needed, then
+** crosslink the artifact.  Or, if zFNameFormat is set, write the
+** content out for "fossil deconstruct" instead, unless isWritten is
+** true to show that this has already been done.  The content buffer
+** is cleared before returning.
+*/
+static void rebuild_artifact(
+  int rid,              /* The artifact */
+  int size,             /* Value of blob.size for rid */
+  Blob *pContent,       /* Full text of rid */
+  int isWritten         /* True if deconstruct has already written rid */
+){
+  if( size!=blob_size(pContent) ){
+    db_multi_exec(
+       "UPDATE blob SET size=%d WHERE rid=%d", blob_size(pContent), rid
+    );
+  }
+  if( zFNameFormat==0 ){
+    /* We are doing "fossil rebuild" */
+    manifest_crosslink(rid, pContent);
+  }else if( isWritten ){
+    blob_reset(pContent);
+  }else{
+    /* We are doing "fossil deconstruct" */
+    char *zUuid = db_text(0, "SELECT uuid FROM blob WHERE rid=%d", rid);
+    char *zFile = mprintf(zFNameFormat, zUuid, zUuid+prefixLength);
+    blob_write_to_file(pContent,zFile);
+    free(zFile);
+    free(zUuid);
+    blob_reset(pContent);
+  }
+  assert( blob_is_reset(pContent) );
+  rebuild_step_done(rid);
+}
+
 /*
 ** Rebuild cross-referencing information for the artifact
 ** rid with content pBase and all of its descendants.  This
@@ -224,13 +261,6 @@ static void rebuild_step(int rid, int size, Blob *pBase){
 
   while( rid>0 ){
 
-    /* Fix up the "blob.size" field if needed. */
-    if( size!=blob_size(pBase) ){
-      db_multi_exec(
-         "UPDATE blob SET size=%d WHERE rid=%d", blob_size(pBase), rid
-      );
-    }
-  
     /* Find all children of artifact rid */
     db_static_prepare(&q1, "SELECT rid FROM delta WHERE srcid=:rid");
     db_bind_int(&q1, ":rid", rid);
@@ -251,20 +281,7 @@ static void rebuild_step(int rid, int size, Blob *pBase){
       blob_copy(&copy, pBase);
       pUse = &copy;
     }
-    if( zFNameFormat==0 ){
-      /* We are doing "fossil rebuild" */
-      manifest_crosslink(rid, pUse);
-    }else{
-      /* We are doing "fossil deconstruct" */
-      char *zUuid = db_text(0, "SELECT uuid FROM blob WHERE rid=%d", rid);
-      char *zFile = mprintf(zFNameFormat, zUuid, zUuid+prefixLength);
-      blob_write_to_file(pUse,zFile);
-      free(zFile);
-      free(zUuid);
-      blob_reset(pUse);
-    }
-    assert( blob_is_reset(pUse) );
-    rebuild_step_done(rid);
+    rebuild_artifact(rid, size, pUse, 0);
   
     /* Call all children recursively */
     rid = 0;
@@ -298,6 +315,289 @@ static void rebuild_step(int rid, int size, Blob *pBase){
   }
 }
 
+/*
+** One artifact of a RebuildTree.
+*/
+typedef struct RebuildNode RebuildNode;
+struct RebuildNode {
+  int rid;              /* The artifact */
+  int size;             /* Value of blob.size for rid */
+  int iBase;            /* Index of the delta source in aNode[].  See below */
+  Blob content;         /* Compressed on input.  Full text on output */
+  char *zFile;          /* File to write for deconstruct, or NULL */
+};
+
+/*
+** Values of RebuildNode.iBase other than an index into aNode[]
+*/
+#define REBUILD_ROOT     (-1)  /* Content is full text */
+#define REBUILD_NOBASE   (-2)  /* Delta source was discarded by rebuild_step */
+
+/*
+** An artifact stored as full text together with all of the artifacts
+** that are deltas off of it, directly or indirectly.  Nodes are listed
+** in the order in which rebuild_step() would crosslink them, and the
+** delta source of each node comes before the node itself.
+*/
+typedef struct RebuildTree RebuildTree;
+struct RebuildTree {
+  int nNode;            /* Number of entries in aNode[] */
+  int nAlloc;           /* Slots allocated for aNode[] */
+  RebuildNode *aNode;   /* The artifacts of the tree */
+  i64 szTree;           /* Total size of all artifacts once expanded */
+  int isTooBig;         /* True if szTree exceeded the limit */
+  int iWriteErr;        /* 1 + index of a node whose file was not written */
+};
+
+/*
+** Append a node to tree p and return its index.  The content of the
+** node is loaded from column 0 of pQuery.  For deconstruct, the name of
+** the file to write is made from the artifact ID in column 2, and the
+** directory that holds the file is created if necessary.
+*/
+static int rebuild_tree_add(
+  RebuildTree *p,
+  int rid,
+  int size,
+  int iBase,
+  Stmt *pQuery
+){
+  RebuildNode *pNode;
+  if( p->nNode>=p->nAlloc ){
+    p->nAlloc = p->nAlloc*2 + 10;
+    p->aNode = fossil_realloc(p->aNode, p->nAlloc*sizeof(p->aNode[0]));
+  }
+  pNode = &p->aNode[p->nNode];
+  pNode->rid = rid;
+  pNode->size = size;
+  pNode->iBase = iBase;
+  blob_zero(&pNode->content);
+  db_column_blob(pQuery, 0, &pNode->content);
+  pNode->zFile = 0;
+  if( zFNameFormat ){
+    const char *zUuid = db_column_text(pQuery, 2);
+    char *z;
+    pNode->zFile = mprintf(zFNameFormat, zUuid, zUuid+prefixLength);
+    z = strrchr(pNode->zFile, '/');
+    if( prefixLength && z ){
+      *z = 0;
+      if( file_mkdir(pNode->zFile, 1) ){
+        fossil_fatal("unable to create directory %s", pNode->zFile);
+      }
+      *z = '/';
+    }
+  }
+  p->szTree += size;
+  return p->nNode++;
+}
+
+/*
+** Add to tree p all artifacts that are deltas off of node iNode, in
+** the same order as rebuild_step() would visit them.  Every artifact
+** added is also entered in bagDone.  Stop early and set p->isTooBig if
+** the tree grows larger than mxSize bytes.
+*/
+static void rebuild_tree_plan(RebuildTree *p, int iNode, i64 mxSize){
+  static Stmt q1;
+  Bag children;
+  int nChild, i, cid, iBase;
+
+  while( iNode>=0 ){
+    bag_insert(&bagDone, p->aNode[iNode].rid);
+    if( p->szTree>mxSize ){
+      p->isTooBig = 1;
+      return;
+    }
+
+    /* Find all children of the artifact */
+    db_static_prepare(&q1, "SELECT rid FROM delta WHERE srcid=:rid");
+    db_bind_int(&q1, ":rid", p->aNode[iNode].rid);
+    bag_init(&children);
+    while( db_step(&q1)==SQLITE_ROW ){
+      int cid = db_column_int(&q1, 0);
+      if( !bag_find(&bagDone, cid) ){
+        bag_insert(&children, cid);
+      }
+    }
+    nChild = bag_count(&children);
+    db_reset(&q1);
+
+    /* Add all children recursively */
+    iBase = iNode;
+    iNode = -1;
+    for(cid=bag_first(&children), i=1; cid; cid=bag_next(&children, cid), i++){
+      static Stmt q2;
+      int sz;
+      db_static_prepare(&q2,
+          "SELECT content, size, uuid FROM blob WHERE rid=:rid");
+      db_bind_int(&q2, ":rid", cid);
+      if( db_step(&q2)==SQLITE_ROW && (sz = db_column_int(&q2,1))>=0 ){
+        int iChild = rebuild_tree_add(p, cid, sz, iBase, &q2);
+        db_reset(&q2);
+        if( i<nChild ){
+          rebuild_tree_plan(p, iChild, mxSize);
+          if( p->isTooBig ) break;
+        }else{
+          iNode = iChild;
+        }
+      }else{
+        /* rebuild_step() discards the content of the parent here */
+        db_reset(&q2);
+        iBase = REBUILD_NOBASE;
+      }
+    }
+    bag_clear(&children);
+  }
+}
+
+/*
+** Free all memory held by tree p.
+*/
+static void rebuild_tree_reset(RebuildTree *p){
+  int i;
+  for(i=0; i<p->nNode; i++){
+    blob_reset(&p->aNode[i].content);
+    free(p->aNode[i].zFile);
+  }
+  free(p->aNode);
+  memset(p, 0, sizeof(*p));
+}
+
+/*
+** Worker-thread half of rebuild_step_many().  Uncompress the content
+** of every node of a RebuildTree and apply the deltas.  For deconstruct,
+** also write each artifact to its file.  This routine must not use the
+** database.
+*/
+static void rebuild_tree_task(void *pArg){
+  RebuildTree *p = (RebuildTree*)pArg;
+  int i;
+  for(i=0; i<p->nNode; i++){
+    RebuildNode *pNode = &p->aNode[i];
+    blob_uncompress(&pNode->content, &pNode->content);
+    if( pNode->iBase!=REBUILD_ROOT ){
+      Blob empty, next;
+      blob_zero(&empty);
+      blob_delta_apply(pNode->iBase>=0 ? &p->aNode[pNode->iBase].content
+                                       : &empty, &pNode->content, &next);
+      blob_reset(&pNode->content);
+      pNode->content = next;
+    }
+    if( pNode->zFile && p->iWriteErr==0 ){
+      FILE *out = fossil_fopen(pNode->zFile, "wb");
+      int n = blob_size(&pNode->content);
+      if( out==0 ){
+        p->iWriteErr = i+1;
+      }else{
+        if( fwrite(blob_buffer(&pNode->content), 1, n, out)!=n ){
+          p->iWriteErr = i+1;
+        }
+        fclose(out);
+      }
+    }
+  }
+}
+
+/*
+** Run rebuild_step() on each artifact returned by query pRoots, which
+** must return the rid and size of artifacts that are stored as full
+** text.  The results are the same, but uncompressing content and
+** applying deltas is spread across the threads of pPool, as is writing
+** out the files for deconstruct.  Crosslinking is still done by the
+** calling thread, one artifact at a time and in the same order as
+** rebuild_step(), since manifest_parse() and manifest_crosslink() use
+** the database.
+**
+** Trees of artifacts are handled in batches so that memory usage stays
+** bounded.  A tree that is too big for a batch on its own is handed to
+** rebuild_step() instead.
+*/
+static void rebuild_step_many(Stmt *pRoots, WorkPool *pPool){
+  const i64 mxBatchSize = 50000000;  /* Expanded bytes per batch */
+  const int mxBatch = 500;           /* Trees per batch */
+  RebuildTree *aTree;
+  int isEof = 0;
+
+  if( workpool_nthread(pPool)==0 ){
+    while( db_step(pRoots)==SQLITE_ROW ){
+      int rid = db_column_int(pRoots, 0);
+      int size = db_column_int(pRoots, 1);
+      if( size>=0 ){
+        Blob content;
+        content_get(rid, &content);
+        rebuild_step(rid, size, &content);
+      }
+    }
+    return;
+  }
+  aTree = fossil_malloc(mxBatch*sizeof(aTree[0]));
+  while( !isEof ){
+    int nTree = 0;
+    i64 szBatch = 0;
+    int bigRid = 0, bigSize = 0;
+    int i, j;
+
+    /* Load the content of a batch of trees and start expanding them */
+    while( nTree<mxBatch && szBatch<mxBatchSize ){
+      static Stmt q;
+      RebuildTree *p = &aTree[nTree];
+      int rid, size;
+      if( db_step(pRoots)!=SQLITE_ROW ){
+        isEof = 1;
+        break;
+      }
+      rid = db_column_int(pRoots, 0);
+      size = db_column_int(pRoots, 1);
+      if( size<0 ) continue;
+      memset(p, 0, sizeof(*p));
+      db_static_prepare(&q,
+          "SELECT content, size, uuid FROM blob WHERE rid=:rid");
+      db_bind_int(&q, ":rid", rid);
+      if( db_step(&q)==SQLITE_ROW ){
+        rebuild_tree_add(p, rid, size, REBUILD_ROOT, &q);
+      }
+      db_reset(&q);
+      if( p->nNode==0 ) continue;
+      if( blob_size(&p->aNode[0].content)==0 && size>0 ){
+        p->isTooBig = 1;  /* Chunked.  Expanded by content_get() below */
+      }else{
+        rebuild_tree_plan(p, 0, mxBatchSize);
+      }
+      if( p->isTooBig ){
+        for(i=0; i<p->nNode; i++) bag_remove(&bagDone, p->aNode[i].rid);
+        rebuild_tree_reset(p);
+        bigRid = rid;
+        bigSize = size;
+        break;
+      }
+      workpool_add(pPool, rebuild_tree_task, p);
+      szBatch += p->szTree;
+      nTree++;
+    }
+    workpool_wait(pPool);
+
+    /* Crosslink the results */
+    for(i=0; i<nTree; i++){
+      RebuildTree *p = &aTree[i];
+      if( p->iWriteErr ){
+        fossil_fatal("unable to write file \"%s\"",
+                     p->aNode[p->iWriteErr-1].zFile);
+      }
+      for(j=0; j<p->nNode; j++){
+        RebuildNode *pNode = &p->aNode[j];
+        rebuild_artifact(pNode->rid, pNode->size, &pNode->content, 1);
+      }
+      rebuild_tree_reset(p);
+    }
+    if( bigRid ){
+      Blob content;
+      content_get(bigRid, &content);
+      rebuild_step(bigRid, bigSize, &content);
+    }
+  }
+  free(aTree);
+}
+
 /*
 ** Check to see if the "sym-trunk" tag exists.  If not, create it
 ** and attach it to the very first check-in.
@@ -336,8 +636,10 @@ int rebuild_db(int randomize, int doOut, int doClustering){
   int errCnt = 0;
   char *zTable;
   int incrSize;
+  WorkPool *pPool;
 
   bag_init(&bagDone);
+  manifest_cache_clear();
   ttyOutput = doOut;
   processCnt = 0;
   if (ttyOutput && !g.fQuiet) {
@@ -350,13 +652,14 @@ int rebuild_db(int randomize, int doOut, int doClustering){
        " WHERE type='table'"
        " AND name NOT IN ('blob','delta','rcvfrom','user',"
                          "'config','shun','private','reportfmt',"
-                         "'concealed','accesslog')"
+                         "'concealed','accesslog','chunk','chunkmap')"
        " AND name NOT GLOB 'sqlite_*'"
     );
     if( zTable==0 ) break;
     db_multi_exec("DROP TABLE %Q", zTable);
     free(zTable);
   }
+  search_index_drop();
   db_multi_exec(zRepositorySchema2);
   ticket_create_table(0);
   shun_artifacts();
@@ -385,15 +688,9 @@ int rebuild_db(int randomize, int doOut, int doClustering){
      "   AND NOT EXISTS(SELECT 1 FROM delta WHERE rid=blob.rid)"
   );
   manifest_crosslink_begin();
-  while( db_step(&s)==SQLITE_ROW ){
-    int rid = db_column_int(&s, 0);
-    int size = db_column_int(&s, 1);
-    if( size>=0 ){
-      Blob content;
-      content_get(rid, &content);
-      rebuild_step(rid, size, &content);
-    }
-  }
+  pPool = workpool_new(nRebuildThread>0 ? nRebuildThread : workpool_size(0));
+  rebuild_step_many(&s, pPool);
+  workpool_delete(pPool);
   db_finalize(&s);
   db_prepare(&s,
      "SELECT rid, size FROM blob"
@@ -414,6 +711,7 @@ int rebuild_db(int randomize, int doOut, int doClustering){
     }
   }
   db_finalize(&s);
+  archive_cache_forget_pending();
   manifest_crosslink_end();
   rebuild_tag_trunk();
   if( ttyOutput && !g.fQuiet && totalSize>0 ){
@@ -432,14 +730,122 @@ int rebuild_db(int randomize, int doOut, int doClustering){
   return errCnt;
 }
 
+#if INTERFACE
+/*
+** Groups of derived tables that rebuild_tables() is able to recompute
+** without a full rebuild.  Each group is fed by a single class of
+** artifacts, so only artifacts of that class need to be replayed.
+*/
+#define REBUILD_TICKET      0x0001   /* "ticket", from ticket changes */
+#define REBUILD_ATTACHMENT  0x0002   /* "attachment", from attachments */
+#define REBUILD_LEAF        0x0004   /* "leaf" and "branch_summary" */
+#endif
+
+/*
+** Derived tables and the group of rebuild_tables() that recomputes
+** each one.  Tables with a group of zero are fed by check-ins or by
+** tags, which can come from any kind of artifact, and so they need a
+** full rebuild.
+*/
+static const struct {
+  const char *zTable;      /* Name of a derived table */
+  int mGroup;              /* REBUILD_* group.  0 for a full rebuild */
+} aRebuildTable[] = {
+  { "attachment",   REBUILD_ATTACHMENT },
+  { "backlink",     0                  },
+  { "branch_summary", REBUILD_LEAF     },
+  { "event",        0                  },
+  { "filename",     0                  },
+  { "leaf",         REBUILD_LEAF       },
+  { "mlink",        0                  },
+  { "orphan",       0                  },
+  { "phantom",      0                  },
+  { "plink",        0                  },
+  { "tag",          0                  },
+  { "tagxref",      0                  },
+  { "ticket",       REBUILD_TICKET     },
+  { "unclustered",  0                  },
+};
+
+/*
+** zList is a comma-separated list of derived table names.  Return the
+** set of REBUILD_* groups needed to recompute those tables, or zero
+** if a full rebuild is needed.  Unknown table names are a fatal error.
+*/
+int rebuild_tables_mask(const char *zList){
+  int mask = 0;
+  int needFull = 0;
+  while( zList[0] ){
+    int n, i;
+    while( zList[0]==',' || fossil_isspace(zList[0]) ) zList++;
+    for(n=0; zList[n] && zList[n]!=',' && !fossil_isspace(zList[n]); n++){}
+    if( n==0 ) break;
+    for(i=0; i<sizeof(aRebuildTable)/sizeof(aRebuildTable[0]); i++){
+      if( strlen(aRebuildTable[i].zTable)==n
+       && fossil_strnicmp(aRebuildTable[i].zTable, zList, n)==0 ) break;
+    }
+    if( i>=sizeof(aRebuildTable)/sizeof(aRebuildTable[0]) ){
+      fossil_fatal("not a derived table: %.*s", n, zList);
+    }
+    if( aRebuildTable[i].mGroup==0 ){
+      needFull = 1;
+    }else{
+      mask |= aRebuildTable[i].mGroup;
+    }
+    zList += n;
+  }
+  return needFull ? 0 : mask;
+}
+
+/*
+** Recompute the derived tables in the groups of mask (a set of
+** REBUILD_* values) by replaying only the artifacts that feed them.
+** All other derived tables are left alone.  The caller must already
+** hold a transaction.  Return the number of errors.
+*/
+int rebuild_tables(int mask){
+  if( mask & REBUILD_TICKET ){
+    ticket_create_table(0);
+    ticket_rebuild_all();
+  }
+  if( mask & REBUILD_ATTACHMENT ){
+    Stmt q;
+    db_multi_exec("DELETE FROM attachment");
+    manifest_crosslink_begin();
+    /* Every attachment makes an event of type 'w' or 't' */
+    db_prepare(&q,
+       "SELECT objid FROM event WHERE type IN ('w','t') ORDER BY objid"
+    );
+    while( db_step(&q)==SQLITE_ROW ){
+      int rid = db_column_int(&q, 0);
+      Manifest *p = manifest_get(rid, CFTYPE_ATTACHMENT);
+      if( p ){
+        Blob content;
+        manifest_destroy(p);
+        content_get(rid, &content);
+        manifest_crosslink(rid, &content);
+      }
+    }
+    db_finalize(&q);
+    manifest_crosslink_end();
+  }
+  if( mask & REBUILD_LEAF ){
+    leaf_rebuild();
+  }
+  return 0;
+}
+
 /*
 ** Attempt to convert more full-text blobs into delta-blobs for
-** storage efficiency.
+** storage efficiency.  The deltas are computed using nThread threads.
 */
-static void extra_deltification(void){
+static void extra_deltification(int nThread){
   Stmt q;
   int topid, previd, rid;
   int prevfnid, fnid;
+  int nReq = 0, nAlloc = 0;
+  DeltifyReq *aReq = 0;
+  WorkPool *pPool;
   db_begin_transaction();
   db_prepare(&q,
      "SELECT rid FROM event, blob"
@@ -454,9 +860,14 @@ static void extra_deltification(void){
     if( topid==0 ){
       topid = previd = rid;
     }else{
-      if( content_deltify(rid, previd, 0)==0 && previd!=topid ){
-        content_deltify(rid, topid, 0);
+      if( nReq>=nAlloc ){
+        nAlloc = nAlloc*2 + 100;
+        aReq = fossil_realloc(aReq, nAlloc*sizeof(aReq[0]));
       }
+      aReq[nReq].rid = rid;
+      aReq[nReq].aSrc[0] = previd;
+      aReq[nReq].aSrc[1] = previd!=topid ? topid : 0;
+      nReq++;
       previd = rid;
     }
   }
@@ -478,14 +889,24 @@ static void extra_deltification(void){
       prevfnid = fnid;
       topid = previd = rid;
     }else{
-      if( content_deltify(rid, previd, 0)==0 && previd!=topid ){
-        content_deltify(rid, topid, 0);
+      if( nReq>=nAlloc ){
+        nAlloc = nAlloc*2 + 100;
+        aReq = fossil_realloc(aReq, nAlloc*sizeof(aReq[0]));
       }
+      aReq[nReq].rid = rid;
+      aReq[nReq].aSrc[0] = previd;
+      aReq[nReq].aSrc[1] = previd!=topid ? topid : 0;
+      nReq++;
       previd = rid;
     }
   }
   db_finalize(&q);
 
+  pPool = workpool_new(nThread);
+  content_deltify_many(nReq, aReq, pPool);
+  workpool_delete(pPool);
+  free(aReq);
+
   db_end_transaction(0);
 }
 
@@ -522,12 +943,23 @@ static void reconstruct_private_table(void){
 **   --cluster     Compute clusters for unclustered artifacts
 **   --compress    Strive to make the database as small as possible
 **   --force       Force the rebuild to complete even if errors are seen
+**   --incremental Only recompute the tables named by --tables.  Cannot
+**                 be used with --cluster or --randomize.
 **   --noverify    Skip the verification of changes to the BLOB table
 **   --pagesize N  Set the database pagesize to N. (512..65536 and power of 2)
 **   --randomize   Scan artifacts in a random order
 **   --vacuum      Run VACUUM on the database after rebuilding
 **   --wal         Set Write-Ahead-Log journalling mode on the database
 **   --stats       Show artifact statistics after rebuilding
+**   --tables LIST Comma-separated list of derived tables to recompute
+**                 with --incremental.  The "ticket", "attachment",
+**                 "leaf", and "branch_summary" tables are recomputed
+**                 by replaying only the artifacts that feed them.  Any
+**                 other table needs a full rebuild, which is done
+**                 instead.
+**   --threads N   Use N threads to expand artifacts and to compute
+**                 deltas for --compress.  The default is one thread
+**                 per CPU.
 **
 ** See also: deconstruct, reconstruct
 */
@@ -543,6 +975,11 @@ void rebuild_database(void){
   int runVacuum;
   int runCompress;
   int showStats;
+  int mxChain;
+  int nThread;
+  int incrFlag;
+  const char *zTables;
+  int mTables = 0;
 
   omitVerify = find_option("noverify",0,0)!=0;
   forceFlag = find_option("force","f",0)!=0;
@@ -552,6 +989,21 @@ void rebuild_database(void){
   runCompress = find_option("compress",0,0)!=0;
   zPagesize = find_option("pagesize",0,1);
   showStats = find_option("stats",0,0)!=0;
+  nThread = workpool_size(find_option("threads",0,1));
+  nRebuildThread = nThread;
+  incrFlag = find_option("incremental",0,0)!=0;
+  zTables = find_option("tables",0,1);
+  if( incrFlag!=(zTables!=0)
+   || (incrFlag && (randomizeFlag || doClustering))
+  ){
+    usage("--incremental --tables LIST ?OPTIONS? ?REPOSITORY-FILENAME?");
+  }
+  if( incrFlag ){
+    mTables = rebuild_tables_mask(zTables);
+    if( mTables==0 ){
+      fossil_print("A full rebuild is needed for tables: %s\n", zTables);
+    }
+  }
   if( zPagesize ){
     newPagesize = atoi(zPagesize);
     if( newPagesize<512 || newPagesize>65536
@@ -573,13 +1025,20 @@ void rebuild_database(void){
   }
   db_begin_transaction();
   ttyOutput = 1;
-  errCnt = rebuild_db(randomizeFlag, 1, doClustering);
-  reconstruct_private_table();
-  db_multi_exec(
-    "REPLACE INTO config(name,value,mtime) VALUES('content-schema','%s',now());"
-    "REPLACE INTO config(name,value,mtime) VALUES('aux-schema','%s',now());",
-    CONTENT_SCHEMA, AUX_SCHEMA
-  );
+  if( mTables ){
+    rebuild_update_schema();
+    errCnt = rebuild_tables(mTables);
+  }else{
+    errCnt = rebuild_db(randomizeFlag, 1, doClustering);
+    reconstruct_private_table();
+    db_multi_exec(
+      "REPLACE INTO config(name,value,mtime)"
+      " VALUES('content-schema','%s',now());"
+      "REPLACE INTO config(name,value,mtime)"
+      " VALUES('aux-schema','%s',now());",
+      CONTENT_SCHEMA, chunk_aux_schema()
+    );
+  }
   if( errCnt && !forceFlag ){
     fossil_print(
       "%d errors. Rolling back changes. Use --force to force a commit.\n",
@@ -589,12 +1048,20 @@ void rebuild_database(void){
   }else{
     if( runCompress ){
       fossil_print("Extra delta compression... "); fflush(stdout);
-      extra_deltification();
+      extra_deltification(nThread);
       runVacuum = 1;
     }
     if( omitVerify ) verify_cancel();
     db_end_transaction(0);
     if( runCompress ) fossil_print("done\n");
+    mxChain = db_get_int("max-delta-chain", 0);
+    if( mxChain>0 ){
+      int nUndelta = content_limit_delta_chains(mxChain);
+      if( nUndelta>0 ){
+        fossil_print("%d artifacts converted to full text to limit delta "
+                     "chains to %d\n", nUndelta, mxChain);
+      }
+    }
     db_close(0);
     db_open_repository(g.zRepositoryName);
     if( newPagesize ){
@@ -825,14 +1292,96 @@ void scrub_cmd(void){
 }
 
 /*
-** Recursively read all files from the directory zPath and install
-** every file read as a new artifact in the repository.
+** COMMAND: compact
+** %fossil compact ?OPTIONS? ?REPOSITORY?
+**
+** Give the free pages of the repository database back to the operating
+** system, shrinking the file.  Pages become free when content is
+** deleted, as by shunning, deltification or "fossil rebuild".
+**
+** Repositories created by this version of fossil use incremental
+** auto-vacuum, so that the free pages can be given back while the
+** repository is in use, a few at a time.  This command can be run
+** from cron, with --budget, in the quiet hours of a busy server.
+** Older repositories must be converted once with --enable, which
+** runs a full VACUUM.
+**
+** Options:
+**   --budget N    Give back at most N pages.  The default is all of them
+**   --enable      Convert the repository to incremental auto-vacuum
+*/
+void compact_cmd(void){
+  const char *zBudget = find_option("budget",0,1);
+  int enableFlag = find_option("enable",0,0)!=0;
+  int nBudget = zBudget ? atoi(zBudget) : 0;
+  const char *zDb;
+  int nFree, nPage;
+
+  if( g.argc!=2 && g.argc!=3 ) usage("?OPTIONS? ?REPOSITORY?");
+  if( zBudget && nBudget<=0 ) fossil_fatal("the budget must be positive");
+  if( g.argc==2 ){
+    db_find_and_open_repository(OPEN_ANY_SCHEMA, 0);
+    db_close(1);
+    db_open_repository(g.zRepositoryName);
+  }else{
+    db_open_repository(g.argv[2]);
+  }
+  zDb = db_name("repository");
+  nPage = db_int(0, "PRAGMA %s.page_count", zDb);
+  nFree = db_int(0, "PRAGMA %s.freelist_count", zDb);
+  if( db_int(0, "PRAGMA %s.auto_vacuum", zDb)!=2 ){
+    if( !enableFlag ){
+      fossil_print(
+        "%d of %d pages are free.  This repository does not use\n"
+        "incremental auto-vacuum.  Use --enable to convert it, or\n"
+        "\"fossil rebuild --vacuum\" to reclaim the space once.\n",
+        nFree, nPage);
+      return;
+    }
+    fossil_print("Converting to incremental auto-vacuum... ");
+    fflush(stdout);
+    db_multi_exec("PRAGMA %s.auto_vacuum=INCREMENTAL", zDb);
+    db_multi_exec("VACUUM");
+    fossil_print("done\n");
+  }else if( nFree>0 ){
+    db_multi_exec("PRAGMA %s.incremental_vacuum(%d)", zDb,
+                  nBudget>0 && nBudget<nFree ? nBudget : nFree);
+  }
+  fossil_print("%d pages freed.  %d of %d pages remain free.\n",
+               nPage - db_int(0, "PRAGMA %s.page_count", zDb),
+               db_int(0, "PRAGMA %s.freelist_count", zDb),
+               db_int(0, "PRAGMA %s.page_count", zDb));
+}
+
+/*
+** A file to be installed as an artifact by "fossil reconstruct".
+*/
+typedef struct ReconFile ReconFile;
+struct ReconFile {
+  char *zName;          /* Name of the file */
+  int size;             /* Size of the file, from before it was read */
+  int isErr;            /* True if the file could not be opened */
+  int nByte;            /* Size of the content, once read */
+  Blob content;         /* Content of the file, once read and compressed */
+  Blob hash;            /* SHA1 hash of the content */
+};
+
+/*
+** Every file found by recon_read_dir(), in the order found.
+*/
+static struct {
+  int n;                /* Number of entries in a[] */
+  int nAlloc;           /* Slots allocated for a[] */
+  ReconFile *a;         /* The files */
+} reconFiles;
+
+/*
+** Recursively find all files in the directory zPath and add them to
+** reconFiles.  They are installed as artifacts by recon_insert_files().
 */
 void recon_read_dir(char *zPath){
   DIR *d;
   struct dirent *pEntry;
-  Blob aContent; /* content of the just read artifact */
-  static int nFileRead = 0;
   char *zMbcsPath;
   char *zUtf8Name;
 
@@ -840,8 +1389,8 @@ void recon_read_dir(char *zPath){
   d = opendir(zMbcsPath);
   if( d ){
     while( (pEntry=readdir(d))!=0 ){
-      Blob path;
       char *zSubpath;
+      ReconFile *p;
 
       if( pEntry->d_name[0]=='.' ){
         continue;
@@ -852,18 +1401,18 @@ void recon_read_dir(char *zPath){
       if( file_isdir(zSubpath)==1 ){
         recon_read_dir(zSubpath);
       }
-      blob_init(&path, 0, 0);
-      blob_appendf(&path, "%s", zSubpath);
-      if( blob_read_from_file(&aContent, blob_str(&path))==-1 ){
-        fossil_panic("some unknown error occurred while reading \"%s\"", 
-                     blob_str(&path));
+      if( reconFiles.n>=reconFiles.nAlloc ){
+        reconFiles.nAlloc = reconFiles.nAlloc*2 + 100;
+        reconFiles.a = fossil_realloc(reconFiles.a,
+                                 reconFiles.nAlloc*sizeof(reconFiles.a[0]));
+      }
+      p = &reconFiles.a[reconFiles.n++];
+      memset(p, 0, sizeof(*p));
+      p->zName = zSubpath;
+      p->size = file_wd_size(zSubpath);
+      if( p->size<0 ){
+        fossil_fatal("no such file: %s", zSubpath);
       }
-      content_put(&aContent);
-      blob_reset(&path);
-      blob_reset(&aContent);
-      free(zSubpath);
-      fossil_print("\r%d", ++nFileRead);
-      fflush(stdout);
     }
     closedir(d);
   }else {
@@ -873,6 +1422,71 @@ void recon_read_dir(char *zPath){
   fossil_mbcs_free(zMbcsPath);
 }
 
+/*
+** Worker-thread half of recon_insert_files().  Read, hash, and compress
+** one file.  This routine must not use the database.
+*/
+static void recon_file_task(void *pArg){
+  ReconFile *p = (ReconFile*)pArg;
+  Blob x;
+  blob_zero(&x);
+  if( p->size>0 ){
+    FILE *in = fossil_fopen(p->zName, "rb");
+    if( in==0 ){
+      p->isErr = 1;
+      return;
+    }
+    blob_read_from_channel(&x, in, p->size);
+    fclose(in);
+  }
+  p->nByte = blob_size(&x);
+  sha1sum_blob(&x, &p->hash);
+  if( p->nByte>0 ){
+    content_compress(&x, &p->content);
+  }else{
+    /* content_put_ex() takes an empty blob to be uncompressed */
+    p->content = x;
+  }
+}
+
+/*
+** Install every file in reconFiles as a new artifact in the repository.
+** Files are read, hashed, and compressed by the threads of pPool, a
+** batch at a time, and then inserted by the calling thread in the
+** order in which they were found.
+*/
+static void recon_insert_files(WorkPool *pPool){
+  const i64 mxBatchSize = 50000000;  /* Bytes of files per batch */
+  int nFileRead = 0;
+  int i = 0;
+
+  content_compression_init();
+  while( i<reconFiles.n ){
+    i64 szBatch = 0;
+    int j, iEnd;
+    for(iEnd=i; iEnd<reconFiles.n && (iEnd==i || szBatch<mxBatchSize); iEnd++){
+      szBatch += reconFiles.a[iEnd].size;
+      workpool_add(pPool, recon_file_task, &reconFiles.a[iEnd]);
+    }
+    workpool_wait(pPool);
+    for(j=i; j<iEnd; j++){
+      ReconFile *p = &reconFiles.a[j];
+      if( p->isErr ){
+        fossil_panic("cannot open %s for reading", p->zName);
+      }
+      content_put_ex(&p->content, blob_str(&p->hash), 0, p->nByte, 0);
+      blob_reset(&p->content);
+      blob_reset(&p->hash);
+      free(p->zName);
+      fossil_print("\r%d", ++nFileRead);
+      fflush(stdout);
+    }
+    i = iEnd;
+  }
+  free(reconFiles.a);
+  memset(&reconFiles, 0, sizeof(reconFiles));
+}
+
 /*
 ** COMMAND: reconstruct*
 **
@@ -883,10 +1497,16 @@ void recon_read_dir(char *zPath){
 ** fossil repository in FILENAME. Subdirectories are read, files
 ** with leading '.' in the filename are ignored.
 **
+** Options:
+**   --threads N   Use N threads to read, hash, and compress the files.
+**                 The default is one thread per CPU.
+**
 ** See also: deconstruct, rebuild
 */
 void reconstruct_cmd(void) {
   char *zPassword;
+  WorkPool *pPool;
+  pPool = workpool_new(workpool_size(find_option("threads",0,1)));
   if( g.argc!=4 ){
     usage("FILENAME DIRECTORY");
   }
@@ -902,6 +1522,8 @@ void reconstruct_cmd(void) {
 
   fossil_print("Reading files from directory \"%s\"...\n", g.argv[3]);
   recon_read_dir(g.argv[3]);
+  recon_insert_files(pPool);
+  workpool_delete(pPool);
   fossil_print("\nBuilding the Fossil repository...\n");
 
   rebuild_db(0, 1, 1);
@@ -937,6 +1559,8 @@ void reconstruct_cmd(void) {
 **   -R|--repository REPOSITORY  deconstruct given REPOSITORY
 **   -L|--prefixlength N         set the length of the names of the DESTINATION
 **                               subdirectories to N
+**   --threads N                 use N threads to expand and write artifacts.
+**                               The default is one thread per CPU.
 **
 ** See also: rebuild, reconstruct
 */
@@ -944,7 +1568,9 @@ void deconstruct_cmd(void){
   const char *zDestDir;
   const char *zPrefixOpt;
   Stmt        s;
+  WorkPool   *pPool;
 
+  pPool = workpool_new(workpool_size(find_option("threads",0,1)));
   /* check number of arguments */
   if( (g.argc != 3) && (g.argc != 5)  && (g.argc != 7)){
     usage ("?-R|--repository REPOSITORY? ?-L|--prefixlength N? DESTINATION");
@@ -994,15 +1620,8 @@ void deconstruct_cmd(void){
      " WHERE NOT EXISTS(SELECT 1 FROM shun WHERE uuid=blob.uuid)"
      "   AND NOT EXISTS(SELECT 1 FROM delta WHERE rid=blob.rid)"
   );
-  while( db_step(&s)==SQLITE_ROW ){
-    int rid = db_column_int(&s, 0);
-    int size = db_column_int(&s, 1);
-    if( size>=0 ){
-      Blob content;
-      content_get(rid, &content);
-      rebuild_step(rid, size, &content);
-    }
-  }
+  rebuild_step_many(&s, pPool);
+  workpool_delete(pPool);
   db_finalize(&s);
   db_prepare(&s,
      "SELECT rid, size FROM blob"
@@ -618,6 +618,8 @@ struct GenerateHTML {
   int isMultirow;  /* True if multiple table rows per query result row */
   int iNewRow;     /* Index of first column that goes on separate row */
   int iBg;         /* Index of column that defines background color */
+  int nLimit;      /* Show at most this many rows, if positive */
+  int hasMore;     /* True if rows beyond nLimit were left out */
 };
 
 /*
@@ -700,6 +702,10 @@ static int generate_html(
     @ </td></tr>
     return 0;
   }
+  if( pState->nLimit>0 && pState->nCount>=pState->nLimit ){
+    pState->hasMore = 1;
+    return 1;
+  }
   ++pState->nCount;
 
   /* Output the separator above each entry in a table which has multiple lines
@@ -889,6 +895,21 @@ int sqlite3_exec_readonly(
 }
 
 
+/*
+** Return true if the HTML table for the report query zSql may be
+** saved in the report cache.  The result of a query that asks for the
+** current time or a random number can change without anything in the
+** repository changing.
+*/
+static int report_is_cacheable(const char *zSql){
+  char *z = mprintf("%s", zSql);
+  int i, rc;
+  for(i=0; z[i]; i++) z[i] = fossil_tolower(z[i]);
+  rc = strstr(z, "now")==0 && strstr(z, "random")==0;
+  fossil_free(z);
+  return rc;
+}
+
 /*
 ** WEBPAGE: /rptview
 **
@@ -896,6 +917,11 @@ int sqlite3_exec_readonly(
 ** corresponding to REPORTFMT.RN.  If the tablist query parameter exists,
 ** then the output consists of lines of tab-separated fields instead of
 ** an HTML table.
+**
+** If the n query parameter is a positive number, the HTML table shows
+** at most that many rows, starting after the number of rows given by
+** the start query parameter, with links to the previous and next pages.
+** The HTML table is kept in the report cache.
 */
 void rptview_page(void){
   int count = 0;
@@ -908,6 +934,8 @@ void rptview_page(void){
   Stmt q;
   char *zErr1 = 0;
   char *zErr2 = 0;
+  int iStart = 0;
+  Blob report;
 
   login_check_credentials();
   if( !g.perm.RdTkt ){ login_needed(); return; }
@@ -966,18 +994,61 @@ void rptview_page(void){
     style_header(zTitle);
     output_color_key(zClrKey, 1, 
         "border=\"0\" cellpadding=\"3\" cellspacing=\"0\" class=\"report\"");
-    @ <table border="1" cellpadding="2" cellspacing="0" class="report">
+    memset(&sState, 0, sizeof(sState));
     sState.rn = rn;
-    sState.nCount = 0;
-    report_restrict_sql(&zErr1);
-    sqlite3_exec_readonly(g.db, zSql, generate_html, &sState, &zErr2);
-    report_unrestrict_sql();
-    @ </table>
-    if( zErr1 ){
-      @ <p class="reportError">Error: %h(zErr1)</p>
-    }else if( zErr2 ){
-      @ <p class="reportError">Error: %h(zErr2)</p>
+    sState.nLimit = atoi(PD("n","0"));
+    if( sState.nLimit>0 ){
+      iStart = atoi(PD("start","0"));
+      if( iStart<0 ) iStart = 0;
+      /* The newline ends any "--" comment at the end of the report SQL */
+      zSql = mprintf("SELECT * FROM (%s\n) LIMIT %d OFFSET %d",
+                     zSql, sState.nLimit+1, iStart);
+    }
+    blob_zero(&report);
+    blob_appendf(&report, "%d %d %d %s\n%s", g.perm.Write, g.perm.History,
+                 g.perm.RdAddr, g.zTop, zSql);
+    if( !report_is_cacheable(zSql)
+     || !report_cache_get(blob_str(&report), cgi_output_blob())
+    ){
+      int iOut = blob_size(cgi_output_blob());
+      @ <table border="1" cellpadding="2" cellspacing="0" class="report">
+      report_restrict_sql(&zErr1);
+      sqlite3_exec_readonly(g.db, zSql, generate_html, &sState, &zErr2);
+      report_unrestrict_sql();
+      @ </table>
+      if( zErr1 ){
+        @ <p class="reportError">Error: %h(zErr1)</p>
+      }else if( zErr2 ){
+        @ <p class="reportError">Error: %h(zErr2)</p>
+      }else if( sState.nLimit>0 && (iStart>0 || sState.hasMore) ){
+        Blob url;
+        blob_zero(&url);
+        blob_appendf(&url, "%s/rptview?rn=%d&amp;n=%d", g.zTop, rn,
+                     sState.nLimit);
+        if( P("order_by") ){
+          blob_appendf(&url, "&amp;order_by=%T&amp;order_dir=%T",
+                       P("order_by"), PD("order_dir",""));
+        }
+        @ <p class="reportPages">
+        if( iStart>0 ){
+          int iPrev = iStart>sState.nLimit ? iStart-sState.nLimit : 0;
+          @ <a href="%s(blob_str(&url))&amp;start=%d(iPrev)">Previous</a>
+        }
+        if( sState.hasMore ){
+          int iNext = iStart+sState.nLimit;
+          @ <a href="%s(blob_str(&url))&amp;start=%d(iNext)">Next</a>
+        }
+        @ </p>
+        blob_reset(&url);
+      }
+      if( zErr1==0 && zErr2==0 && report_is_cacheable(zSql) ){
+        Blob html;
+        blob_init(&html, blob_buffer(cgi_output_blob())+iOut,
+                  blob_size(cgi_output_blob())-iOut);
+        report_cache_put(blob_str(&report), &html);
+      }
     }
+    blob_reset(&report);
     style_footer();
   }else{
     report_restrict_sql(&zErr1);
@@ -1027,7 +1098,9 @@ static const char *zSep = 0;
 ** select the quoting algorithm for "ticket show"
 */
 #if INTERFACE
-typedef enum eTktShowEnc { tktNoTab=0, tktFossilize=1 } tTktShowEncoding;
+typedef enum eTktShowEnc {
+  tktNoTab=0, tktFossilize=1, tktCsv=2
+} tTktShowEncoding;
 #endif
 static tTktShowEncoding tktEncode = tktNoTab;
 
@@ -1047,6 +1120,26 @@ static void output_no_tabs_file(const char *z){
         }
         break;
       }
+    case tktCsv:
+      /* Quote the value as in RFC 4180 if it holds the separator,
+      ** a double-quote or a line break */
+      if( z && (strpbrk(z, "\"\r\n")!=0 || strstr(z, zSep)!=0) ){
+        fossil_print("\"");
+        while( z[0] ){
+          int i;
+          for(i=0; z[i] && z[i]!='"'; i++){}
+          fossil_print("%.*s", i, z);
+          if( z[i]=='"' ){
+            fossil_print("\"\"");
+            i++;
+          }
+          z += i;
+        }
+        fossil_print("\"");
+      }else if( z ){
+        fossil_print("%s", z);
+      }
+      break;
     default:
       while( z && z[0] ){
         int i, j;
@@ -1133,6 +1226,7 @@ void rptshow(
   count = 0;
   tktEncode = enc;
   zSep = zSepIn;
+  if( zSep==0 && enc==tktCsv ) zSep = ",";
   report_restrict_sql(&zErr1);
   sqlite3_exec_readonly(g.db, zSql, output_separated_file, &count, &zErr2);
   report_unrestrict_sql();
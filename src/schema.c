@@ -44,6 +44,30 @@ const char zConfigSchema[] =
 #define CONTENT_SCHEMA  "2"
 #define AUX_SCHEMA      "2011-04-25 19:50"
 
+/*
+** A repository that stores artifacts in chunks (see chunk.c) has this
+** aux schema instead.  Older versions of fossil would read those
+** artifacts as empty, and the different version makes them refuse the
+** repository.
+*/
+#define AUX_SCHEMA_CHUNKED  AUX_SCHEMA " chunked"
+
+/*
+** A repository that stores artifacts compressed with zstd (see
+** content_compress()) has " zstd" added to the end of its aux schema,
+** after any " chunked".  Older versions of fossil, and builds without
+** zstd, refuse such a repository rather than fail on the first
+** artifact they cannot uncompress.
+*/
+#define AUX_SCHEMA_ZSTD     " zstd"
+
+/*
+** Optional features of a repository recorded in its aux schema.  See
+** db_aux_schema_value().
+*/
+#define AUX_FEATURE_CHUNKED  0x01   /* AUX_SCHEMA_CHUNKED */
+#define AUX_FEATURE_ZSTD     0x02   /* AUX_SCHEMA_ZSTD */
+
 #endif /* INTERFACE */
 
 
@@ -267,6 +291,7 @@ const char zRepositorySchema2[] =
 @   omtime DATETIME                 -- Original unchanged date+time, or NULL
 @ );
 @ CREATE INDEX event_i1 ON event(mtime);
+@ CREATE INDEX event_i2 ON event(type, mtime);
 @
 @ -- A record of phantoms.  A phantom is a record for which we know the
 @ -- UUID but we do not (yet) know the file content.
@@ -15,8 +15,9 @@
 **
 *******************************************************************************
 **
-** This file contains code to implement the "/doc" web page and related
-** pages.
+** This file contains code to implement searching of timeline comments,
+** wiki pages, tickets and file content: the "search" command and the
+** "/search" web page.
 */
 #include "config.h"
 #include "search.h"
@@ -164,13 +165,428 @@ void search_sql_setup(Search *p){
      search_score_sqlfunc, 0, 0);
 }
 
+/*
+** The search index is an FTS4 full-text index of the text that can be
+** searched, so that a search reads only the documents that contain
+** every term instead of scoring every row.  SRCHDOC has one row for
+** each document and SRCHTEXT holds its text under the same docid.
+**
+** SRCHDOC.KEY identifies a document and SRCHDOC.TYPE says what it is:
+**
+**    KEY               TYPE             Text
+**    e<objid>          EVENT.TYPE       Comment of the timeline event
+**    w<page-name>      wiki             Latest version of the wiki page
+**    t<ticket-uuid>    tkt              Fields of the ticket
+**    f<filename>       file             The file in the latest check-in
+**                                       on the main branch, for files
+**                                       named by "search-file-glob"
+**    .files            .                (none) RID is the check-in and
+**                                       LABEL the glob of the f rows
+**
+** The index is built by the first search that finds it missing and
+** then kept up to date as artifacts are crosslinked.  It is derived
+** data, so rebuild drops it.  A repository that cannot be written, or
+** an SQLite without FTS4, is searched by scanning as before.
+**
+** The index is kept in a separate database named after the repository
+** with "-search" appended, attached as "srchdb" whenever that file
+** exists, so that versions of fossil built without FTS4 can still read
+** the repository.  Detaching the database also releases the statements
+** that FTS4 keeps prepared on it.
+**
+** The index finds the documents in which every term of the pattern
+** begins a word, and those are ranked with search_score() just as the
+** scan ranks them.  The scan also matches a term in the middle of a
+** word, which an index of words cannot do.
+*/
+static const char zSearchSchema[] =
+@ CREATE VIRTUAL TABLE %s.srchtext USING fts4(body);
+@ CREATE TABLE %s.srchdoc(
+@   docid INTEGER PRIMARY KEY,     -- The same docid in SRCHTEXT
+@   key TEXT UNIQUE,               -- Identifies the document
+@   type TEXT,                     -- Kind of document
+@   rid INTEGER,                   -- Artifact the document shows
+@   mtime DATETIME,                -- Time of the document
+@   label TEXT                     -- Ticket title or file name
+@ );
+;
+
+/*
+** Artifacts and tickets crosslinked since the search index was last
+** updated by search_index_update().
+*/
+static Bag searchPending;      /* RIDs of artifacts */
+static Bag searchPendingTkt;   /* Tagids of "tkt-UUID" tags */
+
+static int searchDbAttached = 0;  /* True if srchdb is attached */
+
+/*
+** Attach the database holding the search index as "srchdb", if it is
+** not attached already.  Unless createFlag is true, only attach a
+** database that exists.  A database cannot be attached inside a
+** transaction.  Return true if srchdb is attached.
+*/
+int search_db_attach(int createFlag){
+  char *zName;
+  if( searchDbAttached ) return 1;
+  if( !g.repositoryOpen || db_transaction_nesting_depth()>0 ) return 0;
+  zName = mprintf("%s-search", g.zRepositoryName);
+  if( createFlag || file_size(zName)>0 ){
+    db_multi_exec("ATTACH DATABASE %Q AS srchdb", zName);
+    searchDbAttached = 1;
+  }
+  fossil_free(zName);
+  return searchDbAttached;
+}
+
+/*
+** Detach the search index database, if it is attached.  This is done
+** before the database connection is closed, outside of any transaction.
+** Errors are ignored, since the connection is about to go away.
+*/
+void search_db_detach(void){
+  if( searchDbAttached ){
+    sqlite3_exec(g.db, "DETACH DATABASE srchdb", 0, 0, 0);
+    searchDbAttached = 0;
+  }
+}
+
+/*
+** Return true if the search index exists.
+*/
+static int search_index_exists(void){
+  return searchDbAttached
+      && db_exists("SELECT 1 FROM srchdb.sqlite_master WHERE name='srchdoc'"
+                   " AND EXISTS(SELECT 1 FROM srchdb.sqlite_master"
+                   "             WHERE name='srchtext')");
+}
+
+/*
+** Drop the search index, if there is one, so that the next search
+** builds it anew.  Rebuild calls this.
+*/
+void search_index_drop(void){
+  if( search_index_exists() ){
+    db_multi_exec(
+      "DROP TABLE srchdb.srchtext;"
+      "DROP TABLE srchdb.srchdoc;"
+    );
+  }
+}
+
+/*
+** Remove the document zKey from the search index.
+*/
+static void search_doc_delete(const char *zKey){
+  db_multi_exec(
+    "DELETE FROM srchdb.srchtext WHERE docid=(SELECT docid FROM srchdb.srchdoc"
+                                     " WHERE key=%Q);"
+    "DELETE FROM srchdb.srchdoc WHERE key=%Q;",
+    zKey, zKey
+  );
+}
+
+/*
+** Make zBody the text of document zKey in the search index.
+*/
+static void search_doc_set(
+  const char *zKey,        /* Identifies the document */
+  const char *zType,       /* Kind of document */
+  int rid,                 /* Artifact the document shows */
+  double rMtime,           /* Time of the document */
+  const char *zLabel,      /* Ticket title or file name, or NULL */
+  const char *zBody        /* Text of the document */
+){
+  search_doc_delete(zKey);
+  db_multi_exec(
+    "INSERT INTO srchdb.srchdoc(key,type,rid,mtime,label)"
+    " VALUES(%Q,%Q,%d,%.17g,%Q);"
+    "INSERT INTO srchdb.srchtext(docid,body) VALUES(last_insert_rowid(),%Q);",
+    zKey, zType, rid, rMtime, zLabel, zBody
+  );
+}
+
+/*
+** Bring the search index entry for the timeline event objid up to date.
+*/
+static void search_index_event(int objid){
+  char *zKey = mprintf("e%d", objid);
+  search_doc_delete(zKey);
+  db_multi_exec(
+    "INSERT INTO srchdb.srchdoc(key,type,rid,mtime)"
+    " SELECT %Q, type, objid, mtime FROM event WHERE objid=%d;"
+    "INSERT INTO srchdb.srchtext(docid,body)"
+    " SELECT docid, coalesce(ecomment,comment) FROM srchdb.srchdoc, event"
+    "  WHERE key=%Q AND objid=%d;",
+    zKey, objid, zKey, objid
+  );
+  fossil_free(zKey);
+}
+
+/*
+** Bring the search index entry for wiki page zPage up to date.
+*/
+static void search_index_wiki(const char *zPage){
+  char *zKey = mprintf("w%s", zPage);
+  int rid = db_int(0,
+     "SELECT x.rid FROM tag t, tagxref x"
+     " WHERE x.tagid=t.tagid AND t.tagname='wiki-%q'"
+     " ORDER BY x.mtime DESC LIMIT 1",
+     zPage
+  );
+  Manifest *pWiki = rid ? manifest_get(rid, CFTYPE_WIKI) : 0;
+  if( pWiki && pWiki->zWiki && pWiki->zWiki[0] ){
+    search_doc_set(zKey, "wiki", rid, pWiki->rDate, 0, pWiki->zWiki);
+  }else{
+    search_doc_delete(zKey);
+  }
+  manifest_destroy(pWiki);
+  fossil_free(zKey);
+}
+
+/*
+** Bring the search index entry for ticket zUuid up to date.  The text
+** is every field of the ticket other than the "tkt_" fields that
+** fossil maintains itself.
+*/
+static void search_index_ticket(const char *zUuid){
+  char *zKey = mprintf("t%s", zUuid);
+  Stmt q;
+  db_prepare(&q, "SELECT * FROM ticket WHERE tkt_uuid=%Q", zUuid);
+  if( db_step(&q)==SQLITE_ROW ){
+    Blob body;
+    const char *zTitle = 0;
+    double rMtime = 0.0;
+    int i, n = db_column_count(&q);
+    blob_zero(&body);
+    for(i=0; i<n; i++){
+      const char *zName = db_column_name(&q, i);
+      if( fossil_strcmp(zName, "tkt_mtime")==0 ){
+        rMtime = db_column_double(&q, i);
+      }
+      if( strncmp(zName, "tkt_", 4)==0 ) continue;
+      if( fossil_strcmp(zName, "title")==0 ) zTitle = db_column_text(&q, i);
+      if( db_column_bytes(&q, i)>0 ){
+        blob_appendf(&body, "%s\n", db_column_text(&q, i));
+      }
+    }
+    search_doc_set(zKey, "tkt", 0, rMtime, zTitle, blob_str(&body));
+    blob_reset(&body);
+  }else{
+    search_doc_delete(zKey);
+  }
+  db_finalize(&q);
+  fossil_free(zKey);
+}
+
+/*
+** Make the "f" documents of the search index match the files named by
+** the "search-file-glob" setting in the latest check-in on the main
+** branch.  Only files that have changed are indexed again.
+*/
+static void search_index_sync_files(void){
+  char *zGlob = db_get("search-file-glob", "");
+  int vid = 0;
+  if( zGlob[0] ){
+    char *zMain = db_get("main-branch", "trunk");
+    vid = symbolic_name_to_rid(zMain, "ci");
+  }
+  if( !db_exists("SELECT 1 FROM srchdb.srchdoc WHERE key='.files'"
+                 "   AND rid=%d AND label=%Q", vid, zGlob) ){
+    Manifest *pManifest = vid>0 ? manifest_get(vid, CFTYPE_MANIFEST) : 0;
+    db_begin_transaction();
+    db_multi_exec("CREATE TEMP TABLE srchkeep(key TEXT PRIMARY KEY)");
+    if( pManifest ){
+      Glob *pGlob = glob_create(zGlob);
+      ManifestFile *pFile;
+      manifest_file_rewind(pManifest);
+      while( (pFile = manifest_file_next(pManifest, 0))!=0 ){
+        char *zKey;
+        int fid;
+        if( !glob_match(pGlob, pFile->zName) ) continue;
+        fid = uuid_to_rid(pFile->zUuid, 0);
+        zKey = mprintf("f%s", pFile->zName);
+        if( fid>0 && !db_exists("SELECT 1 FROM srchdb.srchdoc"
+                                " WHERE key=%Q AND rid=%d", zKey, fid) ){
+          Blob content;
+          content_get(fid, &content);
+          if( memchr(blob_buffer(&content), 0, blob_size(&content))==0 ){
+            search_doc_set(zKey, "file", fid, pManifest->rDate,
+                           pFile->zName, blob_str(&content));
+          }
+          blob_reset(&content);
+        }
+        db_multi_exec("INSERT OR IGNORE INTO srchkeep VALUES(%Q)", zKey);
+        fossil_free(zKey);
+      }
+      glob_free(pGlob);
+      manifest_destroy(pManifest);
+    }
+    db_multi_exec(
+      "DELETE FROM srchdb.srchtext WHERE docid IN (SELECT docid FROM srchdb.srchdoc"
+      "  WHERE type='file' AND key NOT IN srchkeep);"
+      "DELETE FROM srchdb.srchdoc WHERE type='file' AND key NOT IN srchkeep;"
+      "DROP TABLE srchkeep;"
+    );
+    search_doc_delete(".files");
+    db_multi_exec(
+      "INSERT INTO srchdb.srchdoc(key,type,rid,label) VALUES('.files','.',%d,%Q)",
+      vid, zGlob
+    );
+    db_end_transaction(0);
+  }
+}
+
+/*
+** Make sure the search index exists and is up to date, creating it if
+** necessary.  Return false if it cannot be created, in which case the
+** caller should search by scanning.
+*/
+static int search_index_sync(void){
+  if( !search_db_attach(1) ) return 0;
+  if( !search_index_exists() ){
+    char *zSql = mprintf(zSearchSchema, "srchdb", "srchdb");
+    Stmt q;
+    db_begin_transaction();
+    db_multi_exec_ignore_error(zSql, 0);
+    if( search_index_exists() ){
+      db_multi_exec(
+        "INSERT INTO srchdb.srchdoc(key,type,rid,mtime)"
+        " SELECT 'e'||objid, type, objid, mtime FROM event;"
+        "INSERT INTO srchdb.srchtext(docid,body)"
+        " SELECT docid, coalesce(ecomment,comment) FROM srchdb.srchdoc, event"
+        "  WHERE objid=srchdoc.rid;"
+      );
+      db_prepare(&q,
+        "SELECT substr(tagname,6) FROM tag WHERE tagname GLOB 'wiki-*'"
+      );
+      while( db_step(&q)==SQLITE_ROW ){
+        search_index_wiki(db_column_text(&q, 0));
+      }
+      db_finalize(&q);
+      db_prepare(&q, "SELECT tkt_uuid FROM ticket");
+      while( db_step(&q)==SQLITE_ROW ){
+        search_index_ticket(db_column_text(&q, 0));
+      }
+      db_finalize(&q);
+    }
+    db_end_transaction(0);
+    fossil_free(zSql);
+    if( !search_index_exists() ) return 0;
+  }
+  search_index_sync_files();
+  return 1;
+}
+
+/*
+** Note that artifact rid has been crosslinked, or that the comment or
+** time of its timeline event has changed, so that search_index_update()
+** can bring its entries in the search index up to date.
+*/
+void search_index_note(int rid){
+  bag_insert(&searchPending, rid);
+}
+
+/*
+** Note that the ticket whose "tkt-UUID" tag is tagid has changed.
+*/
+void search_index_note_ticket(int tagid){
+  bag_insert(&searchPendingTkt, tagid);
+}
+
+/*
+** Update the search index, if it exists, for the artifacts and tickets
+** noted since the last call.
+*/
+void search_index_update(void){
+  int id;
+  if( bag_count(&searchPending)+bag_count(&searchPendingTkt)==0 ) return;
+  if( search_index_exists() ){
+    for(id=bag_first(&searchPending); id; id=bag_next(&searchPending, id)){
+      char *zPage = db_text(0,
+         "SELECT substr(tagname,6) FROM tagxref, tag"
+         " WHERE tagxref.rid=%d AND tag.tagid=tagxref.tagid"
+         "   AND tagname GLOB 'wiki-*'", id);
+      search_index_event(id);
+      if( zPage ){
+        search_index_wiki(zPage);
+        fossil_free(zPage);
+      }
+    }
+    for(id=bag_first(&searchPendingTkt); id;
+        id=bag_next(&searchPendingTkt, id)){
+      char *zUuid = db_text(0,
+         "SELECT substr(tagname,5) FROM tag WHERE tagid=%d", id);
+      if( zUuid ){
+        search_index_ticket(zUuid);
+        fossil_free(zUuid);
+      }
+    }
+  }
+  bag_clear(&searchPending);
+  bag_clear(&searchPendingTkt);
+}
+
+/*
+** Return an FTS4 query, in memory obtained from fossil_malloc(), that
+** matches every document in which search_score() finds all the terms
+** of p, or NULL if p has no terms.  Each term must begin some word of
+** the document.  The tokenizer also splits words at "_", so a term
+** such as "foo_ba" becomes the phrase "foo ba*".
+*/
+static char *search_fts_query(Search *p){
+  Blob q;
+  int i, j, k;
+  if( p->nTerm==0 ) return 0;
+  blob_zero(&q);
+  for(i=0; i<p->nTerm; i++){
+    const char *z = p->a[i].z;
+    int n = p->a[i].n;
+    int nPart = 0;
+    blob_append(&q, i ? " \"" : "\"", -1);
+    for(j=0; j<n; j=k+1){
+      for(k=j; k<n && z[k]!='_'; k++){}
+      if( k==j ) continue;
+      blob_appendf(&q, "%s%.*s", nPart ? " " : "", k-j, &z[j]);
+      if( k==n ) blob_append(&q, "*", 1);
+      nPart++;
+    }
+    blob_append(&q, "\"", 1);
+  }
+  return blob_str(&q);
+}
+
+/*
+** Return an SQL expression, in memory obtained from fossil_malloc(),
+** that restricts event.objid to the timeline events whose comment
+** matches every term of p, using the search index.  Return NULL if
+** the index is not available, in which case every event is a candidate.
+*/
+static char *search_event_filter(Search *p){
+  char *zQuery;
+  char *zFilter;
+  if( !search_index_sync() ) return 0;
+  zQuery = search_fts_query(p);
+  if( zQuery==0 ) return 0;
+  zFilter = mprintf(
+    "event.objid IN (SELECT rid FROM srchdb.srchdoc"
+    " WHERE key GLOB 'e*' AND docid IN"
+    "  (SELECT docid FROM srchdb.srchtext WHERE srchtext MATCH %Q))",
+    zQuery
+  );
+  fossil_free(zQuery);
+  return zFilter;
+}
+
 /*
 ** Testing the search function.
 **
 ** COMMAND: search*
-** %fossil search pattern...
+** %fossil search ?-a|--all? pattern...
 **
-** Search for timeline entries matching the pattern.
+** Search for timeline entries matching the pattern.  With the -a or
+** --all option, also list the wiki pages, tickets and files that match.
+** Files are searched only if named by the "search-file-glob" setting.
 */
 void search_cmd(void){
   Search *p;
@@ -178,7 +594,10 @@ void search_cmd(void){
   int i;
   Stmt q;
   int iBest;
+  int showAll;
+  char *zFilter;
 
+  showAll = find_option("all", "a", 0)!=0;
   db_must_be_within_tree();
   if( g.argc<2 ) return;
   blob_init(&pattern, g.argv[2], -1);
@@ -188,6 +607,7 @@ void search_cmd(void){
   p = search_init(blob_str(&pattern));
   blob_reset(&pattern);
   search_sql_setup(p);
+  zFilter = search_event_filter(p);
 
   db_multi_exec(
      "CREATE TEMP TABLE srch(rid,uuid,date,comment,x);"
@@ -197,8 +617,10 @@ void search_cmd(void){
      "          coalesce(ecomment,comment),"
      "          score(coalesce(ecomment,comment)) AS y"
      "     FROM event, blob"
-     "    WHERE blob.rid=event.objid AND y>0;"
+     "    WHERE blob.rid=event.objid AND y>0 %s%s;",
+     zFilter ? "AND " : "", zFilter ? zFilter : ""
   );
+  fossil_free(zFilter);
   iBest = db_int(0, "SELECT max(x) FROM srch");
   db_prepare(&q, 
     "SELECT rid, uuid, date, comment, 0, 0 FROM srch"
@@ -207,4 +629,167 @@ void search_cmd(void){
   );
   print_timeline(&q, 1000, 0);
   db_finalize(&q);
+
+  if( showAll && search_index_exists() ){
+    char *zQuery = search_fts_query(p);
+    if( zQuery ){
+      db_prepare(&q,
+        "SELECT type, substr(key,2), label, score(body) AS y"
+        "  FROM srchdb.srchtext, srchdb.srchdoc"
+        " WHERE srchtext MATCH %Q AND srchdoc.docid=srchtext.docid"
+        "   AND type IN ('wiki','tkt','file') AND y>0"
+        " ORDER BY y DESC, mtime DESC",
+        zQuery
+      );
+      while( db_step(&q)==SQLITE_ROW ){
+        const char *zType = db_column_text(&q, 0);
+        const char *zKey = db_column_text(&q, 1);
+        if( zType[0]=='w' ){
+          fossil_print("wiki:   %s\n", zKey);
+        }else if( zType[0]=='t' ){
+          fossil_print("ticket: %.10s %s\n", zKey, db_column_text(&q, 2));
+        }else{
+          fossil_print("file:   %s\n", zKey);
+        }
+      }
+      db_finalize(&q);
+      fossil_free(zQuery);
+    }
+  }
+}
+
+/*
+** Append zSnippet to the reply, with the text between the \002 and
+** \003 markers that snippet() puts around matching terms shown in bold.
+*/
+static void search_snippet_html(const char *zSnippet){
+  char *z = htmlize(zSnippet, -1);
+  int i, j;
+  for(i=j=0; z[i]; i++){
+    if( z[i]==2 || z[i]==3 ){
+      if( i>j ) cgi_append_content(&z[j], i-j);
+      cgi_append_content(z[i]==2 ? "<b>" : "</b>", -1);
+      j = i+1;
+    }
+  }
+  if( i>j ) cgi_append_content(&z[j], i-j);
+  fossil_free(z);
+}
+
+/*
+** WEBPAGE: search
+** URL: /search?s=PATTERN
+**
+** Search timeline comments, wiki pages, tickets and the files named by
+** the "search-file-glob" setting for PATTERN, showing only the kinds
+** of document the user is allowed to read.
+*/
+void search_page(void){
+  const char *zPattern;
+  Blob types;
+  Search *p;
+  Stmt q;
+  int iBest;
+  int cnt = 0;
+
+  login_check_credentials();
+  if( !g.perm.Read && !g.perm.RdWiki && !g.perm.RdTkt ){
+    login_needed();
+    return;
+  }
+  zPattern = PD("s", "");
+  style_header("Search");
+  @ <form method="get" action="%s(g.zTop)/search"><div>
+  @ <input type="text" name="s" size="40" value="%h(zPattern)" />
+  @ <input type="submit" value="Search" />
+  @ </div></form>
+  p = search_init(zPattern);
+  if( p->nTerm==0 ){
+    search_end(p);
+    style_footer();
+    return;
+  }
+  search_sql_setup(p);
+  blob_zero(&types);
+  blob_append(&types, "''", 2);
+  if( g.perm.Read ) blob_append(&types, ",'ci','g','file'", -1);
+  if( g.perm.RdWiki ) blob_append(&types, ",'w','e','wiki'", -1);
+  if( g.perm.RdTkt ) blob_append(&types, ",'t','tkt'", -1);
+  if( search_index_sync() ){
+    char *zQuery = search_fts_query(p);
+    db_multi_exec(
+      "CREATE TEMP TABLE srchres AS"
+      " SELECT type, key, rid, label, mtime, score(body) AS x,"
+      "        snippet(srchtext, CAST(x'02' AS TEXT), CAST(x'03' AS TEXT),"
+      "                '...', -1, 24) AS snip"
+      "   FROM srchdb.srchtext, srchdb.srchdoc"
+      "  WHERE srchtext MATCH %Q AND srchdoc.docid=srchtext.docid"
+      "    AND type IN (%s) AND x>0;",
+      zQuery, blob_str(&types)
+    );
+    fossil_free(zQuery);
+  }else{
+    db_multi_exec(
+      "CREATE TEMP TABLE srchres AS"
+      " SELECT type, 'e'||objid AS key, objid AS rid, NULL AS label, mtime,"
+      "        score(coalesce(ecomment,comment)) AS x,"
+      "        coalesce(ecomment,comment) AS snip"
+      "   FROM event WHERE type IN (%s) AND x>0;",
+      blob_str(&types)
+    );
+  }
+  blob_reset(&types);
+  iBest = db_int(0, "SELECT max(x) FROM srchres");
+  db_prepare(&q,
+    "SELECT type, substr(key,2), (SELECT uuid FROM blob WHERE rid=srchres.rid),"
+    "       label, datetime(mtime,'localtime'), snip"
+    "  FROM srchres WHERE x>%d ORDER BY x DESC, mtime DESC LIMIT 100",
+    iBest/3
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    const char *zType = db_column_text(&q, 0);
+    const char *zKey = db_column_text(&q, 1);
+    const char *zUuid = db_column_text(&q, 2);
+    const char *zLabel = db_column_text(&q, 3);
+    const char *zDate = db_column_text(&q, 4);
+    if( cnt++==0 ){
+      @ <ol>
+    }
+    if( fossil_strcmp(zType, "wiki")==0 ){
+      @ <li><p>Wiki page
+      @ <a href="%s(g.zTop)/wiki?name=%T(zKey)">%h(zKey)</a>
+    }else if( fossil_strcmp(zType, "tkt")==0 ){
+      @ <li><p>Ticket
+      @ <a href="%s(g.zTop)/tktview?name=%S(zKey)">%S(zKey)</a>
+      @ %h(zLabel ? zLabel : "")
+    }else if( fossil_strcmp(zType, "file")==0 ){
+      @ <li><p>File
+      @ <a href="%s(g.zTop)/artifact/%S(zUuid)">%h(zLabel)</a>
+    }else{
+      const char *zKind;
+      switch( zType[0] ){
+        case 'w':  zKind = "Wiki edit";      break;
+        case 't':  zKind = "Ticket change";  break;
+        case 'e':  zKind = "Event";          break;
+        case 'g':  zKind = "Tag change";     break;
+        default:   zKind = "Check-in";       break;
+      }
+      @ <li><p>%s(zKind)
+      @ <a href="%s(g.zTop)/info/%S(zUuid)">[%S(zUuid)]</a>
+    }
+    if( zDate ){
+      @ <span class="date">%s(zDate)</span>
+    }
+    @ <br />
+    search_snippet_html(db_column_text(&q, 5));
+    @ </p></li>
+  }
+  db_finalize(&q);
+  if( cnt ){
+    @ </ol>
+  }else{
+    @ <p>No matches for "%h(zPattern)".</p>
+  }
+  search_end(p);
+  style_footer();
 }
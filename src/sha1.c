@@ -16,12 +16,19 @@
 ** By Steve Reid <steve@edmweb.com>
 ** 100% Public Domain
 */
+#if INTERFACE
+/*
+** The state of an incremental SHA1 checksum computation.  The caller
+** owns the object, so any number of checksums may be underway at once.
+** See sha1_ctx_init(), sha1_ctx_step() and sha1_ctx_finish().
+*/
 typedef struct SHA1Context SHA1Context;
 struct SHA1Context {
   unsigned int state[5];
   unsigned int count[2];
   unsigned char buffer[64];
 };
+#endif
 
 /*
  * blk0() and blk() perform the initial expand.
@@ -135,12 +142,197 @@ void SHA1Transform(unsigned int state[5], const unsigned char buffer[64])
   state[3] += d;
   state[4] += e;
 }
+#undef a
+#undef b
+#undef c
+#undef d
+#undef e
+
+
+/*
+** Hardware acceleration.
+**
+** On x86 processors that implement the SHA extensions ("SHA-NI"), the
+** compression function is computed by dedicated instructions that are
+** several times faster than the portable code above.  The processor is
+** probed at run-time, so a single binary works on all x86 machines.
+**
+** SHA1TransformBlocks() compresses nBlock consecutive 64-byte blocks.
+** It points to the fastest implementation available once sha1_init_hw()
+** has run.
+*/
+static void SHA1TransformPortable(
+  unsigned int state[5],
+  const unsigned char *data,
+  unsigned int nBlock
+){
+  while( nBlock-- ){
+    SHA1Transform(state, data);
+    data += 64;
+  }
+}
+static void (*SHA1TransformBlocks)(unsigned int*, const unsigned char*,
+                                   unsigned int) = 0;
+
+#if defined(__GNUC__) && (__GNUC__>4 || (__GNUC__==4 && __GNUC_MINOR__>=9)) \
+    && (defined(__i386__) || defined(__x86_64__)) && !defined(FOSSIL_OMIT_SHANI)
+#define FOSSIL_HAVE_SHANI 1
+#include <cpuid.h>
+#include <immintrin.h>
+
+/*
+** Return true if the processor supports the SHA, SSSE3 and SSE4.1
+** instruction set extensions.
+*/
+static int sha1_cpu_has_shani(void){
+  unsigned int a, b, c, d;
+  if( !__get_cpuid(1, &a, &b, &c, &d) ) return 0;
+  if( (c & bit_SSSE3)==0 || (c & bit_SSE4_1)==0 ) return 0;
+  if( __get_cpuid_max(0, 0)<7 ) return 0;
+  __cpuid_count(7, 0, a, b, c, d);
+  return (b & (1<<29))!=0;
+}
+
+/*
+** One group of four rounds.  E is updated with message schedule word M,
+** the "other" E register takes a copy of ABCD, and then the next four
+** rounds are computed using round function F.
+*/
+#define SHANI_ROUNDS(E,Eo,M,F) \
+    E = _mm_sha1nexte_epu32(E, M); \
+    Eo = ABCD; \
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E, F);
+
+/*
+** Compress nBlock 64-byte blocks using the SHA extensions.
+*/
+__attribute__((target("sha,ssse3,sse4.1")))
+static void SHA1TransformShani(
+  unsigned int state[5],
+  const unsigned char *data,
+  unsigned int nBlock
+){
+  __m128i ABCD, ABCD_SAVE, E0, E0_SAVE, E1;
+  __m128i MSG0, MSG1, MSG2, MSG3;
+  const __m128i MASK = _mm_set_epi64x(0x0001020304050607ULL,
+                                      0x08090a0b0c0d0e0fULL);
+
+  ABCD = _mm_loadu_si128((const __m128i*)state);
+  E0 = _mm_set_epi32(state[4], 0, 0, 0);
+  ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+
+  while( nBlock-- ){
+    ABCD_SAVE = ABCD;
+    E0_SAVE = E0;
+
+    /* Rounds 0-3 */
+    MSG0 = _mm_loadu_si128((const __m128i*)(data+0));
+    MSG0 = _mm_shuffle_epi8(MSG0, MASK);
+    E0 = _mm_add_epi32(E0, MSG0);
+    E1 = ABCD;
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+
+    /* Rounds 4-7 */
+    MSG1 = _mm_loadu_si128((const __m128i*)(data+16));
+    MSG1 = _mm_shuffle_epi8(MSG1, MASK);
+    SHANI_ROUNDS(E1, E0, MSG1, 0);
+    MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+
+    /* Rounds 8-11 */
+    MSG2 = _mm_loadu_si128((const __m128i*)(data+32));
+    MSG2 = _mm_shuffle_epi8(MSG2, MASK);
+    SHANI_ROUNDS(E0, E1, MSG2, 0);
+    MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+    MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+    /* Rounds 12-15 */
+    MSG3 = _mm_loadu_si128((const __m128i*)(data+48));
+    MSG3 = _mm_shuffle_epi8(MSG3, MASK);
+    MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+    SHANI_ROUNDS(E1, E0, MSG3, 0);
+    MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+    MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+    /* Rounds 16-63.  Each group extends the message schedule by one
+    ** word while computing four rounds. */
+#define SHANI_GROUP(E,Eo,Mk,Mk1,Mk2,Mk3,F) \
+    Mk1 = _mm_sha1msg2_epu32(Mk1, Mk); \
+    SHANI_ROUNDS(E, Eo, Mk, F); \
+    Mk3 = _mm_sha1msg1_epu32(Mk3, Mk); \
+    Mk2 = _mm_xor_si128(Mk2, Mk);
+    SHANI_GROUP(E0, E1, MSG0, MSG1, MSG2, MSG3, 0);   /* 16-19 */
+    SHANI_GROUP(E1, E0, MSG1, MSG2, MSG3, MSG0, 1);   /* 20-23 */
+    SHANI_GROUP(E0, E1, MSG2, MSG3, MSG0, MSG1, 1);   /* 24-27 */
+    SHANI_GROUP(E1, E0, MSG3, MSG0, MSG1, MSG2, 1);   /* 28-31 */
+    SHANI_GROUP(E0, E1, MSG0, MSG1, MSG2, MSG3, 1);   /* 32-35 */
+    SHANI_GROUP(E1, E0, MSG1, MSG2, MSG3, MSG0, 1);   /* 36-39 */
+    SHANI_GROUP(E0, E1, MSG2, MSG3, MSG0, MSG1, 2);   /* 40-43 */
+    SHANI_GROUP(E1, E0, MSG3, MSG0, MSG1, MSG2, 2);   /* 44-47 */
+    SHANI_GROUP(E0, E1, MSG0, MSG1, MSG2, MSG3, 2);   /* 48-51 */
+    SHANI_GROUP(E1, E0, MSG1, MSG2, MSG3, MSG0, 2);   /* 52-55 */
+    SHANI_GROUP(E0, E1, MSG2, MSG3, MSG0, MSG1, 2);   /* 56-59 */
+    SHANI_GROUP(E1, E0, MSG3, MSG0, MSG1, MSG2, 3);   /* 60-63 */
+#undef SHANI_GROUP
+
+    /* Rounds 64-67 */
+    MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+    SHANI_ROUNDS(E0, E1, MSG0, 3);
+    MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+    MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+    /* Rounds 68-71 */
+    MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+    SHANI_ROUNDS(E1, E0, MSG1, 3);
+    MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+    /* Rounds 72-75 */
+    MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+    SHANI_ROUNDS(E0, E1, MSG2, 3);
+
+    /* Rounds 76-79 */
+    SHANI_ROUNDS(E1, E0, MSG3, 3);
+
+    /* Add the working vars back into the state */
+    E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+    ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+    data += 64;
+  }
+
+  ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+  _mm_storeu_si128((__m128i*)state, ABCD);
+  state[4] = _mm_extract_epi32(E0, 3);
+}
+#undef SHANI_ROUNDS
+#endif /* FOSSIL_HAVE_SHANI */
 
+/*
+** Select the fastest available implementation of SHA1TransformBlocks().
+*/
+static void sha1_init_hw(void){
+  SHA1TransformBlocks = SHA1TransformPortable;
+#ifdef FOSSIL_HAVE_SHANI
+  if( sha1_cpu_has_shani() && fossil_getenv("FOSSIL_NO_SHANI")==0 ){
+    SHA1TransformBlocks = SHA1TransformShani;
+  }
+#endif
+}
+
+/*
+** Return the name of the SHA1 implementation in use.
+*/
+const char *sha1_implementation(void){
+  if( SHA1TransformBlocks==0 ) sha1_init_hw();
+#ifdef FOSSIL_HAVE_SHANI
+  if( SHA1TransformBlocks==SHA1TransformShani ) return "sha-ni";
+#endif
+  return "portable";
+}
 
 /*
  * SHA1Init - Initialize new context
  */
 static void SHA1Init(SHA1Context *context){
+    if( SHA1TransformBlocks==0 ) sha1_init_hw();
     /* SHA1 initialization constants */
     context->state[0] = 0x67452301;
     context->state[1] = 0xEFCDAB89;
@@ -167,9 +359,11 @@ static void SHA1Update(
     j = (j >> 3) & 63;
     if ((j + len) > 63) {
 	(void)memcpy(&context->buffer[j], data, (i = 64-j));
-	SHA1Transform(context->state, context->buffer);
-	for ( ; i + 63 < len; i += 64)
-	    SHA1Transform(context->state, &data[i]);
+	SHA1TransformBlocks(context->state, context->buffer, 1);
+	if( i + 63 < len ){
+	    SHA1TransformBlocks(context->state, &data[i], (len-i)/64);
+	    i += ((len-i)/64)*64;
+	}
 	j = 0;
     } else {
 	i = 0;
@@ -220,8 +414,49 @@ static void DigestToBase16(unsigned char *digest, char *zBuf){
 }
 
 /*
-** The state of a incremental SHA1 checksum computation.  Only one
-** such computation can be underway at a time, of course.
+** Begin a new incremental SHA1 checksum in the caller-supplied context.
+*/
+void sha1_ctx_init(SHA1Context *p){
+  SHA1Init(p);
+}
+
+/*
+** Add nBytes of text from zText to the incremental checksum p.  If
+** nBytes is negative, zText is a zero-terminated string.
+*/
+void sha1_ctx_step(SHA1Context *p, const char *zText, int nBytes){
+  if( nBytes<=0 ){
+    if( nBytes==0 ) return;
+    nBytes = strlen(zText);
+  }
+  SHA1Update(p, (unsigned char*)zText, nBytes);
+}
+
+/*
+** Add the content of a blob to the incremental checksum p.
+*/
+void sha1_ctx_step_blob(SHA1Context *p, Blob *pIn){
+  sha1_ctx_step(p, blob_buffer(pIn), blob_size(pIn));
+}
+
+/*
+** Finish the incremental checksum p and write the result as 40
+** hexadecimal digits plus a terminator into zOut[], which must be
+** at least 41 bytes in size.  Return zOut.
+**
+** The context must be reinitialized before it is used again.
+*/
+char *sha1_ctx_finish(SHA1Context *p, char *zOut){
+  unsigned char zResult[20];
+  SHA1Final(p, zResult);
+  DigestToBase16(zResult, zOut);
+  return zOut;
+}
+
+/*
+** The state of the legacy sha1sum_step_text()/sha1sum_finish()
+** checksum.  Only one such computation can be underway at a time.
+** New code should use a caller-owned SHA1Context instead.
 */
 static SHA1Context incrCtx;
 static int incrInit = 0;
@@ -231,14 +466,10 @@ static int incrInit = 0;
 */
 void sha1sum_step_text(const char *zText, int nBytes){
   if( !incrInit ){
-    SHA1Init(&incrCtx);
+    sha1_ctx_init(&incrCtx);
     incrInit = 1;
   }
-  if( nBytes<=0 ){
-    if( nBytes==0 ) return;
-    nBytes = strlen(zText);
-  }
-  SHA1Update(&incrCtx, (unsigned char*)zText, nBytes);
+  sha1_ctx_step(&incrCtx, zText, nBytes);
 }
 
 /*
@@ -257,12 +488,10 @@ void sha1sum_step_blob(Blob *p){
 ** is overwritten by subsequent calls to this function.
 */
 char *sha1sum_finish(Blob *pOut){
-  unsigned char zResult[20];
   static char zOut[41];
   sha1sum_step_text(0,0);
-  SHA1Final(&incrCtx, zResult);
+  sha1_ctx_finish(&incrCtx, zOut);
   incrInit = 0;
-  DigestToBase16(zResult, zOut);
   if( pOut ){
     blob_zero(pOut);
     blob_append(pOut, zOut, 40);
@@ -278,12 +507,22 @@ char *sha1sum_finish(Blob *pOut){
 ** Return the number of errors.
 */
 int sha1sum_file(const char *zFilename, Blob *pCksum){
+  return sha1sum_file_ex(zFilename, file_wd_islink(zFilename), pCksum);
+}
+
+/*
+** Same as sha1sum_file() except that the caller says whether or not
+** zFilename is a symlink whose destination path is to be hashed.  This
+** routine never uses the shared results of stat(), so it is safe to
+** call from a worker thread.
+*/
+int sha1sum_file_ex(const char *zFilename, int isLink, Blob *pCksum){
   FILE *in;
   SHA1Context ctx;
   unsigned char zResult[20];
   char zBuf[10240];
 
-  if( file_wd_islink(zFilename) ){
+  if( isLink ){
     /* Instead of file content, return sha1 of link destination path */
     Blob destinationPath;
     int rc;
@@ -337,6 +576,59 @@ int sha1sum_blob(const Blob *pIn, Blob *pCksum){
   return 0;
 }
 
+/*
+** A range of blobs to be hashed by sha1sum_blob_many().
+*/
+typedef struct Sha1Range Sha1Range;
+struct Sha1Range {
+  int n;                  /* Number of blobs in the range */
+  const Blob *aIn;        /* Blobs to hash */
+  Blob *aCksum;           /* Write the checksums here */
+};
+
+/*
+** Worker routine for sha1sum_blob_many().
+*/
+static void sha1sum_range_task(void *pArg){
+  Sha1Range *p = (Sha1Range*)pArg;
+  int i;
+  for(i=0; i<p->n; i++){
+    sha1sum_blob(&p->aIn[i], &p->aCksum[i]);
+  }
+}
+
+/*
+** Compute the SHA1 checksums of the nBlob blobs in aIn[], storing the
+** results in aCksum[], which is assumed to be uninitialized.  The work is
+** divided among the threads of pPool, if pPool is not NULL.  This is
+** intended for callers such as verify and rebuild that need to hash many
+** artifacts at once.
+*/
+void sha1sum_blob_many(int nBlob, const Blob *aIn, Blob *aCksum,
+                       WorkPool *pPool){
+  int nRange = pPool ? workpool_nthread(pPool) : 0;
+  if( nRange<2 || nBlob<2*nRange ){
+    Sha1Range r;
+    r.n = nBlob;
+    r.aIn = aIn;
+    r.aCksum = aCksum;
+    sha1sum_range_task(&r);
+  }else{
+    Sha1Range *aRange = fossil_malloc(nRange*sizeof(aRange[0]));
+    int i, iFirst = 0;
+    for(i=0; i<nRange; i++){
+      int iNext = (int)(((i64)nBlob*(i+1))/nRange);
+      aRange[i].n = iNext - iFirst;
+      aRange[i].aIn = &aIn[iFirst];
+      aRange[i].aCksum = &aCksum[iFirst];
+      workpool_add(pPool, sha1sum_range_task, &aRange[i]);
+      iFirst = iNext;
+    }
+    workpool_wait(pPool);
+    free(aRange);
+  }
+}
+
 /*
 ** Compute the SHA1 checksum of a zero-terminated string.  The
 ** result is held in memory obtained from mprintf().
@@ -444,12 +736,18 @@ void sha1_shared_secret_sql_function(
 **
 ** Compute an SHA1 checksum of all files named on the command-line.
 ** If an file is named "-" then take its content from standard input.
+**
+** Options:
+**   --impl       Show which SHA1 implementation is in use
 */
 void sha1sum_test(void){
   int i;
   Blob in;
   Blob cksum;
   
+  if( find_option("impl",0,0)!=0 ){
+    fossil_print("%s\n", sha1_implementation());
+  }
   for(i=2; i<g.argc; i++){
     blob_init(&cksum, "************** not found ***************", -1);
     if( g.argv[i][0]=='-' && g.argv[i][1]==0 ){
@@ -0,0 +1,313 @@
+/*
+** Copyright (c) 2012 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*******************************************************************************
+**
+** This file implements a cache of expanded artifact content that is
+** shared by all the processes of "fossil server" or "fossil http".
+**
+** The cache in content.c lives only as long as the process that fills
+** it, which for the web server is a single request.  Expanding a long
+** delta chain is then repeated by every request that needs the same
+** artifact.  The shared cache keeps the result for the next process.
+**
+** The memory is an anonymous shared mapping that "fossil server" creates
+** before it forks, or a file next to the repository that each "fossil
+** http" process maps.  It holds a table of entries and an arena that is
+** written as a ring buffer, so the oldest content is overwritten first.
+** Entries are keyed by artifact ID (the SHA1 hash), not by record ID, so
+** that an entry can never go stale and a server for a directory of
+** repositories can share one cache between all of them.
+**
+** Readers take no lock.  Each entry has a sequence number that is odd
+** while the entry is being changed, and the arena has a count of all
+** bytes ever written to it.  A reader copies the content and then checks
+** that neither changed underneath it.  Writers hold a spin lock.
+** Unix only.
+*/
+#include "config.h"
+#include "shmcache.h"
+#if !defined(_WIN32)
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <signal.h>
+# include <errno.h>
+# include <sched.h>
+#endif
+
+#if !defined(_WIN32)
+#define SHMCACHE_MAGIC   0x46534331   /* Marks an initialized cache */
+#define SHMCACHE_NWAY    4            /* Entries that may hold an artifact */
+#define SHMCACHE_AVG     16384        /* Expected average entry size */
+
+/*
+** One cached artifact.
+*/
+struct ShmCacheEntry {
+  volatile unsigned int seq;   /* Odd while the entry is being changed */
+  int nByte;                   /* Size of the content */
+  i64 iOfst;                   /* Arena position.  See ShmCacheHdr.iWrite */
+  char zUuid[UUID_SIZE];       /* Artifact ID.  Not zero-terminated */
+};
+
+/*
+** The start of the shared memory.  The entry table and then the arena
+** follow it.
+*/
+struct ShmCacheHdr {
+  unsigned int magic;          /* SHMCACHE_MAGIC once initialized */
+  volatile int lockPid;        /* Process that holds the lock, or 0 */
+  int nEntry;                  /* Entries in the table.  A power of 2 */
+  int nArena;                  /* Bytes in the arena */
+  volatile i64 iWrite;         /* Bytes ever written to the arena */
+};
+
+static struct ShmCacheHdr *pShm = 0;         /* The shared memory */
+static struct ShmCacheEntry *aShmEntry = 0;  /* The entry table */
+static unsigned char *aShmArena = 0;         /* The arena */
+
+/*
+** Acquire the lock on the shared memory.  A lock left behind by a
+** process that died while holding it is broken.
+*/
+static void shmcache_lock(void){
+  int pid = getpid();
+  int nSpin = 0;
+  while( !__sync_bool_compare_and_swap(&pShm->lockPid, 0, pid) ){
+    if( ++nSpin>=1000 ){
+      int owner = pShm->lockPid;
+      if( owner && kill(owner, 0)<0 && errno==ESRCH ){
+        __sync_bool_compare_and_swap(&pShm->lockPid, owner, 0);
+      }
+      nSpin = 0;
+      sched_yield();
+    }
+  }
+}
+
+/*
+** Release the lock on the shared memory.
+*/
+static void shmcache_unlock(void){
+  __sync_lock_release(&pShm->lockPid);
+}
+
+/*
+** Return the first of the SHMCACHE_NWAY entries that may hold the
+** artifact zUuid.
+*/
+static int shmcache_slot(const char *zUuid){
+  unsigned int h = 2166136261u;
+  int i;
+  for(i=0; i<UUID_SIZE; i++){
+    h = (h ^ (unsigned char)zUuid[i])*16777619u;
+  }
+  return (h & (pShm->nEntry-1)) & ~(SHMCACHE_NWAY-1);
+}
+
+/*
+** Return true if the content at arena position iOfst has not yet been
+** overwritten.
+*/
+static int shmcache_live(i64 iOfst){
+  return iOfst >= pShm->iWrite - pShm->nArena;
+}
+
+/*
+** Write the artifact ID of record rid into zUuid[].  Return 0 if there
+** is no such record.
+*/
+static int shmcache_uuid(int rid, char *zUuid){
+  static Stmt q;
+  int rc = 0;
+  db_static_prepare(&q, "SELECT uuid FROM blob WHERE rid=:rid");
+  db_bind_int(&q, ":rid", rid);
+  if( db_step(&q)==SQLITE_ROW && db_column_bytes(&q, 0)==UUID_SIZE ){
+    memcpy(zUuid, db_column_text(&q, 0), UUID_SIZE);
+    rc = 1;
+  }
+  db_reset(&q);
+  return rc;
+}
+#endif
+
+/*
+** Share expanded artifact content between processes, in a cache of
+** nMByte megabytes.  If zFile is NULL, the cache is kept in memory that
+** is shared with the processes that this process forks later.  Otherwise
+** it is kept in the file zFile, shared with other processes that use the
+** same file, and the size of an existing file takes precedence.  If the
+** shared memory cannot be set up, content is not shared.
+*/
+void shmcache_init(int nMByte, const char *zFile){
+#if !defined(_WIN32)
+  void *p;
+  i64 sz = (i64)nMByte*1024*1024;
+  int nEntry;
+  if( nMByte<=0 ) return;
+  if( sz>0x40000000 ) sz = 0x40000000;
+  if( zFile==0 ){
+    p = mmap(0, sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON, -1, 0);
+  }else{
+    struct stat st;
+    struct ShmCacheHdr hdr;
+    int fd = open(zFile, O_RDWR|O_CREAT, 0644);
+    if( fd<0 ) return;
+    if( fstat(fd, &st)!=0 ){
+      close(fd);
+      return;
+    }
+    if( st.st_size>=(off_t)sizeof(hdr)
+     && pread(fd, &hdr, sizeof(hdr), 0)==sizeof(hdr)
+     && hdr.magic==SHMCACHE_MAGIC
+    ){
+      sz = st.st_size;
+    }else if( st.st_size!=sz && ftruncate(fd, sz)!=0 ){
+      close(fd);
+      return;
+    }
+    p = mmap(0, sz, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+  }
+  if( p==MAP_FAILED ) return;
+  for(nEntry=64; (i64)nEntry*2*SHMCACHE_AVG<=sz; nEntry *= 2){}
+  if( sizeof(*pShm)+nEntry*sizeof(aShmEntry[0])+SHMCACHE_AVG>sz ){
+    munmap(p, sz);
+    return;
+  }
+  pShm = (struct ShmCacheHdr *)p;
+  aShmEntry = (struct ShmCacheEntry *)&pShm[1];
+  aShmArena = (unsigned char *)&aShmEntry[nEntry];
+  shmcache_lock();
+  if( pShm->magic!=SHMCACHE_MAGIC ){
+    memset(aShmEntry, 0, nEntry*sizeof(aShmEntry[0]));
+    pShm->nEntry = nEntry;
+    pShm->nArena = (int)(sz - (aShmArena - (unsigned char *)p));
+    pShm->iWrite = 0;
+    __sync_synchronize();
+    pShm->magic = SHMCACHE_MAGIC;
+  }
+  shmcache_unlock();
+  if( pShm->nEntry!=nEntry ){
+    /* A file made by a different build.  Do not use it. */
+    munmap(p, sz);
+    pShm = 0;
+  }
+#endif
+}
+
+/*
+** If the content of record rid is in the shared cache, put a copy of
+** it into the uninitialized blob pBlob and return 1.  Otherwise return
+** 0 and leave pBlob untouched.
+*/
+int shmcache_get(int rid, Blob *pBlob){
+#if !defined(_WIN32)
+  int i, iFirst;
+  char zUuid[UUID_SIZE];
+  if( pShm==0 || !shmcache_uuid(rid, zUuid) ) return 0;
+  iFirst = shmcache_slot(zUuid);
+  for(i=iFirst; i<iFirst+SHMCACHE_NWAY; i++){
+    struct ShmCacheEntry *pE = &aShmEntry[i];
+    unsigned int seq = pE->seq;
+    int nByte;
+    i64 iOfst;
+    Blob x;
+    if( seq&1 ) continue;
+    __sync_synchronize();
+    if( memcmp(pE->zUuid, zUuid, UUID_SIZE)!=0 ) continue;
+    nByte = pE->nByte;
+    iOfst = pE->iOfst;
+    if( nByte<=0 || iOfst<0 || iOfst % pShm->nArena + nByte > pShm->nArena
+     || !shmcache_live(iOfst)
+    ){
+      continue;
+    }
+    blob_zero(&x);
+    blob_resize(&x, nByte);
+    memcpy(blob_buffer(&x), &aShmArena[iOfst % pShm->nArena], nByte);
+    __sync_synchronize();
+    if( pE->seq!=seq || !shmcache_live(iOfst) ){
+      blob_reset(&x);
+      continue;
+    }
+    *pBlob = x;
+    return 1;
+  }
+#endif
+  return 0;
+}
+
+/*
+** Add the content pBlob of record rid to the shared cache, unless it is
+** too large.  The oldest content in the arena is overwritten to make
+** room.
+*/
+void shmcache_insert(int rid, Blob *pBlob){
+#if !defined(_WIN32)
+  int nByte = blob_size(pBlob);
+  int i, iFirst, iVictim;
+  i64 iOfst, iVictimOfst;
+  struct ShmCacheEntry *pE;
+  char zUuid[UUID_SIZE];
+  if( pShm==0 || nByte==0 || nByte>pShm->nArena/8 ) return;
+  if( !shmcache_uuid(rid, zUuid) ) return;
+  iFirst = shmcache_slot(zUuid);
+  shmcache_lock();
+
+  /* Reuse the entry for this artifact if there is one, or else the
+  ** entry whose content was written first */
+  iVictim = iFirst;
+  iVictimOfst = aShmEntry[iFirst].iOfst;
+  for(i=iFirst; i<iFirst+SHMCACHE_NWAY; i++){
+    pE = &aShmEntry[i];
+    if( memcmp(pE->zUuid, zUuid, UUID_SIZE)==0 && shmcache_live(pE->iOfst) ){
+      shmcache_unlock();
+      return;
+    }
+    if( pE->nByte==0 ){
+      iVictim = i;
+      break;
+    }
+    if( pE->iOfst<iVictimOfst ){
+      iVictim = i;
+      iVictimOfst = pE->iOfst;
+    }
+  }
+
+  /* Content never wraps around the end of the arena.  Advance iWrite
+  ** before copying so that readers of the content being overwritten
+  ** notice */
+  iOfst = pShm->iWrite;
+  if( iOfst % pShm->nArena + nByte > pShm->nArena ){
+    iOfst += pShm->nArena - iOfst % pShm->nArena;
+  }
+  pShm->iWrite = iOfst + nByte;
+  __sync_synchronize();
+  memcpy(&aShmArena[iOfst % pShm->nArena], blob_buffer(pBlob), nByte);
+
+  /* Publish the entry */
+  pE = &aShmEntry[iVictim];
+  pE->seq++;
+  __sync_synchronize();
+  memcpy(pE->zUuid, zUuid, UUID_SIZE);
+  pE->nByte = nByte;
+  pE->iOfst = iOfst;
+  __sync_synchronize();
+  pE->seq++;
+  shmcache_unlock();
+#endif
+}
@@ -21,13 +21,87 @@
 #include "shun.h"
 #include <assert.h>
 
+/*
+** A Bloom filter over the UUIDs in the SHUN table, loaded on first use.
+** Almost every artifact looked up is not shunned, and the filter says
+** so without any SQL.  Only UUIDs that the filter might contain are
+** checked against the SHUN table itself.  shun_cache_reset() must be
+** called after the SHUN table is changed.
+*/
+static struct {
+  int isLoaded;             /* True if aBit[] is current */
+  unsigned int mask;        /* Number of bits in aBit[], less one */
+  unsigned char *aBit;      /* The filter */
+} shunCache;
+
+/*
+** Compute the two hashes of zUuid from which the bits of the Bloom
+** filter are chosen.
+*/
+static void shun_cache_hash(
+  const char *zUuid,
+  unsigned int *pH1,
+  unsigned int *pH2
+){
+  unsigned int h1 = 2166136261u, h2 = 5381;
+  for(; *zUuid; zUuid++){
+    h1 = (h1 ^ (unsigned char)*zUuid) * 16777619u;
+    h2 = h2*33 + (unsigned char)*zUuid;
+  }
+  *pH1 = h1;
+  *pH2 = h2 | 1;
+}
+
+/*
+** Load the Bloom filter from the SHUN table.  Three bits are set for
+** each UUID in a filter of at least 16 bits per UUID, for a false
+** positive rate of well under 1%.
+*/
+static void shun_cache_load(void){
+  Stmt q;
+  unsigned int nBit = 1024;
+  int nShun = db_int(0, "SELECT count(*) FROM shun");
+  while( nBit<(unsigned int)nShun*16 ) nBit *= 2;
+  fossil_free(shunCache.aBit);
+  shunCache.aBit = fossil_malloc(nBit/8);
+  memset(shunCache.aBit, 0, nBit/8);
+  shunCache.mask = nBit-1;
+  db_prepare(&q, "SELECT uuid FROM shun");
+  while( db_step(&q)==SQLITE_ROW ){
+    unsigned int h1, h2;
+    int i;
+    shun_cache_hash(db_column_text(&q, 0), &h1, &h2);
+    for(i=0; i<3; i++, h1+=h2){
+      shunCache.aBit[(h1&shunCache.mask)/8] |= 1<<(h1&7);
+    }
+  }
+  db_finalize(&q);
+  shunCache.isLoaded = 1;
+}
+
+/*
+** Forget the Bloom filter of shunned UUIDs, so that it is reloaded
+** the next time it is needed.  Call this after changing the SHUN table.
+*/
+void shun_cache_reset(void){
+  shunCache.isLoaded = 0;
+}
+
 /*
 ** Return true if the given artifact ID should be shunned.
 */
 int uuid_is_shunned(const char *zUuid){
   static Stmt q;
-  int rc;
+  unsigned int h1, h2;
+  int i, rc;
   if( zUuid==0 || zUuid[0]==0 ) return 0;
+  if( !shunCache.isLoaded ) shun_cache_load();
+  shun_cache_hash(zUuid, &h1, &h2);
+  for(i=0; i<3; i++, h1+=h2){
+    if( (shunCache.aBit[(h1&shunCache.mask)/8] & (1<<(h1&7)))==0 ){
+      return 0;
+    }
+  }
   db_static_prepare(&q, "SELECT 1 FROM shun WHERE uuid=:uuid");
   db_bind_text(&q, ":uuid", zUuid);
   rc = db_step(&q);
@@ -70,6 +144,7 @@ void shun_page(void){
   if( zUuid && P("sub") ){
     login_verify_csrf_secret();
     db_multi_exec("DELETE FROM shun WHERE uuid='%s'", zUuid);
+    shun_cache_reset();
     if( db_exists("SELECT 1 FROM blob WHERE uuid='%s'", zUuid) ){
       @ <p class="noMoreShun">Artifact 
       @ <a href="%s(g.zTop)/artifact/%s(zUuid)">%s(zUuid)</a> is no
@@ -88,6 +163,7 @@ void shun_page(void){
     db_multi_exec(
       "INSERT OR IGNORE INTO shun(uuid,mtime)"
       " VALUES('%s', now())", zUuid);
+    shun_cache_reset();
     @ <p class="shunned">Artifact
     @ <a href="%s(g.zTop)/artifact/%s(zUuid)">%s(zUuid)</a> has been
     @ shunned.  It will no longer be pushed.
@@ -201,6 +277,18 @@ void shun_artifacts(void){
     content_undelta(srcid);
   }
   db_finalize(&q);
+  if( db_exists("SELECT 1 FROM %s.sqlite_master WHERE name='deltacache'",
+                db_name("repository")) ){
+    db_multi_exec(
+       "DELETE FROM deltacache WHERE rid IN toshun OR srcid IN toshun;"
+    );
+  }
+  if( db_exists("SELECT 1 FROM %s.sqlite_master WHERE name='anncache'",
+                db_name("repository")) ){
+    db_multi_exec(
+       "DELETE FROM anncache WHERE mid IN toshun OR fid IN toshun;"
+    );
+  }
   db_multi_exec(
      "DELETE FROM delta WHERE rid IN toshun;"
      "DELETE FROM blob WHERE rid IN toshun;"
@@ -208,6 +296,9 @@ void shun_artifacts(void){
      "DELETE FROM private "
      " WHERE NOT EXISTS (SELECT 1 FROM blob WHERE rid=private.rid);"
   );
+  chunk_delete_unused();
+  page_cache_invalidate();
+  name_cache_clear();
 }
 
 /*
@@ -26,6 +26,7 @@
 ** WEBPAGE: stat
 **
 ** Show statistics and global information about the repository.
+** The /stat/perf page shows the performance counters instead.
 */
 void stat_page(void){
   i64 t, fsize;
@@ -37,6 +38,10 @@ void stat_page(void){
 
   login_check_credentials();
   if( !g.perm.Read ){ login_needed(); return; }
+  if( fossil_strcmp(g.zExtra, "perf")==0 ){
+    perf_page();
+    return;
+  }
   brief = P("brief")!=0;
   style_header("Repository Statistics");
   @ <table class="label-value">
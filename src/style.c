@@ -75,6 +75,18 @@ static int submenuCompare(const void *a, const void *b){
   return fossil_strcmp(A->zLabel, B->zLabel);
 }
 
+/*
+** Set up the TH1 interpreter and split the header and footer of the
+** skin into parts ahead of time.  This is done in a server process
+** that forks a new process for each request, so that the work is not
+** repeated by every request.
+*/
+void style_preload(void){
+  Th_FossilInit();
+  Th_PrepareTemplate(db_get("header", (char*)zDefaultHeader));
+  Th_PrepareTemplate(db_get("footer", (char*)zDefaultFooter));
+}
+
 /*
 ** Draw the header.
 */
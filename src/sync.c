@@ -20,6 +20,13 @@
 #include "config.h"
 #include "sync.h"
 #include <assert.h>
+#ifndef _WIN32
+# include <fcntl.h>
+# include <signal.h>
+# include <sys/types.h>
+# include <sys/wait.h>
+# include <unistd.h>
+#endif
 
 #if INTERFACE
 /*
@@ -30,6 +37,47 @@
 
 #endif /* INTERFACE */
 
+/*
+** Delays, in seconds, before each attempt of the push that follows a
+** commit when autosync is "background".
+*/
+static const int aAutosyncDelay[] = { 0, 10, 30, 60, 300 };
+
+/*
+** True if autosync() must not hand its push to a background process
+*/
+static int autosyncForeground = 0;
+
+#ifndef _WIN32
+/*
+** Start "fossil autosync-push" as a daemon that outlives this process.
+** Return true if it was started.
+*/
+static int autosync_background(void){
+  int pid, status;
+  fflush(stdout);
+  pid = fork();
+  if( pid<0 ) return 0;
+  if( pid==0 ){
+    /* The grandchild is inherited by init, so it is never a zombie */
+    int fd;
+    setsid();
+    if( fork()!=0 ) _exit(0);
+    fd = open("/dev/null", O_RDWR);
+    if( fd>=0 ){
+      dup2(fd, 0);
+      dup2(fd, 1);
+      dup2(fd, 2);
+      if( fd>2 ) close(fd);
+    }
+    execlp(fossil_nameofexe(), fossil_nameofexe(), "autosync-push", (char*)0);
+    _exit(127);
+  }
+  waitpid(pid, &status, 0);
+  return 1;
+}
+#endif
+
 /*
 ** If the respository is configured for autosyncing, then do an
 ** autosync.  This will be a pull if the argument is true or a push
@@ -69,6 +117,16 @@ int autosync(int flags){
   if( g.urlUser!=0 && g.urlPasswd==0 ){
     g.urlPasswd = mprintf("%s", zPw);
   }
+#ifndef _WIN32
+  if( flags==AUTOSYNC_PUSH && g.localOpen && !autosyncForeground
+   && fossil_strcmp(zAutosync, "background")==0
+   && autosync_background()
+  ){
+    fossil_print("Autosync:  pushing to %s in the background\n",
+                 g.urlCanonical);
+    return 0;
+  }
+#endif
 #if 0 /* Disabled for now */
   if( (flags & AUTOSYNC_PULL)!=0 && db_get_boolean("auto-shun",1) ){
     /* When doing an automatic pull, also automatically pull shuns from
@@ -88,6 +146,62 @@ int autosync(int flags){
   return rc;
 }
 
+/*
+** COMMAND: autosync-push*
+**
+** Usage: %fossil autosync-push
+**
+** Push to the autosync server, retrying a few times over several
+** minutes if the push fails.  This is what runs in the background
+** after a commit when the "autosync" setting is "background".  Its
+** progress, and a failure if every attempt fails, are recorded in the
+** checkout and shown by "fossil status".
+*/
+void autosync_push_cmd(void){
+  int i;
+  int rc = 1;
+  db_must_be_within_tree();
+  user_select();
+  autosyncForeground = 1;
+#ifndef _WIN32
+  db_lset_int("autosync-pid", getpid());
+#endif
+  for(i=0; i<count(aAutosyncDelay) && rc!=0; i++){
+    if( aAutosyncDelay[i]>0 ) sqlite3_sleep(aAutosyncDelay[i]*1000);
+    db_lset("autosync-status",
+            mprintf("push in progress, attempt %d of %d since %z", i+1,
+                    count(aAutosyncDelay),
+                    db_text(0, "SELECT datetime('now','localtime')")));
+    rc = autosync(AUTOSYNC_PUSH);
+  }
+  if( rc ){
+    db_lset("autosync-status",
+            mprintf("push failed at %z.  Run \"fossil push\"",
+                    db_text(0, "SELECT datetime('now','localtime')")));
+  }else{
+    db_multi_exec("DELETE FROM vvar WHERE name='autosync-status'");
+  }
+  db_multi_exec("DELETE FROM vvar WHERE name='autosync-pid'");
+}
+
+/*
+** Show the state of a background autosync push, if there is one, for
+** "fossil status".
+*/
+void autosync_show_status(void){
+  char *zStatus = db_lget("autosync-status", 0);
+  if( zStatus==0 ) return;
+#ifndef _WIN32
+  {
+    int pid = db_lget_int("autosync-pid", 0);
+    if( pid>0 && kill(pid, 0)!=0 ){
+      zStatus = "push interrupted.  Run \"fossil push\"";
+    }
+  }
+#endif
+  fossil_print("autosync:     %s\n", zStatus);
+}
+
 /*
 ** This routine processes the command-line argument for push, pull,
 ** and sync.  If a command-line argument is given, that is the URL
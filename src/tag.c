@@ -30,6 +30,11 @@
 ** If tagtype is 2 then the tag is being propagated from an
 ** ancestor node.  If tagtype is 0 it means a propagating tag is
 ** being blocked.
+**
+** The set of check-ins to change is computed first, by following
+** primary child links from pid until a check-in that has a tag of its
+** own, or a more recent propagated one, is reached.  The changes to
+** TAGXREF and EVENT are then made with one statement each.
 */
 static void tag_propagate(
   int pid,             /* Propagate the tag to children of this node */
@@ -39,77 +44,90 @@ static void tag_propagate(
   const char *zValue,  /* Value of the tag.  Might be NULL */
   double mtime         /* Timestamp on the tag */
 ){
-  PQueue queue;        /* Queue of check-ins to be tagged */
-  Stmt s;              /* Query the children of :pid to which to propagate */
-  Stmt ins;            /* INSERT INTO tagxref */
-  Stmt eventupdate;    /* UPDATE event */
+  static Stmt s;       /* Query the children of :pid to which to propagate */
+  static Stmt ins;     /* INSERT INTO tag_pending */
+  int *aRid;           /* Check-ins to be tagged, in the order found */
+  int nRid = 0;        /* Number of entries in aRid[] */
+  int nAlloc = 10;     /* Slots allocated for aRid[] */
+  int iNext = 0;       /* Next entry of aRid[] whose children to check */
+  int i;
 
   assert( tagType==0 || tagType==2 );
-  pqueue_init(&queue);
-  pqueue_insert(&queue, pid, 0.0, 0);
 
   /* Query for children of :pid to which to propagate the tag.
-  ** Three returns:  (1) rid of the child.  (2) timestamp of child.
-  ** (3) True to propagate or false to block.
+  ** Two returns:  (1) rid of the child.  (2) True to propagate or
+  ** false to block.
   */
-  db_prepare(&s, 
-     "SELECT cid, plink.mtime,"
-     "       coalesce(srcid=0 AND tagxref.mtime<:mtime, %d) AS doit"
-     "  FROM plink LEFT JOIN tagxref ON cid=rid AND tagid=%d"
-     " WHERE pid=:pid AND isprim",
-     tagType==2, tagid
+  db_static_prepare(&s,
+     "SELECT cid, coalesce(srcid=0 AND tagxref.mtime<:mtime, :prop)"
+     "  FROM plink LEFT JOIN tagxref ON cid=rid AND tagid=:tagid"
+     " WHERE pid=:pid AND isprim"
   );
-  db_bind_double(&s, ":mtime", mtime);
+  aRid = fossil_malloc( sizeof(aRid[0])*nAlloc );
+  while( pid!=0 ){
+    db_bind_int(&s, ":pid", pid);
+    db_bind_int(&s, ":tagid", tagid);
+    db_bind_double(&s, ":mtime", mtime);
+    db_bind_int(&s, ":prop", tagType==2);
+    while( db_step(&s)==SQLITE_ROW ){
+      if( !db_column_int(&s, 1) ) continue;
+      if( nRid>=nAlloc ){
+        nAlloc = nAlloc*2;
+        aRid = fossil_realloc(aRid, sizeof(aRid[0])*nAlloc);
+      }
+      aRid[nRid++] = db_column_int(&s, 0);
+    }
+    db_reset(&s);
+    pid = iNext<nRid ? aRid[iNext++] : 0;
+  }
+  if( nRid==0 ){
+    fossil_free(aRid);
+    return;
+  }
 
+  /* manifest_crosslink_begin() creates this table in advance, since
+  ** creating it here would expire statements that the caller has
+  ** pending, such as the artifact loop of rebuild_db(). */
+  db_multi_exec(
+    "CREATE TEMP TABLE IF NOT EXISTS tag_pending(rid INTEGER PRIMARY KEY);"
+    "DELETE FROM tag_pending;"
+  );
+  db_static_prepare(&ins, "INSERT OR IGNORE INTO tag_pending VALUES(:rid)");
+  for(i=0; i<nRid; i++){
+    db_bind_int(&ins, ":rid", aRid[i]);
+    db_step(&ins);
+    db_reset(&ins);
+    if( tagid==TAG_BRANCH ){
+      leaf_eventually_check(aRid[i]);
+    }
+  }
+  fossil_free(aRid);
   if( tagType==2 ){
-    /* Set the propagated tag marker on checkin :rid */
-    db_prepare(&ins,
+    /* Set the propagated tag marker on every pending check-in */
+    Stmt q;
+    db_prepare(&q,
        "REPLACE INTO tagxref(tagid, tagtype, srcid, origid, value, mtime, rid)"
-       "VALUES(%d,2,0,%d,%Q,:mtime,:rid)",
+       " SELECT %d,2,0,%d,%Q,:mtime,rid FROM tag_pending",
        tagid, origId, zValue
     );
-    db_bind_double(&ins, ":mtime", mtime);
+    db_bind_double(&q, ":mtime", mtime);
+    db_step(&q);
+    db_finalize(&q);
   }else{
-    /* Remove all references to the tag from checkin :rid */
+    /* Remove all references to the tag from every pending check-in */
     zValue = 0;
-    db_prepare(&ins,
-       "DELETE FROM tagxref WHERE tagid=%d AND rid=:rid", tagid
+    db_multi_exec(
+       "DELETE FROM tagxref WHERE tagid=%d"
+       "   AND rid IN (SELECT rid FROM tag_pending)", tagid
     );
   }
   if( tagid==TAG_BGCOLOR ){
-    db_prepare(&eventupdate,
-      "UPDATE event SET bgcolor=%Q WHERE objid=:rid", zValue
+    db_multi_exec(
+      "UPDATE event SET bgcolor=%Q"
+      " WHERE objid IN (SELECT rid FROM tag_pending)", zValue
     );
   }
-  while( (pid = pqueue_extract(&queue, 0))!=0 ){
-    db_bind_int(&s, ":pid", pid);
-    while( db_step(&s)==SQLITE_ROW ){
-      int doit = db_column_int(&s, 2);
-      if( doit ){
-        int cid = db_column_int(&s, 0);
-        double mtime = db_column_double(&s, 1);
-        pqueue_insert(&queue, cid, mtime, 0);
-        db_bind_int(&ins, ":rid", cid);
-        db_step(&ins);
-        db_reset(&ins);
-        if( tagid==TAG_BGCOLOR ){
-          db_bind_int(&eventupdate, ":rid", cid);
-          db_step(&eventupdate);
-          db_reset(&eventupdate);
-        }
-        if( tagid==TAG_BRANCH ){
-          leaf_eventually_check(cid);
-        }
-      }
-    }
-    db_reset(&s);
-  }
-  pqueue_clear(&queue);
-  db_finalize(&ins);
-  db_finalize(&s);
-  if( tagid==TAG_BGCOLOR ){
-    db_finalize(&eventupdate);
-  }
+  db_multi_exec("DELETE FROM tag_pending");
 }
 
 /*
@@ -189,7 +207,11 @@ int tag_insert(
   db_bind_double(&s, ":mtime", mtime);
   db_step(&s);
   db_finalize(&s);
-  if( tagid==TAG_BRANCH ) leaf_eventually_check(rid);
+  name_cache_clear();
+  if( tagid==TAG_BRANCH || tagid==TAG_CLOSED ) leaf_eventually_check(rid);
+  if( tagtype>0 && fossil_strcmp(zTag, "sym-release")==0 ){
+    archive_cache_add_release(rid);
+  }
   if( tagtype==0 ){
     zValue = 0;
   }
@@ -223,12 +245,16 @@ int tag_insert(
     }
   }
   if( tagid==TAG_DATE ){
+    char *zRid = mprintf("%d", rid);
     db_multi_exec("UPDATE event "
                   "   SET mtime=julianday(%Q),"
                   "       omtime=coalesce(omtime,mtime)"
                   " WHERE objid=%d",
                   zValue, rid);
+    filehist_update_mtime(zRid);
+    fossil_free(zRid);
   }
+  if( tagid==TAG_COMMENT || tagid==TAG_DATE ) search_index_note(rid);
   if( tagtype==1 ) tagtype = 0;
   tag_propagate(rid, tagid, tagtype, rid, zValue, mtime);
   return tagid;
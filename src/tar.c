@@ -44,9 +44,10 @@ static struct tarball_t {
 /*
 ** Begin the process of generating a tarball.
 **
-** Initialize the GZIP compressor and the table of directory names.
+** Initialize the GZIP compressor, at zlib compression level "level",
+** and the table of directory names.
 */
-static void tar_begin(sqlite3_int64 mTime){
+static void tar_begin(sqlite3_int64 mTime, int level){
   assert( tball.aHdr==0 );
   tball.aHdr = fossil_malloc(512+512);
   memset(tball.aHdr, 0, 512+512);
@@ -62,7 +63,7 @@ static void tar_begin(sqlite3_int64 mTime){
   memcpy(&tball.aHdr[257], "ustar\00000", 8);  /* POSIX.1 format */
   memcpy(&tball.aHdr[265], "nobody", 7);   /* Owner name */
   memcpy(&tball.aHdr[297], "nobody", 7);   /* Group name */
-  gzip_begin(mTime);
+  gzip_begin(mTime, level);
   db_multi_exec(
     "CREATE TEMP TABLE dir(name UNIQUE);"
   );
@@ -397,15 +398,37 @@ static void tar_add_file(
   }
 }
 
+/*
+** If the tarball is being sent as the reply to an HTTP request (pOut
+** is NULL) then pass the compressed output generated so far on to the
+** CGI reply, which sends it to the client once enough has accumulated,
+** or to the file chosen by archive_output_to().
+*/
+static void tar_drain(Blob *pOut){
+  if( pOut==0 ){
+    Blob part;
+    blob_zero(&part);
+    gzip_drain(&part);
+    archive_output(&part);
+  }
+}
+
 /*
 ** Finish constructing the tarball.  Put the content of the tarball
-** in Blob pOut.
+** in Blob pOut, or pass the rest of it to archive_output() if pOut
+** is NULL.
 */
 static void tar_finish(Blob *pOut){
   db_multi_exec("DROP TABLE dir");
   gzip_step(tball.zSpaces, 512);
   gzip_step(tball.zSpaces, 512);
-  gzip_finish(pOut);
+  if( pOut ){
+    gzip_finish(pOut);
+  }else{
+    Blob tail;
+    gzip_finish(&tail);
+    archive_output(&tail);
+  }
   fossil_free(tball.aHdr);
   tball.aHdr = 0;
   fossil_free(tball.zPrevDir);
@@ -429,7 +452,7 @@ void test_tarball_cmd(void){
     usage("ARCHIVE FILE....");
   }
   sqlite3_open(":memory:", &g.db);
-  tar_begin(0);
+  tar_begin(0, 9);
   for(i=3; i<g.argc; i++){
     blob_zero(&file);
     blob_read_from_file(&file, g.argv[i]);
@@ -452,6 +475,12 @@ void test_tarball_cmd(void){
 ** If the RID object does not exist in the repository, then
 ** pTar is zeroed.
 **
+** If pTar is NULL, the tarball becomes the content of the CGI reply
+** and is sent to the client file by file as it is generated, so that
+** the whole archive never has to be held in memory.  The caller should
+** set the content type and call cgi_allow_incremental_reply() first.
+** The tarball goes to a file instead if archive_output_to() chose one.
+**
 ** zDir is a "synthetic" subdirectory which all files get
 ** added to as part of the tarball. It may be 0 or an empty string, in
 ** which case it is ignored. The intention is to create a tarball which
@@ -470,7 +499,7 @@ void tarball_of_checkin(int rid, Blob *pTar, const char *zDir){
 
   content_get(rid, &mfile);
   if( blob_size(&mfile)==0 ){
-    blob_zero(pTar);
+    if( pTar ) blob_zero(pTar);
     return;
   }
   blob_zero(&hash);
@@ -484,7 +513,7 @@ void tarball_of_checkin(int rid, Blob *pTar, const char *zDir){
   pManifest = manifest_get(rid, CFTYPE_MANIFEST);
   if( pManifest ){
     mTime = (pManifest->rDate - 2440587.5)*86400.0;
-    tar_begin(mTime);
+    tar_begin(mTime, archive_level());
     if( db_get_boolean("manifest", 0) ){
       blob_append(&filename, "manifest", -1);
       zName = blob_str(&filename);
@@ -508,6 +537,7 @@ void tarball_of_checkin(int rid, Blob *pTar, const char *zDir){
         zName = blob_str(&filename);
         tar_add_file(zName, &file, manifest_file_mperm(pFile), mTime);
         blob_reset(&file);
+        tar_drain(pTar);
       }
     }
   }else{
@@ -515,7 +545,7 @@ void tarball_of_checkin(int rid, Blob *pTar, const char *zDir){
     blob_append(&filename, blob_str(&hash), 16);
     zName = blob_str(&filename);
     mTime = db_int64(0, "SELECT (julianday('now') -  2440587.5)*86400.0;");
-    tar_begin(mTime);
+    tar_begin(mTime, archive_level());
     tar_add_file(zName, &mfile, 0, mTime);
   }
   manifest_destroy(pManifest);
@@ -572,7 +602,6 @@ void tarball_page(void){
   int rid;
   char *zName, *zRid;
   int nName, nRid;
-  Blob tarball;
 
   login_check_credentials();
   if( !g.perm.Zip ){ login_needed(); return; }
@@ -600,9 +629,11 @@ void tarball_page(void){
     return;
   }
   if( nRid==0 && nName>10 ) zName[10] = 0;
-  tarball_of_checkin(rid, &tarball, zName);
+  cgi_set_content_type("application/x-compressed");
+  if( !archive_cache_reply(rid, "tar.gz", zName, tarball_of_checkin) ){
+    cgi_allow_incremental_reply();
+    tarball_of_checkin(rid, 0, zName);
+  }
   free( zName );
   free( zRid );
-  cgi_set_content(&tarball);
-  cgi_set_content_type("application/x-compressed");
 }
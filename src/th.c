@@ -11,6 +11,14 @@
 typedef struct Th_Command   Th_Command;
 typedef struct Th_Frame     Th_Frame;
 typedef struct Th_Variable  Th_Variable;
+typedef struct Th_Script    Th_Script;
+typedef struct ThCmd        ThCmd;
+typedef struct ThWord       ThWord;
+
+/*
+** Maximum number of parsed scripts kept in Th_Interp.paScript.
+*/
+#define TH_MX_SCRIPT 1000
 
 /*
 ** Interpreter structure.
@@ -22,6 +30,9 @@ struct Th_Interp {
   Th_Hash *paCmd;     /* Table of registered commands */
   Th_Frame *pFrame;   /* Current execution frame */
   int isListMode;     /* True if thSplitList() should operate in "list" mode */
+  Th_Hash *paScript;  /* Parsed scripts. See thEvalLocal() */
+  int nScript;        /* Number of entries in paScript */
+  int iCmdGen;        /* Incremented when commands are added or removed */
 };
 
 /*
@@ -91,13 +102,22 @@ struct Th_Variable {
 
 /*
 ** Hash table API:
+**
+** The number of slots in a hash table is a power of two that doubles
+** whenever the table holds as many entries as it has slots, starting
+** at TH_HASHSIZE once the first entry is added. Each entry keeps the
+** full hash of its key, so that growing the table and walking a chain
+** do not need to look at the keys themselves.
 */
-#define TH_HASHSIZE 257
+#define TH_HASHSIZE 8
 struct Th_Hash {
-  Th_HashEntry *a[TH_HASHSIZE];
+  int nEntry;                 /* Number of entries in the table */
+  int nSlot;                  /* Number of slots in a[] (power of two) */
+  Th_HashEntry **a;           /* Hash chains. 0 while the table is empty */
 };
 
 static int thEvalLocal(Th_Interp *, const char *, int);
+static void thFreeScript(Th_HashEntry*, void*);
 static int thSplitList(Th_Interp*, const char*, int, char***, int **, int*);
 
 static int thHexdigit(char c);
@@ -291,6 +311,16 @@ static void thFreeCommand(Th_HashEntry *pEntry, void *pContext){
   pEntry->pData = 0;
 }
 
+/*
+** Argument pEntry points to an entry in the parsed script hash table
+** (Th_Interp.paScript). Free the Th_Script structure that the entry
+** points to.
+*/
+static void thFreeScript(Th_HashEntry *pEntry, void *pContext){
+  Th_Free((Th_Interp *)pContext, pEntry->pData);
+  pEntry->pData = 0;
+}
+
 /*
 ** Push a new frame onto the stack.
 */
@@ -697,6 +727,40 @@ static int thEndOfLine(const char *zInput, int nInput){
   return ((i==nInput || zInput[i]=='\n')?1:0);
 }
 
+/*
+** Buffer pStr contains nCount nul-terminated strings and buffer pLen
+** contains their lengths, as built up by thSplitList(). Copy them to a
+** single allocation and set *pazElem and *panElem to the arrays of
+** strings and lengths. The caller frees *pazElem using Th_Free().
+*/
+static void thBuildList(
+  Th_Interp *interp,
+  Buffer *pStr,
+  Buffer *pLen,
+  int nCount,
+  char ***pazElem,
+  int **panElem
+){
+  int i;
+  char *zElem; 
+  int *anElem;
+  char **azElem = Th_Malloc(interp,
+    sizeof(char*) * nCount +      /* azElem */
+    sizeof(int) * nCount +         /* anElem */
+    pStr->nBuf                     /* space for list element strings */
+  );
+  anElem = (int *)&azElem[nCount];
+  zElem = (char *)&anElem[nCount];
+  memcpy(anElem, pLen->zBuf, pLen->nBuf);
+  memcpy(zElem, pStr->zBuf, pStr->nBuf);
+  for(i=0; i<nCount;i++){
+    azElem[i] = zElem;
+    zElem += (anElem[i] + 1);
+  }
+  *pazElem = azElem;
+  *panElem = anElem;
+}
+
 /*
 ** This function splits the supplied th1 list (contained in buffer zList,
 ** size nList) into elements and performs word-substitution on each
@@ -774,24 +838,7 @@ static int thSplitList(
 
   assert((pazElem && panElem) || (!pazElem && !panElem));
   if( pazElem && rc==TH_OK ){
-    int i;
-    char *zElem; 
-    int *anElem;
-    char **azElem = Th_Malloc(interp,
-      sizeof(char*) * nCount +      /* azElem */
-      sizeof(int) * nCount +         /* anElem */
-      strbuf.nBuf                    /* space for list element strings */
-    );
-    anElem = (int *)&azElem[nCount];
-    zElem = (char *)&anElem[nCount];
-    memcpy(anElem, lenbuf.zBuf, lenbuf.nBuf);
-    memcpy(zElem, strbuf.zBuf, strbuf.nBuf);
-    for(i=0; i<nCount;i++){
-      azElem[i] = zElem;
-      zElem += (anElem[i] + 1);
-    }
-    *pazElem = azElem;
-    *panElem = anElem;
+    thBuildList(interp, &strbuf, &lenbuf, nCount, pazElem, panElem);
   }
   if( pnCount ){
     *pnCount = nCount;
@@ -804,16 +851,304 @@ static int thSplitList(
 }
 
 /*
-** Evaluate the th1 script contained in the string (zProgram, nProgram)
-** in the current stack frame.
+** A th1 script that has been split into commands and words. Scripts
+** such as loop bodies and proc bodies are evaluated many times, so the
+** first time a script is evaluated the result of parsing it is saved
+** in the Th_Interp.paScript hash table, keyed by the text of the script.
+** Later evaluations of the same text use the saved parse and only have
+** to perform substitution on those words that need it.
+**
+** Offsets in the ThCmd and ThWord structures are relative to the start
+** of the script text.
+**
+** If the command name is a literal, ThCmd.pCommand remembers what the
+** name resolved to the last time the command was run. It may be used
+** for as long as Th_Interp.iCmdGen is still equal to ThCmd.iCmdGen.
+*/
+struct ThCmd {
+  int iFirst;                 /* Offset of the command text */
+  int nText;                  /* Bytes of command text */
+  int iWord;                  /* Index of first word in Th_Script.aWord */
+  int nWord;                  /* Number of words in the command */
+  int isEmptyLast;            /* True if the text ends with white-space */
+  Th_Command *pCommand;       /* Command last called here, or 0 */
+  int iCmdGen;                /* Th_Interp.iCmdGen when pCommand was set */
+};
+struct ThWord {
+  int iOff;                   /* Offset of the word */
+  int n;                      /* Bytes in the word */
+  int isLiteral;              /* True if (iOff, n) needs no substitution */
+  int hasCmd;                 /* True if the word contains a "[" */
+};
+struct Th_Script {
+  int nCmd;                   /* Number of commands */
+  ThCmd *aCmd;                /* The commands */
+  ThWord *aWord;              /* Words of all commands */
+};
+
+/*
+** Split the th1 script (zProgram, nProgram) into commands and words in
+** exactly the way that thEvalText() and thSplitList() do. If successful,
+** set *ppScript to the result, which the caller must eventually free
+** using Th_Free(), and return TH_OK. If the script contains a parse
+** error return TH_ERROR. The interpreter result is not modified.
 */
-static int thEvalLocal(Th_Interp *interp, const char *zProgram, int nProgram){
+static int thCompile(
+  Th_Interp *interp,
+  const char *zProgram,
+  int nProgram,
+  Th_Script **ppScript
+){
   int rc = TH_OK;
   const char *zInput = zProgram;
   int nInput = nProgram;
+  Buffer cmdbuf;
+  Buffer wordbuf;
+
+  thBufferInit(&cmdbuf);
+  thBufferInit(&wordbuf);
 
   while( rc==TH_OK && nInput ){
+    int nSpace;
+    const char *zFirst;
+    const char *zWord;
+    ThCmd cmd;
+
+    if( *zInput==';' ){
+      zInput++;
+      nInput--;
+    }
+    thNextSpace(interp, zInput, nInput, &nSpace);
+    zInput += nSpace;
+    nInput -= nSpace;
+    zFirst = zInput;
+
+    if( nInput>0 && zInput[0]=='#' ){
+      while( !thEndOfLine(zInput, nInput) ){
+        zInput++;
+        nInput--;
+      }
+      continue;
+    }
+
+    while( rc==TH_OK && *zInput!=';' && !thEndOfLine(zInput, nInput) ){
+      int nWord=0;
+      thNextSpace(interp, zInput, nInput, &nSpace);
+      rc = thNextWord(interp, &zInput[nSpace], nInput-nSpace, &nWord, 1);
+      zInput += (nSpace+nWord);
+      nInput -= (nSpace+nWord);
+    }
+    if( rc!=TH_OK ) break;
+
+    /* Split the command into words the same way as thSplitList(). */
+    cmd.iFirst = zFirst-zProgram;
+    cmd.nText = zInput-zFirst;
+    cmd.iWord = wordbuf.nBuf/sizeof(ThWord);
+    cmd.nWord = 0;
+    cmd.isEmptyLast = 0;
+    cmd.pCommand = 0;
+    cmd.iCmdGen = 0;
+    for(zWord=zFirst; rc==TH_OK && zWord<zInput; ){
+      ThWord word;
+      int nWord;
+      int i;
+      thNextSpace(interp, zWord, zInput-zWord, &nSpace);
+      zWord += nSpace;
+      rc = thNextWord(interp, zWord, zInput-zWord, &nWord, 0);
+      if( rc!=TH_OK ) break;
+      if( nWord==0 ){
+        cmd.isEmptyLast = 1;
+        break;
+      }
+      word.iOff = zWord-zProgram;
+      word.n = nWord;
+      word.isLiteral = 0;
+      word.hasCmd = memchr(zWord, '[', nWord)!=0;
+      if( nWord>1 && zWord[0]=='{' && zWord[nWord-1]=='}' ){
+        word.iOff++;
+        word.n -= 2;
+        word.isLiteral = 1;
+      }else{
+        if( nWord>1 && zWord[0]=='"' && zWord[nWord-1]=='"' ){
+          word.iOff++;
+          word.n -= 2;
+        }
+        for(i=0; i<word.n; i++){
+          char c = zProgram[word.iOff+i];
+          if( c=='\\' || c=='[' || c=='$' ) break;
+        }
+        if( i==word.n ){
+          word.isLiteral = 1;
+        }else{
+          word.iOff = zWord-zProgram;
+          word.n = nWord;
+        }
+      }
+      thBufferWrite(interp, &wordbuf, &word, sizeof(word));
+      cmd.nWord++;
+      zWord += nWord;
+    }
+    if( rc==TH_OK && cmd.nWord>0 ){
+      thBufferWrite(interp, &cmdbuf, &cmd, sizeof(cmd));
+    }
+  }
+
+  if( rc==TH_OK ){
+    Th_Script *p = Th_Malloc(interp,
+        sizeof(Th_Script) + cmdbuf.nBuf + wordbuf.nBuf);
+    p->nCmd = cmdbuf.nBuf/sizeof(ThCmd);
+    p->aCmd = (ThCmd *)&p[1];
+    p->aWord = (ThWord *)&p->aCmd[p->nCmd];
+    memcpy(p->aCmd, cmdbuf.zBuf, cmdbuf.nBuf);
+    memcpy(p->aWord, wordbuf.zBuf, wordbuf.nBuf);
+    *ppScript = p;
+  }
+  thBufferFree(interp, &cmdbuf);
+  thBufferFree(interp, &wordbuf);
+  return rc;
+}
+
+/*
+** Invoke the command named by argv[0] with the arguments in argv and
+** argl. If an error occurs, add the command text (zCmd, nCmd) to the
+** stack trace report.
+**
+** If pSite is not 0, it is a parsed command whose name is the literal
+** argv[0]. The command is then looked up through pSite->pCommand if
+** that is still valid, and pSite->pCommand is set otherwise.
+*/
+static int thCallCommand(
+  Th_Interp *interp,
+  ThCmd *pSite,
+  int argc,
+  char **argv,
+  int *argl,
+  const char *zCmd,
+  int nCmd
+){
+  int rc = TH_OK;
+  Th_Command *p = 0;
+
+  /* Look up the command name in the command hash-table. */
+  if( pSite && pSite->pCommand && pSite->iCmdGen==interp->iCmdGen ){
+    p = pSite->pCommand;
+  }else{
     Th_HashEntry *pEntry;
+    pEntry = Th_HashFind(interp, interp->paCmd, argv[0], argl[0], 0);
+    if( !pEntry ){
+      Th_ErrorMessage(interp, "no such command: ", argv[0], argl[0]);
+      rc = TH_ERROR;
+    }else{
+      p = (Th_Command *)(pEntry->pData);
+      if( pSite ){
+        pSite->pCommand = p;
+        pSite->iCmdGen = interp->iCmdGen;
+      }
+    }
+  }
+
+  /* Call the command procedure. */
+  if( rc==TH_OK ){
+    const char **azArg = (const char **)argv;
+    rc = p->xProc(interp, p->pContext, argc, azArg, argl);
+  }
+
+  /* If an error occured, add this command to the stack trace report. */
+  if( rc==TH_ERROR ){
+    char *zRes;
+    int nRes;
+    char *zStack = 0;
+    int nStack = 0;
+
+    zRes = Th_TakeResult(interp, &nRes);
+    if( TH_OK==Th_GetVar(interp, (char *)"::th_stack_trace", -1) ){
+      zStack = Th_TakeResult(interp, &nStack);
+    }
+    Th_ListAppend(interp, &zStack, &nStack, zCmd, nCmd);
+    Th_SetVar(interp, (char *)"::th_stack_trace", -1, zStack, nStack);
+    Th_SetResult(interp, zRes, nRes);
+    Th_Free(interp, zRes);
+    Th_Free(interp, zStack);
+  }
+  return rc;
+}
+
+/*
+** Evaluate the script zProgram, which has already been split into
+** commands and words by thCompile(), in the current stack frame.
+*/
+static int thEvalScript(
+  Th_Interp *interp,
+  Th_Script *pScript,
+  const char *zProgram
+){
+  int rc = TH_OK;
+  int i;
+
+  for(i=0; rc==TH_OK && i<pScript->nCmd; i++){
+    ThCmd *pCmd = &pScript->aCmd[i];
+    Buffer strbuf;
+    Buffer lenbuf;
+    ThWord *pStale = 0;
+    char **argv;
+    int *argl;
+    int j;
+
+    /* thSplitList() leaves the value of each word it substitutes in the
+    ** interpreter result. That value can be seen by a command
+    ** substitution that evaluates no commands and by commands that do
+    ** not set a result, so literal words that are skipped here are
+    ** copied into the result when that might matter. */
+    thBufferInit(&strbuf);
+    thBufferInit(&lenbuf);
+    for(j=0; rc==TH_OK && j<pCmd->nWord; j++){
+      ThWord *pWord = &pScript->aWord[pCmd->iWord+j];
+      const char *zWord = &zProgram[pWord->iOff];
+      int nWord = pWord->n;
+      if( pWord->isLiteral ){
+        pStale = pWord;
+      }else{
+        if( pStale && pWord->hasCmd ){
+          Th_SetResult(interp, &zProgram[pStale->iOff], pStale->n);
+        }
+        pStale = 0;
+        rc = thSubstWord(interp, zWord, nWord);
+        if( rc!=TH_OK ) break;
+        zWord = Th_GetResult(interp, &nWord);
+      }
+      thBufferWrite(interp, &strbuf, zWord, nWord);
+      thBufferWrite(interp, &strbuf, "\0", 1);
+      thBufferWrite(interp, &lenbuf, &nWord, sizeof(int));
+    }
+    if( rc==TH_OK ){
+      if( pCmd->isEmptyLast ){
+        Th_SetResult(interp, 0, 0);
+      }else if( pStale ){
+        Th_SetResult(interp, &zProgram[pStale->iOff], pStale->n);
+      }
+      thBuildList(interp, &strbuf, &lenbuf, pCmd->nWord, &argv, &argl);
+      rc = thCallCommand(interp,
+                         pScript->aWord[pCmd->iWord].isLiteral ? pCmd : 0,
+                         pCmd->nWord, argv, argl,
+                         &zProgram[pCmd->iFirst], pCmd->nText);
+      Th_Free(interp, argv);
+    }
+    thBufferFree(interp, &strbuf);
+    thBufferFree(interp, &lenbuf);
+  }
+  return rc;
+}
+
+/*
+** Evaluate the th1 script contained in the string (zProgram, nProgram)
+** in the current stack frame, parsing it as it goes.
+*/
+static int thEvalText(Th_Interp *interp, const char *zProgram, int nProgram){
+  int rc = TH_OK;
+  const char *zInput = zProgram;
+  int nInput = nProgram;
+
+  while( rc==TH_OK && nInput ){
     int nSpace;
     const char *zFirst;
 
@@ -863,38 +1198,7 @@ static int thEvalLocal(Th_Interp *interp, const char *zProgram, int nProgram){
     if( rc!=TH_OK ) continue;
 
     if( argc>0 ){
-
-      /* Look up the command name in the command hash-table. */
-      pEntry = Th_HashFind(interp, interp->paCmd, argv[0], argl[0], 0);
-      if( !pEntry ){
-        Th_ErrorMessage(interp, "no such command: ", argv[0], argl[0]);
-        rc = TH_ERROR;
-      }
-
-      /* Call the command procedure. */
-      if( rc==TH_OK ){
-        Th_Command *p = (Th_Command *)(pEntry->pData);
-        const char **azArg = (const char **)argv;
-        rc = p->xProc(interp, p->pContext, argc, azArg, argl);
-      }
-  
-      /* If an error occured, add this command to the stack trace report. */
-      if( rc==TH_ERROR ){
-        char *zRes;
-        int nRes;
-        char *zStack = 0;
-        int nStack = 0;
-  
-        zRes = Th_TakeResult(interp, &nRes);
-        if( TH_OK==Th_GetVar(interp, (char *)"::th_stack_trace", -1) ){
-          zStack = Th_TakeResult(interp, &nStack);
-        }
-        Th_ListAppend(interp, &zStack, &nStack, zFirst, zInput-zFirst);
-        Th_SetVar(interp, (char *)"::th_stack_trace", -1, zStack, nStack);
-        Th_SetResult(interp, zRes, nRes);
-        Th_Free(interp, zRes);
-        Th_Free(interp, zStack);
-      }
+      rc = thCallCommand(interp, 0, argc, argv, argl, zFirst, zInput-zFirst);
     }
 
     Th_Free(interp, argv);
@@ -903,6 +1207,37 @@ static int thEvalLocal(Th_Interp *interp, const char *zProgram, int nProgram){
   return rc;
 }
 
+/*
+** Evaluate the th1 script contained in the string (zProgram, nProgram)
+** in the current stack frame.
+**
+** The parse of the script is looked up in, or added to, the
+** Th_Interp.paScript cache. Scripts that contain a parse error are not
+** cached, so that the error is reported exactly as before. Once the
+** cache holds TH_MX_SCRIPT scripts, other scripts are parsed each time
+** they are evaluated.
+*/
+static int thEvalLocal(Th_Interp *interp, const char *zProgram, int nProgram){
+  Th_HashEntry *pEntry;
+  Th_Script *pScript = 0;
+
+  if( nProgram==0 ) return TH_OK;
+  pEntry = Th_HashFind(interp, interp->paScript, zProgram, nProgram, 0);
+  if( pEntry ){
+    pScript = (Th_Script *)pEntry->pData;
+  }else if( interp->nScript<TH_MX_SCRIPT
+         && thCompile(interp, zProgram, nProgram, &pScript)==TH_OK
+  ){
+    pEntry = Th_HashFind(interp, interp->paScript, zProgram, nProgram, 1);
+    pEntry->pData = (void *)pScript;
+    interp->nScript++;
+  }
+  if( pScript ){
+    return thEvalScript(interp, pScript, zProgram);
+  }
+  return thEvalText(interp, zProgram, nProgram);
+}
+
 /*
 ** Interpret an integer frame identifier passed to either Th_Eval() or
 ** Th_LinkVar(). If successful, return a pointer to the identified
@@ -1411,6 +1746,7 @@ int Th_CreateCommand(
   pCommand->pContext = pContext;
   pCommand->xDel = xDel;
   pEntry->pData = (void *)pCommand;
+  interp->iCmdGen++;
  
   return TH_OK;
 }
@@ -1456,6 +1792,7 @@ int Th_RenameCommand(
   }
 
   Th_HashFind(interp, interp->paCmd, zName, nName, -1);
+  interp->iCmdGen++;
   return TH_OK;
 }
 
@@ -1650,6 +1987,10 @@ void Th_DeleteInterp(Th_Interp *interp){
   Th_HashIterate(interp, interp->paCmd, thFreeCommand, (void *)interp);
   Th_HashDelete(interp, interp->paCmd);
 
+  /* Delete all parsed scripts. */
+  Th_HashIterate(interp, interp->paScript, thFreeScript, (void *)interp);
+  Th_HashDelete(interp, interp->paScript);
+
   /* Delete the interpreter structure itself. */
   Th_Free(interp, (void *)interp);
 }
@@ -1665,6 +2006,7 @@ Th_Interp * Th_CreateInterp(Th_Vtab *pVtab){
   memset(p, 0, sizeof(Th_Interp));
   p->pVtab = pVtab;
   p->paCmd = Th_HashNew(p);
+  p->paScript = Th_HashNew(p);
   thPushFrame(p, (Th_Frame *)&p[1]);
 
   return p;
@@ -2179,7 +2521,7 @@ void Th_HashIterate(
   void *pContext
 ){
   int i;
-  for(i=0; i<TH_HASHSIZE; i++){
+  for(i=0; i<pHash->nSlot; i++){
     Th_HashEntry *pEntry;
     Th_HashEntry *pNext;
     for(pEntry=pHash->a[i]; pEntry; pEntry=pNext){
@@ -2202,10 +2544,45 @@ static void xFreeHashEntry(Th_HashEntry *pEntry, void *pContext){
 void Th_HashDelete(Th_Interp *interp, Th_Hash *pHash){
   if( pHash ){
     Th_HashIterate(interp, pHash, xFreeHashEntry, (void *)interp);
+    Th_Free(interp, pHash->a);
     Th_Free(interp, pHash);
   }
 }
 
+/*
+** Return the hash of the key (zKey, nKey).
+*/
+static unsigned int thHashKey(const char *zKey, int nKey){
+  unsigned int iHash = 2166136261u;
+  int i;
+  for(i=0; i<nKey; i++){
+    iHash = (iHash ^ (unsigned char)zKey[i]) * 16777619u;
+  }
+  return iHash;
+}
+
+/*
+** Resize the hash table pHash to have nSlot slots.
+*/
+static void thHashResize(Th_Interp *interp, Th_Hash *pHash, int nSlot){
+  Th_HashEntry **aNew;
+  int i;
+  aNew = (Th_HashEntry **)Th_Malloc(interp, sizeof(aNew[0])*nSlot);
+  for(i=0; i<pHash->nSlot; i++){
+    Th_HashEntry *pEntry;
+    Th_HashEntry *pNext;
+    for(pEntry=pHash->a[i]; pEntry; pEntry=pNext){
+      int iSlot = pEntry->iHash & (nSlot-1);
+      pNext = pEntry->pNext;
+      pEntry->pNext = aNew[iSlot];
+      aNew[iSlot] = pEntry;
+    }
+  }
+  Th_Free(interp, pHash->a);
+  pHash->a = aNew;
+  pHash->nSlot = nSlot;
+}
+
 /*
 ** This function is used to insert or delete hash table items, or to 
 ** query a hash table for an existing item.
@@ -2227,39 +2604,49 @@ Th_HashEntry *Th_HashFind(
   int nKey,
   int op                      /* -ve = delete, 0 = find, +ve = insert */
 ){
-  unsigned int iKey = 0;
-  int i;
-  Th_HashEntry *pRet;
-  Th_HashEntry **ppRet;
+  unsigned int iHash;
+  int iSlot;
+  Th_HashEntry *pRet = 0;
+  Th_HashEntry **ppRet = 0;
 
   if( nKey<0 ){
     nKey = th_strlen(zKey);
   }
+  iHash = thHashKey(zKey, nKey);
 
-  for(i=0; i<nKey; i++){
-    iKey = (iKey<<3) ^ iKey ^ zKey[i];
-  }
-  iKey = iKey % TH_HASHSIZE;
-
-  for(ppRet=&pHash->a[iKey]; (pRet=*ppRet); ppRet=&pRet->pNext){
-    assert( pRet && ppRet && *ppRet==pRet );
-    if( pRet->nKey==nKey && 0==memcmp(pRet->zKey, zKey, nKey) ) break;
+  if( pHash->nSlot>0 ){
+    iSlot = iHash & (pHash->nSlot-1);
+    for(ppRet=&pHash->a[iSlot]; (pRet=*ppRet); ppRet=&pRet->pNext){
+      assert( pRet && ppRet && *ppRet==pRet );
+      if( pRet->iHash==iHash && pRet->nKey==nKey
+       && 0==memcmp(pRet->zKey, zKey, nKey)
+      ){
+        break;
+      }
+    }
   }
 
   if( op<0 && pRet ){
     assert( ppRet && *ppRet==pRet );
     *ppRet = pRet->pNext;
     Th_Free(interp, pRet);
+    pHash->nEntry--;
     pRet = 0;
   }
 
   if( op>0 && !pRet ){
+    if( pHash->nEntry>=pHash->nSlot ){
+      thHashResize(interp, pHash, pHash->nSlot ? pHash->nSlot*2 : TH_HASHSIZE);
+    }
+    iSlot = iHash & (pHash->nSlot-1);
     pRet = (Th_HashEntry *)Th_Malloc(interp, sizeof(Th_HashEntry) + nKey);
     pRet->zKey = (char *)&pRet[1];
     pRet->nKey = nKey;
+    pRet->iHash = iHash;
     memcpy(pRet->zKey, zKey, nKey);
-    pRet->pNext = pHash->a[iKey];
-    pHash->a[iKey] = pRet;
+    pRet->pNext = pHash->a[iSlot];
+    pHash->a[iSlot] = pRet;
+    pHash->nEntry++;
   }
 
   return pRet;
@@ -167,6 +167,7 @@ struct Th_HashEntry {
   void *pData;
   char *zKey;
   int nKey;
+  unsigned int iHash;      /* Internal use only */
   Th_HashEntry *pNext;     /* Internal use only */
 };
 Th_Hash *Th_HashNew(Th_Interp *);
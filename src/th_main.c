@@ -367,6 +367,81 @@ static int repositoryCmd(
   return TH_OK;
 }
 
+/*
+** TH1 command:     query SQL CODE
+**
+** Run the read-only SQL statement SQL against the repository and, for
+** each row of the result, set a variable named after each column to
+** the value of that column (NULL becomes an empty string) and then
+** evaluate CODE.  The statement is prepared once, however many rows it
+** returns, and any output that CODE produces with [html] or [puts] is
+** appended to the reply as it goes.  [break] and [continue] in CODE
+** work as they do in a loop.
+**
+** Parameters in SQL of the form :NAME, $NAME or @NAME are bound to the
+** value of TH1 variable NAME, so values never need to be quoted into
+** the text of SQL.  Put SQL in braces so that TH1 does not substitute
+** the $NAME parameters itself.
+*/
+static int queryCmd(
+  Th_Interp *interp,
+  void *p, 
+  int argc, 
+  const char **argv, 
+  int *argl
+){
+  Stmt q;
+  int rc = TH_OK;
+  int i, nCol;
+
+  if( argc!=3 ){
+    return Th_WrongNumArgs(interp, "query SQL CODE");
+  }
+  if( g.db==0 || !g.repositoryOpen ){
+    Th_SetResult(interp, "no repository is open", -1);
+    return TH_ERROR;
+  }
+  if( db_prepare_ignore_error(&q, "%.*s", argl[1], argv[1])!=SQLITE_OK
+   || q.pStmt==0
+  ){
+    Th_ErrorMessage(interp, "SQL error:", sqlite3_errmsg(g.db), -1);
+    db_finalize(&q);
+    return TH_ERROR;
+  }
+  if( !sqlite3_stmt_readonly(q.pStmt) ){
+    Th_ErrorMessage(interp, "query must be read-only:", argv[1], argl[1]);
+    db_finalize(&q);
+    return TH_ERROR;
+  }
+  for(i=1; rc==TH_OK && i<=sqlite3_bind_parameter_count(q.pStmt); i++){
+    const char *zParam = sqlite3_bind_parameter_name(q.pStmt, i);
+    if( zParam==0 || zParam[0]=='?' ) continue;
+    rc = Th_GetVar(interp, &zParam[1], -1);
+    if( rc==TH_OK ){
+      int nVal;
+      const char *zVal = Th_GetResult(interp, &nVal);
+      sqlite3_bind_text(q.pStmt, i, zVal, nVal, SQLITE_TRANSIENT);
+    }
+  }
+  nCol = db_column_count(&q);
+  while( rc==TH_OK && db_step(&q)==SQLITE_ROW ){
+    for(i=0; i<nCol; i++){
+      const char *zVal = db_column_text(&q, i);
+      Th_SetVar(interp, db_column_name(&q, i), -1, zVal ? zVal : "", -1);
+    }
+    rc = Th_Eval(interp, 0, argv[2], argl[2]);
+    if( rc==TH_CONTINUE ) rc = TH_OK;
+  }
+  if( rc==TH_BREAK ) rc = TH_OK;
+  if( rc==TH_OK && sqlite3_reset(q.pStmt)!=SQLITE_OK ){
+    Th_ErrorMessage(interp, "SQL error:", sqlite3_errmsg(g.db), -1);
+    rc = TH_ERROR;
+  }
+  db_finalize(&q);
+  if( rc==TH_OK ) Th_SetResult(interp, 0, 0);
+  return rc;
+}
+
 /*
 ** Make sure the interpreter has been initialized.  Initialize it if
 ** it has not been already.
@@ -390,6 +465,7 @@ void Th_FossilInit(void){
     {"puts",          putsCmd,       (void*)1},
     {"wiki",          wikiCmd,              0},
     {"repository",    repositoryCmd,        0},
+    {"query",         queryCmd,             0},
     {0, 0, 0}
   };
   if( g.interp==0 ){
@@ -502,6 +578,117 @@ static int validVarName(const char *z){
   return i;
 }
 
+/*
+** A template is text mixed with TH1 scripts and variables, such as the
+** header or footer of the skin.  It is split into parts once and then
+** kept, so that it can be rendered again without being scanned again.
+** Templates are found by their text, so a template that changes is
+** simply a new template.
+*/
+typedef struct ThTemplate ThTemplate;
+struct ThTemplate {
+  char *zText;              /* Text of the template */
+  int nPart;                /* Number of entries in aPart[] */
+  struct ThTemplatePart {
+    char eType;               /* One of the TH_PART_* values */
+    int iStart;               /* Offset of the part in zText[] */
+    int n;                    /* Number of bytes in the part */
+  } *aPart;                 /* Parts before the trailing text */
+  int iTail;                /* Offset of the trailing text */
+  ThTemplate *pNext;        /* Next in the list of all templates */
+};
+
+/*
+** Allowed values for ThTemplate.aPart[].eType
+*/
+#define TH_PART_TEXT    1   /* Literal text */
+#define TH_PART_VAR     2   /* Variable $aaa, output raw */
+#define TH_PART_HVAR    3   /* Variable $<aaa>, html escaped */
+#define TH_PART_SCRIPT  4   /* Script between <th1> and </th1> */
+
+/*
+** Most recently used templates first.  At most TH_MX_TEMPLATE are kept.
+*/
+#define TH_MX_TEMPLATE 10
+static ThTemplate *pAllTemplates = 0;
+
+/*
+** Append a part to template p.
+*/
+static void templateAddPart(ThTemplate *p, int eType, int iStart, int n){
+  p->aPart = fossil_realloc(p->aPart, (p->nPart+1)*sizeof(p->aPart[0]));
+  p->aPart[p->nPart].eType = eType;
+  p->aPart[p->nPart].iStart = iStart;
+  p->aPart[p->nPart].n = n;
+  p->nPart++;
+}
+
+/*
+** Return the template whose text is z[], splitting z[] into parts
+** if it has not been seen before.
+*/
+static ThTemplate *templateFind(const char *z){
+  ThTemplate *p, **pp;
+  int i, n, iStart;
+  int nTemplate = 0;
+
+  for(pp=&pAllTemplates; (p = *pp)!=0; pp=&p->pNext){
+    if( strcmp(p->zText, z)==0 ){
+      *pp = p->pNext;
+      p->pNext = pAllTemplates;
+      pAllTemplates = p;
+      return p;
+    }
+    if( ++nTemplate>=TH_MX_TEMPLATE && p->pNext ){
+      ThTemplate *pOld = p->pNext;
+      p->pNext = pOld->pNext;
+      free(pOld->zText);
+      free(pOld->aPart);
+      free(pOld);
+    }
+  }
+  p = fossil_malloc( sizeof(*p) );
+  memset(p, 0, sizeof(*p));
+  p->zText = mprintf("%s", z);
+  z = p->zText;
+  iStart = i = 0;
+  while( z[i] ){
+    if( z[i]=='$' && (n = validVarName(&z[i+1]))>0 ){
+      if( i>iStart ) templateAddPart(p, TH_PART_TEXT, iStart, i-iStart);
+      if( z[i+1]=='<' ){
+        templateAddPart(p, TH_PART_HVAR, i+2, n-2);
+      }else{
+        templateAddPart(p, TH_PART_VAR, i+1, n);
+      }
+      i += 1+n;
+      iStart = i;
+    }else if( z[i]=='<' && isBeginScriptTag(&z[i]) ){
+      if( i>iStart ) templateAddPart(p, TH_PART_TEXT, iStart, i-iStart);
+      i += 5;
+      for(n=0; z[i+n] && (z[i+n]!='<' || !isEndScriptTag(&z[i+n])); n++){}
+      templateAddPart(p, TH_PART_SCRIPT, i, n);
+      i += n;
+      if( z[i] ){ i += 6; }
+      iStart = i;
+    }else{
+      i++;
+    }
+  }
+  p->iTail = iStart;
+  p->pNext = pAllTemplates;
+  pAllTemplates = p;
+  return p;
+}
+
+/*
+** Split template z[] into parts now, so that a later Th_Render() of
+** the same text does not have to.  Use this in a server process that
+** forks a new process for each request.
+*/
+void Th_PrepareTemplate(const char *z){
+  templateFind(z);
+}
+
 /*
 ** The z[] input contains text mixed with TH1 scripts.
 ** The TH1 scripts are contained within <th1>...</th1>. 
@@ -513,52 +700,46 @@ static int validVarName(const char *z){
 ** on either stdout or into CGI.
 */
 int Th_Render(const char *z){
-  int i = 0;
-  int n;
+  ThTemplate *p;
+  int i, n;
   int rc = TH_OK;
   char *zResult;
   Th_FossilInit();
-  while( z[i] ){
-    if( z[i]=='$' && (n = validVarName(&z[i+1]))>0 ){
-      const char *zVar;
-      int nVar;
-      int encode = 1;
-      sendText(z, i, 0);
-      if( z[i+1]=='<' ){
-        /* Variables of the form $<aaa> are html escaped */
-        zVar = &z[i+2];
-        nVar = n-2;
-      }else{
-        /* Variables of the form $aaa are output raw */
-        zVar = &z[i+1];
-        nVar = n;
-        encode = 0;
+  p = templateFind(z);
+  z = p->zText;
+  for(i=0; i<p->nPart; i++){
+    const char *zPart = &z[p->aPart[i].iStart];
+    int nPart = p->aPart[i].n;
+    switch( p->aPart[i].eType ){
+      case TH_PART_TEXT: {
+        sendText(zPart, nPart, 0);
+        break;
+      }
+      case TH_PART_VAR:
+      case TH_PART_HVAR: {
+        rc = Th_GetVar(g.interp, (char*)zPart, nPart);
+        zResult = (char*)Th_GetResult(g.interp, &n);
+        sendText((char*)zResult, n, p->aPart[i].eType==TH_PART_HVAR);
+        break;
+      }
+      case TH_PART_SCRIPT: {
+        i64 iStart = perf_timer_start(PERF_TH1_EVAL);
+        rc = Th_Eval(g.interp, 0, zPart, nPart);
+        perf_timer_stop(PERF_TH1_EVAL, iStart);
+        break;
       }
-      rc = Th_GetVar(g.interp, (char*)zVar, nVar);
-      z += i+1+n;
-      i = 0;
-      zResult = (char*)Th_GetResult(g.interp, &n);
-      sendText((char*)zResult, n, encode);
-    }else if( z[i]=='<' && isBeginScriptTag(&z[i]) ){
-      sendText(z, i, 0);
-      z += i+5;
-      for(i=0; z[i] && (z[i]!='<' || !isEndScriptTag(&z[i])); i++){}
-      rc = Th_Eval(g.interp, 0, (const char*)z, i);
-      if( rc!=TH_OK ) break;
-      z += i;
-      if( z[0] ){ z += 6; }
-      i = 0;
-    }else{
-      i++;
     }
+    if( rc!=TH_OK && p->aPart[i].eType==TH_PART_SCRIPT ) break;
   }
   if( rc==TH_ERROR ){
     sendText("<hr><p class=\"thmainError\">ERROR: ", -1, 0);
     zResult = (char*)Th_GetResult(g.interp, &n);
     sendText((char*)zResult, n, 1);
     sendText("</p>", -1, 0);
+  }else if( i<p->nPart ){
+    sendText(&z[p->aPart[i].iStart], p->aPart[i].n, 0);
   }else{
-    sendText(z, i, 0);
+    sendText(&z[p->iTail], -1, 0);
   }
   return rc;
 }
@@ -0,0 +1,249 @@
+/*
+** Copyright (c) 2012 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*******************************************************************************
+**
+** This file implements a per-client limit on the rate of requests
+** that "fossil server" and "fossil http" will answer.
+**
+** Each client IP address has a bucket of tokens that refills at a
+** steady rate of N tokens per minute, up to N tokens.  Each request
+** takes tokens from the bucket of its client according to the cost of
+** the page: most pages cost 1, but pages such as /annotate, /vdiff,
+** /zip and deep /timeline views cost more.  A request that finds too
+** few tokens in the bucket gets a short "429 Too Many Requests" reply
+** straight away, before any page is generated.
+**
+** Every request runs in its own process, so the buckets are kept in
+** memory that all of these processes share: an anonymous shared
+** mapping that "fossil server" creates before it forks, or a small
+** file next to the repository that each "fossil http" process maps.
+** A spin lock in the shared memory protects the buckets.  Unix only.
+*/
+#include "config.h"
+#include "throttle.h"
+#if !defined(_WIN32)
+# include <sys/mman.h>
+# include <sys/time.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <signal.h>
+# include <errno.h>
+# include <sched.h>
+#endif
+
+#if !defined(_WIN32)
+/*
+** Number of client buckets.  When all the buckets near the slot for
+** a new client are in use, the one that was used least recently is
+** taken over.
+*/
+#define THROTTLE_NSLOT   4096
+#define THROTTLE_NPROBE  8
+
+/*
+** The bucket of one client.
+*/
+struct ThrottleSlot {
+  unsigned int iHash;          /* Hash of the client address.  0 if unused */
+  float rTokens;               /* Tokens in the bucket at time rLast */
+  double rLast;                /* Time of the last request, in seconds */
+};
+
+/*
+** The shared memory.
+*/
+struct ThrottleTable {
+  volatile int lockPid;        /* Process that holds the lock, or 0 */
+  struct ThrottleSlot a[THROTTLE_NSLOT];
+};
+
+static struct ThrottleTable *pThrottle = 0;  /* The shared buckets */
+static double rThrottleRate = 0.0;           /* Tokens per minute */
+
+/*
+** Pages that cost more than one token.  A page not listed here costs
+** one token.
+*/
+static const struct {
+  const char *zPage;           /* Name of the page */
+  int nCost;                   /* Tokens taken by a request for it */
+} aThrottleCost[] = {
+  { "annotate",  10 },
+  { "blame",     10 },
+  { "fdiff",      5 },
+  { "finfo",      3 },
+  { "tarball",   20 },
+  { "timeline",   2 },
+  { "vdiff",     10 },
+  { "vpatch",    10 },
+  { "zip",       20 },
+};
+
+/*
+** Return the number of tokens that the current request costs.  In a
+** server for a directory of repositories, the page name follows the
+** repository name, so the first two elements of the path are looked at.
+*/
+static int throttle_cost(void){
+  const char *zPath = PD("PATH_INFO", "");
+  int nCost = 1;
+  int iElem, i, n;
+  for(iElem=0; iElem<2; iElem++){
+    while( zPath[0]=='/' ) zPath++;
+    for(n=0; zPath[n] && zPath[n]!='/'; n++){}
+    for(i=0; i<sizeof(aThrottleCost)/sizeof(aThrottleCost[0]); i++){
+      const char *zPage = aThrottleCost[i].zPage;
+      if( strncmp(zPath, zPage, n)==0 && zPage[n]==0 ){
+        nCost = aThrottleCost[i].nCost;
+        if( fossil_strcmp(zPage, "timeline")==0
+         && (P("a") || P("b") || P("c") || P("d") || P("p")) ){
+          /* Timelines anchored far back in history */
+          nCost = 5;
+        }
+        return nCost;
+      }
+    }
+    zPath += n;
+  }
+  return nCost;
+}
+
+/*
+** Acquire the lock on the shared buckets.  A lock left behind by a
+** process that died while holding it is broken.
+*/
+static void throttle_lock(void){
+  int pid = getpid();
+  int nSpin = 0;
+  while( !__sync_bool_compare_and_swap(&pThrottle->lockPid, 0, pid) ){
+    if( ++nSpin>=1000 ){
+      int owner = pThrottle->lockPid;
+      if( owner && kill(owner, 0)<0 && errno==ESRCH ){
+        __sync_bool_compare_and_swap(&pThrottle->lockPid, owner, 0);
+      }
+      nSpin = 0;
+      sched_yield();
+    }
+  }
+}
+
+/*
+** Release the lock on the shared buckets.
+*/
+static void throttle_unlock(void){
+  __sync_lock_release(&pThrottle->lockPid);
+}
+#endif
+
+/*
+** Start limiting requests to nPerMinute tokens per minute for each
+** client.  If zFile is NULL, the buckets are kept in memory that is
+** shared with the processes that this process forks later.  Otherwise
+** they are kept in the file zFile, shared with other processes that
+** use the same file.  If the shared memory cannot be set up, requests
+** are not limited.
+*/
+void throttle_init(int nPerMinute, const char *zFile){
+#if !defined(_WIN32)
+  void *p;
+  if( nPerMinute<=0 ) return;
+  if( zFile==0 ){
+    p = mmap(0, sizeof(*pThrottle), PROT_READ|PROT_WRITE,
+             MAP_SHARED|MAP_ANON, -1, 0);
+  }else{
+    struct stat st;
+    int fd = open(zFile, O_RDWR|O_CREAT, 0644);
+    if( fd<0 ) return;
+    if( fstat(fd, &st)!=0
+     || (st.st_size<(off_t)sizeof(*pThrottle)
+         && ftruncate(fd, sizeof(*pThrottle))!=0)
+    ){
+      close(fd);
+      return;
+    }
+    p = mmap(0, sizeof(*pThrottle), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+  }
+  if( p==MAP_FAILED ) return;
+  pThrottle = (struct ThrottleTable *)p;
+  rThrottleRate = nPerMinute;
+#endif
+}
+
+/*
+** Take the tokens for the current request from the bucket of its
+** client.  If there are not enough, send a "429 Too Many Requests"
+** reply and exit.  Call this after cgi_handle_http_request() and
+** before process_one_web_page().
+*/
+void throttle_check(void){
+#if !defined(_WIN32)
+  const char *zAddr;
+  unsigned int iHash = 2166136261u;
+  struct ThrottleSlot *pSlot = 0;
+  struct timeval tv;
+  double rNow;
+  double rCap = rThrottleRate;
+  int nCost;
+  int nWait = 0;
+  int i;
+
+  if( pThrottle==0 ) return;
+  zAddr = PD("REMOTE_ADDR", "nil");
+  for(i=0; zAddr[i]; i++){
+    iHash = (iHash ^ (unsigned char)zAddr[i]) * 16777619u;
+  }
+  if( iHash==0 ) iHash = 1;
+  nCost = throttle_cost();
+  gettimeofday(&tv, 0);
+  rNow = tv.tv_sec + tv.tv_usec*1e-6;
+
+  throttle_lock();
+  for(i=0; i<THROTTLE_NPROBE; i++){
+    struct ThrottleSlot *p = &pThrottle->a[(iHash+i)%THROTTLE_NSLOT];
+    if( p->iHash==iHash ){
+      pSlot = p;
+      break;
+    }
+    if( pSlot==0 || p->rLast<pSlot->rLast ) pSlot = p;
+  }
+  if( pSlot->iHash!=iHash ){
+    pSlot->iHash = iHash;
+    pSlot->rTokens = rCap;
+  }else if( rNow>pSlot->rLast ){
+    pSlot->rTokens += (rNow-pSlot->rLast)*rThrottleRate/60.0;
+    if( pSlot->rTokens>rCap ) pSlot->rTokens = rCap;
+  }
+  pSlot->rLast = rNow;
+  if( pSlot->rTokens>=nCost || (nCost>rCap && pSlot->rTokens>=rCap) ){
+    pSlot->rTokens -= nCost;
+  }else{
+    nWait = 1 + (int)((nCost-pSlot->rTokens)*60.0/rThrottleRate);
+  }
+  throttle_unlock();
+
+  if( nWait>0 ){
+    char zHdr[50];
+    sqlite3_snprintf(sizeof(zHdr), zHdr, "Retry-After: %d\r\n", nWait);
+    cgi_set_status(429, "Too Many Requests");
+    cgi_set_content_type("text/plain");
+    cgi_append_header(zHdr);
+    cgi_printf("Too many requests.  Try again in %d seconds.\n", nWait);
+    cgi_reply();
+    fossil_exit(0);
+  }
+#endif
+}
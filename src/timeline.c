@@ -204,6 +204,7 @@ void www_print_timeline(
   int fchngQueryInit = 0;     /* True if fchngQuery is initialized */
   Stmt fchngQuery;            /* Query for file changes on check-ins */
   static Stmt qbranch;
+  static Stmt qclosed;
 
   zPrevDate[0] = 0;
   mxWikiLen = db_get_int("timeline-max-comment", 0);
@@ -223,9 +224,13 @@ void www_print_timeline(
     "SELECT value FROM tagxref WHERE tagid=%d AND tagtype>0 AND rid=:rid",
     TAG_BRANCH
   );
+  db_static_prepare(&qclosed,
+    "SELECT 1 FROM tagxref WHERE rid=:rid AND tagid=%d AND tagtype>0",
+    TAG_CLOSED
+  );
 
   @ <table id="timelineTable" class="timelineTable">
-  blob_zero(&comment);
+  blob_zero_arena(&comment);
   while( db_step(pQuery)==SQLITE_ROW ){
     int rid = db_column_int(pQuery, 0);
     const char *zUuid = db_column_text(pQuery, 1);
@@ -325,13 +330,13 @@ void www_print_timeline(
     if( zType[0]=='c' ){
       hyperlink_to_uuid(zUuid);
       if( isLeaf ){
-        if( db_exists("SELECT 1 FROM tagxref"
-                      " WHERE rid=%d AND tagid=%d AND tagtype>0",
-                      rid, TAG_CLOSED) ){
+        db_bind_int(&qclosed, ":rid", rid);
+        if( db_step(&qclosed)==SQLITE_ROW ){
           @ <span class="timelineLeaf">Closed-Leaf:</span>
         }else{
           @ <span class="timelineLeaf">Leaf:</span>
         }
+        db_reset(&qclosed);
       }
     }else if( zType[0]=='e' && tagid ){
       hyperlink_to_event_tagid(tagid);
@@ -341,7 +346,7 @@ void www_print_timeline(
     db_column_blob(pQuery, commentColumn, &comment);
     if( mxWikiLen>0 && blob_size(&comment)>mxWikiLen ){
       Blob truncated;
-      blob_zero(&truncated);
+      blob_zero_arena(&truncated);
       blob_append(&truncated, blob_buffer(&comment), mxWikiLen);
       blob_append(&truncated, "...", 3);
       wiki_convert(&truncated, 0, wikiFlags);
@@ -356,10 +361,11 @@ void www_print_timeline(
     */
     if( zTagList && zTagList[0]==0 ) zTagList = 0;
     if( g.perm.History && fossil_strcmp(zUser, zThisUser)!=0 ){
-      char *zLink = mprintf("%s/timeline?u=%h&c=%t&nd",
-                            g.zTop, zUser, zDate);
-      @ (user: <a href="%s(zLink)">%h(zUser)</a>%s(zTagList?",":"\051")
-      fossil_free(zLink);
+      Blob link;
+      blob_zero_arena(&link);
+      blob_appendf(&link, "%s/timeline?u=%h&c=%t&nd", g.zTop, zUser, zDate);
+      @ (user: <a href="%b(&link)">%h(zUser)</a>%s(zTagList?",":"\051")
+      blob_reset(&link);
     }else{
       @ (user: %h(zUser)%s(zTagList?",":"\051")
     }
@@ -377,7 +383,7 @@ void www_print_timeline(
         int i;
         const char *z = zTagList;
         Blob links;
-        blob_zero(&links);
+        blob_zero_arena(&links);
         while( z && z[0] ){
           for(i=0; z[i] && (z[i]!=',' || z[i+1]!=' '); i++){}
           if( zThisTag==0 || memcmp(z, zThisTag, i)!=0 || zThisTag[i]!=0 ){
@@ -813,6 +819,41 @@ static void timeline_submenu(
                         url_render(pUrl, zParam, zValue, zRemove, 0));
 }
 
+/*
+** Return true if rid can be used as the k= query parameter of the
+** timeline page.  That is, if rid is an event.
+*/
+static int timeline_is_page_key(int rid){
+  return rid>0 && db_exists("SELECT 1 FROM event WHERE objid=%d", rid);
+}
+
+/*
+** Generate the "Older" or "Newer" submenu element.  zParam is "b" for
+** "Older" and "a" for "Newer".  The link names the oldest (or newest)
+** event now in the timeline as k= so that the next page starts right
+** after it, with ties on the timestamp broken by rid.
+*/
+static void timeline_page_submenu(
+  HQuery *pUrl,            /* Base URL */
+  const char *zMenuName,   /* Submenu name */
+  const char *zParam,      /* "a" or "b" */
+  const char *zRemove      /* Parameter to omit */
+){
+  Stmt q;
+  const char *zDir = zParam[0]=='b' ? "ASC" : "DESC";
+  db_prepare(&q,
+    "SELECT timestamp, rid FROM timeline WHERE rid>0"
+    " ORDER BY sortby %s, rid %s LIMIT 1 /*scan*/",
+    zDir, zDir
+  );
+  if( db_step(&q)==SQLITE_ROW ){
+    style_submenu_element(zMenuName, zMenuName, "%s&amp;k=%d",
+        url_render(pUrl, zParam, db_column_text(&q, 0), zRemove, 0),
+        db_column_int(&q, 1));
+  }
+  db_finalize(&q);
+}
+
 
 /*
 ** zDate is a localtime date.  Insert records into the
@@ -850,6 +891,7 @@ static void timeline_add_dividers(const char *zDate, int rid){
 **    a=TIMESTAMP    after this date
 **    b=TIMESTAMP    before this date.
 **    c=TIMESTAMP    "circa" this date.
+**    k=RID          with a= or b=, start just after this event
 **    n=COUNT        number of events in output
 **    p=UUID         artifact and up to COUNT parents and ancestors
 **    d=UUID         artifact and up to COUNT descendants
@@ -873,7 +915,9 @@ static void timeline_add_dividers(const char *zDate, int rid){
 ** appear, then u=, y=, a=, and b= are ignored.
 **
 ** If a= and b= appear, only a= is used.  If neither appear, the most
-** recent events are choosen.
+** recent events are choosen.  The "Older" and "Newer" links add k= so
+** that each page begins exactly where the previous one ended, even when
+** several events share a timestamp.
 **
 ** If n= is missing, the default count is 20.
 */
@@ -890,6 +934,7 @@ void page_timeline(void){
   const char *zAfter = P("a");       /* Events after this time */
   const char *zBefore = P("b");      /* Events before this time */
   const char *zCirca = P("c");       /* Events near this time */
+  int k_rid = atoi(PD("k","0"));     /* Page starts just after this event */
   const char *zTagName = P("t");     /* Show events with this tag */
   const char *zBrName = P("r");      /* Show events related to this tag */
   const char *zSearch = P("s");      /* Search string */
@@ -1054,7 +1099,6 @@ void page_timeline(void){
     /* Otherwise, a timeline based on a span of time */
     int n;
     const char *zEType = "timeline item";
-    char *zDate;
     char *zNEntry = mprintf("%d", nEntry);
     url_add_parameter(&url, "n", zNEntry);
     if( tagid>0 ){
@@ -1145,9 +1189,16 @@ void page_timeline(void){
     if( zAfter ){
       while( fossil_isspace(zAfter[0]) ){ zAfter++; }
       if( zAfter[0] ){
-        blob_appendf(&sql, 
-           " AND event.mtime>=(SELECT julianday(%Q, 'utc'))"
-           " ORDER BY event.mtime ASC", zAfter);
+        if( timeline_is_page_key(k_rid) ){
+          blob_appendf(&sql,
+             " AND event.mtime>=(SELECT mtime FROM event WHERE objid=%d)"
+             " AND (event.mtime>(SELECT mtime FROM event WHERE objid=%d)"
+                  " OR event.objid>%d)", k_rid, k_rid, k_rid);
+        }else{
+          blob_appendf(&sql,
+             " AND event.mtime>=(SELECT julianday(%Q, 'utc'))", zAfter);
+        }
+        blob_appendf(&sql, " ORDER BY event.mtime ASC, event.objid ASC");
         url_add_parameter(&url, "a", zAfter);
         zBefore = 0;
       }else{
@@ -1156,9 +1207,16 @@ void page_timeline(void){
     }else if( zBefore ){
       while( fossil_isspace(zBefore[0]) ){ zBefore++; }
       if( zBefore[0] ){
-        blob_appendf(&sql, 
-           " AND event.mtime<=(SELECT julianday(%Q, 'utc'))"
-           " ORDER BY event.mtime DESC", zBefore);
+        if( timeline_is_page_key(k_rid) ){
+          blob_appendf(&sql,
+             " AND event.mtime<=(SELECT mtime FROM event WHERE objid=%d)"
+             " AND (event.mtime<(SELECT mtime FROM event WHERE objid=%d)"
+                  " OR event.objid<%d)", k_rid, k_rid, k_rid);
+        }else{
+          blob_appendf(&sql,
+             " AND event.mtime<=(SELECT julianday(%Q, 'utc'))", zBefore);
+        }
+        blob_appendf(&sql, " ORDER BY event.mtime DESC, event.objid DESC");
         url_add_parameter(&url, "b", zBefore);
        }else{
         zBefore = 0;
@@ -1170,13 +1228,14 @@ void page_timeline(void){
         Blob sql2;
         blob_init(&sql2, blob_str(&sql), -1);
         blob_appendf(&sql2,
-            " AND event.mtime<=%f ORDER BY event.mtime DESC LIMIT %d",
+            " AND event.mtime<=%f"
+            " ORDER BY event.mtime DESC, event.objid DESC LIMIT %d",
             rCirca, (nEntry+1)/2
         );
         db_multi_exec("%s", blob_str(&sql2));
         blob_reset(&sql2);
         blob_appendf(&sql,
-            " AND event.mtime>=%f ORDER BY event.mtime ASC",
+            " AND event.mtime>=%f ORDER BY event.mtime ASC, event.objid ASC",
             rCirca
         );
         nEntry -= (nEntry+1)/2;
@@ -1186,7 +1245,7 @@ void page_timeline(void){
         zCirca = 0;
       }
     }else{
-      blob_appendf(&sql, " ORDER BY event.mtime DESC");
+      blob_appendf(&sql, " ORDER BY event.mtime DESC, event.objid DESC");
     }
     blob_appendf(&sql, " LIMIT %d", nEntry);
     db_multi_exec("%s", blob_str(&sql));
@@ -1223,14 +1282,10 @@ void page_timeline(void){
     }
     if( g.perm.History ){
       if( zAfter || n==nEntry ){
-        zDate = db_text(0, "SELECT min(timestamp) FROM timeline /*scan*/");
-        timeline_submenu(&url, "Older", "b", zDate, "a");
-        free(zDate);
+        timeline_page_submenu(&url, "Older", "b", "a");
       }
       if( zBefore || (zAfter && n==nEntry) ){
-        zDate = db_text(0, "SELECT max(timestamp) FROM timeline /*scan*/");
-        timeline_submenu(&url, "Newer", "a", zDate, "b");
-        free(zDate);
+        timeline_page_submenu(&url, "Newer", "a", "b");
       }else if( tagid==0 ){
         if( zType[0]!='a' ){
           timeline_submenu(&url, "All Types", "y", "all", 0);
@@ -218,6 +218,7 @@ void ticket_rebuild_entry(const char *zTktUuid){
   int createFlag = 1;
 
   fossil_free(zTag);  
+  search_index_note_ticket(tagid);
   db_multi_exec(
      "DELETE FROM ticket WHERE tkt_uuid=%Q", zTktUuid
   );
@@ -235,14 +236,71 @@ void ticket_rebuild_entry(const char *zTktUuid){
   db_finalize(&q);
 }
 
+/*
+** Bring the entry for ticket zTktUuid in the TICKET table up to date
+** after the change artifacts listed for it in the PENDING_TKT table
+** have been crosslinked.  If the ticket already exists and each new
+** change is more recent than everything applied to it so far, apply
+** just the new changes on top of the current entry.  Otherwise replay
+** every change with ticket_rebuild_entry().
+*/
+void ticket_update_entry(const char *zTktUuid){
+  char *zTag = mprintf("tkt-%s", zTktUuid);
+  int tagid = tag_findid(zTag, 1);
+  double rMtime;
+  int nRid = 0;
+  int *aRid = 0;
+  Stmt q;
+  int i;
+
+  fossil_free(zTag);
+  rMtime = db_double(-1.0,
+     "SELECT tkt_mtime FROM ticket WHERE tkt_uuid=%Q", zTktUuid);
+  db_prepare(&q,
+     "SELECT pending_tkt.rid, tagxref.mtime FROM pending_tkt, tagxref"
+     " WHERE pending_tkt.uuid=%Q AND tagxref.rid=pending_tkt.rid"
+     "   AND tagxref.tagid=%d"
+     " ORDER BY tagxref.mtime",
+     zTktUuid, tagid
+  );
+  while( rMtime>=0.0 && db_step(&q)==SQLITE_ROW ){
+    double rChange = db_column_double(&q, 1);
+    if( rChange<=rMtime ){
+      rMtime = -1.0;
+      break;
+    }
+    rMtime = rChange;
+    aRid = fossil_realloc(aRid, (nRid+1)*sizeof(aRid[0]));
+    aRid[nRid++] = db_column_int(&q, 0);
+  }
+  db_finalize(&q);
+  if( rMtime<0.0 || nRid==0 ){
+    ticket_rebuild_entry(zTktUuid);
+  }else{
+    search_index_note_ticket(tagid);
+    for(i=0; i<nRid; i++){
+      Manifest *pTicket = manifest_get(aRid[i], CFTYPE_TICKET);
+      if( pTicket ){
+        ticket_insert(pTicket, 0, aRid[i]);
+        manifest_ticket_event(aRid[i], pTicket, 0, tagid);
+        manifest_destroy(pTicket);
+      }
+    }
+  }
+  fossil_free(aRid);
+}
+
 /*
 ** Create the subscript interpreter and load the "common" code.
 */
 void ticket_init(void){
   const char *zConfig;
+  i64 iStart;
   Th_FossilInit();
   zConfig = ticket_common_code();
+  iStart = perf_timer_start(PERF_TH1_EVAL);
   Th_Eval(g.interp, 0, zConfig, -1);
+  perf_timer_stop(PERF_TH1_EVAL, iStart);
 }
 
 /*
@@ -250,9 +308,14 @@ void ticket_init(void){
 */
 int ticket_change(void){
   const char *zConfig;
+  i64 iStart;
+  int rc;
   Th_FossilInit();
   zConfig = ticket_change_code();
-  return Th_Eval(g.interp, 0, zConfig, -1);
+  iStart = perf_timer_start(PERF_TH1_EVAL);
+  rc = Th_Eval(g.interp, 0, zConfig, -1);
+  perf_timer_stop(PERF_TH1_EVAL, iStart);
+  return rc;
 }
 
 /*
@@ -271,12 +334,10 @@ void ticket_create_table(int separateConnection){
 }
 
 /*
-** Repopulate the ticket table
+** Replay the changes to every ticket into the ticket table.
 */
-void ticket_rebuild(void){
+void ticket_rebuild_all(void){
   Stmt q;
-  ticket_create_table(1);
-  db_begin_transaction();
   db_prepare(&q,"SELECT tagname FROM tag WHERE tagname GLOB 'tkt-*'");
   while( db_step(&q)==SQLITE_ROW ){
     const char *zName = db_column_text(&q, 0);
@@ -287,6 +348,16 @@ void ticket_rebuild(void){
     ticket_rebuild_entry(zName);
   }
   db_finalize(&q);
+}
+
+/*
+** Repopulate the ticket table
+*/
+void ticket_rebuild(void){
+  ticket_create_table(1);
+  db_begin_transaction();
+  ticket_rebuild_all();
+  search_index_update();
   db_end_transaction(0);
 }
 
@@ -862,6 +933,7 @@ void ticket_output_change_artifact(Manifest *pTkt){
 **         options can be:
 **           ?-l|--limit LIMITCHAR?
 **           ?-q|--quote?
+**           ?--csv?
 **           ?-R|--repository FILE?
 **
 **         Run the ticket report, identified by the report format title
@@ -880,6 +952,9 @@ void ticket_output_change_artifact(Manifest *pTkt){
 **         cr -> \\r, formfeed -> \\f, vtab -> \\v, nul -> \\0, \\ -> \\\\).
 **         Otherwise, the simplified encoding as on the show report raw
 **         page in the gui is used. This has no effect in JSON mode.
+**         With the --csv option, the output is CSV: the separator is
+**         "," unless -l is given and values are quoted as in RFC 4180.
+**         Rows are written as the report query returns them.
 **
 **         Instead of the report title its possible to use the report
 **         number. Using the special report number 0 list all columns,
@@ -974,6 +1049,7 @@ void ticket_cmd(void){
           const char *zSep = 0;
           const char *zFilterUuid = 0;
           zSep = find_option("limit","l",1);
+          if( find_option("csv",0,0)!=0 ) tktEncoding = tktCsv;
           zRep = g.argv[3];
           if( !strcmp(zRep,"0") ){
             zRep = 0;
@@ -48,6 +48,36 @@ static int nArg = 0;
 */
 static int inPrint = 0;
 
+/*
+** The format string of the current cgi_printf(), which is held back
+** until the end of the block.  A block with no "%" conversions is
+** plain text, and is written as a call to cgi_append_content() with
+** a length computed here, so that it skips the printf interpreter.
+*/
+static char *zBlock = 0;       /* The format string, as C literals */
+static int nBlock = 0;         /* Bytes used in zBlock[] */
+static int nBlockAlloc = 0;    /* Bytes allocated for zBlock[] */
+static int nBlockIndent = 0;   /* Indentation of the cgi_printf() */
+static int nBlockText = 0;     /* Length of the text of the literals */
+static int blockHasPct = 0;    /* True if the format contains a "%" */
+
+/*
+** Append text to zBlock[]
+*/
+static void block_append(const char *z){
+  int n = strlen(z);
+  if( nBlock+n+1>nBlockAlloc ){
+    nBlockAlloc = (nBlock+n+1)*2;
+    zBlock = realloc(zBlock, nBlockAlloc);
+    if( zBlock==0 ){
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+  memcpy(&zBlock[nBlock], z, n+1);
+  nBlock += n;
+}
+
 /*
 ** True if we are currently doing a free string
 */
@@ -59,8 +89,16 @@ static int inStr = 0;
 static void end_block(FILE *out){
   if( inPrint ){
     zArg[nArg] = 0;
-    fprintf(out, "%s);\n", zArg);
+    if( nArg==0 && !blockHasPct ){
+      fprintf(out, "%*scgi_append_content(%s, %d);\n",
+              nBlockIndent, "", zBlock, nBlockText);
+    }else{
+      fprintf(out, "%*scgi_printf(%s%s);\n", nBlockIndent, "", zBlock, zArg);
+    }
     nArg = 0;
+    nBlock = 0;
+    nBlockText = 0;
+    blockHasPct = 0;
     inPrint = 0;
   }
 }
@@ -126,12 +164,16 @@ static void trans(FILE *in, FILE *out){
       ** cgi_printf call.
       */
       int indent;
+      int nText = 0;
+      char zPrefix[100];
       i++;
       if( isspace(zLine[i]) ){ i++; }
       indent = i;
       for(j=0; zLine[i] && zLine[i]!='\r' && zLine[i]!='\n'; i++){
         if( zLine[i]=='"' || zLine[i]=='\\' ){ zOut[j++] = '\\'; }
         zOut[j++] = zLine[i];
+        nText++;
+        if( zLine[i]=='%' ) blockHasPct = 1;
         if( zLine[i]!='%' || zLine[i+1]=='%' || zLine[i+1]==0 ) continue;
         if( zLine[i+2]!='(' ) continue;
         i++;
@@ -151,11 +193,16 @@ static void trans(FILE *in, FILE *out){
       }
       zOut[j] = 0;
       if( !inPrint ){
-        fprintf(out,"%*scgi_printf(\"%s\\n\"",indent-2,"", zOut);
+        nBlockIndent = indent-2;
         inPrint = 1;
       }else{
-        fprintf(out,"\n%*s\"%s\\n\"",indent+5, "", zOut);
+        sprintf(zPrefix, "\n%*s", indent+5, "");
+        block_append(zPrefix);
       }
+      block_append("\"");
+      block_append(zOut);
+      block_append("\\n\"");
+      nBlockText += nText+1;
     }      
   }
 }
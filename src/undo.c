@@ -21,6 +21,105 @@
 #include "undo.h"
 
 
+/*
+** Older versions of fossil keep the complete text of each saved file in
+** the "content" column of the undo table.  This version stores a
+** reference to, or a delta from, an artifact in a "delta" column
+** instead.  The column has a new name so that an older fossil fails on
+** the missing "content" column rather than restoring a delta as the
+** text of the file.
+**
+** Return true if the undo table was created by an older fossil.  Such
+** a table is still read and written using whole file content.
+*/
+static int undo_is_legacy(void){
+  return db_exists(
+    "SELECT 1 FROM %s.sqlite_master"
+    " WHERE name='undo' AND sql GLOB '* content *'",
+    db_name("localdb")
+  );
+}
+
+/*
+** Bind the content of a file being saved for undo to the ":c" and
+** ":r" parameters of statement pStmt.  If the content is identical to
+** an artifact already in the repository, only the RID of that artifact
+** is stored.  Otherwise, if the file has a baseline version in the
+** current check-out, a compressed delta against that baseline is
+** stored.  Symlinks, files with no baseline and files whose baseline
+** cannot be read are stored verbatim with a zero RID.  If isLegacy is
+** true, only ":c" is bound and it always holds the verbatim content.
+**
+** pContent is replaced by the compressed delta in the second case.  It
+** is bound statically so it must not be reset until pStmt is stepped.
+*/
+static void undo_bind_content(
+  Stmt *pStmt,              /* Statement to bind to */
+  const char *zPathname,    /* Name of the file relative to the root */
+  Blob *pContent,           /* Content of the file */
+  int isLink,               /* True if the file is a symlink */
+  int isLegacy              /* True to always store the content verbatim */
+){
+  Blob hash;
+  int rid;
+  if( isLegacy ){
+    db_bind_blob(pStmt, ":c", pContent);
+    return;
+  }
+  db_bind_int(pStmt, ":r", 0);
+  if( isLink ){
+    db_bind_blob(pStmt, ":c", pContent);
+    return;
+  }
+  sha1sum_blob(pContent, &hash);
+  rid = db_int(0, "SELECT rid FROM blob WHERE uuid=%B AND size>=0", &hash);
+  blob_reset(&hash);
+  if( rid>0 && content_is_available(rid) ){
+    db_bind_int(pStmt, ":r", rid);
+    return;
+  }
+  rid = db_int(0, "SELECT rid FROM vfile WHERE pathname=%Q AND rid>0"
+                  "   AND vid=%d", zPathname, db_lget_int("checkout", 0));
+  if( rid>0 ){
+    Blob src, delta, z;
+    if( content_get(rid, &src) ){
+      blob_delta_create(&src, pContent, &delta);
+      blob_compress(&delta, &z);
+      blob_reset(&delta);
+      blob_reset(&src);
+      blob_reset(pContent);
+      *pContent = z;
+      db_bind_int(pStmt, ":r", rid);
+      db_bind_blob(pStmt, ":c", pContent);
+      return;
+    }
+    blob_reset(&src);
+  }
+  db_bind_blob(pStmt, ":c", pContent);
+}
+
+/*
+** Reconstruct content saved by undo_bind_content().  rid and column
+** iCol of statement pStmt are the stored "rid" and "delta" values.
+** Return 0 if the artifact the content is based on is no longer
+** available, as happens after it is shunned.
+*/
+static int undo_get_content(Stmt *pStmt, int rid, int iCol, Blob *pOut){
+  Blob z, delta, src;
+  db_ephemeral_blob(pStmt, iCol, &z);
+  if( rid<=0 ){
+    *pOut = z;
+  }else if( blob_size(&z)==0 ){
+    if( content_get(rid, pOut)==0 ) return 0;
+  }else{
+    if( content_get(rid, &src)==0 ) return 0;
+    blob_uncompress(&z, &delta);
+    blob_delta_apply(&src, &delta, pOut);
+    blob_reset(&src);
+    blob_reset(&delta);
+  }
+  return 1;
+}
 
 /*
 ** Undo the change to the file zPathname.  zPathname is the pathname
@@ -31,9 +130,11 @@
 static void undo_one(const char *zPathname, int redoFlag){
   Stmt q;
   char *zFullname;
+  int isLegacy = undo_is_legacy();
   db_prepare(&q,
-    "SELECT content, existsflag, isExe, isLink FROM undo"
+    "SELECT %s, existsflag, isExe, isLink, %s FROM undo"
     " WHERE pathname=%Q AND redoflag=%d",
+     isLegacy ? "content" : "delta", isLegacy ? "0" : "rid",
      zPathname, redoFlag
   );
   if( db_step(&q)==SQLITE_ROW ){
@@ -63,8 +164,14 @@ static void undo_one(const char *zPathname, int redoFlag){
     blob_zero(&new);
     old_exists = db_column_int(&q, 1);
     old_exe = db_column_int(&q, 2);
-    if( old_exists ){
-      db_ephemeral_blob(&q, 0, &new);
+    if( old_exists && !undo_get_content(&q, db_column_int(&q, 4), 0, &new) ){
+      fossil_warning("cannot %s %s: artifact %d is no longer available",
+                     redoFlag ? "redo" : "undo", zPathname,
+                     db_column_int(&q, 4));
+      blob_reset(&current);
+      free(zFullname);
+      db_finalize(&q);
+      return;
     }
     if( old_exists ){
       if( new_exists ){
@@ -89,13 +196,14 @@ static void undo_one(const char *zPathname, int redoFlag){
     free(zFullname);
     db_finalize(&q);
     db_prepare(&q, 
-       "UPDATE undo SET content=:c, existsflag=%d, isExe=%d, isLink=%d,"
-             " redoflag=NOT redoflag"
+       "UPDATE undo SET %s, existsflag=%d, isExe=%d,"
+             " isLink=%d, redoflag=NOT redoflag"
        " WHERE pathname=%Q",
+       isLegacy ? "content=:c" : "delta=:c, rid=:r",
        new_exists, new_exe, new_link, zPathname
     );
     if( new_exists ){
-      db_bind_blob(&q, ":c", &current);
+      undo_bind_content(&q, zPathname, &current, new_link, isLegacy);
     }
     db_step(&q);
     blob_reset(&current);
@@ -227,7 +335,8 @@ void undo_begin(void){
     @   existsflag BOOLEAN,               -- True if the file exists
     @   isExe BOOLEAN,                    -- True if the file is executable
     @   isLink BOOLEAN,                   -- True if the file is symlink
-    @   content BLOB                      -- Saved content
+    @   rid INTEGER,                      -- Artifact delta is based on
+    @   delta BLOB                        -- Saved content or delta from rid
     @ );
     @ CREATE TABLE %s.undo_vfile AS SELECT * FROM vfile;
     @ CREATE TABLE %s.undo_vmerge AS SELECT * FROM vmerge;
@@ -276,8 +385,8 @@ void undo_save(const char *zPathname){
   isLink = file_wd_islink(zFullname);
   db_prepare(&q,
     "INSERT OR IGNORE INTO"
-    "   undo(pathname,redoflag,existsflag,isExe,isLink,content)"
-    " VALUES(%Q,0,%d,%d,%d,:c)",
+    "   undo(pathname,redoflag,existsflag,isExe,isLink,rid,delta)"
+    " VALUES(%Q,0,%d,%d,%d,:r,:c)",
     zPathname, existsFlag, file_wd_isexe(zFullname), isLink
   );
   if( existsFlag ){
@@ -286,7 +395,7 @@ void undo_save(const char *zPathname){
     }else{
       blob_read_from_file(&content, zFullname);
     }
-    db_bind_blob(&q, ":c", &content);
+    undo_bind_content(&q, zPathname, &content, isLink, 0);
   }
   free(zFullname);
   db_step(&q);
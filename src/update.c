@@ -59,6 +59,90 @@ int update_to(int vid){
   return internalConflictCnt;
 }
 
+/*
+** Three-way merges for update_cmd(), computed ahead of its main loop.
+** The lookahead query visits the files that may need a merge in the
+** same order as the main loop, and worker threads merge them a batch
+** at a time.  The main loop then only reports and writes the results.
+*/
+typedef struct MergeAhead MergeAhead;
+struct MergeAhead {
+  Stmt q;                /* Files that may need a merge, ordered by name */
+  int atEof;             /* No more rows in q */
+  WorkPool *pPool;       /* Workers that do the merges */
+  MergeFile *aJob;       /* The current batch of merges */
+  char **azName;         /* Name of each file in aJob[] */
+  int nJob;              /* Number of entries in aJob[] */
+  int iJob;              /* Next entry of aJob[] to hand out */
+};
+
+/* Number of merges in a batch */
+#define MERGE_AHEAD_BATCH 100
+
+/*
+** Free the content of merge p.
+*/
+static void merge_ahead_free(MergeFile *p){
+  blob_reset(&p->pivot);
+  blob_reset(&p->v1);
+  blob_reset(&p->v2);
+  blob_reset(&p->out);
+  free(p->zV1);
+  p->zV1 = 0;
+}
+
+/*
+** Release the batch in p and start merging the next one.
+*/
+static void merge_ahead_fill(MergeAhead *p){
+  while( p->nJob>0 ){
+    p->nJob--;
+    merge_ahead_free(&p->aJob[p->nJob]);
+    free(p->azName[p->nJob]);
+  }
+  p->iJob = 0;
+  while( p->nJob<MERGE_AHEAD_BATCH && !p->atEof ){
+    MergeFile *pJob;
+    char *zFullPath;
+    if( db_step(&p->q)!=SQLITE_ROW ){
+      p->atEof = 1;
+      break;
+    }
+    zFullPath = mprintf("%s%s", g.zLocalRoot, db_column_text(&p->q, 0));
+    if( file_wd_size(zFullPath)<0 ){
+      free(zFullPath);
+      continue;
+    }
+    pJob = &p->aJob[p->nJob];
+    p->azName[p->nJob++] = fossil_strdup(db_column_text(&p->q, 0));
+    memset(pJob, 0, sizeof(*pJob));
+    pJob->zV1 = zFullPath;
+    content_get(db_column_int(&p->q, 1), &pJob->pivot);
+    content_get(db_column_int(&p->q, 2), &pJob->v2);
+    blob_read_from_file(&pJob->v1, zFullPath);
+    blob_zero(&pJob->out);
+    workpool_add(p->pPool, merge_3way_task, pJob);
+  }
+  workpool_wait(p->pPool);
+}
+
+/*
+** Return the merge computed ahead for file zName, or NULL if there is
+** none.  Merges for files before zName were not wanted and are dropped.
+*/
+static MergeFile *merge_ahead_get(MergeAhead *p, const char *zName){
+  for(;;){
+    while( p->iJob<p->nJob ){
+      int c = fossil_strcmp(p->azName[p->iJob], zName);
+      if( c>0 ) return 0;
+      if( c==0 ) return &p->aJob[p->iJob++];
+      merge_ahead_free(&p->aJob[p->iJob++]);
+    }
+    if( p->atEof ) return 0;
+    merge_ahead_fill(p);
+  }
+}
+
 /*
 ** COMMAND: update
 **
@@ -108,6 +192,7 @@ void update_cmd(void){
   int nConflict = 0;    /* Number of merge conflicts */
   int nOverwrite = 0;   /* Number of unmanaged files overwritten */
   Stmt mtimeXfer;       /* Statment to transfer mtimes */
+  MergeAhead ahead;     /* Three-way merges computed ahead */
 
   if( !internalUpdate ){
     undo_capture_command_line();
@@ -334,6 +419,28 @@ void update_cmd(void){
     blob_reset(&sql);
   }
 
+  /*
+  ** Files that are unedited and the same in both versions only need
+  ** their mtime carried over to the target.  Do that for all of them at
+  ** once, so that the loop below only visits files that differ and the
+  ** time needed scales with the size of the change, not of the tree.
+  ** A file that is missing from disk was marked as edited by
+  ** vfile_check_signature(), so it is not one of these.
+  */
+  db_multi_exec(
+    "UPDATE vfile SET mtime=(SELECT v.mtime FROM fv, vfile AS v"
+    "                         WHERE fv.idt=vfile.id AND v.id=fv.idv)"
+    " WHERE id IN (SELECT idt FROM fv"
+    "               WHERE idv>0 AND idt>0 AND ridv=ridt AND ridv>0"
+    "                 AND NOT chnged)"
+  );
+  if( !verboseFlag ){
+    db_multi_exec(
+      "DELETE FROM fv"
+      " WHERE idv>0 AND idt>0 AND ridv=ridt AND ridv>0 AND NOT chnged"
+    );
+  }
+
   /*
   ** Alter the content of the checkout so that it conforms with the
   ** target
@@ -346,6 +453,16 @@ void update_cmd(void){
     "UPDATE vfile SET mtime=(SELECT mtime FROM vfile WHERE id=:idv)"
     " WHERE id=:idt"
   );
+  memset(&ahead, 0, sizeof(ahead));
+  db_prepare(&ahead.q,
+    "SELECT fn, ridv, ridt FROM fv"
+    " WHERE idt>0 AND idv>0 AND ridv>0 AND ridt!=ridv AND chnged"
+    "   AND NOT islinkv AND NOT islinkt"
+    " ORDER BY 1"
+  );
+  ahead.pPool = workpool_new(workpool_size(0));
+  ahead.aJob = fossil_malloc(MERGE_AHEAD_BATCH*sizeof(ahead.aJob[0]));
+  ahead.azName = fossil_malloc(MERGE_AHEAD_BATCH*sizeof(ahead.azName[0]));
   assert( g.zLocalRoot!=0 );
   assert( strlen(g.zLocalRoot)>1 );
   assert( g.zLocalRoot[strlen(g.zLocalRoot)-1]=='/' );
@@ -388,7 +505,7 @@ void update_cmd(void){
       undo_save(zName);
       fossil_print("UPDATE %s\n", zName);
       if( !nochangeFlag ) vfile_to_disk(0, idt, 0, 0);
-    }else if( idt>0 && idv>0 && file_wd_size(zFullPath)<0 ){
+    }else if( idt>0 && idv>0 && chnged && file_wd_size(zFullPath)<0 ){
       /* The file missing from the local check-out. Restore it to the
       ** version that appears in the target. */
       fossil_print("UPDATE %s\n", zName);
@@ -423,10 +540,25 @@ void update_cmd(void){
         fossil_print("***** Cannot merge symlink %s\n", zNewName);
         nConflict++;        
       }else{
+        MergeFile *pMerge = merge_ahead_get(&ahead, zName);
         undo_save(zName);
-        content_get(ridt, &t);
-        content_get(ridv, &v);
-        rc = merge_3way(&v, zFullPath, &t, &r);
+        if( pMerge ){
+          rc = pMerge->rc;
+          if( rc!=0 ){
+            merge_3way_conflict(&pMerge->pivot, zFullPath, &pMerge->v1,
+                                &pMerge->v2, &pMerge->out, rc);
+          }
+          t = pMerge->v2;
+          r = pMerge->out;
+          blob_zero(&v);
+          blob_zero(&pMerge->v2);
+          blob_zero(&pMerge->out);
+          merge_ahead_free(pMerge);
+        }else{
+          content_get(ridt, &t);
+          content_get(ridv, &v);
+          rc = merge_3way(&v, zFullPath, &t, &r);
+        }
         if( rc>=0 ){
           if( !nochangeFlag ){
             blob_write_to_file(&r, zFullNewPath);
@@ -465,6 +597,12 @@ void update_cmd(void){
   }
   db_finalize(&q);
   db_finalize(&mtimeXfer);
+  ahead.atEof = 1;
+  merge_ahead_fill(&ahead);
+  db_finalize(&ahead.q);
+  workpool_delete(ahead.pPool);
+  free(ahead.aJob);
+  free(ahead.azName);
   fossil_print("--------------\n");
   show_common_info(tid, "updated-to:", 1, 0);
 
@@ -27,43 +27,169 @@
 #include "config.h"
 #include "verify.h"
 #include <assert.h>
+#include <zlib.h>
 
 /*
-** Load the record identify by rid.  Make sure we can reproduce it
-** without error.
+** The following bag holds the rid for every record that needs
+** to be verified.
+*/
+static Bag toVerify;
+static int inFinalVerify = 0;
+
+/*
+** When content_put() computes the SHA1 hash of new content itself, it
+** also records the size and a fast checksum of that content here by
+** calling verify_note_content().  Such an artifact is then verified
+** by checking that what is read back has the same size and checksum,
+** which proves the round trip through compression and deltas without
+** computing the SHA1 hash a second time.
+*/
+typedef struct VerifyNote VerifyNote;
+struct VerifyNote {
+  int rid;                /* The artifact */
+  int size;               /* Size of its content */
+  unsigned int cksum;     /* adler32() checksum of its content */
+};
+static struct {
+  int n;                  /* Number of entries in a[] */
+  int nAlloc;             /* Slots allocated for a[] */
+  VerifyNote *a;          /* One entry per noted artifact */
+} verifyNote;
+
+/*
+** Artifacts are verified in batches so that their hashes can be computed
+** by sha1sum_blob_many().  A batch is flushed when it holds VERIFY_BATCH
+** artifacts or VERIFY_BATCH_SIZE bytes of content.
+*/
+#define VERIFY_BATCH       256
+#define VERIFY_BATCH_SIZE  25000000
+static struct {
+  int n;                         /* Number of artifacts in the batch */
+  i64 sz;                        /* Total bytes of content in the batch */
+  int aRid[VERIFY_BATCH];        /* Record ID of each artifact */
+  Blob aUuid[VERIFY_BATCH];      /* Expected hash of each artifact */
+  Blob aContent[VERIFY_BATCH];   /* Content of each artifact */
+  Blob aHash[VERIFY_BATCH];      /* Computed hash of each artifact */
+} verifyBatch;
+
+/*
+** Check the hashes of every artifact in the current batch, using the
+** threads of pPool (which may be NULL) to compute them.
 **
 ** Panic if anything goes wrong.  If this procedure returns it means
 ** that everything is OK.
 */
-static void verify_rid(int rid){
-  Blob uuid, hash, content;
+static void verify_flush(WorkPool *pPool){
+  int i;
+  sha1sum_blob_many(verifyBatch.n, verifyBatch.aContent, verifyBatch.aHash,
+                    pPool);
+  for(i=0; i<verifyBatch.n; i++){
+    if( blob_compare(&verifyBatch.aUuid[i], &verifyBatch.aHash[i]) ){
+      fossil_fatal("hash of rid %d (%b) does not match its uuid (%b)",
+                    verifyBatch.aRid[i], &verifyBatch.aHash[i],
+                    &verifyBatch.aUuid[i]);
+    }
+    blob_reset(&verifyBatch.aContent[i]);
+    blob_reset(&verifyBatch.aHash[i]);
+    blob_reset(&verifyBatch.aUuid[i]);
+  }
+  verifyBatch.n = 0;
+  verifyBatch.sz = 0;
+}
+
+/*
+** Comparison function for qsort() and bsearch() on VerifyNote objects.
+*/
+static int verify_note_cmp(const void *pA, const void *pB){
+  const VerifyNote *a = (const VerifyNote*)pA;
+  const VerifyNote *b = (const VerifyNote*)pB;
+  return a->rid<b->rid ? -1 : a->rid>b->rid;
+}
+
+/*
+** content_stream_ex() callback for verify_streamed().
+*/
+static void verify_hash_step(void *pArg, const unsigned char *z, int n){
+  if( z ) sha1_ctx_step((SHA1Context*)pArg, (const char*)z, n);
+}
+
+/*
+** Check the size and hash of large full-text artifact rid as its
+** content is streamed, so that it is never held in memory in its
+** entirety.
+*/
+static void verify_streamed(int rid){
+  SHA1Context ctx;
+  char zHash[UUID_SIZE+1];
+  char *zUuid;
+  int n;
+  sha1_ctx_init(&ctx);
+  n = content_stream_ex(rid, verify_hash_step, &ctx);
+  sha1_ctx_finish(&ctx, zHash);
+  zUuid = db_text("", "SELECT uuid FROM blob WHERE rid=%d", rid);
+  if( n!=content_size(rid, -1) || fossil_strcmp(zUuid, zHash)!=0 ){
+    fossil_fatal("hash of rid %d (%s) does not match its uuid (%s)",
+                 rid, zHash, zUuid);
+  }
+  fossil_free(zUuid);
+}
+
+/*
+** Load the record identify by rid and add it to the current batch of
+** records to be verified.  If keepFlag is true, also leave a copy of
+** the content in the content cache, for use by the deltas that are
+** based on rid.
+*/
+static void verify_rid(int rid, WorkPool *pPool, int keepFlag){
+  Blob *pUuid;
+  VerifyNote *pNote = 0;
+  if( content_stream_size(rid)>=CONTENT_STREAM_SIZE ){
+    verify_streamed(rid);
+    return;
+  }
+  if( verifyNote.n>0 ){
+    VerifyNote x;
+    x.rid = rid;
+    pNote = bsearch(&x, verifyNote.a, verifyNote.n, sizeof(x),
+                    verify_note_cmp);
+  }
+  if( pNote ){
+    Blob content;
+    if( content_get(rid, &content)==0
+     || blob_size(&content)!=pNote->size
+     || adler32(0, (const Bytef*)blob_buffer(&content),
+                blob_size(&content))!=pNote->cksum
+    ){
+      fossil_fatal("content of rid %d cannot be read back correctly", rid);
+    }
+    blob_reset(&content);
+    return;
+  }
   if( content_size(rid, 0)<0 ){
     return;  /* No way to verify phantoms */
   }
-  blob_zero(&uuid);
-  db_blob(&uuid, "SELECT uuid FROM blob WHERE rid=%d", rid);
-  if( blob_size(&uuid)!=UUID_SIZE ){
+  pUuid = &verifyBatch.aUuid[verifyBatch.n];
+  blob_zero(pUuid);
+  db_blob(pUuid, "SELECT uuid FROM blob WHERE rid=%d", rid);
+  if( blob_size(pUuid)!=UUID_SIZE ){
     fossil_panic("not a valid rid: %d", rid);
   }
-  if( content_get(rid, &content) ){
-    sha1sum_blob(&content, &hash);
-    blob_reset(&content);
-    if( blob_compare(&uuid, &hash) ){
-      fossil_fatal("hash of rid %d (%b) does not match its uuid (%b)",
-                    rid, &hash, &uuid);
+  if( content_get(rid, &verifyBatch.aContent[verifyBatch.n]) ){
+    if( keepFlag ){
+      Blob copy;
+      blob_copy(&copy, &verifyBatch.aContent[verifyBatch.n]);
+      content_cache_insert(rid, &copy);
+    }
+    verifyBatch.sz += blob_size(&verifyBatch.aContent[verifyBatch.n]);
+    verifyBatch.aRid[verifyBatch.n++] = rid;
+    if( verifyBatch.n>=VERIFY_BATCH || verifyBatch.sz>=VERIFY_BATCH_SIZE ){
+      verify_flush(pPool);
     }
-    blob_reset(&hash);
+  }else{
+    blob_reset(pUuid);
   }
-  blob_reset(&uuid);
 }
 
-/*
-** The following bag holds the rid for every record that needs
-** to be verified.
-*/
-static Bag toVerify;
-static int inFinalVerify = 0;
-
 /*
 ** This routine is called just prior to each commit operation.  
 **
@@ -72,14 +198,22 @@ static int inFinalVerify = 0;
 */
 static int verify_at_commit(void){
   int rid;
+  WorkPool *pPool = 0;
   content_clear_cache();
   inFinalVerify = 1;
+  if( bag_count(&toVerify)-verifyNote.n>=VERIFY_BATCH ){
+    pPool = workpool_new(workpool_size(0));
+  }
+  qsort(verifyNote.a, verifyNote.n, sizeof(verifyNote.a[0]), verify_note_cmp);
   rid = bag_first(&toVerify);
   while( rid>0 ){
-    verify_rid(rid);
+    verify_rid(rid, pPool, 0);
     rid = bag_next(&toVerify, rid);
   }
+  verify_flush(pPool);
+  workpool_delete(pPool);
   bag_clear(&toVerify);
+  verifyNote.n = 0;
   inFinalVerify = 0;
   return 0;
 }
@@ -103,30 +237,151 @@ void verify_before_commit(int rid){
   }
 }
 
+/*
+** Arrange to verify artifact rid prior to committing, as with
+** verify_before_commit(), where pContent is the complete content of
+** rid and is known to match its SHA1 hash.
+*/
+void verify_note_content(int rid, const Blob *pContent){
+  VerifyNote *p;
+  verify_before_commit(rid);
+  if( verifyNote.n>=verifyNote.nAlloc ){
+    verifyNote.nAlloc = verifyNote.nAlloc*2 + 100;
+    verifyNote.a = fossil_realloc(verifyNote.a,
+                                  verifyNote.nAlloc*sizeof(verifyNote.a[0]));
+  }
+  p = &verifyNote.a[verifyNote.n++];
+  p->rid = rid;
+  p->size = blob_size(pContent);
+  p->cksum = adler32(0, (const Bytef*)blob_buffer(pContent),
+                     blob_size(pContent));
+}
+
 /*
 ** Cancel all pending verification operations.
 */
 void verify_cancel(void){
   bag_clear(&toVerify);
+  verifyNote.n = 0;
 }
 
 /*
 ** COMMAND: test-verify-all
 **
-** Verify all records in the repository.
+** Usage: %fossil test-verify-all ?OPTIONS?
+**
+** Verify all records in the repository.  Artifacts are visited in
+** an order that lets each delta be applied to the content of its
+** source that was just expanded, and their hashes are computed on
+** several threads.
+**
+** Options:
+**   --sample P    Verify only about P percent of the artifacts, chosen
+**                 at random.  P may be followed by "%".
+**   --threads N   Use N threads to compute hashes.  The default is the
+**                 number of CPUs.
 */
 void verify_all_cmd(void){
   Stmt q;
-  int cnt = 0;
-  db_must_be_within_tree();
-  db_prepare(&q, "SELECT rid FROM blob");
+  const char *zSample;
+  int mxSample = 10000;   /* Verify if random%10000 is less than this */
+  WorkPool *pPool;
+  int n = 0;              /* Number of artifacts */
+  int nAlloc = 0;         /* Slots allocated in the arrays below */
+  int *aRid = 0;          /* Record ID of each artifact, in order */
+  int *aSrc = 0;          /* Delta source of each artifact, or 0 */
+  int *aChild = 0;        /* Index+1 of the first delta based on each */
+  int *aNext = 0;         /* Index+1 of the next delta on the same source */
+  int *aStack;            /* Stack of artifacts still to be visited */
+  int nStack;
+  int i, cnt = 0;
+
+  db_find_and_open_repository(0, 0);
+  zSample = find_option("sample",0,1);
+  pPool = workpool_new(workpool_size(find_option("threads",0,1)));
+  if( zSample ){
+    double r = atof(zSample);
+    if( r<=0.0 || r>100.0 ){
+      fossil_fatal("the --sample percentage must be between 0 and 100");
+    }
+    mxSample = (int)(r*100.0);
+  }
+  db_prepare(&q,
+    "SELECT rid, coalesce((SELECT srcid FROM delta WHERE delta.rid=blob.rid),0)"
+    "  FROM blob ORDER BY rid"
+  );
   while( db_step(&q)==SQLITE_ROW ){
-    int rid = db_column_int(&q, 0);
-    verify_before_commit(rid);
-    cnt++;
-    assert( bag_count(&toVerify)==cnt );
+    if( n>=nAlloc ){
+      nAlloc = nAlloc*2 + 100;
+      aRid = fossil_realloc(aRid, nAlloc*sizeof(aRid[0]));
+      aSrc = fossil_realloc(aSrc, nAlloc*sizeof(aSrc[0]));
+    }
+    aRid[n] = db_column_int(&q, 0);
+    aSrc[n] = db_column_int(&q, 1);
+    n++;
   }
   db_finalize(&q);
-  verify_at_commit();
-  assert( bag_count(&toVerify)==0 );
+
+  /* Link every delta onto the list of deltas based on its source.
+  ** aRid[] is sorted, so the source is found by a binary search.
+  */
+  aChild = fossil_malloc( (n+1)*sizeof(aChild[0]) );
+  aNext = fossil_malloc( (n+1)*sizeof(aNext[0]) );
+  aStack = fossil_malloc( (n+1)*sizeof(aStack[0]) );
+  memset(aChild, 0, (n+1)*sizeof(aChild[0]));
+  nStack = 0;
+  for(i=n-1; i>=0; i--){
+    int lo = 0, hi = n-1;
+    aNext[i] = 0;
+    while( aSrc[i] && lo<=hi ){
+      int mid = (lo+hi)/2;
+      if( aRid[mid]<aSrc[i] ){
+        lo = mid+1;
+      }else if( aRid[mid]>aSrc[i] ){
+        hi = mid-1;
+      }else{
+        aNext[i] = aChild[mid];
+        aChild[mid] = i+1;
+        break;
+      }
+    }
+    if( aSrc[i]==0 || lo>hi ) aStack[nStack++] = i;
+  }
+
+  /* Visit the artifacts that are stored as full text, each followed
+  ** by the deltas that are based on it.  An artifact with deltas is
+  ** left in the content cache so that the deltas need not expand its
+  ** whole chain again.  Artifacts that are never reached (which means
+  ** that their delta chain is a loop) are verified last.
+  */
+  content_clear_cache();
+  for(i=0; i<=n; i++){
+    while( nStack>0 ){
+      int k = aStack[--nStack];
+      int x;
+      unsigned int r = 0;
+      if( aSrc[k]<0 ) continue;
+      aSrc[k] = -1;
+      if( mxSample<10000 ){
+        sqlite3_randomness(sizeof(r), &r);
+      }
+      if( (int)(r%10000)<mxSample ){
+        verify_rid(aRid[k], pPool, aChild[k]!=0);
+        cnt++;
+      }
+      for(x=aChild[k]; x; x=aNext[x-1]){
+        aStack[nStack++] = x-1;
+      }
+    }
+    if( i<n && aSrc[i]>0 ) aStack[nStack++] = i;
+  }
+  verify_flush(pPool);
+  workpool_delete(pPool);
+  content_clear_cache();
+  fossil_print("%d of %d artifacts verified\n", cnt, n);
+  free(aRid);
+  free(aSrc);
+  free(aChild);
+  free(aNext);
+  free(aStack);
 }
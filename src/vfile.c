@@ -73,56 +73,421 @@ int uuid_to_rid(const char *zUuid, int phantomize){
   return rid;
 }
 
+/*
+** An entry of the sorted list of UUIDs made by uuid_to_rid_many().
+*/
+typedef struct UuidSlot UuidSlot;
+struct UuidSlot {
+  const char *zUuid;     /* The UUID */
+  int i;                 /* Its index in the caller's array */
+};
 
 /*
-** Load a vfile from a record ID.
+** Comparison function for qsort() on UuidSlot objects.
 */
-void load_vfile_from_rid(int vid){
-  int rid, size;
-  Stmt ins, ridq;
+static int uuid_slot_cmp(const void *pA, const void *pB){
+  return strcmp(((const UuidSlot*)pA)->zUuid, ((const UuidSlot*)pB)->zUuid);
+}
+
+/*
+** The number of UUIDs looked up by each query of uuid_to_rid_many()
+*/
+#define UUID_BATCH  250
+
+/*
+** Set aRid[i] to the record ID of the exact UUID azUuid[i], or to 0 if
+** it is not in the BLOB table, for the n entries of azUuid[].  If aSize
+** is not NULL, also set aSize[i] to the size of the artifact, which is
+** -1 for phantoms and for UUIDs that are not found.
+**
+** This is the same as calling fast_uuid_to_rid() n times, but the
+** UUIDs are sorted and looked up UUID_BATCH at a time by a single query
+** that returns them in the same order, so that the answers are matched
+** up in a single pass.  Use it where many UUIDs are known in advance,
+** such as for the F-cards of a manifest or a run of "igot" cards.
+*/
+void uuid_to_rid_many(int n, const char **azUuid, int *aRid, int *aSize){
+  UuidSlot *a;
+  int i, iBase;
+  Blob sql;
+  Stmt q;
+
+  if( n<=0 ) return;
+  a = fossil_malloc( n*sizeof(a[0]) );
+  for(i=0; i<n; i++){
+    a[i].zUuid = azUuid[i];
+    a[i].i = i;
+    aRid[i] = 0;
+    if( aSize ) aSize[i] = -1;
+  }
+  qsort(a, n, sizeof(a[0]), uuid_slot_cmp);
+  blob_zero(&sql);
+  for(iBase=0; iBase<n; iBase+=UUID_BATCH){
+    int iEnd = iBase+UUID_BATCH<n ? iBase+UUID_BATCH : n;
+    blob_truncate(&sql, 0);
+    blob_append(&sql, "SELECT uuid, rid, size FROM blob WHERE uuid IN(", -1);
+    for(i=iBase; i<iEnd; i++){
+      blob_appendf(&sql, "%s%Q", i>iBase ? "," : "", a[i].zUuid);
+    }
+    blob_append(&sql, ") ORDER BY uuid", -1);
+    db_prepare(&q, "%s", blob_str(&sql));
+    i = iBase;
+    while( db_step(&q)==SQLITE_ROW ){
+      const char *zUuid = db_column_text(&q, 0);
+      while( i<iEnd && strcmp(a[i].zUuid, zUuid)<0 ) i++;
+      while( i<iEnd && strcmp(a[i].zUuid, zUuid)==0 ){
+        aRid[a[i].i] = db_column_int(&q, 1);
+        if( aSize ) aSize[a[i].i] = db_column_int(&q, 2);
+        i++;
+      }
+    }
+    db_finalize(&q);
+  }
+  blob_reset(&sql);
+  fossil_free(a);
+}
+
+/*
+** The sparse-checkout profile of the current checkout.
+*/
+static struct {
+  int isInit;            /* True after the profile has been read */
+  Glob *pGlob;           /* The profile, or NULL for a full checkout */
+} sparse;
+
+/*
+** Return the sparse-checkout profile of the current checkout, or NULL
+** if the checkout is not sparse.  The profile is a list of GLOB
+** patterns stored in VVAR under the name "sparse-glob".
+*/
+Glob *vfile_sparse_glob(void){
+  if( !sparse.isInit ){
+    char *zGlob = db_lget("sparse-glob", 0);
+    sparse.pGlob = glob_create(zGlob);
+    sparse.isInit = 1;
+    free(zGlob);
+  }
+  return sparse.pGlob;
+}
+
+/*
+** Forget the sparse-checkout profile, so that it is read from VVAR
+** again by the next call to vfile_sparse_glob().
+*/
+void vfile_sparse_reset(void){
+  glob_free(sparse.pGlob);
+  sparse.pGlob = 0;
+  sparse.isInit = 0;
+}
+
+/*
+** Return true if the file zPath, relative to the root of the checkout,
+** is part of the checkout.  That is so for every file unless there is a
+** sparse-checkout profile.  Otherwise a file is part of the checkout if
+** its name or the name of any directory that holds it matches the
+** profile.
+*/
+int vfile_in_sparse_profile(const char *zPath){
+  Glob *pGlob = vfile_sparse_glob();
+  char *zCopy;
+  int i, rc;
+  if( pGlob==0 || glob_match(pGlob, zPath) ) return 1;
+  zCopy = mprintf("%s", zPath);
+  for(i=0, rc=0; zCopy[i] && rc==0; i++){
+    if( zCopy[i]=='/' ){
+      zCopy[i] = 0;
+      rc = glob_match(pGlob, zCopy);
+      zCopy[i] = '/';
+    }
+  }
+  free(zCopy);
+  return rc!=0;
+}
+
+/*
+** In a sparse checkout, fill the TEMP table SPARSE_CARRY with the files
+** of check-in vid that are outside of the sparse-checkout profile, so
+** that a new check-in can carry them forward unchanged.  Return true if
+** the checkout is sparse and false if it is not.
+*/
+int vfile_sparse_carry(int vid){
   Manifest *p;
   ManifestFile *pFile;
+  Stmt ins;
+  if( vfile_sparse_glob()==0 ) return 0;
+  db_multi_exec(
+    "DROP TABLE IF EXISTS sparse_carry;"
+    "CREATE TEMP TABLE sparse_carry("
+    "  pathname TEXT PRIMARY KEY,"
+    "  uuid TEXT,"
+    "  rid INTEGER,"
+    "  isexe BOOLEAN,"
+    "  islink BOOLEAN"
+    ");"
+  );
+  p = manifest_get(vid, CFTYPE_MANIFEST);
+  if( p==0 ) return 1;
+  db_prepare(&ins,
+    "INSERT OR IGNORE INTO sparse_carry"
+    " SELECT :name, uuid, rid, :isexe, :islink FROM blob WHERE uuid=:uuid"
+    "   AND NOT EXISTS(SELECT 1 FROM vfile WHERE vid=%d"
+    "                     AND (pathname=:name OR origname=:name))", vid);
+  manifest_file_rewind(p);
+  while( (pFile = manifest_file_next(p,0))!=0 ){
+    if( pFile->zUuid==0 || vfile_in_sparse_profile(pFile->zName) ) continue;
+    db_bind_text(&ins, ":name", pFile->zName);
+    db_bind_text(&ins, ":uuid", pFile->zUuid);
+    db_bind_int(&ins, ":isexe", manifest_file_mperm(pFile)==PERM_EXE);
+    db_bind_int(&ins, ":islink", manifest_file_mperm(pFile)==PERM_LNK);
+    db_step(&ins);
+    db_reset(&ins);
+  }
+  db_finalize(&ins);
+  manifest_destroy(p);
+  return 1;
+}
 
+/*
+** Load a vfile from a record ID.
+**
+** In a sparse checkout, only files that match the sparse-checkout
+** profile are loaded.
+*/
+void load_vfile_from_rid(int vid){
   if( db_exists("SELECT 1 FROM vfile WHERE vid=%d", vid) ){
     return;
   }
-
   db_begin_transaction();
+  vfile_add_missing(vid);
+  db_end_transaction(0);
+}
+
+/*
+** Add to VFILE an entry for every file of check-in vid that matches the
+** sparse-checkout profile (or for every file, in a full checkout) and
+** that does not already have one, either under its own name or as the
+** original name of a renamed file.
+*/
+void vfile_add_missing(int vid){
+  Stmt ins;
+  Manifest *p;
+  ManifestFile *pFile;
+  ManifestFile **apFile;
+  const char **azUuid;
+  int *aRid, *aSize;
+  int i, n = 0, nAlloc;
+
   p = manifest_get(vid, CFTYPE_MANIFEST);
   if( p==0 ) return;
-  db_multi_exec("DELETE FROM vfile WHERE vid=%d", vid);
-  db_prepare(&ins,
-    "INSERT INTO vfile(vid,isexe,islink,rid,mrid,pathname) "
-    " VALUES(:vid,:isexe,:islink,:id,:id,:name)");
-  db_prepare(&ridq, "SELECT rid,size FROM blob WHERE uuid=:uuid");
-  db_bind_int(&ins, ":vid", vid);
+  nAlloc = p->nFile+10;
+  apFile = fossil_malloc( nAlloc*sizeof(apFile[0]) );
+  azUuid = fossil_malloc( nAlloc*sizeof(azUuid[0]) );
   manifest_file_rewind(p);
   while( (pFile = manifest_file_next(p,0))!=0 ){
     if( pFile->zUuid==0 || uuid_is_shunned(pFile->zUuid) ) continue;
-    db_bind_text(&ridq, ":uuid", pFile->zUuid);
-    if( db_step(&ridq)==SQLITE_ROW ){
-      rid = db_column_int(&ridq, 0);
-      size = db_column_int(&ridq, 0);
-    }else{
-      rid = 0;
-      size = 0;
+    if( !vfile_in_sparse_profile(pFile->zName) ) continue;
+    if( n>=nAlloc ){
+      nAlloc = nAlloc*2;
+      apFile = fossil_realloc(apFile, nAlloc*sizeof(apFile[0]));
+      azUuid = fossil_realloc(azUuid, nAlloc*sizeof(azUuid[0]));
     }
-    db_reset(&ridq);
-    if( rid==0 || size<0 ){
+    apFile[n] = pFile;
+    azUuid[n++] = pFile->zUuid;
+  }
+  aRid = fossil_malloc( (n+1)*sizeof(aRid[0])*2 );
+  aSize = &aRid[n+1];
+  uuid_to_rid_many(n, azUuid, aRid, aSize);
+  db_prepare(&ins,
+    "INSERT OR IGNORE INTO vfile(vid,isexe,islink,rid,mrid,pathname) "
+    " SELECT :vid,:isexe,:islink,:id,:id,:name"
+    "  WHERE NOT EXISTS(SELECT 1 FROM vfile"
+    "                    WHERE vid=:vid AND origname=:name)");
+  db_bind_int(&ins, ":vid", vid);
+  for(i=0; i<n; i++){
+    pFile = apFile[i];
+    if( aRid[i]==0 || aSize[i]<0 ){
       fossil_warning("content missing for %s", pFile->zName);
       continue;
     }
     db_bind_int(&ins, ":isexe", ( manifest_file_mperm(pFile)==PERM_EXE ));
-    db_bind_int(&ins, ":id", rid);
+    db_bind_int(&ins, ":id", aRid[i]);
     db_bind_text(&ins, ":name", pFile->zName);
     db_bind_int(&ins, ":islink", ( manifest_file_mperm(pFile)==PERM_LNK ));
     db_step(&ins);
     db_reset(&ins);
   }
-  db_finalize(&ridq);
   db_finalize(&ins);
+  fossil_free(apFile);
+  fossil_free(azUuid);
+  fossil_free(aRid);
   manifest_destroy(p);
-  db_end_transaction(0);
+}
+
+/*
+** Ask the program named by the "fsmonitor-command" setting which files
+** of checkout vid have changed since the previous time it was asked.
+** Return true if the answer can be used, in which case the relative
+** pathname of every file that might have changed is in the TEMP table
+** FSMON and the new token is in *pzToken.
+**
+** The program is run with the token it returned on the previous call
+** as its only argument, or with no argument the first time.  It prints
+** a new token on the first line of its output and the names of changed
+** files, one per line, after that.  The token is remembered only for
+** the current check-out, so the program is not trusted after a command
+** such as "update" or "commit" moves the checkout to another version.
+** Any failure, or an empty token, means that every file must be checked.
+*/
+static int vfile_fsmonitor_query(int vid, char **pzToken){
+  char *zCmd = db_get("fsmonitor-command", 0);
+  char *zToken = 0;
+  Blob cmd, out, line;
+  char zBuf[8192];
+  int fdIn, childPid, n;
+  FILE *pOut;
+  Stmt ins;
+  int nRoot = strlen(g.zLocalRoot);
+
+  *pzToken = 0;
+  if( zCmd==0 || zCmd[0]==0 ){
+    free(zCmd);
+    return 0;
+  }
+  if( db_lget_int("fsmonitor-vid", 0)==vid ){
+    zToken = db_lget("fsmonitor-token", 0);
+  }
+  blob_zero(&cmd);
+  blob_append(&cmd, zCmd, -1);
+  if( zToken ){
+    blob_append(&cmd, " ", 1);
+    shell_escape(&cmd, zToken);
+  }
+  free(zCmd);
+  if( popen2(blob_str(&cmd), &fdIn, &pOut, &childPid) || childPid==0 ){
+    fossil_warning("cannot run fsmonitor-command: %b", &cmd);
+    blob_reset(&cmd);
+    free(zToken);
+    return 0;
+  }
+  blob_reset(&cmd);
+  blob_zero(&out);
+  while( (n = read(fdIn, zBuf, sizeof(zBuf)))>0 ){
+    blob_append(&out, zBuf, n);
+  }
+  pclose2(fdIn, pOut, childPid);
+  blob_line(&out, &line);
+  if( blob_trim(&line)>0 ){
+    *pzToken = mprintf("%.*s", blob_size(&line), blob_buffer(&line));
+  }
+  if( zToken==0 || *pzToken==0 ){
+    blob_reset(&out);
+    free(zToken);
+    return 0;
+  }
+  free(zToken);
+  db_multi_exec("CREATE TEMP TABLE IF NOT EXISTS fsmon(name TEXT PRIMARY KEY);"
+                "DELETE FROM fsmon;");
+  db_prepare(&ins, "INSERT OR IGNORE INTO fsmon VALUES(:name)");
+  while( blob_line(&out, &line) ){
+    char *zName;
+    if( blob_trim(&line)==0 ) continue;
+    zName = mprintf("%.*s", blob_size(&line), blob_buffer(&line));
+    if( strncmp(zName, g.zLocalRoot, nRoot)==0 ){
+      db_bind_text(&ins, ":name", &zName[nRoot]);
+    }else{
+      db_bind_text(&ins, ":name", zName);
+    }
+    db_step(&ins);
+    db_reset(&ins);
+    free(zName);
+  }
+  db_finalize(&ins);
+  blob_reset(&out);
+  return 1;
+}
+
+/*
+** The inputs and results of checking one file for
+** vfile_check_signature().
+*/
+typedef struct SigCheck SigCheck;
+struct SigCheck {
+  int id;                /* VFILE.ID of the file */
+  char *zName;           /* Full pathname of the file */
+  int rid;               /* VFILE.MRID */
+  int isDeleted;         /* VFILE.DELETED */
+  int oldChnged;         /* VFILE.CHNGED before the check */
+  i64 oldMtime;          /* VFILE.MTIME before the check */
+  i64 origSize;          /* Size of the checked-in version */
+  char zUuid[UUID_SIZE+1];  /* SHA1 of the checked-in version, or "" */
+  int chnged;            /* New value for VFILE.CHNGED */
+  i64 currentMtime;      /* Modification time of the file on disk */
+  int notFile;           /* True if it exists but is not an ordinary file */
+};
+
+/*
+** A task for a worker thread: check the files aCheck[0..n-1].
+*/
+typedef struct SigCheckTask SigCheckTask;
+struct SigCheckTask {
+  SigCheck *aCheck;      /* First file to check */
+  int n;                 /* Number of files to check */
+  int useMtime;          /* True to trust an unchanged mtime */
+};
+
+/*
+** Return true if the SHA1 hash of file p is different from the
+** checked-in version.  A file that cannot be read has an empty hash.
+*/
+static int vfile_hash_differs(SigCheck *p, int isLink){
+  Blob fileCksum;
+  int rc;
+  if( sha1sum_file_ex(p->zName, isLink, &fileCksum) ){
+    blob_zero(&fileCksum);
+  }
+  rc = fossil_strcmp(blob_str(&fileCksum), p->zUuid)!=0;
+  blob_reset(&fileCksum);
+  return rc;
+}
+
+/*
+** Worker-thread half of vfile_check_signature().  Compute the new
+** VFILE.CHNGED and VFILE.MTIME of a range of files.  This routine must
+** not use the database.
+*/
+static void vfile_check_task(void *pArg){
+  SigCheckTask *pTask = (SigCheckTask*)pArg;
+  int i;
+  for(i=0; i<pTask->n; i++){
+    SigCheck *p = &pTask->aCheck[i];
+    FileWdStatus st;
+    int chnged = p->oldChnged;
+
+    file_wd_status(p->zName, &st);
+    p->currentMtime = st.mtime;
+    if( chnged==0 && (p->isDeleted || p->rid==0) ){
+      /* "fossil rm" or "fossil add" always change the file */
+      chnged = 1;
+    }else if( !st.isFileOrLink && st.size>=0 ){
+      p->notFile = 1;
+      chnged = 1;
+    }
+    if( p->origSize!=st.size ){
+      /* A file size change is definitive - the file has changed.  No
+      ** need to check the mtime or sha1sum */
+      chnged = 1;
+    }else if( chnged==1 && p->rid!=0 && !p->isDeleted ){
+      /* File is believed to have changed but it is the same size.
+      ** Double check that it really has changed by looking at content. */
+      if( !vfile_hash_differs(p, st.isLink) ) chnged = 0;
+    }else if( chnged==0 && (pTask->useMtime==0 || st.mtime!=p->oldMtime) ){
+      /* For files that were formerly believed to be unchanged, if their
+      ** mtime changes, or unconditionally if --sha1sum is used, check
+      ** to see if they have been edited by looking at their SHA1 sum */
+      if( vfile_hash_differs(p, st.isLink) ) chnged = 1;
+    }
+    p->chnged = chnged;
+  }
 }
 
 /*
@@ -150,92 +515,236 @@ void load_vfile_from_rid(int vid){
 ** If the mtime is used, it is used only to determine if files are the same.
 ** If the mtime of a file has changed, we still examine the on-disk content
 ** to see whether or not the edit was a null-edit.
+**
+** If the "fsmonitor-command" setting names a filesystem monitor, and
+** useSha1sum is false, only the files that the monitor reports as
+** changed are examined, along with files that are already known to be
+** changed, added, removed, or never examined before.
+**
+** The files are examined by a pool of worker threads, since on a large
+** checkout the stat() and SHA1 calls take far longer than the updates
+** to VFILE, which are all made by the main thread afterwards.
 */
 void vfile_check_signature(int vid, int notFileIsFatal, int useSha1sum){
+  const int nPerTask = 64;  /* Files checked by each worker-thread task */
   int nErr = 0;
   Stmt q;
-  Blob fileCksum, origCksum;
+  SigCheck *aCheck = 0;
+  SigCheckTask *aTask;
+  int nCheck = 0, nAlloc = 0, nTask, i;
+  WorkPool *pPool;
   int useMtime = useSha1sum==0 && db_get_boolean("mtime-changes", 1);
+  char *zToken = 0;
+  int useMonitor;
 
   db_begin_transaction();
+  useMonitor = useSha1sum==0 && vfile_fsmonitor_query(vid, &zToken);
   db_prepare(&q, "SELECT id, %Q || pathname,"
                  "       vfile.mrid, deleted, chnged, uuid, size, mtime"
                  "  FROM vfile LEFT JOIN blob ON vfile.mrid=blob.rid"
-                 " WHERE vid=%d ", g.zLocalRoot, vid);
+                 " WHERE vid=%d %s", g.zLocalRoot, vid,
+                 useMonitor ? "AND (chnged OR deleted OR vfile.mrid=0"
+                              " OR vfile.mtime=0"
+                              " OR pathname IN fsmon"
+                              " OR origname IN fsmon)" : "");
   while( db_step(&q)==SQLITE_ROW ){
-    int id, rid, isDeleted;
-    const char *zName;
-    int chnged = 0;
-    int oldChnged;
-    i64 oldMtime;
-    i64 currentMtime;
-    i64 origSize;
-    i64 currentSize;
-
-    id = db_column_int(&q, 0);
-    zName = db_column_text(&q, 1);
-    rid = db_column_int(&q, 2);
-    isDeleted = db_column_int(&q, 3);
-    oldChnged = chnged = db_column_int(&q, 4);
-    oldMtime = db_column_int64(&q, 7);
-    currentSize = file_wd_size(zName);
-    origSize = db_column_int64(&q, 6);
-    currentMtime = file_wd_mtime(0);
-    if( chnged==0 && (isDeleted || rid==0) ){
-      /* "fossil rm" or "fossil add" always change the file */
-      chnged = 1;
-    }else if( !file_wd_isfile_or_link(0) && currentSize>=0 ){
-      if( notFileIsFatal ){
-        fossil_warning("not an ordinary file: %s", zName);
-        nErr++;
-      }
-      chnged = 1;
+    SigCheck *p;
+    if( nCheck>=nAlloc ){
+      nAlloc = nAlloc*2 + 100;
+      aCheck = fossil_realloc(aCheck, nAlloc*sizeof(aCheck[0]));
     }
-    if( origSize!=currentSize ){
-      if( chnged!=1 ){
-        /* A file size change is definitive - the file has changed.  No
-        ** need to check the mtime or sha1sum */
-        chnged = 1;
-      }
-    }else if( chnged==1 && rid!=0 && !isDeleted ){
-      /* File is believed to have changed but it is the same size.
-      ** Double check that it really has changed by looking at content. */
-      assert( origSize==currentSize );
-      db_ephemeral_blob(&q, 5, &origCksum);
-      if( sha1sum_file(zName, &fileCksum) ){
-        blob_zero(&fileCksum);
-      }
-      if( blob_compare(&fileCksum, &origCksum)==0 ) chnged = 0;
-      blob_reset(&origCksum);
-      blob_reset(&fileCksum);
-    }else if( chnged==0 && (useMtime==0 || currentMtime!=oldMtime) ){
-      /* For files that were formerly believed to be unchanged, if their
-      ** mtime changes, or unconditionally if --sha1sum is used, check
-      ** to see if they have been edited by looking at their SHA1 sum */
-      assert( origSize==currentSize );
-      db_ephemeral_blob(&q, 5, &origCksum);
-      if( sha1sum_file(zName, &fileCksum) ){
-        blob_zero(&fileCksum);
-      }
-      if( blob_compare(&fileCksum, &origCksum) ){
-        chnged = 1;
-      }
-      blob_reset(&origCksum);
-      blob_reset(&fileCksum);
+    p = &aCheck[nCheck++];
+    memset(p, 0, sizeof(*p));
+    p->id = db_column_int(&q, 0);
+    p->zName = fossil_strdup(db_column_text(&q, 1));
+    p->rid = db_column_int(&q, 2);
+    p->isDeleted = db_column_int(&q, 3);
+    p->oldChnged = db_column_int(&q, 4);
+    if( db_column_bytes(&q, 5)==UUID_SIZE ){
+      memcpy(p->zUuid, db_column_text(&q, 5), UUID_SIZE+1);
     }
-    if( currentMtime!=oldMtime || chnged!=oldChnged ){
+    p->origSize = db_column_int64(&q, 6);
+    p->oldMtime = db_column_int64(&q, 7);
+  }
+  db_finalize(&q);
+
+  nTask = (nCheck+nPerTask-1)/nPerTask;
+  aTask = fossil_malloc(sizeof(aTask[0])*(nTask+1));
+  pPool = workpool_new(workpool_size(0));
+  for(i=0; i<nTask; i++){
+    aTask[i].aCheck = &aCheck[i*nPerTask];
+    aTask[i].n = i<nTask-1 ? nPerTask : nCheck-i*nPerTask;
+    aTask[i].useMtime = useMtime;
+    workpool_add(pPool, vfile_check_task, &aTask[i]);
+  }
+  workpool_wait(pPool);
+  workpool_delete(pPool);
+  free(aTask);
+
+  for(i=0; i<nCheck; i++){
+    SigCheck *p = &aCheck[i];
+    if( p->notFile && notFileIsFatal ){
+      fossil_warning("not an ordinary file: %s", p->zName);
+      nErr++;
+    }
+    if( p->currentMtime!=p->oldMtime || p->chnged!=p->oldChnged ){
       db_multi_exec("UPDATE vfile SET mtime=%lld, chnged=%d WHERE id=%d",
-                    currentMtime, chnged, id);
+                    p->currentMtime, p->chnged, p->id);
     }
+    free(p->zName);
   }
-  db_finalize(&q);
+  free(aCheck);
   if( nErr ) fossil_fatal("abort due to prior errors");
+  if( zToken ){
+    db_lset_int("fsmonitor-vid", vid);
+    db_lset("fsmonitor-token", zToken);
+    free(zToken);
+  }
   db_end_transaction(0);
 }
 
+/*
+** One file to be written by a worker thread for vfile_to_disk().
+*/
+typedef struct DiskWrite DiskWrite;
+struct DiskWrite {
+  int id;                /* VFILE.ID of the file */
+  char *zName;           /* Full pathname of the file */
+  Blob content;          /* Content to be written */
+  char *zCache;          /* Copy of the content in the checkout cache */
+  int useLink;           /* Hard link to zCache rather than clone it */
+  int isExe;             /* True if the file should be executable */
+  int exists;            /* True if a file of the same size exists */
+  int isSame;            /* Set if the file on disk already has content */
+  int isCloned;          /* Set if the file was made from the cache */
+  int exeChanged;        /* Set if the execute permission was changed */
+  i64 mtime;             /* Modification time after the write */
+  int rc;                /* 1: cannot open.  2: short write */
+};
+
+/*
+** Worker-thread half of vfile_to_disk().  Write one ordinary file,
+** unless the file is already there with the same content, and set its
+** execute permission.  The directory that holds the file must already
+** exist.  This routine must not use the database or fileStat.
+*/
+static void vfile_write_task(void *pArg){
+  DiskWrite *p = (DiskWrite*)pArg;
+  FileWdStatus st;
+  FILE *f;
+  int n = blob_size(&p->content);
+
+  if( p->exists && (f = fossil_fopen(p->zName, "rb"))!=0 ){
+    char *zOnDisk = fossil_malloc(n+1);
+    p->isSame = fread(zOnDisk, 1, n+1, f)==n
+             && memcmp(zOnDisk, blob_buffer(&p->content), n)==0;
+    fclose(f);
+    free(zOnDisk);
+  }
+  if( !p->isSame && p->zCache
+   && file_cache_put(p->zCache, &p->content)==0
+   && file_clone(p->zCache, p->zName, p->useLink && !p->isExe)==0
+  ){
+    p->isCloned = 1;
+  }
+  if( !p->isSame && !p->isCloned ){
+    if( file_unshare(p->zName) ){
+      p->rc = 1;
+      return;
+    }
+    f = fossil_fopen(p->zName, "wb");
+    if( f==0 ){
+      p->rc = 1;
+      return;
+    }
+    if( fwrite(blob_buffer(&p->content), 1, n, f)!=n ) p->rc = 2;
+    fclose(f);
+  }
+  p->exeChanged = file_wd_setexe(p->zName, p->isExe);
+  file_wd_status(p->zName, &st);
+  p->mtime = st.mtime;
+}
+
+/*
+** Make sure that the directory holding file zName exists.  pPrev
+** holds the directory made by the previous call, which is not checked
+** again, since the files of a checkout are usually grouped by directory.
+*/
+static void vfile_make_parent(const char *zName, Blob *pPrev){
+  int i, n;
+  char *zDir;
+  for(n=strlen(zName)-1; n>0 && zName[n]!='/'; n--){}
+  if( n<=0 ) return;
+  if( blob_size(pPrev)==n && memcmp(blob_buffer(pPrev), zName, n)==0 ){
+    return;
+  }
+  zDir = mprintf("%.*s", n, zName);
+  for(i=1; i<=n; i++){
+    if( zDir[i]=='/' || zDir[i]==0 ){
+      char c = zDir[i];
+      zDir[i] = 0;
+#if defined(_WIN32)
+      if( !(i==2 && zDir[1]==':') )
+#endif
+      if( file_mkdir(zDir, 1) ){
+        fossil_fatal("unable to create directory %s", zDir);
+      }
+      zDir[i] = c;
+    }
+  }
+  blob_reset(pPrev);
+  blob_append(pPrev, zDir, n);
+  free(zDir);
+}
+
+/*
+** Finish the writes in aWrite[0..nWrite-1] started by vfile_to_disk():
+** wait for the workers, then report and record the results in order.
+*/
+static void vfile_write_finish(
+  WorkPool *pPool,       /* The workers doing the writes */
+  DiskWrite *aWrite,     /* The writes */
+  int nWrite,            /* Number of writes */
+  int verbose            /* Print the name of every file written */
+){
+  int i;
+  int nRepos = strlen(g.zLocalRoot);
+  workpool_wait(pPool);
+  for(i=0; i<nWrite; i++){
+    DiskWrite *p = &aWrite[i];
+    if( p->rc==1 ){
+      fossil_fatal("unable to open file \"%s\" for writing", p->zName);
+    }else if( p->rc==2 ){
+      fossil_fatal("short write to %s", p->zName);
+    }
+    if( !p->isSame && verbose ) fossil_print("%s\n", &p->zName[nRepos]);
+    if( !p->isSame || p->exeChanged ){
+      db_multi_exec("UPDATE vfile SET mtime=%lld WHERE id=%d",
+                    p->mtime, p->id);
+    }
+    blob_reset(&p->content);
+    free(p->zName);
+    free(p->zCache);
+  }
+}
+
 /*
 ** Write all files from vid to the disk.  Or if vid==0 and id!=0
 ** write just the specific file where VFILE.ID=id.
+**
+** When the whole of vid is written, the main thread expands the content
+** of each file (sharing the work of delta expansion through the content
+** cache) and creates its directory, while a pool of worker threads
+** compares and writes the files.  Symlinks, files that would need the
+** user to confirm an overwrite, and anything else unusual are written
+** by the main thread.
+**
+** If the "checkout-cache" setting names a directory, the workers keep
+** a copy of every file written there, named by its artifact ID, and
+** make the file in the checkout share storage with that copy: a
+** copy-on-write clone where the filesystem supports one, or a read-only
+** hard link if "checkout-cache-link" is on.  Checkouts of the same
+** project then share the storage of the files they have in common.
 */
 void vfile_to_disk(
   int vid,               /* vid to write to disk */
@@ -243,24 +752,47 @@ void vfile_to_disk(
   int verbose,           /* Output progress information */
   int promptFlag         /* Prompt user to confirm overwrites */
 ){
+  const int mxBatch = 1000;           /* Files written per batch */
+  const i64 mxBatchSize = 50000000;   /* Content bytes per batch */
   Stmt q;
   Blob content;
   int nRepos = strlen(g.zLocalRoot);
+  WorkPool *pPool = 0;
+  DiskWrite *aWrite = 0;
+  int nWrite = 0;
+  i64 szBatch = 0;
+  Blob prevDir;
+  Blob cacheDir;
+  int useLink = 0;
 
   if( vid>0 && id==0 ){
-    db_prepare(&q, "SELECT id, %Q || pathname, mrid, isexe, islink"
+    db_prepare(&q, "SELECT id, %Q || pathname, mrid, isexe, islink,"
+                   "       (SELECT uuid FROM blob WHERE rid=mrid)"
                    "  FROM vfile"
                    " WHERE vid=%d AND mrid>0",
                    g.zLocalRoot, vid);
   }else{
     assert( vid==0 && id>0 );
-    db_prepare(&q, "SELECT id, %Q || pathname, mrid, isexe, islink"
+    db_prepare(&q, "SELECT id, %Q || pathname, mrid, isexe, islink,"
+                   "       (SELECT uuid FROM blob WHERE rid=mrid)"
                    "  FROM vfile"
                    " WHERE id=%d AND mrid>0",
                    g.zLocalRoot, id);
   }
+  blob_zero(&prevDir);
+  blob_zero(&cacheDir);
+  if( id==0 ){
+    char *zCacheDir = db_get("checkout-cache", 0);
+    if( zCacheDir && zCacheDir[0] ){
+      file_canonical_name(zCacheDir, &cacheDir);
+      useLink = db_get_boolean("checkout-cache-link", 0);
+    }
+    free(zCacheDir);
+    pPool = workpool_new(workpool_size(0));
+    aWrite = fossil_malloc(mxBatch*sizeof(aWrite[0]));
+  }
   while( db_step(&q)==SQLITE_ROW ){
-    int id, rid, isExe, isLink;
+    int id, rid, isExe, isLink, sz;
     const char *zName;
 
     id = db_column_int(&q, 0);
@@ -268,7 +800,60 @@ void vfile_to_disk(
     rid = db_column_int(&q, 2);
     isExe = db_column_int(&q, 3);
     isLink = db_column_int(&q, 4);
+    if( !isLink && (sz = content_stream_size(rid))>=CONTENT_STREAM_SIZE ){
+      /* Write a large artifact a piece at a time, unless the file on
+      ** disk already holds it */
+      i64 szDisk = file_wd_size(zName);
+      Blob hash;
+      int isSame = 0;
+      if( szDisk==sz && sha1sum_file(zName, &hash)==0 ){
+        isSame = fossil_strcmp(blob_str(&hash), db_column_text(&q, 5))==0;
+        blob_reset(&hash);
+      }
+      if( isSame || !promptFlag || szDisk<0 ){
+        if( !isSame ){
+          if( verbose ) fossil_print("%s\n", &zName[nRepos]);
+          vfile_make_parent(zName, &prevDir);
+          if( szDisk>=0 && file_wd_islink(zName) ){
+            file_delete(zName);
+          }
+          content_write_to_file(rid, zName);
+        }
+        file_wd_setexe(zName, isExe);
+        db_multi_exec("UPDATE vfile SET mtime=%lld WHERE id=%d",
+                      file_wd_mtime(zName), id);
+        continue;
+      }
+    }
     content_get(rid, &content);
+    if( pPool && !isLink ){
+      FileWdStatus st;
+      file_wd_status(zName, &st);
+      if( st.size<0 || (!promptFlag && st.isFileOrLink && !st.isLink) ){
+        DiskWrite *p = &aWrite[nWrite++];
+        vfile_make_parent(zName, &prevDir);
+        memset(p, 0, sizeof(*p));
+        p->id = id;
+        p->zName = fossil_strdup(zName);
+        p->content = content;
+        if( blob_size(&cacheDir) ){
+          const char *zUuid = db_column_text(&q, 5);
+          p->zCache = mprintf("%s/%.2s/%s", blob_str(&cacheDir),
+                              zUuid, &zUuid[2]);
+          p->useLink = useLink;
+        }
+        p->isExe = isExe;
+        p->exists = st.size==blob_size(&content);
+        szBatch += blob_size(&content);
+        workpool_add(pPool, vfile_write_task, p);
+        if( nWrite>=mxBatch || szBatch>=mxBatchSize ){
+          vfile_write_finish(pPool, aWrite, nWrite, verbose);
+          nWrite = 0;
+          szBatch = 0;
+        }
+        continue;
+      }
+    }
     if( file_is_the_same(&content, zName) ){
       blob_reset(&content);
       if( file_wd_setexe(zName, isExe) ){
@@ -314,6 +899,13 @@ void vfile_to_disk(
                   file_wd_mtime(zName), id);
   }
   db_finalize(&q);
+  if( pPool ){
+    vfile_write_finish(pPool, aWrite, nWrite, verbose);
+    workpool_delete(pPool);
+    free(aWrite);
+  }
+  blob_reset(&prevDir);
+  blob_reset(&cacheDir);
 }
 
 
@@ -334,21 +926,32 @@ void vfile_unlink(int vid){
   db_multi_exec("UPDATE vfile SET mtime=NULL WHERE vid=%d AND mrid>0", vid);
 }
 
+/*
+** Return true if zFile is large enough to be a checkout database.
+*/
+static int vfile_is_checkout_db(const char *zFile){
+  FileWdStatus st;
+  file_wd_status(zFile, &st);
+  return st.size>=1024;
+}
+
 /*
 ** Check to see if the directory named in zPath is the top of a checkout.
 ** In other words, check to see if directory pPath contains a file named
 ** "_FOSSIL_" or ".fslckout".  Return true or false.
+**
+** This routine is safe to call from a worker thread.
 */
 int vfile_top_of_checkout(const char *zPath){
   char *zFile;
   int fileFound = 0;
 
   zFile = mprintf("%s/_FOSSIL_", zPath);
-  fileFound = file_size(zFile)>=1024;
+  fileFound = vfile_is_checkout_db(zFile);
   fossil_free(zFile);
   if( !fileFound ){
     zFile = mprintf("%s/.fslckout", zPath);
-    fileFound = file_size(zFile)>=1024;
+    fileFound = vfile_is_checkout_db(zFile);
     fossil_free(zFile);
   }
 
@@ -359,13 +962,165 @@ int vfile_top_of_checkout(const char *zPath){
   */
   if( !fileFound ){
     zFile = mprintf("%s/.fos", zPath);
-    fileFound = file_size(zFile)>=1024;
+    fileFound = vfile_is_checkout_db(zFile);
     fossil_free(zFile);
   }
   return fileFound;
 }
 
 
+/*
+** When scanProgress is true, vfile_scan() shows a running count of the
+** files it has found.  nScan is that count.
+*/
+static int scanProgress = 0;
+static int nScan = 0;
+
+/*
+** Turn the progress display of vfile_scan() on or off.
+*/
+void vfile_scan_progress(int onOff){
+  scanProgress = onOff;
+}
+
+/*
+** One directory read by a worker thread of vfile_scan().  A task reads
+** only its own directory and adds a task of its own for each
+** subdirectory, so the threads share the whole tree between them
+** however unevenly it is shaped.  Nothing in this structure is touched
+** by more than one thread.
+*/
+typedef struct ScanDir ScanDir;
+struct ScanDir {
+  WorkPool *pPool;       /* Pool that runs the tasks of the scan */
+  int nPrefix;           /* Characters of a path to omit from names */
+  int allFlag;           /* Include files whose names begin with "." */
+  Glob *pIgnore;         /* Omit files and directories that match */
+  char *zPath;           /* Full pathname of the directory */
+  Blob files;            /* Names of files found, each zero-terminated */
+  int nFile;             /* Number of names in files */
+  int nSub;              /* Number of entries in aSub[] */
+  ScanDir **aSub;        /* Subdirectories, each read by its own task */
+};
+
+/*
+** Return a new ScanDir for the directory zPath, with the same settings
+** as pFrom.
+*/
+static ScanDir *vfile_scan_dir_new(ScanDir *pFrom, const char *zPath){
+  ScanDir *p = fossil_malloc(sizeof(*p));
+  *p = *pFrom;
+  p->zPath = fossil_strdup(zPath);
+  blob_zero(&p->files);
+  p->nFile = 0;
+  p->nSub = 0;
+  p->aSub = 0;
+  return p;
+}
+
+/*
+** Worker-thread half of vfile_scan().  Read the directory pArg and
+** queue a task for every subdirectory that is not ignored.  This
+** routine must not use the database.
+*/
+static void vfile_scan_task(void *pArg){
+  ScanDir *p = (ScanDir*)pArg;
+  ScanDir *pSub;
+  DIR *d;
+  struct dirent *pEntry;
+  char *zMbcs;
+  Blob path;
+  int origSize;
+
+  blob_zero(&path);
+  blob_append(&path, p->zPath, -1);
+  origSize = blob_size(&path);
+  zMbcs = fossil_utf8_to_mbcs(p->zPath);
+  d = opendir(zMbcs);
+  if( d ){
+    while( (pEntry=readdir(d))!=0 ){
+      char *zPath;
+      char *zUtf8;
+      FileWdStatus st;
+      if( pEntry->d_name[0]=='.' ){
+        if( !p->allFlag ) continue;
+        if( pEntry->d_name[1]==0 ) continue;
+        if( pEntry->d_name[1]=='.' && pEntry->d_name[2]==0 ) continue;
+      }
+      zUtf8 = fossil_mbcs_to_utf8(pEntry->d_name);
+      blob_append(&path, "/", 1);
+      blob_append(&path, zUtf8, -1);
+      fossil_mbcs_free(zUtf8);
+      zPath = blob_str(&path);
+      if( glob_match(p->pIgnore, &zPath[p->nPrefix+1]) ){
+        blob_resize(&path, origSize);
+        continue;
+      }
+      file_wd_status(zPath, &st);
+      if( st.isDir ){
+        /* Prune an ignored subtree before it is read */
+        blob_append(&path, "/", 1);
+        if( !glob_match(p->pIgnore, &blob_str(&path)[p->nPrefix+1]) ){
+          blob_resize(&path, blob_size(&path)-1);
+          zPath = blob_str(&path);
+          if( !vfile_top_of_checkout(zPath) ){
+            pSub = vfile_scan_dir_new(p, zPath);
+            if( (p->nSub%10)==0 ){
+              p->aSub = fossil_realloc(p->aSub, (p->nSub+10)*sizeof(pSub));
+            }
+            p->aSub[p->nSub++] = pSub;
+          }
+        }
+      }else if( st.isFileOrLink
+             && vfile_in_sparse_profile(&zPath[p->nPrefix+1]) ){
+        blob_append(&p->files, &zPath[p->nPrefix+1],
+                    blob_size(&path)-p->nPrefix);
+        p->nFile++;
+      }
+      blob_resize(&path, origSize);
+    }
+    closedir(d);
+  }
+  fossil_mbcs_free(zMbcs);
+  blob_reset(&path);
+
+  /* Queue the subdirectories only now, so that in serial mode the
+  ** directory is closed before its subdirectories are opened */
+  {
+    int i;
+    for(i=0; i<p->nSub; i++){
+      workpool_add(p->pPool, vfile_scan_task, p->aSub[i]);
+    }
+  }
+}
+
+/*
+** Insert the names of files found by vfile_scan_task() for the
+** directory p and all of its subdirectories into table SFILE using
+** the prepared statement pIns, then free p.
+*/
+static void vfile_scan_insert(ScanDir *p, Stmt *pIns){
+  const char *z = blob_buffer(&p->files);
+  int i;
+  for(i=0; i<p->nFile; i++){
+    db_bind_text(pIns, ":file", z);
+    db_step(pIns);
+    db_reset(pIns);
+    z += strlen(z)+1;
+    nScan++;
+    if( scanProgress && nScan%1000==0 ){
+      fossil_print("  %d files scanned...\r", nScan);
+    }
+  }
+  for(i=0; i<p->nSub; i++){
+    vfile_scan_insert(p->aSub[i], pIns);
+  }
+  blob_reset(&p->files);
+  fossil_free(p->aSub);
+  fossil_free(p->zPath);
+  fossil_free(p);
+}
+
 /*
 ** Load into table SFILE the name of every ordinary file in
 ** the directory pPath.   Omit the first nPrefix characters of
@@ -378,17 +1133,19 @@ int vfile_top_of_checkout(const char *zPath){
 **
 ** Any files or directories that match the glob pattern pIgnore are 
 ** excluded from the scan.  Name matching occurs after the first
-** nPrefix characters are elided from the filename.
+** nPrefix characters are elided from the filename.  So are files
+** outside of the sparse-checkout profile, if there is one.
+**
+** The directories are read by a pool of worker threads, and the names
+** they find are inserted by the main thread once all are read.
 */
 void vfile_scan(Blob *pPath, int nPrefix, int allFlag, Glob *pIgnore){
-  DIR *d;
   int origSize;
-  const char *zDir;
-  struct dirent *pEntry;
   int skipAll = 0;
-  static Stmt ins;
-  static int depth = 0;
-  char *zMbcs;
+  Stmt ins;
+  WorkPool *pPool;
+  ScanDir x;             /* Settings shared by every ScanDir */
+  ScanDir *pRoot;
 
   origSize = blob_size(pPath);
   if( pIgnore ){
@@ -398,51 +1155,145 @@ void vfile_scan(Blob *pPath, int nPrefix, int allFlag, Glob *pIgnore){
   }
   if( skipAll ) return;
 
-  if( depth==0 ){
-    db_prepare(&ins,
-       "INSERT OR IGNORE INTO sfile(x) SELECT :file"
-       "  WHERE NOT EXISTS(SELECT 1 FROM vfile WHERE pathname=:file)"
-    );
+  /* Read the sparse-checkout profile before the worker threads use it */
+  vfile_sparse_glob();
+  memset(&x, 0, sizeof(x));
+  x.pPool = pPool = workpool_new(workpool_size(0));
+  x.nPrefix = nPrefix;
+  x.allFlag = allFlag;
+  x.pIgnore = pIgnore;
+  pRoot = vfile_scan_dir_new(&x, blob_str(pPath));
+  workpool_add(pPool, vfile_scan_task, pRoot);
+  workpool_wait(pPool);
+  workpool_delete(pPool);
+
+  nScan = 0;
+  db_begin_transaction();
+  db_prepare(&ins,
+     "INSERT OR IGNORE INTO sfile(x) SELECT :file"
+     "  WHERE NOT EXISTS(SELECT 1 FROM vfile WHERE pathname=:file)"
+  );
+  vfile_scan_insert(pRoot, &ins);
+  db_finalize(&ins);
+  db_end_transaction(0);
+  if( scanProgress && nScan>=1000 ){
+    fossil_print("  %d files scanned\n", nScan);
   }
-  depth++;
+}
 
-  zDir = blob_str(pPath);
-  zMbcs = fossil_utf8_to_mbcs(zDir);
-  d = opendir(zMbcs);
-  if( d ){
-    while( (pEntry=readdir(d))!=0 ){
-      char *zPath;
-      char *zUtf8;
-      if( pEntry->d_name[0]=='.' ){
-        if( !allFlag ) continue;
-        if( pEntry->d_name[1]==0 ) continue;
-        if( pEntry->d_name[1]=='.' && pEntry->d_name[2]==0 ) continue;
-      }
-      zUtf8 = fossil_mbcs_to_utf8(pEntry->d_name);
-      blob_appendf(pPath, "/%s", zUtf8);
-      fossil_mbcs_free(zUtf8);
-      zPath = blob_str(pPath);
-      if( glob_match(pIgnore, &zPath[nPrefix+1]) ){
-        /* do nothing */
-      }else if( file_wd_isdir(zPath)==1 ){
-        if( !vfile_top_of_checkout(zPath) ){
-          vfile_scan(pPath, nPrefix, allFlag, pIgnore);
-        }
-      }else if( file_wd_isfile_or_link(zPath) ){
-        db_bind_text(&ins, ":file", &zPath[nPrefix+1]);
-        db_step(&ins);
-        db_reset(&ins);
-      }
-      blob_resize(pPath, origSize);
-    }
-    closedir(d);
+/*
+** Add one file to the aggregate checksum p.  The file name, the size
+** of the content, and the content itself all contribute.
+*/
+static void vfile_cksum_add(MD5Context *p, const char *zName, Blob *pFile){
+  char zBuf[100];
+  md5_ctx_step(p, zName, -1);
+  sqlite3_snprintf(sizeof(zBuf), zBuf, " %d\n", blob_size(pFile));
+  md5_ctx_step(p, zBuf, -1);
+  md5_ctx_step_blob(p, pFile);
+}
+
+/*
+** content_stream_ex() callback that adds to an aggregate checksum.
+*/
+static void vfile_cksum_step(void *pArg, const unsigned char *z, int n){
+  if( z ) md5_ctx_step((MD5Context*)pArg, (const char*)z, n);
+}
+
+/*
+** Add file zName, whose content is artifact rid, to the aggregate
+** checksum p.  Large full-text artifacts are streamed.  Others are
+** read into pFile, which must be zeroed, and left there so that the
+** caller can reuse them.  Return true if pFile holds the content.
+*/
+static int vfile_cksum_add_rid(
+  MD5Context *p,
+  const char *zName,
+  int rid,
+  Blob *pFile
+){
+  char zBuf[100];
+  int sz = content_stream_size(rid);
+  if( sz<CONTENT_STREAM_SIZE ){
+    content_get(rid, pFile);
+    vfile_cksum_add(p, zName, pFile);
+    return 1;
   }
-  fossil_mbcs_free(zMbcs);
+  md5_ctx_step(p, zName, -1);
+  sqlite3_snprintf(sizeof(zBuf), zBuf, " %d\n", sz);
+  md5_ctx_step(p, zBuf, -1);
+  content_stream_ex(rid, vfile_cksum_step, p);
+  return 0;
+}
 
-  depth--;
-  if( depth==0 ){
-    db_finalize(&ins);
+/*
+** Add file zName, whose content is the file zFullpath on disk, to the
+** aggregate checksum p without reading it all into memory.  Return
+** non-zero if the file cannot be read.
+*/
+static int vfile_cksum_add_file(
+  MD5Context *p,
+  const char *zName,
+  const char *zFullpath
+){
+  char zBuf[65536];
+  FILE *in;
+  int n;
+  in = fossil_fopen(zFullpath, "rb");
+  if( in==0 ) return 1;
+  md5_ctx_step(p, zName, -1);
+  sqlite3_snprintf(sizeof(zBuf), zBuf, " %lld\n", file_wd_size(zFullpath));
+  md5_ctx_step(p, zBuf, -1);
+  while( (n = (int)fread(zBuf, 1, sizeof(zBuf), in))>0 ){
+    md5_ctx_step(p, zBuf, n);
   }
+  fclose(in);
+  return 0;
+}
+
+/*
+** One file read by a worker thread for vfile_aggregate_checksum_disk().
+*/
+typedef struct CksumRead CksumRead;
+struct CksumRead {
+  char *zFullpath;       /* File on disk to read, or NULL to use rid */
+  char *zName;           /* Name of the file in the checksum */
+  int rid;               /* Repository artifact if zFullpath is NULL */
+  int isLink;            /* Set if the file is a symlink, which is not read */
+  int isLarge;           /* Set if the file is too large to read */
+  int rc;                /* Set if the file cannot be read */
+  Blob content;          /* Content of the file */
+};
+
+/*
+** Worker-thread half of vfile_aggregate_checksum_disk().  Read one
+** file from disk.  This routine must not use the database or fileStat.
+*/
+static void vfile_cksum_read_task(void *pArg){
+  CksumRead *p = (CksumRead*)pArg;
+  FileWdStatus st;
+  FILE *in;
+  file_wd_status(p->zFullpath, &st);
+  if( st.isLink ){
+    p->isLink = 1;
+    return;
+  }
+  if( st.size>=CONTENT_STREAM_SIZE ){
+    p->isLarge = 1;
+    return;
+  }
+  in = fossil_fopen(p->zFullpath, "rb");
+  if( in==0 ){
+    p->rc = 1;
+    return;
+  }
+  for(;;){
+    char zBuf[8192];
+    int n = fread(zBuf, 1, sizeof(zBuf), in);
+    if( n<=0 ) break;
+    blob_append(&p->content, zBuf, n);
+  }
+  fclose(in);
 }
 
 /*
@@ -465,11 +1316,20 @@ void vfile_scan(Blob *pPath, int nPrefix, int allFlag, Glob *pIgnore){
 ** and their original name if they are not in Global.aCommitFile[]
 **
 ** Return the resulting checksum in blob pOut.
+**
+** Worker threads read each batch of files while the main thread adds
+** the previous batch to the checksum, which must be done in order.
 */
 void vfile_aggregate_checksum_disk(int vid, Blob *pOut){
-  FILE *in;
+  const int mxBatch = 64;    /* Files read per batch */
   Stmt q;
-  char zBuf[4096];
+  char zBuf[100];
+  MD5Context ctx;
+  WorkPool *pPool;
+  CksumRead *aBuf;           /* Space for two batches */
+  CksumRead *aRead, *aPrev;  /* The batch being read and the one before */
+  int nRead, nPrev = 0;
+  int i, haveRow;
 
   db_must_be_within_tree();
   db_prepare(&q, 
@@ -479,62 +1339,73 @@ void vfile_aggregate_checksum_disk(int vid, Blob *pOut){
       " ORDER BY pathname /*scan*/",
       g.zLocalRoot, vid
   );
-  md5sum_init();
-  while( db_step(&q)==SQLITE_ROW ){
-    const char *zFullpath = db_column_text(&q, 0);
-    const char *zName = db_column_text(&q, 1);
-    int isSelected = db_column_int(&q, 3);
-
-    if( isSelected ){
-      md5sum_step_text(zName, -1);
-      if( file_wd_islink(zFullpath) ){
-        /* Instead of file content, use link destination path */
-        Blob pathBuf;
-
-        sqlite3_snprintf(sizeof(zBuf), zBuf, " %ld\n", 
-                         blob_read_link(&pathBuf, zFullpath));
-        md5sum_step_text(zBuf, -1);
-        md5sum_step_text(blob_str(&pathBuf), -1);
-        blob_reset(&pathBuf);
+  md5_ctx_init(&ctx);
+  pPool = workpool_new(workpool_size(0));
+  aBuf = fossil_malloc(2*mxBatch*sizeof(aBuf[0]));
+  aRead = aBuf;
+  aPrev = &aBuf[mxBatch];
+  haveRow = db_step(&q)==SQLITE_ROW;
+  while( haveRow || nPrev>0 ){
+    CksumRead *aSwap;
+
+    /* Start reading the next batch */
+    for(nRead=0; haveRow && nRead<mxBatch; nRead++){
+      CksumRead *p = &aRead[nRead];
+      const char *zName = db_column_text(&q, 1);
+      const char *zOrigName = db_column_text(&q, 2);
+      memset(p, 0, sizeof(*p));
+      blob_zero(&p->content);
+      if( db_column_int(&q, 3) ){
+        p->zName = fossil_strdup(zName);
+        p->zFullpath = fossil_strdup(db_column_text(&q, 0));
+        workpool_add(pPool, vfile_cksum_read_task, p);
       }else{
-        in = fossil_fopen(zFullpath,"rb");
-        if( in==0 ){
-          md5sum_step_text(" 0\n", -1);
+        p->zName = fossil_strdup(zOrigName ? zOrigName : zName);
+        p->rid = db_column_int(&q, 4);
+      }
+      haveRow = db_step(&q)==SQLITE_ROW;
+    }
+
+    /* Add the batch read before to the checksum */
+    for(i=0; i<nPrev; i++){
+      CksumRead *p = &aPrev[i];
+      if( p->isLarge
+       && vfile_cksum_add_file(&ctx, p->zName, p->zFullpath)==0
+      ){
+        free(p->zFullpath);
+      }else if( p->zFullpath ){
+        md5_ctx_step(&ctx, p->zName, -1);
+        if( p->isLink ){
+          /* Instead of file content, use link destination path */
+          blob_read_link(&p->content, p->zFullpath);
+        }else if( p->rc ){
+          md5_ctx_step(&ctx, " 0\n", -1);
+          free(p->zFullpath);
+          free(p->zName);
           continue;
         }
-        fseek(in, 0L, SEEK_END);
-        sqlite3_snprintf(sizeof(zBuf), zBuf, " %ld\n", ftell(in));
-        fseek(in, 0L, SEEK_SET);
-        md5sum_step_text(zBuf, -1);
-        /*printf("%s %s %s",md5sum_current_state(),zName,zBuf); fflush(stdout);*/
-        for(;;){
-          int n;
-          n = fread(zBuf, 1, sizeof(zBuf), in);
-          if( n<=0 ) break;
-          md5sum_step_text(zBuf, n);
-        }
-        fclose(in);
-      }
-    }else{
-      int rid = db_column_int(&q, 4);
-      const char *zOrigName = db_column_text(&q, 2);
-      char zBuf[100];
-      Blob file;
-
-      if( zOrigName ) zName = zOrigName;
-      if( rid>0 ){
-        md5sum_step_text(zName, -1);
-        blob_zero(&file);
-        content_get(rid, &file);
-        sqlite3_snprintf(sizeof(zBuf), zBuf, " %d\n", blob_size(&file));
-        md5sum_step_text(zBuf, -1);
-        md5sum_step_blob(&file);
-        blob_reset(&file);
+        sqlite3_snprintf(sizeof(zBuf), zBuf, " %d\n", blob_size(&p->content));
+        md5_ctx_step(&ctx, zBuf, -1);
+        md5_ctx_step_blob(&ctx, &p->content);
+        free(p->zFullpath);
+      }else if( p->rid>0 ){
+        vfile_cksum_add_rid(&ctx, p->zName, p->rid, &p->content);
       }
+      blob_reset(&p->content);
+      free(p->zName);
     }
+
+    workpool_wait(pPool);
+    aSwap = aPrev;
+    aPrev = aRead;
+    aRead = aSwap;
+    nPrev = nRead;
   }
   db_finalize(&q);
-  md5sum_finish(pOut);
+  workpool_delete(pPool);
+  free(aBuf);
+  blob_zero(pOut);
+  blob_append(pOut, md5_ctx_finish(&ctx, zBuf), 32);
 }
 
 /*
@@ -552,7 +1423,6 @@ void vfile_compare_repository_to_disk(int vid){
       " WHERE NOT deleted AND vid=%d AND file_is_selected(id)",
       g.zLocalRoot, vid
   );
-  md5sum_init();
   while( db_step(&q)==SQLITE_ROW ){
     const char *zFullpath = db_column_text(&q, 0);
     const char *zName = db_column_text(&q, 1);
@@ -590,43 +1460,117 @@ void vfile_compare_repository_to_disk(int vid){
 }
 
 /*
-** Compute an aggregate MD5 checksum over the repository image of every
-** file in vid.  The file names are part of the checksum.  The resulting
-** checksum is suitable for the R-card of a manifest.
+** Compute the aggregate checksums of check-in vid as recorded in the
+** vfile table (into pRepo) and as recorded in the manifest (into pMan).
+** Either pRepo or pMan may be NULL if that checksum is not wanted.  If
+** pManOut is not NULL then fill it with the checksum found in the "R"
+** card of the manifest.
 **
-** Return the resulting checksum in blob pOut.
+** Both lists are in pathname order, so they are walked side by side
+** and the content of a file that appears in both with the same
+** artifact is only extracted once.  Each checksum still covers exactly
+** the files of its own list, so any disagreement between the two is
+** detected just as if they had been computed separately.
 */
-void vfile_aggregate_checksum_repository(int vid, Blob *pOut){
+void vfile_aggregate_checksum_pair(
+  int vid,            /* The check-in to checksum */
+  Blob *pRepo,        /* Write the vfile checksum here, if not NULL */
+  Blob *pMan,         /* Write the manifest checksum here, if not NULL */
+  Blob *pManOut       /* Write the R-card of the manifest here, if not NULL */
+){
+  Stmt q;                    /* Walks the vfile list */
+  Manifest *pManifest = 0;   /* The manifest of vid */
+  ManifestFile *pFile = 0;   /* Current file of the manifest */
+  MD5Context cRepo, cMan;    /* The two checksums */
+  int fid = 0;               /* Artifact for pFile */
+  int haveRow = 0;           /* True if q holds a row */
   Blob file;
-  Stmt q;
-  char zBuf[100];
+  char zOut[33];
 
   db_must_be_within_tree();
- 
-  db_prepare(&q, "SELECT pathname, origname, rid, file_is_selected(id)"
-                 " FROM vfile"
-                 " WHERE (NOT deleted OR NOT file_is_selected(id))"
-                 "   AND rid>0 AND vid=%d"
-                 " ORDER BY pathname /*scan*/",
-                 vid);
+  md5_ctx_init(&cRepo);
+  md5_ctx_init(&cMan);
+  if( pManOut ) blob_zero(pManOut);
+  if( pRepo ){
+    db_prepare(&q, "SELECT pathname, origname, rid, file_is_selected(id)"
+                   " FROM vfile"
+                   " WHERE (NOT deleted OR NOT file_is_selected(id))"
+                   "   AND rid>0 AND vid=%d"
+                   " ORDER BY pathname /*scan*/",
+                   vid);
+    haveRow = db_step(&q)==SQLITE_ROW;
+  }
+  if( pMan || pManOut ){
+    pManifest = manifest_get(vid, CFTYPE_MANIFEST);
+    if( pManifest==0 ){
+      fossil_panic("manifest file (%d) is malformed", vid);
+    }
+    if( pManOut && pManifest->zRepoCksum ){
+      blob_append(pManOut, pManifest->zRepoCksum, -1);
+    }
+  }
+  if( pMan ){
+    manifest_file_rewind(pManifest);
+    while( (pFile = manifest_file_next(pManifest,0))!=0 && pFile->zUuid==0 ){}
+    if( pFile ) fid = uuid_to_rid(pFile->zUuid, 0);
+  }
   blob_zero(&file);
-  md5sum_init();
-  while( db_step(&q)==SQLITE_ROW ){
-    const char *zName = db_column_text(&q, 0);
-    const char *zOrigName = db_column_text(&q, 1);
-    int rid = db_column_int(&q, 2);
-    int isSelected = db_column_int(&q, 3);
-    if( zOrigName && !isSelected ) zName = zOrigName;
-    md5sum_step_text(zName, -1);
-    content_get(rid, &file);
-    sqlite3_snprintf(sizeof(zBuf), zBuf, " %d\n", blob_size(&file));
-    md5sum_step_text(zBuf, -1);
-    /*printf("%s %s %s",md5sum_current_state(),zName,zBuf); fflush(stdout);*/
-    md5sum_step_blob(&file);
+  while( haveRow || pFile ){
+    int c;
+    if( !haveRow ){
+      c = 1;
+    }else if( pFile==0 ){
+      c = -1;
+    }else{
+      c = fossil_strcmp(db_column_text(&q, 0), pFile->zName);
+    }
+    if( c<=0 ){
+      const char *zName = db_column_text(&q, 0);
+      const char *zOrigName = db_column_text(&q, 1);
+      int rid = db_column_int(&q, 2);
+      int isLoaded;
+      if( zOrigName && !db_column_int(&q, 3) ) zName = zOrigName;
+      isLoaded = vfile_cksum_add_rid(&cRepo, zName, rid, &file);
+      if( c==0 && rid==fid && isLoaded ){
+        vfile_cksum_add(&cMan, pFile->zName, &file);
+      }else if( c==0 ){
+        blob_reset(&file);
+        vfile_cksum_add_rid(&cMan, pFile->zName, fid, &file);
+      }
+    }else{
+      vfile_cksum_add_rid(&cMan, pFile->zName, fid, &file);
+    }
     blob_reset(&file);
+    if( c<=0 ){
+      haveRow = db_step(&q)==SQLITE_ROW;
+    }
+    if( c>=0 ){
+      while( (pFile = manifest_file_next(pManifest,0))!=0
+             && pFile->zUuid==0 ){}
+      if( pFile ) fid = uuid_to_rid(pFile->zUuid, 0);
+    }
   }
-  db_finalize(&q);
-  md5sum_finish(pOut);
+  if( pRepo ){
+    db_finalize(&q);
+    blob_zero(pRepo);
+    blob_append(pRepo, md5_ctx_finish(&cRepo, zOut), 32);
+  }
+  if( pMan ){
+    blob_zero(pMan);
+    blob_append(pMan, md5_ctx_finish(&cMan, zOut), 32);
+  }
+  manifest_destroy(pManifest);
+}
+
+/*
+** Compute an aggregate MD5 checksum over the repository image of every
+** file in vid.  The file names are part of the checksum.  The resulting
+** checksum is suitable for the R-card of a manifest.
+**
+** Return the resulting checksum in blob pOut.
+*/
+void vfile_aggregate_checksum_repository(int vid, Blob *pOut){
+  vfile_aggregate_checksum_pair(vid, pOut, 0, 0);
 }
 
 /*
@@ -643,41 +1587,7 @@ void vfile_aggregate_checksum_repository(int vid, Blob *pOut){
 ** pManOut, should be identical.  
 */
 void vfile_aggregate_checksum_manifest(int vid, Blob *pOut, Blob *pManOut){
-  int fid;
-  Blob file;
-  Manifest *pManifest;
-  ManifestFile *pFile;
-  char zBuf[100];
-
-  blob_zero(pOut);
-  if( pManOut ){
-    blob_zero(pManOut);
-  }
-  db_must_be_within_tree();
-  pManifest = manifest_get(vid, CFTYPE_MANIFEST);
-  if( pManifest==0 ){
-    fossil_panic("manifest file (%d) is malformed", vid);
-  }
-  manifest_file_rewind(pManifest);
-  while( (pFile = manifest_file_next(pManifest,0))!=0 ){
-    if( pFile->zUuid==0 ) continue;
-    fid = uuid_to_rid(pFile->zUuid, 0);
-    md5sum_step_text(pFile->zName, -1);
-    content_get(fid, &file);
-    sqlite3_snprintf(sizeof(zBuf), zBuf, " %d\n", blob_size(&file));
-    md5sum_step_text(zBuf, -1);
-    md5sum_step_blob(&file);
-    blob_reset(&file);
-  }
-  if( pManOut ){
-    if( pManifest->zRepoCksum ){
-      blob_append(pManOut, pManifest->zRepoCksum, -1);
-    }else{
-      blob_zero(pManOut);
-    }
-  }
-  manifest_destroy(pManifest);
-  md5sum_finish(pOut);
+  vfile_aggregate_checksum_pair(vid, 0, pOut, pManOut);
 }
 
 /*
@@ -384,6 +384,12 @@ struct Renderer {
   int wantAutoParagraph;      /* True if a <p> is desired */
   int inAutoParagraph;        /* True if within an automatic paragraph */
   const char *zVerbatimId;    /* The id= attribute of <verbatim> */
+  Blob *pDeps;                /* Record link targets here, if not NULL */
+  int nLink;                  /* Number of entries in aLink[] */
+  struct sLink {
+    char *zTarget;               /* A UUID link target */
+    char cState;                 /* Its state.  See link_state() */
+  } *aLink;                   /* UUID link targets, sorted by zTarget */
   int nStack;                 /* Number of elements on the stack */
   int nAlloc;                 /* Space allocated for aStack */
   struct sStack {
@@ -1000,6 +1006,129 @@ static int is_ticket(
   return rc;
 }
 
+/*
+** Return the state of zTarget, which is guaranteed to be a UUID, as
+** far as rendering a hyperlink to it is concerned:
+**
+**    'c'     A closed ticket
+**    't'     A ticket that is not closed
+**    'a'     Some other artifact in this repository
+**    'm'     Missing from this repository
+*/
+static char link_state(Renderer *p, const char *zTarget){
+  int isClosed = 0;
+  if( p && p->nLink ){
+    int lwr = 0, upr = p->nLink-1;
+    while( lwr<=upr ){
+      int i = (lwr+upr)/2;
+      int c = strcmp(p->aLink[i].zTarget, zTarget);
+      if( c==0 ) return p->aLink[i].cState;
+      if( c<0 ){
+        lwr = i+1;
+      }else{
+        upr = i-1;
+      }
+    }
+  }
+  if( is_ticket(zTarget, &isClosed) ) return isClosed ? 'c' : 't';
+  return in_this_repo(zTarget) ? 'a' : 'm';
+}
+
+/*
+** Comparison function for qsort() that sorts link targets.
+*/
+static int link_cmp(const void *a, const void *b){
+  return strcmp(((struct sLink*)a)->zTarget, ((struct sLink*)b)->zTarget);
+}
+
+/*
+** Maximum number of link targets resolved by one query in
+** resolve_links().  SQLite allows at most 500 terms in a compound
+** SELECT.
+*/
+#define LINK_BATCH 250
+
+/*
+** Find every [...] in z whose target is a UUID and look up the state
+** of all of them at once, instead of with two queries per hyperlink
+** in openHyperlink().  Anything in brackets is taken, even where the
+** renderer will not see a hyperlink, so p->aLink[] might hold more
+** targets than are used.
+*/
+static void resolve_links(Renderer *p, const char *z){
+  int nAlloc = 0;
+  int i, j, k;
+  const char *zClosedExpr;
+
+  for(i=0; z[i]; i++){
+    int n;
+    if( z[i]!='[' ) continue;
+    for(n=1; z[i+n] && z[i+n]!='|' && z[i+n]!=']'; n++){}
+    if( z[i+n]==0 ) break;
+    if( z[i+n]=='|' ){
+      while( n>1 && fossil_isspace(z[i+n-1]) ) n--;
+    }
+    if( n-1>=4 && n-1<=UUID_SIZE && validate16(&z[i+1], n-1) ){
+      if( p->nLink>=nAlloc ){
+        nAlloc = nAlloc*2 + 20;
+        p->aLink = fossil_realloc(p->aLink, nAlloc*sizeof(p->aLink[0]));
+      }
+      p->aLink[p->nLink].zTarget = fossil_malloc(n);
+      memcpy(p->aLink[p->nLink].zTarget, &z[i+1], n-1);
+      p->aLink[p->nLink].zTarget[n-1] = 0;
+      p->aLink[p->nLink].cState = 'm';
+      p->nLink++;
+    }
+  }
+  if( p->nLink==0 ) return;
+  qsort(p->aLink, p->nLink, sizeof(p->aLink[0]), link_cmp);
+  for(i=j=1; i<p->nLink; i++){
+    if( strcmp(p->aLink[i].zTarget, p->aLink[j-1].zTarget)==0 ){
+      fossil_free(p->aLink[i].zTarget);
+    }else{
+      p->aLink[j++] = p->aLink[i];
+    }
+  }
+  p->nLink = j;
+
+  zClosedExpr = db_get("ticket-closed-expr", "status='Closed'");
+  for(i=0; i<p->nLink; i+=LINK_BATCH){
+    Blob sql;
+    Stmt q;
+    blob_zero(&sql);
+    for(k=i; k<p->nLink && k<i+LINK_BATCH; k++){
+      const char *zTarget = p->aLink[k].zTarget;
+      int n = strlen(zTarget);
+      char zLower[UUID_SIZE+1];
+      char zUpper[UUID_SIZE+1];
+      memcpy(zLower, zTarget, n+1);
+      canonical16(zLower, n+1);
+      memcpy(zUpper, zLower, n+1);
+      zUpper[n-1]++;
+      blob_appendf(&sql, "%sSELECT %d AS k, %Q AS u, %Q AS lwr, %Q AS upr",
+                   k>i ? " UNION ALL " : "", k, zTarget, zLower, zUpper);
+    }
+    db_prepare(&q,
+      "SELECT k,"
+      "  EXISTS(SELECT 1 FROM ticket WHERE tkt_uuid>=lwr AND tkt_uuid<upr),"
+      "  (SELECT %s FROM ticket WHERE tkt_uuid>=lwr AND tkt_uuid<upr),"
+      "  EXISTS(SELECT 1 FROM blob WHERE uuid>=u AND +uuid GLOB (u || '*'))"
+      " FROM (%s)",
+      zClosedExpr, blob_str(&sql)
+    );
+    while( db_step(&q)==SQLITE_ROW ){
+      struct sLink *pLink = &p->aLink[db_column_int(&q, 0)];
+      if( db_column_int(&q, 1) ){
+        pLink->cState = db_column_int(&q, 2) ? 'c' : 't';
+      }else if( db_column_int(&q, 3) ){
+        pLink->cState = 'a';
+      }
+    }
+    db_finalize(&q);
+    blob_reset(&sql);
+  }
+}
+
 /*
 ** Resolve a hyperlink.  The zTarget argument is the content of the [...]
 ** in the wiki.  Append to the output string whatever text is approprate
@@ -1057,12 +1186,15 @@ static void openHyperlink(
       zTerm = "";
     }
   }else if( is_valid_uuid(zTarget) ){
-    int isClosed = 0;
-    if( is_ticket(zTarget, &isClosed) ){
+    char cState = link_state(p, zTarget);
+    if( p->pDeps ){
+      blob_appendf(p->pDeps, "%s %c\n", zTarget, cState);
+    }
+    if( cState=='c' || cState=='t' ){
       /* Special display processing for tickets.  Display the hyperlink
       ** as crossed out if the ticket is closed.
       */
-      if( isClosed ){
+      if( cState=='c' ){
         if( g.perm.History ){
           blob_appendf(p->pOut,
              "<a href=\"%s/info/%s\"><span class=\"wikiTagCancelled\">[",
@@ -1084,7 +1216,7 @@ static void openHyperlink(
           zTerm = "]";
         }
       }
-    }else if( !in_this_repo(zTarget) ){
+    }else if( cState=='m' ){
       blob_appendf(p->pOut, "<span class=\"brokenlink\">[", zTarget);
       zTerm = "]</span>";
     }else if( g.perm.History ){
@@ -1479,16 +1611,67 @@ char *skip_bom(char *z){
   return z;
 }
 
+/*
+** Markup shorter than this many bytes, such as most check-in comments,
+** is rendered faster than it can be looked up in the wiki cache.
+*/
+#define WIKI_CACHE_MIN 2000
+
+/*
+** Return true if each line of pDeps, "UUID STATE" as written by
+** openHyperlink(), still gives the state of that link target.
+*/
+static int wiki_deps_current(Blob *pDeps){
+  Blob line, uuid, state;
+  int isCurrent = 1;
+  while( isCurrent && blob_line(pDeps, &line) ){
+    blob_zero(&uuid);
+    blob_zero(&state);
+    isCurrent = blob_token(&line, &uuid) && blob_token(&line, &state)
+             && link_state(0, blob_str(&uuid))==blob_str(&state)[0];
+    blob_reset(&uuid);
+    blob_reset(&state);
+  }
+  return isCurrent;
+}
+
 /*
 ** Transform the text in the pIn blob.  Write the results
 ** into the pOut blob.  The pOut blob should already be
 ** initialized.  The output is merely appended to pOut.
 ** If pOut is NULL, then the output is appended to the CGI
 ** reply.
+**
+** Long markup is looked up in the wiki cache first, and saved there
+** after it is rendered.
 */
 void wiki_convert(Blob *pIn, Blob *pOut, int flags){
   char *z;
   Renderer renderer;
+  Blob key, html, deps;
+  int useCache = blob_size(pIn)>=WIKI_CACHE_MIN;
+
+  if( pOut==0 ) pOut = cgi_output_blob();
+  if( useCache ){
+    blob_zero(&key);
+    blob_zero(&html);
+    blob_zero(&deps);
+    blob_appendf(&key, "%d %d %d %s\n", flags, wikiUsesHtml(),
+                 g.perm.History, g.zTop);
+    blob_append(&key, blob_buffer(pIn), blob_size(pIn));
+    sha1sum_blob(&key, &key);
+    if( wiki_cache_get(blob_str(&key), &html, &deps)
+     && wiki_deps_current(&deps)
+    ){
+      blob_append(pOut, blob_buffer(&html), blob_size(&html));
+      blob_reset(&key);
+      blob_reset(&html);
+      blob_reset(&deps);
+      return;
+    }
+    blob_reset(&html);
+    blob_reset(&deps);
+  }
 
   memset(&renderer, 0, sizeof(renderer));
   renderer.state = ALLOW_WIKI|AT_NEWLINE|AT_PARAGRAPH;
@@ -1503,13 +1686,15 @@ void wiki_convert(Blob *pIn, Blob *pOut, int flags){
   if( wikiUsesHtml() ){
     renderer.state |= WIKI_USE_HTML;
   }
-  if( pOut ){
-    renderer.pOut = pOut;
+  if( useCache ){
+    renderer.pOut = &html;
+    renderer.pDeps = &deps;
   }else{
-    renderer.pOut = cgi_output_blob();
+    renderer.pOut = pOut;
   }
 
   z = skip_bom(blob_str(pIn));
+  resolve_links(&renderer, z);
   wiki_render(&renderer, z);
   endAutoParagraph(&renderer);
   while( renderer.nStack ){
@@ -1517,6 +1702,17 @@ void wiki_convert(Blob *pIn, Blob *pOut, int flags){
   }
   blob_append(renderer.pOut, "\n", 1);
   free(renderer.aStack);
+  while( renderer.nLink ){
+    fossil_free(renderer.aLink[--renderer.nLink].zTarget);
+  }
+  fossil_free(renderer.aLink);
+  if( useCache ){
+    wiki_cache_put(blob_str(&key), &html, &deps);
+    blob_append(pOut, blob_buffer(&html), blob_size(&html));
+    blob_reset(&key);
+    blob_reset(&html);
+    blob_reset(&deps);
+  }
 }
 
 /*
@@ -15,9 +15,9 @@
 **
 *******************************************************************************
 **
-** This file implements a very simple (and low-performance) HTTP server
-** for windows. It also implements a Windows Service which allows the HTTP
-** server to be run without any user logged on.
+** This file implements a simple HTTP server for windows. It also
+** implements a Windows Service which allows the HTTP server to be run
+** without any user logged on.
 */
 #include "config.h"
 #ifdef _WIN32
@@ -31,16 +31,35 @@
 */
 typedef struct HttpRequest HttpRequest;
 struct HttpRequest {
-  int id;                /* ID counter */
   SOCKET s;              /* Socket on which to receive data */
   SOCKADDR_IN addr;      /* Address from which data is coming */
-  const char *zOptions;  /* --notfound and/or --localauth options */
+  HttpRequest *pNext;    /* Next request waiting for a thread */
 };
 
 /*
-** Prefix for a temporary file.
+** A "fossil http" child process that is started ahead of time and
+** waits on its standard input for a request.
 */
-static char *zTempPrefix;
+typedef struct HttpChild HttpChild;
+struct HttpChild {
+  HANDLE hToChild;       /* Write end of the child's standard input */
+  HANDLE hFromChild;     /* Read end of the child's standard output */
+};
+
+/*
+** Requests are handed from the listener to a fixed pool of threads
+** through a queue.  Each thread keeps one spare child process that is
+** already running, so that the cost of starting a process and opening
+** the repository is paid before a request arrives.  The request and
+** its reply travel through pipes to and from the child.
+*/
+static struct {
+  CRITICAL_SECTION cs;   /* Protects the queue and process creation */
+  HANDLE hAvail;         /* Semaphore counting requests in the queue */
+  HttpRequest *pFirst;   /* Oldest request in the queue */
+  HttpRequest *pLast;    /* Newest request in the queue */
+  char *zCmd;            /* Command that starts a child process */
+} httpPool;
 
 /*
 ** Look at the HTTP header contained in zHdr.  Find the content
@@ -61,23 +80,83 @@ static int find_content_length(const char *zHdr){
 }
 
 /*
-** Process a single incoming HTTP request.
+** Start a child process to handle the next request.  Return the
+** number of errors.
+**
+** Process creation is serialized so that the inheritable ends of the
+** pipes of one child are never inherited by another.
+*/
+static int win32_http_spawn(HttpChild *pChild){
+  SECURITY_ATTRIBUTES sa;
+  STARTUPINFO si;
+  PROCESS_INFORMATION pi;
+  HANDLE hInRd, hInWr, hOutRd, hOutWr;
+  char *zCmd;
+  BOOL rc = 0;
+
+  sa.nLength = sizeof(sa);
+  sa.bInheritHandle = TRUE;
+  sa.lpSecurityDescriptor = NULL;
+  memset(&si, 0, sizeof(si));
+  si.cb = sizeof(si);
+  si.dwFlags = STARTF_USESTDHANDLES;
+  zCmd = fossil_malloc( strlen(httpPool.zCmd)+1 );
+  strcpy(zCmd, httpPool.zCmd);
+  EnterCriticalSection(&httpPool.cs);
+  if( CreatePipe(&hInRd, &hInWr, &sa, 65536) ){
+    if( CreatePipe(&hOutRd, &hOutWr, &sa, 65536) ){
+      SetHandleInformation(hInWr, HANDLE_FLAG_INHERIT, FALSE);
+      SetHandleInformation(hOutRd, HANDLE_FLAG_INHERIT, FALSE);
+      si.hStdInput = hInRd;
+      si.hStdOutput = hOutWr;
+      si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+      SetHandleInformation(si.hStdError, HANDLE_FLAG_INHERIT, TRUE);
+      rc = CreateProcess(NULL, zCmd, NULL, NULL, TRUE, 0, NULL, NULL,
+                         &si, &pi);
+      CloseHandle(hOutWr);
+      if( rc ){
+        CloseHandle(pi.hProcess);
+        CloseHandle(pi.hThread);
+        pChild->hToChild = hInWr;
+        pChild->hFromChild = hOutRd;
+      }else{
+        CloseHandle(hInWr);
+        CloseHandle(hOutRd);
+      }
+    }else{
+      CloseHandle(hInWr);
+    }
+    CloseHandle(hInRd);
+  }
+  LeaveCriticalSection(&httpPool.cs);
+  free(zCmd);
+  return rc==0;
+}
+
+/*
+** Write N bytes to a pipe.  Return the number of errors.
+*/
+static int win32_http_write(HANDLE h, const char *z, int N){
+  DWORD nWrote;
+  while( N>0 ){
+    if( !WriteFile(h, z, N, &nWrote, NULL) ) return 1;
+    z += nWrote;
+    N -= nWrote;
+  }
+  return 0;
+}
+
+/*
+** Process a single incoming HTTP request using the child process
+** pChild, which is used up.
 */
-static void win32_process_one_http_request(void *pAppData){
-  HttpRequest *p = (HttpRequest*)pAppData;
-  FILE *in = 0, *out = 0;
+static void win32_process_one_http_request(HttpRequest *p, HttpChild *pChild){
   int amt, got;
   int wanted = 0;
+  DWORD nRead;
   char *z;
-  char zRequestFName[100];
-  char zReplyFName[100];
-  char zCmd[2000];          /* Command-line to process the request */
   char zHdr[2000];          /* The HTTP request header */
 
-  sqlite3_snprintf(sizeof(zRequestFName), zRequestFName,
-                   "%s_in%d.txt", zTempPrefix, p->id);
-  sqlite3_snprintf(sizeof(zReplyFName), zReplyFName,
-                   "%s_out%d.txt", zTempPrefix, p->id);
   amt = 0;
   while( amt<sizeof(zHdr) ){
     got = recv(p->s, &zHdr[amt], sizeof(zHdr)-1-amt, 0);
@@ -95,42 +174,63 @@ static void win32_process_one_http_request(void *pAppData){
     }
   }
   if( amt>=sizeof(zHdr) ) goto end_request;
-  out = fossil_fopen(zRequestFName, "wb");
-  if( out==0 ) goto end_request;
-  fwrite(zHdr, 1, amt, out);
+
+  /* The child reads the client address first, then the request */
+  z = inet_ntoa(p->addr.sin_addr);
+  if( win32_http_write(pChild->hToChild, z, strlen(z)) ) goto end_request;
+  if( win32_http_write(pChild->hToChild, "\n", 1) ) goto end_request;
+  if( win32_http_write(pChild->hToChild, zHdr, amt) ) goto end_request;
   while( wanted>0 ){
     got = recv(p->s, zHdr, sizeof(zHdr), 0);
     if( got==SOCKET_ERROR ) goto end_request;
-    if( got ){
-      fwrite(zHdr, 1, got, out);
-    }else{
-      break;
-    }
+    if( got==0 ) break;
+    if( win32_http_write(pChild->hToChild, zHdr, got) ) goto end_request;
     wanted -= got;
   }
-  fclose(out);
-  out = 0;
-  sqlite3_snprintf(sizeof(zCmd), zCmd, "\"%s\" http \"%s\" %s %s %s --nossl%s",
-    fossil_nameofexe(), g.zRepositoryName, zRequestFName, zReplyFName, 
-    inet_ntoa(p->addr.sin_addr), p->zOptions
-  );
-  fossil_system(zCmd);
-  in = fossil_fopen(zReplyFName, "rb");
-  if( in ){
-    while( (got = fread(zHdr, 1, sizeof(zHdr), in))>0 ){
-      send(p->s, zHdr, got, 0);
-    }
+  CloseHandle(pChild->hToChild);
+  pChild->hToChild = INVALID_HANDLE_VALUE;
+  while( ReadFile(pChild->hFromChild, zHdr, sizeof(zHdr), &nRead, NULL)
+         && nRead>0 ){
+    send(p->s, zHdr, nRead, 0);
   }
 
 end_request:
-  if( out ) fclose(out);
-  if( in ) fclose(in);
+  if( pChild->hToChild!=INVALID_HANDLE_VALUE ){
+    CloseHandle(pChild->hToChild);
+  }
+  CloseHandle(pChild->hFromChild);
   closesocket(p->s);
-  file_delete(zRequestFName);
-  file_delete(zReplyFName);
   free(p);
 }
 
+/*
+** Main routine for each thread of the pool.  Take requests from the
+** queue and process them one at a time.
+*/
+static void win32_http_thread(void *pNotUsed){
+  HttpChild child;
+  int haveChild = 0;
+  HttpRequest *p;
+
+  for(;;){
+    if( !haveChild ) haveChild = win32_http_spawn(&child)==0;
+    WaitForSingleObject(httpPool.hAvail, INFINITE);
+    EnterCriticalSection(&httpPool.cs);
+    p = httpPool.pFirst;
+    httpPool.pFirst = p->pNext;
+    if( httpPool.pFirst==0 ) httpPool.pLast = 0;
+    LeaveCriticalSection(&httpPool.cs);
+    if( !haveChild ) haveChild = win32_http_spawn(&child)==0;
+    if( haveChild ){
+      win32_process_one_http_request(p, &child);
+      haveChild = 0;
+    }else{
+      closesocket(p->s);
+      free(p);
+    }
+  }
+}
+
 /*
 ** Start a listening socket and process incoming HTTP requests on
 ** that socket.
@@ -145,10 +245,10 @@ void win32_http_server(
   WSADATA wd;
   SOCKET s = INVALID_SOCKET;
   SOCKADDR_IN addr;
-  int idCnt = 0;
   int iPort = mnPort;
+  int nThread;
   Blob options;
-  char zTmpPath[MAX_PATH];
+  char *zCmd;
 
   if( zStopper ) file_delete(zStopper);
   blob_zero(&options);
@@ -193,10 +293,21 @@ void win32_http_server(
                    " port in the range %d..%d", mnPort, mxPort);
     }
   }
-  if( !GetTempPath(sizeof(zTmpPath), zTmpPath) ){
-    fossil_fatal("unable to get path to the temporary directory.");
+  zCmd = mprintf("\"%s\" http \"%s\" --ipaddr - --nossl%s",
+    fossil_nameofexe(), g.zRepositoryName, blob_str(&options)
+  );
+  httpPool.zCmd = fossil_utf8_to_mbcs(zCmd);
+  InitializeCriticalSection(&httpPool.cs);
+  httpPool.hAvail = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+  if( httpPool.hAvail==NULL ){
+    fossil_fatal("unable to create a semaphore");
+  }
+  nThread = 2*workpool_ncpu();
+  if( nThread<4 ) nThread = 4;
+  if( nThread>32 ) nThread = 32;
+  while( nThread-- > 0 ){
+    _beginthread(win32_http_thread, 0, 0);
   }
-  zTempPrefix = mprintf("%sfossil_server_P%d_", zTmpPath, iPort);
   fossil_print("Listening for HTTP requests on TCP port %d\n", iPort);
   if( zBrowser ){
     zBrowser = mprintf(zBrowser, iPort);
@@ -231,11 +342,18 @@ void win32_http_server(
       break;
     }
     p = fossil_malloc( sizeof(*p) );
-    p->id = ++idCnt;
     p->s = client;
     p->addr = client_addr;
-    p->zOptions = blob_str(&options);
-    _beginthread(win32_process_one_http_request, 0, (void*)p);
+    p->pNext = 0;
+    EnterCriticalSection(&httpPool.cs);
+    if( httpPool.pLast ){
+      httpPool.pLast->pNext = p;
+    }else{
+      httpPool.pFirst = p;
+    }
+    httpPool.pLast = p;
+    LeaveCriticalSection(&httpPool.cs);
+    ReleaseSemaphore(httpPool.hAvail, 1, NULL);
   }
   closesocket(s);
   WSACleanup();
@@ -0,0 +1,235 @@
+/*
+** Copyright (c) 2012 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*******************************************************************************
+**
+** This file implements a simple pool of worker threads used to spread
+** CPU-bound work (delta computation, compression, hashing, and the like)
+** across multiple cores.
+**
+** Tasks run by a WorkPool must not touch the database, the global "g"
+** structure, the content cache, or any other shared state.  The usual
+** pattern is for the main thread to load all of the inputs a task
+** needs, hand the task to the pool, then after workpool_wait() returns,
+** write the results of every task back to the database.
+**
+** When fossil is built without thread support (FOSSIL_ENABLE_THREADS is
+** undefined) or when the pool is created with fewer than two threads,
+** each task simply runs to completion inside of workpool_add().  Callers
+** do not need to know which case applies.
+*/
+#include "config.h"
+#include "workpool.h"
+#ifdef FOSSIL_ENABLE_THREADS
+# include <pthread.h>
+#endif
+#ifdef _WIN32
+# include <windows.h>
+#endif
+
+#if INTERFACE
+/*
+** An opaque handle for a pool of worker threads.
+*/
+typedef struct WorkPool WorkPool;
+#endif
+
+/*
+** One unit of work waiting in the queue.
+*/
+typedef struct WorkTask WorkTask;
+struct WorkTask {
+  void (*xTask)(void*);  /* The routine to run */
+  void *pArg;            /* Argument to xTask */
+  WorkTask *pNext;       /* Next task in the queue */
+};
+
+/*
+** A pool of worker threads and the queue of tasks they draw from.
+*/
+struct WorkPool {
+  int nThread;           /* Number of worker threads.  0 means serial */
+  int nPending;          /* Tasks queued or running but not yet finished */
+  WorkTask *pFirst;      /* Next task to run */
+  WorkTask *pLast;       /* Last task in the queue */
+#ifdef FOSSIL_ENABLE_THREADS
+  int isShutdown;        /* True when workers should exit */
+  pthread_mutex_t mutex; /* Protects all fields of this object */
+  pthread_cond_t cvWork; /* Signaled when a task is added or on shutdown */
+  pthread_cond_t cvDone; /* Signaled when nPending reaches zero */
+  pthread_t *aThread;    /* The worker threads */
+#endif
+};
+
+/*
+** Return the number of CPUs available on this machine, or 1 if the
+** number is unknown.
+*/
+int workpool_ncpu(void){
+  int n = 1;
+#if defined(_WIN32)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  n = (int)info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return n<1 ? 1 : n;
+}
+
+/*
+** Return the number of worker threads to use, based on the value of
+** the command-line option zOpt (which may be NULL) or the number of
+** CPUs if that option is omitted.  Always return 1 if this build of
+** fossil is unable to run threads.
+*/
+int workpool_size(const char *zOpt){
+#ifdef FOSSIL_ENABLE_THREADS
+  int n = zOpt ? atoi(zOpt) : workpool_ncpu();
+  if( n<1 ) n = 1;
+  if( n>64 ) n = 64;
+  return n;
+#else
+  return 1;
+#endif
+}
+
+#ifdef FOSSIL_ENABLE_THREADS
+/*
+** The main loop of each worker thread.
+*/
+static void *workpool_thread_main(void *pArg){
+  WorkPool *p = (WorkPool*)pArg;
+  pthread_mutex_lock(&p->mutex);
+  while( 1 ){
+    WorkTask *pTask;
+    while( p->pFirst==0 && !p->isShutdown ){
+      pthread_cond_wait(&p->cvWork, &p->mutex);
+    }
+    if( p->pFirst==0 ) break;
+    pTask = p->pFirst;
+    p->pFirst = pTask->pNext;
+    if( p->pFirst==0 ) p->pLast = 0;
+    pthread_mutex_unlock(&p->mutex);
+    pTask->xTask(pTask->pArg);
+    free(pTask);
+    pthread_mutex_lock(&p->mutex);
+    if( --p->nPending==0 ){
+      pthread_cond_broadcast(&p->cvDone);
+    }
+  }
+  pthread_mutex_unlock(&p->mutex);
+  return 0;
+}
+#endif
+
+/*
+** Create a new pool with nThread worker threads.  If nThread is less
+** than 2, or if threads are not available, tasks are run serially.
+*/
+WorkPool *workpool_new(int nThread){
+  WorkPool *p = fossil_malloc(sizeof(*p));
+  memset(p, 0, sizeof(*p));
+#ifdef FOSSIL_ENABLE_THREADS
+  if( nThread>1 ){
+    int i;
+    pthread_mutex_init(&p->mutex, 0);
+    pthread_cond_init(&p->cvWork, 0);
+    pthread_cond_init(&p->cvDone, 0);
+    p->aThread = fossil_malloc(nThread*sizeof(p->aThread[0]));
+    for(i=0; i<nThread; i++){
+      if( pthread_create(&p->aThread[i], 0, workpool_thread_main, p) ) break;
+    }
+    p->nThread = i;
+  }
+#endif
+  return p;
+}
+
+/*
+** Return the number of worker threads in pool p.  Zero means that tasks
+** run serially.
+*/
+int workpool_nthread(WorkPool *p){
+  return p->nThread;
+}
+
+/*
+** Add a task to the pool.  xTask(pArg) will be invoked on some worker
+** thread at some point before workpool_wait() returns.  In serial mode
+** the task runs before this routine returns.
+*/
+void workpool_add(WorkPool *p, void (*xTask)(void*), void *pArg){
+  WorkTask *pTask;
+  if( p->nThread==0 ){
+    xTask(pArg);
+    return;
+  }
+  pTask = fossil_malloc(sizeof(*pTask));
+  pTask->xTask = xTask;
+  pTask->pArg = pArg;
+  pTask->pNext = 0;
+#ifdef FOSSIL_ENABLE_THREADS
+  pthread_mutex_lock(&p->mutex);
+  if( p->pLast ){
+    p->pLast->pNext = pTask;
+  }else{
+    p->pFirst = pTask;
+  }
+  p->pLast = pTask;
+  p->nPending++;
+  pthread_cond_signal(&p->cvWork);
+  pthread_mutex_unlock(&p->mutex);
+#endif
+}
+
+/*
+** Wait until every task that has been added to the pool has finished.
+*/
+void workpool_wait(WorkPool *p){
+#ifdef FOSSIL_ENABLE_THREADS
+  if( p->nThread==0 ) return;
+  pthread_mutex_lock(&p->mutex);
+  while( p->nPending>0 ){
+    pthread_cond_wait(&p->cvDone, &p->mutex);
+  }
+  pthread_mutex_unlock(&p->mutex);
+#endif
+}
+
+/*
+** Finish all pending tasks, stop the worker threads and free the pool.
+*/
+void workpool_delete(WorkPool *p){
+  if( p==0 ) return;
+#ifdef FOSSIL_ENABLE_THREADS
+  if( p->nThread>0 ){
+    int i;
+    workpool_wait(p);
+    pthread_mutex_lock(&p->mutex);
+    p->isShutdown = 1;
+    pthread_cond_broadcast(&p->cvWork);
+    pthread_mutex_unlock(&p->mutex);
+    for(i=0; i<p->nThread; i++){
+      pthread_join(p->aThread[i], 0);
+    }
+    free(p->aThread);
+    pthread_cond_destroy(&p->cvWork);
+    pthread_cond_destroy(&p->cvDone);
+    pthread_mutex_destroy(&p->mutex);
+  }
+#endif
+  free(p);
+}
@@ -19,6 +19,13 @@
 */
 #include "config.h"
 #include "xfer.h"
+#ifndef _WIN32
+# include <sys/types.h>
+# include <sys/wait.h>
+# include <sys/select.h>
+# include <signal.h>
+# include <unistd.h>
+#endif
 
 /*
 ** This structure holds information about the current state of either
@@ -42,8 +49,35 @@ struct Xfer {
   int mxSend;         /* Stop sending "file" with pOut reaches this size */
   u8 syncPrivate;     /* True to enable syncing private content */
   u8 nextIsPrivate;   /* If true, next "file" received is a private */
+  u8 acceptZstd;      /* True if the other side can read zstd "cfile"s */
+  u8 pipeline;        /* True if both sides agreed on "pragma pipeline" */
+  u8 rawHash;         /* True if both sides agreed on "pragma raw-hash" */
+  const char *zRawCard; /* "igot" or "gimme" for the hashes in rawHashes */
+  int nRawHash;       /* Number of hashes in rawHashes */
+  Blob rawHashes;     /* Binary hashes of cards not yet sent */
+  int cloneLimit;     /* Send no clone artifacts beyond this rid, if >0 */
+  int mxDeltaCache;   /* Size limit on the DELTACACHE table.  0 to not use */
 };
 
+/*
+** Maximum number of "gimme" cards a client sends in a single message
+** once the server has agreed to pipelined operation.
+*/
+#define PIPELINE_MAX_GIMME  10000
+
+/*
+** Maximum number of hashes in a single "igot_raw" or "gimme_raw" card.
+*/
+#define XFER_RAW_MAX_HASH   1000
+
+
+/*
+** Return the number of bytes of output generated so far.  This includes
+** any part of a server reply that has already been sent to the client.
+*/
+static i64 xfer_out_size(Xfer *pXfer){
+  return blob_size(pXfer->pOut) + cgi_flushed_size();
+}
 
 /*
 ** The input blob contains a UUID.  Convert it into a record ID.
@@ -85,6 +119,272 @@ static void remote_has(int rid){
   }
 }
 
+/*
+** Send any "igot" or "gimme" cards that xfer_send_hash() is holding
+** back, as a single "igot_raw" or "gimme_raw" card.
+*/
+static void xfer_flush_raw(Xfer *pXfer){
+  if( pXfer->nRawHash==0 ) return;
+  blob_appendf(pXfer->pOut, "%s_raw %d\n", pXfer->zRawCard, pXfer->nRawHash);
+  blob_append(pXfer->pOut, blob_buffer(&pXfer->rawHashes),
+              blob_size(&pXfer->rawHashes));
+  blob_reset(&pXfer->rawHashes);
+  pXfer->nRawHash = 0;
+}
+
+/*
+** Send the card "zCard zUuid", where zCard is "igot" or "gimme".
+**
+** Once both sides have agreed on "pragma raw-hash", a run of such cards
+** is sent instead as one card followed by the binary hashes:
+**
+**      igot_raw N \n HASHES
+**      gimme_raw N \n HASHES
+**
+** HASHES is N hashes of 20 bytes each.  This is less than half the
+** size of N text cards and needs no tokenizing.  xfer_flush_raw() must
+** be called before any other card is sent.
+*/
+static void xfer_send_hash(Xfer *pXfer, const char *zCard, const char *zUuid){
+  unsigned char aHash[UUID_SIZE/2];
+  if( !pXfer->rawHash ){
+    blob_appendf(pXfer->pOut, "%s %s\n", zCard, zUuid);
+    return;
+  }
+  if( pXfer->nRawHash>0
+   && (pXfer->zRawCard!=zCard || pXfer->nRawHash>=XFER_RAW_MAX_HASH)
+  ){
+    xfer_flush_raw(pXfer);
+  }
+  if( pXfer->nRawHash==0 ) blob_zero(&pXfer->rawHashes);
+  decode16((const unsigned char*)zUuid, aHash, UUID_SIZE);
+  blob_append(&pXfer->rawHashes, (const char*)aHash, sizeof(aHash));
+  pXfer->zRawCard = zCard;
+  pXfer->nRawHash++;
+}
+
+/*
+** The aToken[0..nToken-1] blob array is a parse of an "igot_raw" or a
+** "gimme_raw" card.  Read the hashes that follow it into *pHashes and
+** return how many there are, or return 0 if the card is malformed.
+*/
+static int xfer_read_raw(Xfer *pXfer, Blob *pHashes){
+  int n;
+  blob_zero(pHashes);
+  if( pXfer->nToken!=2
+   || !blob_is_int(&pXfer->aToken[1], &n)
+   || n<=0 || n>XFER_RAW_MAX_HASH
+  ){
+    return 0;
+  }
+  if( blob_extract(pXfer->pIn, n*(UUID_SIZE/2), pHashes)!=n*(UUID_SIZE/2) ){
+    blob_reset(pHashes);
+    return 0;
+  }
+  return n;
+}
+
+/*
+** Write the artifact ID of the i-th hash of pHashes into zUuid[].
+*/
+static void xfer_raw_uuid(Blob *pHashes, int i, char *zUuid){
+  encode16((const unsigned char*)&blob_buffer(pHashes)[i*(UUID_SIZE/2)],
+           (unsigned char*)zUuid, UUID_SIZE/2);
+}
+
+/*
+** A file received by the client that waits in xferIngest to be stored.
+** A thread of xferIngest.pPool computes its hash and compressed form
+** while the main thread goes on to read the cards that follow.
+*/
+typedef struct XferFile XferFile;
+struct XferFile {
+  char zUuid[UUID_SIZE+1];   /* UUID according to the other side */
+  Blob content;              /* The content, or a delta if srcid>0 */
+  Blob cmpr;                 /* Compressed content.  Set by the worker */
+  Blob hash;                 /* SHA1 of content.  Set by the worker */
+  int srcid;                 /* Delta source, when cloning.  Otherwise 0 */
+  int size;                  /* Size of the artifact.  Set by the worker */
+  u8 isPriv;                 /* True if the file is private */
+  u8 isClone;                /* True if the file is part of a clone */
+};
+
+/*
+** Files received by client_sync() that are not stored yet.  pPool is
+** NULL except during client_sync(), so the server stores each file as
+** it arrives.
+*/
+static struct {
+  WorkPool *pPool;           /* Threads that hash and compress files */
+  int nFile;                 /* Number of entries in aFile[] */
+  XferFile *aFile;           /* XFER_BATCH_FILES slots */
+  i64 szFile;                /* Bytes of content in aFile[] */
+} xferIngest;
+
+/*
+** Store the waiting files once there are this many of them, or once
+** they hold this many bytes.
+*/
+#define XFER_BATCH_FILES  1000
+#define XFER_BATCH_BYTES  50000000
+
+/*
+** Look up the waiting "igot" cards once there are this many of them.
+*/
+#define XFER_BATCH_IGOT   500
+
+/*
+** Worker-thread half of xfer_store_files().  Hash and compress one
+** file.  This routine must not use the database.
+*/
+static void xfer_file_task(void *pArg){
+  XferFile *p = (XferFile*)pArg;
+  if( p->srcid ){
+    p->size = delta_output_size(blob_buffer(&p->content),
+                                blob_size(&p->content));
+  }else{
+    p->size = blob_size(&p->content);
+    if( !p->isClone ) sha1sum_blob(&p->content, &p->hash);
+  }
+  if( p->size>0 ) content_compress(&p->content, &p->cmpr);
+}
+
+/*
+** Return true if the file with UUID pUuid waits in xferIngest.
+*/
+static int xfer_file_is_waiting(Blob *pUuid){
+  int i;
+  for(i=0; i<xferIngest.nFile; i++){
+    if( blob_eq_str(pUuid, xferIngest.aFile[i].zUuid, UUID_SIZE) ) return 1;
+  }
+  return 0;
+}
+
+/*
+** Store every file waiting in xferIngest, in the order received, just
+** as xfer_accept_file() would have stored them one by one.  Append any
+** error messages to pXfer->err.  Return the number of errors.
+*/
+static int xfer_store_files(Xfer *pXfer){
+  int i;
+  int nErr = 0;
+  if( xferIngest.nFile==0 ) return 0;
+  workpool_wait(xferIngest.pPool);
+  for(i=0; i<xferIngest.nFile; i++){
+    XferFile *p = &xferIngest.aFile[i];
+    const char *zUuid = p->zUuid;
+    int rid;
+    if( !p->isClone ){
+      zUuid = blob_str(&p->hash);
+      if( fossil_strcmp(p->zUuid, zUuid)!=0 ){
+        blob_appendf(&pXfer->err, "content does not match sha1 hash");
+        nErr++;
+      }
+    }
+    if( p->size>0 ){
+      rid = content_put_ex(&p->cmpr, zUuid, p->srcid, p->size, p->isPriv);
+    }else{
+      rid = content_put_ex(&p->content, zUuid, p->srcid, 0, p->isPriv);
+    }
+    blob_reset(&p->cmpr);
+    if( p->isClone ){
+      blob_reset(&p->content);
+    }else if( rid==0 ){
+      blob_appendf(&pXfer->err, "%s", g.zErrMsg);
+      blob_reset(&p->content);
+      nErr++;
+    }else{
+      if( !p->isPriv ) content_make_public(rid);
+      manifest_crosslink(rid, &p->content);
+    }
+    blob_reset(&p->hash);
+    remote_has(rid);
+  }
+  xferIngest.nFile = 0;
+  xferIngest.szFile = 0;
+  return nErr;
+}
+
+/*
+** Take over pContent, a file received by the client, and start to hash
+** and compress it on a thread of xferIngest.pPool.  It is stored by a
+** later call to xfer_store_files().
+*/
+static void xfer_queue_file(
+  Xfer *pXfer,           /* The sync in progress */
+  Blob *pContent,        /* The content, or a delta against srcid */
+  Blob *pUuid,           /* UUID according to the other side */
+  int srcid,             /* Delta source, when cloning.  Otherwise 0 */
+  int isPriv,            /* True if the file is private */
+  int isClone            /* True if the file is part of a clone */
+){
+  XferFile *p;
+  if( xferIngest.nFile>=XFER_BATCH_FILES
+   || xferIngest.szFile>=XFER_BATCH_BYTES
+  ){
+    xfer_store_files(pXfer);
+  }
+  p = &xferIngest.aFile[xferIngest.nFile++];
+  memcpy(p->zUuid, blob_buffer(pUuid), UUID_SIZE);
+  p->zUuid[UUID_SIZE] = 0;
+  p->content = *pContent;
+  blob_zero(pContent);
+  blob_zero(&p->cmpr);
+  blob_zero(&p->hash);
+  p->srcid = srcid;
+  p->size = 0;
+  p->isPriv = isPriv!=0;
+  p->isClone = isClone!=0;
+  xferIngest.szFile += blob_size(&p->content);
+  workpool_add(xferIngest.pPool, xfer_file_task, p);
+}
+
+/*
+** "igot" cards received by the client that are not acted on yet.  A
+** server sends an igot card for every artifact of the repository on
+** each sync, so the client looks them up together with
+** uuid_to_rid_many() rather than one query per card.
+*/
+static struct {
+  int nIgot;                               /* Number of waiting cards */
+  char azUuid[XFER_BATCH_IGOT][UUID_SIZE+1]; /* UUID of each card */
+  u8 aIsPriv[XFER_BATCH_IGOT];             /* True if the card is private */
+} xferIgot;
+
+/*
+** Act on every waiting "igot" card, in the order received, just as if
+** each had been handled when it arrived.  Create phantoms for unknown
+** artifacts if pullFlag is true.  Return true if any phantom was made.
+*/
+static int xfer_flush_igot(int pullFlag){
+  const char *azUuid[XFER_BATCH_IGOT];
+  int aRid[XFER_BATCH_IGOT];
+  int i;
+  int newPhantom = 0;
+  if( xferIgot.nIgot==0 ) return 0;
+  for(i=0; i<xferIgot.nIgot; i++) azUuid[i] = xferIgot.azUuid[i];
+  uuid_to_rid_many(xferIgot.nIgot, azUuid, aRid, 0);
+  for(i=0; i<xferIgot.nIgot; i++){
+    int rid = aRid[i];
+    int isPriv = xferIgot.aIsPriv[i];
+    if( rid==0 ){
+      /* An earlier card of this batch might have made the phantom */
+      rid = fast_uuid_to_rid(azUuid[i]);
+    }
+    if( rid>0 ){
+      if( !isPriv ) content_make_public(rid);
+    }else if( isPriv && !g.perm.Private ){
+      /* ignore private files */
+    }else if( pullFlag ){
+      rid = content_new(azUuid[i], isPriv);
+      if( rid ) newPhantom = 1;
+    }
+    remote_has(rid);
+  }
+  xferIgot.nIgot = 0;
+  return newPhantom;
+}
+
 /*
 ** The aToken[0..nToken-1] blob array is a parse of a "file" line 
 ** message.  This routine finishes parsing that message and does
@@ -104,6 +404,9 @@ static void remote_has(int rid){
 **
 ** Any artifact successfully received by this routine is considered to
 ** be public and is therefore removed from the "private" table.
+**
+** In the client, the file is only queued, and it is stored by a later
+** call to xfer_store_files().
 */
 static void xfer_accept_file(Xfer *pXfer, int cloneFlag){
   int n;
@@ -137,6 +440,10 @@ static void xfer_accept_file(Xfer *pXfer, int cloneFlag){
     blob_reset(&content);
     return;
   }
+  if( pXfer->nToken==4 && xfer_file_is_waiting(&pXfer->aToken[2]) ){
+    /* The delta source must be stored first */
+    xfer_store_files(pXfer);
+  }
   if( cloneFlag ){
     if( pXfer->nToken==4 ){
       srcid = rid_from_uuid(&pXfer->aToken[2], 1, isPriv);
@@ -145,6 +452,10 @@ static void xfer_accept_file(Xfer *pXfer, int cloneFlag){
       srcid = 0;
       pXfer->nFileRcvd++;
     }
+    if( xferIngest.pPool ){
+      xfer_queue_file(pXfer, &content, &pXfer->aToken[1], srcid, isPriv, 1);
+      return;
+    }
     rid = content_put_ex(&content, blob_str(&pXfer->aToken[1]), srcid,
                          0, isPriv);
     remote_has(rid);
@@ -172,6 +483,10 @@ static void xfer_accept_file(Xfer *pXfer, int cloneFlag){
   }else{
     pXfer->nFileRcvd++;
   }
+  if( xferIngest.pPool ){
+    xfer_queue_file(pXfer, &content, &pXfer->aToken[1], 0, isPriv, 0);
+    return;
+  }
   sha1sum_blob(&content, &hash);
   if( !blob_eq_str(&pXfer->aToken[1], blob_str(&hash), -1) ){
     blob_appendf(&pXfer->err, "content does not match sha1 hash");
@@ -258,20 +573,35 @@ static void xfer_accept_compressed_file(Xfer *pXfer){
 }
 
 /*
-** Try to send a file as a delta against its parent.
-** If successful, return the number of bytes in the delta.
-** If we cannot generate an appropriate delta, then send
-** nothing and return zero.
+** While accepting a push, commit once this many more bytes of the
+** request have been read.
+*/
+#define XFER_COMMIT_BYTES  10000000
+
+/*
+** Called by the server after it stores a file pushed by the client.  If
+** XFER_COMMIT_BYTES of the request have been read since *piMark, then
+** crosslink and commit the artifacts received so far and start a new
+** transaction.  A large push then never holds the write lock for long,
+** so readers and other pushes get a turn between batches.  Artifacts
+** are immutable, so a batch that is committed stays valid even if a
+** later part of the push fails.
+*/
+static void xfer_push_checkpoint(Xfer *pXfer, int *piMark){
+  if( pXfer->pIn->iCursor - *piMark < XFER_COMMIT_BYTES ) return;
+  manifest_crosslink_end();
+  db_checkpoint_transaction();
+  manifest_crosslink_begin();
+  *piMark = pXfer->pIn->iCursor;
+}
+
+/*
+** Return the rid of the parent of artifact rid that a delta for rid
+** should be made against, or zero if there is no suitable parent.
 **
 ** Never send a delta against a private artifact.
 */
-static int send_delta_parent(
-  Xfer *pXfer,            /* The transfer context */
-  int rid,                /* record id of the file to send */
-  int isPrivate,          /* True if rid is a private artifact */
-  Blob *pContent,         /* The content of the file to send */
-  Blob *pUuid             /* The UUID of the file to send */
-){
+static int delta_parent(Xfer *pXfer, int rid){
   static const char *azQuery[] = {
     "SELECT pid FROM plink x"
     " WHERE cid=%d"
@@ -286,17 +616,164 @@ static int send_delta_parent(
                      "  WHERE y.pid=x.fid AND y.fid=x.pid)"
   };
   int i;
-  Blob src, delta;
-  int size = 0;
   int srcId = 0;
 
   for(i=0; srcId==0 && i<count(azQuery); i++){
     srcId = db_int(0, azQuery[i], rid);
   }
-  if( srcId>0
-   && (pXfer->syncPrivate || !content_is_private(srcId))
-   && content_get(srcId, &src)
-  ){
+  if( srcId>0 && !pXfer->syncPrivate && content_is_private(srcId) ){
+    srcId = 0;
+  }
+  return srcId;
+}
+
+/*
+** A server that has the "delta-cache-size" setting keeps the deltas
+** that it computes against parent artifacts in the DELTACACHE table,
+** keyed by the rid of the artifact and the rid of the parent.  When
+** many clients pull the same new check-in, each delta is computed
+** only once.  The deltas are stored compressed.  Once the table
+** holds more than delta-cache-size bytes, the oldest entries are
+** removed.
+**
+** The DELTACACHE table is not part of the repository schema.  It is
+** dropped by "fossil rebuild".  Entries that refer to shunned
+** artifacts are removed by shun_artifacts(), and a shunned source is
+** never used in any case.
+**
+** Updates to the cache are made on a best-effort basis.  A failure,
+** such as another process holding the write lock, is silently
+** ignored and the delta is simply not cached.
+*/
+
+/*
+** Try to send a file as a delta against srcId taken from the
+** DELTACACHE table.  If successful, return the number of bytes in
+** the delta.  Return zero and send nothing if no delta is cached.
+*/
+static int send_cached_delta(
+  Xfer *pXfer,            /* The transfer context */
+  int rid,                /* record id of the file to send */
+  int srcId,              /* The parent to send a delta against */
+  int isPrivate,          /* True if rid is a private artifact */
+  Blob *pUuid             /* The UUID of the file to send */
+){
+  Blob delta;
+  int size = 0;
+  char *zUuid;
+  Stmt q;
+
+  db_prepare(&q,
+    "SELECT delta, (SELECT uuid FROM blob WHERE rid=%d)"
+    "  FROM %s.deltacache WHERE rid=%d AND srcid=%d",
+    srcId, db_name("repository"), rid, srcId
+  );
+  if( db_step(&q)==SQLITE_ROW ){
+    zUuid = fossil_strdup(db_column_text(&q, 1));
+    blob_zero(&delta);
+    db_column_blob(&q, 0, &delta);
+    db_finalize(&q);
+    if( zUuid==0 || uuid_is_shunned(zUuid) ){
+      blob_reset(&delta);
+      free(zUuid);
+      return 0;
+    }
+    blob_uncompress(&delta, &delta);
+    size = blob_size(&delta);
+    if( isPrivate ) blob_append(pXfer->pOut, "private\n", -1);
+    blob_appendf(pXfer->pOut, "file %b %s %d\n", pUuid, zUuid, size);
+    blob_append(pXfer->pOut, blob_buffer(&delta), size);
+    blob_reset(&delta);
+    free(zUuid);
+  }else{
+    db_finalize(&q);
+  }
+  return size;
+}
+
+/*
+** Return the "delta-cache-size" setting for use as Xfer.mxDeltaCache,
+** first creating the DELTACACHE table if it does not already exist.
+** Return zero if the cache is disabled or the table cannot be created.
+**
+** This is called before the reply is started, so that any error is
+** discarded along with the rest of the output up to that point and
+** so that the schema does not change while the reply is generated.
+*/
+static int delta_cache_init(void){
+  const char *zDb = db_name("repository");
+  char *zSql;
+  int mx = db_get_int("delta-cache-size", 0);
+  if( mx<=0 ) return 0;
+  if( !db_exists("SELECT 1 FROM %s.sqlite_master WHERE name='deltacache'",
+                 zDb) ){
+    zSql = mprintf(
+      "CREATE TABLE IF NOT EXISTS %s.deltacache(\n"
+      "  rid INTEGER,       -- The artifact\n"
+      "  srcid INTEGER,     -- The parent the delta is against\n"
+      "  sz INTEGER,        -- Size of the delta column in bytes\n"
+      "  delta BLOB,        -- Compressed delta of rid against srcid\n"
+      "  PRIMARY KEY(rid,srcid)\n"
+      ");", zDb
+    );
+    db_multi_exec_ignore_error(zSql, 0);
+    free(zSql);
+    if( !db_exists("SELECT 1 FROM %s.sqlite_master WHERE name='deltacache'",
+                   zDb) ){
+      return 0;
+    }
+  }
+  return mx;
+}
+
+/*
+** Save the delta of rid against srcId in the DELTACACHE table.  If
+** the table then holds more than pXfer->mxDeltaCache bytes, remove
+** the older half of its entries.
+*/
+static void delta_cache_put(Xfer *pXfer, int rid, int srcId, Blob *pDelta){
+  const char *zDb = db_name("repository");
+  char *zSql;
+  Blob z;
+
+  blob_compress(pDelta, &z);
+  if( blob_size(&z)>pXfer->mxDeltaCache ){
+    blob_reset(&z);
+    return;
+  }
+  zSql = mprintf(
+    "INSERT OR IGNORE INTO %s.deltacache(rid,srcid,sz,delta)"
+    " VALUES(%d,%d,%d,:content);"
+    "DELETE FROM %s.deltacache"
+    " WHERE (SELECT total(sz) FROM %s.deltacache)>%d"
+    "   AND rowid<(SELECT rowid FROM %s.deltacache ORDER BY rowid DESC"
+    "               LIMIT 1 OFFSET (SELECT count(*)/2 FROM %s.deltacache));",
+    zDb, rid, srcId, blob_size(&z),
+    zDb, zDb, pXfer->mxDeltaCache, zDb, zDb
+  );
+  db_multi_exec_ignore_error(zSql, &z);
+  free(zSql);
+  blob_reset(&z);
+}
+
+/*
+** Try to send a file as a delta against its parent srcId.
+** If successful, return the number of bytes in the delta.
+** If we cannot generate an appropriate delta, then send
+** nothing and return zero.
+*/
+static int send_delta_parent(
+  Xfer *pXfer,            /* The transfer context */
+  int rid,                /* record id of the file to send */
+  int srcId,              /* The parent, from delta_parent() */
+  int isPrivate,          /* True if rid is a private artifact */
+  Blob *pContent,         /* The content of the file to send */
+  Blob *pUuid             /* The UUID of the file to send */
+){
+  Blob src, delta;
+  int size = 0;
+
+  if( srcId>0 && content_get(srcId, &src) ){
     char *zUuid = db_text(0, "SELECT uuid FROM blob WHERE rid=%d", srcId);
     blob_delta_create(&src, pContent, &delta);
     size = blob_size(&delta);
@@ -308,6 +785,7 @@ static int send_delta_parent(
       if( isPrivate ) blob_append(pXfer->pOut, "private\n", -1);
       blob_appendf(pXfer->pOut, "file %b %s %d\n", pUuid, zUuid, size);
       blob_append(pXfer->pOut, blob_buffer(&delta), size);
+      if( pXfer->mxDeltaCache>0 ) delta_cache_put(pXfer, rid, srcId, &delta);
     }
     blob_reset(&delta);
     free(zUuid);
@@ -399,8 +877,14 @@ static void send_file(Xfer *pXfer, int rid, Blob *pUuid, int nativeDelta){
     blob_reset(&uuid);
     return;
   }
-  if( pXfer->mxSend<=blob_size(pXfer->pOut) ){
+  if( pXfer->mxSend<=xfer_out_size(pXfer) ){
     const char *zFormat = isPriv ? "igot %b 1\n" : "igot %b\n";
+    if( pXfer->pipeline && pUuid!=&uuid ){
+      /* A pipelined client knows about every artifact it asked for
+      ** and will ask again, so do not echo an igot back */
+      blob_reset(&uuid);
+      return;
+    }
     blob_appendf(pXfer->pOut, zFormat, pUuid);
     pXfer->nIGotSent++;
     blob_reset(&uuid);
@@ -413,21 +897,28 @@ static void send_file(Xfer *pXfer, int rid, Blob *pUuid, int nativeDelta){
     }
   }
   if( size==0 ){
-    content_get(rid, &content);
-
-    if( !nativeDelta && blob_size(&content)>100 ){
-      size = send_delta_parent(pXfer, rid, isPriv, &content, pUuid);
+    int srcId = nativeDelta ? 0 : delta_parent(pXfer, rid);
+    if( srcId>0 && pXfer->mxDeltaCache>0 ){
+      size = send_cached_delta(pXfer, rid, srcId, isPriv, pUuid);
+    }
+    if( size==0 ){
+      content_get(rid, &content);
+      if( srcId>0 && blob_size(&content)>100 ){
+        size = send_delta_parent(pXfer, rid, srcId, isPriv, &content, pUuid);
+      }
+      if( size==0 ){
+        int size = blob_size(&content);
+        if( isPriv ) blob_append(pXfer->pOut, "private\n", -1);
+        blob_appendf(pXfer->pOut, "file %b %d\n", pUuid, size);
+        blob_append(pXfer->pOut, blob_buffer(&content), size);
+      }
+      blob_reset(&content);
     }
     if( size==0 ){
-      int size = blob_size(&content);
-      if( isPriv ) blob_append(pXfer->pOut, "private\n", -1);
-      blob_appendf(pXfer->pOut, "file %b %d\n", pUuid, size);
-      blob_append(pXfer->pOut, blob_buffer(&content), size);
       pXfer->nFileSent++;
     }else{
       pXfer->nDeltaSent++;
     }
-    blob_reset(&content);
   }
   remote_has(rid);
   blob_reset(&uuid);
@@ -442,6 +933,10 @@ static void send_file(Xfer *pXfer, int rid, Blob *pUuid, int nativeDelta){
 ** Send the file identified by rid as a compressed artifact.  Basically,
 ** send the content exactly as it appears in the BLOB table using 
 ** a "cfile" card.
+**
+** Content stored with zstd compression is only sent as-is if the other
+** side has said that it can read zstd, using "pragma accept-zstd".
+** Otherwise it is recompressed with zlib, which every fossil can read.
 */
 static void send_compressed_file(Xfer *pXfer, int rid){
   const char *zContent;
@@ -452,6 +947,7 @@ static void send_compressed_file(Xfer *pXfer, int rid){
   int rc;
   int isPrivate;
   int srcIsPrivate;
+  int isRecompress;
   static Stmt q1;
   Blob fullContent;
 
@@ -476,7 +972,14 @@ static void send_compressed_file(Xfer *pXfer, int rid){
     zDelta = db_column_text(&q1, 4);
     if( isPrivate ) blob_append(pXfer->pOut, "private\n", -1);
     blob_appendf(pXfer->pOut, "cfile %s ", zUuid);
-    if( !isPrivate && srcIsPrivate ){
+    blob_init(&fullContent, zContent, szC);
+    isRecompress = (!isPrivate && srcIsPrivate) || (szC==0 && szU>0);
+    if( !pXfer->acceptZstd
+     && blob_compress_method(&fullContent)==BLOB_COMPRESS_ZSTD
+    ){
+      isRecompress = 1;
+    }
+    if( isRecompress ){
       content_get(rid, &fullContent);
       szU = blob_size(&fullContent);
       blob_compress(&fullContent, &fullContent);
@@ -495,13 +998,80 @@ static void send_compressed_file(Xfer *pXfer, int rid){
     if( blob_buffer(pXfer->pOut)[blob_size(pXfer->pOut)-1]!='\n' ){
       blob_appendf(pXfer->pOut, "\n", 1);
     }
-    if( !isPrivate && srcIsPrivate ){
+    if( isRecompress ){
       blob_reset(&fullContent);
     }
   }
   db_reset(&q1);
 }
 
+/*
+** A clone bundle is a pre-built copy of the "cfile" cards that a
+** "clone 3" reply would contain, generated ahead of time by the
+** "fossil clone-bundle" command.  The cards are split into segments
+** of about max-download bytes and stored in the CLONEBUNDLE table,
+** one row per segment, keyed by the first rid the segment covers.
+** A "clone 3 N" request that lands on the start of a segment is
+** answered by copying out the segment, without looking at the
+** individual artifacts.  Requests for rids past the end of the
+** bundle are answered from the BLOB table as usual.
+**
+** The CLONEBUNDLE table is not part of the repository schema.  It is
+** dropped by "fossil rebuild", and it is ignored once the shun list
+** has changed since the bundle was built.  Each segment also records
+** how many rids in its range were left out as phantoms or private
+** artifacts.  If that number has since gone down, some of those rids
+** now need to be sent and the segment is not used.
+*/
+
+/*
+** Return a string that changes whenever an entry is added to or
+** removed from the SHUN table.  Space to hold the string is obtained
+** from malloc().
+*/
+static char *clone_bundle_shun_mark(void){
+  return db_text("", "SELECT count(*) || ' ' || coalesce(max(rowid),0)"
+                     "  FROM shun");
+}
+
+/*
+** If there is a clone bundle segment that starts at seqno and ends at
+** or before rid max, append it to the reply and return the seqno of
+** the first rid after the segment.  Return 0 if no usable segment
+** exists, in which case the caller should send artifacts itself.
+*/
+static int send_clone_bundle(Xfer *pXfer, int seqno, int max){
+  static int isValid = -1;
+  int nextSeqno = 0;
+  Stmt q;
+
+  if( pXfer->syncPrivate ) return 0;
+  if( isValid<0 ){
+    isValid = 0;
+    if( db_exists("SELECT 1 FROM %s.sqlite_master"
+                  " WHERE name='clonebundle'", db_name("repository")) ){
+      char *zMark = clone_bundle_shun_mark();
+      isValid = fossil_strcmp(zMark, db_get("clone-bundle-shun",""))==0;
+      free(zMark);
+    }
+  }
+  if( !isValid ) return 0;
+  db_prepare(&q,
+    "SELECT nextseq, content FROM clonebundle"
+    " WHERE seqno=%d AND nextseq<=%d+1"
+    "   AND nskip=(SELECT count(*) FROM blob"
+                 " WHERE rid>=clonebundle.seqno"
+                 "   AND rid<clonebundle.nextseq"
+                 "   AND (size<0 OR rid IN private))", seqno, max
+  );
+  if( db_step(&q)==SQLITE_ROW ){
+    nextSeqno = db_column_int(&q, 0);
+    blob_append(pXfer->pOut, db_column_raw(&q, 1), db_column_bytes(&q, 1));
+  }
+  db_finalize(&q);
+  return nextSeqno;
+}
+
 /*
 ** Send a gimme message for every phantom.
 **
@@ -518,10 +1088,11 @@ static void request_phantoms(Xfer *pXfer, int maxReq){
   );
   while( db_step(&q)==SQLITE_ROW && maxReq-- > 0 ){
     const char *zUuid = db_column_text(&q, 0);
-    blob_appendf(pXfer->pOut, "gimme %s\n", zUuid);
+    xfer_send_hash(pXfer, "gimme", zUuid);
     pXfer->nGimmeSent++;
   }
   db_finalize(&q);
+  xfer_flush_raw(pXfer);
 }
 
 /*
@@ -649,6 +1220,13 @@ static void send_unsent(Xfer *pXfer){
 ** 100 and if it is, form a new cluster.  Unclustered phantoms do not
 ** count toward the 100 total.  And phantoms are never added to a new
 ** cluster.
+**
+** A cluster holds at most about 800 entries, so a large backlog makes
+** many clusters, and each new cluster is itself unclustered.  Repeat
+** until fewer than 100 entries remain, so that the older clusters are
+** gathered into clusters of clusters.  A tree of clusters keeps the
+** unclustered table, and hence the igot cards sent on every sync, small
+** however many artifacts the repository holds.
 */
 void create_cluster(void){
   Blob cluster, cksum;
@@ -666,10 +1244,11 @@ void create_cluster(void){
   );
 #endif
 
-  nUncl = db_int(0, "SELECT count(*) FROM unclustered /*scan*/"
-                    " WHERE NOT EXISTS(SELECT 1 FROM phantom"
-                                      " WHERE rid=unclustered.rid)");
-  if( nUncl>=100 ){
+  while( (nUncl = db_int(0, "SELECT count(*) FROM unclustered /*scan*/"
+                            " WHERE NOT EXISTS(SELECT 1 FROM phantom"
+                            "                  WHERE rid=unclustered.rid)"))
+         >=100 ){
+    nRow = 0;
     blob_zero(&cluster);
     blob_zero(&deleteWhere);
     db_prepare(&q, "SELECT uuid FROM unclustered, blob"
@@ -719,6 +1298,7 @@ static int send_private(Xfer *pXfer){
     while( db_step(&q)==SQLITE_ROW ){
       blob_appendf(pXfer->pOut, "igot %s 1\n", db_column_text(&q,0));
       cnt++;
+      cgi_flush_content();
     }
     db_finalize(&q);
   }
@@ -739,10 +1319,12 @@ static int send_unclustered(Xfer *pXfer){
     "   AND NOT EXISTS(SELECT 1 FROM private WHERE rid=blob.rid)"
   );
   while( db_step(&q)==SQLITE_ROW ){
-    blob_appendf(pXfer->pOut, "igot %s\n", db_column_text(&q, 0));
+    xfer_send_hash(pXfer, "igot", db_column_text(&q, 0));
     cnt++;
+    cgi_flush_content();
   }
   db_finalize(&q);
+  xfer_flush_raw(pXfer);
   return cnt;
 }
 
@@ -758,9 +1340,124 @@ static void send_all(Xfer *pXfer){
     "   AND NOT EXISTS(SELECT 1 FROM phantom WHERE rid=blob.rid)"
   );
   while( db_step(&q)==SQLITE_ROW ){
-    blob_appendf(pXfer->pOut, "igot %s\n", db_column_text(&q, 0));
+    xfer_send_hash(pXfer, "igot", db_column_text(&q, 0));
+    cgi_flush_content();
   }
   db_finalize(&q);
+  xfer_flush_raw(pXfer);
+}
+
+/*
+** When the two sides of a pull appear to differ by at least
+** IBLT_MIN_DIFF artifacts, the server asks the client for an IBLT of
+** its artifacts, which is then used to find every missing artifact in
+** a single exchange instead of walking down through the clusters one
+** round trip at a time.  IBLTs larger than IBLT_MAX_CELL cells are
+** never requested.
+*/
+#define IBLT_MIN_DIFF  1000
+#define IBLT_MAX_CELL  400000
+
+/*
+** Return the approximate number of public artifacts in the repository.
+** This is used to guess how many artifacts the two sides of a sync
+** differ by, so it only needs to be close.
+*/
+static int xfer_public_count(void){
+  return db_int(0,
+    "SELECT (SELECT count(*) FROM blob)"
+    "     - (SELECT count(*) FROM phantom)"
+    "     - (SELECT count(*) FROM private)"
+  );
+}
+
+/*
+** Fill in an IBLT with nCell cells holding every public artifact.
+** This is the same set of artifacts that send_all() sends igots for.
+*/
+static void xfer_build_iblt(Iblt *p, int nCell){
+  Stmt q;
+  iblt_init(p, nCell);
+  db_prepare(&q,
+    "SELECT uuid FROM blob "
+    " WHERE NOT EXISTS(SELECT 1 FROM shun WHERE uuid=blob.uuid)"
+    "   AND NOT EXISTS(SELECT 1 FROM private WHERE rid=blob.rid)"
+    "   AND NOT EXISTS(SELECT 1 FROM phantom WHERE rid=blob.rid)"
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    iblt_insert(p, db_column_text(&q, 0));
+  }
+  db_finalize(&q);
+}
+
+/*
+** State passed to send_reconciled_key().
+*/
+struct ReconcileState {
+  Xfer *pXfer;        /* Where to send cards */
+  int isPush;         /* True if the client is allowed to push */
+};
+
+/*
+** Callback from iblt_decode() for one artifact that is on only one
+** side of the sync.  Artifacts said to be only here are checked
+** against the BLOB table before they are offered, which guards against
+** the small chance that a cell of the IBLT merely looked like it held
+** a single artifact.
+*/
+static void send_reconciled_key(void *pArg, const char *zUuid, int n){
+  struct ReconcileState *p = (struct ReconcileState*)pArg;
+  if( n>0 ){
+    if( db_exists("SELECT 1 FROM blob WHERE uuid='%s' AND size>=0", zUuid) ){
+      xfer_send_hash(p->pXfer, "igot", zUuid);
+    }
+  }else if( p->isPush
+         && !db_exists("SELECT 1 FROM blob WHERE uuid='%s' AND size>=0",
+                       zUuid)
+         && !db_exists("SELECT 1 FROM shun WHERE uuid='%s'", zUuid) ){
+    xfer_send_hash(p->pXfer, "gimme", zUuid);
+  }
+  cgi_flush_content();
+}
+
+/*
+** The client sent an IBLT of its public artifacts with nCell cells in
+** pIn.  Send an igot card for every public artifact the client does
+** not have and, if the client is pushing, a gimme card for every
+** artifact it has that we do not.  If there are too many differences
+** to work out from an IBLT of that size, only some of them are sent
+** and the client finds the rest the usual way, through the igot cards
+** from send_unclustered().
+*/
+static void send_reconciled(Xfer *pXfer, int nCell, Blob *pIn, int isPush){
+  Iblt local, remote;
+  struct ReconcileState x;
+
+  if( iblt_deserialize(&remote, nCell, pIn) ) return;
+  xfer_build_iblt(&local, nCell);
+  iblt_subtract(&local, &remote);
+  iblt_reset(&remote);
+  x.pXfer = pXfer;
+  x.isPush = isPush;
+  iblt_decode(&local, send_reconciled_key, &x);
+  iblt_reset(&local);
+  xfer_flush_raw(pXfer);
+}
+
+/*
+** The client has about nRemote public artifacts.  It also has nUnsent
+** artifacts that it has not yet pushed.  If that suggests the two
+** sides differ by many artifacts, ask the client for an IBLT.
+*/
+static void request_reconcile(int nRemote, int nUnsent){
+  int nDiff = xfer_public_count() - nRemote;
+  int nCell;
+  if( nDiff<0 ) nDiff = -nDiff;
+  nDiff += nUnsent;
+  if( nDiff<IBLT_MIN_DIFF ) return;
+  nCell = nDiff*2 + 60;
+  if( nCell>IBLT_MAX_CELL ) return;
+  @ pragma iblt-request %d(nCell)
 }
 
 /*
@@ -803,11 +1500,16 @@ static void server_private_xfer_not_authorized(void){
 ** when there is no script.
 */
 static int run_script(const char *zScript){
+  i64 iStart;
+  int rc;
   if( !zScript ){
     return TH_OK; /* No script, return success. */
   }
   Th_FossilInit(); /* Make sure TH1 is ready. */
-  return Th_Eval(g.interp, 0, zScript, -1);
+  iStart = perf_timer_start(PERF_TH1_EVAL);
+  rc = Th_Eval(g.interp, 0, zScript, -1);
+  perf_timer_stop(PERF_TH1_EVAL, iStart);
+  return rc;
 }
 
 /*
@@ -853,7 +1555,12 @@ void page_xfer(void){
   int nGimme = 0;
   int size;
   int recvConfig = 0;
+  int nRemoteCount = -1;
+  int nRemoteUnsent = 0;
+  int nIbltCell = 0;
+  Blob ibltIn;
   char *zNow;
+  int iCommitMark = 0;   /* Input read as of the last commit of a push */
 
   if( fossil_strcmp(PD("REQUEST_METHOD","POST"),"POST") ){
      fossil_redirect_home();
@@ -863,6 +1570,7 @@ void page_xfer(void){
   login_check_credentials();
   memset(&xfer, 0, sizeof(xfer));
   blobarray_zero(xfer.aToken, count(xfer.aToken));
+  xfer.mxDeltaCache = delta_cache_init();
   cgi_set_content_type(g.zContentType);
   cgi_reset_content();
   if( db_schema_is_outofdate() ){
@@ -870,6 +1578,7 @@ void page_xfer(void){
     return;
   }
   blob_zero(&xfer.err);
+  blob_zero(&ibltIn);
   xfer.pIn = &g.cgiIn;
   xfer.pOut = cgi_output_blob();
   xfer.mxSend = db_get_int("max-download", 5000000);
@@ -909,6 +1618,7 @@ void page_xfer(void){
         nErr++;
         break;
       }
+      xfer_push_checkpoint(&xfer, &iCommitMark);
     }else
 
     /*   cfile UUID USIZE CSIZE \n CONTENT
@@ -930,6 +1640,7 @@ void page_xfer(void){
         nErr++;
         break;
       }
+      xfer_push_checkpoint(&xfer, &iCommitMark);
     }else
 
     /*   gimme UUID
@@ -949,6 +1660,37 @@ void page_xfer(void){
       }
     }else
 
+    /*   gimme_raw N \n HASHES
+    **   igot_raw N \n HASHES
+    **
+    ** The same as N "gimme" or public "igot" cards.  See
+    ** xfer_send_hash().
+    */
+    if( blob_eq(&xfer.aToken[0], "gimme_raw")
+     || blob_eq(&xfer.aToken[0], "igot_raw")
+    ){
+      int isGimme = blob_eq(&xfer.aToken[0], "gimme_raw");
+      Blob hashes;
+      int i, n;
+      char zUuid[UUID_SIZE+1];
+      n = xfer_read_raw(&xfer, &hashes);
+      for(i=0; i<n; i++){
+        Blob uuid;
+        xfer_raw_uuid(&hashes, i, zUuid);
+        blob_init(&uuid, zUuid, UUID_SIZE);
+        if( isGimme ){
+          nGimme++;
+          if( isPull ){
+            int rid = rid_from_uuid(&uuid, 0, 0);
+            if( rid ) send_file(&xfer, rid, &uuid, deltaFlag);
+          }
+        }else if( isPush ){
+          rid_from_uuid(&uuid, 1, 0);
+        }
+      }
+      blob_reset(&hashes);
+    }else
+
     /*   igot UUID ?ISPRIVATE?
     **
     ** Client announces that it has a particular file.  If the ISPRIVATE
@@ -1040,15 +1782,25 @@ void page_xfer(void){
         }
         blob_is_int(&xfer.aToken[2], &seqno);
         max = db_int(0, "SELECT max(rid) FROM blob");
-        while( xfer.mxSend>blob_size(xfer.pOut) && seqno<=max ){
+        @ pragma clone-max %d(max)
+        if( xfer.cloneLimit>0 && xfer.cloneLimit<max ) max = xfer.cloneLimit;
+        if( iVers>=3 ){
+          int nextSeqno = send_clone_bundle(&xfer, seqno, max);
+          if( nextSeqno>0 ){
+            seqno = nextSeqno;
+            cgi_flush_content();
+          }
+        }
+        while( xfer.mxSend>xfer_out_size(&xfer) && seqno<=max ){
           if( iVers>=3 ){
             send_compressed_file(&xfer, seqno);
           }else{
             send_file(&xfer, seqno, 0, 1);
           }
           seqno++;
+          cgi_flush_content();
         }
-        if( seqno>=max ) seqno = 0;
+        if( seqno>max ) seqno = 0;
         @ clone_seqno %d(seqno)
       }else{
         isClone = 1;
@@ -1128,6 +1880,28 @@ void page_xfer(void){
       blob_seek(xfer.pIn, 1, BLOB_SEEK_CUR);
     }else
 
+    /*   iblt NCELL SIZE \n CONTENT
+    **
+    ** An IBLT of all public artifacts on the client, sent in answer to
+    ** a "pragma iblt-request".  It is used once all other cards have
+    ** been processed, to list the artifacts the client is missing.
+    */
+    if( blob_eq(&xfer.aToken[0],"iblt") && xfer.nToken==3
+        && blob_is_int(&xfer.aToken[1], &nIbltCell)
+        && blob_is_int(&xfer.aToken[2], &size) ){
+      if( nIbltCell<=0 || nIbltCell>IBLT_MAX_CELL
+       || size!=iblt_serialized_size(nIbltCell)
+      ){
+        cgi_reset_content();
+        @ error bad\siblt\scard
+        nErr++;
+        break;
+      }
+      blob_reset(&ibltIn);
+      blob_extract(xfer.pIn, size, &ibltIn);
+      blob_seek(xfer.pIn, 1, BLOB_SEEK_CUR);
+    }else
+
       
 
     /*    cookie TEXT
@@ -1187,6 +1961,71 @@ void page_xfer(void){
           xfer.syncPrivate = 1;
         }
       }
+
+      /*   pragma accept-zstd
+      **
+      ** The client is able to read "cfile" content that is compressed
+      ** using zstd, so such content can be sent without recompression.
+      */
+      if( blob_eq(&xfer.aToken[1], "accept-zstd") ){
+        xfer.acceptZstd = 1;
+      }
+
+      /*   pragma pipeline
+      **
+      ** The client keeps re-requesting every artifact it is missing
+      ** until it arrives, so it can send far more "gimme" cards in one
+      ** message than fit in a single reply.  Gimmes that do not fit are
+      ** dropped silently instead of being answered with "igot".  The
+      ** pragma is echoed back so that the client knows it was honored.
+      */
+      if( blob_eq(&xfer.aToken[1], "pipeline") && !xfer.pipeline ){
+        xfer.pipeline = 1;
+        @ pragma pipeline
+      }
+
+      /*   pragma raw-hash
+      **
+      ** The client can read "igot_raw" and "gimme_raw" cards, so send
+      ** runs of "igot" and "gimme" cards that way.  The pragma is echoed
+      ** back so that the client does the same in later messages.
+      */
+      if( blob_eq(&xfer.aToken[1], "raw-hash") && !xfer.rawHash ){
+        xfer.rawHash = 1;
+        @ pragma raw-hash
+      }
+
+      /*   pragma stream-reply
+      **
+      ** The client can read a reply that has no Content-Length and
+      ** ends when the connection closes.  Such a reply is sent while
+      ** it is still being generated, as a single zlib stream, so the
+      ** server never holds the whole reply in memory.
+      */
+      if( blob_eq(&xfer.aToken[1], "stream-reply") ){
+        cgi_allow_incremental_reply();
+      }
+
+      /*   pragma clone-limit N
+      **
+      ** Stop a "clone 3" reply after the artifact with rid N, so that
+      ** several connections can each fetch part of a clone.
+      */
+      if( blob_eq(&xfer.aToken[1], "clone-limit") && xfer.nToken==3 ){
+        blob_is_int(&xfer.aToken[2], &xfer.cloneLimit);
+      }
+
+      /*   pragma iblt COUNT UNSENT
+      **
+      ** The client has about COUNT public artifacts, of which UNSENT
+      ** have not yet been pushed anywhere.  If that is far from the
+      ** number of artifacts here, the server answers with
+      ** "pragma iblt-request NCELL" to ask for an IBLT of that size.
+      */
+      if( blob_eq(&xfer.aToken[1], "iblt") && xfer.nToken==4 ){
+        blob_is_int(&xfer.aToken[2], &nRemoteCount);
+        blob_is_int(&xfer.aToken[3], &nRemoteUnsent);
+      }
     }else
 
     /* Unknown message
@@ -1196,6 +2035,7 @@ void page_xfer(void){
       @ error bad\scommand:\s%F(blob_str(&xfer.line))
     }
     blobarray_reset(xfer.aToken, xfer.nToken);
+    cgi_flush_content();
   }
   if( isPush ){
     if( run_push_script()==TH_ERROR ){
@@ -1219,11 +2059,19 @@ void page_xfer(void){
     create_cluster();
     send_unclustered(&xfer);
     if( xfer.syncPrivate ) send_private(&xfer);
+    if( blob_size(&ibltIn)>0 ){
+      send_reconciled(&xfer, nIbltCell, &ibltIn, isPush);
+    }else if( nRemoteCount>=0 ){
+      request_reconcile(nRemoteCount, nRemoteUnsent);
+    }
   }
+  blob_reset(&ibltIn);
   if( recvConfig ){
     configure_finalize_receive();
   }
   manifest_crosslink_end();
+  metrics_xfer(xfer.nIGotSent, xfer.nGimmeSent, xfer.nFileSent,
+               xfer.nDeltaSent, xfer.nFileRcvd, xfer.nDeltaRcvd);
 
   /* Send the server timestamp last, in case prior processing happened
   ** to use up a significant fraction of our time window.
@@ -1267,12 +2115,317 @@ void cmd_test_xfer(void){
   fossil_print("%s\n", cgi_extract_content());
 }
 
+/*
+** COMMAND: clone-bundle
+**
+** Usage: %fossil clone-bundle ?OPTIONS?
+**
+** Build or refresh the clone bundle for a repository.  The clone
+** bundle holds the content of every public artifact in the form in
+** which it is sent to clients by "fossil clone", prepared ahead of
+** time.  A server with a clone bundle answers most clone requests by
+** copying out pieces of the bundle, which costs far less than
+** gathering up each artifact individually.  Artifacts received after
+** the bundle was last refreshed are sent in the usual way.
+**
+** Run this command periodically, for example from cron, to keep the
+** bundle close to the current state of the repository.  Each run
+** only adds the artifacts received since the previous run, unless
+** the shun list has changed in the meantime, in which case the bundle
+** is built again from scratch.  The bundle takes about as much space
+** as the artifacts themselves.
+**
+** Options:
+**    -R|--repository FILE    The repository to build the bundle for
+**    --drop                  Remove the clone bundle
+**    --full                  Build the bundle again from scratch
+*/
+void clone_bundle_cmd(void){
+  int dropFlag = find_option("drop",0,0)!=0;
+  int fullFlag = find_option("full",0,0)!=0;
+  int seqno, max, nSeg = 0;
+  char *zMark;
+  Xfer xfer;
+  Blob out;
+
+  db_find_and_open_repository(0, 0);
+  verify_all_options();
+  if( g.argc!=2 ) usage("?OPTIONS?");
+  db_begin_transaction();
+  zMark = clone_bundle_shun_mark();
+  if( dropFlag || fullFlag
+   || fossil_strcmp(zMark, db_get("clone-bundle-shun",""))!=0
+  ){
+    db_multi_exec("DROP TABLE IF EXISTS %s.clonebundle",
+                  db_name("repository"));
+  }
+  if( dropFlag ){
+    db_unset("clone-bundle-shun", 0);
+    db_end_transaction(0);
+    return;
+  }
+  db_multi_exec(
+    "CREATE TABLE IF NOT EXISTS %s.clonebundle(\n"
+    "  seqno INTEGER PRIMARY KEY,  -- First rid covered by this segment\n"
+    "  nextseq INTEGER,            -- First rid after this segment\n"
+    "  nskip INTEGER,              -- Phantoms and private rids omitted\n"
+    "  content BLOB                -- \"cfile\" cards for the segment\n"
+    ");", db_name("repository")
+  );
+  db_set("clone-bundle-shun", zMark, 0);
+  free(zMark);
+  memset(&xfer, 0, sizeof(xfer));
+  blob_zero(&out);
+  xfer.pOut = &out;
+  xfer.mxSend = db_get_int("max-download", 5000000);
+  seqno = db_int(1, "SELECT coalesce(max(nextseq),1) FROM clonebundle");
+  max = db_int(0, "SELECT max(rid) FROM blob");
+  while( seqno<=max ){
+    int first = seqno;
+    Stmt ins;
+    while( xfer.mxSend>blob_size(&out) && seqno<=max ){
+      send_compressed_file(&xfer, seqno);
+      seqno++;
+    }
+    db_prepare(&ins,
+      "INSERT INTO clonebundle"
+      " SELECT %d, %d, count(*), :content FROM blob"
+      "  WHERE rid>=%d AND rid<%d AND (size<0 OR rid IN private)",
+      first, seqno, first, seqno
+    );
+    db_bind_blob(&ins, ":content", &out);
+    db_step(&ins);
+    db_finalize(&ins);
+    blob_reset(&out);
+    nSeg++;
+  }
+  db_end_transaction(0);
+  fossil_print("%d segments added, %d artifacts and %d deltas\n",
+               nSeg, xfer.nFileSent, xfer.nDeltaSent);
+}
+
 /*
 ** Format strings for progress reporting.
 */
 static const char zLabelFormat[] = "%-10s %10s %10s %10s %10s\n";
 static const char zValueFormat[] = "\r%-10s %10d %10d %10d %10d\n";
 
+/*
+** A clone can be fetched over several connections at once.  Once the
+** first exchanges have retrieved the project code and configuration,
+** the remaining range of rids is divided among child processes, each
+** with its own connection to the server.  A child only does network
+** I/O.  It sends "clone 3" requests limited to its own range with
+** "pragma clone-limit" and passes every reply up a pipe.  The parent
+** process is the only one that writes to the new repository.  It
+** handles each reply exactly as if it had come from its own
+** connection.
+**
+** A reply travels through the pipe as a 4-byte big-endian length
+** followed by that many bytes of uncompressed reply.
+*/
+typedef struct CloneJob CloneJob;
+struct CloneJob {
+  int pid;           /* Process ID of the child, or 0 when finished */
+  int fd;            /* Read replies from the child here */
+};
+
+#ifndef _WIN32
+/*
+** Write N bytes from z onto file descriptor fd.  Return 0 on success.
+*/
+static int clone_job_write(int fd, const char *z, int N){
+  while( N>0 ){
+    int n = write(fd, z, N);
+    if( n<=0 ) return 1;
+    z += n;
+    N -= n;
+  }
+  return 0;
+}
+
+/*
+** Read exactly N bytes from fd into z.  Return 0 on success.
+*/
+static int clone_job_read(int fd, char *z, int N){
+  while( N>0 ){
+    int n = read(fd, z, N);
+    if( n<=0 ) return 1;
+    z += n;
+    N -= n;
+  }
+  return 0;
+}
+
+/*
+** The body of a child process that fetches artifacts iFirst through
+** iLast and writes each reply onto fd.  This routine does not return.
+**
+** The child must not touch the database, which belongs to the parent.
+*/
+static void clone_job_main(int fd, int iFirst, int iLast, int privateFlag){
+  int seqno = iFirst;
+  while( seqno>0 && seqno<=iLast ){
+    Blob send, recv;
+    unsigned char aRand[20];
+    char zRand[41];
+    unsigned char aLen[4];
+    const char *z;
+    int i, n;
+
+    blob_zero(&send);
+    blob_zero(&recv);
+    if( privateFlag ) blob_append(&send, "pragma send-private\n", -1);
+    if( blob_have_zstd() ) blob_append(&send, "pragma accept-zstd\n", -1);
+    blob_append(&send, "pragma stream-reply\n", -1);
+    blob_appendf(&send, "pragma clone-limit %d\n", iLast);
+    blob_appendf(&send, "clone 3 %d\n", seqno);
+    sqlite3_randomness(sizeof(aRand), aRand);
+    encode16(aRand, (unsigned char*)zRand, sizeof(aRand));
+    blob_appendf(&send, "# %s\n", zRand);
+    if( http_exchange(&send, &recv, 1) ) _exit(1);
+    blob_reset(&send);
+
+    /* The "clone_seqno" card follows the last artifact in the reply */
+    z = blob_buffer(&recv);
+    n = blob_size(&recv);
+    seqno = 0;
+    for(i=n-13; i>=0; i--){
+      if( (i==0 || z[i-1]=='\n') && memcmp(&z[i], "clone_seqno ", 12)==0 ){
+        seqno = atoi(&z[i+12]);
+        break;
+      }
+    }
+    aLen[0] = (n>>24) & 0xff;
+    aLen[1] = (n>>16) & 0xff;
+    aLen[2] = (n>>8) & 0xff;
+    aLen[3] = n & 0xff;
+    if( clone_job_write(fd, (char*)aLen, 4) || clone_job_write(fd, z, n) ){
+      _exit(1);
+    }
+    blob_reset(&recv);
+  }
+  transport_close();
+  _exit(0);
+}
+#endif
+
+/*
+** Start nJob child processes that between them fetch artifacts iFirst
+** through iLast.  Return the number of children started, which is zero
+** if this platform or transport is unable to run children.
+*/
+static int clone_jobs_start(
+  CloneJob *aJob,        /* Fill in one entry per child */
+  int nJob,              /* Number of children wanted */
+  int iFirst,            /* First rid to fetch */
+  int iLast,             /* Last rid to fetch */
+  int privateFlag        /* True to fetch private artifacts too */
+){
+#ifndef _WIN32
+  int i;
+  int nPer;
+  if( g.urlIsFile || g.urlIsSsh ) return 0;
+  if( nJob>iLast-iFirst+1 ) nJob = iLast-iFirst+1;
+  nPer = (iLast-iFirst+nJob)/nJob;
+  transport_close();
+  fflush(stdout);
+  for(i=0; i<nJob; i++){
+    int aFd[2];
+    int lo = iFirst + i*nPer;
+    int hi = i==nJob-1 ? iLast : lo+nPer-1;
+    if( pipe(aFd) ) break;
+    aJob[i].pid = fork();
+    if( aJob[i].pid<0 ){
+      close(aFd[0]);
+      close(aFd[1]);
+      break;
+    }
+    if( aJob[i].pid==0 ){
+      int j;
+      for(j=0; j<i; j++) close(aJob[j].fd);
+      close(aFd[0]);
+      db_disown();
+      g.fQuiet = 1;
+      clone_job_main(aFd[1], lo, hi, privateFlag);
+    }
+    close(aFd[1]);
+    aJob[i].fd = aFd[0];
+  }
+  if( i<nJob ){
+    /* Could not start every child.  Abandon the ones that did start. */
+    while( i-- > 0 ){
+      kill(aJob[i].pid, SIGTERM);
+      close(aJob[i].fd);
+      waitpid(aJob[i].pid, 0, 0);
+    }
+    return 0;
+  }
+  return nJob;
+#else
+  return 0;
+#endif
+}
+
+/*
+** Stop every child that is still running.
+*/
+static void clone_jobs_abandon(CloneJob *aJob, int nJob){
+#ifndef _WIN32
+  int i;
+  for(i=0; i<nJob; i++){
+    if( aJob[i].pid==0 ) continue;
+    kill(aJob[i].pid, SIGTERM);
+    close(aJob[i].fd);
+    waitpid(aJob[i].pid, 0, 0);
+    aJob[i].pid = 0;
+  }
+#endif
+}
+
+/*
+** Wait for the next reply from any of the nJob children and store it
+** in pRecv.  Return 1 if a reply was received.  Return 0 once every
+** child has finished.  *pnErr is incremented for each child that
+** failed.
+*/
+static int clone_jobs_next(CloneJob *aJob, int nJob, Blob *pRecv, int *pnErr){
+#ifndef _WIN32
+  while( 1 ){
+    fd_set rd;
+    int i, mxFd = -1;
+    FD_ZERO(&rd);
+    for(i=0; i<nJob; i++){
+      if( aJob[i].pid==0 ) continue;
+      FD_SET(aJob[i].fd, &rd);
+      if( aJob[i].fd>mxFd ) mxFd = aJob[i].fd;
+    }
+    if( mxFd<0 ) return 0;
+    if( select(mxFd+1, &rd, 0, 0, 0)<0 ) continue;
+    for(i=0; i<nJob; i++){
+      unsigned char aLen[4];
+      int n, status = 0;
+      if( aJob[i].pid==0 || !FD_ISSET(aJob[i].fd, &rd) ) continue;
+      if( clone_job_read(aJob[i].fd, (char*)aLen, 4)==0 ){
+        n = (aLen[0]<<24) + (aLen[1]<<16) + (aLen[2]<<8) + aLen[3];
+        blob_zero(pRecv);
+        blob_resize(pRecv, n);
+        if( clone_job_read(aJob[i].fd, blob_buffer(pRecv), n)==0 ){
+          return 1;
+        }
+        blob_reset(pRecv);
+      }
+      close(aJob[i].fd);
+      waitpid(aJob[i].pid, &status, 0);
+      if( !WIFEXITED(status) || WEXITSTATUS(status)!=0 ) (*pnErr)++;
+      aJob[i].pid = 0;
+    }
+  }
+#else
+  return 0;
+#endif
+}
+
 
 /*
 ** Sync to the host identified in g.urlName and g.urlPath.  This
@@ -1310,6 +2463,10 @@ int client_sync(
   const char *zSCode = db_get("server-code", "x");
   const char *zPCode = db_get("project-code", 0);
   int nErr = 0;           /* Number of errors */
+  int cloneMax = 0;       /* Largest rid on the server, if known */
+  int nIbltCell = 0;      /* Send an IBLT this big on the next message */
+  CloneJob aJob[64];      /* Child processes fetching parts of a clone */
+  int nJob = 0;           /* Number of entries in aJob[] */
 
   if( db_get_boolean("dont-push", 0) ) pushFlag = 0;
   if( pushFlag + pullFlag + cloneFlag == 0 
@@ -1337,16 +2494,26 @@ int client_sync(
   blob_zero(&recv);
   blob_zero(&xfer.err);
   blob_zero(&xfer.line);
+  content_compression_init();
+  xferIngest.pPool = workpool_new(workpool_size(0));
+  xferIngest.aFile = fossil_malloc(XFER_BATCH_FILES*sizeof(XferFile));
+  xferIngest.nFile = 0;
+  xferIngest.szFile = 0;
   origConfigRcvMask = 0;
 
 
   /* Send the send-private pragma if we are trying to sync private data */
   if( privateFlag ) blob_append(&send, "pragma send-private\n", -1);
+  if( blob_have_zstd() ) blob_append(&send, "pragma accept-zstd\n", -1);
+  blob_append(&send, "pragma pipeline\n", -1);
+  blob_append(&send, "pragma raw-hash\n", -1);
+  blob_append(&send, "pragma stream-reply\n", -1);
 
   /*
   ** Always begin with a clone, pull, or push message
   */
   if( cloneFlag ){
+    cloneSeqno = db_get_int("clone-resume", 1);
     blob_appendf(&send, "clone 3 %d\n", cloneSeqno);
     pushFlag = 0;
     pullFlag = 0;
@@ -1355,6 +2522,8 @@ int client_sync(
     content_enable_dephantomize(0);
   }else if( pullFlag ){
     blob_appendf(&send, "pull %s %s\n", zSCode, zPCode);
+    blob_appendf(&send, "pragma iblt %d %d\n", xfer_public_count(),
+                 db_int(0, "SELECT count(*) FROM unsent"));
     nCardSent++;
   }
   if( pushFlag ){
@@ -1383,6 +2552,17 @@ int client_sync(
     if( pullFlag || (cloneFlag && cloneSeqno==1) ){
       request_phantoms(&xfer, mxPhantomReq);
     }
+    if( nIbltCell>0 ){
+      Iblt local;
+      xfer_build_iblt(&local, nIbltCell);
+      blob_appendf(&send, "iblt %d %d\n", local.nCell,
+                   iblt_serialized_size(local.nCell));
+      iblt_serialize(&local, &send);
+      blob_append(&send, "\n", 1);
+      iblt_reset(&local);
+      nIbltCell = 0;
+      nCardSent++;
+    }
     if( pushFlag ){
       send_unsent(&xfer);
       nCardSent += send_unclustered(&xfer);
@@ -1435,23 +2615,30 @@ int client_sync(
     blob_appendf(&send, "# %s\n", zRandomness);
     free(zRandomness);
 
-    /* Exchange messages with the server */
-    fossil_print(zValueFormat, "Sent:",
-                 blob_size(&send), nCardSent+xfer.nGimmeSent+xfer.nIGotSent,
-                 xfer.nFileSent, xfer.nDeltaSent);
-    nCardSent = 0;
-    nCardRcvd = 0;
-    xfer.nFileSent = 0;
-    xfer.nDeltaSent = 0;
-    xfer.nGimmeSent = 0;
-    xfer.nIGotSent = 0;
-    if( !g.cgiOutput && !g.fQuiet ){
-      fossil_print("waiting for server...");
-    }
-    fflush(stdout);
-    if( http_exchange(&send, &recv, cloneFlag==0 || nCycle>0) ){
-      nErr++;
-      break;
+    /* Exchange messages with the server, or take the next reply from
+    ** one of the children fetching the clone in parallel.
+    */
+    if( nJob>0 ){
+      nCardSent = 0;
+      if( !clone_jobs_next(aJob, nJob, &recv, &nErr) ) break;
+    }else{
+      fossil_print(zValueFormat, "Sent:",
+                   blob_size(&send), nCardSent+xfer.nGimmeSent+xfer.nIGotSent,
+                   xfer.nFileSent, xfer.nDeltaSent);
+      nCardSent = 0;
+      nCardRcvd = 0;
+      xfer.nFileSent = 0;
+      xfer.nDeltaSent = 0;
+      xfer.nGimmeSent = 0;
+      xfer.nIGotSent = 0;
+      if( !g.cgiOutput && !g.fQuiet ){
+        fossil_print("waiting for server...");
+      }
+      fflush(stdout);
+      if( http_exchange(&send, &recv, cloneFlag==0 || nCycle>0) ){
+        nErr++;
+        break;
+      }
     }
     lastPctDone = -1;
     blob_reset(&send);
@@ -1459,6 +2646,10 @@ int client_sync(
 
     /* Send the send-private pragma if we are trying to sync private data */
     if( privateFlag ) blob_append(&send, "pragma send-private\n", -1);
+    if( blob_have_zstd() ) blob_append(&send, "pragma accept-zstd\n", -1);
+    blob_append(&send, "pragma pipeline\n", -1);
+    blob_append(&send, "pragma raw-hash\n", -1);
+    blob_append(&send, "pragma stream-reply\n", -1);
 
     /* Begin constructing the next message (which might never be
     ** sent) by beginning with the pull or push cards
@@ -1499,6 +2690,16 @@ int client_sync(
       }
       xfer.nToken = blob_tokenize(&xfer.line, xfer.aToken, count(xfer.aToken));
       nCardRcvd++;
+      if( xfer.nToken>0 && !blob_eq(&xfer.aToken[0], "igot")
+       && !blob_eq(&xfer.aToken[0], "igot_raw")
+      ){
+        /* Cards that follow may depend on the igot cards before them */
+        if( xfer_flush_igot(pullFlag || cloneFlag) ) newPhantom = 1;
+      }
+      if( xfer.nToken>0 && !blob_eq(&xfer.aToken[0], "file") ){
+        /* Files received so far must be stored before other cards */
+        xfer_store_files(&xfer);
+      }
       if( !g.cgiOutput && !g.fQuiet && recv.nUsed>0 ){
         pctDone = (recv.iCursor*100)/recv.nUsed;
         if( pctDone!=lastPctDone ){
@@ -1542,6 +2743,40 @@ int client_sync(
         }
       }else
   
+      /*   gimme_raw N \n HASHES
+      **   igot_raw N \n HASHES
+      **
+      ** The same as N "gimme" or public "igot" cards.  See
+      ** xfer_send_hash().
+      */
+      if( blob_eq(&xfer.aToken[0], "gimme_raw")
+       || blob_eq(&xfer.aToken[0], "igot_raw")
+      ){
+        int isGimme = blob_eq(&xfer.aToken[0], "gimme_raw");
+        Blob hashes;
+        int i, n;
+        n = xfer_read_raw(&xfer, &hashes);
+        for(i=0; i<n; i++){
+          if( isGimme ){
+            char zUuid[UUID_SIZE+1];
+            Blob uuid;
+            int rid;
+            if( !pushFlag ) break;
+            xfer_raw_uuid(&hashes, i, zUuid);
+            blob_init(&uuid, zUuid, UUID_SIZE);
+            rid = rid_from_uuid(&uuid, 0, 0);
+            if( rid ) send_file(&xfer, rid, &uuid, 0);
+          }else{
+            if( xferIgot.nIgot>=XFER_BATCH_IGOT ){
+              if( xfer_flush_igot(pullFlag || cloneFlag) ) newPhantom = 1;
+            }
+            xfer_raw_uuid(&hashes, i, xferIgot.azUuid[xferIgot.nIgot]);
+            xferIgot.aIsPriv[xferIgot.nIgot++] = 0;
+          }
+        }
+        blob_reset(&hashes);
+      }else
+
       /*   igot UUID  ?PRIVATEFLAG?
       **
       ** Server announces that it has a particular file.  If this is
@@ -1558,18 +2793,14 @@ int client_sync(
        && blob_eq(&xfer.aToken[0], "igot")
        && blob_is_uuid(&xfer.aToken[1])
       ){
-        int rid;
         int isPriv = xfer.nToken>=3 && blob_eq(&xfer.aToken[2],"1");
-        rid = rid_from_uuid(&xfer.aToken[1], 0, 0);
-        if( rid>0 ){
-          if( !isPriv ) content_make_public(rid);
-        }else if( isPriv && !g.perm.Private ){
-          /* ignore private files */
-        }else if( pullFlag || cloneFlag ){
-          rid = content_new(blob_str(&xfer.aToken[1]), isPriv);
-          if( rid ) newPhantom = 1;
+        if( xferIgot.nIgot>=XFER_BATCH_IGOT ){
+          if( xfer_flush_igot(pullFlag || cloneFlag) ) newPhantom = 1;
         }
-        remote_has(rid);
+        memcpy(xferIgot.azUuid[xferIgot.nIgot], blob_buffer(&xfer.aToken[1]),
+               UUID_SIZE);
+        xferIgot.azUuid[xferIgot.nIgot][UUID_SIZE] = 0;
+        xferIgot.aIsPriv[xferIgot.nIgot++] = isPriv;
       }else
     
       
@@ -1590,6 +2821,8 @@ int client_sync(
         if( zPCode==0 ){
           zPCode = mprintf("%b", &xfer.aToken[2]);
           db_set("project-code", zPCode, 0);
+        }else if( !blob_eq_str(&xfer.aToken[2], zPCode, -1) ){
+          fossil_fatal("the server is for a different project");
         }
         if( cloneSeqno>0 ) blob_appendf(&send, "clone 3 %d\n", cloneSeqno);
         nCardSent++;
@@ -1671,6 +2904,46 @@ int client_sync(
       ** silently ignored.
       */
       if( blob_eq(&xfer.aToken[0], "pragma") && xfer.nToken>=2 ){
+        /*   pragma pipeline
+        **
+        ** The server drops gimme cards that do not fit in its reply
+        ** instead of echoing them back.  So request every missing
+        ** artifact at once rather than ramping up from a small batch.
+        */
+        if( blob_eq(&xfer.aToken[1], "pipeline") ){
+          xfer.pipeline = 1;
+        }
+
+        /*   pragma raw-hash
+        **
+        ** The server reads "igot_raw" and "gimme_raw" cards.
+        */
+        if( blob_eq(&xfer.aToken[1], "raw-hash") ){
+          xfer.rawHash = 1;
+        }
+
+        /*   pragma clone-max N
+        **
+        ** The largest rid the server has.  Used to divide a clone
+        ** among several connections.
+        */
+        if( blob_eq(&xfer.aToken[1], "clone-max") && xfer.nToken==3 ){
+          blob_is_int(&xfer.aToken[2], &cloneMax);
+        }
+
+        /*   pragma iblt-request NCELL
+        **
+        ** The server thinks the two repositories differ by many
+        ** artifacts and asks for an IBLT of NCELL cells covering all
+        ** public artifacts here.  The server answers it with an igot
+        ** for each artifact that this side is missing.
+        */
+        if( blob_eq(&xfer.aToken[1], "iblt-request") && xfer.nToken==3
+         && nCycle==0
+        ){
+          blob_is_int(&xfer.aToken[2], &nIbltCell);
+          if( nIbltCell>IBLT_MAX_CELL ) nIbltCell = 0;
+        }
       }else
 
       /*   error MESSAGE
@@ -1723,6 +2996,11 @@ int client_sync(
       blobarray_reset(xfer.aToken, xfer.nToken);
       blob_reset(&xfer.line);
     }
+    if( xfer_flush_igot(pullFlag || cloneFlag) ) newPhantom = 1;
+    if( xfer_store_files(&xfer) && nErr==0 ){
+      fossil_warning("%b", &xfer.err);
+      nErr++;
+    }
     if( (configRcvMask & (CONFIGSET_USER|CONFIGSET_TKT))!=0
      && (configRcvMask & CONFIGSET_OLDFORMAT)!=0
     ){
@@ -1745,9 +3023,11 @@ int client_sync(
       go = 1;
       mxPhantomReq = nFileRecv*2;
       if( mxPhantomReq<200 ) mxPhantomReq = 200;
+      if( xfer.pipeline ) mxPhantomReq = PIPELINE_MAX_GIMME;
     }else if( cloneFlag && nFileRecv>0 ){
       go = 1;
     }
+    if( nIbltCell>0 ) go = 1;
     nCardRcvd = 0;
     xfer.nFileRcvd = 0;
     xfer.nDeltaRcvd = 0;
@@ -1769,6 +3049,47 @@ int client_sync(
     ** information which is only sent on the second round.
     */
     if( cloneSeqno<=0 && nCycle>1 ) go = 0;   
+
+    /* While children are fetching the clone, keep taking their replies
+    ** until all of them have finished.  On an error, stop them all.
+    */
+    if( nJob>0 ){
+      if( nErr ){
+        clone_jobs_abandon(aJob, nJob);
+        break;
+      }
+      go = 1;
+    }
+
+    /* Save the artifacts received so far, so that an interrupted clone
+    ** or pull does not have to fetch them again.  A clone also records
+    ** where to resume.  While children fetch parts of a clone in
+    ** parallel, replies arrive out of order and the resume point stays
+    ** where the children began.
+    */
+    if( go && nErr==0 && (cloneFlag || pullFlag) && nFileRecv>0 ){
+      if( cloneFlag ){
+        if( nJob==0 && cloneSeqno>0 ){
+          db_set_int("clone-resume", cloneSeqno, 0);
+        }
+        verify_cancel();
+        db_keep_on_failure(g.zRepositoryName);
+      }
+      manifest_crosslink_end();
+      db_checkpoint_transaction();
+      manifest_crosslink_begin();
+    }
+
+    /* Once the configuration has been received, divide the rest of a
+    ** clone among g.nCloneJob connections if the user asked for that.
+    */
+    if( go && cloneFlag && nCycle>1 && nJob==0 && cloneSeqno>0
+     && g.nCloneJob>1 && cloneMax>cloneSeqno
+    ){
+      int n = g.nCloneJob;
+      if( n>count(aJob) ) n = count(aJob);
+      nJob = clone_jobs_start(aJob, n, cloneSeqno, cloneMax, privateFlag);
+    }
   };
   transport_stats(&nSent, &nRcvd, 1);
   fossil_print("Total network traffic: %lld bytes sent, %lld bytes received\n",
@@ -1776,6 +3097,10 @@ int client_sync(
   transport_close();
   transport_global_shutdown();
   db_multi_exec("DROP TABLE onremote");
+  workpool_delete(xferIngest.pPool);
+  xferIngest.pPool = 0;
+  fossil_free(xferIngest.aFile);
+  xferIngest.aFile = 0;
   manifest_crosslink_end();
   content_enable_dephantomize(1);
   db_end_transaction(0);
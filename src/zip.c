@@ -40,6 +40,7 @@ static void put32(char *z, int v){
 ** Variables in which to accumulate a growing ZIP archive.
 */
 static Blob body;    /* The body of the ZIP archive */
+static int nDrained; /* Bytes of the body already taken by zip_drain() */
 static Blob toc;     /* The table of contents */
 static int nEntry;   /* Number of files */
 static int dosTime;  /* DOS-format time */
@@ -47,17 +48,100 @@ static int dosDate;  /* DOS-format date */
 static int unixTime; /* Seconds since 1970 */
 static int nDir;     /* Number of entries in azDir[] */
 static char **azDir; /* Directory names already added to the archive */
+static int zipLevel; /* zlib compression level */
 
 /*
-** Initialize a new ZIP archive.
+** Files added to the archive are compressed by a pool of worker threads
+** in batches of up to ZIP_BATCH_FILES files or ZIP_BATCH_CONTENT bytes
+** of content.  Once a batch is compressed, its entries are written to
+** the archive in the order in which they were added.
 */
-void zip_open(void){
+#define ZIP_BATCH_FILES    64
+#define ZIP_BATCH_CONTENT  16000000
+
+/*
+** One file waiting in the current batch.
+*/
+typedef struct ZipEntry ZipEntry;
+struct ZipEntry {
+  char *zName;         /* Name of the file within the archive */
+  int mPerm;           /* PERM_REG, PERM_EXE or PERM_LNK */
+  int level;           /* zlib compression level */
+  Blob content;        /* Uncompressed content.  Freed once compressed */
+  int nByte;           /* Size of the uncompressed content */
+  int iCRC;            /* CRC of the uncompressed content */
+  Blob out;            /* Compressed content */
+};
+static WorkPool *pZipPool;     /* Workers that compress the files */
+static ZipEntry *aPend;        /* Files in the current batch */
+static int nPend;              /* Number of entries in aPend[] */
+static int nPendContent;       /* Bytes of content in aPend[] */
+
+/*
+** Return the zlib compression level to use for ZIP archives and
+** tarballs of check-ins, from the "archive-compression-level" setting.
+*/
+int archive_level(void){
+  int level = db_get_int("archive-compression-level", 9);
+  if( level<0 ) level = 0;
+  if( level>9 ) level = 9;
+  return level;
+}
+
+/*
+** When not NULL, ZIP archives and tarballs that are built without an
+** output Blob are written to this file instead of the CGI reply.
+*/
+static FILE *archiveOut = 0;
+static int nArchiveOutErr = 0;   /* Failed writes to archiveOut */
+
+/*
+** Send ZIP archives and tarballs that are built without an output Blob
+** to file out, or to the CGI reply again if out is NULL.  Return the
+** number of failed writes to the previous file.
+*/
+int archive_output_to(FILE *out){
+  int nErr = nArchiveOutErr;
+  archiveOut = out;
+  nArchiveOutErr = 0;
+  return nErr;
+}
+
+/*
+** Pass pPart, the next part of an archive that is being built without
+** an output Blob, on to the CGI reply or to the file chosen by
+** archive_output_to().  pPart is left empty.
+*/
+void archive_output(Blob *pPart){
+  int n = blob_size(pPart);
+  if( archiveOut ){
+    if( n>0 && fwrite(blob_buffer(pPart), 1, n, archiveOut)!=n ){
+      nArchiveOutErr++;
+    }
+  }else{
+    cgi_append_content(blob_buffer(pPart), n);
+    cgi_flush_content();
+  }
+  blob_reset(pPart);
+}
+
+/*
+** Initialize a new ZIP archive whose files are compressed at the given
+** zlib compression level.
+*/
+void zip_open(int level){
   blob_zero(&body);
   blob_zero(&toc);
+  nDrained = 0;
   nEntry = 0;
   dosTime = 0;
   dosDate = 0;
   unixTime = 0;
+  zipLevel = level;
+  pZipPool = workpool_new(workpool_size(0));
+  aPend = fossil_malloc(sizeof(aPend[0])*ZIP_BATCH_FILES);
+  nPend = 0;
+  nPendContent = 0;
 }
 
 /*
@@ -114,34 +198,53 @@ void zip_add_folders(char *zName){
 }
 
 /*
-** Append a single file to a growing ZIP archive.
-**
-** pFile is the file to be appended.  zName is the name
-** that the file should be saved as.
+** Worker-thread routine that compresses the content of a ZipEntry.
 */
-void zip_add_file(const char *zName, const Blob *pFile, int mPerm){
+static void zip_deflate_task(void *pArg){
+  ZipEntry *p = (ZipEntry*)pArg;
   z_stream stream;
+  int nOut;
+
+  p->nByte = blob_size(&p->content);
+  p->iCRC = 0;
+  blob_zero(&p->out);
+  if( p->nByte==0 ) return;
+  p->iCRC = crc32(0, (unsigned char*)blob_buffer(&p->content), p->nByte);
+  memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, p->level, Z_DEFLATED, -MAX_WBITS, 8,
+               Z_DEFAULT_STRATEGY);
+  nOut = deflateBound(&stream, p->nByte);
+  blob_resize(&p->out, nOut);
+  stream.avail_in = p->nByte;
+  stream.next_in = (unsigned char*)blob_buffer(&p->content);
+  stream.avail_out = nOut;
+  stream.next_out = (unsigned char*)blob_buffer(&p->out);
+  deflate(&stream, Z_FINISH);
+  blob_resize(&p->out, stream.total_out);
+  deflateEnd(&stream);
+  blob_reset(&p->content);
+}
+
+/*
+** Write the header, the compressed content and the table of contents
+** entry for a file whose content has been compressed.
+*/
+static void zip_write_entry(ZipEntry *p){
+  const char *zName = p->zName;
   int nameLen;
-  int toOut = 0;
   int iStart;
-  int iCRC = 0;
-  int nByte = 0;
-  int nByteCompr = 0;
-  int nBlob;                 /* Size of the blob */
+  int nByteCompr = blob_size(&p->out);
   int iMethod;               /* Compression method. */
   int iMode = 0644;          /* Access permissions */
-  char *z;
   char zHdr[30];
   char zExTime[13];
   char zBuf[100];
-  char zOutBuf[100000];
 
-  /* Fill in as much of the header as we know.
+  /* Fill in the header.
   */
-  nBlob = pFile ? blob_size(pFile) : 0;
-  if( nBlob>0 ){
+  if( p->nByte>0 ){
     iMethod = 8;
-    switch( mPerm ){
+    switch( p->mPerm ){
       case PERM_LNK:   iMode = 0120755;   break;
       case PERM_EXE:   iMode = 0100755;   break;
       default:         iMode = 0100644;   break;
@@ -158,6 +261,9 @@ void zip_add_file(const char *zName, const Blob *pFile, int mPerm){
   put16(&zHdr[8], iMethod);
   put16(&zHdr[10], dosTime);
   put16(&zHdr[12], dosDate);
+  put32(&zHdr[14], p->iCRC);
+  put32(&zHdr[18], nByteCompr);
+  put32(&zHdr[22], p->nByte);
   put16(&zHdr[26], nameLen);
   put16(&zHdr[28], 13);
   
@@ -168,50 +274,13 @@ void zip_add_file(const char *zName, const Blob *pFile, int mPerm){
   put32(&zExTime[9], unixTime);
   
 
-  /* Write the header and filename.
+  /* Write the header, filename and compressed file.
   */
-  iStart = blob_size(&body);
+  iStart = nDrained + blob_size(&body);
   blob_append(&body, zHdr, 30);
   blob_append(&body, zName, nameLen);
   blob_append(&body, zExTime, 13);
-
-  if( nBlob>0 ){
-    /* Write the compressed file.  Compute the CRC as we progress.
-    */
-    stream.zalloc = (alloc_func)0;
-    stream.zfree = (free_func)0;
-    stream.opaque = 0;
-    stream.avail_in = blob_size(pFile);
-    stream.next_in = (unsigned char*)blob_buffer(pFile);
-    stream.avail_out = sizeof(zOutBuf);
-    stream.next_out = (unsigned char*)zOutBuf;
-    deflateInit2(&stream, 9, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
-    iCRC = crc32(0, stream.next_in, stream.avail_in);
-    while( stream.avail_in>0 ){
-      deflate(&stream, 0);
-      toOut = sizeof(zOutBuf) - stream.avail_out;
-      blob_append(&body, zOutBuf, toOut);
-      stream.avail_out = sizeof(zOutBuf);
-      stream.next_out = (unsigned char*)zOutBuf;
-    }
-    do{
-      stream.avail_out = sizeof(zOutBuf);
-      stream.next_out = (unsigned char*)zOutBuf;
-      deflate(&stream, Z_FINISH);
-      toOut = sizeof(zOutBuf) - stream.avail_out;
-      blob_append(&body, zOutBuf, toOut);
-    }while( stream.avail_out==0 );
-    nByte = stream.total_in;
-    nByteCompr = stream.total_out;
-    deflateEnd(&stream);
-  
-    /* Go back and write the header, now that we know the compressed file size.
-    */
-    z = &blob_buffer(&body)[iStart];
-    put32(&z[14], iCRC);
-    put32(&z[18], nByteCompr);
-    put32(&z[22], nByte);
-  }
+  blob_append(&body, blob_buffer(&p->out), nByteCompr);
   
   /* Make an entry in the tables of contents
   */
@@ -223,9 +292,9 @@ void zip_add_file(const char *zName, const Blob *pFile, int mPerm){
   put16(&zBuf[10], iMethod);
   put16(&zBuf[12], dosTime);
   put16(&zBuf[14], dosDate);
-  put32(&zBuf[16], iCRC);
+  put32(&zBuf[16], p->iCRC);
   put32(&zBuf[20], nByteCompr);
-  put32(&zBuf[24], nByte);
+  put32(&zBuf[24], p->nByte);
   put16(&zBuf[28], nameLen);
   put16(&zBuf[30], 9);
   put16(&zBuf[32], 0);
@@ -240,9 +309,72 @@ void zip_add_file(const char *zName, const Blob *pFile, int mPerm){
   nEntry++;
 }
 
+/*
+** Wait for the files of the current batch to be compressed, then
+** write them to the archive.
+*/
+static void zip_flush_batch(void){
+  int i;
+  workpool_wait(pZipPool);
+  for(i=0; i<nPend; i++){
+    zip_write_entry(&aPend[i]);
+    blob_reset(&aPend[i].out);
+    fossil_free(aPend[i].zName);
+  }
+  nPend = 0;
+  nPendContent = 0;
+}
+
+/*
+** Add a file named zName to the archive, taking ownership of the
+** content in pContent, which is left empty.
+*/
+static void zip_add_entry(const char *zName, Blob *pContent, int mPerm){
+  ZipEntry *p;
+  if( nPend>=ZIP_BATCH_FILES || nPendContent>=ZIP_BATCH_CONTENT ){
+    zip_flush_batch();
+  }
+  p = &aPend[nPend++];
+  p->zName = fossil_strdup(zName);
+  p->mPerm = mPerm;
+  p->level = zipLevel;
+  p->content = *pContent;
+  blob_zero(pContent);
+  nPendContent += blob_size(&p->content);
+  workpool_add(pZipPool, zip_deflate_task, p);
+}
 
 /*
-** Write the ZIP archive into the given BLOB.
+** Append a single file to a growing ZIP archive.
+**
+** pFile is the file to be appended.  zName is the name
+** that the file should be saved as.
+*/
+void zip_add_file(const char *zName, const Blob *pFile, int mPerm){
+  Blob content;
+  blob_zero(&content);
+  if( pFile ){
+    blob_append(&content, blob_buffer(pFile), blob_size(pFile));
+  }
+  zip_add_entry(zName, &content, mPerm);
+}
+
+
+/*
+** Append the part of the ZIP archive generated so far to pOut and
+** discard it from the archive under construction.  Only the table of
+** contents is kept until zip_close(), which then writes the rest of
+** the archive.
+*/
+void zip_drain(Blob *pOut){
+  blob_append(pOut, blob_buffer(&body), blob_size(&body));
+  nDrained += blob_size(&body);
+  blob_reset(&body);
+}
+
+/*
+** Write the ZIP archive into the given BLOB.  If zip_drain() has been
+** used, only the remainder of the archive is written.
 */
 void zip_close(Blob *pZip){
   int iTocStart;
@@ -250,9 +382,14 @@ void zip_close(Blob *pZip){
   int i;
   char zBuf[30];
 
-  iTocStart = blob_size(&body);
+  zip_flush_batch();
+  workpool_delete(pZipPool);
+  pZipPool = 0;
+  fossil_free(aPend);
+  aPend = 0;
+  iTocStart = nDrained + blob_size(&body);
   blob_append(&body, blob_buffer(&toc), blob_size(&toc));
-  iTocEnd = blob_size(&body);
+  iTocEnd = nDrained + blob_size(&body);
 
   memset(zBuf, 0, sizeof(zBuf));
   put32(&zBuf[0], 0x06054b50);
@@ -289,7 +426,7 @@ void filezip_cmd(void){
   if( g.argc<3 ){
     usage("ARCHIVE FILE....");
   }
-  zip_open();
+  zip_open(9);
   for(i=3; i<g.argc; i++){
     blob_zero(&file);
     blob_read_from_file(&file, g.argv[i]);
@@ -311,6 +448,12 @@ void filezip_cmd(void){
 ** If the RID object does not exist in the repository, then
 ** pZip is zeroed.
 **
+** If pZip is NULL, the ZIP archive becomes the content of the CGI reply
+** and is sent to the client file by file as it is generated, so that
+** the whole archive never has to be held in memory.  The caller should
+** set the content type and call cgi_allow_incremental_reply() first.
+** The archive goes to a file instead if archive_output_to() chose one.
+**
 ** zDir is a "synthetic" subdirectory which all zipped files get
 ** added to as part of the zip file. It may be 0 or an empty string,
 ** in which case it is ignored. The intention is to create a zip which
@@ -327,12 +470,12 @@ void zip_of_baseline(int rid, Blob *pZip, const char *zDir){
   
   content_get(rid, &mfile);
   if( blob_size(&mfile)==0 ){
-    blob_zero(pZip);
+    if( pZip ) blob_zero(pZip);
     return;
   }
   blob_zero(&hash);
   blob_zero(&filename);
-  zip_open();
+  zip_open(archive_level());
 
   if( zDir && zDir[0] ){
     blob_appendf(&filename, "%s/", zDir);
@@ -366,8 +509,13 @@ void zip_of_baseline(int rid, Blob *pZip, const char *zDir){
         blob_append(&filename, pFile->zName, -1);
         zName = blob_str(&filename);
         zip_add_folders(zName);
-        zip_add_file(zName, &file, manifest_file_mperm(pFile));
-        blob_reset(&file);
+        zip_add_entry(zName, &file, manifest_file_mperm(pFile));
+        if( pZip==0 ){
+          Blob part;
+          blob_zero(&part);
+          zip_drain(&part);
+          archive_output(&part);
+        }
       }
     }
   }else{
@@ -375,7 +523,13 @@ void zip_of_baseline(int rid, Blob *pZip, const char *zDir){
   }
   manifest_destroy(pManifest);
   blob_reset(&filename);
-  zip_close(pZip);
+  if( pZip ){
+    zip_close(pZip);
+  }else{
+    Blob tail;
+    zip_close(&tail);
+    archive_output(&tail);
+  }
 }
 
 /*
@@ -425,7 +579,6 @@ void baseline_zip_page(void){
   int rid;
   char *zName, *zRid;
   int nName, nRid;
-  Blob zip;
 
   login_check_credentials();
   if( !g.perm.Zip ){ login_needed(); return; }
@@ -445,9 +598,11 @@ void baseline_zip_page(void){
     return;
   }
   if( nRid==0 && nName>10 ) zName[10] = 0;
-  zip_of_baseline(rid, &zip, zName);
+  cgi_set_content_type("application/zip");
+  if( !archive_cache_reply(rid, "zip", zName, zip_of_baseline) ){
+    cgi_allow_incremental_reply();
+    zip_of_baseline(rid, 0, zName);
+  }
   free( zName );
   free( zRid );
-  cgi_set_content(&zip);
-  cgi_set_content_type("application/zip");
 }
@@ -0,0 +1,231 @@
+#
+# Copyright (c) 2012 D. Richard Hipp
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the Simplified BSD License (also
+# known as the "2-Clause License" or "FreeBSD License".)
+#
+# This program is distributed in the hope that it will be useful,
+# but without any warranty; without even the implied warranty of
+# merchantability or fitness for a particular purpose.
+#
+# Author contact information:
+#   drh@hwaci.com
+#   http://www.hwaci.com/drh/
+#
+############################################################################
+#
+# This is the benchmark script.  It builds a synthetic repository in
+# a temporary directory, then times the hot code paths against it:
+#
+#     tclsh ../test/bench.tcl ../bld/fossil ?OPTIONS?
+#
+# Options:
+#
+#     -files N          Number of files in the repository.  Default 200
+#     -checkins N       Number of check-ins after the first.  Default 50
+#     -size N           Average bytes per file.  Default 4000
+#     -iterations N     Repetitions of each benchmark.  Default 5
+#     -port N           TCP port for the loopback server.  Default 8197
+#     -synth            Make the repository with "fossil test-synth-repo"
+#                       rather than by a sequence of commits
+#     -keep             Do not delete the temporary directory
+#
+# Results go to standard output, one per line, as JSON objects in the
+# same format as the "fossil test-bench" command, which supplies most
+# of them.  This script adds the time to build the repository, to clone
+# it over loopback and to generate some common web pages.  The same
+# options always build the same repository, so the results of two
+# builds of fossil can be compared line by line.
+#
+
+set fossilexe [file normalize [lindex $argv 0]]
+set argv [lrange $argv 1 end]
+array set opt {-files 200 -checkins 50 -size 4000 -iterations 5
+               -port 8197 -synth 0 -keep 0}
+while {[llength $argv]>0} {
+  set a [lindex $argv 0]
+  if {$a=="-keep" || $a=="-synth"} {
+    set opt($a) 1
+    set argv [lrange $argv 1 end]
+  } elseif {[info exists opt($a)] && [llength $argv]>=2} {
+    set opt($a) [lindex $argv 1]
+    set argv [lrange $argv 2 end]
+  } else {
+    puts stderr "unknown option: $a"
+    exit 1
+  }
+}
+
+# Run the fossil program and return its output.
+#
+proc fossil {args} {
+  global fossilexe
+  return [eval exec [list $fossilexe] $args]
+}
+
+# Print one result.
+#
+proc result {name n items usec bytes} {
+  puts [format \
+     {{"bench":"%s","iterations":%d,"items":%d,"usec":%s,"usec_per_op":%.1f,"bytes":%s}} \
+     $name $n $items $usec [expr {double($usec)/$n}] $bytes]
+  flush stdout
+}
+
+# Return a line of text that looks like C source code.
+#
+set words {int return if else for while Blob zName rid db_step(&q) (void)
+           \{ \} 0; struct char *p = + i++ static const n x}
+proc rand_line {} {
+  global words
+  set n [expr {int(rand()*12)+1}]
+  set out [string repeat "  " [expr {int(rand()*4)}]]
+  for {set i 0} {$i<$n} {incr i} {
+    if {$i} {append out " "}
+    append out [lindex $words [expr {int(rand()*[llength $words])}]]
+  }
+  return $out
+}
+
+# Write a file of about N bytes of synthetic text.
+#
+proc write_text {filename N} {
+  set out [open $filename w]
+  fconfigure $out -translation binary
+  set n 0
+  while {$n<$N} {
+    set line [rand_line]
+    puts $out $line
+    incr n [expr {[string length $line]+1}]
+  }
+  close $out
+}
+
+# Replace about one line in fifty of a file with new text.  If the
+# always argument is true, also add a line at the end, so that the
+# file is certain to change.
+#
+proc edit_text {filename {always 0}} {
+  set in [open $filename r]
+  set lines [split [read $in] \n]
+  close $in
+  set out [open $filename w]
+  fconfigure $out -translation binary
+  foreach line [lrange $lines 0 end-1] {
+    if {rand()<0.02} {set line [rand_line]}
+    puts $out $line
+  }
+  if {$always} {puts $out [rand_line]}
+  close $out
+}
+
+expr {srand(1)}
+set dir [file normalize bench-[pid]]
+file delete -force $dir
+file mkdir $dir/home $dir/ckout
+set env(HOME) $dir/home
+cd $dir/ckout
+set repo $dir/repo.fossil
+
+# Build the repository.  Each check-in edits about one file in twenty.
+#
+set t0 [clock microseconds]
+if {$opt(-synth)} {
+  fossil test-synth-repo $repo --files $opt(-files) \
+      --commits [expr {$opt(-checkins)+1}] --size $opt(-size) --churn 5
+  fossil open $repo
+  result synth-repo [expr {$opt(-checkins)+1}] $opt(-files) \
+      [expr {[clock microseconds]-$t0}] [file size $repo]
+} else {
+  fossil new --admin-user bench $repo
+  fossil open $repo
+  set files {}
+  for {set i 0} {$i<$opt(-files)} {incr i} {
+    set f dir[expr {$i/50}]/file$i.c
+    file mkdir [file dirname $f]
+    write_text $f [expr {int($opt(-size)*(0.5+rand()))}]
+    lappend files $f
+  }
+  fossil add .
+  fossil commit -m "initial check-in" --nosign
+  for {set c 1} {$c<=$opt(-checkins)} {incr c} {
+    foreach f $files {
+      if {rand()<0.05} {edit_text $f}
+    }
+    edit_text [lindex $files [expr {$c%[llength $files]}]] 1
+    fossil commit -m "check-in $c" --nosign
+  }
+  result build-repo [expr {$opt(-checkins)+1}] $opt(-files) \
+      [expr {[clock microseconds]-$t0}] [file size $repo]
+}
+
+# The in-process benchmarks
+#
+puts [fossil test-bench -n $opt(-iterations)]
+flush stdout
+
+# Start a server on the loopback interface and wait for it to answer.
+#
+set pid [exec $fossilexe server --port $opt(-port) --localauth $repo &]
+for {set i 0} {$i<100} {incr i} {
+  if {![catch {socket 127.0.0.1 $opt(-port)} s]} {
+    close $s
+    break
+  }
+  after 50
+}
+set url http://127.0.0.1:$opt(-port)
+
+# Clone over loopback.
+#
+set t 0
+for {set i 0} {$i<$opt(-iterations)} {incr i} {
+  file delete -force $dir/clone.fossil
+  set t0 [clock microseconds]
+  fossil clone $url $dir/clone.fossil
+  incr t [expr {[clock microseconds]-$t0}]
+}
+result clone $opt(-iterations) $opt(-files) $t [file size $repo]
+
+# Common web pages.  The server grants localhost requests all
+# permissions, so the pages are generated in full.  The diff is from
+# the first check-in with files, and the file pages use a file changed
+# by the last check-in.
+#
+package require http
+set first [exec $fossilexe sqlite3 << {
+  SELECT uuid FROM blob WHERE rid=(SELECT objid FROM event
+   WHERE type='ci' AND objid IN (SELECT mid FROM mlink)
+   ORDER BY mtime LIMIT 1);
+}]
+set hot [exec $fossilexe sqlite3 << {
+  SELECT name FROM filename WHERE fnid=(SELECT fnid FROM mlink
+   WHERE mid=(SELECT objid FROM event WHERE type='ci'
+               ORDER BY mtime DESC LIMIT 1) LIMIT 1);
+}]
+foreach {name page} [list \
+    page-timeline  /timeline \
+    page-dir       /dir?ci=tip \
+    page-tree      /tree?ci=tip \
+    page-info      /info/tip \
+    page-vdiff     /vdiff?from=$first&to=tip \
+    page-finfo     /finfo?name=$hot \
+    page-annotate  /annotate?checkin=tip&filename=$hot \
+    page-zip       /zip/tip \
+] {
+  set t 0
+  set nByte 0
+  for {set i 0} {$i<$opt(-iterations)} {incr i} {
+    set t0 [clock microseconds]
+    set tok [http::geturl $url$page -binary 1]
+    incr t [expr {[clock microseconds]-$t0}]
+    set nByte [string length [http::data $tok]]
+    http::cleanup $tok
+  }
+  result $name $opt(-iterations) 1 $t $nByte
+}
+
+catch {exec kill $pid}
+cd [file dirname $dir]
+if {!$opt(-keep)} {file delete -force $dir}